@@ -6,9 +6,12 @@
 #include "funcapi.h"
 #include "catalog/pg_type.h"
 #include "utils/builtins.h"
+#include "utils/array.h"
+#include "utils/lsyscache.h"
 
 #include "parseaddress-api.h"
 #include <string.h>
+#include <stdlib.h>
 
 #undef DEBUG
 //#define DEBUG 1
@@ -21,46 +24,27 @@
 #endif
 
 Datum parse_address(PG_FUNCTION_ARGS);
+Datum parse_address_array(PG_FUNCTION_ARGS);
 
-PG_FUNCTION_INFO_V1(parse_address);
+/* State names hash, built once per thread and kept for its life */
+static THR_LOCAL HHash *StateHash = NULL;
 
-Datum parse_address(PG_FUNCTION_ARGS)
+static HHash *get_state_hash(void)
 {
-    TupleDesc            tupdesc;
-    AttInMetadata       *attinmeta;
-    Datum                result;
-    ADDRESS             *paddr;
-    HHash               *stH;
-    char                *str;
-    char               **values;
-    int                  err;
-    HeapTuple            tuple;
-
-
-    DBG("Start standardize_address");
-
-    str = text_to_cstring(PG_GETARG_TEXT_P(0));
-
-    DBG("str='%s'", str);
-
-    if (get_call_result_type( fcinfo, NULL, &tupdesc ) != TYPEFUNC_COMPOSITE ) {
-        elog(ERROR, "function returning record called in context"
-            " that cannot accept type record");
-        return -1;
-    }
-    BlessTupleDesc(tupdesc);
-    attinmeta = TupleDescGetAttInMetadata(tupdesc);
+    HHash *stH;
+    int err;
 
-    DBG("Got tupdesc, allocating HHash");
+    if (StateHash)
+        return StateHash;
 
-    stH = (HHash *) palloc0(sizeof(HHash));
+    DBG("allocating HHash");
+    stH = (HHash *) calloc(1, sizeof(HHash));
     if (!stH) {
-         elog(ERROR, "parse_address: Failed to allocate memory for hash!");
-         return -1;
+        elog(ERROR, "parse_address: Failed to allocate memory for hash!");
+        return NULL;
     }
 
     DBG("going to load_state_hash");
-
     err = load_state_hash(stH);
     if (err) {
         DBG("got err=%d from load_state_hash().", err);
@@ -68,23 +52,29 @@ Datum parse_address(PG_FUNCTION_ARGS)
         DBG("calling hdestroy_r(stH).");
         hdestroy_r(stH);
 #endif
+        free(stH);
         elog(ERROR, "parse_address: load_state_hash() failed(%d)!", err);
-        return -1;
+        return NULL;
     }
 
+    StateHash = stH;
+    return StateHash;
+}
+
+/* Parses str, which is modified, into a tuple of the parse_address columns */
+static HeapTuple parse_address_tuple(AttInMetadata *attinmeta, HHash *stH, char *str)
+{
+    ADDRESS *paddr;
+    char *values[9];
+    int err;
+
     DBG("calling parseaddress()");
     paddr = parseaddress(stH, str, &err);
     if (!paddr) {
         elog(ERROR, "parse_address: parseaddress() failed!");
-        return -1;
+        return NULL;
     }
 
-    DBG("setup values array for natts=%d", tupdesc->natts);
-    values = (char **) palloc(9 * sizeof(char *));
-    if (!values) {
-        elog(ERROR, "parse_address: out of memory!");
-        return -1;
-    }
     values[0] = paddr->num;
     values[1] = paddr->street;
     values[2] = paddr->street2;
@@ -96,17 +86,108 @@ Datum parse_address(PG_FUNCTION_ARGS)
     values[8] = paddr->cc;
 
     DBG("calling heap_form_tuple");
-    tuple = BuildTupleFromCStrings(attinmeta, values);
+    return BuildTupleFromCStrings(attinmeta, values);
+}
 
-    /* make the tuple into a datum */
-    DBG("calling HeapTupleGetDatum");
-    result = HeapTupleGetDatum(tuple);
+PG_FUNCTION_INFO_V1(parse_address);
 
-    /* clean up (this is not really necessary */
-    DBG("freeing values, hash, and paddr");
-    free_state_hash(stH);
+Datum parse_address(PG_FUNCTION_ARGS)
+{
+    TupleDesc            tupdesc;
+    AttInMetadata       *attinmeta;
+    HHash               *stH;
+    char                *str;
+    HeapTuple            tuple;
 
+
+    DBG("Start standardize_address");
+
+    str = text_to_cstring(PG_GETARG_TEXT_P(0));
+
+    DBG("str='%s'", str);
+
+    if (get_call_result_type( fcinfo, NULL, &tupdesc ) != TYPEFUNC_COMPOSITE ) {
+        elog(ERROR, "function returning record called in context"
+            " that cannot accept type record");
+        return -1;
+    }
+    BlessTupleDesc(tupdesc);
+    attinmeta = TupleDescGetAttInMetadata(tupdesc);
+
+    stH = get_state_hash();
+    tuple = parse_address_tuple(attinmeta, stH, str);
+
+    /* make the tuple into a datum */
     DBG("returning parsed address result");
-    return result;
+    return HeapTupleGetDatum(tuple);
 }
 
+typedef struct parse_address_array_state {
+    Datum *elems;
+    bool *nulls;
+    int nelems;
+    int next;
+    AttInMetadata *attinmeta;
+} PARSE_ADDRESS_ARRAY_STATE;
+
+/*
+ * Batch form of parse_address, returning one row per array element in
+ * array order, all null for null elements.
+ */
+PG_FUNCTION_INFO_V1(parse_address_array);
+
+Datum parse_address_array(PG_FUNCTION_ARGS)
+{
+    FuncCallContext            *funcctx;
+    PARSE_ADDRESS_ARRAY_STATE  *state;
+    HeapTuple                   tuple;
+
+    if (SRF_IS_FIRSTCALL()) {
+        MemoryContext   oldcontext;
+        ArrayType      *array;
+        TupleDesc       tupdesc;
+        int16           elmlen;
+        bool            elmbyval;
+        char            elmalign;
+
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        if (get_call_result_type( fcinfo, NULL, &tupdesc ) != TYPEFUNC_COMPOSITE ) {
+            elog(ERROR, "function returning record called in context"
+                " that cannot accept type record");
+            return -1;
+        }
+        BlessTupleDesc(tupdesc);
+
+        state = (PARSE_ADDRESS_ARRAY_STATE *) palloc0(sizeof(PARSE_ADDRESS_ARRAY_STATE));
+        state->attinmeta = TupleDescGetAttInMetadata(tupdesc);
+
+        array = PG_GETARG_ARRAYTYPE_P(0);
+        get_typlenbyvalalign(ARR_ELEMTYPE(array), &elmlen, &elmbyval, &elmalign);
+        deconstruct_array(array, ARR_ELEMTYPE(array), elmlen, elmbyval, elmalign,
+            &state->elems, &state->nulls, &state->nelems);
+
+        funcctx->user_fctx = state;
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    state = (PARSE_ADDRESS_ARRAY_STATE *) funcctx->user_fctx;
+
+    if (state->next >= state->nelems)
+        SRF_RETURN_DONE(funcctx);
+
+    if (state->nulls[state->next]) {
+        char *values[9] = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+        tuple = BuildTupleFromCStrings(state->attinmeta, values);
+    }
+    else {
+        char *str = TextDatumGetCString(state->elems[state->next]);
+        DBG("str='%s'", str);
+        tuple = parse_address_tuple(state->attinmeta, get_state_hash(), str);
+    }
+    state->next++;
+
+    SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+}
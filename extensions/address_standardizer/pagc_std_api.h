@@ -62,6 +62,8 @@ int std_use_gaz(STANDARDIZER *std, LEXICON *gaz);
 int std_use_rules(STANDARDIZER *std, RULES *rules);
 int std_ready_standardizer(STANDARDIZER *std);
 void std_free(STANDARDIZER *std);
+STANDARDIZER *std_attach(STANDARDIZER *shared);
+void std_detach(STANDARDIZER *std);
 
 STDADDR *std_standardize_one(STANDARDIZER *std, char *address_one_line, int options);
 
@@ -20,6 +20,8 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #if PCRE_VERSION <= 1
 # include <pcre.h>
@@ -96,19 +98,130 @@ void strtoupper(char *s)
         s[i] = toupper(s[i]);
 }
 
+/*
+ * Compiled patterns are cached for the life of the process, keyed by the
+ * address of the pattern, so match() must only be given patterns with
+ * static storage, as all the patterns in this file are. Compiled code is
+ * read only once published and is shared by all threads, each thread
+ * keeping its own match data.
+ */
+#define REGEX_CACHE_SIZE 512
+
+typedef struct regex_cache_entry {
+    const char *pattern;
+    int options;
 #if PCRE_VERSION <= 1
-int match(char *pattern, char *s, int *ovect, int options)
+    pcre *re;
+    pcre_extra *extra;
+#else
+    pcre2_code *re;
+#endif
+} REGEX_CACHE_ENTRY;
+
+static REGEX_CACHE_ENTRY regex_cache[REGEX_CACHE_SIZE];
+static pthread_mutex_t regex_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t regex_cache_slot(const char *pattern, int options)
+{
+    uint64_t h = ((uint64_t)(uintptr_t)pattern ^ (uint64_t)options) * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h >> 32) % REGEX_CACHE_SIZE;
+}
+
+/* Returns the published entry of pattern, or NULL at the first free slot */
+static REGEX_CACHE_ENTRY *regex_cache_find(const char *pattern, int options, size_t *free_slot)
+{
+    size_t slot = regex_cache_slot(pattern, options);
+    size_t i;
+
+    for (i = 0; i < REGEX_CACHE_SIZE; i++) {
+        REGEX_CACHE_ENTRY *entry = &regex_cache[(slot + i) % REGEX_CACHE_SIZE];
+        const char *key = __atomic_load_n(&entry->pattern, __ATOMIC_ACQUIRE);
+        if (!key) {
+            *free_slot = (slot + i) % REGEX_CACHE_SIZE;
+            return NULL;
+        }
+        if (key == pattern && entry->options == options)
+            return entry;
+    }
+    *free_slot = REGEX_CACHE_SIZE;
+    return NULL;
+}
+
+#if PCRE_VERSION <= 1
+/* Compiles pattern into entry, returns 0 on a bad pattern */
+static int regex_compile(REGEX_CACHE_ENTRY *entry, const char *pattern, int options)
 {
     const char *error;
     int erroffset;
-    pcre *re;
+
+    entry->re = pcre_compile(pattern, options, &error, &erroffset, NULL);
+    if (!entry->re) return 0;
+#ifdef PCRE_STUDY_JIT_COMPILE
+    entry->extra = pcre_study(entry->re, PCRE_STUDY_JIT_COMPILE, &error);
+#else
+    entry->extra = pcre_study(entry->re, 0, &error);
+#endif
+    return 1;
+}
+#else
+static int regex_compile(REGEX_CACHE_ENTRY *entry, const char *pattern, int options)
+{
+    int errorcode;
+    PCRE2_SIZE erroffset;
+
+    entry->re = pcre2_compile((PCRE2_SPTR8)pattern, PCRE2_ZERO_TERMINATED, options, &errorcode, &erroffset, NULL);
+    if (!entry->re) return 0;
+    /* Without JIT support pcre2_match just interprets the pattern */
+    pcre2_jit_compile(entry->re, PCRE2_JIT_COMPLETE);
+    return 1;
+}
+#endif
+
+static REGEX_CACHE_ENTRY *regex_cache_get(const char *pattern, int options, REGEX_CACHE_ENTRY *uncached)
+{
+    REGEX_CACHE_ENTRY *entry;
+    size_t free_slot;
+
+    entry = regex_cache_find(pattern, options, &free_slot);
+    if (entry) return entry;
+
+    pthread_mutex_lock(&regex_cache_lock);
+    entry = regex_cache_find(pattern, options, &free_slot);
+    if (!entry) {
+        if (free_slot < REGEX_CACHE_SIZE) {
+            entry = &regex_cache[free_slot];
+            entry->options = options;
+            if (regex_compile(entry, pattern, options))
+                __atomic_store_n(&entry->pattern, pattern, __ATOMIC_RELEASE);
+            else
+                entry = NULL;
+        }
+        else {
+            /* Cache full, compile for this call only */
+            memset(uncached, 0, sizeof(*uncached));
+            entry = regex_compile(uncached, pattern, options) ? uncached : NULL;
+        }
+    }
+    pthread_mutex_unlock(&regex_cache_lock);
+    return entry;
+}
+
+#if PCRE_VERSION <= 1
+int match(char *pattern, char *s, int *ovect, int options)
+{
+    REGEX_CACHE_ENTRY uncached;
+    REGEX_CACHE_ENTRY *entry;
     int rc;
 
-    re = pcre_compile(pattern, options, &error, &erroffset, NULL);
-    if (!re) return -99;
+    entry = regex_cache_get(pattern, options, &uncached);
+    if (!entry) return -99;
 
-    rc = pcre_exec(re, NULL, s, strlen(s), 0, 0, ovect, OVECCOUNT);
-    free(re);
+    rc = pcre_exec(entry->re, entry->extra, s, strlen(s), 0, 0, ovect, OVECCOUNT);
+
+    if (entry == &uncached) {
+        if (uncached.extra) pcre_free_study(uncached.extra);
+        pcre_free(uncached.re);
+    }
 
     if (rc < 0) return rc;
     else if (rc == 0) rc = OVECPAIRS; // more matches than ovect can hold
@@ -116,43 +229,47 @@ int match(char *pattern, char *s, int *ovect, int options)
     return rc;
 }
 #else
+/* Match data of the calling thread, reused by every match */
+static THR_LOCAL pcre2_match_data *thread_match_data = NULL;
+
 int match(char *pattern, char *s, int *ovect, int options)
 {
-    int errorcode;
-    PCRE2_SIZE erroffset;
-    pcre2_code *re;
+    REGEX_CACHE_ENTRY uncached;
+    REGEX_CACHE_ENTRY *entry;
     int rc;
-    pcre2_match_data *match_data;
     PCRE2_SIZE *ovect2;
     int i;
 
-    re = pcre2_compile((PCRE2_SPTR8)pattern, PCRE2_ZERO_TERMINATED, options, &errorcode, &erroffset, NULL);
-    if (!re) return -99;
+    entry = regex_cache_get(pattern, options, &uncached);
+    if (!entry) return -99;
 
-    match_data = pcre2_match_data_create(OVECPAIRS, NULL);
+    if (!thread_match_data) {
+        thread_match_data = pcre2_match_data_create(OVECPAIRS, NULL);
+        if (!thread_match_data) return -99;
+    }
 
-    rc = pcre2_match(re, (PCRE2_SPTR8)s, strlen(s), 0, 0, match_data, NULL);
+    rc = pcre2_match(entry->re, (PCRE2_SPTR8)s, strlen(s), 0, 0, thread_match_data, NULL);
 
-    if (rc < 0) { // no match or error
-        pcre2_code_free(re);
-        pcre2_match_data_free(match_data);
+    /* The generated city patterns can outgrow the default JIT stack */
+    if (rc == PCRE2_ERROR_JIT_STACKLIMIT)
+        rc = pcre2_match(entry->re, (PCRE2_SPTR8)s, strlen(s), 0, PCRE2_NO_JIT, thread_match_data, NULL);
+
+    if (entry == &uncached)
+        pcre2_code_free(uncached.re);
+
+    if (rc < 0) // no match or error
         return rc;
-    }
 
     if (rc == 0) { // more matches than ovect can hold
         rc = OVECPAIRS;
     }
 
-    // copy the results out so we can free everything
-    // before returning
-    ovect2 = pcre2_get_ovector_pointer(match_data);
+    ovect2 = pcre2_get_ovector_pointer(thread_match_data);
     for (i = 0; i < rc; i++) {
         ovect[2*i] = ovect2[2*i];
         ovect[2*i + 1] = ovect2[2*i + 1];
     }
 
-    pcre2_code_free(re);
-    pcre2_match_data_free(match_data);
     return rc;
 }
 #endif
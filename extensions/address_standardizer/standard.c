@@ -393,6 +393,53 @@ void std_free(STANDARDIZER *std)
 }
 
 
+/*
+ * Returns a standardizer that uses the lexicons and rules of a readied
+ * standardizer without copying them, with its own errors and
+ * standardization context. The tables are only read while standardizing,
+ * so several attached standardizers can run at once on different threads.
+ * The shared standardizer must outlive the attached ones.
+ */
+STANDARDIZER *std_attach(STANDARDIZER *shared)
+{
+    STANDARDIZER *std;
+
+    std = (STANDARDIZER *) calloc(1,sizeof(STANDARDIZER)) ;
+    if ( std == NULL ) return NULL ;
+
+    std -> pagc_p = (PAGC_GLOBAL *) calloc(1,sizeof(PAGC_GLOBAL)) ;
+    if ( std -> pagc_p == NULL ) {
+        free( std ) ;
+        return NULL ;
+    }
+    *(std -> pagc_p) = *(shared -> pagc_p) ;
+
+    std -> pagc_p -> process_errors = init_errors(std -> pagc_p, NULL) ;
+    std -> err_p = std -> pagc_p -> process_errors ;
+
+    std -> misc_stand = init_stand_context(std -> pagc_p, std -> err_p, 1);
+    if ( std -> misc_stand == NULL ) {
+        std_detach( std ) ;
+        return NULL ;
+    }
+
+    return std;
+}
+
+
+/* Frees a standardizer made by std_attach, leaving the shared tables */
+void std_detach(STANDARDIZER *std)
+{
+    if ( std == NULL ) return;
+    close_stand_context( std -> misc_stand );
+    if ( std -> pagc_p != NULL ) {
+        close_errors( std -> pagc_p -> process_errors );
+        FREE_AND_NULL( std -> pagc_p ) ;
+    }
+    free( std );
+}
+
+
 void stdaddr_free(STDADDR *stdaddr)
 {
     if (!stdaddr) return;
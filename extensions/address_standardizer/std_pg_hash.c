@@ -23,6 +23,8 @@
 #include <sys/time.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
 
 #ifdef DEBUG
 #define SET_TIME(a) gettimeofday(&(a), NULL)
@@ -39,10 +41,52 @@
 
 #define STD_CACHE_ITEMS 4
 #define STD_BACKEND_HASH_SIZE 16
+#define STD_SHARED_CACHE_ITEMS 16
 
 static THR_LOCAL HTAB* StdHash = NULL;
 
 
+/*
+ * Compiled standardizers shared by all the sessions of the process, keyed
+ * by database and table names and versioned by a checksum of the table
+ * rows (see StdTablesVersion), so that edits to the tables are seen by the
+ * next query that fills a portal cache. Sessions only allocate their own
+ * standardization context, attached to the shared lexicons and rules with
+ * std_attach. Entries are allocated with malloc, and only changed under the
+ * lock.
+ */
+typedef struct
+{
+    Oid dbid;
+    char *lextab;
+    char *gaztab;
+    char *rultab;
+    uint64 version;
+    STANDARDIZER *std;
+    int refcount;
+    bool stale;
+    uint64 last_used;
+}
+StdSharedEntry;
+
+static StdSharedEntry StdSharedCache[STD_SHARED_CACHE_ITEMS];
+static pthread_mutex_t StdSharedCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static uint64 StdSharedClock = 0;
+
+/*
+ * References this session holds on each shared entry. They are released
+ * with the portal caches, and whatever is left when the session memory
+ * goes away (a portal that never got to clean up) is released then, so
+ * that entries do not stay pinned by sessions that are gone.
+ */
+static THR_LOCAL int StdSessionRefs[STD_SHARED_CACHE_ITEMS];
+static THR_LOCAL MemoryContext StdSessionContext = NULL;
+
+#ifndef CacheMemoryContext
+#define CacheMemoryContext (u_sess->cache_mem_cxt)
+#endif
+
+
 typedef struct
 {
     char *lextab;
@@ -65,6 +109,7 @@ typedef struct
 {
     MemoryContext context;
     STANDARDIZER *std;
+    StdSharedEntry *shared; /* NULL if std is private to the portal */
 }
 StdHashEntry;
 
@@ -86,7 +131,7 @@ typedef struct rules_columns
 /* Memory context hash table function prototypes */
 uint32 mcxt_ptr_hash_std(const void *key, Size keysize);
 static void CreateStdHash(void);
-static void AddStdHashEntry(MemoryContext mcxt, STANDARDIZER *std);
+static void AddStdHashEntry(MemoryContext mcxt, STANDARDIZER *std, StdSharedEntry *shared);
 static StdHashEntry *GetStdHashEntry(MemoryContext mcxt);
 static void DeleteStdHashEntry(MemoryContext mcxt);
 
@@ -100,6 +145,10 @@ static StdPortalCache *GetStdPortalCache(FunctionCallInfo fcinfo);
 /* standardizer api functions */
 
 static STANDARDIZER *CreateStd(char *lextab, char *gaztab, char *rultab);
+static uint64 StdTablesVersion(char *lextab, char *gaztab, char *rultab);
+static StdSharedEntry *AcquireSharedStd(char *lextab, char *gaztab, char *rultab, STANDARDIZER **private_std);
+static void ReleaseSharedStd(StdSharedEntry *entry);
+static void ReleaseSessionStds(void);
 static int parse_rule(char *buf, int *rule);
 static int fetch_lex_columns(SPITupleTable *tuptable, lex_columns_t *lex_cols);
 static int tableNameOk(char *t);
@@ -132,7 +181,12 @@ StdCacheDelete(void *ptr)
 
     DBG("deleting std object (%p) with MemoryContext key (%p)", she->std, context);
 
-    if (she->std)
+    if (she->shared) {
+        if (she->std)
+            std_detach(she->std);
+        ReleaseSharedStd(she->shared);
+    }
+    else if (she->std)
         std_free(she->std);
 
     DeleteStdHashEntry(context);
@@ -190,6 +244,64 @@ static MemoryContextMethods StdCacheContextMethods =
 #endif
 };
 
+#if POSTGIS_PGSQL_VERSION < 96
+static void
+StdSessionDelete(MemoryContext context)
+{
+    ReleaseSessionStds();
+}
+
+/* Memory context definition must match the current version of PostgreSQL */
+static MemoryContextMethods StdSessionContextMethods =
+{
+    NULL,
+    NULL,
+    NULL,
+    StdCacheInit,
+    StdCacheReset,
+    StdSessionDelete,
+    NULL,
+    StdCacheIsEmpty,
+    StdCacheStats
+#ifdef MEMORY_CONTEXT_CHECKING
+    , StdCacheCheck
+#endif
+};
+#else
+static void
+StdSessionDelete(void *ptr)
+{
+    ReleaseSessionStds();
+}
+#endif
+
+/* Hooks ReleaseSessionStds to the session memory, once per session */
+static void
+StdSessionInit(void)
+{
+    if (StdSessionContext)
+        return;
+
+#if POSTGIS_PGSQL_VERSION < 96
+    StdSessionContext = MemoryContextCreate(T_AllocSetContext, 8192,
+                                            &StdSessionContextMethods,
+                                            CacheMemoryContext,
+                                            "PAGC STD Session Context");
+#else
+    StdSessionContext = AllocSetContextCreate(CacheMemoryContext,
+                                              "PAGC STD Session Context",
+                                              ALLOCSET_SMALL_MINSIZE,
+                                              ALLOCSET_SMALL_INITSIZE,
+                                              ALLOCSET_SMALL_MAXSIZE);
+    {
+        MemoryContextCallback *callback = MemoryContextAlloc(StdSessionContext, sizeof(MemoryContextCallback));
+        callback->arg = NULL;
+        callback->func = StdSessionDelete;
+        MemoryContextRegisterResetCallback(StdSessionContext, callback);
+    }
+#endif
+}
+
 uint32
 mcxt_ptr_hash_std(const void *key, Size keysize)
 {
@@ -214,7 +326,7 @@ CreateStdHash(void)
 
 
 static void
-AddStdHashEntry(MemoryContext mcxt, STANDARDIZER *std)
+AddStdHashEntry(MemoryContext mcxt, STANDARDIZER *std, StdSharedEntry *shared)
 {
     bool found;
     void **key;
@@ -231,6 +343,7 @@ AddStdHashEntry(MemoryContext mcxt, STANDARDIZER *std)
         he->context = mcxt;
         DBG("&he->std=%p", &he->std);
         he->std = std;
+        he->shared = shared;
         DBG("Leaving AddStdHashEntry");
     }
     else {
@@ -357,12 +470,10 @@ AddToStdPortalCache(StdPortalCache *STDCache, char *lextab, char *gaztab, char *
     MemoryContext STDMemoryContext;
     MemoryContext old_context;
     STANDARDIZER *std = NULL;
+    StdSharedEntry *shared;
+    StdHashEntry *she;
 
     DBG("Enter: AddToStdPortalCache");
-    std = CreateStd(lextab, gaztab, rultab);
-    if (!std)
-        elog(ERROR,
-            "AddToStdPortalCache: could not create address standardizer for '%s', '%s', '%s'", lextab, gaztab, rultab);
 
     /* if the NextSlot in the cache is used, then delete it */
     if (STDCache->StdCache[STDCache->NextSlot].std != NULL) {
@@ -373,8 +484,6 @@ AddToStdPortalCache(StdPortalCache *STDCache, char *lextab, char *gaztab, char *
         DeleteNextSlotFromStdCache(STDCache);
     }
 
-    DBG("Adding item to STD cache ('%s', '%s', '%s') index %d", lextab, gaztab, rultab, STDCache->NextSlot);
-
 #if POSTGIS_PGSQL_VERSION < 96
     STDMemoryContext = MemoryContextCreate(T_AllocSetContext, 8192,
                                            &StdCacheContextMethods,
@@ -403,12 +512,27 @@ AddToStdPortalCache(StdPortalCache *STDCache, char *lextab, char *gaztab, char *
         CreateStdHash();
 
     /*
-     * Add the MemoryContext to the backend hash so we can
-     * clean up upon portal shutdown
+     * Add the MemoryContext to the backend hash before getting the
+     * standardizer, so that it is freed with the portal even if we
+     * error out below
      */
-    DBG("Adding standardizer obj (%p) to hash table with MemoryContext key (%p)", std, STDMemoryContext);
+    AddStdHashEntry(STDMemoryContext, NULL, NULL);
+
+    shared = AcquireSharedStd(lextab, gaztab, rultab, &std);
+    she = GetStdHashEntry(STDMemoryContext);
+    if (shared) {
+        she->shared = shared;
+        std = std_attach(shared->std);
+        if (!std)
+            elog(ERROR, "AddToStdPortalCache: could not allocate memory (std)");
+    }
+    if (!std)
+        elog(ERROR,
+            "AddToStdPortalCache: could not create address standardizer for '%s', '%s', '%s'", lextab, gaztab, rultab);
+    she->std = std;
 
-    AddStdHashEntry(STDMemoryContext, std);
+    DBG("Added standardizer obj (%p) to hash table with MemoryContext key (%p)", std, STDMemoryContext);
+    DBG("Adding item to STD cache ('%s', '%s', '%s') index %d", lextab, gaztab, rultab, STDCache->NextSlot);
 
     /* change memory contexts so the pstrdup are allocated in the
      * context of this cache item. They will be freed when the
@@ -506,6 +630,239 @@ GetStdUsingFCInfo(FunctionCallInfo fcinfo, char *lextab, char *gaztab, char *rul
 }
 
 
+/*
+ * Version of the contents of the three tables, used as the version of the
+ * shared standardizer built from them. It is a checksum of the rows visible
+ * to the current snapshot, so it is transactional: edits of the current
+ * transaction are seen, and those of other sessions once committed. Plain
+ * tables are summed over the identity of the row versions (xmin and ctid),
+ * which changes with every insert, update and delete without converting the
+ * rows to text (freezing or moving rows only costs a rebuild); views are
+ * summed over their rows as text.
+ */
+static uint64
+StdTablesVersion(char *lextab, char *gaztab, char *rultab)
+{
+    char *tabs[3];
+    uint64 version = 0;
+    int i;
+
+    tabs[0] = lextab;
+    tabs[1] = gaztab;
+    tabs[2] = rultab;
+
+    /* Let CreateStd report bad table names */
+    for (i=0; i<3; i++)
+        if (!tabs[i] || !strlen(tabs[i]) || !tableNameOk(tabs[i]))
+            return 0;
+
+    if (SPI_connect() != SPI_OK_CONNECT)
+        elog(ERROR, "StdTablesVersion: couldn't open a connection to SPI");
+
+    for (i=0; i<3; i++) {
+        char sql[512 + NAMEDATALEN * 4];
+        bool isnull;
+        bool is_table;
+        int64 key1, key2;
+
+        snprintf(sql, sizeof(sql),
+            "select c.relkind = 'r' from pg_class c where c.oid = '%s'::regclass", tabs[i]);
+        if (SPI_execute(sql, true, 1) != SPI_OK_SELECT || SPI_processed != 1) {
+            SPI_finish();
+            elog(ERROR, "StdTablesVersion: could not read table '%s'", tabs[i]);
+        }
+        is_table = DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+        SPI_freetuptable(SPI_tuptable);
+
+        snprintf(sql, sizeof(sql),
+            "select count(*)::int8, coalesce(sum(hashtext(%s)::int8), 0)::int8 from %s t",
+            is_table ? "t.xmin::text || t.ctid::text" : "t::text", tabs[i]);
+        if (SPI_execute(sql, true, 1) != SPI_OK_SELECT || SPI_processed != 1) {
+            SPI_finish();
+            elog(ERROR, "StdTablesVersion: could not read table '%s'", tabs[i]);
+        }
+
+        key1 = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+        key2 = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2, &isnull));
+        version = (version ^ (uint64) key1) * UINT64CONST(0x9E3779B97F4A7C15);
+        version = (version ^ (uint64) key2) * UINT64CONST(0x9E3779B97F4A7C15);
+        SPI_freetuptable(SPI_tuptable);
+    }
+
+    SPI_finish();
+    return version;
+}
+
+/* Called with the lock held, for entries no longer in use */
+static void
+FreeSharedStdEntry(StdSharedEntry *entry)
+{
+    DBG("Freeing shared STD ('%s', '%s', '%s')", entry->lextab, entry->gaztab, entry->rultab);
+    std_free(entry->std);
+    free(entry->lextab);
+    free(entry->gaztab);
+    free(entry->rultab);
+    memset(entry, 0, sizeof(StdSharedEntry));
+}
+
+/* Called with the lock held */
+static StdSharedEntry *
+FindSharedStd(char *lextab, char *gaztab, char *rultab, uint64 version)
+{
+    int i;
+
+    for (i=0; i<STD_SHARED_CACHE_ITEMS; i++) {
+        StdSharedEntry *entry = &StdSharedCache[i];
+        if (entry->std && !entry->stale &&
+            entry->dbid == MyDatabaseId &&
+            entry->version == version &&
+            !strcmp(entry->lextab, lextab) &&
+            !strcmp(entry->gaztab, gaztab) &&
+            !strcmp(entry->rultab, rultab))
+                return entry;
+    }
+    return NULL;
+}
+
+/*
+ * Returns the shared standardizer for the current contents of the tables,
+ * building it if needed, with a reference the caller must release. When
+ * the shared cache is full of standardizers in use, the one built is
+ * returned in private_std instead, for the caller alone.
+ */
+static StdSharedEntry *
+AcquireSharedStd(char *lextab, char *gaztab, char *rultab, STANDARDIZER **private_std)
+{
+    StdSharedEntry *entry;
+    StdSharedEntry *slot = NULL;
+    STANDARDIZER *std;
+    uint64 version;
+    int i;
+
+    *private_std = NULL;
+    StdSessionInit();
+    version = StdTablesVersion(lextab, gaztab, rultab);
+
+    pthread_mutex_lock(&StdSharedCacheLock);
+    entry = FindSharedStd(lextab, gaztab, rultab, version);
+    if (entry) {
+        entry->refcount++;
+        entry->last_used = ++StdSharedClock;
+        StdSessionRefs[entry - StdSharedCache]++;
+    }
+    pthread_mutex_unlock(&StdSharedCacheLock);
+    if (entry)
+        return entry;
+
+    /* Build without the lock, this can error out */
+    std = CreateStd(lextab, gaztab, rultab);
+    if (!std)
+        return NULL;
+
+    pthread_mutex_lock(&StdSharedCacheLock);
+
+    /* Another session may have built it meanwhile */
+    entry = FindSharedStd(lextab, gaztab, rultab, version);
+    if (entry) {
+        entry->refcount++;
+        entry->last_used = ++StdSharedClock;
+        StdSessionRefs[entry - StdSharedCache]++;
+        pthread_mutex_unlock(&StdSharedCacheLock);
+        std_free(std);
+        return entry;
+    }
+
+    /* Retire the older versions, and pick a free or least recently used slot */
+    for (i=0; i<STD_SHARED_CACHE_ITEMS; i++) {
+        StdSharedEntry *e = &StdSharedCache[i];
+        if (e->std && e->dbid == MyDatabaseId &&
+            !strcmp(e->lextab, lextab) &&
+            !strcmp(e->gaztab, gaztab) &&
+            !strcmp(e->rultab, rultab)) {
+            e->stale = true;
+            if (e->refcount == 0)
+                FreeSharedStdEntry(e);
+        }
+        if (!e->std) {
+            if (!slot || slot->std)
+                slot = e;
+        }
+        else if (e->refcount == 0 && (!slot || (slot->std && e->last_used < slot->last_used)))
+            slot = e;
+    }
+
+    if (slot) {
+        char *l = strdup(lextab);
+        char *g = strdup(gaztab);
+        char *r = strdup(rultab);
+        if (l && g && r) {
+            if (slot->std)
+                FreeSharedStdEntry(slot);
+            slot->dbid = MyDatabaseId;
+            slot->lextab = l;
+            slot->gaztab = g;
+            slot->rultab = r;
+            slot->version = version;
+            slot->std = std;
+            slot->refcount = 1;
+            slot->stale = false;
+            slot->last_used = ++StdSharedClock;
+            StdSessionRefs[slot - StdSharedCache]++;
+            pthread_mutex_unlock(&StdSharedCacheLock);
+            return slot;
+        }
+        free(l);
+        free(g);
+        free(r);
+    }
+
+    pthread_mutex_unlock(&StdSharedCacheLock);
+    *private_std = std;
+    return NULL;
+}
+
+/* Called with the lock held */
+static void
+ReleaseSharedStdRefs(StdSharedEntry *entry, int count)
+{
+    entry->refcount -= count;
+    if (entry->refcount == 0 && entry->stale)
+        FreeSharedStdEntry(entry);
+}
+
+static void
+ReleaseSharedStd(StdSharedEntry *entry)
+{
+    int i = entry - StdSharedCache;
+
+    pthread_mutex_lock(&StdSharedCacheLock);
+    /* Already dropped if the session memory went first */
+    if (StdSessionRefs[i] > 0) {
+        StdSessionRefs[i]--;
+        ReleaseSharedStdRefs(entry, 1);
+    }
+    pthread_mutex_unlock(&StdSharedCacheLock);
+}
+
+/* Drops every reference the session still holds, when its memory goes away */
+static void
+ReleaseSessionStds(void)
+{
+    int i;
+
+    pthread_mutex_lock(&StdSharedCacheLock);
+    for (i=0; i<STD_SHARED_CACHE_ITEMS; i++) {
+        if (StdSessionRefs[i] > 0) {
+            DBG("Releasing %d session references to shared STD %d", StdSessionRefs[i], i);
+            ReleaseSharedStdRefs(&StdSharedCache[i], StdSessionRefs[i]);
+            StdSessionRefs[i] = 0;
+        }
+    }
+    pthread_mutex_unlock(&StdSharedCacheLock);
+    StdSessionContext = NULL;
+}
+
+
 static STANDARDIZER *
 CreateStd(char *lextab, char *gaztab, char *rultab)
 {
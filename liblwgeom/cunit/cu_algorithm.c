@@ -1759,6 +1759,60 @@ static void test_kmeans(void)
 	return;
 }
 
+static void test_kmeans_ext(void)
+{
+	static int cluster_size = 2500;
+	static int num_clusters = 4;
+	int N = cluster_size * num_clusters;
+	LWGEOM **geoms;
+	int i, j, k = 0;
+	int *r_exact, *r_threads, *r_batch;
+
+	geoms = lwalloc(sizeof(LWGEOM*) * N);
+
+	/* Four blobs far apart from each other */
+	for (j = 0; j < num_clusters; j++)
+	{
+		for (i = 0; i < cluster_size; i++)
+		{
+			double x = 100 * (j % 2) + (i * 37 % 101) / 10.0;
+			double y = 100 * (j / 2) + (i * 59 % 103) / 10.0;
+			geoms[k++] = lwpoint_as_lwgeom(lwpoint_make2d(SRID_UNKNOWN, x, y));
+		}
+	}
+
+	/* Threads do not change the outcome of exact iterations */
+	r_exact = lwgeom_cluster_kmeans((const LWGEOM **)geoms, N, num_clusters, 0.0);
+	r_threads = lwgeom_cluster_kmeans_ext((const LWGEOM **)geoms, N, num_clusters, 0.0, 0, 4);
+	for (i = 0; i < N; i++)
+		ASSERT_INT_EQUAL(r_threads[i], r_exact[i]);
+
+	/* Mini-batches find the blobs too */
+	r_batch = lwgeom_cluster_kmeans_ext((const LWGEOM **)geoms, N, num_clusters, 0.0, 500, 2);
+	for (j = 0; j < num_clusters; j++)
+	{
+		int first = j * cluster_size;
+		for (i = 1; i < cluster_size; i++)
+			ASSERT_INT_EQUAL(r_batch[first + i], r_batch[first]);
+		for (i = 0; i < j; i++)
+			CU_ASSERT_NOT_EQUAL(r_batch[first], r_batch[i * cluster_size]);
+	}
+
+	/* Interrupted runs return no clustering, for both iteration kinds */
+	lwgeom_request_interrupt();
+	CU_ASSERT_PTR_NULL(lwgeom_cluster_kmeans_ext((const LWGEOM **)geoms, N, num_clusters, 0.0, 0, 4));
+	lwgeom_request_interrupt();
+	CU_ASSERT_PTR_NULL(lwgeom_cluster_kmeans_ext((const LWGEOM **)geoms, N, num_clusters, 0.0, 500, 2));
+
+	/* Clean up */
+	lwfree(r_exact);
+	lwfree(r_threads);
+	lwfree(r_batch);
+	for (i = 0; i < k; i++)
+		lwgeom_free(geoms[i]);
+	lwfree(geoms);
+}
+
 static void test_trim_bits(void)
 {
 	POINTARRAY *pta = ptarray_construct_empty(LW_TRUE, LW_TRUE, 2);
@@ -1837,6 +1891,7 @@ void algorithms_suite_setup(void)
 	PG_ADD_TEST(suite,test_lw_arc_center);
 	PG_ADD_TEST(suite,test_point_density);
 	PG_ADD_TEST(suite,test_kmeans);
+	PG_ADD_TEST(suite,test_kmeans_ext);
 	PG_ADD_TEST(suite,test_median_handles_3d_correctly);
 	PG_ADD_TEST(suite,test_median_robustness);
 	PG_ADD_TEST(suite,test_lwpoly_construct_circle);
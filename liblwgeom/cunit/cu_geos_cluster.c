@@ -367,6 +367,107 @@ static void dbscan_test_3612c(void)
 	do_dbscan_test(test);
 }
 
+static void dbscan_points_test(void)
+{
+	/* The grid path taken for points, single and multi-threaded, must find
+	 * the same clusters as the general path taken for single-point multipoints */
+	uint32_t num_geoms = 400;
+	uint32_t min_points[] = { 1, 4, 5 };
+	LWGEOM** points = (LWGEOM**)lwalloc(num_geoms * sizeof(LWGEOM*));
+	LWGEOM** mpoints = (LWGEOM**)lwalloc(num_geoms * sizeof(LWGEOM*));
+	uint32_t i, j, k;
+
+	for (i = 0; i < num_geoms; i++)
+	{
+		double x = (i * 37 % 101) / 10.0;
+		double y = (i * 59 % 103) / 10.0;
+		LWMPOINT* mpoint = lwmpoint_construct_empty(SRID_UNKNOWN, 0, 0);
+		points[i] = lwpoint_as_lwgeom(lwpoint_make2d(SRID_UNKNOWN, x, y));
+		mpoints[i] = lwmpoint_as_lwgeom(lwmpoint_add_lwpoint(mpoint, lwpoint_make2d(SRID_UNKNOWN, x, y)));
+	}
+
+	for (k = 0; k < sizeof(min_points) / sizeof(uint32_t); k++)
+	{
+		UNIONFIND* uf_general = UF_create(num_geoms);
+		UNIONFIND* uf_points = UF_create(num_geoms);
+		UNIONFIND* uf_threads = UF_create(num_geoms);
+		char *in_general, *in_points, *in_threads;
+		uint32_t *ids_points, *ids_threads;
+
+		union_dbscan(mpoints, num_geoms, uf_general, 0.5, min_points[k], &in_general);
+		union_dbscan(points, num_geoms, uf_points, 0.5, min_points[k], &in_points);
+		union_dbscan_ext(points, num_geoms, uf_threads, 0.5, min_points[k], &in_threads, 4, 0.0);
+
+		ids_points = UF_get_collapsed_cluster_ids(uf_points, in_points);
+		ids_threads = UF_get_collapsed_cluster_ids(uf_threads, in_threads);
+
+		for (i = 0; i < num_geoms; i++)
+		{
+			ASSERT_INT_EQUAL(in_points[i], in_general[i]);
+			ASSERT_INT_EQUAL(in_threads[i], in_points[i]);
+			if (in_points[i])
+				ASSERT_INT_EQUAL(ids_threads[i], ids_points[i]);
+			for (j = i + 1; j < num_geoms; j++)
+			{
+				int same_points, same_general;
+				if (!in_points[i] || !in_points[j])
+					continue;
+				same_points = UF_find(uf_points, i) == UF_find(uf_points, j);
+				same_general = UF_find(uf_general, i) == UF_find(uf_general, j);
+				ASSERT_INT_EQUAL(same_points, same_general);
+			}
+		}
+
+		lwfree(ids_points);
+		lwfree(ids_threads);
+		lwfree(in_general);
+		lwfree(in_points);
+		lwfree(in_threads);
+		UF_destroy(uf_general);
+		UF_destroy(uf_points);
+		UF_destroy(uf_threads);
+	}
+
+	for (i = 0; i < num_geoms; i++)
+	{
+		lwgeom_free(points[i]);
+		lwgeom_free(mpoints[i]);
+	}
+	lwfree(points);
+	lwfree(mpoints);
+}
+
+static void dbscan_points_interrupt_test(void)
+{
+	/* An interrupt stops the grid path between passes, without a GEOS fallback */
+	uint32_t num_geoms = 100;
+	LWGEOM** points = (LWGEOM**)lwalloc(num_geoms * sizeof(LWGEOM*));
+	UNIONFIND* uf;
+	char* in_a_cluster = NULL;
+	uint32_t i;
+
+	for (i = 0; i < num_geoms; i++)
+		points[i] = lwpoint_as_lwgeom(lwpoint_make2d(SRID_UNKNOWN, i % 10, i / 10));
+
+	uf = UF_create(num_geoms);
+	lwgeom_request_interrupt();
+	ASSERT_INT_EQUAL(union_dbscan_ext(points, num_geoms, uf, 1.5, 3, &in_a_cluster, 2, 0.0), LW_FAILURE);
+	CU_ASSERT_PTR_NULL(in_a_cluster);
+	UF_destroy(uf);
+
+	/* The request is consumed, so the next run completes */
+	uf = UF_create(num_geoms);
+	ASSERT_INT_EQUAL(union_dbscan_ext(points, num_geoms, uf, 1.5, 3, &in_a_cluster, 2, 0.0), LW_SUCCESS);
+	for (i = 0; i < num_geoms; i++)
+		ASSERT_INT_EQUAL(in_a_cluster[i], LW_TRUE);
+	lwfree(in_a_cluster);
+	UF_destroy(uf);
+
+	for (i = 0; i < num_geoms; i++)
+		lwgeom_free(points[i]);
+	lwfree(points);
+}
+
 void geos_cluster_suite_setup(void);
 void geos_cluster_suite_setup(void)
 {
@@ -381,4 +482,6 @@ void geos_cluster_suite_setup(void)
 	PG_ADD_TEST(suite, dbscan_test_3612a);
 	PG_ADD_TEST(suite, dbscan_test_3612b);
 	PG_ADD_TEST(suite, dbscan_test_3612c);
+	PG_ADD_TEST(suite, dbscan_points_test);
+	PG_ADD_TEST(suite, dbscan_points_interrupt_test);
 }
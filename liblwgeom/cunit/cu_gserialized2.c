@@ -101,6 +101,201 @@ static void test_gserialized2_extended_flags(void)
 
 }
 
+static void test_gserialized2_cached_checks(void)
+{
+	LWGEOM *lwg;
+	GSERIALIZED *g1, *g2, *g3;
+	int32_t hval = 0;
+	int32_t hval_plain;
+	size_t size = 0;
+
+	lwg = lwgeom_from_wkt("SRID=4326;LINESTRING(0 0, 1 1, 2 0)", LW_PARSER_CHECK_NONE);
+	g1 = gserialized2_from_lwgeom(lwg, &size);
+	hval_plain = gserialized2_hash(g1);
+
+	/* Nothing stored yet */
+	CU_ASSERT_EQUAL(gserialized2_get_cached_valid(g1), -1);
+	CU_ASSERT_EQUAL(gserialized2_get_cached_hash(g1, &hval), LW_FAILURE);
+
+	/* Storing grows the serialization by the extended flags word */
+	g2 = gserialized2_set_cached_checks(g1, LW_TRUE, LW_TRUE);
+	CU_ASSERT(g2 != g1);
+	CU_ASSERT_EQUAL(LWSIZE_GET(g2->size), size + 8);
+	CU_ASSERT_EQUAL(1, G2FLAGS_GET_EXTENDED(g2->gflags));
+	CU_ASSERT_EQUAL(gserialized2_get_cached_valid(g2), LW_TRUE);
+	CU_ASSERT_EQUAL(gserialized2_get_cached_hash(g2, &hval), LW_SUCCESS);
+	CU_ASSERT_EQUAL(hval, hval_plain);
+	CU_ASSERT_EQUAL(gserialized2_hash(g2), hval_plain);
+	CU_ASSERT_EQUAL(gserialized2_get_type(g2), LINETYPE);
+	CU_ASSERT_EQUAL(gserialized2_get_srid(g2), 4326);
+
+	/* Flags live in the existing word on the second pass */
+	g3 = gserialized2_set_cached_checks(g2, LW_FALSE, LW_FALSE);
+	CU_ASSERT(g3 == g2);
+	CU_ASSERT_EQUAL(gserialized2_get_cached_valid(g2), LW_FALSE);
+	CU_ASSERT_EQUAL(gserialized2_get_cached_hash(g2, &hval), LW_FAILURE);
+
+	/* A new SRID makes the stored hash stale */
+	g3 = gserialized2_set_cached_checks(g2, -1, LW_TRUE);
+	gserialized2_set_srid(g3, 3857);
+	CU_ASSERT_EQUAL(gserialized2_get_cached_hash(g3, &hval), LW_FAILURE);
+	gserialized2_set_srid(g3, 4326);
+
+	/* Clearing everything drops the word again */
+	g3 = gserialized2_set_cached_checks(g2, -1, LW_FALSE);
+	CU_ASSERT(g3 != g2);
+	CU_ASSERT_EQUAL(LWSIZE_GET(g3->size), size);
+	CU_ASSERT_EQUAL(0, G2FLAGS_GET_EXTENDED(g3->gflags));
+	CU_ASSERT_EQUAL(memcmp(g1, g3, size), 0);
+	lwfree(g3);
+	lwfree(g2);
+	lwfree(g1);
+
+	/* Solid flag survives clearing the checks */
+	FLAGS_SET_SOLID(lwg->flags, 1);
+	g1 = gserialized2_from_lwgeom(lwg, &size);
+	g2 = gserialized2_set_cached_checks(g1, LW_TRUE, LW_TRUE);
+	CU_ASSERT(g2 == g1);
+	CU_ASSERT_EQUAL(gserialized2_hash(g1), hval_plain);
+	g2 = gserialized2_set_cached_checks(g1, -1, LW_FALSE);
+	CU_ASSERT(g2 == g1);
+	CU_ASSERT_EQUAL(1, G2FLAGS_GET_EXTENDED(g2->gflags));
+	lwgeom_free(lwg);
+	lwg = lwgeom_from_gserialized2(g2);
+	CU_ASSERT_EQUAL(1, FLAGS_GET_SOLID(lwg->flags));
+	lwgeom_free(lwg);
+	lwfree(g1);
+}
+
+static void test_gserialized2_compact(void)
+{
+	LWGEOM *lwg1, *lwg2;
+	GSERIALIZED *g1, *g2;
+	GBOX box;
+	POINT4D pt;
+	size_t size = 0;
+	POINTARRAY *pa;
+	char *wkt;
+	int i;
+
+	/* A long line shrinks a lot once quantized and delta encoded */
+	pa = ptarray_construct_empty(LW_FALSE, LW_FALSE, 100);
+	for (i = 0; i < 100; i++)
+	{
+		pt.x = i + 0.04;
+		pt.y = i % 7 + 0.96;
+		ptarray_append_point(pa, &pt, LW_TRUE);
+	}
+	lwg1 = lwline_as_lwgeom(lwline_construct(4326, NULL, pa));
+
+	g1 = gserialized2_compact_from_lwgeom(lwg1, 1, 0, 0, &size);
+	CU_ASSERT_FATAL(g1 != NULL);
+	CU_ASSERT_EQUAL(LWSIZE_GET(g1->size), size);
+	CU_ASSERT(size * 4 < gserialized2_from_lwgeom_size(lwg1));
+	CU_ASSERT(gserialized2_is_compact(g1));
+	CU_ASSERT_EQUAL(gserialized2_get_type(g1), LINETYPE);
+	CU_ASSERT_EQUAL(gserialized2_get_srid(g1), 4326);
+	CU_ASSERT_FALSE(gserialized2_is_empty(g1));
+
+	/* Box is read straight from the header */
+	CU_ASSERT_EQUAL(gserialized2_fast_gbox_p(g1, &box), LW_SUCCESS);
+	CU_ASSERT_DOUBLE_EQUAL(box.xmin, 0.0, 1e-6);
+	CU_ASSERT_DOUBLE_EQUAL(box.xmax, 99.0, 1e-5);
+	CU_ASSERT_DOUBLE_EQUAL(box.ymin, 1.0, 1e-6);
+	CU_ASSERT_DOUBLE_EQUAL(box.ymax, 7.0, 1e-6);
+
+	/* Decoding gives the rounded vertices */
+	lwg2 = lwgeom_from_gserialized2(g1);
+	CU_ASSERT_EQUAL(lwgeom_get_srid(lwg2), 4326);
+	CU_ASSERT_EQUAL(lwgeom_count_vertices(lwg2), 100);
+	wkt = lwgeom_to_wkt(lwg2, WKT_ISO, 8, NULL);
+	CU_ASSERT_NSTRING_EQUAL(wkt, "LINESTRING(0 1,1 2,2 3,", 23);
+	lwfree(wkt);
+
+	/* Same hash as the plain form of the rounded geometry */
+	g2 = gserialized2_from_lwgeom(lwg2, NULL);
+	CU_ASSERT_EQUAL(gserialized2_hash(g1), gserialized2_hash(g2));
+	CU_ASSERT_EQUAL(gserialized_cmp(g1, g2), 0);
+	CU_ASSERT_EQUAL(gserialized_cmp(g2, g1), 0);
+	lwfree(g2);
+	lwgeom_free(lwg2);
+	lwgeom_free(lwg1);
+	lwfree(g1);
+
+	/* Empty and point */
+	lwg1 = lwgeom_from_wkt("MULTIPOLYGON EMPTY", LW_PARSER_CHECK_NONE);
+	g1 = gserialized2_compact_from_lwgeom(lwg1, 0, 0, 0, NULL);
+	CU_ASSERT(gserialized2_is_empty(g1));
+	CU_ASSERT_EQUAL(gserialized2_get_type(g1), MULTIPOLYGONTYPE);
+	CU_ASSERT_EQUAL(gserialized2_get_gbox_p(g1, &box), LW_FAILURE);
+	lwfree(g1);
+	lwgeom_free(lwg1);
+
+	lwg1 = lwgeom_from_wkt("POINT Z (1.26 -2.5 3.3)", LW_PARSER_CHECK_NONE);
+	g1 = gserialized2_compact_from_lwgeom(lwg1, 1, 0, 0, NULL);
+	CU_ASSERT_EQUAL(gserialized2_peek_first_point(g1, &pt), LW_SUCCESS);
+	CU_ASSERT_DOUBLE_EQUAL(pt.x, 1.3, 1e-9);
+	CU_ASSERT_DOUBLE_EQUAL(pt.y, -2.5, 1e-9);
+	CU_ASSERT_DOUBLE_EQUAL(pt.z, 3.0, 1e-9);
+	lwfree(g1);
+	lwgeom_free(lwg1);
+
+	/* No TWKB for curves */
+	lwg1 = lwgeom_from_wkt("CIRCULARSTRING(0 0,1 1,2 0)", LW_PARSER_CHECK_NONE);
+	CU_ASSERT(gserialized2_compact_from_lwgeom(lwg1, 0, 0, 0, NULL) == NULL);
+	lwgeom_free(lwg1);
+}
+
+static int cmp_sign(int cmp)
+{
+	return cmp > 0 ? 1 : (cmp < 0 ? -1 : 0);
+}
+
+static void test_gserialized2_compact_cmp(void)
+{
+	/* Same box, so the order comes from the data area, with and without ring padding */
+	const char *wkt[] = {
+		"POLYGON((0 0,10 0,10 10,0 10,0 0))",
+		"POLYGON((0 0,10 0,10 10,0 10,0 0),(2 2,2 4,4 4,4 2,2 2))",
+		"POLYGON((0 0,10 0,10 10,0 10,0 0),(2 2,2 4,4 4,4 2,2 2),(6 6,6 8,8 8,8 6,6 6))",
+		"MULTIPOINT(0 0,10 10)",
+		"MULTIPOINT(0 0,5 5,10 10)",
+		"GEOMETRYCOLLECTION(POINT(0 0),LINESTRING(0 0,10 10))"
+	};
+	const int n = sizeof(wkt) / sizeof(wkt[0]);
+	GSERIALIZED *plain[6], *compact[6];
+	int i, j;
+
+	for (i = 0; i < n; i++)
+	{
+		LWGEOM *lwg = lwgeom_from_wkt(wkt[i], LW_PARSER_CHECK_NONE);
+		plain[i] = gserialized2_from_lwgeom(lwg, NULL);
+		compact[i] = gserialized2_compact_from_lwgeom(lwg, 0, 0, 0, NULL);
+		CU_ASSERT_FATAL(compact[i] != NULL);
+		lwgeom_free(lwg);
+		CU_ASSERT_EQUAL(gserialized2_hash(compact[i]), gserialized2_hash(plain[i]));
+	}
+
+	/* Compact values sort exactly like their plain form, whatever the other side */
+	for (i = 0; i < n; i++)
+	{
+		for (j = 0; j < n; j++)
+		{
+			int expected = cmp_sign(gserialized_cmp(plain[i], plain[j]));
+			CU_ASSERT_EQUAL(expected == 0, i == j);
+			CU_ASSERT_EQUAL(cmp_sign(gserialized_cmp(compact[i], plain[j])), expected);
+			CU_ASSERT_EQUAL(cmp_sign(gserialized_cmp(plain[i], compact[j])), expected);
+			CU_ASSERT_EQUAL(cmp_sign(gserialized_cmp(compact[i], compact[j])), expected);
+		}
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		lwfree(plain[i]);
+		lwfree(compact[i]);
+	}
+}
+
 static void test_gserialized2_srid(void)
 {
 	GSERIALIZED s;
@@ -512,5 +707,8 @@ void gserialized2_suite_setup(void)
 	PG_ADD_TEST(suite, test_gserialized2_peek_gbox_p_gets_correct_box);
 	PG_ADD_TEST(suite, test_gserialized2_peek_gbox_p_fails_for_unsupported_cases);
 	PG_ADD_TEST(suite, test_gserialized2_extended_flags);
+	PG_ADD_TEST(suite, test_gserialized2_cached_checks);
+	PG_ADD_TEST(suite, test_gserialized2_compact);
+	PG_ADD_TEST(suite, test_gserialized2_compact_cmp);
 	PG_ADD_TEST(suite, test_gserialized2_peek_first_point);
 }
@@ -518,6 +518,86 @@ static void test_unstroke()
 	lwfree(str);
 }
 
+static void test_lwbezier_linearize(void)
+{
+	LWGEOM *in, *out;
+	const POINTARRAY *pa;
+	const GBOX *box;
+	POINT4D p;
+	int i;
+	char *str;
+
+	in = lwgeom_from_text("BEZIER3CURVE(0 0,0 10,10 10,10 0)");
+
+	/* 180 degrees of turning, 2 segments per quadrant */
+	out = lwcurve_linearize(in, 2, LW_LINEARIZE_TOLERANCE_TYPE_SEGS_PER_QUAD, 0);
+	str = lwgeom_to_wkt(out, WKT_ISO, 4, NULL);
+	ASSERT_STRING_EQUAL(str, "LINESTRING(0 0,1.5625 5.625,5 7.5,8.4375 5.625,10 0)");
+	lwfree(str);
+	lwgeom_free(out);
+
+	/* Invalid segments per quadrant */
+	cu_error_msg_reset();
+	out = lwcurve_linearize(in, 0, LW_LINEARIZE_TOLERANCE_TYPE_SEGS_PER_QUAD, 0);
+	CU_ASSERT(out == NULL);
+	ASSERT_STRING_EQUAL(cu_error_msg, "lwbezier_linearize: segments per quadrant must be a positive integer value, got 0");
+
+	/* Max deviation: exact endpoints, every vertex on the curve, chords close to it */
+	out = lwcurve_linearize(in, 0.01, LW_LINEARIZE_TOLERANCE_TYPE_MAX_DEVIATION, 0);
+	pa = ((LWLINE *)out)->points;
+	CU_ASSERT(pa->npoints > 5);
+	getPoint4d_p(pa, 0, &p);
+	CU_ASSERT_EQUAL(p.x, 0);
+	CU_ASSERT_EQUAL(p.y, 0);
+	getPoint4d_p(pa, pa->npoints - 1, &p);
+	CU_ASSERT_EQUAL(p.x, 10);
+	CU_ASSERT_EQUAL(p.y, 0);
+	for (i = 0; i <= 100; i++)
+	{
+		double t = i / 100.0;
+		LWPOINT *pt = lwpoint_make2d(SRID_UNKNOWN, 30 * t * t - 20 * t * t * t, 30 * t * (1 - t));
+		CU_ASSERT(lwgeom_mindistance2d(lwpoint_as_lwgeom(pt), out) <= 0.01);
+		lwpoint_free(pt);
+	}
+	lwgeom_free(out);
+
+	/* Max angle */
+	out = lwcurve_linearize(in, M_PI / 8, LW_LINEARIZE_TOLERANCE_TYPE_MAX_ANGLE, 0);
+	pa = ((LWLINE *)out)->points;
+	for (i = 2; i < (int)pa->npoints; i++)
+	{
+		const POINT2D *a = getPoint2d_cp(pa, i - 2);
+		const POINT2D *b = getPoint2d_cp(pa, i - 1);
+		const POINT2D *c = getPoint2d_cp(pa, i);
+		double turn = atan2((b->x - a->x) * (c->y - b->y) - (b->y - a->y) * (c->x - b->x),
+				    (b->x - a->x) * (c->x - b->x) + (b->y - a->y) * (c->y - b->y));
+		CU_ASSERT(fabs(turn) <= M_PI / 8 + 1e-12);
+	}
+	lwgeom_free(out);
+
+	/* Bounding box is the exact extent of the curve, not the control points */
+	lwgeom_add_bbox(in);
+	box = lwgeom_get_bbox(in);
+	CU_ASSERT_DOUBLE_EQUAL(box->xmin, 0, 1e-12);
+	CU_ASSERT_DOUBLE_EQUAL(box->xmax, 10, 1e-12);
+	CU_ASSERT_DOUBLE_EQUAL(box->ymin, 0, 1e-12);
+	CU_ASSERT_DOUBLE_EQUAL(box->ymax, 7.5, 1e-12);
+	lwgeom_free(in);
+
+	/* Z is carried along, the box covers it too */
+	in = lwgeom_from_text("BEZIER3CURVE Z(0 0 0,0 10 4,10 10 4,10 0 0)");
+	out = lwcurve_linearize(in, 1, LW_LINEARIZE_TOLERANCE_TYPE_SEGS_PER_QUAD, 0);
+	str = lwgeom_to_wkt(out, WKT_ISO, 4, NULL);
+	ASSERT_STRING_EQUAL(str, "LINESTRING Z (0 0 0,5 7.5 3,10 0 0)");
+	lwfree(str);
+	lwgeom_free(out);
+	lwgeom_add_bbox(in);
+	box = lwgeom_get_bbox(in);
+	CU_ASSERT_DOUBLE_EQUAL(box->zmin, 0, 1e-12);
+	CU_ASSERT_DOUBLE_EQUAL(box->zmax, 3, 1e-12);
+	lwgeom_free(in);
+}
+
 /*
 ** Used by the test harness to register the tests in this file.
 */
@@ -527,4 +607,5 @@ void lwstroke_suite_setup(void)
 	CU_pSuite suite = CU_add_suite("lwstroke", NULL, NULL);
 	PG_ADD_TEST(suite, test_lwcurve_linearize);
 	PG_ADD_TEST(suite, test_unstroke);
+	PG_ADD_TEST(suite, test_lwbezier_linearize);
 }
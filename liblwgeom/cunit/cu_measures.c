@@ -1542,6 +1542,107 @@ test_lwgeom_is_trajectory(void)
 	ASSERT_INT_EQUAL(ret, LW_TRUE); /* ok (corner case) */
 }
 
+static void
+test_lwellipse_analytic(void)
+{
+	LWGEOM *g, *pt;
+	const GBOX *box;
+	GBOX window;
+	POINT2D p, q;
+	double d;
+
+	/* Full ellipse, semi axes 10 and 5 */
+	g = lwgeom_from_text("ELLIPTICALSTRING(10 0,10 0,0 0,1,0,0,10,0.5)");
+	lwgeom_add_bbox(g);
+	box = lwgeom_get_bbox(g);
+	CU_ASSERT_DOUBLE_EQUAL(box->xmin, -10, 1e-9);
+	CU_ASSERT_DOUBLE_EQUAL(box->xmax, 10, 1e-9);
+	CU_ASSERT_DOUBLE_EQUAL(box->ymin, -5, 1e-9);
+	CU_ASSERT_DOUBLE_EQUAL(box->ymax, 5, 1e-9);
+
+	p.x = 0; p.y = 0;
+	ASSERT_INT_EQUAL(lwgeom_contains_point(g, &p), LW_INSIDE);
+	p.x = 10; p.y = 0;
+	ASSERT_INT_EQUAL(lwgeom_contains_point(g, &p), LW_BOUNDARY);
+	p.x = 0; p.y = 6;
+	ASSERT_INT_EQUAL(lwgeom_contains_point(g, &p), LW_OUTSIDE);
+
+	/* Distance to the curve from inside and outside */
+	p.x = 0; p.y = 0;
+	d = lwellipse_closest_point((LWELLIPSE *)g, &p, LW_FALSE, &q);
+	CU_ASSERT_DOUBLE_EQUAL(d, 5, 1e-9);
+	CU_ASSERT_DOUBLE_EQUAL(q.x, 0, 1e-9);
+	CU_ASSERT_DOUBLE_EQUAL(fabs(q.y), 5, 1e-9);
+	d = lwellipse_closest_point((LWELLIPSE *)g, &p, LW_TRUE, &q);
+	CU_ASSERT_DOUBLE_EQUAL(d, 10, 1e-9);
+	p.x = 3; p.y = 9;
+	d = lwellipse_closest_point((LWELLIPSE *)g, &p, LW_FALSE, &q);
+	CU_ASSERT_DOUBLE_EQUAL(d, sqrt((p.x - q.x) * (p.x - q.x) + (p.y - q.y) * (p.y - q.y)), 1e-12);
+	CU_ASSERT_DOUBLE_EQUAL(q.x * q.x / 100 + q.y * q.y / 25, 1, 1e-12);
+	/* The offset to the closest point is normal to the curve */
+	CU_ASSERT_DOUBLE_EQUAL((p.x - q.x) * (-q.y * 10 / 5) + (p.y - q.y) * (q.x * 5 / 10), 0, 1e-9);
+
+	pt = lwgeom_from_text("POINT(20 0)");
+	CU_ASSERT_DOUBLE_EQUAL(lwgeom_mindistance2d(pt, g), 10, 1e-9);
+	CU_ASSERT_DOUBLE_EQUAL(lwgeom_maxdistance2d(pt, g), 30, 1e-9);
+	lwgeom_free(pt);
+
+	/* Box inside the ellipse does not touch the curve */
+	window.flags = 0;
+	window.xmin = -1; window.xmax = 1; window.ymin = -1; window.ymax = 1;
+	CU_ASSERT_FALSE(lwellipse_intersects_gbox((LWELLIPSE *)g, &window));
+	window.xmin = 9; window.xmax = 11;
+	CU_ASSERT_TRUE(lwellipse_intersects_gbox((LWELLIPSE *)g, &window));
+	window.xmin = 9.5; window.xmax = 11; window.ymin = 4; window.ymax = 6;
+	CU_ASSERT_FALSE(lwellipse_intersects_gbox((LWELLIPSE *)g, &window));
+	lwgeom_free(g);
+
+	/* Rotated by 45 degrees */
+	g = lwgeom_from_text("ELLIPTICALSTRING(7.0710678118654755 7.0710678118654755,7.0710678118654755 7.0710678118654755,0 0,1,0,0.7853981633974483,10,0.5)");
+	lwgeom_add_bbox(g);
+	box = lwgeom_get_bbox(g);
+	CU_ASSERT_DOUBLE_EQUAL(box->xmin, -sqrt(62.5), 1e-9);
+	CU_ASSERT_DOUBLE_EQUAL(box->xmax, sqrt(62.5), 1e-9);
+	CU_ASSERT_DOUBLE_EQUAL(box->ymin, -sqrt(62.5), 1e-9);
+	CU_ASSERT_DOUBLE_EQUAL(box->ymax, sqrt(62.5), 1e-9);
+	lwgeom_free(g);
+
+	/* Upper half, counterclockwise from (10 0) to (-10 0) */
+	g = lwgeom_from_text("ELLIPTICALSTRING(10 0,-10 0,0 0,1,0,0,10,0.5)");
+	lwgeom_add_bbox(g);
+	box = lwgeom_get_bbox(g);
+	CU_ASSERT_DOUBLE_EQUAL(box->ymin, 0, 1e-9);
+	CU_ASSERT_DOUBLE_EQUAL(box->ymax, 5, 1e-9);
+	p.x = 0; p.y = 2;
+	ASSERT_INT_EQUAL(lwgeom_contains_point(g, &p), LW_INSIDE);
+	p.x = 0; p.y = -2;
+	ASSERT_INT_EQUAL(lwgeom_contains_point(g, &p), LW_OUTSIDE);
+	p.x = 0; p.y = -3;
+	CU_ASSERT_DOUBLE_EQUAL(lwellipse_closest_point((LWELLIPSE *)g, &p, LW_FALSE, NULL), 8, 1e-9);
+	window.xmin = -1; window.xmax = 1; window.ymin = -6; window.ymax = -4;
+	CU_ASSERT_FALSE(lwellipse_intersects_gbox((LWELLIPSE *)g, &window));
+	lwgeom_free(g);
+
+	/* Lower half, clockwise */
+	g = lwgeom_from_text("ELLIPTICALSTRING(10 0,-10 0,0 0,0,1,0,10,0.5)");
+	lwgeom_add_bbox(g);
+	box = lwgeom_get_bbox(g);
+	CU_ASSERT_DOUBLE_EQUAL(box->ymin, -5, 1e-9);
+	CU_ASSERT_DOUBLE_EQUAL(box->ymax, 0, 1e-9);
+	CU_ASSERT_TRUE(lwellipse_intersects_gbox((LWELLIPSE *)g, &window));
+	lwgeom_free(g);
+
+	/* Point to curve polygon bounded by an ellipse */
+	g = lwgeom_from_text("CURVEPOLYGON(ELLIPTICALSTRING(10 0,10 0,0 0,1,0,0,10,0.5))");
+	pt = lwgeom_from_text("POINT(1 1)");
+	CU_ASSERT_DOUBLE_EQUAL(lwgeom_mindistance2d(pt, g), 0, 1e-12);
+	lwgeom_free(pt);
+	pt = lwgeom_from_text("POINT(0 8)");
+	CU_ASSERT_DOUBLE_EQUAL(lwgeom_mindistance2d(pt, g), 3, 1e-9);
+	lwgeom_free(pt);
+	lwgeom_free(g);
+}
+
 /*
 ** Used by test harness to register the tests in this file.
 */
@@ -1564,4 +1665,5 @@ void measures_suite_setup(void)
 	PG_ADD_TEST(suite, test_lwgeom_tcpa);
 	PG_ADD_TEST(suite, test_lwgeom_is_trajectory);
 	PG_ADD_TEST(suite, test_rect_tree_distance_tree);
+	PG_ADD_TEST(suite, test_lwellipse_analytic);
 }
@@ -172,6 +172,109 @@ static void test_tree_circ_pip2(void)
 }
 
 
+static void test_tree_circ_cells(void)
+{
+	const char *wkt[] = {
+		"POLYGON((-10 -10,-10 50,60 50,60 -10,-10 -10),(0 0,0 10,10 10,10 0,0 0))",
+		"MULTIPOLYGON(((170 -20,-170 -20,-170 20,170 20,170 -20)),((100 60,140 60,140 89,100 89,100 60)))",
+		"POLYGON((-180 60,-90 60,0 60,90 60,180 60,180 90,-180 90,-180 60))"
+	};
+	int i, x, y;
+
+	for ( i = 0; i < 3; i++ )
+	{
+		LWGEOM *g = lwgeom_from_wkt(wkt[i], LW_PARSER_CHECK_NONE);
+		CIRC_NODE *c = lwgeom_calculate_circ_tree(g);
+		CIRC_CELL_INDEX *index;
+		GBOX gbox;
+		POINT2D pt, pt_outside;
+		int num_inside = 0, num_boundary = 0;
+
+		lwgeom_calculate_gbox_geodetic(g, &gbox);
+		gbox_pt_outside(&gbox, &pt_outside);
+		index = circ_cell_index_new(g, c, &gbox, &pt_outside);
+		CU_ASSERT_PTR_NOT_NULL_FATAL(index);
+
+		/* Cells that are not on the boundary agree with the tree */
+		for ( x = -179; x < 180; x += 2 )
+		{
+			for ( y = -89; y < 90; y += 2 )
+			{
+				GEOGRAPHIC_POINT gp;
+				POINT3D p3;
+				int rv_tree, rv_cell;
+
+				pt.x = x + 0.3;
+				pt.y = y + 0.7;
+				geographic_point_init(pt.x, pt.y, &gp);
+				geog2cart(&gp, &p3);
+				rv_tree = gbox_contains_point3d(&gbox, &p3) && circ_tree_contains_point(c, &pt, &pt_outside, 0, NULL);
+				rv_cell = circ_cell_index_lookup(index, &p3);
+				if ( rv_cell == CIRC_CELL_BOUNDARY )
+				{
+					num_boundary++;
+					continue;
+				}
+				CU_ASSERT_EQUAL(rv_cell, rv_tree ? CIRC_CELL_INSIDE : CIRC_CELL_OUTSIDE);
+				num_inside += rv_tree;
+			}
+		}
+		CU_ASSERT(num_inside > 0);
+		CU_ASSERT(num_boundary < 90 * 180 / 10);
+
+		lwfree(index);
+		circ_tree_free(c);
+		lwgeom_free(g);
+	}
+
+	/* Only areas get an index */
+	{
+		LWGEOM *g = lwgeom_from_wkt("LINESTRING(0 0,10 10)", LW_PARSER_CHECK_NONE);
+		CIRC_NODE *c = lwgeom_calculate_circ_tree(g);
+		GBOX gbox;
+		POINT2D pt_outside;
+		lwgeom_calculate_gbox_geodetic(g, &gbox);
+		gbox_pt_outside(&gbox, &pt_outside);
+		CU_ASSERT_PTR_NULL(circ_cell_index_new(g, c, &gbox, &pt_outside));
+		circ_tree_free(c);
+		lwgeom_free(g);
+	}
+}
+
+
+static void test_tree_circ_distance_brute(void)
+{
+	/* The tree walk and the plain pairwise walk agree on the sphere */
+	const char *wkt[][2] = {
+		{ "LINESTRING(0 0,10 5,20 -3,30 8,40 0)", "LINESTRING(5 30,15 22,25 28,35 21)" },
+		{ "LINESTRING(170 10,-175 12,-160 9)", "LINESTRING(175 -10,-170 -2,-165 -12)" },
+		{ "POLYGON((0 60,40 60,40 80,0 80,0 60))", "LINESTRING(10 50,20 55,30 52)" },
+		{ "MULTIPOINT(1 1,2 2,3 3)", "LINESTRING(0 10,10 10)" }
+	};
+	SPHEROID s;
+	int i;
+
+	spheroid_init(&s, 1.0, 1.0);
+	for ( i = 0; i < 4; i++ )
+	{
+		LWGEOM *lwg1 = lwgeom_from_wkt(wkt[i][0], LW_PARSER_CHECK_NONE);
+		LWGEOM *lwg2 = lwgeom_from_wkt(wkt[i][1], LW_PARSER_CHECK_NONE);
+		CIRC_NODE *c1 = lwgeom_calculate_circ_tree(lwg1);
+		CIRC_NODE *c2 = lwgeom_calculate_circ_tree(lwg2);
+		double d1, d2;
+		lwgeom_add_bbox_deep(lwg1, NULL);
+		lwgeom_add_bbox_deep(lwg2, NULL);
+		d1 = circ_tree_distance_tree(c1, c2, &s, 0.0);
+		d2 = lwgeom_distance_spheroid(lwg1, lwg2, &s, 0.0);
+		CU_ASSERT_DOUBLE_EQUAL(d1, d2, 1e-12);
+		circ_tree_free(c1);
+		circ_tree_free(c2);
+		lwgeom_free(lwg1);
+		lwgeom_free(lwg2);
+	}
+}
+
+
 static void test_tree_circ_distance(void)
 {
 	LWGEOM *lwg1, *lwg2;
@@ -429,6 +532,8 @@ void tree_suite_setup(void)
 	PG_ADD_TEST(suite, test_tree_circ_create);
 	PG_ADD_TEST(suite, test_tree_circ_pip);
 	PG_ADD_TEST(suite, test_tree_circ_pip2);
+	PG_ADD_TEST(suite, test_tree_circ_cells);
 	PG_ADD_TEST(suite, test_tree_circ_distance);
+	PG_ADD_TEST(suite, test_tree_circ_distance_brute);
 	PG_ADD_TEST(suite, test_tree_circ_distance_threshold);
 }
@@ -694,34 +694,68 @@ static int lwtriangle_calculate_gbox_cartesian(LWTRIANGLE *triangle, GBOX *gbox)
 	return ptarray_calculate_gbox_cartesian( triangle->points, gbox );
 }
 
-static int
-lwellipse_calculate_gbox_cartesian(LWELLIPSE *ellipse, GBOX *gbox)
+/*
+ * Extent of one ordinate of a cubic bezier: the endpoints plus the
+ * roots of the derivative 3at^2 + 2bt + c that fall inside (0,1).
+ */
+static void
+bezier_ordinate_extent(double p0, double p1, double p2, double p3, double *min, double *max)
 {
-	if (!ellipse)
+	double a = -p0 + 3.0 * p1 - 3.0 * p2 + p3;
+	double b = 3.0 * p0 - 6.0 * p1 + 3.0 * p2;
+	double c = 3.0 * (p1 - p0);
+	double qa = 3.0 * a, qb = 2.0 * b;
+	double disc = qb * qb - 4.0 * qa * c;
+	double q, t[2];
+	int i, nroots = 0;
+
+	*min = FP_MIN(p0, p3);
+	*max = FP_MAX(p0, p3);
+
+	if (disc < 0)
+		return;
+
+	/* Numerically stable roots, also covers the degenerate qa == 0 case */
+	q = -0.5 * (qb + (qb < 0 ? -sqrt(disc) : sqrt(disc)));
+	if (q != 0.0)
+		t[nroots++] = c / q;
+	if (qa != 0.0)
+		t[nroots++] = q / qa;
+
+	for (i = 0; i < nroots; i++)
 	{
-		return LW_FAILURE;
+		double v;
+		if (!(t[i] > 0.0 && t[i] < 1.0))
+			continue;
+		v = ((a * t[i] + b) * t[i] + c) * t[i] + p0;
+		*min = FP_MIN(*min, v);
+		*max = FP_MAX(*max, v);
 	}
-	/* convert it to linestring  */
-	LWLINE *temp = lwellipse_get_spatialdata(ellipse, 72);
-
-	int res = lwline_calculate_gbox_cartesian(temp, gbox);
-	lwgeom_free((LWGEOM*)temp);
-	return res;
 }
 
 static int lwbezier_calculate_gbox_cartesian(LWBEZIER *bezier, GBOX *gbox)
 {
-	if (!bezier)
-	{
+	POINT4D p[4];
+	uint32_t i;
+
+	if (!bezier || !bezier->data || !bezier->data->points)
 		return LW_FAILURE;
-	}
-	
-	/* convert it to linestring  */
-	LWLINE *temp = lwbezier_linearize(bezier, 72);
+	if (bezier->data->points->npoints != 4)
+		return LW_FAILURE;
+
+	for (i = 0; i < 4; i++)
+		getPoint4d_p(bezier->data->points, i, &p[i]);
 
-	int res = lwline_calculate_gbox_cartesian((LWLINE *)temp, gbox);
-	lwline_free(temp);
-	return res;
+	/* Exact extent from the derivative roots, no linearization needed */
+	gbox->flags = lwflags(FLAGS_GET_Z(bezier->flags), FLAGS_GET_M(bezier->flags), 0);
+	bezier_ordinate_extent(p[0].x, p[1].x, p[2].x, p[3].x, &gbox->xmin, &gbox->xmax);
+	bezier_ordinate_extent(p[0].y, p[1].y, p[2].y, p[3].y, &gbox->ymin, &gbox->ymax);
+	if (FLAGS_GET_Z(bezier->flags))
+		bezier_ordinate_extent(p[0].z, p[1].z, p[2].z, p[3].z, &gbox->zmin, &gbox->zmax);
+	if (FLAGS_GET_M(bezier->flags))
+		bezier_ordinate_extent(p[0].m, p[1].m, p[2].m, p[3].m, &gbox->mmin, &gbox->mmax);
+
+	return LW_SUCCESS;
 }
 
 static int lwpoly_calculate_gbox_cartesian(LWPOLY *poly, GBOX *gbox)
@@ -119,6 +119,42 @@ gserialized_hash(const GSERIALIZED *g)
 		return gserialized1_hash(g);
 }
 
+/**
+* Read the stored validity of a #GSERIALIZED. Returns #LW_TRUE or
+* #LW_FALSE if a validity check result is stored, -1 otherwise.
+*/
+int gserialized_get_cached_valid(const GSERIALIZED *g)
+{
+	if (GFLAGS_GET_VERSION(g->gflags))
+		return gserialized2_get_cached_valid(g);
+	else
+		return -1;
+}
+
+/**
+* Read the stored hash of a #GSERIALIZED into hash. Returns
+* #LW_FAILURE if no hash is stored.
+*/
+int gserialized_get_cached_hash(const GSERIALIZED *g, int32_t *hash)
+{
+	if (GFLAGS_GET_VERSION(g->gflags))
+		return gserialized2_get_cached_hash(g, hash);
+	else
+		return LW_FAILURE;
+}
+
+/**
+* Store a validity check result and optionally the hash in a
+* #GSERIALIZED. Version 1 has no room for them and is returned as is.
+*/
+GSERIALIZED *gserialized_set_cached_checks(GSERIALIZED *g, int valid, int with_hash)
+{
+	if (GFLAGS_GET_VERSION(g->gflags))
+		return gserialized2_set_cached_checks(g, valid, with_hash);
+	else
+		return g;
+}
+
 /**
 * Extract the SRID from the serialized form (it is packed into
 * three bytes so this is a handy function).
@@ -232,6 +268,27 @@ size_t gserialized_from_lwgeom_size(const LWGEOM *geom)
 	return gserialized2_from_lwgeom_size(geom);
 }
 
+/**
+* Allocate a new compact #GSERIALIZED from an #LWGEOM, with coordinates
+* quantized to the given decimal precisions and delta encoded. Returns
+* NULL if the geometry type has no compact form.
+*/
+GSERIALIZED* gserialized_compact_from_lwgeom(LWGEOM *geom, int8_t prec_xy, int8_t prec_z, int8_t prec_m, size_t *size)
+{
+	return gserialized2_compact_from_lwgeom(geom, prec_xy, prec_z, prec_m, size);
+}
+
+/**
+* Check if a #GSERIALIZED is stored in the compact form.
+*/
+int gserialized_is_compact(const GSERIALIZED *g)
+{
+	if (GFLAGS_GET_VERSION(g->gflags))
+		return gserialized2_is_compact(g);
+	else
+		return LW_FALSE;
+}
+
 /**
 * Allocate a new #LWGEOM from a #GSERIALIZED. The resulting #LWGEOM will have coordinates
 * that are double aligned and suitable for direct reading using getPoint2d_cp
@@ -310,6 +367,7 @@ inline static int gserialized_cmp_srid(const GSERIALIZED *g1, const GSERIALIZED
 }
 
 /* ORDER BY hash(g), g::bytea, ST_SRID(g), hasz(g), hasm(g) */
+/* Compact ones sort like the plain geometry they decode to */
 int gserialized_cmp(const GSERIALIZED *g1, const GSERIALIZED *g2)
 {
 	GBOX box1 = {0}, box2 = {0};
@@ -323,17 +381,19 @@ int gserialized_cmp(const GSERIALIZED *g1, const GSERIALIZED *g2)
 	size_t bsz1 = sz1 - hsz1;
 	size_t bsz2 = sz2 - hsz2;
 	size_t bsz_min = bsz1 < bsz2 ? bsz1 : bsz2;
+	/* Compact data is only decoded once the header can not decide */
+	int has_compact = gserialized_is_compact(g1) || gserialized_is_compact(g2);
 
 	/* Equality fast path */
 	/* Return equality for perfect equality only */
 	int cmp_srid = gserialized_cmp_srid(g1, g2);
-	int cmp = memcmp(b1, b2, bsz_min);
+	int cmp = has_compact ? 0 : memcmp(b1, b2, bsz_min);
 	int g1hasz = gserialized_has_z(g1);
 	int g1hasm = gserialized_has_m(g1);
 	int g2hasz = gserialized_has_z(g2);
 	int g2hasm = gserialized_has_m(g2);
 
-	if (bsz1 == bsz2 && cmp_srid == 0 && cmp == 0 && g1hasz == g2hasz && g1hasm == g2hasm)
+	if (!has_compact && bsz1 == bsz2 && cmp_srid == 0 && cmp == 0 && g1hasz == g2hasz && g1hasm == g2hasm)
 		return 0;
 	else
 	{
@@ -362,6 +422,14 @@ int gserialized_cmp(const GSERIALIZED *g1, const GSERIALIZED *g2)
 				return -1;
 		}
 
+		/* Same fast path, on the plain form of the data */
+		if (has_compact)
+		{
+			cmp = gserialized2_cmp_data(g1, hsz1, g2, hsz2, &bsz1, &bsz2);
+			if (bsz1 == bsz2 && cmp_srid == 0 && cmp == 0 && g1hasz == g2hasz && g1hasm == g2hasm)
+				return 0;
+		}
+
 		/* Prefix comes before longer one. */
 		if (bsz1 != bsz2 && cmp == 0)
 		{
@@ -77,6 +77,26 @@ extern uint32_t gserialized_max_header_size(void);
 */
 extern int32_t gserialized_hash(const GSERIALIZED *g);
 
+/**
+* Read the stored validity of a #GSERIALIZED. Returns #LW_TRUE or
+* #LW_FALSE if a validity check result is stored, -1 otherwise.
+*/
+extern int gserialized_get_cached_valid(const GSERIALIZED *g);
+
+/**
+* Read the stored hash of a #GSERIALIZED into hash. Returns
+* #LW_FAILURE if no hash is stored.
+*/
+extern int gserialized_get_cached_hash(const GSERIALIZED *g, int32_t *hash);
+
+/**
+* Store a validity check result (#LW_TRUE, #LW_FALSE or -1 to forget it)
+* and optionally the hash in a #GSERIALIZED. If necessary a new
+* #GSERIALIZED will be allocated. Test that input != output before
+* freeing input.
+*/
+extern GSERIALIZED *gserialized_set_cached_checks(GSERIALIZED *g, int valid, int with_hash);
+
 /**
 * Extract the SRID from the serialized form (it is packed into
 * three bytes so this is a handy function).
@@ -147,6 +167,18 @@ GSERIALIZED *gserialized_from_lwgeom(LWGEOM *geom, size_t *size);
 */
 size_t gserialized_from_lwgeom_size(const LWGEOM *geom);
 
+/**
+* Allocate a new compact #GSERIALIZED from an #LWGEOM, with coordinates
+* quantized to the given decimal precisions and delta encoded. Returns
+* NULL if the geometry type has no compact form.
+*/
+GSERIALIZED* gserialized_compact_from_lwgeom(LWGEOM *geom, int8_t prec_xy, int8_t prec_z, int8_t prec_m, size_t *size);
+
+/**
+* Check if a #GSERIALIZED is stored in the compact form.
+*/
+int gserialized_is_compact(const GSERIALIZED *g);
+
 /**
 * Allocate a new #LWGEOM from a #GSERIALIZED. The resulting #LWGEOM will have coordinates
 * that are double aligned and suitable for direct reading using getPoint2d_cp
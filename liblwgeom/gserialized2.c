@@ -40,6 +40,9 @@
 *   <bbox-ymax>]
 *  ...
 *  data area
+*
+*  With G2FLAG_COMPACT set the data area is the uint32_t geometry type
+*  followed by the geometry in TWKB, without sizes, boxes or ids.
 */
 
 #include "liblwgeom_internal.h"
@@ -150,6 +153,11 @@ int gserialized2_has_bbox(const GSERIALIZED *g)
 	return G2FLAGS_GET_BBOX(g->gflags);
 }
 
+int gserialized2_is_compact(const GSERIALIZED *g)
+{
+	return G2FLAGS_GET_COMPACT(g->gflags);
+}
+
 int gserialized2_has_extended(const GSERIALIZED *g)
 {
 	return G2FLAGS_GET_EXTENDED(g->gflags);
@@ -219,6 +227,15 @@ void gserialized2_set_srid(GSERIALIZED *g, int32_t srid)
 	g->srid[0] = (srid & 0x001F0000) >> 16;
 	g->srid[1] = (srid & 0x0000FF00) >> 8;
 	g->srid[2] = (srid & 0x000000FF);
+
+	/* The SRID is part of the hash, so a stored one is stale now */
+	if (G2FLAGS_GET_EXTENDED(g->gflags))
+	{
+		uint64_t xflags = 0;
+		memcpy(&xflags, g->data, sizeof(uint64_t));
+		xflags &= ~((uint64_t)0xFFFFFFFF << G2FLAG_X_HASH_SHIFT | G2FLAG_X_HAS_HASH);
+		memcpy(g->data, &xflags, sizeof(uint64_t));
+	}
 }
 
 static size_t gserialized2_is_empty_recurse(const uint8_t *p, int *isempty);
@@ -253,6 +270,11 @@ int gserialized2_is_empty(const GSERIALIZED *g)
 {
 	int isempty = 0;
 	uint8_t *p = gserialized2_get_geometry_p(g);
+
+	/* TWKB flags emptiness in the metadata byte after the type byte */
+	if (G2FLAGS_GET_COMPACT(g->gflags))
+		return (p[sizeof(uint32_t) + 1] & 0x10) ? LW_TRUE : LW_FALSE;
+
 	gserialized2_is_empty_recurse(p, &isempty);
 	return isempty;
 }
@@ -265,11 +287,32 @@ int gserialized2_is_empty(const GSERIALIZED *g)
 /* pb = IN: secondary initval, OUT: secondary hash */
 void hashlittle2(const void *key, size_t length, uint32_t *pc, uint32_t *pb);
 
-int32_t
-gserialized2_hash(const GSERIALIZED *g1)
+static size_t gserialized2_from_any_size(const LWGEOM *geom);
+static size_t gserialized2_from_lwgeom_any(const LWGEOM *geom, uint8_t *buf);
+
+static int32_t
+gserialized2_hash_data(const GSERIALIZED *g1)
 {
 	int32_t hval;
 	int32_t pb = 0, pc = 0;
+
+	/* Hash what the plain form would hash, so equal geometries agree */
+	if (G2FLAGS_GET_COMPACT(g1->gflags))
+	{
+		/* Only the data area is written, straight into the buffer to hash */
+		LWGEOM *lwgeom = lwgeom_from_gserialized2(g1);
+		int32_t srid = gserialized2_get_srid(g1);
+		size_t bsz = sizeof(int) + gserialized2_from_any_size(lwgeom);
+		uint8_t *b = (uint8_t*)lwalloc(bsz);
+		memcpy(b, &srid, sizeof(int));
+		gserialized2_from_lwgeom_any(lwgeom, b + sizeof(int));
+		lwgeom_free(lwgeom);
+		hashlittle2(b, bsz, (uint32_t *)&pb, (uint32_t *)&pc);
+		lwfree(b);
+		hval = pb ^ pc;
+		return hval;
+	}
+
 	/* Point to just the type/coordinate part of buffer */
 	size_t hsz1 = gserialized2_header_size(g1);
 	uint8_t *b1 = (uint8_t *)g1 + hsz1;
@@ -291,6 +334,89 @@ gserialized2_hash(const GSERIALIZED *g1)
 	return hval;
 }
 
+int32_t
+gserialized2_hash(const GSERIALIZED *g1)
+{
+	int32_t hval;
+	if (gserialized2_get_cached_hash(g1, &hval) == LW_SUCCESS)
+		return hval;
+	return gserialized2_hash_data(g1);
+}
+
+int gserialized2_get_cached_valid(const GSERIALIZED *g)
+{
+	uint64_t xflags = 0;
+	if (!G2FLAGS_GET_EXTENDED(g->gflags))
+		return -1;
+	memcpy(&xflags, g->data, sizeof(uint64_t));
+	if (!(xflags & G2FLAG_X_CHECKED_VALID))
+		return -1;
+	return (xflags & G2FLAG_X_IS_VALID) ? LW_TRUE : LW_FALSE;
+}
+
+int gserialized2_get_cached_hash(const GSERIALIZED *g, int32_t *hash)
+{
+	uint64_t xflags = 0;
+	if (!G2FLAGS_GET_EXTENDED(g->gflags))
+		return LW_FAILURE;
+	memcpy(&xflags, g->data, sizeof(uint64_t));
+	if (!(xflags & G2FLAG_X_HAS_HASH))
+		return LW_FAILURE;
+	*hash = (int32_t)(uint32_t)(xflags >> G2FLAG_X_HASH_SHIFT);
+	return LW_SUCCESS;
+}
+
+GSERIALIZED *gserialized2_set_cached_checks(GSERIALIZED *g, int valid, int with_hash)
+{
+	uint64_t check_flags = G2FLAG_X_CHECKED_VALID | G2FLAG_X_IS_VALID | G2FLAG_X_HAS_HASH;
+	uint64_t xflags = 0;
+	size_t varsize_in = LWSIZE_GET(g->size);
+	GSERIALIZED *g_out = g;
+
+	if (G2FLAGS_GET_EXTENDED(g->gflags))
+		memcpy(&xflags, g->data, sizeof(uint64_t));
+
+	/* Drop the previous checks and hash, keep anything else */
+	xflags &= ~((uint64_t)0xFFFFFFFF << G2FLAG_X_HASH_SHIFT | check_flags);
+	if (valid >= 0)
+		xflags |= G2FLAG_X_CHECKED_VALID | (valid ? G2FLAG_X_IS_VALID : 0);
+	if (with_hash)
+	{
+		/* The hash skips the header, so adding the flags does not change it */
+		uint32_t hval = (uint32_t)gserialized2_hash_data(g);
+		xflags |= G2FLAG_X_HAS_HASH | (uint64_t)hval << G2FLAG_X_HASH_SHIFT;
+	}
+
+	/* Nothing to store and no flags word to clear */
+	if (!xflags && !G2FLAGS_GET_EXTENDED(g->gflags))
+		return g;
+
+	/* Make room for the flags word just after the header */
+	if (!G2FLAGS_GET_EXTENDED(g->gflags))
+	{
+		size_t varsize_out = varsize_in + sizeof(uint64_t);
+		g_out = (GSERIALIZED*)lwalloc(varsize_out);
+		memcpy(g_out, g, 8);
+		memcpy(g_out->data + sizeof(uint64_t), g->data, varsize_in - 8);
+		G2FLAGS_SET_EXTENDED(g_out->gflags, 1);
+		LWSIZE_SET(g_out->size, varsize_out);
+	}
+	/* No flags left, the flags word goes away */
+	else if (!xflags)
+	{
+		size_t varsize_out = varsize_in - sizeof(uint64_t);
+		g_out = (GSERIALIZED*)lwalloc(varsize_out);
+		memcpy(g_out, g, 8);
+		memcpy(g_out->data, g->data + sizeof(uint64_t), varsize_out - 8);
+		G2FLAGS_SET_EXTENDED(g_out->gflags, 0);
+		LWSIZE_SET(g_out->size, varsize_out);
+		return g_out;
+	}
+
+	memcpy(g_out->data, &xflags, sizeof(uint64_t));
+	return g_out;
+}
+
 
 const float * gserialized2_get_float_box_p(const GSERIALIZED *g, size_t *ndims)
 {
@@ -366,7 +492,8 @@ gserialized2_peek_gbox_p(const GSERIALIZED *g, GBOX *gbox)
 	int32_t *iptr = (int32_t *)(geometry_start);
 
 	/* Peeking doesn't help if you already have a box or are geodetic */
-	if (G2FLAGS_GET_GEODETIC(g->gflags) || G2FLAGS_GET_BBOX(g->gflags))
+	/* and cannot be done on the varints of the compact form */
+	if (G2FLAGS_GET_GEODETIC(g->gflags) || G2FLAGS_GET_BBOX(g->gflags) || G2FLAGS_GET_COMPACT(g->gflags))
 	{
 		return LW_FAILURE;
 	}
@@ -550,6 +677,25 @@ gserialized2_peek_first_point(const GSERIALIZED *g, POINT4D *out_point)
 {
 	uint8_t *geometry_start = gserialized2_get_geometry_p(g);
 
+	/* Varints have to be decoded, a point is cheap to */
+	if (G2FLAGS_GET_COMPACT(g->gflags))
+	{
+		LWGEOM *lwgeom;
+		int ret = LW_FAILURE;
+
+		if (gserialized2_get_type(g) != POINTTYPE)
+		{
+			lwerror("%s is currently not implemented for type %d", __func__, gserialized2_get_type(g));
+			return LW_FAILURE;
+		}
+
+		lwgeom = lwgeom_from_gserialized2(g);
+		if (!lwgeom_is_empty(lwgeom))
+			ret = getPoint4d_p(((LWPOINT *)lwgeom)->point, 0, out_point);
+		lwgeom_free(lwgeom);
+		return ret;
+	}
+
 	uint32_t isEmpty = (((uint32_t *)geometry_start)[1]) == 0;
 	if (isEmpty)
 	{
@@ -1193,9 +1339,8 @@ static size_t gserialized2_from_extended_flags(lwflags_t lwflags, uint8_t *buf)
 		if (FLAGS_GET_SOLID(lwflags))
 			xflags |= G2FLAG_X_SOLID;
 
-		// G2FLAG_X_CHECKED_VALID
-		// G2FLAG_X_IS_VALID
-		// G2FLAG_X_HAS_HASH
+		/* Validity and hash are not carried by LWGEOM, they are */
+		/* only stored by gserialized2_set_cached_checks */
 
 		memcpy(buf, &xflags, sizeof(uint64_t));
 		return sizeof(uint64_t);
@@ -1276,8 +1421,6 @@ GSERIALIZED* gserialized2_from_lwgeom(LWGEOM *geom, size_t *size)
 	ptr = (uint8_t*)lwalloc(expected_size);
 	g = (GSERIALIZED*)(ptr);
 
-	/* Set the SRID! */
-	gserialized2_set_srid(g, geom->srid);
 	/*
 	** We are aping PgSQL code here, PostGIS code should use
 	** VARSIZE to set this for real.
@@ -1285,6 +1428,9 @@ GSERIALIZED* gserialized2_from_lwgeom(LWGEOM *geom, size_t *size)
 	LWSIZE_SET(g->size, expected_size);
 	g->gflags = lwflags_get_g2flags(geom->flags);
 
+	/* Set the SRID! (flags first, as this peeks at them) */
+	gserialized2_set_srid(g, geom->srid);
+
 	/* Move write head past size, srid and flags. */
 	ptr += 8;
 
@@ -1308,6 +1454,245 @@ GSERIALIZED* gserialized2_from_lwgeom(LWGEOM *geom, size_t *size)
 	return g;
 }
 
+/* TWKB only knows the simple features types */
+static int gserialized2_compact_supported(const LWGEOM *geom)
+{
+	uint32_t i;
+
+	switch (geom->type)
+	{
+	case POINTTYPE:
+	case LINETYPE:
+	case POLYGONTYPE:
+		return LW_TRUE;
+	case MULTIPOINTTYPE:
+	case MULTILINETYPE:
+	case MULTIPOLYGONTYPE:
+	case COLLECTIONTYPE:
+	{
+		const LWCOLLECTION *col = (const LWCOLLECTION *)geom;
+		for (i = 0; i < col->ngeoms; i++)
+		{
+			if (!gserialized2_compact_supported(col->geoms[i]))
+				return LW_FALSE;
+		}
+		return LW_TRUE;
+	}
+	default:
+		return LW_FALSE;
+	}
+}
+
+GSERIALIZED* gserialized2_compact_from_lwgeom(LWGEOM *geom, int8_t prec_xy, int8_t prec_z, int8_t prec_m, size_t *size)
+{
+	lwvarlena_t *twkb;
+	LWGEOM *quantized;
+	GBOX gbox;
+	lwflags_t lwflags = geom->flags;
+	size_t twkb_size, expected_size;
+	uint32_t type = geom->type;
+	uint8_t *ptr;
+	GSERIALIZED *g;
+
+	if (FLAGS_GET_GEODETIC(geom->flags) || !gserialized2_compact_supported(geom))
+		return NULL;
+
+	twkb = lwgeom_to_twkb(geom, 0, prec_xy, prec_z, prec_m);
+	twkb_size = LWSIZE_GET(twkb->size) - LWVARHDRSZ;
+
+	/* The box has to cover the rounded vertices, not the input ones */
+	quantized = lwgeom_from_twkb((uint8_t *)twkb->data, twkb_size, LW_PARSER_CHECK_NONE);
+	FLAGS_SET_BBOX(lwflags, lwgeom_calculate_gbox(quantized, &gbox) == LW_SUCCESS);
+	FLAGS_SET_SOLID(lwflags, 0);
+	gbox.flags = lwflags;
+	lwgeom_free(quantized);
+
+	expected_size = 8 + sizeof(uint32_t) + twkb_size;
+	if (FLAGS_GET_BBOX(lwflags))
+		expected_size += gbox_serialized_size(lwflags);
+
+	ptr = (uint8_t*)lwalloc(expected_size);
+	g = (GSERIALIZED*)(ptr);
+	LWSIZE_SET(g->size, expected_size);
+	g->gflags = lwflags_get_g2flags(lwflags);
+	G2FLAGS_SET_COMPACT(g->gflags, 1);
+	gserialized2_set_srid(g, geom->srid);
+	ptr += 8;
+
+	if (FLAGS_GET_BBOX(lwflags))
+		ptr += gserialized2_from_gbox(&gbox, ptr);
+
+	memcpy(ptr, &type, sizeof(uint32_t));
+	ptr += sizeof(uint32_t);
+	memcpy(ptr, twkb->data, twkb_size);
+	ptr += twkb_size;
+	lwfree(twkb);
+
+	assert(expected_size == (size_t)(ptr - (uint8_t*)g));
+	if (size)
+		*size = expected_size;
+
+	return g;
+}
+
+/* A piece of a plain data area, ptr is NULL for a uint32_t held in word */
+typedef struct
+{
+	const uint8_t *ptr;
+	size_t len;
+	uint32_t word;
+} G2RANGE;
+
+typedef struct
+{
+	G2RANGE *ranges;
+	uint32_t nranges;
+	uint32_t maxranges;
+	size_t size;
+} G2RANGES;
+
+static void g2ranges_add(G2RANGES *r, const uint8_t *ptr, size_t len, uint32_t word)
+{
+	if (!len)
+		return;
+	if (r->nranges == r->maxranges)
+	{
+		r->maxranges = r->maxranges ? 2 * r->maxranges : 16;
+		r->ranges = (G2RANGE*)lwrealloc(r->ranges, sizeof(G2RANGE) * r->maxranges);
+	}
+	r->ranges[r->nranges].ptr = ptr;
+	r->ranges[r->nranges].len = len;
+	r->ranges[r->nranges].word = word;
+	r->nranges++;
+	r->size += len;
+}
+
+/*
+* Pieces of the data area gserialized2_from_lwgeom_any would write, in order,
+* pointing at the ordinates instead of copying them. Only the types a compact
+* serialization can hold are handled.
+*/
+static void g2ranges_add_lwgeom(G2RANGES *r, const LWGEOM *geom)
+{
+	uint32_t i;
+
+	switch (geom->type)
+	{
+	case POINTTYPE:
+	{
+		const POINTARRAY *pa = ((const LWPOINT *)geom)->point;
+		g2ranges_add(r, NULL, sizeof(uint32_t), POINTTYPE);
+		g2ranges_add(r, NULL, sizeof(uint32_t), pa->npoints);
+		if (pa->npoints > 0)
+			g2ranges_add(r, getPoint_internal(pa, 0), ptarray_point_size(pa), 0);
+		return;
+	}
+	case LINETYPE:
+	{
+		const POINTARRAY *pa = ((const LWLINE *)geom)->points;
+		g2ranges_add(r, NULL, sizeof(uint32_t), LINETYPE);
+		g2ranges_add(r, NULL, sizeof(uint32_t), pa->npoints);
+		if (pa->npoints > 0)
+			g2ranges_add(r, getPoint_internal(pa, 0), (size_t)pa->npoints * ptarray_point_size(pa), 0);
+		return;
+	}
+	case POLYGONTYPE:
+	{
+		const LWPOLY *poly = (const LWPOLY *)geom;
+		size_t ptsize = sizeof(double) * FLAGS_NDIMS(poly->flags);
+		g2ranges_add(r, NULL, sizeof(uint32_t), POLYGONTYPE);
+		g2ranges_add(r, NULL, sizeof(uint32_t), poly->nrings);
+		for (i = 0; i < poly->nrings; i++)
+			g2ranges_add(r, NULL, sizeof(uint32_t), poly->rings[i]->npoints);
+		if (poly->nrings % 2)
+			g2ranges_add(r, NULL, sizeof(uint32_t), 0);
+		for (i = 0; i < poly->nrings; i++)
+		{
+			const POINTARRAY *pa = poly->rings[i];
+			if (pa->npoints > 0)
+				g2ranges_add(r, getPoint_internal(pa, 0), (size_t)pa->npoints * ptsize, 0);
+		}
+		return;
+	}
+	case MULTIPOINTTYPE:
+	case MULTILINETYPE:
+	case MULTIPOLYGONTYPE:
+	case COLLECTIONTYPE:
+	{
+		const LWCOLLECTION *col = (const LWCOLLECTION *)geom;
+		g2ranges_add(r, NULL, sizeof(uint32_t), col->type);
+		g2ranges_add(r, NULL, sizeof(uint32_t), col->ngeoms);
+		for (i = 0; i < col->ngeoms; i++)
+			g2ranges_add_lwgeom(r, col->geoms[i]);
+		return;
+	}
+	default:
+		lwerror("%s: Unsupported type: %s", __func__, lwtype_name(geom->type));
+	}
+}
+
+/* Returns the decoded geometry the ranges point into, NULL for a plain input */
+static LWGEOM *g2ranges_add_gserialized(G2RANGES *r, const GSERIALIZED *g, size_t hsz)
+{
+	LWGEOM *lwgeom;
+
+	if (!G2FLAGS_GET_VERSION(g->gflags) || !G2FLAGS_GET_COMPACT(g->gflags))
+	{
+		g2ranges_add(r, (const uint8_t *)g + hsz, LWSIZE_GET(g->size) - hsz, 0);
+		return NULL;
+	}
+
+	lwgeom = lwgeom_from_gserialized2(g);
+	g2ranges_add_lwgeom(r, lwgeom);
+	return lwgeom;
+}
+
+int gserialized2_cmp_data(const GSERIALIZED *g1, size_t hsz1, const GSERIALIZED *g2, size_t hsz2, size_t *bsz1, size_t *bsz2)
+{
+	G2RANGES r1 = {0}, r2 = {0};
+	LWGEOM *lwgeom1 = g2ranges_add_gserialized(&r1, g1, hsz1);
+	LWGEOM *lwgeom2 = g2ranges_add_gserialized(&r2, g2, hsz2);
+	uint32_t i1 = 0, i2 = 0;
+	size_t o1 = 0, o2 = 0;
+	int cmp = 0;
+
+	/* memcmp over the shorter one, walking both lists of pieces in step */
+	while (!cmp && i1 < r1.nranges && i2 < r2.nranges)
+	{
+		const G2RANGE *p1 = &r1.ranges[i1];
+		const G2RANGE *p2 = &r2.ranges[i2];
+		size_t len = FP_MIN(p1->len - o1, p2->len - o2);
+
+		cmp = memcmp((p1->ptr ? p1->ptr : (const uint8_t *)&p1->word) + o1,
+			     (p2->ptr ? p2->ptr : (const uint8_t *)&p2->word) + o2,
+			     len);
+		o1 += len;
+		o2 += len;
+		if (o1 == p1->len)
+		{
+			i1++;
+			o1 = 0;
+		}
+		if (o2 == p2->len)
+		{
+			i2++;
+			o2 = 0;
+		}
+	}
+
+	*bsz1 = r1.size;
+	*bsz2 = r2.size;
+	if (r1.ranges)
+		lwfree(r1.ranges);
+	if (r2.ranges)
+		lwfree(r2.ranges);
+	if (lwgeom1)
+		lwgeom_free(lwgeom1);
+	if (lwgeom2)
+		lwgeom_free(lwgeom2);
+	return cmp;
+}
+
 // xxxx continue reviewing extended flags content from here
 
 /***********************************************************************
@@ -1703,7 +2088,17 @@ LWGEOM* lwgeom_from_gserialized2(const GSERIALIZED *g)
 	if (FLAGS_GET_BBOX(lwflags))
 		data_ptr += gbox_serialized_size(lwflags);
 
-	lwgeom = lwgeom_from_gserialized2_buffer(data_ptr, lwflags, &size, srid);
+	/* Decode the TWKB following the type */
+	if (G2FLAGS_GET_COMPACT(g->gflags))
+	{
+		data_ptr += sizeof(uint32_t);
+		size = LWSIZE_GET(g->size) - (data_ptr - (uint8_t*)g);
+		lwgeom = lwgeom_from_twkb(data_ptr, size, LW_PARSER_CHECK_NONE);
+		if (lwgeom)
+			lwgeom_set_srid(lwgeom, srid);
+	}
+	else
+		lwgeom = lwgeom_from_gserialized2_buffer(data_ptr, lwflags, &size, srid);
 
 	if (!lwgeom)
 		lwerror("%s: unable create geometry", __func__); /* Ooops! */
@@ -1833,7 +2228,7 @@ GSERIALIZED* gserialized2_drop_gbox(GSERIALIZED *g)
 		/* Advance past box */
 		inptr += box_size;
 		/* Copy parts after the box into place */
-		memcpy(outptr, inptr, g_out_size - 8);
+		memcpy(outptr, inptr, g_out_size - (outptr - (uint8_t*)g_out));
 		G2FLAGS_SET_BBOX(g_out->gflags, 0);
 		LWSIZE_SET(g_out->size, g_out_size);
 	}
@@ -6,17 +6,20 @@
 #define G2FLAG_BBOX      0x04
 #define G2FLAG_GEODETIC  0x08
 #define G2FLAG_EXTENDED  0x10
-#define G2FLAG_RESERVED1 0x20 /* RESERVED FOR FUTURE USES */
+#define G2FLAG_COMPACT   0x20 /* Data area is quantized TWKB, see gserialized2_compact_from_lwgeom */
 #define G2FLAG_VER_0     0x40
 #define G2FLAG_RESERVED2 0x80 /* RESERVED FOR FUTURE VERSIONS */
 
 /**
 * Macros for the extended 'flags' uint64_t.
+* When G2FLAG_X_HAS_HASH is set the upper 32 bits hold the
+* value of gserialized2_hash() for the geometry.
 */
 #define G2FLAG_X_SOLID            0x00000001
-#define G2FLAG_X_CHECKED_VALID    0x00000002 // To Be Implemented?
-#define G2FLAG_X_IS_VALID         0x00000004 // To Be Implemented?
-#define G2FLAG_X_HAS_HASH         0x00000008 // To Be Implemented?
+#define G2FLAG_X_CHECKED_VALID    0x00000002
+#define G2FLAG_X_IS_VALID         0x00000004
+#define G2FLAG_X_HAS_HASH         0x00000008
+#define G2FLAG_X_HASH_SHIFT       32
 
 #define G2FLAGS_GET_VERSION(gflags)  (((gflags) & G2FLAG_VER_0)>>6)
 #define G2FLAGS_GET_Z(gflags)         ((gflags) & G2FLAG_Z)
@@ -24,7 +27,7 @@
 #define G2FLAGS_GET_BBOX(gflags)     (((gflags) & G2FLAG_BBOX)>>2)
 #define G2FLAGS_GET_GEODETIC(gflags) (((gflags) & G2FLAG_GEODETIC)>>3)
 #define G2FLAGS_GET_EXTENDED(gflags) (((gflags) & G2FLAG_EXTENDED)>>4)
-#define G2FLAGS_GET_UNUSED(gflags)   (((gflags) & G2FLAG_UNUSED)>>5)
+#define G2FLAGS_GET_COMPACT(gflags)  (((gflags) & G2FLAG_COMPACT)>>5)
 
 #define G2FLAGS_SET_Z(gflags, value) ((gflags) = (value) ? ((gflags) | G2FLAG_Z) : ((gflags) & ~G2FLAG_Z))
 #define G2FLAGS_SET_M(gflags, value) ((gflags) = (value) ? ((gflags) | G2FLAG_M) : ((gflags) & ~G2FLAG_M))
@@ -32,6 +35,7 @@
 #define G2FLAGS_SET_GEODETIC(gflags, value) ((gflags) = (value) ? ((gflags) | G2FLAG_GEODETIC) : ((gflags) & ~G2FLAG_GEODETIC))
 #define G2FLAGS_SET_EXTENDED(gflags, value) ((gflags) = (value) ? ((gflags) | G2FLAG_EXTENDED) : ((gflags) & ~G2FLAG_EXTENDED))
 #define G2FLAGS_SET_VERSION(gflags, value) ((gflags) = (value) ? ((gflags) | G2FLAG_VER_0) : ((gflags) & ~G2FLAG_VER_0))
+#define G2FLAGS_SET_COMPACT(gflags, value) ((gflags) = (value) ? ((gflags) | G2FLAG_COMPACT) : ((gflags) & ~G2FLAG_COMPACT))
 
 #define G2FLAGS_NDIMS(gflags) (2 + G2FLAGS_GET_Z(gflags) + G2FLAGS_GET_M(gflags))
 #define G2FLAGS_GET_ZM(gflags) (G2FLAGS_GET_M(gflags) + G2FLAGS_GET_Z(gflags) * 2)
@@ -95,6 +99,26 @@ uint32_t gserialized2_max_header_size(void);
 */
 int32_t gserialized2_hash(const GSERIALIZED *g);
 
+/**
+* Read the stored validity of a #GSERIALIZED. Returns #LW_TRUE or
+* #LW_FALSE if a validity check result is stored, -1 otherwise.
+*/
+int gserialized2_get_cached_valid(const GSERIALIZED *g);
+
+/**
+* Read the stored hash of a #GSERIALIZED into hash. Returns
+* #LW_FAILURE if no hash is stored.
+*/
+int gserialized2_get_cached_hash(const GSERIALIZED *g, int32_t *hash);
+
+/**
+* Store a validity check result (#LW_TRUE, #LW_FALSE or -1 to forget it)
+* and optionally the hash in the extended flags of a #GSERIALIZED.
+* If necessary a new #GSERIALIZED will be allocated. Test
+* that input != output before freeing input.
+*/
+GSERIALIZED *gserialized2_set_cached_checks(GSERIALIZED *g, int valid, int with_hash);
+
 /**
 * Extract the SRID from the serialized form (it is packed into
 * three bytes so this is a handy function).
@@ -159,6 +183,29 @@ GSERIALIZED* gserialized2_from_lwgeom(LWGEOM *geom, size_t *size);
 */
 size_t gserialized2_from_lwgeom_size(const LWGEOM *geom);
 
+/**
+* Allocate a new compact #GSERIALIZED from an #LWGEOM. The header and the
+* bounding box are as usual, the data area holds the type followed by the
+* geometry as TWKB with the given precisions, so coordinates are quantized
+* and delta encoded. Returns NULL for types TWKB cannot hold (curves,
+* surfaces) and for geodetic input.
+*/
+GSERIALIZED* gserialized2_compact_from_lwgeom(LWGEOM *geom, int8_t prec_xy, int8_t prec_z, int8_t prec_m, size_t *size);
+
+/**
+* Check if a #GSERIALIZED data area is in the compact (TWKB) form.
+*/
+int gserialized2_is_compact(const GSERIALIZED *g);
+
+/**
+* Compare the data areas of two serializations as they are, or would be in
+* the plain form for compact ones, memcmp style over the shorter one. The
+* plain sizes are returned in bsz1 and bsz2. hsz1 and hsz2 are the header
+* sizes, used for plain inputs only. Compact inputs are decoded, but not
+* serialized again: the comparison reads their ordinates in place.
+*/
+int gserialized2_cmp_data(const GSERIALIZED *g1, size_t hsz1, const GSERIALIZED *g2, size_t hsz2, size_t *bsz1, size_t *bsz2);
+
 /**
 * Allocate a new #LWGEOM from a #GSERIALIZED. The resulting #LWGEOM will have coordinates
 * that are double aligned and suitable for direct reading using getPoint2d_cp
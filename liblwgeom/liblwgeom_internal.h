@@ -281,7 +281,15 @@ double lwbezier_area(const LWBEZIER *bezier, const POINT2D *pt);
  * 
  */
 LWLINE* lwellipse_get_spatialdata(LWELLIPSE* ellipse, unsigned int);
-LWLINE* lwbezier_linearize(LWBEZIER * bezier, unsigned int);
+LWLINE* lwbezier_linearize(const LWBEZIER *bezier, double tol, LW_LINEARIZE_TOLERANCE_TYPE tolerance_type, int flags);
+
+/**
+ * 椭圆弧解析计算, 无需拟合
+ */
+int lwellipse_calculate_gbox_cartesian(const LWELLIPSE *ellipse, GBOX *gbox);
+int lwellipse_contains_point(const LWELLIPSE *ellipse, const POINT2D *pt);
+double lwellipse_closest_point(const LWELLIPSE *ellipse, const POINT2D *pt, int farthest, POINT2D *closest);
+int lwellipse_intersects_gbox(const LWELLIPSE *ellipse, const GBOX *box);
 
 /**
 * Pull a #GBOX from the header of a #GSERIALIZED, if one is available. If
@@ -29,43 +29,178 @@ uint32_t lwbezier_count_vertices(LWBEZIER *beizer)
 	return beizer->data->points->npoints;
 }
 
-POINT2D
-bezier_interpolation_func(float t, POINT2D *points, int count)
+/* Maximum subdivision depth of the adaptive flattening (2^16 segments) */
+#define BEZIER_MAX_DEPTH 16
+
+/* Control points of a cubic span and its subdivision depth */
+typedef struct
+{
+	POINT4D p[4];
+	int depth;
+} BEZIER_SPAN;
+
+static inline void
+bezier_mid(const POINT4D *a, const POINT4D *b, POINT4D *out)
 {
-	assert(count > 0);
+	out->x = (a->x + b->x) * 0.5;
+	out->y = (a->y + b->y) * 0.5;
+	out->z = (a->z + b->z) * 0.5;
+	out->m = (a->m + b->m) * 0.5;
+}
+
+/* Split a span at t = 0.5 with de Casteljau */
+static void
+bezier_split(const BEZIER_SPAN *in, BEZIER_SPAN *left, BEZIER_SPAN *right)
+{
+	POINT4D p01, p12, p23, p012, p123, mid;
+
+	bezier_mid(&in->p[0], &in->p[1], &p01);
+	bezier_mid(&in->p[1], &in->p[2], &p12);
+	bezier_mid(&in->p[2], &in->p[3], &p23);
+	bezier_mid(&p01, &p12, &p012);
+	bezier_mid(&p12, &p23, &p123);
+	bezier_mid(&p012, &p123, &mid);
+
+	left->p[0] = in->p[0];
+	left->p[1] = p01;
+	left->p[2] = p012;
+	left->p[3] = mid;
+	right->p[0] = mid;
+	right->p[1] = p123;
+	right->p[2] = p23;
+	right->p[3] = in->p[3];
+	left->depth = right->depth = in->depth + 1;
+}
+
+/*
+ * Upper bound of the squared distance between a span and its chord,
+ * times 16 (Hain's flatness criterion).
+ */
+static double
+bezier_flatness(const BEZIER_SPAN *s)
+{
+	double ux = 3.0 * s->p[1].x - 2.0 * s->p[0].x - s->p[3].x;
+	double uy = 3.0 * s->p[1].y - 2.0 * s->p[0].y - s->p[3].y;
+	double vx = 3.0 * s->p[2].x - s->p[0].x - 2.0 * s->p[3].x;
+	double vy = 3.0 * s->p[2].y - s->p[0].y - 2.0 * s->p[3].y;
+
+	return FP_MAX(ux * ux, vx * vx) + FP_MAX(uy * uy, vy * vy);
+}
+
+/* Angle between two planar vectors, zero when either is degenerate */
+static double
+bezier_turn(double ax, double ay, double bx, double by)
+{
+	if ((ax == 0.0 && ay == 0.0) || (bx == 0.0 && by == 0.0))
+		return 0.0;
+	return fabs(atan2(ax * by - ay * bx, ax * bx + ay * by));
+}
 
-	POINT2D *tmp_points = (POINT2D*)malloc(sizeof(POINT2D) * count);
-	for (int i = 1; i < count; ++i)
+/*
+ * Total turning of the control polygon, which bounds the turning of
+ * the curve itself.
+ */
+static double
+bezier_turning(const POINT4D *p)
+{
+	double d[3][2];
+	int i;
+
+	for (i = 0; i < 3; i++)
 	{
-		for (int j = 0; j < count - i; ++j)
-		{
-			if (i == 1)
-			{
-				tmp_points[j].x = (float)(points[j].x * (1 - t) + points[j + 1].x * t);
-				tmp_points[j].y = (float)(points[j].y * (1 - t) + points[j + 1].y * t);
-				continue;
-			}
-			tmp_points[j].x = (float)(tmp_points[j].x * (1 - t) + tmp_points[j + 1].x * t);
-			tmp_points[j].y = (float)(tmp_points[j].y * (1 - t) + tmp_points[j + 1].y * t);
-		}
+		d[i][0] = p[i + 1].x - p[i].x;
+		d[i][1] = p[i + 1].y - p[i].y;
 	}
-	POINT2D res;
-	res.x = tmp_points[0].x;
-	res.y = tmp_points[0].y;
-	free(tmp_points);
-	return res;
+	return bezier_turn(d[0][0], d[0][1], d[1][0], d[1][1]) +
+	       bezier_turn(d[1][0], d[1][1], d[2][0], d[2][1]);
 }
 
-void
-draw_bezier_curves(POINT2D *points, int count, POINT2D *out_points, int out_count)
+/* Power basis coefficients, P(t) = a t^3 + b t^2 + c t + P0 */
+static void
+bezier_coefficients(const POINT4D *p, POINT4D *a, POINT4D *b, POINT4D *c)
+{
+	a->x = -p[0].x + 3.0 * p[1].x - 3.0 * p[2].x + p[3].x;
+	a->y = -p[0].y + 3.0 * p[1].y - 3.0 * p[2].y + p[3].y;
+	a->z = -p[0].z + 3.0 * p[1].z - 3.0 * p[2].z + p[3].z;
+	a->m = -p[0].m + 3.0 * p[1].m - 3.0 * p[2].m + p[3].m;
+	b->x = 3.0 * p[0].x - 6.0 * p[1].x + 3.0 * p[2].x;
+	b->y = 3.0 * p[0].y - 6.0 * p[1].y + 3.0 * p[2].y;
+	b->z = 3.0 * p[0].z - 6.0 * p[1].z + 3.0 * p[2].z;
+	b->m = 3.0 * p[0].m - 6.0 * p[1].m + 3.0 * p[2].m;
+	c->x = 3.0 * (p[1].x - p[0].x);
+	c->y = 3.0 * (p[1].y - p[0].y);
+	c->z = 3.0 * (p[1].z - p[0].z);
+	c->m = 3.0 * (p[1].m - p[0].m);
+}
+
+/* Emit n uniform segments by forward differencing, endpoints exact */
+static void
+bezier_stroke_uniform(const POINT4D *p, uint32_t n, POINTARRAY *pa)
+{
+	POINT4D a, b, c, f, df, d2f, d3f;
+	double h = 1.0 / n, h2 = h * h, h3 = h2 * h;
+	uint32_t i;
+
+	bezier_coefficients(p, &a, &b, &c);
+
+	f = p[0];
+	df.x = a.x * h3 + b.x * h2 + c.x * h;
+	df.y = a.y * h3 + b.y * h2 + c.y * h;
+	df.z = a.z * h3 + b.z * h2 + c.z * h;
+	df.m = a.m * h3 + b.m * h2 + c.m * h;
+	d2f.x = 6.0 * a.x * h3 + 2.0 * b.x * h2;
+	d2f.y = 6.0 * a.y * h3 + 2.0 * b.y * h2;
+	d2f.z = 6.0 * a.z * h3 + 2.0 * b.z * h2;
+	d2f.m = 6.0 * a.m * h3 + 2.0 * b.m * h2;
+	d3f.x = 6.0 * a.x * h3;
+	d3f.y = 6.0 * a.y * h3;
+	d3f.z = 6.0 * a.z * h3;
+	d3f.m = 6.0 * a.m * h3;
+
+	ptarray_append_point(pa, &p[0], LW_TRUE);
+	for (i = 1; i < n; i++)
+	{
+		f.x += df.x; f.y += df.y; f.z += df.z; f.m += df.m;
+		df.x += d2f.x; df.y += d2f.y; df.z += d2f.z; df.m += d2f.m;
+		d2f.x += d3f.x; d2f.y += d3f.y; d2f.z += d3f.z; d2f.m += d3f.m;
+		ptarray_append_point(pa, &f, LW_TRUE);
+	}
+	ptarray_append_point(pa, &p[3], LW_TRUE);
+}
+
+/*
+ * Emit the subdivision of a curve until every span passes the
+ * tolerance, depth first so that spans come out in curve order.
+ */
+static void
+bezier_stroke_adaptive(const POINT4D *p, double tol, LW_LINEARIZE_TOLERANCE_TYPE type, POINTARRAY *pa)
 {
-	float step = 1.0 / out_count;
-	float t = 0;
-	for (int i = 0; i < out_count; i++)
+	BEZIER_SPAN stack[BEZIER_MAX_DEPTH + 1];
+	BEZIER_SPAN span;
+	double limit = 16.0 * tol * tol;
+	int n = 1, flat;
+
+	memcpy(stack[0].p, p, sizeof(POINT4D) * 4);
+	stack[0].depth = 0;
+
+	ptarray_append_point(pa, &p[0], LW_TRUE);
+	while (n > 0)
 	{
-		POINT2D temp_point = bezier_interpolation_func(t, points, count); // 计算插值点
-		t += step;
-		out_points[i] = temp_point;
+		span = stack[--n];
+		if (type == LW_LINEARIZE_TOLERANCE_TYPE_MAX_DEVIATION)
+			flat = bezier_flatness(&span) <= limit;
+		else
+			flat = bezier_turning(span.p) <= tol;
+
+		if (flat || span.depth >= BEZIER_MAX_DEPTH)
+		{
+			ptarray_append_point(pa, &span.p[3], LW_TRUE);
+			continue;
+		}
+
+		/* Right half goes below the left one, which is processed first */
+		bezier_split(&span, &stack[n + 1], &stack[n]);
+		n += 2;
 	}
 }
 
@@ -73,38 +208,66 @@ draw_bezier_curves(POINT2D *points, int count, POINT2D *out_points, int out_coun
  * @brief 贝塞尔曲线拟合
  *
  * @param bezier 贝塞尔曲线
- * @param seg  段数
- * @return LWLINE* 拟合后的线段
+ * @param tol tolerance, semantic driven by tolerance_type
+ * @param tolerance_type see LW_LINEARIZE_TOLERANCE_TYPE
+ * @param flags see flags in lwarc_linearize, unused for beziers
+ * @return LWLINE* 拟合后的线段, 包含两个端点
  */
 LWLINE *
-lwbezier_linearize(LWBEZIER *bezier, unsigned int seg)
+lwbezier_linearize(const LWBEZIER *bezier, double tol,
+                   LW_LINEARIZE_TOLERANCE_TYPE tolerance_type,
+                   int flags)
 {
-	// 拟合后的点
-	POINT2D *output_points = (POINT2D*)malloc(sizeof(POINT2D) * seg);
+	POINTARRAY *pa;
+	POINT4D p[4];
+	uint32_t i, n;
+	double segs;
+	int perQuad;
 
-	// 构造初始点
-	int npoints = bezier->data->points->npoints;
-	POINT2D *source_point = (POINT2D*)malloc(sizeof(POINT2D) * npoints);
+	(void)flags;
+	if (!bezier || !bezier->data || !bezier->data->points || bezier->data->points->npoints != 4)
+	{
+		lwerror("lwbezier_linearize: invalid bezier3");
+		return NULL;
+	}
+
+	for (i = 0; i < 4; i++)
+		getPoint4d_p(bezier->data->points, i, &p[i]);
 
-	for (int i = 0; i < npoints; i++)
+	pa = ptarray_construct_empty(FLAGS_GET_Z(bezier->flags), FLAGS_GET_M(bezier->flags), 32);
+
+	switch (tolerance_type)
 	{
-		POINT4D pt;
-		getPoint4d_p(bezier->data->points, i, &pt);
-		source_point[i].x = pt.x;
-		source_point[i].y = pt.y;
+	case LW_LINEARIZE_TOLERANCE_TYPE_SEGS_PER_QUAD:
+		perQuad = rint(tol);
+		if (perQuad != tol || perQuad < 1)
+		{
+			lwerror("lwbezier_linearize: segments per quadrant must be a positive integer value, got %.15g", tol);
+			ptarray_free(pa);
+			return NULL;
+		}
+		segs = ceil(bezier_turning(p) / M_PI_2 * perQuad);
+		n = segs < 1 ? 1 : (uint32_t)FP_MIN(segs, 1 << BEZIER_MAX_DEPTH);
+		bezier_stroke_uniform(p, n, pa);
+		break;
+	case LW_LINEARIZE_TOLERANCE_TYPE_MAX_DEVIATION:
+	case LW_LINEARIZE_TOLERANCE_TYPE_MAX_ANGLE:
+		if (tol <= 0)
+		{
+			lwerror("lwbezier_linearize: tolerance must be bigger than 0, got %.15g", tol);
+			ptarray_free(pa);
+			return NULL;
+		}
+		bezier_stroke_adaptive(p, tol, tolerance_type, pa);
+		break;
+	default:
+		lwerror("lwbezier_linearize: unsupported tolerance type %d", tolerance_type);
+		ptarray_free(pa);
+		return NULL;
 	}
 
-	// 拟合
-	draw_bezier_curves(source_point, npoints, output_points, seg);
-
-	// 构造返回值
-	LWLINE *lwgeom = NULL;
-	POINTARRAY *parr = ptarray_construct_copy_data(
-	    FLAGS_GET_Z(bezier->flags), FLAGS_GET_M(bezier->flags), seg, (uint8_t *)output_points);
-	lwgeom = lwline_construct(4326, NULL, parr);
-	free(source_point);
-	free(output_points);
-	return lwgeom;
+	LWDEBUGF(3, "lwbezier_linearize: generated %d points", pa->npoints);
+	return lwline_construct(bezier->srid, NULL, pa);
 }
 
 
@@ -149,45 +312,33 @@ double SimpsonsRuleIntegration(double a, double b, double c, double d, double e,
 	return (intervalwidth / 3) * integral;
 }
 
-POINT2D* Evaluate(double dt,const LWBEZIER *bezier)
-{
-	const POINT2D *pt = NULL;
-	double pos[4][2];
-	for (int i = 0; i < 4; i++)
-	{
-		pt = getPoint2d_cp(bezier->data->points, i);
-		pos[i][0] = pt->x;
-		pos[i][1] = pt->y;
-	}
-
-	double x = pow(1 - dt, 3) * pos[0][0] + 3 * pow(1 - dt, 2) * dt * pos[1][0] + 3 * (1 - dt) * pow(dt, 2) * pos[2][0] + pow(dt, 3) * pos[3][0];
-	double y = pow(1 - dt, 3) * pos[0][1] + 3 * pow(1 - dt, 2) * dt * pos[1][1] + 3 * (1 - dt) * pow(dt, 2) * pos[2][1] + pow(dt, 3) * pos[3][1];
-
-	POINT2D *rpt = (POINT2D *)lwalloc(sizeof(POINT2D));
-	rpt->x = x;
-	rpt->y = y;
-	return rpt;
-}
-
 double lwbezier_area(const LWBEZIER *bezier, const POINT2D *pt)
 {
+	/* 3 point Gauss-Legendre on [0,1], exact for the quintic integrand */
+	static const double node[3] = {0.11270166537925831, 0.5, 0.88729833462074169};
+	static const double weight[3] = {5.0 / 18.0, 8.0 / 18.0, 5.0 / 18.0};
+	POINT4D p[4], a, b, c;
+	double totalArea = 0.0;
+	int i;
+
 	if (!bezier)
 		lwerror("lwbezier_area called with null bezier pointer!");
+	if (bezier->data->points->npoints != 4)
+		lwerror("invalid bezier3");
 
-	int numSegments = 200; // 你可以调整这个值以提高或降低精度
-	double totalArea = 0.0;
+	for (i = 0; i < 4; i++)
+		getPoint4d_p(bezier->data->points, i, &p[i]);
+	bezier_coefficients(p, &a, &b, &c);
 
-	for (int i = 0; i < numSegments; ++i)
+	for (i = 0; i < 3; i++)
 	{
-		double t1 = (double)(i) / numSegments;
-		double t2 = (double)(i + 1) / numSegments;
-
-		POINT2D *p1 = Evaluate(t1, bezier);
-		POINT2D *p2 = Evaluate(t2, bezier);
-		lwfree(p1);
-		lwfree(p2);
+		double t = node[i];
+		double x = ((a.x * t + b.x) * t + c.x) * t + p[0].x - pt->x;
+		double y = ((a.y * t + b.y) * t + c.y) * t + p[0].y - pt->y;
+		double dx = (3.0 * a.x * t + 2.0 * b.x) * t + c.x;
+		double dy = (3.0 * a.y * t + 2.0 * b.y) * t + c.y;
 
-		totalArea += ((p2->x - pt->x) * (p1->y - pt->y) - (p1->x - pt->x) * (p2->y - pt->y)) / 2;
+		totalArea -= weight[i] * (x * dy - y * dx) / 2;
 	}
 
 	return totalArea;
@@ -204,6 +204,8 @@ int lwgeom_contains_point(const LWGEOM *geom, const POINT2D *pt)
 			return ptarrayarc_contains_point(((LWCIRCSTRING*)geom)->points, pt);
 		case COMPOUNDTYPE:
 			return lwcompound_contains_point((LWCOMPOUND*)geom, pt);
+		case ELLIPSETYPE:
+			return lwellipse_contains_point((LWELLIPSE*)geom, pt);
 	}
 	lwerror("lwgeom_contains_point failed");
 	return LW_FAILURE;
@@ -142,7 +142,7 @@ lwellipse_get_spatialdata(LWELLIPSE *geom, unsigned int segment)
 	{
 		//创建 POINTARRAY
 		POINTARRAY *parr = ptarray_construct_copy_data(FLAGS_GET_Z(geom->flags), FLAGS_GET_M(geom->flags), len, (uint8_t *)poarr);
-		lwgeom = lwline_construct(4326, NULL, parr);
+		lwgeom = lwline_construct(geom->srid, NULL, parr);
 		free(poarr);
 	}
 	return lwgeom;
@@ -395,4 +395,335 @@ lwellipse_get_middle_point(const LWELLIPSE *ellipse)
 			    (ycenter + dSin_a_Pri * cos(dRadianEndT) + dCos_a_Sec * sin(dRadianEndT))};
 
 	return respoint;
-}
\ No newline at end of file
+}
+/*
+ * Parametric frame of an elliptical arc: the arc is
+ * C + R(rotation) * (a cos t, b sin t) for t in [t0, t1], t0 <= t1.
+ */
+typedef struct
+{
+	double cx, cy;
+	double a, b;
+	double cosr, sinr;
+	double t0, t1;
+	int full;
+} ELLIPSE_FRAME;
+
+/* Number of parameter samples seeding the Newton refinement */
+#define ELLIPSE_SAMPLES 16
+#define ELLIPSE_NEWTON_ITER 20
+
+/* Same angular range as lwellipse_get_spatialdata covers */
+static int
+lwellipse_frame(const LWELLIPSE *ellipse, ELLIPSE_FRAME *f)
+{
+	POINT4D start, end, center;
+	double dRadianBegin, dRadianEnd;
+
+	if (!ellipse || !ellipse->data || !ellipse->data->points || ellipse->data->points->npoints < 3)
+		return LW_FAILURE;
+
+	getPoint4d_p(ellipse->data->points, 0, &start);
+	getPoint4d_p(ellipse->data->points, 1, &end);
+	getPoint4d_p(ellipse->data->points, 2, &center);
+
+	f->cx = center.x;
+	f->cy = center.y;
+	f->a = fabs(ellipse->data->axis);
+	f->b = fabs(ellipse->data->axis * ellipse->data->ratio);
+	f->cosr = cos(ellipse->data->rotation);
+	f->sinr = sin(ellipse->data->rotation);
+	if (f->a == 0.0 || f->b == 0.0)
+		return LW_FAILURE;
+
+	CalcEllipseRotation(start.x, start.y, end.x, end.y, center.x, center.y,
+			    ellipse->data->rotation, ellipse->data->minor,
+			    &dRadianBegin, &dRadianEnd);
+
+	while (dRadianEnd < dRadianBegin)
+		dRadianEnd += 2 * PI;
+	while (dRadianEnd > (dRadianBegin + PI * 2))
+		dRadianBegin += PI * 2;
+
+	f->t0 = CalcEllipseRadian(dRadianBegin, f->a, f->b);
+	f->t1 = CalcEllipseRadian(dRadianEnd, f->a, f->b);
+	if (fabs(f->t1 - f->t0) <= 1e-15)
+		f->t1 += 2 * PI;
+	f->full = (f->t1 - f->t0) >= 2 * PI - FP_TOLERANCE;
+	return LW_SUCCESS;
+}
+
+static inline void
+ellipse_frame_point(const ELLIPSE_FRAME *f, double t, POINT2D *p)
+{
+	double u = f->a * cos(t), v = f->b * sin(t);
+	p->x = f->cx + f->cosr * u - f->sinr * v;
+	p->y = f->cy + f->sinr * u + f->cosr * v;
+}
+
+/* Is parameter t (any turn) on the arc? */
+static int
+ellipse_frame_covers(const ELLIPSE_FRAME *f, double t)
+{
+	if (f->full)
+		return LW_TRUE;
+	t = f->t0 + fmod(fmod(t - f->t0, 2 * PI) + 2 * PI, 2 * PI);
+	return t <= f->t1 + FP_TOLERANCE;
+}
+
+/**
+ * Exact cartesian box of an elliptical arc: its endpoints plus the
+ * parameters where dx/dt or dy/dt vanish, when they fall on the arc.
+ * Z and M are taken from the arc endpoints.
+ */
+int
+lwellipse_calculate_gbox_cartesian(const LWELLIPSE *ellipse, GBOX *gbox)
+{
+	ELLIPSE_FRAME f;
+	POINT4D start, end;
+	POINT2D p;
+	double t[4];
+	int i;
+
+	if (lwellipse_frame(ellipse, &f) == LW_FAILURE)
+		return LW_FAILURE;
+
+	getPoint4d_p(ellipse->data->points, 0, &start);
+	getPoint4d_p(ellipse->data->points, 1, &end);
+
+	gbox->flags = lwflags(FLAGS_GET_Z(ellipse->flags), FLAGS_GET_M(ellipse->flags), 0);
+	gbox->xmin = FP_MIN(start.x, end.x);
+	gbox->xmax = FP_MAX(start.x, end.x);
+	gbox->ymin = FP_MIN(start.y, end.y);
+	gbox->ymax = FP_MAX(start.y, end.y);
+	gbox->zmin = FP_MIN(start.z, end.z);
+	gbox->zmax = FP_MAX(start.z, end.z);
+	gbox->mmin = FP_MIN(start.m, end.m);
+	gbox->mmax = FP_MAX(start.m, end.m);
+
+	t[0] = atan2(-f.b * f.sinr, f.a * f.cosr);
+	t[1] = t[0] + PI;
+	t[2] = atan2(f.b * f.cosr, f.a * f.sinr);
+	t[3] = t[2] + PI;
+	for (i = 0; i < 4; i++)
+	{
+		if (!ellipse_frame_covers(&f, t[i]))
+			continue;
+		ellipse_frame_point(&f, t[i], &p);
+		if (i < 2)
+		{
+			gbox->xmin = FP_MIN(gbox->xmin, p.x);
+			gbox->xmax = FP_MAX(gbox->xmax, p.x);
+		}
+		else
+		{
+			gbox->ymin = FP_MIN(gbox->ymin, p.y);
+			gbox->ymax = FP_MAX(gbox->ymax, p.y);
+		}
+	}
+	return LW_SUCCESS;
+}
+
+/**
+ * Point in the region bounded by the arc and its chord, which is the
+ * whole ellipse when the arc is closed.
+ * Returns LW_INSIDE, LW_BOUNDARY or LW_OUTSIDE.
+ */
+int
+lwellipse_contains_point(const LWELLIPSE *ellipse, const POINT2D *pt)
+{
+	ELLIPSE_FRAME f;
+	POINT2D start, end, mid;
+	double dx, dy, u, v, r;
+	int side, arcside;
+
+	if (lwellipse_frame(ellipse, &f) == LW_FAILURE)
+		return LW_OUTSIDE;
+
+	dx = pt->x - f.cx;
+	dy = pt->y - f.cy;
+	u = (f.cosr * dx + f.sinr * dy) / f.a;
+	v = (f.cosr * dy - f.sinr * dx) / f.b;
+	r = u * u + v * v;
+
+	if (r > 1.0 + FP_TOLERANCE)
+		return LW_OUTSIDE;
+	if (f.full)
+		return r < 1.0 - FP_TOLERANCE ? LW_INSIDE : LW_BOUNDARY;
+
+	ellipse_frame_point(&f, f.t0, &start);
+	ellipse_frame_point(&f, f.t1, &end);
+	ellipse_frame_point(&f, (f.t0 + f.t1) / 2, &mid);
+	side = lw_segment_side(&start, &end, pt);
+	arcside = lw_segment_side(&start, &end, &mid);
+
+	if (side == 0)
+		return LW_BOUNDARY;
+	if (side != arcside)
+		return LW_OUTSIDE;
+	return r < 1.0 - FP_TOLERANCE ? LW_INSIDE : LW_BOUNDARY;
+}
+
+/* Squared distance from the local point (u,v) to the ellipse at t */
+static inline double
+ellipse_dist2(const ELLIPSE_FRAME *f, double u, double v, double t)
+{
+	double du = f->a * cos(t) - u, dv = f->b * sin(t) - v;
+	return du * du + dv * dv;
+}
+
+/* Newton on half the derivative of ellipse_dist2, kept inside [lo,hi] */
+static double
+ellipse_newton(const ELLIPSE_FRAME *f, double u, double v, double t, double lo, double hi)
+{
+	double k = f->b * f->b - f->a * f->a;
+	int i;
+
+	for (i = 0; i < ELLIPSE_NEWTON_ITER; i++)
+	{
+		double s = sin(t), c = cos(t);
+		double g = k * s * c + f->a * u * s - f->b * v * c;
+		double dg = k * (c * c - s * s) + f->a * u * c + f->b * v * s;
+		double step;
+
+		if (dg == 0.0)
+			break;
+		step = g / dg;
+		t = FP_MIN(FP_MAX(t - step, lo), hi);
+		if (fabs(step) < 1e-15)
+			break;
+	}
+	return t;
+}
+
+/**
+ * Nearest (or farthest) point of an elliptical arc to a point, found by
+ * Newton iteration on the parametric form seeded from a coarse scan.
+ * Returns the distance and, if requested, the point on the arc.
+ */
+double
+lwellipse_closest_point(const LWELLIPSE *ellipse, const POINT2D *pt, int farthest, POINT2D *closest)
+{
+	ELLIPSE_FRAME f;
+	double d[ELLIPSE_SAMPLES + 1];
+	double h, u, v, dx, dy, best_t, best;
+	POINT2D p;
+	int i, n = ELLIPSE_SAMPLES;
+
+	if (lwellipse_frame(ellipse, &f) == LW_FAILURE)
+	{
+		lwerror("lwellipse_closest_point: invalid ellipse");
+		return -1;
+	}
+
+	/* Work in the frame of the ellipse axes */
+	dx = pt->x - f.cx;
+	dy = pt->y - f.cy;
+	u = f.cosr * dx + f.sinr * dy;
+	v = f.cosr * dy - f.sinr * dx;
+
+	h = (f.t1 - f.t0) / n;
+	for (i = 0; i <= n; i++)
+		d[i] = ellipse_dist2(&f, u, v, f.t0 + i * h);
+
+	best_t = f.t0;
+	best = d[0];
+	for (i = 0; i <= n; i++)
+	{
+		double prev, next, t, dt;
+
+		/* Closed arcs wrap around, open ones keep their endpoints */
+		prev = i > 0 ? d[i - 1] : (f.full ? d[n - 1] : d[i]);
+		next = i < n ? d[i + 1] : (f.full ? d[1] : d[i]);
+
+		t = f.t0 + i * h;
+		if (farthest ? (d[i] >= prev && d[i] >= next) : (d[i] <= prev && d[i] <= next))
+		{
+			double lo = t - h, hi = t + h;
+			if (!f.full)
+			{
+				lo = FP_MAX(lo, f.t0);
+				hi = FP_MIN(hi, f.t1);
+			}
+			t = ellipse_newton(&f, u, v, t, lo, hi);
+		}
+
+		dt = ellipse_dist2(&f, u, v, t);
+		if (farthest ? dt > best : dt < best)
+		{
+			best = dt;
+			best_t = t;
+		}
+	}
+
+	if (closest)
+	{
+		ellipse_frame_point(&f, best_t, &p);
+		*closest = p;
+	}
+	return sqrt(best);
+}
+
+/*
+ * Parameters where one ordinate of the arc equals a value:
+ * A cos t + B sin t = w. Returns the number of solutions.
+ */
+static int
+ellipse_ordinate_solve(double A, double B, double w, double *t)
+{
+	double r = sqrt(A * A + B * B), phi, da;
+
+	if (r == 0.0 || fabs(w) > r)
+		return 0;
+	phi = atan2(B, A);
+	da = acos(FP_MIN(FP_MAX(w / r, -1.0), 1.0));
+	t[0] = phi + da;
+	t[1] = phi - da;
+	return 2;
+}
+
+/**
+ * Does the arc touch the 2D box (interior or boundary)?
+ * Either an endpoint is inside, or the arc crosses one of the box edges.
+ */
+int
+lwellipse_intersects_gbox(const LWELLIPSE *ellipse, const GBOX *box)
+{
+	ELLIPSE_FRAME f;
+	GBOX ebox;
+	POINT2D p;
+	double t[2];
+	int i, j, n;
+
+	if (lwellipse_calculate_gbox_cartesian(ellipse, &ebox) == LW_FAILURE)
+		return LW_FALSE;
+	if (gbox_overlaps_2d(&ebox, box) == LW_FALSE)
+		return LW_FALSE;
+
+	lwellipse_frame(ellipse, &f);
+	ellipse_frame_point(&f, f.t0, &p);
+	if (p.x >= box->xmin && p.x <= box->xmax && p.y >= box->ymin && p.y <= box->ymax)
+		return LW_TRUE;
+
+	for (i = 0; i < 4; i++)
+	{
+		/* x = xmin, x = xmax, y = ymin, y = ymax */
+		double w = i < 2 ? (i ? box->xmax : box->xmin) - f.cx : (i == 3 ? box->ymax : box->ymin) - f.cy;
+
+		if (i < 2)
+			n = ellipse_ordinate_solve(f.a * f.cosr, -f.b * f.sinr, w, t);
+		else
+			n = ellipse_ordinate_solve(f.a * f.sinr, f.b * f.cosr, w, t);
+
+		for (j = 0; j < n; j++)
+		{
+			if (!ellipse_frame_covers(&f, t[j]))
+				continue;
+			ellipse_frame_point(&f, t[j], &p);
+			if (i < 2 ? (p.y >= box->ymin - FP_TOLERANCE && p.y <= box->ymax + FP_TOLERANCE)
+				  : (p.x >= box->xmin - FP_TOLERANCE && p.x <= box->xmax + FP_TOLERANCE))
+				return LW_TRUE;
+		}
+	}
+	return LW_FALSE;
+}
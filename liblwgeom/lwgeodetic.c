@@ -1834,17 +1834,113 @@ ptarray_area_sphere(const POINTARRAY *pa)
 }
 
 
-static double ptarray_distance_spheroid(const POINTARRAY *pa1, const POINTARRAY *pa2, const SPHEROID *s, double tolerance, int check_intersection)
+/**
+* Convert every point of a point array to geographic and unit vector
+* form in one pass.
+*/
+static void ptarray_to_geographic(const POINTARRAY *pa, GEOGRAPHIC_POINT *g, POINT3D *q)
+{
+	uint32_t i;
+	for ( i = 0; i < pa->npoints; i++ )
+	{
+		const POINT2D *p = getPoint2d_cp(pa, i);
+		geographic_point_init(p->x, p->y, &(g[i]));
+		geog2cart(&(g[i]), &(q[i]));
+	}
+}
+
+/**
+* Line/line case of ptarray_distance_spheroid, with the second line
+* already converted by ptarray_to_geographic.
+*/
+static double ptarray_distance_spheroid_lines(const POINTARRAY *pa1, const GEOGRAPHIC_POINT *g2s, const POINT3D *B, uint32_t n2, const SPHEROID *s, double tolerance, int check_intersection)
 {
 	GEOGRAPHIC_EDGE e1, e2;
 	GEOGRAPHIC_POINT g1, g2;
 	GEOGRAPHIC_POINT nearest1, nearest2;
-	POINT3D A1, A2, B1, B2;
+	POINT3D A1, A2;
 	const POINT2D *p;
-	double distance;
+	double distance = FLT_MAX;
 	uint32_t i, j;
 	int use_sphere = (s->a == s->b ? 1 : 0);
 
+	/* Initialize start of line 1 */
+	p = getPoint2d_cp(pa1, 0);
+	geographic_point_init(p->x, p->y, &(e1.start));
+	geog2cart(&(e1.start), &A1);
+
+	/* Handle line/line case */
+	for ( i = 1; i < pa1->npoints; i++ )
+	{
+		p = getPoint2d_cp(pa1, i);
+		geographic_point_init(p->x, p->y, &(e1.end));
+		geog2cart(&(e1.end), &A2);
+
+		for ( j = 1; j < n2; j++ )
+		{
+			double d;
+
+			e2.start = g2s[j-1];
+			e2.end = g2s[j];
+
+			LWDEBUGF(4, "e1.start == GPOINT(%.6g %.6g) ", e1.start.lat, e1.start.lon);
+			LWDEBUGF(4, "e1.end == GPOINT(%.6g %.6g) ", e1.end.lat, e1.end.lon);
+			LWDEBUGF(4, "e2.start == GPOINT(%.6g %.6g) ", e2.start.lat, e2.start.lon);
+			LWDEBUGF(4, "e2.end == GPOINT(%.6g %.6g) ", e2.end.lat, e2.end.lon);
+
+			if ( check_intersection && edge_intersects(&A1, &A2, &(B[j-1]), &(B[j])) )
+			{
+				LWDEBUG(4,"edge intersection! returning 0.0");
+				return 0.0;
+			}
+			d = s->radius * edge_distance_to_edge(&e1, &e2, &g1, &g2);
+			LWDEBUGF(4,"got edge_distance_to_edge %.8g", d);
+
+			if ( d < distance )
+			{
+				distance = d;
+				nearest1 = g1;
+				nearest2 = g2;
+			}
+			if ( d < tolerance )
+			{
+				if ( use_sphere )
+				{
+					return d;
+				}
+				else
+				{
+					d = spheroid_distance(&nearest1, &nearest2, s);
+					if ( d < tolerance )
+						return d;
+				}
+			}
+		}
+
+		/* Copy end to start to allow a new end value in next iteration */
+		e1.start = e1.end;
+		A1 = A2;
+		LW_ON_INTERRUPT(return -1.0);
+	}
+	LWDEBUGF(4,"finished all loops, returning %.8g", distance);
+
+	if ( use_sphere )
+		return distance;
+	else
+		return spheroid_distance(&nearest1, &nearest2, s);
+}
+
+static double ptarray_distance_spheroid(const POINTARRAY *pa1, const POINTARRAY *pa2, const SPHEROID *s, double tolerance, int check_intersection)
+{
+	GEOGRAPHIC_EDGE e1;
+	GEOGRAPHIC_POINT g1, g2;
+	GEOGRAPHIC_POINT nearest2;
+	GEOGRAPHIC_POINT *g2s;
+	POINT3D *B;
+	const POINT2D *p;
+	double distance;
+	int use_sphere = (s->a == s->b ? 1 : 0);
+
 	/* Make result really big, so that everything will be smaller than it */
 	distance = FLT_MAX;
 
@@ -1946,81 +2042,16 @@ static double ptarray_distance_spheroid(const POINTARRAY *pa1, const POINTARRAY
 
 	}
 
-	/* Initialize start of line 1 */
-	p = getPoint2d_cp(pa1, 0);
-	geographic_point_init(p->x, p->y, &(e1.start));
-	geog2cart(&(e1.start), &A1);
-
-
-	/* Handle line/line case */
-	for ( i = 1; i < pa1->npoints; i++ )
-	{
-		p = getPoint2d_cp(pa1, i);
-		geographic_point_init(p->x, p->y, &(e1.end));
-		geog2cart(&(e1.end), &A2);
-
-		/* Initialize start of line 2 */
-		p = getPoint2d_cp(pa2, 0);
-		geographic_point_init(p->x, p->y, &(e2.start));
-		geog2cart(&(e2.start), &B1);
-
-		for ( j = 1; j < pa2->npoints; j++ )
-		{
-			double d;
-
-			p = getPoint2d_cp(pa2, j);
-			geographic_point_init(p->x, p->y, &(e2.end));
-			geog2cart(&(e2.end), &B2);
-
-			LWDEBUGF(4, "e1.start == GPOINT(%.6g %.6g) ", e1.start.lat, e1.start.lon);
-			LWDEBUGF(4, "e1.end == GPOINT(%.6g %.6g) ", e1.end.lat, e1.end.lon);
-			LWDEBUGF(4, "e2.start == GPOINT(%.6g %.6g) ", e2.start.lat, e2.start.lon);
-			LWDEBUGF(4, "e2.end == GPOINT(%.6g %.6g) ", e2.end.lat, e2.end.lon);
-
-			if ( check_intersection && edge_intersects(&A1, &A2, &B1, &B2) )
-			{
-				LWDEBUG(4,"edge intersection! returning 0.0");
-				return 0.0;
-			}
-			d = s->radius * edge_distance_to_edge(&e1, &e2, &g1, &g2);
-			LWDEBUGF(4,"got edge_distance_to_edge %.8g", d);
-
-			if ( d < distance )
-			{
-				distance = d;
-				nearest1 = g1;
-				nearest2 = g2;
-			}
-			if ( d < tolerance )
-			{
-				if ( use_sphere )
-				{
-					return d;
-				}
-				else
-				{
-					d = spheroid_distance(&nearest1, &nearest2, s);
-					if ( d < tolerance )
-						return d;
-				}
-			}
-
-			/* Copy end to start to allow a new end value in next iteration */
-			e2.start = e2.end;
-			B1 = B2;
-		}
+	/* Line 2 is walked once per edge of line 1, convert it only once */
+	g2s = (GEOGRAPHIC_POINT*)lwalloc(sizeof(GEOGRAPHIC_POINT) * pa2->npoints);
+	B = (POINT3D*)lwalloc(sizeof(POINT3D) * pa2->npoints);
+	ptarray_to_geographic(pa2, g2s, B);
 
-		/* Copy end to start to allow a new end value in next iteration */
-		e1.start = e1.end;
-		A1 = A2;
-		LW_ON_INTERRUPT(return -1.0);
-	}
-	LWDEBUGF(4,"finished all loops, returning %.8g", distance);
+	distance = ptarray_distance_spheroid_lines(pa1, g2s, B, pa2->npoints, s, tolerance, check_intersection);
 
-	if ( use_sphere )
-		return distance;
-	else
-		return spheroid_distance(&nearest1, &nearest2, s);
+	lwfree(g2s);
+	lwfree(B);
+	return distance;
 }
 
 
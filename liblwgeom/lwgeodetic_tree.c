@@ -99,7 +99,12 @@ circ_node_leaf_new(const POINTARRAY* pa, int i)
 	normalize(&c);
 	cart2geog(&c, &gc);
 	node->center = gc;
+	node->center3d = c;
 	node->radius = diameter / 2.0;
+	node->edge.start = g1;
+	node->edge.end = g2;
+	node->q1 = q1;
+	node->q2 = q2;
 
 	LWDEBUGF(3,"edge #%d CENTER(%g %g) RADIUS=%g", i, gc.lon, gc.lat, node->radius);
 
@@ -125,6 +130,9 @@ circ_node_leaf_point_new(const POINTARRAY* pa)
 	CIRC_NODE* tree = (CIRC_NODE*)lwalloc(sizeof(CIRC_NODE));
 	tree->p1 = tree->p2 = (POINT2D*)getPoint_internal(pa, 0);
 	geographic_point_init(tree->p1->x, tree->p1->y, &(tree->center));
+	geog2cart(&(tree->center), &(tree->center3d));
+	tree->edge.start = tree->edge.end = tree->center;
+	tree->q1 = tree->q2 = tree->center3d;
 	tree->radius = 0.0;
 	tree->nodes = NULL;
 	tree->num_nodes = 0;
@@ -338,6 +346,7 @@ circ_node_internal_new(CIRC_NODE** c, uint32_t num_nodes)
 	node->p1 = NULL;
 	node->p2 = NULL;
 	node->center = new_center;
+	geog2cart(&new_center, &(node->center3d));
 	node->radius = new_radius;
 	node->num_nodes = num_nodes;
 	node->nodes = c;
@@ -492,20 +501,14 @@ int circ_tree_get_point_outside(const CIRC_NODE* node, POINT2D* pt)
 * KNOWN PROBLEM: Grazings (think of a sharp point, just touching the
 *   stabline) will be counted for one, which will throw off the count.
 */
-int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt, const POINT2D* pt_outside, int level, int* on_boundary)
+static int
+circ_tree_contains_point_internal(const CIRC_NODE* node, const POINT2D* pt, const POINT2D* pt_outside,
+	const GEOGRAPHIC_EDGE* stab_edge, const POINT3D* S1, const POINT3D* S2, int level, int* on_boundary)
 {
 	GEOGRAPHIC_POINT closest;
-	GEOGRAPHIC_EDGE stab_edge, edge;
-	POINT3D S1, S2, E1, E2;
 	double d;
 	uint32_t i, c;
 
-	/* Construct a stabline edge from our "inside" to our known outside point */
-	geographic_point_init(pt->x, pt->y, &(stab_edge.start));
-	geographic_point_init(pt_outside->x, pt_outside->y, &(stab_edge.end));
-	geog2cart(&(stab_edge.start), &S1);
-	geog2cart(&(stab_edge.end), &S2);
-
 	LWDEBUGF(3, "%*s entered", level, "");
 
 	/*
@@ -514,7 +517,7 @@ int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt, const POI
 	*/
 
 	LWDEBUGF(3, "%*s :working on node %p, edge_num %d, radius %g, center POINT(%.12g %.12g)", level, "", node, node->edge_num, node->radius, rad2deg(node->center.lon), rad2deg(node->center.lat));
-	d = edge_distance_to_point(&stab_edge, &(node->center), &closest);
+	d = edge_distance_to_point(stab_edge, &(node->center), &closest);
 	LWDEBUGF(3, "%*s :edge_distance_to_point=%g, node_radius=%g", level, "", d, node->radius);
 	if ( FP_LTEQ(d, node->radius) )
 	{
@@ -525,12 +528,7 @@ int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt, const POI
 		{
 			int inter;
 			LWDEBUGF(3, "%*s :leaf node calculation (edge %d)", level, "", node->edge_num);
-			geographic_point_init(node->p1->x, node->p1->y, &(edge.start));
-			geographic_point_init(node->p2->x, node->p2->y, &(edge.end));
-			geog2cart(&(edge.start), &E1);
-			geog2cart(&(edge.end), &E2);
-
-			inter = edge_intersects(&S1, &S2, &E1, &E2);
+			inter = edge_intersects(S1, S2, &(node->q1), &(node->q2));
 			LWDEBUGF(3, "%*s :inter = %d", level, "", inter);
 
 			if ( inter & PIR_INTERSECTS )
@@ -539,7 +537,7 @@ int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt, const POI
 				/* To avoid double counting crossings-at-a-vertex, */
 				/* always ignore crossings at "lower" ends of edges*/
 				GEOGRAPHIC_POINT e1, e2;
-				cart2geog(&E1,&e1); cart2geog(&E2,&e2);
+				cart2geog(&(node->q1),&e1); cart2geog(&(node->q2),&e2);
 
 				LWDEBUGF(3,"%*s LINESTRING(%.15g %.15g,%.15g %.15g)", level, "",
 					pt->x, pt->y,
@@ -574,7 +572,7 @@ int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt, const POI
 			for ( i = 0; i < node->num_nodes; i++ )
 			{
 				LWDEBUGF(3,"%*s calling circ_tree_contains_point on child %d!", level, "", i);
-				c += circ_tree_contains_point(node->nodes[i], pt, pt_outside, level + 1, on_boundary);
+				c += circ_tree_contains_point_internal(node->nodes[i], pt, pt_outside, stab_edge, S1, S2, level + 1, on_boundary);
 			}
 			return c % 2;
 		}
@@ -586,10 +584,39 @@ int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt, const POI
 	return 0;
 }
 
+int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt, const POINT2D* pt_outside, int level, int* on_boundary)
+{
+	GEOGRAPHIC_EDGE stab_edge;
+	POINT3D S1, S2;
+
+	/* Construct a stabline edge from our "inside" to our known outside point */
+	geographic_point_init(pt->x, pt->y, &(stab_edge.start));
+	geographic_point_init(pt_outside->x, pt_outside->y, &(stab_edge.end));
+	geog2cart(&(stab_edge.start), &S1);
+	geog2cart(&(stab_edge.end), &S2);
+
+	return circ_tree_contains_point_internal(node, pt, pt_outside, &stab_edge, &S1, &S2, level, on_boundary);
+}
+
+/**
+* Angle between the centers of two nodes, from their cached unit vectors.
+* The atan2 form keeps its precision for nearby centers, unlike acos.
+*/
+static inline double
+circ_node_center_distance(const CIRC_NODE* n1, const CIRC_NODE* n2)
+{
+	const POINT3D *a = &(n1->center3d);
+	const POINT3D *b = &(n2->center3d);
+	double cx = a->y * b->z - a->z * b->y;
+	double cy = a->z * b->x - a->x * b->z;
+	double cz = a->x * b->y - a->y * b->x;
+	return atan2(sqrt(cx * cx + cy * cy + cz * cz), a->x * b->x + a->y * b->y + a->z * b->z);
+}
+
 static double
 circ_node_min_distance(const CIRC_NODE* n1, const CIRC_NODE* n2)
 {
-	double d = sphere_distance(&(n1->center), &(n2->center));
+	double d = circ_node_center_distance(n1, n2);
 	double r1 = n1->radius;
 	double r2 = n2->radius;
 
@@ -602,7 +629,7 @@ circ_node_min_distance(const CIRC_NODE* n1, const CIRC_NODE* n2)
 static double
 circ_node_max_distance(const CIRC_NODE *n1, const CIRC_NODE *n2)
 {
-	return sphere_distance(&(n1->center), &(n2->center)) + n1->radius + n2->radius;
+	return circ_node_center_distance(n1, n2) + n1->radius + n2->radius;
 }
 
 double
@@ -660,7 +687,7 @@ circ_internal_nodes_sort(CIRC_NODE **nodes, uint32_t num_nodes, const CIRC_NODE
 	for (i = 0; i < num_nodes; i++)
 	{
 		sort_nodes[i].node = nodes[i];
-		sort_nodes[i].d = sphere_distance(&(nodes[i]->center), &(target_node->center));
+		sort_nodes[i].d = circ_node_center_distance(nodes[i], target_node);
 	}
 
 	/* Sort the nodes and copy the result back into the input array */
@@ -744,63 +771,43 @@ circ_tree_distance_tree_internal(const CIRC_NODE* n1, const CIRC_NODE* n2, doubl
 		double d;
 		GEOGRAPHIC_POINT close1, close2;
 		LWDEBUGF(4, "testing leaf pair [%d], [%d]", n1->edge_num, n2->edge_num);
+		/* Leaves carry their edge ends already converted */
 		/* One of the nodes is a point */
 		if ( n1->p1 == n1->p2 || n2->p1 == n2->p2 )
 		{
-			GEOGRAPHIC_EDGE e;
-			GEOGRAPHIC_POINT gp1, gp2;
-
 			/* Both nodes are points! */
 			if ( n1->p1 == n1->p2 && n2->p1 == n2->p2 )
 			{
-				geographic_point_init(n1->p1->x, n1->p1->y, &gp1);
-				geographic_point_init(n2->p1->x, n2->p1->y, &gp2);
-				close1 = gp1; close2 = gp2;
-				d = sphere_distance(&gp1, &gp2);
+				close1 = n1->edge.start; close2 = n2->edge.start;
+				d = sphere_distance(&close1, &close2);
 			}
 			/* Node 1 is a point */
 			else if ( n1->p1 == n1->p2 )
 			{
-				geographic_point_init(n1->p1->x, n1->p1->y, &gp1);
-				geographic_point_init(n2->p1->x, n2->p1->y, &(e.start));
-				geographic_point_init(n2->p2->x, n2->p2->y, &(e.end));
-				close1 = gp1;
-				d = edge_distance_to_point(&e, &gp1, &close2);
+				close1 = n1->edge.start;
+				d = edge_distance_to_point(&(n2->edge), &close1, &close2);
 			}
 			/* Node 2 is a point */
 			else
 			{
-				geographic_point_init(n2->p1->x, n2->p1->y, &gp1);
-				geographic_point_init(n1->p1->x, n1->p1->y, &(e.start));
-				geographic_point_init(n1->p2->x, n1->p2->y, &(e.end));
-				close1 = gp1;
-				d = edge_distance_to_point(&e, &gp1, &close2);
+				close1 = n2->edge.start;
+				d = edge_distance_to_point(&(n1->edge), &close1, &close2);
 			}
 			LWDEBUGF(4, "  got distance %g", d);
 		}
 		/* Both nodes are edges */
 		else
 		{
-			GEOGRAPHIC_EDGE e1, e2;
 			GEOGRAPHIC_POINT g;
-			POINT3D A1, A2, B1, B2;
-			geographic_point_init(n1->p1->x, n1->p1->y, &(e1.start));
-			geographic_point_init(n1->p2->x, n1->p2->y, &(e1.end));
-			geographic_point_init(n2->p1->x, n2->p1->y, &(e2.start));
-			geographic_point_init(n2->p2->x, n2->p2->y, &(e2.end));
-			geog2cart(&(e1.start), &A1);
-			geog2cart(&(e1.end), &A2);
-			geog2cart(&(e2.start), &B1);
-			geog2cart(&(e2.end), &B2);
-			if ( edge_intersects(&A1, &A2, &B1, &B2) )
+			if ( edge_intersects(&(n1->q1), &(n1->q2), &(n2->q1), &(n2->q2)) )
 			{
 				d = 0.0;
-				edge_intersection(&e1, &e2, &g);
+				edge_intersection(&(n1->edge), &(n2->edge), &g);
 				close1 = close2 = g;
 			}
 			else
 			{
-				d = edge_distance_to_edge(&e1, &e2, &close1, &close2);
+				d = edge_distance_to_edge(&(n1->edge), &(n2->edge), &close1, &close2);
 			}
 			LWDEBUGF(4, "edge_distance_to_edge returned %g", d);
 		}
@@ -1026,3 +1033,455 @@ lwgeom_calculate_circ_tree(const LWGEOM* lwgeom)
 	}
 
 }
+
+
+/***********************************************************************
+* Cell index over the sphere, for repeated point-in-polygon tests.
+*
+* The sphere is projected onto the six faces of a cube with the gnomonic
+* projection, which maps great circles to straight lines, so each edge
+* piece becomes a straight segment on the faces it touches. Those
+* segments are rasterized into a per-face grid to find the boundary
+* cells, and every connected run of edge-free cells is classified with a
+* single circ_tree_contains_point() call.
+*/
+
+/* Longest edge piece we rasterize, short enough for a piece to never */
+/* reach the region of a face from behind that face's plane */
+#define CIRC_CELL_MAX_ARC 0.5
+#define CIRC_CELL_EPS 1e-9
+
+/* Face of a unit vector: 0, 1, 2 for +x, +y, +z and 3, 4, 5 for -x, -y, -z */
+static inline int
+circ_cell_face(const POINT3D* p)
+{
+	double ax = fabs(p->x), ay = fabs(p->y), az = fabs(p->z);
+	if ( ax >= ay && ax >= az )
+		return p->x >= 0.0 ? 0 : 3;
+	if ( ay >= az )
+		return p->y >= 0.0 ? 1 : 4;
+	return p->z >= 0.0 ? 2 : 5;
+}
+
+/* Gnomonic projection onto the plane of a face, LW_FALSE if p is not in front of it */
+static inline int
+circ_cell_project(int face, const POINT3D* p, double* u, double* v)
+{
+	double c[3];
+	double w;
+	int a = face % 3;
+	c[0] = p->x; c[1] = p->y; c[2] = p->z;
+	w = face < 3 ? c[a] : -c[a];
+	if ( w <= 0.0 )
+		return LW_FALSE;
+	*u = c[(a + 1) % 3] / w;
+	*v = c[(a + 2) % 3] / w;
+	return LW_TRUE;
+}
+
+static void
+circ_cell_unproject(int face, double u, double v, POINT3D* p)
+{
+	double c[3];
+	int a = face % 3;
+	c[a] = face < 3 ? 1.0 : -1.0;
+	c[(a + 1) % 3] = u;
+	c[(a + 2) % 3] = v;
+	p->x = c[0]; p->y = c[1]; p->z = c[2];
+	normalize(p);
+}
+
+/* Position along one axis of a face grid, in cell units */
+static inline double
+circ_cell_grid(double min, double max, uint32_t resolution, double x)
+{
+	return (x - min) * resolution / (max - min);
+}
+
+static inline int
+circ_cell_clamp(double x, uint32_t resolution)
+{
+	if ( x < 0.0 ) return 0;
+	if ( x >= resolution ) return resolution - 1;
+	return (int)x;
+}
+
+/* Liang-Barsky clip of a segment to a box, LW_FALSE if nothing is left */
+static int
+circ_cell_clip(double* u0, double* v0, double* u1, double* v1, double umin, double umax, double vmin, double vmax)
+{
+	double t0 = 0.0, t1 = 1.0;
+	double du = *u1 - *u0, dv = *v1 - *v0;
+	double p[4], q[4];
+	int i;
+
+	p[0] = -du; q[0] = *u0 - umin;
+	p[1] =  du; q[1] = umax - *u0;
+	p[2] = -dv; q[2] = *v0 - vmin;
+	p[3] =  dv; q[3] = vmax - *v0;
+
+	for ( i = 0; i < 4; i++ )
+	{
+		if ( p[i] == 0.0 )
+		{
+			if ( q[i] < 0.0 )
+				return LW_FALSE;
+		}
+		else
+		{
+			double r = q[i] / p[i];
+			if ( p[i] < 0.0 )
+			{
+				if ( r > t1 ) return LW_FALSE;
+				if ( r > t0 ) t0 = r;
+			}
+			else
+			{
+				if ( r < t0 ) return LW_FALSE;
+				if ( r < t1 ) t1 = r;
+			}
+		}
+	}
+
+	*u1 = *u0 + t1 * du;
+	*v1 = *v0 + t1 * dv;
+	*u0 = *u0 + t0 * du;
+	*v0 = *v0 + t0 * dv;
+	return LW_TRUE;
+}
+
+/* Mark every cell the segment passes through, or passes close to, as boundary */
+static void
+circ_cell_rasterize(CIRC_CELL_INDEX* index, const CIRC_CELL_FACE* face, double u0, double v0, double u1, double v1)
+{
+	uint32_t n = index->resolution;
+	uint8_t* cells = index->cells + face->offset;
+	double x0 = circ_cell_grid(face->umin, face->umax, n, u0);
+	double y0 = circ_cell_grid(face->vmin, face->vmax, n, v0);
+	double x1 = circ_cell_grid(face->umin, face->umax, n, u1);
+	double y1 = circ_cell_grid(face->vmin, face->vmax, n, v1);
+	double ymin = FP_MIN(y0, y1), ymax = FP_MAX(y0, y1);
+	/* A margin for the rounding of the lookup projection */
+	double pad = 1e-6 + CIRC_CELL_EPS * n / (face->umax - face->umin);
+	int j, jlo, jhi;
+
+	jlo = circ_cell_clamp(floor(ymin - pad), n);
+	jhi = circ_cell_clamp(floor(ymax + pad), n);
+
+	for ( j = jlo; j <= jhi; j++ )
+	{
+		double ya = FP_MAX(ymin, FP_MIN(ymax, (double)j));
+		double yb = FP_MAX(ymin, FP_MIN(ymax, (double)(j + 1)));
+		double xa, xb;
+		int i, ilo, ihi;
+
+		if ( y1 == y0 )
+		{
+			xa = x0;
+			xb = x1;
+		}
+		else
+		{
+			xa = x0 + (ya - y0) * (x1 - x0) / (y1 - y0);
+			xb = x0 + (yb - y0) * (x1 - x0) / (y1 - y0);
+		}
+		ilo = circ_cell_clamp(floor(FP_MIN(xa, xb) - pad), n);
+		ihi = circ_cell_clamp(floor(FP_MAX(xa, xb) + pad), n);
+		for ( i = ilo; i <= ihi; i++ )
+			cells[j * n + i] = CIRC_CELL_BOUNDARY;
+	}
+}
+
+/* Grow the grid extent of every face the edge piece shows up on, or rasterize it */
+static void
+circ_cell_piece(CIRC_CELL_INDEX* index, const POINT3D* a, const POINT3D* b, int rasterize)
+{
+	int f;
+	for ( f = 0; f < 6; f++ )
+	{
+		CIRC_CELL_FACE* face = &(index->faces[f]);
+		double u0, v0, u1, v1;
+
+		if ( ! circ_cell_project(f, a, &u0, &v0) || ! circ_cell_project(f, b, &u1, &v1) )
+			continue;
+
+		if ( rasterize )
+		{
+			if ( face->has_grid && circ_cell_clip(&u0, &v0, &u1, &v1, face->umin, face->umax, face->vmin, face->vmax) )
+				circ_cell_rasterize(index, face, u0, v0, u1, v1);
+		}
+		else
+		{
+			double lim = 1.0 + CIRC_CELL_EPS;
+			if ( ! circ_cell_clip(&u0, &v0, &u1, &v1, -lim, lim, -lim, lim) )
+				continue;
+			face->umin = FP_MIN(face->umin, FP_MIN(u0, u1));
+			face->umax = FP_MAX(face->umax, FP_MAX(u0, u1));
+			face->vmin = FP_MIN(face->vmin, FP_MIN(v0, v1));
+			face->vmax = FP_MAX(face->vmax, FP_MAX(v0, v1));
+			face->has_grid = 1;
+		}
+	}
+}
+
+static int
+circ_cell_ptarray(CIRC_CELL_INDEX* index, const POINTARRAY* pa, int rasterize)
+{
+	uint32_t i;
+	POINT3D a, b;
+	GEOGRAPHIC_POINT g;
+	const POINT2D* p;
+
+	if ( pa->npoints == 0 )
+		return LW_SUCCESS;
+
+	p = getPoint2d_cp(pa, 0);
+	geographic_point_init(p->x, p->y, &g);
+	geog2cart(&g, &a);
+
+	/* A lone vertex still has to land in a boundary cell */
+	if ( pa->npoints == 1 )
+		circ_cell_piece(index, &a, &a, rasterize);
+
+	for ( i = 1; i < pa->npoints; i++ )
+	{
+		double angle, s;
+		int k, n;
+		POINT3D prev = a;
+
+		p = getPoint2d_cp(pa, i);
+		geographic_point_init(p->x, p->y, &g);
+		geog2cart(&g, &b);
+
+		angle = vector_angle(&a, &b);
+		n = (int)ceil(angle / CIRC_CELL_MAX_ARC);
+		s = sin(angle);
+
+		/* Antipodal edges have no defined great circle */
+		if ( n > 1 && s < CIRC_CELL_EPS )
+			return LW_FAILURE;
+
+		for ( k = 1; k < n; k++ )
+		{
+			double t = (double)k / n;
+			double wa = sin((1.0 - t) * angle) / s;
+			double wb = sin(t * angle) / s;
+			POINT3D q;
+			q.x = wa * a.x + wb * b.x;
+			q.y = wa * a.y + wb * b.y;
+			q.z = wa * a.z + wb * b.z;
+			normalize(&q);
+			circ_cell_piece(index, &prev, &q, rasterize);
+			prev = q;
+		}
+		circ_cell_piece(index, &prev, &b, rasterize);
+		a = b;
+	}
+	return LW_SUCCESS;
+}
+
+static int
+circ_cell_lwgeom(CIRC_CELL_INDEX* index, const LWGEOM* lwgeom, int rasterize)
+{
+	uint32_t i;
+
+	if ( lwgeom->type == POLYGONTYPE )
+	{
+		const LWPOLY* poly = (const LWPOLY*)lwgeom;
+		for ( i = 0; i < poly->nrings; i++ )
+			if ( circ_cell_ptarray(index, poly->rings[i], rasterize) == LW_FAILURE )
+				return LW_FAILURE;
+		return LW_SUCCESS;
+	}
+	if ( lwgeom_is_collection(lwgeom) )
+	{
+		const LWCOLLECTION* col = (const LWCOLLECTION*)lwgeom;
+		for ( i = 0; i < col->ngeoms; i++ )
+			if ( circ_cell_lwgeom(index, col->geoms[i], rasterize) == LW_FAILURE )
+				return LW_FAILURE;
+		return LW_SUCCESS;
+	}
+	/* Only areas have an inside */
+	return LW_FAILURE;
+}
+
+static uint8_t
+circ_cell_classify(const CIRC_NODE* tree, const GBOX* gbox, const POINT2D* pt_outside, int face, double u, double v)
+{
+	POINT3D p;
+	GEOGRAPHIC_POINT g;
+	POINT2D pt;
+
+	circ_cell_unproject(face, u, v, &p);
+	if ( ! gbox_contains_point3d(gbox, &p) )
+		return CIRC_CELL_OUTSIDE;
+
+	cart2geog(&p, &g);
+	pt.x = rad2deg(g.lon);
+	pt.y = rad2deg(g.lat);
+	return circ_tree_contains_point(tree, &pt, pt_outside, 0, NULL) ? CIRC_CELL_INSIDE : CIRC_CELL_OUTSIDE;
+}
+
+/* Give each 4-connected run of edge-free cells the class of its first cell */
+static void
+circ_cell_fill(CIRC_CELL_INDEX* index, int f, const CIRC_NODE* tree, const GBOX* gbox, const POINT2D* pt_outside, int* queue)
+{
+	const CIRC_CELL_FACE* face = &(index->faces[f]);
+	int n = (int)index->resolution;
+	uint8_t* cells = index->cells + face->offset;
+	const uint8_t visited = 0xFE;
+	const uint8_t unknown = 0xFF;
+	int c;
+
+	for ( c = 0; c < n * n; c++ )
+	{
+		int head = 0, tail = 0, k;
+		uint8_t cls;
+
+		if ( cells[c] != unknown )
+			continue;
+
+		cells[c] = visited;
+		queue[tail++] = c;
+		while ( head < tail )
+		{
+			int cur = queue[head++];
+			int ci = cur % n, cj = cur / n;
+			int nb[4];
+			int m = 0;
+			if ( ci > 0 ) nb[m++] = cur - 1;
+			if ( ci < n - 1 ) nb[m++] = cur + 1;
+			if ( cj > 0 ) nb[m++] = cur - n;
+			if ( cj < n - 1 ) nb[m++] = cur + n;
+			for ( k = 0; k < m; k++ )
+			{
+				if ( cells[nb[k]] == unknown )
+				{
+					cells[nb[k]] = visited;
+					queue[tail++] = nb[k];
+				}
+			}
+		}
+
+		cls = circ_cell_classify(tree, gbox, pt_outside, f,
+			face->umin + ((c % n) + 0.5) * (face->umax - face->umin) / n,
+			face->vmin + ((c / n) + 0.5) * (face->vmax - face->vmin) / n);
+		for ( k = 0; k < tail; k++ )
+			cells[queue[k]] = cls;
+	}
+}
+
+/**
+* Build a cell index for a polygonal geometry and the tree built from it.
+* The gbox and pt_outside must be the ones the caller would use for a
+* plain circ_tree_contains_point() test, so both give the same answers.
+* Returns NULL when no index can be built for the geometry.
+*/
+CIRC_CELL_INDEX*
+circ_cell_index_new(const LWGEOM* lwgeom, const CIRC_NODE* tree, const GBOX* gbox, const POINT2D* pt_outside)
+{
+	CIRC_CELL_INDEX extent;
+	CIRC_CELL_INDEX* index;
+	uint32_t npoints, resolution = 64, ngrids = 0;
+	size_t size;
+	int* queue;
+	int f;
+
+	if ( ! tree || lwgeom_is_empty(lwgeom) )
+		return NULL;
+
+	/* About four cells per vertex, on the faces carrying edges */
+	npoints = lwgeom_count_vertices(lwgeom);
+	while ( resolution < CIRC_CELL_MAX_RESOLUTION && resolution * resolution < 4 * npoints )
+		resolution *= 2;
+
+	/* First pass finds the part of each face the edges cover */
+	memset(&extent, 0, sizeof(CIRC_CELL_INDEX));
+	for ( f = 0; f < 6; f++ )
+	{
+		extent.faces[f].umin = extent.faces[f].vmin = FLT_MAX;
+		extent.faces[f].umax = extent.faces[f].vmax = -1 * FLT_MAX;
+	}
+	if ( circ_cell_lwgeom(&extent, lwgeom, LW_FALSE) == LW_FAILURE )
+		return NULL;
+
+	for ( f = 0; f < 6; f++ )
+	{
+		CIRC_CELL_FACE* face = &(extent.faces[f]);
+		if ( ! face->has_grid )
+			continue;
+		face->umin -= CIRC_CELL_EPS;
+		face->umax += CIRC_CELL_EPS;
+		face->vmin -= CIRC_CELL_EPS;
+		face->vmax += CIRC_CELL_EPS;
+		face->offset = ngrids * resolution * resolution;
+		ngrids++;
+	}
+
+	size = sizeof(CIRC_CELL_INDEX) + (size_t)ngrids * resolution * resolution;
+	index = (CIRC_CELL_INDEX*)lwalloc(size);
+	memcpy(index, &extent, sizeof(CIRC_CELL_INDEX));
+	index->size = (uint32_t)size;
+	index->resolution = resolution;
+	memset(index->cells, 0xFF, (size_t)ngrids * resolution * resolution);
+
+	/* Second pass marks the boundary cells */
+	circ_cell_lwgeom(index, lwgeom, LW_TRUE);
+
+	/* Everything else is classified one edge-free region at a time */
+	queue = ngrids ? (int*)lwalloc(sizeof(int) * resolution * resolution) : NULL;
+	for ( f = 0; f < 6; f++ )
+	{
+		CIRC_CELL_FACE* face = &(index->faces[f]);
+		if ( ! face->has_grid )
+		{
+			face->strip[0] = circ_cell_classify(tree, gbox, pt_outside, f, 0.0, 0.0);
+			face->strip[1] = face->strip[2] = face->strip[3] = face->strip[0];
+			continue;
+		}
+
+		circ_cell_fill(index, f, tree, gbox, pt_outside, queue);
+
+		/* Empty strips are never looked up, their class does not matter */
+		face->strip[0] = face->umin > -1.0 ?
+			circ_cell_classify(tree, gbox, pt_outside, f, (face->umin - 1.0) / 2, 0.0) : CIRC_CELL_OUTSIDE;
+		face->strip[1] = face->umax < 1.0 ?
+			circ_cell_classify(tree, gbox, pt_outside, f, (face->umax + 1.0) / 2, 0.0) : CIRC_CELL_OUTSIDE;
+		face->strip[2] = face->vmin > -1.0 ?
+			circ_cell_classify(tree, gbox, pt_outside, f,
+				FP_MAX(-1.0, FP_MIN(1.0, (face->umin + face->umax) / 2)), (face->vmin - 1.0) / 2) : CIRC_CELL_OUTSIDE;
+		face->strip[3] = face->vmax < 1.0 ?
+			circ_cell_classify(tree, gbox, pt_outside, f,
+				FP_MAX(-1.0, FP_MIN(1.0, (face->umin + face->umax) / 2)), (face->vmax + 1.0) / 2) : CIRC_CELL_OUTSIDE;
+	}
+	if ( queue )
+		lwfree(queue);
+
+	return index;
+}
+
+/**
+* Class of the cell holding a point on the unit sphere. Only
+* #CIRC_CELL_BOUNDARY answers need an actual edge test.
+*/
+int
+circ_cell_index_lookup(const CIRC_CELL_INDEX* index, const POINT3D* pt)
+{
+	int f = circ_cell_face(pt);
+	const CIRC_CELL_FACE* face = &(index->faces[f]);
+	uint32_t n = index->resolution;
+	double u, v;
+	int i, j;
+
+	if ( ! face->has_grid || ! circ_cell_project(f, pt, &u, &v) )
+		return face->strip[0];
+
+	if ( u < face->umin ) return face->strip[0];
+	if ( u > face->umax ) return face->strip[1];
+	if ( v < face->vmin ) return face->strip[2];
+	if ( v > face->vmax ) return face->strip[3];
+
+	i = circ_cell_clamp(circ_cell_grid(face->umin, face->umax, n, u), n);
+	j = circ_cell_clamp(circ_cell_grid(face->vmin, face->vmax, n, v), n);
+	return index->cells[face->offset + j * n + i];
+}
@@ -45,6 +45,12 @@ typedef struct circ_node
 	POINT2D pt_outside;
 	POINT2D* p1;
 	POINT2D* p2;
+	/* Unit vector of the center, and for leaves the edge ends */
+	/* in both forms, so the tree walks need no trigonometry */
+	POINT3D center3d;
+	GEOGRAPHIC_EDGE edge;
+	POINT3D q1;
+	POINT3D q2;
 } CIRC_NODE;
 
 void circ_tree_print(const CIRC_NODE* node, int depth);
@@ -56,6 +62,45 @@ CIRC_NODE* lwgeom_calculate_circ_tree(const LWGEOM* lwgeom);
 int circ_tree_get_point(const CIRC_NODE* node, POINT2D* pt);
 int circ_tree_get_point_outside(const CIRC_NODE* node, POINT2D* pt);
 
+/**
+* Cell classes of a #CIRC_CELL_INDEX
+*/
+#define CIRC_CELL_OUTSIDE  0
+#define CIRC_CELL_INSIDE   1
+#define CIRC_CELL_BOUNDARY 2
+
+#define CIRC_CELL_MAX_RESOLUTION 256
+
+/**
+* One face of the cube the sphere is projected onto. Edges are
+* rasterized into a resolution x resolution grid covering their
+* (u,v) extent on the face, the rest of the face is split into four
+* edge-free strips (left, right, below, above the grid) of one class each.
+*/
+typedef struct
+{
+	double umin, umax, vmin, vmax;
+	uint32_t offset;
+	uint8_t has_grid;
+	uint8_t strip[4];
+} CIRC_CELL_FACE;
+
+/**
+* Precomputed point-in-polygon answer for cells of a gnomonic cube
+* projection of the sphere. The structure is a single allocation of
+* size bytes without internal pointers, so it can be copied around.
+*/
+typedef struct
+{
+	uint32_t size;
+	uint32_t resolution;
+	CIRC_CELL_FACE faces[6];
+	uint8_t cells[1];
+} CIRC_CELL_INDEX;
+
+CIRC_CELL_INDEX* circ_cell_index_new(const LWGEOM* lwgeom, const CIRC_NODE* tree, const GBOX* gbox, const POINT2D* pt_outside);
+int circ_cell_index_lookup(const CIRC_CELL_INDEX* index, const POINT3D* pt);
+
 #endif /* _LWGEODETIC_TREE_H */
 
 
@@ -53,6 +53,10 @@ GEOSGeometry* make_geos_segment(double x1, double y1, double x2, double y2);
 int cluster_intersecting(GEOSGeometry **geoms, uint32_t num_geoms, GEOSGeometry ***clusterGeoms, uint32_t *num_clusters);
 int cluster_within_distance(LWGEOM **geoms, uint32_t num_geoms, double tolerance, LWGEOM ***clusterGeoms, uint32_t *num_clusters);
 int union_dbscan(LWGEOM **geoms, uint32_t num_geoms, UNIONFIND *uf, double eps, uint32_t min_points, char **is_in_cluster_ret);
+/* As union_dbscan, point inputs are clustered on a grid using up to num_threads threads. A positive
+ * approximation lets pairs up to eps * (1 + approximation) apart count as neighbors to skip distance checks. */
+int union_dbscan_ext(LWGEOM **geoms, uint32_t num_geoms, UNIONFIND *uf, double eps, uint32_t min_points,
+		     char **is_in_cluster_ret, uint32_t num_threads, double approximation);
 
 POINTARRAY* ptarray_from_GEOSCoordSeq(const GEOSCoordSequence* cs, uint8_t want3d);
 
@@ -23,6 +23,7 @@
  **********************************************************************/
 
 #include <string.h>
+#include <pthread.h>
 #include "liblwgeom.h"
 #include "liblwgeom_internal.h"
 #include "lwgeom_log.h"
@@ -511,14 +512,494 @@ union_dbscan_general(LWGEOM** geoms, uint32_t num_geoms, UNIONFIND* uf, double e
 	return success;
 }
 
-int union_dbscan(LWGEOM** geoms, uint32_t num_geoms, UNIONFIND* uf, double eps, uint32_t min_points, char** in_a_cluster_ret)
+/*
+ * Point-specialized DBSCAN.
+ *
+ * Points are bucketed on a flat grid of eps-wide cells (eps/2 in
+ * approximate mode) and their coordinates packed in cell order, so
+ * the neighbors of a point are found by scanning a handful of runs
+ * of contiguous coordinates, with no GEOS envelopes or tree queries.
+ *
+ * The work is done in three passes over the grid: find the core
+ * points, union the core points that are within eps of each other,
+ * and attach each border point to a core point. Each pass only reads
+ * the grid and writes per-point state, so the cells are shared out
+ * between worker threads. Core points are merged with a lock-free
+ * union-find that always links the larger root under the smaller one,
+ * so the outcome does not depend on thread scheduling: a cluster is
+ * rooted at its lowest-numbered core point, and a border point joins
+ * the cluster of its lowest-numbered core neighbor, just like in the
+ * sequential implementation above.
+ *
+ * Worker threads must not call lwalloc or lwerror, which are mapped
+ * onto the backend memory contexts and error handling, so everything
+ * is allocated up front by the calling thread.
+ */
+
+#define DBSCAN_NO_POINT UINT32_MAX
+#define DBSCAN_CELLS_PER_TASK 256
+#define DBSCAN_MAX_REACH 2
+
+typedef struct
+{
+	uint64_t key;   /* cell x in the high word, cell y in the low word */
+	uint32_t id;    /* input index */
+} DBSCAN_ENTRY;
+
+typedef struct
+{
+	uint64_t key;   /* packed cell coordinates */
+	uint32_t start; /* first packed point of the cell */
+	uint32_t count; /* number of points in the cell */
+} DBSCAN_CELL;
+
+typedef struct
+{
+	const DBSCAN_CELL* cell;
+	char all_within; /* every pair of points between the two cells counts as neighbors */
+} DBSCAN_NEIGHBOR_CELL;
+
+typedef enum
+{
+	DBSCAN_PASS_CORE,
+	DBSCAN_PASS_UNION,
+	DBSCAN_PASS_BORDER
+} DBSCAN_PASS;
+
+typedef struct
+{
+	POINT2D* pts;       /* coordinates, packed in cell order */
+	uint32_t* ids;      /* input index of each packed point */
+	DBSCAN_CELL* cells; /* non-empty cells, sorted by key */
+	uint32_t num_cells;
+	double eps;
+	double eps_approx;  /* cell pairs entirely within this distance skip the point checks */
+	double side;        /* cell width */
+	int reach;          /* how many cells away a neighbor can sit */
+	uint32_t min_points;
+	char* is_core;      /* by input index */
+	uint32_t* parent;   /* lock-free union-find, by input index */
+	uint32_t* attach;   /* core point each border point joins, by input index */
+	DBSCAN_PASS pass;
+	uint32_t next_cell; /* work distribution counter */
+} DBSCAN_GRID;
+
+static int
+dbscan_cmp_entry(const void* a, const void* b)
+{
+	const DBSCAN_ENTRY* ea = (const DBSCAN_ENTRY*)a;
+	const DBSCAN_ENTRY* eb = (const DBSCAN_ENTRY*)b;
+	if (ea->key != eb->key)
+		return ea->key < eb->key ? -1 : 1;
+	if (ea->id != eb->id)
+		return ea->id < eb->id ? -1 : 1;
+	return 0;
+}
+
+static uint32_t
+dbscan_uf_find(uint32_t* parent, uint32_t i)
+{
+	for (;;)
+	{
+		uint32_t p = __atomic_load_n(&parent[i], __ATOMIC_ACQUIRE);
+		uint32_t gp;
+		if (p == i)
+			return i;
+		/* Path halving, losing the race is harmless */
+		gp = __atomic_load_n(&parent[p], __ATOMIC_ACQUIRE);
+		if (gp != p)
+			__atomic_compare_exchange_n(&parent[i], &p, gp, LW_FALSE, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+		i = gp;
+	}
+}
+
+static void
+dbscan_uf_union(uint32_t* parent, uint32_t a, uint32_t b)
+{
+	for (;;)
+	{
+		uint32_t lo, hi;
+		a = dbscan_uf_find(parent, a);
+		b = dbscan_uf_find(parent, b);
+		if (a == b)
+			return;
+		lo = a < b ? a : b;
+		hi = a < b ? b : a;
+		/* Only a root can be linked, retry if another thread got there first */
+		if (__atomic_compare_exchange_n(&parent[hi], &hi, lo, LW_FALSE, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			return;
+	}
+}
+
+static const DBSCAN_CELL*
+dbscan_find_cell(const DBSCAN_GRID* grid, uint64_t key)
+{
+	uint32_t lo = 0, hi = grid->num_cells;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (grid->cells[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < grid->num_cells && grid->cells[lo].key == key)
+		return &(grid->cells[lo]);
+	return NULL;
+}
+
+/* Collect the non-empty cells that may hold neighbors of the points of cell c */
+static uint32_t
+dbscan_neighbor_cells(const DBSCAN_GRID* grid, const DBSCAN_CELL* c, DBSCAN_NEIGHBOR_CELL* out)
 {
+	int64_t cx = (int64_t)(c->key >> 32);
+	int64_t cy = (int64_t)(c->key & 0xFFFFFFFF);
+	uint32_t n = 0;
+	int dx, dy;
+
+	for (dx = -grid->reach; dx <= grid->reach; dx++)
+	{
+		for (dy = -grid->reach; dy <= grid->reach; dy++)
+		{
+			int64_t nx = cx + dx, ny = cy + dy;
+			double gapx, gapy, spanx, spany;
+			const DBSCAN_CELL* nc;
+
+			if (nx < 0 || ny < 0 || nx > UINT32_MAX || ny > UINT32_MAX)
+				continue;
+
+			/* Closest and furthest apart two points of the cells can be */
+			gapx = (abs(dx) > 0 ? abs(dx) - 1 : 0) * grid->side;
+			gapy = (abs(dy) > 0 ? abs(dy) - 1 : 0) * grid->side;
+			if (sqrt(gapx * gapx + gapy * gapy) > grid->eps)
+				continue;
+
+			nc = dbscan_find_cell(grid, ((uint64_t)nx << 32) | (uint64_t)ny);
+			if (!nc)
+				continue;
+
+			spanx = (abs(dx) + 1) * grid->side;
+			spany = (abs(dy) + 1) * grid->side;
+			out[n].cell = nc;
+			out[n].all_within = sqrt(spanx * spanx + spany * spany) <= grid->eps_approx;
+			n++;
+		}
+	}
+	return n;
+}
+
+static inline int
+dbscan_within(const DBSCAN_GRID* grid, const POINT2D* p, const POINT2D* q)
+{
+	double hside = q->x - p->x;
+	double vside = q->y - p->y;
+	return sqrt(hside * hside + vside * vside) <= grid->eps;
+}
+
+static void
+dbscan_process_cell(DBSCAN_GRID* grid, const DBSCAN_CELL* c)
+{
+	DBSCAN_NEIGHBOR_CELL nbrs[(2 * DBSCAN_MAX_REACH + 1) * (2 * DBSCAN_MAX_REACH + 1)];
+	uint32_t num_nbrs = dbscan_neighbor_cells(grid, c, nbrs);
+	uint32_t i, j, k;
+
+	for (i = c->start; i < c->start + c->count; i++)
+	{
+		const POINT2D* p = &(grid->pts[i]);
+		uint32_t pid = grid->ids[i];
+
+		if (grid->pass == DBSCAN_PASS_CORE)
+		{
+			uint32_t num_neighbors = 0;
+			for (k = 0; k < num_nbrs && num_neighbors < grid->min_points; k++)
+			{
+				const DBSCAN_CELL* nc = nbrs[k].cell;
+				if (nbrs[k].all_within)
+				{
+					num_neighbors += nc->count;
+					continue;
+				}
+				for (j = nc->start; j < nc->start + nc->count && num_neighbors < grid->min_points; j++)
+				{
+					if (dbscan_within(grid, p, &(grid->pts[j])))
+						num_neighbors++;
+				}
+			}
+			grid->is_core[pid] = num_neighbors >= grid->min_points;
+		}
+		else if (grid->pass == DBSCAN_PASS_UNION)
+		{
+			if (!grid->is_core[pid])
+				continue;
+			for (k = 0; k < num_nbrs; k++)
+			{
+				const DBSCAN_CELL* nc = nbrs[k].cell;
+				for (j = nc->start; j < nc->start + nc->count; j++)
+				{
+					uint32_t qid = grid->ids[j];
+					/* Every pair is seen from both ends, only look at it once */
+					if (qid <= pid || !grid->is_core[qid])
+						continue;
+					if (nbrs[k].all_within || dbscan_within(grid, p, &(grid->pts[j])))
+						dbscan_uf_union(grid->parent, pid, qid);
+				}
+			}
+		}
+		else
+		{
+			uint32_t best = DBSCAN_NO_POINT;
+			if (grid->is_core[pid])
+				continue;
+			for (k = 0; k < num_nbrs; k++)
+			{
+				const DBSCAN_CELL* nc = nbrs[k].cell;
+				for (j = nc->start; j < nc->start + nc->count; j++)
+				{
+					uint32_t qid = grid->ids[j];
+					if (qid >= best || !grid->is_core[qid])
+						continue;
+					if (nbrs[k].all_within || dbscan_within(grid, p, &(grid->pts[j])))
+						best = qid;
+				}
+			}
+			grid->attach[pid] = best;
+		}
+	}
+}
+
+static void*
+dbscan_worker(void* arg)
+{
+	DBSCAN_GRID* grid = (DBSCAN_GRID*)arg;
+	for (;;)
+	{
+		uint32_t c, first = __atomic_fetch_add(&(grid->next_cell), DBSCAN_CELLS_PER_TASK, __ATOMIC_RELAXED);
+		if (first >= grid->num_cells)
+			break;
+		for (c = first; c < first + DBSCAN_CELLS_PER_TASK && c < grid->num_cells; c++)
+			dbscan_process_cell(grid, &(grid->cells[c]));
+	}
+	return NULL;
+}
+
+static void
+dbscan_run_pass(DBSCAN_GRID* grid, DBSCAN_PASS pass, pthread_t* threads, uint32_t num_threads)
+{
+	uint32_t t, num_started = 0;
+
+	grid->pass = pass;
+	grid->next_cell = 0;
+
+	for (t = 1; t < num_threads; t++)
+	{
+		if (pthread_create(&(threads[num_started]), NULL, dbscan_worker, grid) != 0)
+			break;
+		num_started++;
+	}
+
+	/* The calling thread takes its share too, and all of it if no worker started */
+	dbscan_worker(grid);
+
+	for (t = 0; t < num_started; t++)
+		pthread_join(threads[t], NULL);
+}
+
+/* union_dbscan_points was interrupted between two passes */
+#define DBSCAN_INTERRUPTED -1
+
+/*
+ * Returns LW_FAILURE if the inputs are not all points, or can not be gridded,
+ * and DBSCAN_INTERRUPTED if an interrupt was requested between two passes.
+ */
+static int
+union_dbscan_points(LWGEOM** geoms, uint32_t num_geoms, UNIONFIND* uf, double eps, uint32_t min_points,
+		    char** in_a_cluster_ret, uint32_t num_threads, double approximation)
+{
+	DBSCAN_GRID grid;
+	DBSCAN_ENTRY* entries;
+	pthread_t* threads;
+	char* in_a_cluster;
+	int interrupted = LW_FALSE;
+	uint32_t i, num_pts = 0;
+	double xmin = DBL_MAX, ymin = DBL_MAX, xmax = -DBL_MAX, ymax = -DBL_MAX;
+	double magnitude, slack;
+	int div = approximation > 0.0 ? DBSCAN_MAX_REACH : 1;
+
+	if (!(eps > 0.0) || !isfinite(eps))
+		return LW_FAILURE;
+
+	for (i = 0; i < num_geoms; i++)
+	{
+		const POINT2D* pt;
+		if (lwgeom_get_type(geoms[i]) != POINTTYPE)
+			return LW_FAILURE;
+		if (lwgeom_is_empty(geoms[i]))
+			continue;
+		pt = getPoint2d_cp(lwgeom_as_lwpoint(geoms[i])->point, 0);
+		if (!isfinite(pt->x) || !isfinite(pt->y))
+			return LW_FAILURE;
+		xmin = FP_MIN(xmin, pt->x);
+		ymin = FP_MIN(ymin, pt->y);
+		xmax = FP_MAX(xmax, pt->x);
+		ymax = FP_MAX(ymax, pt->y);
+		num_pts++;
+	}
+
+	/*
+	 * Widen the cells a hair past eps / div, by more than the rounding error
+	 * of computing the cell coordinates, so that two points within eps of each
+	 * other can never land more than div cells apart.
+	 */
+	memset(&grid, 0, sizeof(DBSCAN_GRID));
+	magnitude = FP_MAX(FP_MAX(fabs(xmin), fabs(xmax)), FP_MAX(fabs(ymin), fabs(ymax)));
+	slack = 16 * DBL_EPSILON * FP_MAX(1.0, div * magnitude / eps);
+	grid.side = eps / div * (1.0 + slack);
+
+	/* Cell coordinates have to fit in 32 bits */
+	if (slack > 0.01 || (num_pts && ((xmax - xmin) / grid.side >= UINT32_MAX || (ymax - ymin) / grid.side >= UINT32_MAX)))
+		return LW_FAILURE;
+
+	grid.eps = eps;
+	grid.eps_approx = approximation > 0.0 ? eps * (1.0 + approximation) : -1.0;
+	grid.reach = div;
+	grid.min_points = min_points > 1 ? min_points : 1;
+
+	/* Bucket and pack the points */
+	entries = (DBSCAN_ENTRY*)lwalloc(sizeof(DBSCAN_ENTRY) * (num_pts ? num_pts : 1));
+	num_pts = 0;
+	for (i = 0; i < num_geoms; i++)
+	{
+		const POINT2D* pt;
+		uint64_t cx, cy;
+		if (lwgeom_is_empty(geoms[i]))
+			continue;
+		pt = getPoint2d_cp(lwgeom_as_lwpoint(geoms[i])->point, 0);
+		cx = (uint64_t)floor((pt->x - xmin) / grid.side);
+		cy = (uint64_t)floor((pt->y - ymin) / grid.side);
+		entries[num_pts].key = (cx << 32) | cy;
+		entries[num_pts].id = i;
+		num_pts++;
+	}
+	qsort(entries, num_pts, sizeof(DBSCAN_ENTRY), dbscan_cmp_entry);
+
+	grid.pts = (POINT2D*)lwalloc(sizeof(POINT2D) * (num_pts ? num_pts : 1));
+	grid.ids = (uint32_t*)lwalloc(sizeof(uint32_t) * (num_pts ? num_pts : 1));
+	grid.cells = (DBSCAN_CELL*)lwalloc(sizeof(DBSCAN_CELL) * (num_pts ? num_pts : 1));
+	for (i = 0; i < num_pts; i++)
+	{
+		grid.pts[i] = *getPoint2d_cp(lwgeom_as_lwpoint(geoms[entries[i].id])->point, 0);
+		grid.ids[i] = entries[i].id;
+		if (i == 0 || entries[i].key != entries[i - 1].key)
+		{
+			grid.cells[grid.num_cells].key = entries[i].key;
+			grid.cells[grid.num_cells].start = i;
+			grid.cells[grid.num_cells].count = 0;
+			grid.num_cells++;
+		}
+		grid.cells[grid.num_cells - 1].count++;
+	}
+	lwfree(entries);
+
+	grid.is_core = (char*)lwalloc(num_geoms * sizeof(char));
+	grid.parent = (uint32_t*)lwalloc(num_geoms * sizeof(uint32_t));
+	grid.attach = (uint32_t*)lwalloc(num_geoms * sizeof(uint32_t));
+	memset(grid.is_core, 0, num_geoms * sizeof(char));
+	for (i = 0; i < num_geoms; i++)
+	{
+		grid.parent[i] = i;
+		grid.attach[i] = DBSCAN_NO_POINT;
+	}
+
+	if (num_threads < 1)
+		num_threads = 1;
+	threads = (pthread_t*)lwalloc(num_threads * sizeof(pthread_t));
+
+	/* Workers can not see the interrupt flag, so it is checked between passes */
+	if (grid.min_points > 1)
+		dbscan_run_pass(&grid, DBSCAN_PASS_CORE, threads, num_threads);
+	else
+		for (i = 0; i < num_pts; i++)
+			grid.is_core[grid.ids[i]] = LW_TRUE;
+	LW_ON_INTERRUPT(interrupted = LW_TRUE);
+
+	if (!interrupted)
+	{
+		dbscan_run_pass(&grid, DBSCAN_PASS_UNION, threads, num_threads);
+		LW_ON_INTERRUPT(interrupted = LW_TRUE);
+	}
+
+	if (!interrupted && grid.min_points > 1)
+		dbscan_run_pass(&grid, DBSCAN_PASS_BORDER, threads, num_threads);
+
+	if (interrupted)
+	{
+		lwfree(threads);
+		lwfree(grid.attach);
+		lwfree(grid.parent);
+		lwfree(grid.is_core);
+		lwfree(grid.cells);
+		lwfree(grid.ids);
+		lwfree(grid.pts);
+		return DBSCAN_INTERRUPTED;
+	}
+
+	/* Replay the outcome into the caller's UNIONFIND, lowest ids first */
+	in_a_cluster = (char*)lwalloc(num_geoms * sizeof(char));
+	for (i = 0; i < num_geoms; i++)
+	{
+		in_a_cluster[i] = grid.min_points <= 1 || grid.is_core[i];
+		if (grid.is_core[i])
+		{
+			uint32_t root = dbscan_uf_find(grid.parent, i);
+			if (root != i)
+				UF_union(uf, root, i);
+		}
+	}
+	for (i = 0; i < num_geoms; i++)
+	{
+		if (grid.attach[i] != DBSCAN_NO_POINT)
+		{
+			UF_union(uf, grid.attach[i], i);
+			in_a_cluster[i] = LW_TRUE;
+		}
+	}
+
+	if (in_a_cluster_ret)
+		*in_a_cluster_ret = in_a_cluster;
+	else
+		lwfree(in_a_cluster);
+
+	lwfree(threads);
+	lwfree(grid.attach);
+	lwfree(grid.parent);
+	lwfree(grid.is_core);
+	lwfree(grid.cells);
+	lwfree(grid.ids);
+	lwfree(grid.pts);
+	return LW_SUCCESS;
+}
+
+int union_dbscan_ext(LWGEOM** geoms, uint32_t num_geoms, UNIONFIND* uf, double eps, uint32_t min_points,
+		     char** in_a_cluster_ret, uint32_t num_threads, double approximation)
+{
+	/* Point inputs take the grid path, which also does the threading and approximation */
+	int rv = union_dbscan_points(geoms, num_geoms, uf, eps, min_points, in_a_cluster_ret, num_threads, approximation);
+	if (rv == LW_SUCCESS)
+		return LW_SUCCESS;
+	if (rv == DBSCAN_INTERRUPTED)
+		return LW_FAILURE;
+
 	if (min_points <= 1)
 		return union_dbscan_minpoints_1(geoms, num_geoms, uf, eps, in_a_cluster_ret);
 	else
 		return union_dbscan_general(geoms, num_geoms, uf, eps, min_points, in_a_cluster_ret);
 }
 
+int union_dbscan(LWGEOM** geoms, uint32_t num_geoms, UNIONFIND* uf, double eps, uint32_t min_points, char** in_a_cluster_ret)
+{
+	return union_dbscan_ext(geoms, num_geoms, uf, eps, min_points, in_a_cluster_ret, 1, 0.0);
+}
+
 /** Takes an array of LWGEOM* and constructs an array of LWGEOM*, where each element in the constructed array is a
  *  GeometryCollection representing a set of geometries separated by no more than the specified tolerance. Caller is
  *  responsible for freeing the input array, but not the LWGEOM* items inside it. */
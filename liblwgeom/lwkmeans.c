@@ -5,6 +5,8 @@
  *
  *------------------------------------------------------------------------*/
 
+#include <pthread.h>
+
 #include "liblwgeom_internal.h"
 
 /*
@@ -19,13 +21,100 @@
  */
 #define KMEANS_MAX_ITERATIONS 1000
 
+/*
+ * Objects are handed to the assignment threads in chunks of this size.
+ * Partial sums are kept per chunk and added up in chunk order, so results
+ * do not depend on the number of threads.
+ */
+#define KMEANS_CHUNK_SIZE 4096
+
+/*
+ * Relative slack added to the triangle inequality bounds, so that rounding
+ * never lets them prune an object whose nearest center did change.
+ */
+#define KMEANS_BOUND_EPSILON (16 * DBL_EPSILON)
+
+/* k-means|| seeding: number of sampling rounds, and samples per round in units of k */
+#define KMEANS_SEED_ROUNDS 5
+#define KMEANS_SEED_OVERSAMPLING 2
+
+/* Mini-batch seeding looks at a sample of this many batches */
+#define KMEANS_SEED_SAMPLE_BATCHES 3
+
+/* Mini-batch stops once no center moves further than this fraction of the input extent */
+#define KMEANS_MINIBATCH_TOLERANCE 1e-4
+
+/* Streams of the deterministic random generator */
+#define KMEANS_STREAM_SEED 0
+#define KMEANS_STREAM_BATCH (KMEANS_SEED_ROUNDS + 2)
+
+typedef enum
+{
+	KMEANS_TASK_ASSIGN,	   /* find nearest center for every object, resetting bounds */
+	KMEANS_TASK_ASSIGN_PRUNED, /* same, skipping objects whose bounds prove the assignment */
+	KMEANS_TASK_ASSIGN_BATCH,  /* find nearest center for every mini-batch sample */
+	KMEANS_TASK_SEED_SAMPLE,   /* k-means|| oversampling draw */
+	KMEANS_TASK_SEED_UPDATE	   /* k-means|| distance and cost update for new candidates */
+} KMEANS_TASK;
+
+typedef struct
+{
+	POINT4D *objs;
+	uint32_t *clusters;
+	uint32_t n;
+	POINT4D *centers;
+	uint32_t k;
+
+	/* Hamerly bounds, only allocated for full Lloyd iterations */
+	double *upper;	   /* per object, upper bound of distance to its center */
+	double *lower;	   /* per object, lower bound of distance to any other center */
+	double *half_gap;  /* per center, half the distance to the nearest other center */
+	double *shift;	   /* per center, distance moved by the last update */
+	POINT4D *old_centers;
+	double max_shift;
+	double second_max_shift;
+	uint32_t max_shift_cluster;
+
+	/* Mini-batch samples and their nearest centers */
+	uint32_t *batch;
+	uint32_t *batch_clusters;
+	uint32_t batch_size;
+
+	/* k-means|| seeding, over a sample of the objects */
+	POINT4D *seed_objs;
+	uint32_t seed_n;
+	POINT4D *candidates;
+	uint32_t num_candidates;
+	uint32_t first_new_candidate;
+	double *seed_distance; /* per object, squared distance to nearest candidate */
+	uint32_t *seed_nearest;
+	uint8_t *seed_chosen;
+	double seed_factor;
+	uint32_t seed_round;
+
+	/* Work distribution, written by worker threads chunk by chunk */
+	KMEANS_TASK task;
+	uint32_t task_size;
+	uint32_t next_chunk;
+	uint32_t num_chunks;
+	uint32_t *changed; /* per chunk, objects that switched clusters */
+	double *cost;	   /* per chunk, weighted seeding cost */
+	uint32_t num_threads;
+	pthread_t *threads;
+
+	/* Set when an interrupt was seen between two passes */
+	uint8_t interrupted;
+} KMEANS_STATE;
+
 static uint32_t kmeans(POINT4D *objs,
 		       uint32_t *clusters,
 		       uint32_t n,
 		       POINT4D *centers,
 		       double *radii,
 		       uint32_t min_k,
-		       double max_radius);
+		       double max_radius,
+		       uint32_t batch_size,
+		       uint32_t num_threads);
 
 inline static double
 distance3d_sqr_pt4d_pt4d(const POINT4D *p1, const POINT4D *p2)
@@ -37,7 +126,254 @@ distance3d_sqr_pt4d_pt4d(const POINT4D *p1, const POINT4D *p2)
 	return hside * hside + vside * vside + zside * zside;
 }
 
-/* Split the clusters that need to be split */
+/* Uniform double in [0, 1) for a given stream and index, independent of evaluation order */
+inline static double
+kmeans_random(uint64_t stream, uint64_t index)
+{
+	/* splitmix64 finalizer, applied to the stream and then to the index */
+	uint64_t z = stream * UINT64_C(0x9E3779B97F4A7C15) + index;
+	z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+	z ^= z >> 31;
+	return (double)(z >> 11) / 9007199254740992.0;
+}
+
+/* Nearest center to an object, ties going to the lowest index, and squared distances to the two nearest */
+inline static uint32_t
+kmeans_nearest(const POINT4D *obj, const POINT4D *centers, uint32_t k, double *best_ret, double *second_ret)
+{
+	double best = distance3d_sqr_pt4d_pt4d(obj, &centers[0]);
+	double second = DBL_MAX;
+	uint32_t best_cluster = 0;
+
+	for (uint32_t cluster = 1; cluster < k; cluster++)
+	{
+		double distance = distance3d_sqr_pt4d_pt4d(obj, &centers[cluster]);
+		if (distance < best)
+		{
+			second = best;
+			best = distance;
+			best_cluster = cluster;
+		}
+		else if (distance < second)
+			second = distance;
+	}
+	*best_ret = best;
+	*second_ret = second;
+	return best_cluster;
+}
+
+/* Find nearest center for objects in [start, end), counting the ones that moved */
+static uint32_t
+kmeans_assign_range(KMEANS_STATE *state, uint32_t start, uint32_t end, int prune)
+{
+	uint32_t changed = 0;
+
+	for (uint32_t i = start; i < end; i++)
+	{
+		const POINT4D *obj = &state->objs[i];
+		uint32_t cluster = state->clusters[i];
+		double best, second;
+
+		if (prune)
+		{
+			/* Centers moved since the bounds were set, loosen them accordingly */
+			double other_shift = cluster == state->max_shift_cluster ? state->second_max_shift
+										 : state->max_shift;
+			double upper = state->upper[i] + state->shift[cluster];
+			double lower = state->lower[i] - other_shift;
+			double bound;
+
+			upper += KMEANS_BOUND_EPSILON * (state->upper[i] + state->shift[cluster]);
+			lower -= KMEANS_BOUND_EPSILON * (fabs(state->lower[i]) + other_shift);
+			bound = FP_MAX(lower, state->half_gap[cluster]);
+			state->lower[i] = lower;
+
+			/* No other center can be as close as the current one */
+			if (upper < bound)
+			{
+				state->upper[i] = upper;
+				continue;
+			}
+
+			/* Tighten the upper bound and try again before scanning all centers */
+			upper = sqrt(distance3d_sqr_pt4d_pt4d(obj, &state->centers[cluster])) *
+				(1 + KMEANS_BOUND_EPSILON);
+			state->upper[i] = upper;
+			if (upper < bound)
+				continue;
+		}
+
+		uint32_t nearest = kmeans_nearest(obj, state->centers, state->k, &best, &second);
+		if (nearest != cluster)
+		{
+			state->clusters[i] = nearest;
+			changed++;
+		}
+		if (state->upper)
+		{
+			state->upper[i] = sqrt(best) * (1 + KMEANS_BOUND_EPSILON);
+			state->lower[i] = sqrt(second) * (1 - KMEANS_BOUND_EPSILON);
+		}
+	}
+	return changed;
+}
+
+/* Update nearest candidate and weighted seeding cost for objects in [start, end) */
+static double
+kmeans_seed_update_range(KMEANS_STATE *state, uint32_t start, uint32_t end)
+{
+	double cost = 0;
+
+	for (uint32_t i = start; i < end; i++)
+	{
+		for (uint32_t c = state->first_new_candidate; c < state->num_candidates; c++)
+		{
+			double distance = distance3d_sqr_pt4d_pt4d(&state->seed_objs[i], &state->candidates[c]);
+			if (distance < state->seed_distance[i])
+			{
+				state->seed_distance[i] = distance;
+				state->seed_nearest[i] = c;
+			}
+		}
+		cost += state->seed_objs[i].m * state->seed_distance[i];
+	}
+	return cost;
+}
+
+static void
+kmeans_run_chunk(KMEANS_STATE *state, uint32_t chunk)
+{
+	uint32_t start = chunk * KMEANS_CHUNK_SIZE;
+	uint32_t end = FP_MIN(start + KMEANS_CHUNK_SIZE, state->task_size);
+	double best, second;
+
+	switch (state->task)
+	{
+	case KMEANS_TASK_ASSIGN:
+		state->changed[chunk] = kmeans_assign_range(state, start, end, LW_FALSE);
+		break;
+	case KMEANS_TASK_ASSIGN_PRUNED:
+		state->changed[chunk] = kmeans_assign_range(state, start, end, LW_TRUE);
+		break;
+	case KMEANS_TASK_ASSIGN_BATCH:
+		for (uint32_t j = start; j < end; j++)
+			state->batch_clusters[j] = kmeans_nearest(
+			    &state->objs[state->batch[j]], state->centers, state->k, &best, &second);
+		break;
+	case KMEANS_TASK_SEED_SAMPLE:
+		/* Sample each object with probability proportional to its share of the cost */
+		for (uint32_t i = start; i < end; i++)
+			state->seed_chosen[i] =
+			    kmeans_random(KMEANS_STREAM_SEED + state->seed_round, i) <
+			    state->seed_factor * state->seed_objs[i].m * state->seed_distance[i];
+		break;
+	case KMEANS_TASK_SEED_UPDATE:
+		state->cost[chunk] = kmeans_seed_update_range(state, start, end);
+		break;
+	}
+}
+
+/* Worker threads only read the inputs and write their own chunks: no allocations, no errors */
+static void *
+kmeans_worker(void *arg)
+{
+	KMEANS_STATE *state = (KMEANS_STATE *)arg;
+	for (;;)
+	{
+		uint32_t chunk = __atomic_fetch_add(&(state->next_chunk), 1, __ATOMIC_RELAXED);
+		if (chunk >= state->num_chunks)
+			break;
+		kmeans_run_chunk(state, chunk);
+	}
+	return NULL;
+}
+
+static void
+kmeans_run_task(KMEANS_STATE *state, KMEANS_TASK task, uint32_t task_size)
+{
+	uint32_t t, num_started = 0;
+
+	state->task = task;
+	state->task_size = task_size;
+	state->num_chunks = (task_size + KMEANS_CHUNK_SIZE - 1) / KMEANS_CHUNK_SIZE;
+	state->next_chunk = 0;
+
+	for (t = 1; t < state->num_threads && t < state->num_chunks; t++)
+	{
+		if (pthread_create(&(state->threads[num_started]), NULL, kmeans_worker, state) != 0)
+			break;
+		num_started++;
+	}
+
+	/* The calling thread takes its share too, and all of it if no worker started */
+	kmeans_worker(state);
+
+	for (t = 0; t < num_started; t++)
+		pthread_join(state->threads[t], NULL);
+}
+
+static void
+kmeans_state_init(KMEANS_STATE *state,
+		  POINT4D *objs,
+		  uint32_t *clusters,
+		  uint32_t n,
+		  POINT4D *centers,
+		  uint32_t batch_size,
+		  uint32_t num_threads)
+{
+	uint32_t max_chunks = (FP_MAX(n, batch_size) + KMEANS_CHUNK_SIZE - 1) / KMEANS_CHUNK_SIZE;
+
+	memset(state, 0, sizeof(KMEANS_STATE));
+	state->objs = objs;
+	state->clusters = clusters;
+	state->n = n;
+	state->centers = centers;
+	state->batch_size = batch_size;
+	state->num_threads = FP_MAX(num_threads, 1);
+	state->changed = (uint32_t *)lwalloc(sizeof(uint32_t) * max_chunks);
+	state->cost = (double *)lwalloc(sizeof(double) * max_chunks);
+	if (state->num_threads > 1)
+		state->threads = (pthread_t *)lwalloc(sizeof(pthread_t) * (state->num_threads - 1));
+
+	if (batch_size)
+	{
+		state->batch = (uint32_t *)lwalloc(sizeof(uint32_t) * batch_size);
+		state->batch_clusters = (uint32_t *)lwalloc(sizeof(uint32_t) * batch_size);
+	}
+	else
+	{
+		/* Centers are at most n, see lwgeom_cluster_kmeans */
+		state->upper = (double *)lwalloc(sizeof(double) * n);
+		state->lower = (double *)lwalloc(sizeof(double) * n);
+		state->half_gap = (double *)lwalloc(sizeof(double) * n);
+		state->shift = (double *)lwalloc(sizeof(double) * n);
+		state->old_centers = (POINT4D *)lwalloc(sizeof(POINT4D) * n);
+	}
+}
+
+static void
+kmeans_state_free(KMEANS_STATE *state)
+{
+	if (state->threads)
+		lwfree(state->threads);
+	if (state->batch)
+		lwfree(state->batch);
+	if (state->batch_clusters)
+		lwfree(state->batch_clusters);
+	if (state->upper)
+	{
+		lwfree(state->upper);
+		lwfree(state->lower);
+		lwfree(state->half_gap);
+		lwfree(state->shift);
+		lwfree(state->old_centers);
+	}
+	lwfree(state->cost);
+	lwfree(state->changed);
+}
+
+/* Split the clusters that need to be split, returns 0 if a 2-means was interrupted or failed */
 static uint32_t
 improve_structure(POINT4D *objs,
 		  uint32_t *clusters,
@@ -45,7 +381,8 @@ improve_structure(POINT4D *objs,
 		  POINT4D *centers,
 		  double *radii,
 		  uint32_t k,
-		  double max_radius)
+		  double max_radius,
+		  uint32_t num_threads)
 {
 	/* Input check: radius limit should be measurable */
 	if (max_radius <= 0)
@@ -81,8 +418,12 @@ improve_structure(POINT4D *objs,
 		if (cluster_size <= 1)
 			continue;
 
-		/* run 2-means on the cluster */
-		kmeans(temp_objs, temp_clusters, cluster_size, temp_centers, temp_radii, 2, 0);
+		/* run 2-means on the cluster, giving up if it did not complete */
+		if (!kmeans(temp_objs, temp_clusters, cluster_size, temp_centers, temp_radii, 2, 0, 0, num_threads))
+		{
+			new_k = 0;
+			break;
+		}
 
 		/* replace cluster with split */
 		uint32_t d = 0;
@@ -104,44 +445,33 @@ improve_structure(POINT4D *objs,
 	return new_k;
 }
 
-/* Refresh mapping of point to closest cluster */
+/*
+ * Refresh mapping of point to closest cluster. With prune set, objects whose
+ * Hamerly bounds show their center is still the closest one are skipped.
+ */
 static uint8_t
-update_r(POINT4D *objs, uint32_t *clusters, uint32_t n, POINT4D *centers, double *radii, uint32_t k)
+update_r(KMEANS_STATE *state, uint32_t k, int prune)
 {
-	uint8_t converged = LW_TRUE;
-	if (radii)
-		memset(radii, 0, sizeof(double) * k);
+	uint32_t changed = 0;
+
+	state->k = k;
+	kmeans_run_task(state, prune ? KMEANS_TASK_ASSIGN_PRUNED : KMEANS_TASK_ASSIGN, state->n);
+	for (uint32_t chunk = 0; chunk < state->num_chunks; chunk++)
+		changed += state->changed[chunk];
+	return changed == 0;
+}
 
+/* Largest squared distance from an object to its cluster center */
+static void
+update_radii(POINT4D *objs, uint32_t *clusters, uint32_t n, POINT4D *centers, double *radii, uint32_t k)
+{
+	memset(radii, 0, sizeof(double) * k);
 	for (uint32_t i = 0; i < n; i++)
 	{
-		POINT4D obj = objs[i];
-
-		/* Initialize with distance to first cluster */
-		double curr_distance = distance3d_sqr_pt4d_pt4d(&obj, &centers[0]);
-		uint32_t curr_cluster = 0;
-
-		/* Check all other cluster centers and find the nearest */
-		for (uint32_t cluster = 1; cluster < k; cluster++)
-		{
-			double distance = distance3d_sqr_pt4d_pt4d(&obj, &centers[cluster]);
-			if (distance < curr_distance)
-			{
-				curr_distance = distance;
-				curr_cluster = cluster;
-			}
-		}
-
-		/* Store the nearest cluster this object is in */
-		if (clusters[i] != curr_cluster)
-		{
-			converged = LW_FALSE;
-			clusters[i] = curr_cluster;
-		}
-		if (radii)
-			if (radii[curr_cluster] < curr_distance)
-				radii[curr_cluster] = curr_distance;
+		double distance = distance3d_sqr_pt4d_pt4d(&objs[i], &centers[clusters[i]]);
+		if (radii[clusters[i]] < distance)
+			radii[clusters[i]] = distance;
 	}
-	return converged;
 }
 
 /* Refresh cluster centroids based on all of their objects */
@@ -170,6 +500,46 @@ update_means(POINT4D *objs, uint32_t *clusters, uint32_t n, POINT4D *centers, ui
 	}
 }
 
+/* Refresh centroids, recording how far each center moved and how close the centers are to each other */
+static void
+update_means_and_bounds(KMEANS_STATE *state, uint32_t k)
+{
+	memcpy(state->old_centers, state->centers, sizeof(POINT4D) * k);
+	update_means(state->objs, state->clusters, state->n, state->centers, k);
+
+	state->max_shift = state->second_max_shift = 0;
+	state->max_shift_cluster = 0;
+	for (uint32_t c = 0; c < k; c++)
+	{
+		double shift = sqrt(distance3d_sqr_pt4d_pt4d(&state->old_centers[c], &state->centers[c]));
+		state->shift[c] = shift;
+		if (shift > state->max_shift)
+		{
+			state->second_max_shift = state->max_shift;
+			state->max_shift = shift;
+			state->max_shift_cluster = c;
+		}
+		else if (shift > state->second_max_shift)
+			state->second_max_shift = shift;
+	}
+
+	for (uint32_t c = 0; c < k; c++)
+		state->half_gap[c] = DBL_MAX;
+	for (uint32_t c = 0; c < k; c++)
+	{
+		for (uint32_t other = c + 1; other < k; other++)
+		{
+			double gap = distance3d_sqr_pt4d_pt4d(&state->centers[c], &state->centers[other]);
+			if (gap < state->half_gap[c])
+				state->half_gap[c] = gap;
+			if (gap < state->half_gap[other])
+				state->half_gap[other] = gap;
+		}
+	}
+	for (uint32_t c = 0; c < k; c++)
+		state->half_gap[c] = k > 1 ? sqrt(state->half_gap[c]) / 2 * (1 - KMEANS_BOUND_EPSILON) : DBL_MAX;
+}
+
 /* Assign initial clusters centroids heuristically */
 static void
 kmeans_init(POINT4D *objs, uint32_t n, POINT4D *centers, uint32_t k)
@@ -272,6 +642,213 @@ kmeans_init(POINT4D *objs, uint32_t n, POINT4D *centers, uint32_t k)
 	}
 }
 
+/* Run one k-means|| distance update over the candidates added since the last one, returning total cost */
+static double
+kmeans_seed_update(KMEANS_STATE *state)
+{
+	double cost = 0;
+	kmeans_run_task(state, KMEANS_TASK_SEED_UPDATE, state->seed_n);
+	for (uint32_t chunk = 0; chunk < state->num_chunks; chunk++)
+		cost += state->cost[chunk];
+	state->first_new_candidate = state->num_candidates;
+	return cost;
+}
+
+/*
+ * Scalable k-means++ (k-means||) seeding: a few rounds oversample the input
+ * with probability proportional to the distance to the candidates picked so
+ * far, then k-means++ picks k centers out of the candidates, weighted by
+ * the number of objects closest to each. Only a few batches worth of
+ * objects are looked at, as mini-batch iterations refine the centers anyway.
+ */
+static void
+kmeans_init_parallel(KMEANS_STATE *state, uint32_t k)
+{
+	uint32_t n = FP_MIN(state->n, KMEANS_SEED_SAMPLE_BATCHES * FP_MAX(state->batch_size, k));
+	POINT4D *objs = state->objs;
+	uint32_t oversampling = KMEANS_SEED_OVERSAMPLING * k;
+	uint32_t capacity = oversampling * KMEANS_SEED_ROUNDS + 1;
+	double *weights, *distances;
+	double cost;
+
+	if (n < state->n)
+	{
+		objs = (POINT4D *)lwalloc(sizeof(POINT4D) * n);
+		for (uint32_t i = 0; i < n; i++)
+			objs[i] = state->objs[(uint32_t)(kmeans_random(KMEANS_STREAM_SEED, i) * state->n)];
+	}
+	state->seed_objs = objs;
+	state->seed_n = n;
+	state->candidates = (POINT4D *)lwalloc(sizeof(POINT4D) * capacity);
+	state->seed_distance = (double *)lwalloc(sizeof(double) * n);
+	state->seed_nearest = (uint32_t *)lwalloc(sizeof(uint32_t) * n);
+	state->seed_chosen = (uint8_t *)lwalloc(sizeof(uint8_t) * n);
+	for (uint32_t i = 0; i < n; i++)
+		state->seed_distance[i] = DBL_MAX;
+
+	state->candidates[0] = objs[(uint32_t)(kmeans_random(KMEANS_STREAM_SEED + KMEANS_SEED_ROUNDS + 1, k) * n)];
+	state->num_candidates = 1;
+	state->first_new_candidate = 0;
+	cost = kmeans_seed_update(state);
+
+	for (uint32_t round = 1; round <= KMEANS_SEED_ROUNDS && cost > 0; round++)
+	{
+		/* Candidates so far still make a valid seeding, the caller stops after it */
+		LW_ON_INTERRUPT(state->interrupted = LW_TRUE; break);
+		state->seed_round = round;
+		state->seed_factor = oversampling / cost;
+		kmeans_run_task(state, KMEANS_TASK_SEED_SAMPLE, n);
+
+		for (uint32_t i = 0; i < n; i++)
+		{
+			if (!state->seed_chosen[i])
+				continue;
+			if (state->num_candidates == capacity)
+			{
+				capacity *= 2;
+				state->candidates =
+				    (POINT4D *)lwrealloc(state->candidates, sizeof(POINT4D) * capacity);
+			}
+			state->candidates[state->num_candidates++] = objs[i];
+		}
+		if (state->num_candidates > state->first_new_candidate)
+			cost = kmeans_seed_update(state);
+	}
+
+	if (state->num_candidates <= k)
+	{
+		/* Too few distinct objects to oversample, fall back to the exhaustive heuristic */
+		kmeans_init(state->objs, state->n, state->centers, k);
+	}
+	else
+	{
+		uint32_t num_candidates = state->num_candidates;
+		POINT4D *candidates = state->candidates;
+
+		weights = (double *)lwalloc(sizeof(double) * num_candidates);
+		distances = (double *)lwalloc(sizeof(double) * num_candidates);
+		memset(weights, 0, sizeof(double) * num_candidates);
+		for (uint32_t i = 0; i < n; i++)
+			weights[state->seed_nearest[i]] += objs[i].m;
+		for (uint32_t c = 0; c < num_candidates; c++)
+			distances[c] = DBL_MAX;
+
+		for (uint32_t i = 0; i < k; i++)
+		{
+			/* First center is drawn by weight alone, later ones by weighted squared distance */
+			uint32_t chosen = num_candidates;
+			double total = 0, target, sum = 0;
+			for (uint32_t c = 0; c < num_candidates; c++)
+				total += weights[c] * (i ? distances[c] : 1);
+			target = kmeans_random(KMEANS_STREAM_SEED + KMEANS_SEED_ROUNDS + 1, i) * total;
+			for (uint32_t c = 0; c < num_candidates; c++)
+			{
+				double share = weights[c] * (i ? distances[c] : 1);
+				if (share <= 0)
+					continue;
+				chosen = c;
+				sum += share;
+				if (sum > target)
+					break;
+			}
+			/* Nothing left with positive weight: take any candidate not yet used */
+			if (chosen == num_candidates)
+				for (uint32_t c = 0; c < num_candidates && chosen == num_candidates; c++)
+					if (distances[c] > 0)
+						chosen = c;
+			if (chosen == num_candidates)
+				chosen = i;
+
+			state->centers[i] = candidates[chosen];
+			for (uint32_t c = 0; c < num_candidates; c++)
+			{
+				double distance = distance3d_sqr_pt4d_pt4d(&candidates[c], &candidates[chosen]);
+				if (distance < distances[c])
+					distances[c] = distance;
+			}
+			distances[chosen] = 0;
+		}
+		lwfree(distances);
+		lwfree(weights);
+	}
+
+	lwfree(state->seed_chosen);
+	lwfree(state->seed_nearest);
+	lwfree(state->seed_distance);
+	lwfree(state->candidates);
+	if (objs != state->objs)
+		lwfree(objs);
+	state->candidates = NULL;
+	state->seed_objs = NULL;
+}
+
+/*
+ * Mini-batch k-means: every iteration draws a random sample of the input,
+ * and moves each center towards the samples nearest to it with a learning
+ * rate decreasing as the center accumulates weight.
+ */
+static void
+kmeans_minibatch(KMEANS_STATE *state, uint32_t k)
+{
+	POINT4D *objs = state->objs;
+	POINT4D *centers = state->centers;
+	uint32_t n = state->n;
+	double *counts = (double *)lwalloc(sizeof(double) * k);
+	POINT4D *old_centers = (POINT4D *)lwalloc(sizeof(POINT4D) * k);
+	double xmin = DBL_MAX, ymin = DBL_MAX, zmin = DBL_MAX, xmax = -DBL_MAX, ymax = -DBL_MAX, zmax = -DBL_MAX;
+	double tolerance_sq;
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		xmin = FP_MIN(xmin, objs[i].x);
+		ymin = FP_MIN(ymin, objs[i].y);
+		zmin = FP_MIN(zmin, objs[i].z);
+		xmax = FP_MAX(xmax, objs[i].x);
+		ymax = FP_MAX(ymax, objs[i].y);
+		zmax = FP_MAX(zmax, objs[i].z);
+	}
+	tolerance_sq = (xmax - xmin) * (xmax - xmin) + (ymax - ymin) * (ymax - ymin) + (zmax - zmin) * (zmax - zmin);
+	tolerance_sq *= KMEANS_MINIBATCH_TOLERANCE * KMEANS_MINIBATCH_TOLERANCE;
+
+	state->k = k;
+	memset(counts, 0, sizeof(double) * k);
+	for (uint32_t t = 0; t < KMEANS_MAX_ITERATIONS && tolerance_sq > 0; t++)
+	{
+		double max_shift_sq = 0;
+
+		LW_ON_INTERRUPT(state->interrupted = LW_TRUE; break);
+		for (uint32_t j = 0; j < state->batch_size; j++)
+			state->batch[j] = (uint32_t)(kmeans_random(KMEANS_STREAM_BATCH + t, j) * n);
+		kmeans_run_task(state, KMEANS_TASK_ASSIGN_BATCH, state->batch_size);
+
+		memcpy(old_centers, centers, sizeof(POINT4D) * k);
+		for (uint32_t j = 0; j < state->batch_size; j++)
+		{
+			const POINT4D *obj = &objs[state->batch[j]];
+			POINT4D *center = &centers[state->batch_clusters[j]];
+			double rate;
+
+			counts[state->batch_clusters[j]] += obj->m;
+			rate = obj->m / counts[state->batch_clusters[j]];
+			center->x += rate * (obj->x - center->x);
+			center->y += rate * (obj->y - center->y);
+			center->z += rate * (obj->z - center->z);
+		}
+
+		for (uint32_t c = 0; c < k; c++)
+		{
+			double shift_sq = distance3d_sqr_pt4d_pt4d(&old_centers[c], &centers[c]);
+			if (shift_sq > max_shift_sq)
+				max_shift_sq = shift_sq;
+		}
+		if (t > 0 && max_shift_sq <= tolerance_sq)
+			break;
+	}
+
+	lwfree(old_centers);
+	lwfree(counts);
+}
+
 static uint32_t
 kmeans(POINT4D *objs,
        uint32_t *clusters,
@@ -279,46 +856,102 @@ kmeans(POINT4D *objs,
        POINT4D *centers,
        double *radii,
        uint32_t min_k,
-       double max_radius)
+       double max_radius,
+       uint32_t batch_size,
+       uint32_t num_threads)
 {
+	KMEANS_STATE state;
 	uint8_t converged = LW_FALSE;
 	uint32_t cur_k = min_k;
 
+	/* Mini-batches the size of the input are plain Lloyd iterations */
+	if (batch_size >= n)
+		batch_size = 0;
+
+	kmeans_state_init(&state, objs, clusters, n, centers, batch_size, num_threads);
+
+	if (batch_size)
+	{
+		kmeans_init_parallel(&state, cur_k);
+		if (!state.interrupted)
+			kmeans_minibatch(&state, cur_k);
+		if (!state.interrupted)
+			update_r(&state, cur_k, LW_FALSE);
+
+		/* Mini-batch centers are approximate, so each split is followed by one assignment pass only */
+		for (uint32_t t = 0; max_radius && !state.interrupted && t < KMEANS_MAX_ITERATIONS; t++)
+		{
+			update_radii(objs, clusters, n, centers, radii, cur_k);
+			uint32_t new_k = improve_structure(objs, clusters, n, centers, radii, cur_k, max_radius, num_threads);
+			if (!new_k)
+				state.interrupted = LW_TRUE;
+			if (new_k == cur_k || state.interrupted)
+				break;
+			cur_k = new_k;
+			update_r(&state, cur_k, LW_FALSE);
+			LW_ON_INTERRUPT(state.interrupted = LW_TRUE);
+		}
+		kmeans_state_free(&state);
+		return state.interrupted ? 0 : cur_k;
+	}
+
 	kmeans_init(objs, n, centers, cur_k);
 	/* One iteration of kmeans needs to happen without shortcuts to fully initialize structures */
-	update_r(objs, clusters, n, centers, radii, cur_k);
-	update_means(objs, clusters, n, centers, cur_k);
+	update_r(&state, cur_k, LW_FALSE);
+	update_means_and_bounds(&state, cur_k);
 	for (uint32_t t = 0; t < KMEANS_MAX_ITERATIONS; t++)
 	{
-		/* Standard KMeans loop */
+		/* Standard KMeans loop, pruned by Hamerly bounds once they are set */
 		for (uint32_t i = 0; i < KMEANS_MAX_ITERATIONS; i++)
 		{
-			LW_ON_INTERRUPT(break);
-			converged = update_r(objs, clusters, n, centers, radii, cur_k);
+			LW_ON_INTERRUPT(state.interrupted = LW_TRUE; break);
+			converged = update_r(&state, cur_k, t == 0 || i > 0);
 			if (converged)
 				break;
-			update_means(objs, clusters, n, centers, cur_k);
+			update_means_and_bounds(&state, cur_k);
 		}
 		if (!converged || !max_radius)
 			break;
 
 		/* XMeans-inspired improve_structure pass to split clusters bigger than limit into 2 */
-		uint32_t new_k = improve_structure(objs, clusters, n, centers, radii, cur_k, max_radius);
-		if (new_k == cur_k)
+		update_radii(objs, clusters, n, centers, radii, cur_k);
+		uint32_t new_k = improve_structure(objs, clusters, n, centers, radii, cur_k, max_radius, num_threads);
+		if (!new_k)
+			state.interrupted = LW_TRUE;
+		if (new_k == cur_k || state.interrupted)
 			break;
 		cur_k = new_k;
 	}
+	kmeans_state_free(&state);
+
+	/* Interrupted runs return no clustering, and leave reporting to the caller */
+	if (state.interrupted)
+		return 0;
 
 	if (!converged)
 	{
 		lwerror("%s did not converge after %d iterations", __func__, KMEANS_MAX_ITERATIONS);
 		return 0;
 	}
+
+	/* Callers splitting clusters read the radii of the final assignment */
+	update_radii(objs, clusters, n, centers, radii, cur_k);
 	return cur_k;
 }
 
 int *
 lwgeom_cluster_kmeans(const LWGEOM **geoms, uint32_t n, uint32_t k, double max_radius)
+{
+	return lwgeom_cluster_kmeans_ext(geoms, n, k, max_radius, 0, 1);
+}
+
+int *
+lwgeom_cluster_kmeans_ext(const LWGEOM **geoms,
+			  uint32_t n,
+			  uint32_t k,
+			  double max_radius,
+			  uint32_t batch_size,
+			  uint32_t num_threads)
 {
 	uint32_t num_non_empty = 0;
 
@@ -426,7 +1059,8 @@ lwgeom_cluster_kmeans(const LWGEOM **geoms, uint32_t n, uint32_t k, double max_r
 	{
 		uint32_t *clusters_dense = (uint32_t*)lwalloc(sizeof(uint32_t) * num_non_empty);
 		memset(clusters_dense, 0, sizeof(uint32_t) * num_non_empty);
-		uint32_t output_cluster_count = kmeans(objs_dense, clusters_dense, num_non_empty, centers, radii, k, max_radius);
+		uint32_t output_cluster_count = kmeans(
+		    objs_dense, clusters_dense, num_non_empty, centers, radii, k, max_radius, batch_size, num_threads);
 
 		uint32_t d = 0;
 		for (uint32_t i = 0; i < n; i++)
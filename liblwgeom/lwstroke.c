@@ -629,12 +629,13 @@ lwcompound_linearize(const LWCOMPOUND *icompound, double tol,
 		}
 		else if (geom->type == BEZIERTYPE)
 		{
-			tmp = lwbezier_linearize((LWBEZIER*)geom,72);
+			tmp = lwbezier_linearize((LWBEZIER *)geom, tol, tolerance_type, flags);
 			for (j = 0; j < tmp->points->npoints; j++)
 			{
 				getPoint4d_p(tmp->points, j, &p);
 				ptarray_append_point(ptarray, &p, LW_TRUE);
 			}
+			lwline_free(tmp);
 		}
 		else
 		{
@@ -699,7 +700,7 @@ lwcurvepoly_linearize(const LWCURVEPOLY *curvepoly, double tol,
 		}
 		else if (tmp->type == BEZIERTYPE)
 		{
-			line = lwbezier_linearize((LWBEZIER *)tmp, 72);
+			line = lwbezier_linearize((LWBEZIER *)tmp, tol, tolerance_type, flags);
 			ptarray[i] = ptarray_clone_deep(line->points);
 			lwline_free(line);
 		}
@@ -764,7 +765,7 @@ lwmcurve_linearize(const LWMCURVE *mcurve, double tol,
 		}
 		else if (tmp->type == BEZIERTYPE)
 		{
-			lines[i] = (LWGEOM *)lwbezier_linearize((LWBEZIER *)tmp, tol);
+			lines[i] = (LWGEOM *)lwbezier_linearize((LWBEZIER *)tmp, tol, type, flags);
 		}
 		else
 		{
@@ -903,7 +904,7 @@ lwcurve_linearize(const LWGEOM *geom, double tol,
 		ogeom = (LWGEOM *)lwellipse_get_spatialdata((LWELLIPSE *)geom, 72);
 		break;
 	case BEZIERTYPE:
-		ogeom = (LWGEOM *)lwbezier_linearize((LWBEZIER *)geom, 72);
+		ogeom = (LWGEOM *)lwbezier_linearize((LWBEZIER *)geom, tol, type, flags);
 		break;
 	default:
 		ogeom = lwgeom_clone_deep(geom);
@@ -353,6 +353,37 @@ lw_dist2d_recursive(const LWGEOM *lwg1, const LWGEOM *lwg2, DISTPTS *dl)
 	return LW_TRUE;
 }
 
+/**
+ * Elliptical arcs are only segmentized against geometries other than
+ * points, which are handled analytically.
+ */
+static int
+lw_dist2d_ellipse_stroked(const LWGEOM *lwg1, const LWGEOM *lwg2, DISTPTS *dl)
+{
+	LWGEOM *g1 = (LWGEOM *)lwg1;
+	LWGEOM *g2 = (LWGEOM *)lwg2;
+	int ret;
+
+	if (lwg1->type == ELLIPSETYPE)
+		g1 = (LWGEOM *)lwellipse_get_spatialdata((LWELLIPSE *)lwg1, 0);
+	if (lwg2->type == ELLIPSETYPE)
+		g2 = (LWGEOM *)lwellipse_get_spatialdata((LWELLIPSE *)lwg2, 0);
+
+	if (g1 && g2)
+		ret = lw_dist2d_distribute_bruteforce(g1, g2, dl);
+	else
+	{
+		lwerror("%s: Could not segmentize elliptical arc", __func__);
+		ret = LW_FALSE;
+	}
+
+	if (g1 && g1 != lwg1)
+		lwgeom_free(g1);
+	if (g2 && g2 != lwg2)
+		lwgeom_free(g2);
+	return ret;
+}
+
 int
 lw_dist2d_distribute_bruteforce(const LWGEOM *lwg1, const LWGEOM *lwg2, DISTPTS *dl)
 {
@@ -360,6 +391,9 @@ lw_dist2d_distribute_bruteforce(const LWGEOM *lwg1, const LWGEOM *lwg2, DISTPTS
 	int t1 = lwg1->type;
 	int t2 = lwg2->type;
 
+	if ((t1 == ELLIPSETYPE && t2 != POINTTYPE) || (t2 == ELLIPSETYPE && t1 != POINTTYPE))
+		return lw_dist2d_ellipse_stroked(lwg1, lwg2, dl);
+
 	switch (t1)
 	{
 	case POINTTYPE:
@@ -367,6 +401,8 @@ lw_dist2d_distribute_bruteforce(const LWGEOM *lwg1, const LWGEOM *lwg2, DISTPTS
 		dl->twisted = 1;
 		switch (t2)
 		{
+		case ELLIPSETYPE:
+			return lw_dist2d_point_ellipse((LWPOINT *)lwg1, (LWELLIPSE *)lwg2, dl);
 		case POINTTYPE:
 			return lw_dist2d_point_point((LWPOINT *)lwg1, (LWPOINT *)lwg2, dl);
 		case LINETYPE:
@@ -480,6 +516,11 @@ lw_dist2d_distribute_bruteforce(const LWGEOM *lwg1, const LWGEOM *lwg2, DISTPTS
 			return LW_FALSE;
 		}
 	}
+	case ELLIPSETYPE:
+	{
+		dl->twisted = -1;
+		return lw_dist2d_point_ellipse((LWPOINT *)lwg2, (LWELLIPSE *)lwg1, dl);
+	}
 	case CURVEPOLYTYPE:
 	{
 		dl->twisted = -1;
@@ -633,6 +674,17 @@ lw_dist2d_point_circstring(LWPOINT *point, LWCIRCSTRING *circ, DISTPTS *dl)
 	return lw_dist2d_pt_ptarrayarc(p, circ->points, dl);
 }
 
+int
+lw_dist2d_point_ellipse(LWPOINT *point, LWELLIPSE *ellipse, DISTPTS *dl)
+{
+	const POINT2D *p = getPoint2d_cp(point->point, 0);
+	POINT2D q;
+
+	/* Nearest or farthest point on the arc, no segmentation */
+	lwellipse_closest_point(ellipse, p, dl->mode == DIST_MAX, &q);
+	return lw_dist2d_pt_pt(p, &q, dl);
+}
+
 /**
  * 1. see if pt in outer boundary. if no, then treat the outer ring like a line
  * 2. if in the boundary, test to see if its in a hole.
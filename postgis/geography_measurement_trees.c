@@ -22,7 +22,35 @@
  *
  **********************************************************************/
 
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "../postgis_config.h"
 #include "geography_measurement_trees.h"
+#include "utils/memutils.h"
+#include "access/hash.h"
+
+
+/*
+* Cell indexes of polygonal geographies, shared by all the sessions of
+* the process so that a fixed polygon set only gets indexed once. Entries
+* are keyed by the serialized geography, allocated with malloc and only
+* changed under the lock.
+*/
+#define CIRC_CELL_SHARED_ITEMS 16
+
+typedef struct {
+	uint32_t hash;
+	size_t gsize;
+	GSERIALIZED* geom;
+	CIRC_CELL_INDEX* cells;
+	int refcount;
+	uint64_t last_used;
+} CircCellSharedEntry;
+
+static CircCellSharedEntry CircCellSharedCache[CIRC_CELL_SHARED_ITEMS];
+static pthread_mutex_t CircCellSharedLock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t CircCellSharedClock = 0;
 
 
 /*
@@ -35,8 +63,13 @@
 typedef struct {
 	GeomCache    gcache;
 	CIRC_NODE*   index;
+	/* Cell index of a polygonal cached argument, built on first use */
+	CIRC_CELL_INDEX* cells;
+	CircCellSharedEntry* cells_shared; /* NULL if cells is private */
+	bool cells_tried;
 } CircTreeGeomCache;
 
+static void CircTreeReleaseCells(CircTreeGeomCache* circ_cache);
 
 
 /**
@@ -53,6 +86,7 @@ CircTreeBuilder(const LWGEOM* lwgeom, GeomCache* cache)
 		circ_tree_free(circ_cache->index);
 		circ_cache->index = 0;
 	}
+	CircTreeReleaseCells(circ_cache);
 	if ( ! tree )
 		return LW_FAILURE;
 
@@ -70,14 +104,109 @@ CircTreeFreer(GeomCache* cache)
 		circ_cache->index = 0;
 		circ_cache->gcache.argnum = 0;
 	}
+	CircTreeReleaseCells(circ_cache);
 	return LW_SUCCESS;
 }
 
+/*
+* The freer only runs on cache misses, so the shared cells are also
+* dropped when the cache context goes away. Before 9.6 there are no
+* reset callbacks, a child context whose reset and delete methods
+* release the cells plays that role.
+*/
+#if POSTGIS_PGSQL_VERSION >= 96
+static void
+CircTreeCacheDelete(void* arg)
+{
+	CircTreeReleaseCells((CircTreeGeomCache*)arg);
+}
+#else
+typedef struct {
+	MemoryContextData header; /* must be first */
+	CircTreeGeomCache* cache;
+} CircTreeCacheContextData;
+
+static void
+CircTreeCacheContextInit(MemoryContext context)
+{
+	/* Nothing is allocated in this context */
+}
+
+static void
+CircTreeCacheContextReset(MemoryContext context)
+{
+	CircTreeCacheContextData* data = (CircTreeCacheContextData*)context;
+	if ( data->cache )
+	{
+		CircTreeReleaseCells(data->cache);
+		data->cache = NULL;
+	}
+}
+
+static void
+CircTreeCacheContextDelete(MemoryContext context)
+{
+	CircTreeCacheContextReset(context);
+}
+
+static bool
+CircTreeCacheContextIsEmpty(MemoryContext context)
+{
+	return false;
+}
+
+static void
+CircTreeCacheContextStats(MemoryContext context, int level)
+{
+}
+
+#ifdef MEMORY_CONTEXT_CHECKING
+static void
+CircTreeCacheContextCheck(MemoryContext context)
+{
+}
+#endif
+
+/* Memory context definition must match the current version of PostgreSQL */
+static MemoryContextMethods CircTreeCacheContextMethods =
+{
+	NULL,
+	NULL,
+	NULL,
+	CircTreeCacheContextInit,
+	CircTreeCacheContextReset,
+	CircTreeCacheContextDelete,
+	NULL,
+	CircTreeCacheContextIsEmpty,
+	CircTreeCacheContextStats
+#ifdef MEMORY_CONTEXT_CHECKING
+	, CircTreeCacheContextCheck
+#endif
+};
+#endif
+
 static GeomCache*
 CircTreeAllocator(void)
 {
 	CircTreeGeomCache* cache = (CircTreeGeomCache*)palloc(sizeof(CircTreeGeomCache));
 	memset(cache, 0, sizeof(CircTreeGeomCache));
+	/* We are in the cache context, which lives as long as the cache */
+#if POSTGIS_PGSQL_VERSION >= 96
+	{
+		MemoryContextCallback *callback = (MemoryContextCallback*)palloc(sizeof(MemoryContextCallback));
+		callback->arg = (void*)cache;
+		callback->func = CircTreeCacheDelete;
+		MemoryContextRegisterResetCallback(CurrentMemoryContext, callback);
+	}
+#else
+	{
+		MemoryContext context = MemoryContextCreate(T_AllocSetContext, sizeof(CircTreeCacheContextData),
+		                                            &CircTreeCacheContextMethods,
+		                                            CurrentMemoryContext,
+		                                            "PostGIS CircTree Cache Context");
+		((CircTreeCacheContextData*)context)->cache = cache;
+	}
+#endif
 	return (GeomCache*)cache;
 }
 
@@ -95,8 +224,191 @@ GetCircTreeGeomCache(FunctionCallInfo fcinfo, SHARED_GSERIALIZED *g1, SHARED_GSE
 	return (CircTreeGeomCache*)GetGeomCache(fcinfo, &CircTreeCacheMethods, g1, g2);
 }
 
+/**
+* Box of a polygonal tree argument, as used for its P-i-P tests
+*/
+static void
+CircTreePIPBox(const GSERIALIZED* g1, GBOX* gbox1)
+{
+	/* Need a gbox to calculate an outside point */
+	if ( LW_FAILURE == gserialized_get_gbox_p(g1, gbox1) )
+	{
+		LWGEOM* lwgeom1 = lwgeom_from_gserialized(g1);
+		POSTGIS_DEBUG(3, "unable to read gbox from gserialized, calculating from scratch");
+		lwgeom_calculate_gbox_geodetic(lwgeom1, gbox1);
+		lwgeom_free(lwgeom1);
+	}
+}
+
+/**
+* Definitive outside point for the P-i-P tests of a polygonal tree
+*/
+static void
+CircTreePIPOutside(const CIRC_NODE* tree1, const GBOX* gbox1, POINT2D* pt2d_outside)
+{
+	if (gbox_pt_outside(gbox1, pt2d_outside) == LW_FAILURE)
+		if (circ_tree_get_point_outside(tree1, pt2d_outside) == LW_FAILURE)
+			lwpgerror("%s: Unable to generate outside point!", __func__);
+}
+
+/* Called with the lock held, for entries no longer in use */
+static void
+CircCellSharedFree(CircCellSharedEntry* entry)
+{
+	free(entry->geom);
+	free(entry->cells);
+	memset(entry, 0, sizeof(CircCellSharedEntry));
+}
+
+/* Called with the lock held */
+static CircCellSharedEntry*
+CircCellSharedFind(const GSERIALIZED* g, size_t gsize, uint32_t hash)
+{
+	int i;
+	for ( i = 0; i < CIRC_CELL_SHARED_ITEMS; i++ )
+	{
+		CircCellSharedEntry* entry = &(CircCellSharedCache[i]);
+		if ( entry->cells && entry->hash == hash && entry->gsize == gsize &&
+		     memcmp(entry->geom, g, gsize) == 0 )
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+* Hand the cell index of the cached polygonal argument to the cache,
+* from the shared set or freshly built. When the shared set is full of
+* indexes in use, the new one stays private to this cache.
+*/
+static void
+CircTreeAcquireCells(FunctionCallInfo fcinfo, CircTreeGeomCache* circ_cache, const GSERIALIZED* g)
+{
+	size_t gsize = VARSIZE(g);
+	uint32_t hash = DatumGetUInt32(hash_any((const unsigned char*)g, gsize));
+	CircCellSharedEntry* entry;
+	CircCellSharedEntry* slot = NULL;
+	CIRC_CELL_INDEX* cells;
+	CIRC_CELL_INDEX* shared_cells;
+	GSERIALIZED* shared_geom;
+	MemoryContext old_context;
+	LWGEOM* lwgeom;
+	GBOX gbox;
+	POINT2D pt_outside;
+	int i;
+
+	circ_cache->cells_tried = true;
+
+	pthread_mutex_lock(&CircCellSharedLock);
+	entry = CircCellSharedFind(g, gsize, hash);
+	if ( entry )
+	{
+		entry->refcount++;
+		entry->last_used = ++CircCellSharedClock;
+	}
+	pthread_mutex_unlock(&CircCellSharedLock);
+	if ( entry )
+	{
+		circ_cache->cells = entry->cells;
+		circ_cache->cells_shared = entry;
+		return;
+	}
+
+	/* Build without the lock, this can error out */
+	old_context = MemoryContextSwitchTo(PostgisCacheContext(fcinfo));
+	CircTreePIPBox(g, &gbox);
+	CircTreePIPOutside(circ_cache->index, &gbox, &pt_outside);
+	lwgeom = lwgeom_from_gserialized(g);
+	cells = circ_cell_index_new(lwgeom, circ_cache->index, &gbox, &pt_outside);
+	lwgeom_free(lwgeom);
+	MemoryContextSwitchTo(old_context);
+	if ( ! cells )
+		return;
+
+	shared_cells = (CIRC_CELL_INDEX*)malloc(cells->size);
+	shared_geom = (GSERIALIZED*)malloc(gsize);
+	if ( ! shared_cells || ! shared_geom )
+	{
+		free(shared_cells);
+		free(shared_geom);
+		circ_cache->cells = cells;
+		return;
+	}
+	memcpy(shared_cells, cells, cells->size);
+	memcpy(shared_geom, g, gsize);
+
+	pthread_mutex_lock(&CircCellSharedLock);
+
+	/* Another session may have built it meanwhile */
+	entry = CircCellSharedFind(g, gsize, hash);
+	if ( entry )
+	{
+		entry->refcount++;
+		entry->last_used = ++CircCellSharedClock;
+		pthread_mutex_unlock(&CircCellSharedLock);
+		free(shared_cells);
+		free(shared_geom);
+		lwfree(cells);
+		circ_cache->cells = entry->cells;
+		circ_cache->cells_shared = entry;
+		return;
+	}
+
+	/* Pick a free or least recently used slot */
+	for ( i = 0; i < CIRC_CELL_SHARED_ITEMS; i++ )
+	{
+		CircCellSharedEntry* e = &(CircCellSharedCache[i]);
+		if ( ! e->cells )
+		{
+			if ( ! slot || slot->cells )
+				slot = e;
+		}
+		else if ( e->refcount == 0 && (! slot || (slot->cells && e->last_used < slot->last_used)) )
+			slot = e;
+	}
+
+	if ( slot )
+	{
+		if ( slot->cells )
+			CircCellSharedFree(slot);
+		slot->hash = hash;
+		slot->gsize = gsize;
+		slot->geom = shared_geom;
+		slot->cells = shared_cells;
+		slot->refcount = 1;
+		slot->last_used = ++CircCellSharedClock;
+		pthread_mutex_unlock(&CircCellSharedLock);
+		lwfree(cells);
+		circ_cache->cells = slot->cells;
+		circ_cache->cells_shared = slot;
+		return;
+	}
+
+	pthread_mutex_unlock(&CircCellSharedLock);
+	free(shared_cells);
+	free(shared_geom);
+	circ_cache->cells = cells;
+}
+
+static void
+CircTreeReleaseCells(CircTreeGeomCache* circ_cache)
+{
+	if ( circ_cache->cells_shared )
+	{
+		pthread_mutex_lock(&CircCellSharedLock);
+		circ_cache->cells_shared->refcount--;
+		pthread_mutex_unlock(&CircCellSharedLock);
+	}
+	else if ( circ_cache->cells )
+	{
+		lwfree(circ_cache->cells);
+	}
+	circ_cache->cells = NULL;
+	circ_cache->cells_shared = NULL;
+	circ_cache->cells_tried = false;
+}
+
 static int
-CircTreePIP(const CIRC_NODE* tree1, const GSERIALIZED* g1, const POINT4D* in_point)
+CircTreePIP(const CIRC_NODE* tree1, const GSERIALIZED* g1, const CIRC_CELL_INDEX* cells1, const POINT4D* in_point)
 {
 	int tree1_type = gserialized_get_type(g1);
 	GBOX gbox1;
@@ -109,14 +421,7 @@ CircTreePIP(const CIRC_NODE* tree1, const GSERIALIZED* g1, const POINT4D* in_poi
 	if ( tree1_type == POLYGONTYPE || tree1_type == MULTIPOLYGONTYPE )
 	{
 		POSTGIS_DEBUG(3, "tree is a polygon, using tree PiP");
-		/* Need a gbox to calculate an outside point */
-		if ( LW_FAILURE == gserialized_get_gbox_p(g1, &gbox1) )
-		{
-			LWGEOM* lwgeom1 = lwgeom_from_gserialized(g1);
-			POSTGIS_DEBUG(3, "unable to read gbox from gserialized, calculating from scratch");
-			lwgeom_calculate_gbox_geodetic(lwgeom1, &gbox1);
-			lwgeom_free(lwgeom1);
-		}
+		CircTreePIPBox(g1, &gbox1);
 
 		/* Flip the candidate point into geographics */
 		geographic_point_init(in_point->x, in_point->y, &in_gpoint);
@@ -133,12 +438,22 @@ CircTreePIP(const CIRC_NODE* tree1, const GSERIALIZED* g1, const POINT4D* in_poi
 		{
 			POINT2D pt2d_outside; /* latlon */
 			POINT2D pt2d_inside;
+
+			/* Only points in cells crossed by edges need the edge tests */
+			if ( cells1 )
+			{
+				int cell = circ_cell_index_lookup(cells1, &in_point3d);
+				if ( cell != CIRC_CELL_BOUNDARY )
+				{
+					POSTGIS_DEBUGF(3, "in_point3d is in a cell of class %d", cell);
+					return cell == CIRC_CELL_INSIDE;
+				}
+			}
+
 			pt2d_inside.x = in_point->x;
 			pt2d_inside.y = in_point->y;
 			/* Calculate a definitive outside point */
-			if (gbox_pt_outside(&gbox1, &pt2d_outside) == LW_FAILURE)
-				if (circ_tree_get_point_outside(tree1, &pt2d_outside) == LW_FAILURE)
-					lwpgerror("%s: Unable to generate outside point!", __func__);
+			CircTreePIPOutside(tree1, &gbox1, &pt2d_outside);
 
 			POSTGIS_DEBUGF(3, "p2d_inside=POINT(%g %g) p2d_outside=POINT(%g %g)", pt2d_inside.x, pt2d_inside.y, pt2d_outside.x, pt2d_outside.y);
 			/* Test the candidate point for strict containment */
@@ -214,8 +529,11 @@ geography_distance_cache_tolerance(FunctionCallInfo fcinfo,
 		lwgeom = lwgeom_from_gserialized(g);
 		if ( geomtype_cached == POLYGONTYPE || geomtype_cached == MULTIPOLYGONTYPE )
 		{
+			if ( ! tree_cache->cells_tried )
+				CircTreeAcquireCells(fcinfo, tree_cache, g_cached);
+
 			lwgeom_startpoint(lwgeom, &p4d);
-			if ( CircTreePIP(circtree_cached, g_cached, &p4d) )
+			if ( CircTreePIP(circtree_cached, g_cached, tree_cache->cells, &p4d) )
 			{
 				*distance = 0.0;
 				lwgeom_free(lwgeom);
@@ -230,7 +548,7 @@ geography_distance_cache_tolerance(FunctionCallInfo fcinfo,
 			circ_tree_get_point(circtree_cached, &p2d);
 			p4d.x = p2d.x;
 			p4d.y = p2d.y;
-			if ( CircTreePIP(circtree, g, &p4d) )
+			if ( CircTreePIP(circtree, g, NULL, &p4d) )
 			{
 				*distance = 0.0;
 				circ_tree_free(circtree);
@@ -299,7 +617,7 @@ geography_tree_distance(const GSERIALIZED* g1, const GSERIALIZED* g2, const SPHE
 	lwgeom_startpoint(lwgeom1, &pt1);
 	lwgeom_startpoint(lwgeom2, &pt2);
 
-	if ( CircTreePIP(circ_tree1, g1, &pt2) || CircTreePIP(circ_tree2, g2, &pt1) )
+	if ( CircTreePIP(circ_tree1, g1, NULL, &pt2) || CircTreePIP(circ_tree2, g2, NULL, &pt1) )
 	{
 		*distance = 0.0;
 	}
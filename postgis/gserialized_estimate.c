@@ -43,6 +43,15 @@ the contant search box.
 gserialized_gist_joinsel sums up the product of the overlapping
 cells in each relation's histogram.
 
+Along with the (pro-rated) feature count, each histogram cell also
+records the average extent of the features that fell into it. The
+estimators use those sizes to work out how likely features in a cell
+are to actually interact with the search box or with the features of
+the other relation's cell, instead of assuming that everything within
+a cell interacts with everything else. Histograms built by versions
+that did not record sizes are read with the sizes flagged as unknown,
+and fall back to the plain cell overlap calculation.
+
 Depending on the operator and type, the mode of selectivity calculation
 will be 2D or ND.
 
@@ -281,9 +290,16 @@ typedef struct ND_STATS_T
 	float4 cells_covered;
 
 	/* Variable length # of floats for histogram */
+	/* followed by ndims average feature extents per cell */
 	float4 value[1];
 } ND_STATS;
 
+/**
+* Number of floats in the fixed part of #ND_STATS, before the
+* histogram values.
+*/
+#define ND_STATS_HEADER_FLOATS (offsetof(ND_STATS, value) / sizeof(float4))
+
 typedef struct {
 	/* Saved state from std_typanalyze() */
 	AnalyzeAttrComputeStatsFunc std_compute_stats;
@@ -445,6 +461,53 @@ nd_stats_value_index(const ND_STATS *stats, int *indexes)
 	return vdx;
 }
 
+/**
+* Return the average feature extents (one per dimension) recorded for
+* the histogram cell at position vdx of the values array. A negative
+* extent means the stats were built without feature sizes.
+*/
+static inline const float4 *
+nd_stats_feature_size(const ND_STATS *stats, int vdx)
+{
+	int ncells = (int)roundf(stats->histogram_cells);
+	int ndims = (int)roundf(stats->ndims);
+	return stats->value + ncells + vdx * ndims;
+}
+
+/**
+* Do the stats carry per-cell feature sizes?
+*/
+static inline int
+nd_stats_has_feature_size(const ND_STATS *stats)
+{
+	return nd_stats_feature_size(stats, 0)[0] >= 0.0;
+}
+
+/**
+* Fill maxsize with the largest per-cell average feature extent
+* in each dimension.
+*/
+static void
+nd_stats_max_feature_size(const ND_STATS *stats, double *maxsize)
+{
+	int i, d;
+	int ncells = (int)roundf(stats->histogram_cells);
+	int ndims = (int)roundf(stats->ndims);
+
+	for ( d = 0; d < ND_DIMS; d++ )
+		maxsize[d] = 0.0;
+
+	if ( ! nd_stats_has_feature_size(stats) )
+		return;
+
+	for ( i = 0; i < ncells; i++ )
+	{
+		const float4 *size = nd_stats_feature_size(stats, i);
+		for ( d = 0; d < ndims; d++ )
+			maxsize[d] = Max(maxsize[d], size[d]);
+	}
+}
+
 /**
 * Convert an #ND_BOX to a JSON string for printing
 */
@@ -762,6 +825,80 @@ nd_box_ratio(const ND_BOX *b1, const ND_BOX *b2, int ndims)
 	return ivol / vol2;
 }
 
+/**
+* Grow an #ND_BOX by half of the given extent on every side.
+*/
+static void
+nd_box_grow(ND_BOX *nd_box, const double *size, int ndims)
+{
+	int d;
+	for ( d = 0; d < ndims; d++ )
+	{
+		nd_box->min[d] -= size[d] / 2;
+		nd_box->max[d] += size[d] / 2;
+	}
+}
+
+/**
+* Integral from 0 to y of min(max(s, 0), w) ds.
+*/
+static inline double
+ramp_integral(double y, double w)
+{
+	if ( y <= 0.0 )
+		return 0.0;
+	if ( y <= w )
+		return y * y / 2;
+	return w * w / 2 + w * (y - w);
+}
+
+/**
+* Probability that two intervals, whose centers are uniformly
+* distributed over [min1, max1] and [min2, max2] and whose
+* half-widths add up to h, overlap. This is the area of the
+* band |x1 - x2| <= h inside the rectangle of possible center
+* pairs, divided by the area of the rectangle.
+*/
+static double
+interval_overlap_probability(double min1, double max1, double min2, double max2, double h)
+{
+	double width1 = max1 - min1;
+	double width2 = max2 - min2;
+	double band;
+
+	/* Degenerate cells, every feature sits in the same spot */
+	if ( width1 < MIN_DIMENSION_WIDTH || width2 < MIN_DIMENSION_WIDTH )
+		return (min1 - h <= max2 && max1 + h >= min2) ? 1.0 : 0.0;
+
+	/* Area of { x1 - x2 <= t } is F(t), band area is F(h) - F(-h) */
+	band = ramp_integral(max2 + h - min1, width2) - ramp_integral(max2 + h - max1, width2);
+	band -= ramp_integral(max2 - h - min1, width2) - ramp_integral(max2 - h - max1, width2);
+	band /= width1 * width2;
+
+	return Min(1.0, Max(0.0, band));
+}
+
+/**
+* Proportion of the feature pairs drawn from cell1 and cell2 that
+* interact, given the average feature extents in each cell.
+*/
+static double
+nd_cell_pair_ratio(const ND_BOX *cell1, const float4 *size1,
+                   const ND_BOX *cell2, const float4 *size2, int ndims)
+{
+	int d;
+	double ratio = 1.0;
+	for ( d = 0; d < ndims; d++ )
+	{
+		double h = (size1[d] + size2[d]) / 2;
+		ratio *= interval_overlap_probability(cell1->min[d], cell1->max[d],
+		                                      cell2->min[d], cell2->max[d], h);
+		if ( ratio == 0.0 )
+			break;
+	}
+	return ratio;
+}
+
 /* How many bins shall we use in figuring out the distribution? */
 #define NUM_BINS 50
 
@@ -900,6 +1037,36 @@ nd_increment(ND_IBOX *ibox, int ndims, int *counter)
 	return true;
 }
 
+/**
+* Copy the stats numbers array into a palloc'ed #ND_STATS. Stats
+* written without per-cell feature sizes get their sizes flagged
+* as unknown, so every #ND_STATS in memory has the same layout.
+*/
+static ND_STATS*
+nd_stats_copy(const float4 *numbers, int nnumbers)
+{
+	const ND_STATS *src = (const ND_STATS*)numbers;
+	int ncells = (int)roundf(src->histogram_cells);
+	int ndims = (int)roundf(src->ndims);
+	int nvalues = ND_STATS_HEADER_FLOATS + ncells;
+	int nsized = nvalues + ncells * ndims;
+	ND_STATS *nd_stats = (ND_STATS*)palloc(sizeof(float4) * nsized);
+
+	if ( nnumbers >= nsized )
+	{
+		memcpy(nd_stats, numbers, sizeof(float4) * nsized);
+	}
+	else
+	{
+		int i;
+		float4 *sizes = (float4*)nd_stats + nvalues;
+		memcpy(nd_stats, numbers, sizeof(float4) * Min(nnumbers, nvalues));
+		for ( i = 0; i < ncells * ndims; i++ )
+			sizes[i] = -1.0;
+	}
+	return nd_stats;
+}
+
 static ND_STATS*
 pg_nd_stats_from_tuple(HeapTuple stats_tuple, int mode)
 {
@@ -926,8 +1093,7 @@ pg_nd_stats_from_tuple(HeapTuple stats_tuple, int mode)
 		}
 
 		/* Clone the stats here so we can release the attstatsslot immediately */
-		nd_stats = (ND_STATS*)palloc(sizeof(float) * nvalues);
-		memcpy(nd_stats, floatptr, sizeof(float) * nvalues);
+		nd_stats = nd_stats_copy(floatptr, nvalues);
 
 		/* Clean up */
 		free_attstatsslot(0, NULL, 0, floatptr, nvalues);
@@ -943,8 +1109,7 @@ pg_nd_stats_from_tuple(HeapTuple stats_tuple, int mode)
 		}
 
 		/* Clone the stats here so we can release the attstatsslot immediately */
-		nd_stats = palloc(sizeof(float4) * sslot.nnumbers);
-		memcpy(nd_stats, sslot.numbers, sizeof(float4) * sslot.nnumbers);
+		nd_stats = nd_stats_copy(sslot.numbers, sslot.nnumbers);
 
 		free_attstatsslot(&sslot);
 	}
@@ -1042,6 +1207,12 @@ pg_get_nd_stats_by_name(const Oid table_oid, const text *att_text, int mode, boo
 * of one histogram, and multiply the cell value by the
 * proportion of the cells in the other histogram the cell
 * overlaps: val += val1 * ( val2 * overlap_ratio )
+*
+* When both histograms carry per-cell feature sizes, the overlap
+* ratio is replaced by the probability that a feature of one cell
+* interacts with a feature of the other, given the average feature
+* extents of the two cells. Small features packed into dense cells
+* then no longer count as all joining with each other.
 */
 static float8
 estimate_join_selectivity(const ND_STATS *s1, const ND_STATS *s2)
@@ -1063,6 +1234,8 @@ estimate_join_selectivity(const ND_STATS *s1, const ND_STATS *s2)
 	double width2[ND_DIMS];
 	double cellsize2[ND_DIMS];
 	int size1[ND_DIMS];
+	double maxsize2[ND_DIMS];
+	int sized;
 	int d;
 	double val = 0;
 	float8 selectivity;
@@ -1144,21 +1317,40 @@ estimate_join_selectivity(const ND_STATS *s1, const ND_STATS *s2)
 		cellsize2[d] = width2[d] / size2[d];
 	}
 
+	/* Use the feature sizes only if both sides have them */
+	sized = nd_stats_has_feature_size(s1) && nd_stats_has_feature_size(s2);
+	nd_stats_max_feature_size(s2, maxsize2);
+
 	/* For each affected cell of s1... */
 	do
 	{
 		double val1;
+		const float4 *fsize1;
 		/* Construct the bounds of this cell */
 		ND_BOX nd_cell1;
+		ND_BOX nd_reach1;
+		int vdx1 = nd_stats_value_index(s1, at1);
 		nd_box_init(&nd_cell1);
 		for ( d = 0; d < ndims1; d++ )
 		{
 			nd_cell1.min[d] = min1[d] + (at1[d]+0) * cellsize1[d];
 			nd_cell1.max[d] = min1[d] + (at1[d]+1) * cellsize1[d];
 		}
+		fsize1 = nd_stats_feature_size(s1, vdx1);
 
-		/* Find the cells of s2 that cell1 overlaps.. */
-		nd_box_overlap(s2, &nd_cell1, &ibox2);
+		/*
+		 * Find the cells of s2 that cell1 overlaps... or that the
+		 * features of cell1 can reach, once feature sizes are known.
+		 */
+		nd_reach1 = nd_cell1;
+		if ( sized )
+		{
+			double reach[ND_DIMS];
+			for ( d = 0; d < ndims1; d++ )
+				reach[d] = fsize1[d] + maxsize2[d];
+			nd_box_grow(&nd_reach1, reach, ndims1);
+		}
+		nd_box_overlap(s2, &nd_reach1, &ibox2);
 
 		/* Initialize counter */
 		for ( d = 0; d < ndims2; d++ )
@@ -1169,13 +1361,16 @@ estimate_join_selectivity(const ND_STATS *s1, const ND_STATS *s2)
 		POSTGIS_DEBUGF(3, "at1 %d,%d  %s", at1[0], at1[1], nd_box_to_json(&nd_cell1, ndims1));
 
 		/* Get the value at this cell */
-		val1 = s1->value[nd_stats_value_index(s1, at1)];
+		val1 = s1->value[vdx1];
+		if ( val1 == 0.0 )
+			continue;
 
 		/* For each overlapped cell of s2... */
 		do
 		{
 			double ratio2;
 			double val2;
+			int vdx2 = nd_stats_value_index(s2, at2);
 
 			/* Construct the bounds of this cell */
 			ND_BOX nd_cell2;
@@ -1189,10 +1384,15 @@ estimate_join_selectivity(const ND_STATS *s1, const ND_STATS *s2)
 			POSTGIS_DEBUGF(3, "  at2 %d,%d  %s", at2[0], at2[1], nd_box_to_json(&nd_cell2, ndims2));
 
 			/* Calculate overlap ratio of the cells */
-			ratio2 = nd_box_ratio(&nd_cell1, &nd_cell2, Max(ndims1, ndims2));
+			if ( sized )
+				ratio2 = nd_cell_pair_ratio(&nd_cell1, fsize1,
+				                            &nd_cell2, nd_stats_feature_size(s2, vdx2),
+				                            Min(ndims1, ndims2));
+			else
+				ratio2 = nd_box_ratio(&nd_cell1, &nd_cell2, Max(ndims1, ndims2));
 
 			/* Multiply the cell counts, scaled by overlap ratio */
-			val2 = s2->value[nd_stats_value_index(s2, at2)];
+			val2 = s2->value[vdx2];
 			POSTGIS_DEBUGF(3, "  val1 %.6g  val2 %.6g  ratio %.6g", val1, val2, ratio2);
 			val += val1 * (val2 * ratio2);
 		}
@@ -1388,6 +1588,7 @@ compute_gserialized_stats_mode(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfu
 
 	ND_STATS *nd_stats;                /* Our histogram */
 	size_t    nd_stats_size;           /* Size to allocate */
+	double   *size_sums;               /* Per-cell sums of pro-rated feature extents */
 
 	double total_width = 0;            /* # of bytes used by sample */
 	double total_sample_volume = 0;    /* Area/volume coverage of the sample */
@@ -1701,10 +1902,14 @@ compute_gserialized_stats_mode(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfu
 	 */
 	old_context = MemoryContextSwitchTo(stats->anl_context);
 	nd_stats_size = sizeof(ND_STATS) + ((histo_cells - 1) * sizeof(float4));
+	nd_stats_size += histo_cells * ndims * sizeof(float4); /* Feature sizes */
 	nd_stats = (ND_STATS*)palloc(nd_stats_size);
 	memset(nd_stats, 0, nd_stats_size); /* Initialize all values to 0 */
 	MemoryContextSwitchTo(old_context);
 
+	/* Scratch space to average the feature extents per cell */
+	size_sums = (double*)palloc0(sizeof(double) * histo_cells * ndims);
+
 	/* Initialize the #ND_STATS objects */
 	nd_stats->ndims = ndims;
 	nd_stats->extent = histo_extent;
@@ -1727,6 +1932,9 @@ compute_gserialized_stats_mode(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfu
 	 * up the values in the histogram, we could get the
 	 * histogram feature count.
 	 *
+	 *  o sum up the extents of the portion of each feature
+	 *    that falls in each cell, weighted the same way, to
+	 *    get the average feature size of the cell.
 	 */
 	for ( i = 0; i < notnull_cnt; i++ )
 	{
@@ -1735,6 +1943,7 @@ compute_gserialized_stats_mode(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfu
 		int at[ND_DIMS];
 		int d;
 		double num_cells = 0;
+		int vdx;
 		double tmp_volume = 1.0;
 		double min[ND_DIMS] = {0.0, 0.0, 0.0, 0.0};
 		double max[ND_DIMS] = {0.0, 0.0, 0.0, 0.0};
@@ -1790,8 +1999,16 @@ compute_gserialized_stats_mode(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfu
 			 * 0.5 added on.
 			 */
 			ratio = nd_box_ratio(&nd_cell, nd_box, nd_stats->ndims);
-			nd_stats->value[nd_stats_value_index(nd_stats, at)] += ratio;
+			vdx = nd_stats_value_index(nd_stats, at);
+			nd_stats->value[vdx] += ratio;
 			num_cells += ratio;
+
+			/* Extent of the part of the feature inside the cell */
+			for ( d = 0; d < nd_stats->ndims; d++ )
+			{
+				double clipped = Min(nd_box->max[d], nd_cell.max[d]) - Max(nd_box->min[d], nd_cell.min[d]);
+				size_sums[vdx * ndims + d] += ratio * Max(clipped, 0.0);
+			}
 			POSTGIS_DEBUGF(3, "               ratio (%.8g)  num_cells (%.8g)", ratio, num_cells);
 			POSTGIS_DEBUGF(3, "               at (%d, %d, %d, %d)", at[0], at[1], at[2], at[3]);
 		}
@@ -1820,6 +2037,16 @@ compute_gserialized_stats_mode(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfu
 	nd_stats->histogram_cells = histo_cells;
 	nd_stats->cells_covered = total_cell_count;
 
+	/* Turn the extent sums into per-cell averages */
+	for ( i = 0; i < histo_cells; i++ )
+	{
+		float4 *size = (float4*)nd_stats_feature_size(nd_stats, i);
+		double count = nd_stats->value[i];
+		for ( d = 0; d < ndims; d++ )
+			size[d] = count > 0.0 ? size_sums[i * ndims + d] / count : 0.0;
+	}
+	pfree(size_sums);
+
 	/* Put this histogram data into the right slot/kind */
 	if ( mode == 2 )
 	{
@@ -1954,6 +2181,11 @@ Datum gserialized_analyze_nd(PG_FUNCTION_ARGS)
 * we need "only" sum up the values * the proportion of each cell
 * in the histogram that falls within the search box, then
 * divide by the number of features that generated the histogram.
+*
+* Features are not points, so when the stats carry per-cell feature
+* sizes the search box is grown by half the average feature extent
+* of each cell before working out the proportion: a feature hits
+* the box when its center falls within that grown box.
 */
 static float8
 estimate_selectivity(const GBOX *box, const ND_STATS *nd_stats, int mode)
@@ -1961,12 +2193,15 @@ estimate_selectivity(const GBOX *box, const ND_STATS *nd_stats, int mode)
 	int d; /* counter */
 	float8 selectivity;
 	ND_BOX nd_box;
+	ND_BOX nd_reach;
 	ND_IBOX nd_ibox;
 	int at[ND_DIMS];
 	double cell_size[ND_DIMS];
 	double min[ND_DIMS];
 	double max[ND_DIMS];
 	double total_count = 0.0;
+	double maxsize[ND_DIMS];
+	int sized;
 	int ndims_max;
 
 	/* Calculate the overlap of the box on the histogram */
@@ -2016,8 +2251,14 @@ estimate_selectivity(const GBOX *box, const ND_STATS *nd_stats, int mode)
 		return 1.0;
 	}
 
+	/* Cells that only hold features reaching into the box count too */
+	sized = nd_stats_has_feature_size(nd_stats);
+	nd_stats_max_feature_size(nd_stats, maxsize);
+	nd_reach = nd_box;
+	nd_box_grow(&nd_reach, maxsize, nd_stats->ndims);
+
 	/* Calculate the overlap of the box on the histogram */
-	if ( ! nd_box_overlap(nd_stats, &nd_box, &nd_ibox) )
+	if ( ! nd_box_overlap(nd_stats, &nd_reach, &nd_ibox) )
 	{
 		POSTGIS_DEBUG(3, " search box overlap with stats histogram failed");
 		return FALLBACK_ND_SEL;
@@ -2040,6 +2281,7 @@ estimate_selectivity(const GBOX *box, const ND_STATS *nd_stats, int mode)
 	do
 	{
 		float cell_count, ratio;
+		int vdx;
 		ND_BOX nd_cell = { {0.0, 0.0, 0.0, 0.0}, {0.0, 0.0, 0.0, 0.0} };
 
 		/* We have to pro-rate partially overlapped cells. */
@@ -2049,8 +2291,22 @@ estimate_selectivity(const GBOX *box, const ND_STATS *nd_stats, int mode)
 			nd_cell.max[d] = min[d] + (at[d]+1) * cell_size[d];
 		}
 
-		ratio = nd_box_ratio(&nd_box, &nd_cell, nd_stats->ndims);
-		cell_count = nd_stats->value[nd_stats_value_index(nd_stats, at)];
+		vdx = nd_stats_value_index(nd_stats, at);
+		cell_count = nd_stats->value[vdx];
+		if ( sized )
+		{
+			double fsize[ND_DIMS];
+			const float4 *size = nd_stats_feature_size(nd_stats, vdx);
+			ND_BOX nd_hit = nd_box;
+			for ( d = 0; d < nd_stats->ndims; d++ )
+				fsize[d] = size[d];
+			nd_box_grow(&nd_hit, fsize, nd_stats->ndims);
+			ratio = nd_box_ratio(&nd_hit, &nd_cell, nd_stats->ndims);
+		}
+		else
+		{
+			ratio = nd_box_ratio(&nd_box, &nd_cell, nd_stats->ndims);
+		}
 
 		/* Add the pro-rated count for this cell to the overall total */
 		total_count += cell_count * ratio;
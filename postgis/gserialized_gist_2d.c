@@ -1047,6 +1047,54 @@ static inline bool gserialized_gist_consistent_internal_2d(BOX2DF *key, BOX2DF *
 	return (retval);
 }
 
+/*
+** The query argument is the same for every entry a scan tests. An inline
+** query with a stored box is read directly; a toasted, compressed or
+** box-less one is decoded once and remembered in fn_extra, keyed on the
+** raw datum bytes since several scan keys may share the FmgrInfo.
+*/
+typedef struct
+{
+	BOX2DF box;
+	int result;
+	size_t size;
+	char datum[1];
+} QueryBox2DFCache;
+
+static int
+gserialized_gist_query_box2df(FunctionCallInfo fcinfo, BOX2DF *box)
+{
+	Datum query = PG_GETARG_DATUM(1);
+	struct varlena *raw = (struct varlena *)DatumGetPointer(query);
+	QueryBox2DFCache *cache = (QueryBox2DFCache *)fcinfo->flinfo->fn_extra;
+	size_t size;
+
+	if (!PG_GSERIALIZED_DATUM_NEEDS_DETOAST(raw) && gserialized_has_bbox((GSERIALIZED *)raw))
+		return gserialized_datum_get_box2df_p(query, box);
+
+	size = VARSIZE_ANY(raw);
+	if (cache && cache->size == size && memcmp(cache->datum, raw, size) == 0)
+	{
+		*box = cache->box;
+		return cache->result;
+	}
+
+	if (!cache || cache->size < size)
+	{
+		if (cache)
+			pfree(cache);
+		cache = (QueryBox2DFCache *)MemoryContextAlloc(fcinfo->flinfo->fn_mcxt,
+		                                              offsetof(QueryBox2DFCache, datum) + size);
+		fcinfo->flinfo->fn_extra = cache;
+	}
+	cache->result = gserialized_datum_get_box2df_p(query, &cache->box);
+	cache->size = size;
+	memcpy(cache->datum, raw, size);
+
+	*box = cache->box;
+	return cache->result;
+}
+
 /*
 ** GiST support function. Take in a query and an entry and see what the
 ** relationship is, based on the query strategy.
@@ -1089,12 +1137,24 @@ Datum gserialized_gist_consistent_2d(PG_FUNCTION_ARGS)
 	}
 
 	/* Null box should never make this far. */
-	if ( gserialized_datum_get_box2df_p(PG_GETARG_DATUM(1), &query_gbox_index) == LW_FAILURE )
+	if ( gserialized_gist_query_box2df(fcinfo, &query_gbox_index) == LW_FAILURE )
 	{
 		POSTGIS_DEBUG(4, "[GIST] null query_gbox_index!");
 		PG_RETURN_BOOL(false);
 	}
 
+	/* && is the same test on leaf and internal keys and by far the most
+	   common, so it skips the dispatch below. The comparisons are written
+	   so that an EMPTY (NaN) box on either side yields false without a
+	   separate check, and are combined without short-circuit branches. */
+	if (strategy == RTOverlapStrategyNumber)
+	{
+		const BOX2DF *key = (BOX2DF *)DatumGetPointer(entry->key);
+		const BOX2DF *q = &query_gbox_index;
+		PG_RETURN_BOOL((key->xmin <= q->xmax) & (q->xmin <= key->xmax) &
+		               (key->ymin <= q->ymax) & (q->ymin <= key->ymax));
+	}
+
 	/* Treat leaf node tests different from internal nodes */
 	if (GIST_LEAF(entry))
 	{
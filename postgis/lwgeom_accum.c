@@ -48,6 +48,11 @@ extern "C" Datum pgis_geometry_polygonize_finalfn(PG_FUNCTION_ARGS);
 extern "C" Datum pgis_geometry_makeline_finalfn(PG_FUNCTION_ARGS);
 extern "C" Datum pgis_geometry_clusterintersecting_finalfn(PG_FUNCTION_ARGS);
 extern "C" Datum pgis_geometry_clusterwithin_finalfn(PG_FUNCTION_ARGS);
+extern "C" Datum pgis_geometry_union_parallel_transfn(PG_FUNCTION_ARGS);
+extern "C" Datum pgis_geometry_union_parallel_combinefn(PG_FUNCTION_ARGS);
+extern "C" Datum pgis_geometry_union_parallel_serialfn(PG_FUNCTION_ARGS);
+extern "C" Datum pgis_geometry_union_parallel_deserialfn(PG_FUNCTION_ARGS);
+extern "C" Datum pgis_geometry_union_parallel_finalfn(PG_FUNCTION_ARGS);
 
 /* External prototypes */
 extern "C" Datum pgis_union_geometry_array(PG_FUNCTION_ARGS);
@@ -330,6 +335,449 @@ pgis_geometry_clusterwithin_finalfn(PG_FUNCTION_ARGS)
 	PG_RETURN_DATUM(result);
 }
 
+/* Vertices buffered by the parallel ST_Union before they are unioned */
+#define UNION_BUFFER_POINTS (1024 * 1024)
+/* Inputs unioned together in each Hilbert ordered batch of a flush */
+#define UNION_BATCH_SIZE 128
+
+typedef struct
+{
+	uint64_t key;
+	LWGEOM *geom;
+} UnionItem;
+
+static int
+union_item_cmp(const void *a, const void *b)
+{
+	const UnionItem *ia = (const UnionItem *)a;
+	const UnionItem *ib = (const UnionItem *)b;
+	return ia->key < ib->key ? -1 : ia->key > ib->key;
+}
+
+static UnionState *
+union_state_create(MemoryContext aggcontext)
+{
+	UnionState *state = (UnionState *)MemoryContextAllocZero(aggcontext, sizeof(UnionState));
+	state->gridSize = -1.0;
+	state->list = NIL;
+	state->srid = SRID_UNKNOWN;
+	state->aggcontext = aggcontext;
+	state->context = AllocSetContextCreate(aggcontext, "ST_Union pending", ALLOCSET_DEFAULT_SIZES);
+	return state;
+}
+
+/* Copies geom into the pending list, empties only count for the result type */
+static void
+union_state_add(UnionState *state, const LWGEOM *geom)
+{
+	MemoryContext old;
+
+	if (!state->has_geoms)
+	{
+		state->srid = lwgeom_get_srid(geom);
+		state->has_geoms = true;
+	}
+
+	if (lwgeom_is_empty(geom))
+	{
+		int32_t type = lwgeom_get_type(geom);
+		state->empty_type = type > state->empty_type ? type : state->empty_type;
+		return;
+	}
+
+	old = MemoryContextSwitchTo(state->context);
+	state->list = lappend(state->list, lwgeom_clone_deep(geom));
+	state->npoints += lwgeom_count_vertices(geom);
+	MemoryContextSwitchTo(old);
+}
+
+/*
+ * Unions n geometries of the state into a new one allocated in aggcontext,
+ * leaving the inputs alone. Scratch goes to a temporary context, as the
+ * pending context may hold inputs not yet flushed.
+ */
+static LWGEOM *
+union_state_union(UnionState *state, LWGEOM **geoms, uint32_t n)
+{
+	MemoryContext context, old;
+	LWCOLLECTION *col;
+	LWGEOM *result;
+
+	context = AllocSetContextCreate(state->aggcontext, "ST_Union merge", ALLOCSET_DEFAULT_SIZES);
+	old = MemoryContextSwitchTo(context);
+	col = lwcollection_construct(COLLECTIONTYPE, state->srid, NULL, n, geoms);
+	result = lwgeom_unaryunion_prec(lwcollection_as_lwgeom(col), state->gridSize);
+	MemoryContextSwitchTo(state->aggcontext);
+	result = result ? lwgeom_clone_deep(result) : NULL;
+	MemoryContextSwitchTo(old);
+	MemoryContextDelete(context);
+	return result;
+}
+
+/*
+ * Adds a union of flushed geometries, allocated in aggcontext, at a level.
+ * While that level is taken the two are unioned and carried one level up.
+ */
+static void
+union_state_push(UnionState *state, LWGEOM *geom, uint32_t level)
+{
+	while (geom && state->levels[level])
+	{
+		LWGEOM *pair[2];
+		pair[0] = state->levels[level];
+		pair[1] = geom;
+		geom = union_state_union(state, pair, 2);
+		lwgeom_free(pair[0]);
+		lwgeom_free(pair[1]);
+		state->levels[level] = NULL;
+		if (level < UNION_MAX_LEVELS - 1)
+			level++;
+	}
+	if (geom)
+		state->levels[level] = geom;
+}
+
+/* Unions the pending geometries and pushes the result on the levels */
+static void
+union_state_flush(UnionState *state)
+{
+	MemoryContext old;
+	ListCell *l;
+	UnionItem *items;
+	LWGEOM **batches;
+	LWGEOM *result;
+	GBOX extent;
+	double width, height;
+	uint32_t nitems = list_length(state->list);
+	uint32_t nbatches = 0;
+	uint32_t i = 0;
+
+	if (nitems == 0)
+		return;
+
+	old = MemoryContextSwitchTo(state->context);
+
+	/* Sort the inputs along a Hilbert curve over their extent, so that
+	 * each batch holds neighbouring geometries that dissolve together */
+	items = (UnionItem *)palloc(nitems * sizeof(UnionItem));
+	foreach (l, state->list)
+	{
+		items[i].geom = (LWGEOM *)lfirst(l);
+		if (i == 0)
+			extent = *lwgeom_get_bbox(items[i].geom);
+		else
+			gbox_merge(lwgeom_get_bbox(items[i].geom), &extent);
+		i++;
+	}
+	width = extent.xmax - extent.xmin;
+	height = extent.ymax - extent.ymin;
+	for (i = 0; i < nitems; i++)
+	{
+		const GBOX *box = lwgeom_get_bbox(items[i].geom);
+		double cx = (box->xmin + box->xmax) / 2.0 - extent.xmin;
+		double cy = (box->ymin + box->ymax) / 2.0 - extent.ymin;
+		uint32_t qx = width > 0 ? (uint32_t)(cx / width * UINT32_MAX) : 0;
+		uint32_t qy = height > 0 ? (uint32_t)(cy / height * UINT32_MAX) : 0;
+		items[i].key = uint32_hilbert(qx, qy);
+	}
+	qsort(items, nitems, sizeof(UnionItem), union_item_cmp);
+
+	batches = (LWGEOM **)palloc((nitems / UNION_BATCH_SIZE + 1) * sizeof(LWGEOM *));
+	for (i = 0; i < nitems; i += UNION_BATCH_SIZE)
+	{
+		uint32_t n = Min(UNION_BATCH_SIZE, nitems - i);
+		LWGEOM **geoms = (LWGEOM **)palloc(n * sizeof(LWGEOM *));
+		LWCOLLECTION *col;
+
+		for (uint32_t j = 0; j < n; j++)
+			geoms[j] = items[i + j].geom;
+		col = lwcollection_construct(COLLECTIONTYPE, state->srid, NULL, n, geoms);
+		batches[nbatches++] = lwgeom_unaryunion_prec(lwcollection_as_lwgeom(col), state->gridSize);
+	}
+
+	if (nbatches == 1)
+		result = batches[0];
+	else
+	{
+		LWCOLLECTION *col = lwcollection_construct(COLLECTIONTYPE, state->srid, NULL, nbatches, batches);
+		result = lwgeom_unaryunion_prec(lwcollection_as_lwgeom(col), state->gridSize);
+	}
+
+	/* Keep the union of the flush, drop the pending inputs */
+	MemoryContextSwitchTo(state->aggcontext);
+	result = result ? lwgeom_clone_deep(result) : NULL;
+	MemoryContextSwitchTo(old);
+
+	MemoryContextReset(state->context);
+	state->list = NIL;
+	state->npoints = 0;
+
+	union_state_push(state, result, 0);
+}
+
+/*
+ * Flushes and unions all the levels together, once. The result is kept as
+ * the only level, so that finishing again does not redo the work.
+ */
+static LWGEOM *
+union_state_finish(UnionState *state)
+{
+	LWGEOM *geoms[UNION_MAX_LEVELS];
+	LWGEOM *result;
+	uint32_t n = 0, top = 0;
+
+	union_state_flush(state);
+
+	for (uint32_t i = 0; i < UNION_MAX_LEVELS; i++)
+	{
+		if (state->levels[i])
+		{
+			geoms[n++] = state->levels[i];
+			top = i;
+		}
+	}
+	if (n == 0)
+		return NULL;
+	if (n == 1)
+		return geoms[0];
+
+	result = union_state_union(state, geoms, n);
+	for (uint32_t i = 0; i < UNION_MAX_LEVELS; i++)
+	{
+		if (state->levels[i])
+			lwgeom_free(state->levels[i]);
+		state->levels[i] = NULL;
+	}
+	state->levels[top] = result;
+	return result;
+}
+
+/**
+* The parallel union transfer function adds the input to the pending list,
+* unioning the list once it is over the buffer size.
+*/
+PG_FUNCTION_INFO_V1(pgis_geometry_union_parallel_transfn);
+Datum
+pgis_geometry_union_parallel_transfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	UnionState *state;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "%s called in non-aggregate context", __func__);
+
+	if (PG_ARGISNULL(0))
+		state = union_state_create(aggcontext);
+	else
+		state = (UnionState *)PG_GETARG_POINTER(0);
+
+	if (PG_NARGS() > 2 && !PG_ARGISNULL(2))
+	{
+		double gridSize = PG_GETARG_FLOAT8(2);
+		if (gridSize > state->gridSize)
+			state->gridSize = gridSize;
+	}
+
+	if (!PG_ARGISNULL(1))
+	{
+		GSERIALIZED *gser = PG_GETARG_GSERIALIZED_P(1);
+		LWGEOM *geom;
+
+		if (state->has_geoms)
+			gserialized_error_if_srid_mismatch_reference(gser, state->srid, __func__);
+
+		geom = lwgeom_from_gserialized(gser);
+		union_state_add(state, geom);
+		lwgeom_free(geom);
+		PG_FREE_IF_COPY(gser, 1);
+
+		if (state->npoints > UNION_BUFFER_POINTS)
+			union_state_flush(state);
+	}
+
+	PG_RETURN_POINTER(state);
+}
+
+/**
+* The combine function moves the levels of the second state onto the levels
+* of the first, and its pending inputs into the pending list of the first.
+*/
+PG_FUNCTION_INFO_V1(pgis_geometry_union_parallel_combinefn);
+Datum
+pgis_geometry_union_parallel_combinefn(PG_FUNCTION_ARGS)
+{
+	UnionState *state1 = PG_ARGISNULL(0) ? NULL : (UnionState *)PG_GETARG_POINTER(0);
+	UnionState *state2 = PG_ARGISNULL(1) ? NULL : (UnionState *)PG_GETARG_POINTER(1);
+	ListCell *l;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "%s called in non-aggregate context", __func__);
+
+	if (!state1 && !state2)
+		PG_RETURN_NULL();
+	if (!state2)
+		PG_RETURN_POINTER(state1);
+	if (!state1)
+		PG_RETURN_POINTER(state2);
+
+	if (state1->has_geoms && state2->has_geoms && state1->srid != state2->srid)
+		elog(ERROR, "%s: Operation on mixed SRID geometries (%d != %d)", __func__, state1->srid, state2->srid);
+
+	if (state2->gridSize > state1->gridSize)
+		state1->gridSize = state2->gridSize;
+	if (state2->empty_type > state1->empty_type)
+		state1->empty_type = state2->empty_type;
+	if (!state1->has_geoms)
+	{
+		state1->srid = state2->srid;
+		state1->has_geoms = state2->has_geoms;
+	}
+
+	for (uint32_t i = 0; i < UNION_MAX_LEVELS; i++)
+	{
+		MemoryContext old;
+		LWGEOM *geom;
+
+		if (!state2->levels[i])
+			continue;
+		old = MemoryContextSwitchTo(state1->aggcontext);
+		geom = lwgeom_clone_deep(state2->levels[i]);
+		MemoryContextSwitchTo(old);
+		lwgeom_free(state2->levels[i]);
+		state2->levels[i] = NULL;
+		union_state_push(state1, geom, i);
+	}
+	foreach (l, state2->list)
+		union_state_add(state1, (LWGEOM *)lfirst(l));
+
+	MemoryContextDelete(state2->context);
+
+	if (state1->npoints > UNION_BUFFER_POINTS)
+		union_state_flush(state1);
+
+	PG_RETURN_POINTER(state1);
+}
+
+/**
+* The serial function unions what is pending with the levels, and writes the
+* state header followed by the serialized union, if any.
+*/
+PG_FUNCTION_INFO_V1(pgis_geometry_union_parallel_serialfn);
+Datum
+pgis_geometry_union_parallel_serialfn(PG_FUNCTION_ARGS)
+{
+	UnionState *state;
+	GSERIALIZED *gser = NULL;
+	LWGEOM *partial;
+	size_t header_size = sizeof(float8) + 3 * sizeof(int32_t);
+	size_t size = VARHDRSZ + header_size;
+	int32_t has_geoms;
+	bytea *result;
+	char *ptr;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "%s called in non-aggregate context", __func__);
+
+	state = (UnionState *)PG_GETARG_POINTER(0);
+	partial = union_state_finish(state);
+
+	if (partial)
+	{
+		gser = geometry_serialize(partial);
+		size += VARSIZE(gser);
+	}
+
+	result = (bytea *)palloc(size);
+	SET_VARSIZE(result, size);
+	ptr = VARDATA(result);
+	has_geoms = state->has_geoms;
+	memcpy(ptr, &state->gridSize, sizeof(float8));
+	ptr += sizeof(float8);
+	memcpy(ptr, &state->srid, sizeof(int32_t));
+	ptr += sizeof(int32_t);
+	memcpy(ptr, &state->empty_type, sizeof(int32_t));
+	ptr += sizeof(int32_t);
+	memcpy(ptr, &has_geoms, sizeof(int32_t));
+	ptr += sizeof(int32_t);
+	if (gser)
+		memcpy(ptr, gser, VARSIZE(gser));
+
+	PG_RETURN_BYTEA_P(result);
+}
+
+PG_FUNCTION_INFO_V1(pgis_geometry_union_parallel_deserialfn);
+Datum
+pgis_geometry_union_parallel_deserialfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext, old;
+	UnionState *state;
+	bytea *serialized;
+	size_t header_size = sizeof(float8) + 3 * sizeof(int32_t);
+	size_t size;
+	int32_t has_geoms;
+	const char *ptr;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "%s called in non-aggregate context", __func__);
+
+	serialized = PG_GETARG_BYTEA_P(0);
+	size = VARSIZE(serialized) - VARHDRSZ;
+	if (size < header_size)
+		elog(ERROR, "%s: Invalid serialized state", __func__);
+
+	state = union_state_create(aggcontext);
+	ptr = VARDATA(serialized);
+	memcpy(&state->gridSize, ptr, sizeof(float8));
+	ptr += sizeof(float8);
+	memcpy(&state->srid, ptr, sizeof(int32_t));
+	ptr += sizeof(int32_t);
+	memcpy(&state->empty_type, ptr, sizeof(int32_t));
+	ptr += sizeof(int32_t);
+	memcpy(&has_geoms, ptr, sizeof(int32_t));
+	ptr += sizeof(int32_t);
+	state->has_geoms = has_geoms;
+
+	if (size > header_size)
+	{
+		/* Copy out to get an aligned geometry */
+		GSERIALIZED *gser = (GSERIALIZED *)palloc(size - header_size);
+		memcpy(gser, ptr, size - header_size);
+		old = MemoryContextSwitchTo(aggcontext);
+		state->levels[0] = lwgeom_clone_deep(lwgeom_from_gserialized(gser));
+		MemoryContextSwitchTo(old);
+	}
+
+	PG_RETURN_POINTER(state);
+}
+
+/**
+* The final function unions what is pending with the levels and returns it.
+* Inputs that were all empty give an empty of the largest type.
+*/
+PG_FUNCTION_INFO_V1(pgis_geometry_union_parallel_finalfn);
+Datum
+pgis_geometry_union_parallel_finalfn(PG_FUNCTION_ARGS)
+{
+	UnionState *state;
+	LWGEOM *result;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL(); /* returns null iff no input values */
+
+	state = (UnionState *)PG_GETARG_POINTER(0);
+	result = union_state_finish(state);
+
+	if (result)
+		PG_RETURN_POINTER(geometry_serialize(result));
+
+	/* If it was only empties, we'll return the largest type number */
+	if (state->empty_type > 0)
+		PG_RETURN_POINTER(geometry_serialize(lwgeom_construct_empty(state->empty_type, state->srid, 0, 0)));
+
+	/* Nothing but NULL, returns NULL */
+	PG_RETURN_NULL();
+}
+
 /**
 * A modified version of PostgreSQL's DirectFunctionCall1 which allows NULL results; this
 * is required for aggregates that return NULL.
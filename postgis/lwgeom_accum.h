@@ -41,5 +41,31 @@ typedef struct CollectionBuildState
 	float8 gridSize;
 } CollectionBuildState;
 
+/* Levels of flushed unions kept by the parallel ST_Union, see UnionState */
+#define UNION_MAX_LEVELS 32
+
+/**
+** State of the parallel ST_Union aggregate. Inputs are buffered until
+** they add up to UNION_BUFFER_POINTS vertices, and are then unioned in
+** Hilbert ordered batches. The union of each flush is merged into the
+** levels like a binary counter, levels[k] holding the union of 2^k
+** flushes, so every input goes through O(log flushes) unions and the
+** levels are unioned together once, by the final function. Memory is
+** bounded by the buffer and the size of the union, not by the number
+** of inputs. Workers serialize their union for the combine function.
+*/
+typedef struct UnionState
+{
+	float8 gridSize;
+	List *list;            /* pending geometries, allocated in context */
+	uint32_t npoints;      /* vertices in the pending geometries */
+	LWGEOM *levels[UNION_MAX_LEVELS]; /* unions of flushed geometries, in aggcontext */
+	MemoryContext context;
+	MemoryContext aggcontext;
+	int32_t srid;
+	int32_t empty_type;    /* largest type of the empty inputs */
+	bool has_geoms;        /* got some non null input */
+} UnionState;
+
 
 #endif /* _LWGEOM_ACCUM_H */
@@ -133,9 +133,19 @@ Datum lwgeom_cmp(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(lwgeom_hash);
 Datum lwgeom_hash(PG_FUNCTION_ARGS)
 {
-	GSERIALIZED *g1 = PG_GETARG_GSERIALIZED_P(0);
+	GSERIALIZED *g1 = PG_GETARG_GSERIALIZED_HEADER(0);
+	int32_t hval;
+
+	/* A stored hash saves detoasting and hashing the whole geometry */
+	if (gserialized_get_cached_hash(g1, &hval) == LW_SUCCESS)
+	{
+		PG_FREE_IF_COPY(g1, 0);
+		PG_RETURN_INT32(hval);
+	}
+	PG_FREE_IF_COPY(g1, 0);
 
-	int32_t hval = gserialized_hash(g1);
+	g1 = PG_GETARG_GSERIALIZED_P(0);
+	hval = gserialized_hash(g1);
 	PG_FREE_IF_COPY(g1, 0);
 	PG_RETURN_INT32(hval);
 }
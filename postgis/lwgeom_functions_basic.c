@@ -108,6 +108,7 @@ extern "C" Datum LWGEOM_removepoint(PG_FUNCTION_ARGS);
 extern "C" Datum LWGEOM_setpoint_linestring(PG_FUNCTION_ARGS);
 extern "C" Datum LWGEOM_asEWKT(PG_FUNCTION_ARGS);
 extern "C" Datum LWGEOM_hasBBOX(PG_FUNCTION_ARGS);
+extern "C" Datum LWGEOM_isCompact(PG_FUNCTION_ARGS);
 extern "C" Datum LWGEOM_azimuth(PG_FUNCTION_ARGS);
 extern "C" Datum LWGEOM_angle(PG_FUNCTION_ARGS);
 extern "C" Datum LWGEOM_affine(PG_FUNCTION_ARGS);
@@ -2157,6 +2158,15 @@ Datum LWGEOM_hasBBOX(PG_FUNCTION_ARGS)
 	PG_RETURN_BOOL(res);
 }
 
+PG_FUNCTION_INFO_V1(LWGEOM_isCompact);
+Datum LWGEOM_isCompact(PG_FUNCTION_ARGS)
+{
+	GSERIALIZED *in = PG_GETARG_GSERIALIZED_HEADER(0);
+	char res = gserialized_is_compact(in);
+	PG_FREE_IF_COPY(in, 0);
+	PG_RETURN_BOOL(res);
+}
+
 /** Return: 2,3 or 4 */
 PG_FUNCTION_INFO_V1(LWGEOM_ndims);
 Datum LWGEOM_ndims(PG_FUNCTION_ARGS)
@@ -79,6 +79,7 @@ extern "C" Datum overlaps(PG_FUNCTION_ARGS);
 extern "C" Datum isvalid(PG_FUNCTION_ARGS);
 extern "C" Datum isvalidreason(PG_FUNCTION_ARGS);
 extern "C" Datum isvaliddetail(PG_FUNCTION_ARGS);
+extern "C" Datum LWGEOM_addChecks(PG_FUNCTION_ARGS);
 extern "C" Datum buffer(PG_FUNCTION_ARGS);
 extern "C" Datum ST_Intersection(PG_FUNCTION_ARGS);
 extern "C" Datum convexhull(PG_FUNCTION_ARGS);
@@ -147,6 +148,68 @@ is_point(const GSERIALIZED* g)
 	return type == POINTTYPE || type == MULTIPOINTTYPE;
 }
 
+/*
+ * Is the polygon a single axis-aligned rectangle (as built by
+ * ST_MakeEnvelope)? If so, fill in its box.
+ */
+static int
+lwpoly_is_axis_rectangle(const LWPOLY *poly, GBOX *box)
+{
+	const POINTARRAY *pa;
+	uint32_t i;
+
+	if (!poly || poly->nrings != 1 || poly->rings[0]->npoints != 5)
+		return LW_FALSE;
+
+	pa = poly->rings[0];
+	for (i = 1; i < pa->npoints; i++)
+	{
+		const POINT2D *p1 = getPoint2d_cp(pa, i - 1);
+		const POINT2D *p2 = getPoint2d_cp(pa, i);
+		if (p1->x != p2->x && p1->y != p2->y)
+			return LW_FALSE;
+	}
+	if (!ptarray_is_closed_2d(pa))
+		return LW_FALSE;
+
+	ptarray_calculate_gbox_cartesian(pa, box);
+	return LW_TRUE;
+}
+
+/*
+ * Analytic intersects test of an elliptical arc against a point or an
+ * axis-aligned rectangle. Returns -1 when the other geometry is
+ * neither and the caller has to fall back to GEOS.
+ */
+static int
+ellipse_intersects_short_circuit(const GSERIALIZED *gellipse, const GSERIALIZED *gother)
+{
+	LWGEOM *ellipse, *other;
+	GBOX box;
+	int result = -1;
+	int type = gserialized_get_type(gother);
+
+	if (type != POINTTYPE && type != POLYGONTYPE)
+		return -1;
+
+	ellipse = lwgeom_from_gserialized(gellipse);
+	other = lwgeom_from_gserialized(gother);
+
+	if (type == POINTTYPE)
+	{
+		const POINT2D *pt = getPoint2d_cp(lwgeom_as_lwpoint(other)->point, 0);
+		result = lwellipse_closest_point((LWELLIPSE *)ellipse, pt, LW_FALSE, NULL) <= FP_TOLERANCE;
+	}
+	else if (lwpoly_is_axis_rectangle(lwgeom_as_lwpoly(other), &box))
+	{
+		result = lwellipse_intersects_gbox((LWELLIPSE *)ellipse, &box);
+	}
+
+	lwgeom_free(ellipse);
+	lwgeom_free(other);
+	return result;
+}
+
 /* Utility function that checks a LWPOINT and a GSERIALIZED poly against a cache.
  * Serialized poly may be a multipart.
  */
@@ -1535,6 +1598,14 @@ Datum isvalid(PG_FUNCTION_ARGS)
 	LWGEOM *lwgeom;
 	char result;
 	GEOSGeom g1;
+	int cached;
+
+	/* Validity stored by postgis_addchecks, no need to ask GEOS */
+	geom1 = PG_GETARG_GSERIALIZED_HEADER(0);
+	cached = gserialized_get_cached_valid(geom1);
+	PG_FREE_IF_COPY(geom1, 0);
+	if (cached >= 0)
+		PG_RETURN_BOOL(cached);
 
 	geom1 = PG_GETARG_GSERIALIZED_P(0);
 
@@ -1578,6 +1649,14 @@ Datum isvalidreason(PG_FUNCTION_ARGS)
 	text *result = NULL;
 	const GEOSGeometry *g1 = NULL;
 
+	geom = PG_GETARG_GSERIALIZED_HEADER(0);
+	if (gserialized_get_cached_valid(geom) == LW_TRUE)
+	{
+		PG_FREE_IF_COPY(geom, 0);
+		PG_RETURN_TEXT_P(cstring_to_text("Valid Geometry"));
+	}
+	PG_FREE_IF_COPY(geom, 0);
+
 	geom = PG_GETARG_GSERIALIZED_P(0);
 
 	initGEOS(lwpgnotice, lwgeom_geos_error);
@@ -1682,6 +1761,38 @@ Datum isvaliddetail(PG_FUNCTION_ARGS)
 	PG_RETURN_HEAPTUPLEHEADER(result);
 }
 
+/**
+ * postgis_addchecks(geometry)
+ * Stores the ST_IsValid result and the hash in the extended
+ * flags of the geometry, so ST_IsValid, ST_MakeValid and hash
+ * joins or aggregates on it can skip that work later on.
+ */
+PG_FUNCTION_INFO_V1(LWGEOM_addChecks);
+Datum LWGEOM_addChecks(PG_FUNCTION_ARGS)
+{
+	GSERIALIZED *geom = PG_GETARG_GSERIALIZED_P_COPY(0);
+	GEOSGeometry *g1;
+	char valid = LW_TRUE;
+
+	/* Same answer as isvalid(), without the self-intersection notices */
+	if (!gserialized_is_empty(geom))
+	{
+		initGEOS(lwgeom_geos_error, lwgeom_geos_error);
+		g1 = POSTGIS2GEOS(geom);
+		if (!g1)
+			valid = LW_FALSE;
+		else
+		{
+			valid = GEOSisValid(g1);
+			GEOSGeom_destroy(g1);
+			if (valid == 2)
+				HANDLE_GEOS_ERROR("GEOSisValid");
+		}
+	}
+
+	PG_RETURN_POINTER(gserialized_set_cached_checks(geom, valid, LW_TRUE));
+}
+
 /**
  * overlaps(GSERIALIZED g1,GSERIALIZED g2)
  * @param g1
@@ -2326,6 +2437,23 @@ Datum ST_Intersects(PG_FUNCTION_ARGS)
 		PG_RETURN_BOOL(retval);
 	}
 
+	/*
+	 * short-circuit 3: an elliptical arc against a point or a
+	 * rectangle is answered without segmentizing the arc.
+	 */
+	if (gserialized_get_type(geom1) == ELLIPSETYPE || gserialized_get_type(geom2) == ELLIPSETYPE)
+	{
+		int retval;
+
+		if (gserialized_get_type(geom1) == ELLIPSETYPE)
+			retval = ellipse_intersects_short_circuit(geom1, geom2);
+		else
+			retval = ellipse_intersects_short_circuit(geom2, geom1);
+
+		if (retval != -1)
+			PG_RETURN_BOOL(retval);
+	}
+
 	initGEOS(lwpgnotice, lwgeom_geos_error);
 	prep_cache = GetPrepGeomCache(fcinfo, shared_geom1, shared_geom2);
 
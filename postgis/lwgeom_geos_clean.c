@@ -46,6 +46,18 @@ Datum ST_MakeValid(PG_FUNCTION_ARGS)
 	GSERIALIZED *in, *out;
 	LWGEOM *lwgeom_in, *lwgeom_out;
 
+	/* Known valid input with default parameters is returned untouched */
+	if (PG_NARGS() < 2 || PG_ARGISNULL(1))
+	{
+		int cached;
+		in = PG_GETARG_GSERIALIZED_HEADER(0);
+		/* The types supported below are POINTTYPE to COLLECTIONTYPE */
+		cached = gserialized_get_type(in) <= COLLECTIONTYPE ? gserialized_get_cached_valid(in) : -1;
+		PG_FREE_IF_COPY(in, 0);
+		if (cached == LW_TRUE)
+			PG_RETURN_POINTER(PG_GETARG_GSERIALIZED_P(0));
+	}
+
 	in = PG_GETARG_GSERIALIZED_P_COPY(0);
 	lwgeom_in = lwgeom_from_gserialized(in);
 
@@ -70,6 +70,9 @@ extern "C" Datum WKBFromLWGEOM(PG_FUNCTION_ARGS);
 extern "C" Datum TWKBFromLWGEOM(PG_FUNCTION_ARGS);
 extern "C" Datum TWKBFromLWGEOMArray(PG_FUNCTION_ARGS);
 extern "C" Datum LWGEOMFromTWKB(PG_FUNCTION_ARGS);
+extern "C" Datum LWGEOM_dropChecks(PG_FUNCTION_ARGS);
+extern "C" Datum LWGEOM_compact(PG_FUNCTION_ARGS);
+extern "C" Datum LWGEOM_uncompact(PG_FUNCTION_ARGS);
 
 /*
  * LWGEOM_in(cstring)
@@ -650,6 +653,91 @@ Datum LWGEOM_dropBBOX(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(gserialized_drop_gbox(geom));
 }
 
+/* removes the stored validity and hash from a geometry */
+PG_FUNCTION_INFO_V1(LWGEOM_dropChecks);
+Datum LWGEOM_dropChecks(PG_FUNCTION_ARGS)
+{
+	GSERIALIZED *geom = PG_GETARG_GSERIALIZED_P_COPY(0);
+
+	PG_RETURN_POINTER(gserialized_set_cached_checks(geom, -1, LW_FALSE));
+}
+
+/* Storage precision defaults, centimeters (or hundredths of feet) */
+#define COMPACT_DEFAULT_PRECISION 2
+
+/*
+ * postgis_compact(geometry, prec_xy, prec_z, prec_m)
+ * Rewrites a geometry with quantized, delta encoded coordinates.
+ * Types without a compact form, and geometries that would not
+ * get smaller, are returned in the plain form.
+ */
+PG_FUNCTION_INFO_V1(LWGEOM_compact);
+Datum LWGEOM_compact(PG_FUNCTION_ARGS)
+{
+	GSERIALIZED *geom;
+	GSERIALIZED *result;
+	LWGEOM *lwgeom;
+	srs_precision sp;
+	size_t size = 0;
+
+	if (PG_ARGISNULL(0)) PG_RETURN_NULL();
+	geom = PG_GETARG_GSERIALIZED_P(0);
+
+	/* Same defaults as ST_AsTWKB, two digits finer */
+	sp = srid_axis_precision(gserialized_get_srid(geom), COMPACT_DEFAULT_PRECISION);
+	if (PG_NARGS() > 1 && !PG_ARGISNULL(1))
+		sp.precision_xy = PG_GETARG_INT32(1);
+	if (PG_NARGS() > 2 && !PG_ARGISNULL(2))
+		sp.precision_z = PG_GETARG_INT32(2);
+	if (PG_NARGS() > 3 && !PG_ARGISNULL(3))
+		sp.precision_m = PG_GETARG_INT32(3);
+
+	/* What fits in the TWKB header */
+	if (sp.precision_xy < -7 || sp.precision_xy > 7)
+		elog(ERROR, "%s: XY precision must be between -7 and 7", __func__);
+	if (sp.precision_z < 0 || sp.precision_z > 7 || sp.precision_m < 0 || sp.precision_m > 7)
+		elog(ERROR, "%s: Z and M precision must be between 0 and 7", __func__);
+
+	lwgeom = lwgeom_from_gserialized(geom);
+	result = gserialized_compact_from_lwgeom(lwgeom, sp.precision_xy, sp.precision_z, sp.precision_m, &size);
+	if (!result || size >= gserialized_from_lwgeom_size(lwgeom))
+	{
+		if (result)
+			lwfree(result);
+
+		/* Plain input stays as it is */
+		if (!gserialized_is_compact(geom))
+		{
+			lwgeom_free(lwgeom);
+			PG_RETURN_POINTER(geom);
+		}
+		result = geometry_serialize(lwgeom);
+	}
+	lwgeom_free(lwgeom);
+
+	PG_FREE_IF_COPY(geom, 0);
+	PG_RETURN_POINTER(result);
+}
+
+/* decodes a compact geometry back to the plain form */
+PG_FUNCTION_INFO_V1(LWGEOM_uncompact);
+Datum LWGEOM_uncompact(PG_FUNCTION_ARGS)
+{
+	GSERIALIZED *geom = PG_GETARG_GSERIALIZED_P(0);
+	GSERIALIZED *result;
+	LWGEOM *lwgeom;
+
+	if (!gserialized_is_compact(geom))
+		PG_RETURN_POINTER(geom);
+
+	lwgeom = lwgeom_from_gserialized(geom);
+	result = geometry_serialize(lwgeom);
+	lwgeom_free(lwgeom);
+
+	PG_FREE_IF_COPY(geom, 0);
+	PG_RETURN_POINTER(result);
+}
+
 
 /* for the wkt parser */
 void elog_ERROR(const char* string)
@@ -23,6 +23,7 @@
  **********************************************************************/
 
 #include "postgres.h"
+#include "funcapi.h"
 #include "utils/builtins.h"
 #include "executor/spi.h"
 #include "utils/lsyscache.h"
@@ -42,6 +43,7 @@ extern "C" Datum pgis_asmvt_finalfn(PG_FUNCTION_ARGS);
 extern "C" Datum pgis_asmvt_serialfn(PG_FUNCTION_ARGS);
 extern "C" Datum pgis_asmvt_deserialfn(PG_FUNCTION_ARGS);
 extern "C" Datum pgis_asmvt_combinefn(PG_FUNCTION_ARGS);
+extern "C" Datum ST_AsMVTPyramid(PG_FUNCTION_ARGS);
 
 /**
  * Process input parameters to mvt_geom and returned serialized geometry
@@ -287,3 +289,186 @@ Datum pgis_asmvt_combinefn(PG_FUNCTION_ARGS)
 #endif
 }
 
+#ifdef HAVE_LIBPROTOBUF
+/* Rows read from the table per cursor fetch */
+#define MVT_PYRAMID_FETCH_SIZE 1000
+
+/**
+ * Scans the table once, adding every row with a non null geometry to the
+ * pyramid. Tiles are kept in the pyramid context, scratch data goes to a per
+ * row context.
+ */
+static void
+mvt_pyramid_scan(mvt_pyramid *pyramid, Oid relid, const char *geom_name)
+{
+	MemoryContext old_context = CurrentMemoryContext;
+	MemoryContext row_context;
+	StringInfoData sql;
+	SPIPlanPtr plan;
+	Portal portal;
+	TupleDesc tupdesc;
+	int geom_attnum;
+
+	row_context = AllocSetContextCreate(CurrentMemoryContext, "ST_AsMVTPyramid row", ALLOCSET_DEFAULT_SIZES);
+
+	initStringInfo(&sql);
+	appendStringInfo(&sql, "SELECT * FROM %s",
+			 DatumGetCString(DirectFunctionCall1(regclassout, ObjectIdGetDatum(relid))));
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "%s: could not connect to SPI manager", __func__);
+
+	plan = SPI_prepare(sql.data, 0, NULL);
+	if (!plan)
+		elog(ERROR, "%s: unexpected return (%d) from query preparation: %s", __func__, SPI_result, sql.data);
+	portal = SPI_cursor_open(NULL, plan, NULL, NULL, true);
+
+	/* Rows are passed to the encoder as composites, which need a registered type */
+	MemoryContextSwitchTo(old_context);
+	tupdesc = CreateTupleDescCopy(portal->tupDesc);
+	BlessTupleDesc(tupdesc);
+
+	geom_attnum = SPI_fnumber(tupdesc, geom_name);
+	if (geom_attnum <= 0 || SPI_gettypeid(tupdesc, geom_attnum) != postgis_oid(GEOMETRYOID))
+		elog(ERROR, "%s: Could not find column '%s' of geometry type", __func__, geom_name);
+
+	for (;;)
+	{
+		SPITupleTable *tuptable;
+		uint64 i;
+
+		SPI_cursor_fetch(portal, true, MVT_PYRAMID_FETCH_SIZE);
+		if (SPI_processed == 0)
+			break;
+
+		tuptable = SPI_tuptable;
+		for (i = 0; i < SPI_processed; i++)
+		{
+			HeapTuple tuple = tuptable->vals[i];
+			HeapTupleHeader row;
+			GSERIALIZED *gser;
+			LWGEOM *lwgeom;
+			bool isnull;
+			Datum datum;
+
+			datum = SPI_getbinval(tuple, tupdesc, geom_attnum, &isnull);
+			if (isnull)
+				continue;
+
+			MemoryContextSwitchTo(row_context);
+
+			row = (HeapTupleHeader)palloc(tuple->t_len);
+			memcpy(row, tuple->t_data, tuple->t_len);
+			HeapTupleHeaderSetDatumLength(row, tuple->t_len);
+			HeapTupleHeaderSetTypeId(row, tupdesc->tdtypeid);
+			HeapTupleHeaderSetTypMod(row, tupdesc->tdtypmod);
+
+			gser = (GSERIALIZED *)PG_DETOAST_DATUM(datum);
+			lwgeom = lwgeom_from_gserialized(gser);
+			mvt_pyramid_add(pyramid, row, lwgeom);
+
+			MemoryContextSwitchTo(old_context);
+			MemoryContextReset(row_context);
+		}
+		SPI_freetuptable(tuptable);
+	}
+
+	SPI_cursor_close(portal);
+	SPI_finish();
+	MemoryContextSwitchTo(old_context);
+	MemoryContextDelete(row_context);
+}
+#endif
+
+/**
+ * Encodes every tile of zoom levels zmin to zmax of a table in a single pass,
+ * returning z, x, y and the tile for each non empty tile. Each feature is read
+ * once and clipped down the tile tree into all the zooms. Tiles growing past
+ * work_mem are spilled to a temporary file and merged back on output.
+ */
+PG_FUNCTION_INFO_V1(ST_AsMVTPyramid);
+Datum ST_AsMVTPyramid(PG_FUNCTION_ARGS)
+{
+#ifndef HAVE_LIBPROTOBUF
+	elog(ERROR, "ST_AsMVTPyramid: Compiled without protobuf-c support");
+	PG_RETURN_NULL();
+#else
+	FuncCallContext *funcctx;
+	mvt_pyramid *pyramid;
+	uint32_t z, x, y;
+	bytea *mvt;
+	Datum values[4];
+	bool nulls[4] = {false, false, false, false};
+	HeapTuple tuple;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext old_context;
+		int32_t zmin, zmax, extent, buffer;
+		bool clip_geom;
+		char *name, *geom_name, *id_name;
+		GSERIALIZED *gbounds;
+		GBOX bounds;
+
+		/* We need to initialize the internal cache to access it later via postgis_oid() */
+		postgis_initialize_cache();
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		old_context = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2))
+			elog(ERROR, "%s: Table and zoom levels cannot be null", __func__);
+
+		zmin = PG_GETARG_INT32(1);
+		zmax = PG_GETARG_INT32(2);
+		if (zmin < 0 || zmax < zmin || zmax > MVT_PYRAMID_MAX_ZOOM)
+			elog(ERROR, "%s: Invalid zoom range %d to %d, must be within 0 and %d",
+			     __func__, zmin, zmax, MVT_PYRAMID_MAX_ZOOM);
+
+		name = PG_ARGISNULL(3) ? pstrdup("default") : text_to_cstring(PG_GETARG_TEXT_P(3));
+		extent = PG_ARGISNULL(4) ? 4096 : PG_GETARG_INT32(4);
+		if (extent <= 0)
+			elog(ERROR, "%s: Extent must be greater than 0", __func__);
+		buffer = PG_ARGISNULL(5) ? 256 : PG_GETARG_INT32(5);
+		if (buffer < 0)
+			elog(ERROR, "%s: Buffer cannot be negative", __func__);
+		clip_geom = PG_ARGISNULL(6) ? true : PG_GETARG_BOOL(6);
+		geom_name = PG_ARGISNULL(7) ? pstrdup("geom") : text_to_cstring(PG_GETARG_TEXT_P(7));
+		id_name = PG_ARGISNULL(8) ? NULL : text_to_cstring(PG_GETARG_TEXT_P(8));
+
+		if (PG_ARGISNULL(9))
+			elog(ERROR, "%s: Geometric bounds cannot be null", __func__);
+		gbounds = PG_GETARG_GSERIALIZED_P(9);
+		if (gserialized_get_gbox_p(gbounds, &bounds) != LW_SUCCESS)
+			elog(ERROR, "%s: Empty bounds", __func__);
+		if (bounds.xmax - bounds.xmin <= 0 || bounds.ymax - bounds.ymin <= 0)
+			elog(ERROR, "%s: Geometric bounds are too small", __func__);
+
+		if (get_call_result_type(fcinfo, 0, &funcctx->tuple_desc) != TYPEFUNC_COMPOSITE)
+		{
+			ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				errmsg("set-valued function called in context that cannot accept a set")));
+		}
+		BlessTupleDesc(funcctx->tuple_desc);
+
+		pyramid = mvt_pyramid_init(&bounds, zmin, zmax, name, extent, buffer, clip_geom, geom_name, id_name);
+		mvt_pyramid_scan(pyramid, PG_GETARG_OID(0), geom_name);
+		funcctx->user_fctx = pyramid;
+
+		MemoryContextSwitchTo(old_context);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	pyramid = (mvt_pyramid *)funcctx->user_fctx;
+
+	if (!mvt_pyramid_next(pyramid, &z, &x, &y, &mvt))
+		SRF_RETURN_DONE(funcctx);
+
+	values[0] = Int32GetDatum(z);
+	values[1] = Int32GetDatum(x);
+	values[2] = Int32GetDatum(y);
+	values[3] = PointerGetDatum(mvt);
+	tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+	SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+#endif
+}
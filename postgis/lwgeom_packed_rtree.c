@@ -0,0 +1,716 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************/
+
+/*
+ * Static, fully packed Hilbert R-tree for read-only layers.
+ *
+ * ST_PackedRTree(geom, id) aggregates the 2D boxes of a layer into a
+ * single bytea, laid out like the flatgeobuf PackedRTree: items are
+ * sorted along a Hilbert curve, every node holds PRTREE_NODE_SIZE
+ * children (only the last node of a level may be short) and each level
+ * is stored contiguously, leaves first and root last.
+ *
+ * Node boxes are kept as four separate float arrays rather than an array
+ * of boxes, so testing all the children of a node is a straight,
+ * branch-free loop over contiguous memory that the compiler can
+ * vectorize. ST_PackedRTreeSearch answers && and ST_PackedRTreeNearest
+ * answers box-distance KNN directly from the tree; both only look at the
+ * stored boxes, callers recheck against the real geometries.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+
+#include "../postgis_config.h"
+
+#include "liblwgeom.h"
+#include "lwgeom_pg.h"
+#include "gserialized_gist.h"
+
+#include <float.h>
+#include <math.h>
+
+extern "C" Datum pgis_packedrtree_transfn(PG_FUNCTION_ARGS);
+extern "C" Datum pgis_packedrtree_finalfn(PG_FUNCTION_ARGS);
+extern "C" Datum ST_PackedRTreeSearch(PG_FUNCTION_ARGS);
+extern "C" Datum ST_PackedRTreeNearest(PG_FUNCTION_ARGS);
+
+#define PRTREE_VERSION 1
+#define PRTREE_NODE_SIZE 16
+#define PRTREE_MAX_NODE_SIZE 64
+#define PRTREE_MAX_LEVELS 32
+
+/*
+ * On-disk header. It is followed by num_nodes int64 refs (item id for a
+ * leaf, position of the first child for an internal node) and then by
+ * the xmin, ymin, xmax and ymax float arrays, each num_nodes long.
+ * Level L occupies positions [level_end[L-1], level_end[L]).
+ */
+typedef struct
+{
+	int32 vl_len_;
+	uint16 version;
+	uint16 node_size;
+	int32 srid;
+	uint32 num_items;
+	uint32 num_nodes;
+	uint32 num_levels;
+	uint32 level_end[PRTREE_MAX_LEVELS];
+} PackedRTreeHeader;
+
+typedef struct
+{
+	const PackedRTreeHeader *hdr;
+	const char *refs;
+	const float *xmin;
+	const float *ymin;
+	const float *xmax;
+	const float *ymax;
+} PackedRTree;
+
+/*
+ * A tree argument that had to be detoasted, kept in fn_extra so that a
+ * search repeated over many rows against the same tree only detoasts and
+ * validates it once. It is keyed on the raw datum bytes, which for a
+ * toasted value is just the toast pointer.
+ */
+typedef struct
+{
+	PackedRTree tree;
+	size_t size;
+	char datum[1];
+} PackedRTreeCache;
+
+typedef struct
+{
+	MemoryContext aggcontext;
+	BOX2DF *boxes;
+	int64 *ids;
+	uint32 nitems;
+	uint32 capacity;
+	int32 srid;
+} PackedRTreeBuildState;
+
+typedef struct
+{
+	uint64_t key;
+	uint32 idx;
+} PackedRTreeSortItem;
+
+static size_t
+prtree_size(uint32 num_nodes)
+{
+	return sizeof(PackedRTreeHeader) + (size_t)num_nodes * (sizeof(int64) + 4 * sizeof(float));
+}
+
+/*
+ * Largest tree that fits in a bytea. Levels above the leaves add less than
+ * one node per node_size - 1 items, plus one per level for short nodes.
+ */
+#define PRTREE_MAX_NODES ((uint32)((MaxAllocSize - sizeof(PackedRTreeHeader)) / (sizeof(int64) + 4 * sizeof(float))))
+#define PRTREE_MAX_ITEMS (PRTREE_MAX_NODES / PRTREE_NODE_SIZE * (PRTREE_NODE_SIZE - 1) - PRTREE_MAX_LEVELS)
+
+/* The bytea is only guaranteed int4 alignment, so refs are copied out */
+static inline int64
+prtree_ref(const PackedRTree *t, uint32 pos)
+{
+	int64 ref;
+	memcpy(&ref, t->refs + (size_t)pos * sizeof(int64), sizeof(int64));
+	return ref;
+}
+
+static void
+prtree_init(PackedRTree *t, const bytea *b)
+{
+	const PackedRTreeHeader *hdr = (const PackedRTreeHeader *)b;
+	const char *base = (const char *)b;
+	uint32 n;
+
+	if (VARSIZE(b) < sizeof(PackedRTreeHeader) || hdr->version != PRTREE_VERSION ||
+	    hdr->node_size < 2 || hdr->node_size > PRTREE_MAX_NODE_SIZE ||
+	    hdr->num_levels > PRTREE_MAX_LEVELS || VARSIZE(b) != prtree_size(hdr->num_nodes) ||
+	    (hdr->num_nodes > 0 && (hdr->num_levels == 0 || hdr->level_end[hdr->num_levels - 1] != hdr->num_nodes)))
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE), errmsg("invalid packed rtree")));
+	for (n = 1; n < hdr->num_levels; n++)
+	{
+		if (hdr->level_end[n] <= hdr->level_end[n - 1])
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE), errmsg("invalid packed rtree")));
+	}
+
+	n = hdr->num_nodes;
+	t->hdr = hdr;
+	t->refs = base + sizeof(PackedRTreeHeader);
+	t->xmin = (const float *)(t->refs + (size_t)n * sizeof(int64));
+	t->ymin = t->xmin + n;
+	t->xmax = t->ymin + n;
+	t->ymax = t->xmax + n;
+}
+
+/* Children of the node at pos on level, as a [start, end) range one level down */
+static inline void
+prtree_children(const PackedRTree *t, uint32 pos, uint32 level, uint32 *start, uint32 *end)
+{
+	int64 first = prtree_ref(t, pos);
+	uint32 lo = level >= 2 ? t->hdr->level_end[level - 2] : 0;
+
+	if (first < lo || first >= t->hdr->level_end[level - 1])
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE), errmsg("invalid packed rtree")));
+	*start = (uint32)first;
+	*end = Min(*start + t->hdr->node_size, t->hdr->level_end[level - 1]);
+}
+
+static int
+prtree_sort_cmp(const void *a, const void *b)
+{
+	uint64_t ka = ((const PackedRTreeSortItem *)a)->key;
+	uint64_t kb = ((const PackedRTreeSortItem *)b)->key;
+	return ka < kb ? -1 : (ka > kb ? 1 : 0);
+}
+
+/**
+** Collect the boxes and ids of the layer in the aggregate context.
+** Empty and NULL geometries, and NULL ids, are skipped.
+*/
+PG_FUNCTION_INFO_V1(pgis_packedrtree_transfn);
+Datum
+pgis_packedrtree_transfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	PackedRTreeBuildState *state;
+	BOX2DF box;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "%s called in non-aggregate context", __func__);
+
+	if (PG_ARGISNULL(0))
+	{
+		state = (PackedRTreeBuildState *)MemoryContextAlloc(aggcontext, sizeof(PackedRTreeBuildState));
+		state->aggcontext = aggcontext;
+		state->capacity = 1024;
+		state->nitems = 0;
+		state->srid = SRID_UNKNOWN;
+		state->boxes = (BOX2DF *)MemoryContextAlloc(aggcontext, state->capacity * sizeof(BOX2DF));
+		state->ids = (int64 *)MemoryContextAlloc(aggcontext, state->capacity * sizeof(int64));
+	}
+	else
+		state = (PackedRTreeBuildState *)PG_GETARG_POINTER(0);
+
+	if (PG_ARGISNULL(1) || PG_ARGISNULL(2))
+		PG_RETURN_POINTER(state);
+
+	if (state->nitems == 0)
+		state->srid = gserialized_get_srid(PG_GETARG_GSERIALIZED_HEADER(1));
+	else
+		gserialized_error_if_srid_mismatch_reference(PG_GETARG_GSERIALIZED_HEADER(1), state->srid, __func__);
+
+	if (gserialized_datum_get_box2df_p(PG_GETARG_DATUM(1), &box) == LW_FAILURE)
+		PG_RETURN_POINTER(state);
+
+	if (state->nitems == state->capacity)
+	{
+		if (state->capacity >= PRTREE_MAX_ITEMS)
+			ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				errmsg("too many items for a packed rtree"),
+				errdetail("A packed rtree holds at most %u items.", (uint32)PRTREE_MAX_ITEMS)));
+		state->capacity = Min(state->capacity * 2, (uint32)PRTREE_MAX_ITEMS);
+		state->boxes = (BOX2DF *)repalloc(state->boxes, state->capacity * sizeof(BOX2DF));
+		state->ids = (int64 *)repalloc(state->ids, state->capacity * sizeof(int64));
+	}
+	state->boxes[state->nitems] = box;
+	state->ids[state->nitems] = PG_GETARG_INT64(2);
+	state->nitems++;
+
+	PG_RETURN_POINTER(state);
+}
+
+/**
+** Sort the collected boxes along a Hilbert curve over their extent and
+** pack them bottom-up into a PRTREE_NODE_SIZE-ary tree.
+*/
+PG_FUNCTION_INFO_V1(pgis_packedrtree_finalfn);
+Datum
+pgis_packedrtree_finalfn(PG_FUNCTION_ARGS)
+{
+	PackedRTreeBuildState *state;
+	PackedRTreeSortItem *items;
+	PackedRTreeHeader *hdr;
+	bytea *result;
+	int64 *refs;
+	float *xmin, *ymin, *xmax, *ymax;
+	uint32 level_count[PRTREE_MAX_LEVELS];
+	uint32 nitems, num_nodes = 0, num_levels = 0;
+	uint32 i, level;
+	double ext_xmin = DBL_MAX, ext_ymin = DBL_MAX, ext_xmax = -DBL_MAX, ext_ymax = -DBL_MAX;
+	double width, height;
+	size_t size;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "%s called in non-aggregate context", __func__);
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+
+	state = (PackedRTreeBuildState *)PG_GETARG_POINTER(0);
+	nitems = state->nitems;
+
+	/* Level sizes: every parent level holds ceil(n / node size) nodes */
+	if (nitems > 0)
+	{
+		uint32 n = nitems;
+		do
+		{
+			level_count[num_levels++] = n;
+			num_nodes += n;
+			n = (n + PRTREE_NODE_SIZE - 1) / PRTREE_NODE_SIZE;
+		} while (level_count[num_levels - 1] > 1);
+	}
+
+	if (num_nodes > PRTREE_MAX_NODES)
+		ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+			errmsg("too many items for a packed rtree"),
+			errdetail("A packed rtree holds at most %u items.", (uint32)PRTREE_MAX_ITEMS)));
+
+	size = prtree_size(num_nodes);
+	result = (bytea *)palloc0(size);
+	SET_VARSIZE(result, size);
+	hdr = (PackedRTreeHeader *)result;
+	hdr->version = PRTREE_VERSION;
+	hdr->node_size = PRTREE_NODE_SIZE;
+	hdr->srid = state->srid;
+	hdr->num_items = nitems;
+	hdr->num_nodes = num_nodes;
+	hdr->num_levels = num_levels;
+
+	if (nitems == 0)
+		PG_RETURN_BYTEA_P(result);
+
+	refs = (int64 *)palloc(num_nodes * sizeof(int64));
+	xmin = (float *)((char *)result + sizeof(PackedRTreeHeader) + num_nodes * sizeof(int64));
+	ymin = xmin + num_nodes;
+	xmax = ymin + num_nodes;
+	ymax = xmax + num_nodes;
+
+	for (i = 0; i < nitems; i++)
+	{
+		const BOX2DF *b = &state->boxes[i];
+		ext_xmin = Min(ext_xmin, b->xmin);
+		ext_ymin = Min(ext_ymin, b->ymin);
+		ext_xmax = Max(ext_xmax, b->xmax);
+		ext_ymax = Max(ext_ymax, b->ymax);
+	}
+	width = ext_xmax - ext_xmin;
+	height = ext_ymax - ext_ymin;
+
+	items = (PackedRTreeSortItem *)palloc(nitems * sizeof(PackedRTreeSortItem));
+	for (i = 0; i < nitems; i++)
+	{
+		const BOX2DF *b = &state->boxes[i];
+		double cx = ((double)b->xmin + b->xmax) / 2.0 - ext_xmin;
+		double cy = ((double)b->ymin + b->ymax) / 2.0 - ext_ymin;
+		uint32_t qx = width > 0 ? (uint32_t)(cx / width * UINT32_MAX) : 0;
+		uint32_t qy = height > 0 ? (uint32_t)(cy / height * UINT32_MAX) : 0;
+		items[i].key = uint32_hilbert(qx, qy);
+		items[i].idx = i;
+	}
+	qsort(items, nitems, sizeof(PackedRTreeSortItem), prtree_sort_cmp);
+
+	/* Leaves, in Hilbert order */
+	for (i = 0; i < nitems; i++)
+	{
+		const BOX2DF *b = &state->boxes[items[i].idx];
+		refs[i] = state->ids[items[i].idx];
+		xmin[i] = b->xmin;
+		ymin[i] = b->ymin;
+		xmax[i] = b->xmax;
+		ymax[i] = b->ymax;
+	}
+	hdr->level_end[0] = nitems;
+
+	/* Each parent level is packed right after the level it covers */
+	for (level = 1; level < num_levels; level++)
+	{
+		uint32 child_start = level == 1 ? 0 : hdr->level_end[level - 2];
+		uint32 child_end = hdr->level_end[level - 1];
+		uint32 pos = child_end;
+
+		for (i = child_start; i < child_end; i += PRTREE_NODE_SIZE, pos++)
+		{
+			uint32 j, end = Min(i + PRTREE_NODE_SIZE, child_end);
+			float nxmin = xmin[i], nymin = ymin[i], nxmax = xmax[i], nymax = ymax[i];
+			for (j = i + 1; j < end; j++)
+			{
+				nxmin = Min(nxmin, xmin[j]);
+				nymin = Min(nymin, ymin[j]);
+				nxmax = Max(nxmax, xmax[j]);
+				nymax = Max(nymax, ymax[j]);
+			}
+			refs[pos] = i;
+			xmin[pos] = nxmin;
+			ymin[pos] = nymin;
+			xmax[pos] = nxmax;
+			ymax[pos] = nymax;
+		}
+		Assert(pos - child_end == level_count[level]);
+		hdr->level_end[level] = pos;
+	}
+
+	memcpy((char *)result + sizeof(PackedRTreeHeader), refs, num_nodes * sizeof(int64));
+	pfree(refs);
+	pfree(items);
+
+	PG_RETURN_BYTEA_P(result);
+}
+
+/* Branch-free overlap test of a query box against a contiguous run of nodes */
+static inline void
+prtree_overlaps(const PackedRTree *t, uint32 start, uint32 end, const BOX2DF *q, uint8 *hit)
+{
+	const float *x0 = t->xmin + start, *y0 = t->ymin + start;
+	const float *x1 = t->xmax + start, *y1 = t->ymax + start;
+	uint32 i, n = end - start;
+
+	for (i = 0; i < n; i++)
+		hit[i] = (x0[i] <= q->xmax) & (x1[i] >= q->xmin) & (y0[i] <= q->ymax) & (y1[i] >= q->ymin);
+}
+
+typedef struct
+{
+	int64 *ids;
+	double *dists;
+	uint32 count;
+	uint32 next;
+} PackedRTreeResult;
+
+static PackedRTree *
+prtree_get(FunctionCallInfo fcinfo, BOX2DF *query, bool *empty)
+{
+	struct varlena *raw = (struct varlena *)PG_GETARG_POINTER(0);
+	PackedRTreeCache *cache = (PackedRTreeCache *)fcinfo->flinfo->fn_extra;
+	PackedRTree *t;
+	size_t size;
+
+	if (!VARATT_IS_EXTENDED(raw))
+	{
+		t = (PackedRTree *)palloc(sizeof(PackedRTree));
+		prtree_init(t, (bytea *)raw);
+	}
+	else
+	{
+		size = VARSIZE_ANY(raw);
+		if (!cache || cache->size != size || memcmp(cache->datum, raw, size) != 0)
+		{
+			MemoryContext oldcontext = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+
+			if (cache)
+			{
+				pfree((void *)cache->tree.hdr);
+				pfree(cache);
+				fcinfo->flinfo->fn_extra = NULL;
+			}
+			cache = (PackedRTreeCache *)palloc(offsetof(PackedRTreeCache, datum) + size);
+			cache->size = size;
+			memcpy(cache->datum, raw, size);
+			prtree_init(&cache->tree, (bytea *)pg_detoast_datum(raw));
+			fcinfo->flinfo->fn_extra = cache;
+
+			MemoryContextSwitchTo(oldcontext);
+		}
+		t = &cache->tree;
+	}
+
+	if (t->hdr->num_items > 0)
+		gserialized_error_if_srid_mismatch_reference(PG_GETARG_GSERIALIZED_HEADER(1), t->hdr->srid, __func__);
+	*empty = t->hdr->num_nodes == 0 ||
+		 gserialized_datum_get_box2df_p(PG_GETARG_DATUM(1), query) == LW_FAILURE;
+	return t;
+}
+
+/*
+ * Collect the ids of every leaf whose box overlaps the query box.
+ * Ranges of siblings are kept on an explicit stack, so each visit is
+ * one vectorized scan of up to node_size boxes.
+ */
+static void
+prtree_search(const PackedRTree *t, const BOX2DF *q, PackedRTreeResult *res)
+{
+	typedef struct { uint32 start, end, level; } Range;
+	Range stack[PRTREE_MAX_LEVELS * PRTREE_MAX_NODE_SIZE];
+	uint8 hit[PRTREE_MAX_NODE_SIZE];
+	uint32 capacity = 64;
+	int sp = 0;
+
+	res->ids = (int64 *)palloc(capacity * sizeof(int64));
+	res->count = 0;
+
+	stack[sp].start = t->hdr->num_nodes - 1;
+	stack[sp].end = t->hdr->num_nodes;
+	stack[sp].level = t->hdr->num_levels - 1;
+	sp++;
+
+	while (sp > 0)
+	{
+		Range r = stack[--sp];
+		uint32 i, n = r.end - r.start;
+
+		prtree_overlaps(t, r.start, r.end, q, hit);
+		for (i = 0; i < n; i++)
+		{
+			uint32 pos = r.start + i;
+			if (!hit[i])
+				continue;
+			if (r.level == 0)
+			{
+				if (res->count == capacity)
+				{
+					capacity *= 2;
+					res->ids = (int64 *)repalloc(res->ids, capacity * sizeof(int64));
+				}
+				res->ids[res->count++] = prtree_ref(t, pos);
+			}
+			else
+			{
+				prtree_children(t, pos, r.level, &stack[sp].start, &stack[sp].end);
+				stack[sp].level = r.level - 1;
+				sp++;
+			}
+		}
+	}
+}
+
+/**
+* ST_PackedRTreeSearch(tree bytea, geom geometry) returns setof bigint
+* Ids of the items whose box overlaps the box of geom (the && test).
+*/
+PG_FUNCTION_INFO_V1(ST_PackedRTreeSearch);
+Datum
+ST_PackedRTreeSearch(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	PackedRTreeResult *res;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		PackedRTree *t;
+		BOX2DF query;
+		bool empty;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		res = (PackedRTreeResult *)palloc0(sizeof(PackedRTreeResult));
+		t = prtree_get(fcinfo, &query, &empty);
+		if (!empty)
+			prtree_search(t, &query, res);
+		funcctx->user_fctx = res;
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	res = (PackedRTreeResult *)funcctx->user_fctx;
+
+	if (res->next >= res->count)
+		SRF_RETURN_DONE(funcctx);
+
+	SRF_RETURN_NEXT(funcctx, Int64GetDatum(res->ids[res->next++]));
+}
+
+/* Min-heap of nodes keyed on their box distance to the query */
+typedef struct
+{
+	double dist;
+	uint32 pos;
+	uint32 level;
+} PackedRTreeHeapItem;
+
+static void
+prtree_heap_push(PackedRTreeHeapItem **heap, uint32 *n, uint32 *capacity, PackedRTreeHeapItem item)
+{
+	uint32 i;
+
+	if (*n == *capacity)
+	{
+		*capacity *= 2;
+		*heap = (PackedRTreeHeapItem *)repalloc(*heap, *capacity * sizeof(PackedRTreeHeapItem));
+	}
+	i = (*n)++;
+	while (i > 0)
+	{
+		uint32 parent = (i - 1) / 2;
+		if ((*heap)[parent].dist <= item.dist)
+			break;
+		(*heap)[i] = (*heap)[parent];
+		i = parent;
+	}
+	(*heap)[i] = item;
+}
+
+static PackedRTreeHeapItem
+prtree_heap_pop(PackedRTreeHeapItem *heap, uint32 *n)
+{
+	PackedRTreeHeapItem top = heap[0];
+	PackedRTreeHeapItem last = heap[--(*n)];
+	uint32 i = 0;
+
+	for (;;)
+	{
+		uint32 child = 2 * i + 1;
+		if (child >= *n)
+			break;
+		if (child + 1 < *n && heap[child + 1].dist < heap[child].dist)
+			child++;
+		if (last.dist <= heap[child].dist)
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	if (*n > 0)
+		heap[i] = last;
+	return top;
+}
+
+/* Box-to-box distances of a run of nodes, branch-free like prtree_overlaps */
+static inline void
+prtree_distances(const PackedRTree *t, uint32 start, uint32 end, const BOX2DF *q, double *dist)
+{
+	const float *x0 = t->xmin + start, *y0 = t->ymin + start;
+	const float *x1 = t->xmax + start, *y1 = t->ymax + start;
+	uint32 i, n = end - start;
+
+	for (i = 0; i < n; i++)
+	{
+		double dx = Max(0.0, Max((double)x0[i] - q->xmax, (double)q->xmin - x1[i]));
+		double dy = Max(0.0, Max((double)y0[i] - q->ymax, (double)q->ymin - y1[i]));
+		dist[i] = sqrt(dx * dx + dy * dy);
+	}
+}
+
+/*
+ * Best-first traversal: nodes come off the heap in increasing box
+ * distance, so the first k leaves popped are the k nearest boxes.
+ */
+static void
+prtree_nearest(const PackedRTree *t, const BOX2DF *q, uint32 k, PackedRTreeResult *res)
+{
+	PackedRTreeHeapItem *heap;
+	PackedRTreeHeapItem root;
+	double dist[PRTREE_MAX_NODE_SIZE];
+	uint32 n = 0, capacity = 256;
+
+	k = Min(k, t->hdr->num_items);
+	res->ids = (int64 *)palloc(k * sizeof(int64));
+	res->dists = (double *)palloc(k * sizeof(double));
+	res->count = 0;
+	if (k == 0)
+		return;
+
+	heap = (PackedRTreeHeapItem *)palloc(capacity * sizeof(PackedRTreeHeapItem));
+	root.pos = t->hdr->num_nodes - 1;
+	root.level = t->hdr->num_levels - 1;
+	prtree_distances(t, root.pos, root.pos + 1, q, &root.dist);
+	prtree_heap_push(&heap, &n, &capacity, root);
+
+	while (n > 0 && res->count < k)
+	{
+		PackedRTreeHeapItem item = prtree_heap_pop(heap, &n);
+		uint32 i, start, end;
+
+		if (item.level == 0)
+		{
+			res->ids[res->count] = prtree_ref(t, item.pos);
+			res->dists[res->count] = item.dist;
+			res->count++;
+			continue;
+		}
+
+		prtree_children(t, item.pos, item.level, &start, &end);
+		prtree_distances(t, start, end, q, dist);
+		for (i = start; i < end; i++)
+		{
+			PackedRTreeHeapItem child;
+			child.dist = dist[i - start];
+			child.pos = i;
+			child.level = item.level - 1;
+			prtree_heap_push(&heap, &n, &capacity, child);
+		}
+	}
+	pfree(heap);
+}
+
+/**
+* ST_PackedRTreeNearest(tree bytea, geom geometry, k integer,
+*     OUT id bigint, OUT distance float8) returns setof record
+* The k items whose boxes are nearest to the box of geom (the <-> test),
+* nearest first.
+*/
+PG_FUNCTION_INFO_V1(ST_PackedRTreeNearest);
+Datum
+ST_PackedRTreeNearest(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	PackedRTreeResult *res;
+	bool isnull[2] = {0, 0};
+	Datum values[2];
+	HeapTuple tuple;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		PackedRTree *t;
+		BOX2DF query;
+		bool empty;
+		int32 k = PG_GETARG_INT32(2);
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		res = (PackedRTreeResult *)palloc0(sizeof(PackedRTreeResult));
+		t = prtree_get(fcinfo, &query, &empty);
+		if (!empty && k > 0)
+			prtree_nearest(t, &query, (uint32)k, res);
+		funcctx->user_fctx = res;
+
+		if (get_call_result_type(fcinfo, 0, &funcctx->tuple_desc) != TYPEFUNC_COMPOSITE)
+		{
+			ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				errmsg("set-valued function called in context that cannot accept a set")));
+		}
+		BlessTupleDesc(funcctx->tuple_desc);
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	res = (PackedRTreeResult *)funcctx->user_fctx;
+
+	if (res->next >= res->count)
+		SRF_RETURN_DONE(funcctx);
+
+	values[0] = Int64GetDatum(res->ids[res->next]);
+	values[1] = Float8GetDatum(res->dists[res->next]);
+	res->next++;
+
+	tuple = heap_form_tuple(funcctx->tuple_desc, values, isnull);
+	SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+}
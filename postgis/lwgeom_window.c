@@ -25,9 +25,12 @@
 
 #include "../postgis_config.h"
 
+#include <unistd.h>
+
 /* PostgreSQL */
 #include "postgres.h"
 #include "funcapi.h"
+#include "miscadmin.h"
 #include "windowapi.h"
 
 /* PostGIS */
@@ -79,6 +82,19 @@ read_lwgeom_from_partition(WindowObject win_obj, uint32_t i, bool* is_null)
 	return lwgeom_from_gserialized(g);
 }
 
+/*
+ * Worker threads beyond the online CPUs only add contention, and the
+ * requested count comes straight from SQL, so cap it there.
+ */
+static int
+cluster_num_threads(int num_threads)
+{
+	long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_cpus < 1)
+		num_cpus = 1;
+	return num_threads > num_cpus ? (int)num_cpus : num_threads;
+}
+
 PG_FUNCTION_INFO_V1(ST_ClusterDBSCAN);
 Datum ST_ClusterDBSCAN(PG_FUNCTION_ARGS)
 {
@@ -100,6 +116,8 @@ Datum ST_ClusterDBSCAN(PG_FUNCTION_ARGS)
 		Datum minpoints_datum = WinGetFuncArgCurrent(win_obj, 2, &minpoints_is_null);
 		double tolerance = DatumGetFloat8(tolerance_datum);
 		int minpoints = DatumGetInt32(minpoints_datum);
+		int num_threads = 1;
+		double approximation = 0.0;
 
 		context->is_error = LW_TRUE; /* until proven otherwise */
 
@@ -114,6 +132,33 @@ Datum ST_ClusterDBSCAN(PG_FUNCTION_ARGS)
 			lwpgerror("Minpoints must be a positive number", minpoints);
 		}
 
+		/* Optional worker threads and approximation for point inputs */
+		if (PG_NARGS() > 3)
+		{
+			bool num_threads_is_null;
+			Datum num_threads_datum = WinGetFuncArgCurrent(win_obj, 3, &num_threads_is_null);
+			if (!num_threads_is_null)
+				num_threads = DatumGetInt32(num_threads_datum);
+			if (num_threads < 1)
+			{
+				lwpgerror("Number of threads must be a positive number");
+				PG_RETURN_NULL();
+			}
+			num_threads = cluster_num_threads(num_threads);
+		}
+		if (PG_NARGS() > 4)
+		{
+			bool approximation_is_null;
+			Datum approximation_datum = WinGetFuncArgCurrent(win_obj, 4, &approximation_is_null);
+			if (!approximation_is_null)
+				approximation = DatumGetFloat8(approximation_datum);
+			if (approximation < 0)
+			{
+				lwpgerror("Approximation must be a positive number");
+				PG_RETURN_NULL();
+			}
+		}
+
 		initGEOS(lwnotice, lwgeom_geos_error);
 		geoms = (LWGEOM**)lwalloc(ngeoms * sizeof(LWGEOM*));
 		uf = UF_create(ngeoms);
@@ -128,7 +173,8 @@ Datum ST_ClusterDBSCAN(PG_FUNCTION_ARGS)
 			}
 		}
 
-		if (union_dbscan(geoms, ngeoms, uf, tolerance, minpoints, minpoints > 1 ? &is_in_cluster : NULL) == LW_SUCCESS)
+		if (union_dbscan_ext(geoms, ngeoms, uf, tolerance, minpoints, minpoints > 1 ? &is_in_cluster : NULL,
+				     num_threads, approximation) == LW_SUCCESS)
 			context->is_error = LW_FALSE;
 
 		for (i = 0; i < ngeoms; i++)
@@ -142,6 +188,8 @@ Datum ST_ClusterDBSCAN(PG_FUNCTION_ARGS)
 			UF_destroy(uf);
 			if (is_in_cluster)
 				lwfree(is_in_cluster);
+			/* An interrupted clustering also lands here; report the cancel, not an error */
+			CHECK_FOR_INTERRUPTS();
 			lwpgerror("Error during clustering");
 			PG_RETURN_NULL();
 		}
@@ -186,6 +234,7 @@ Datum ST_ClusterKMeans(PG_FUNCTION_ARGS)
 		int       i, k, N;
 		bool      isnull, isout;
 		double max_radius = 0.0;
+		int batch_size = 0, num_threads = 1;
 		LWGEOM    **geoms;
 		int       *r;
 		Datum argdatum;
@@ -218,6 +267,29 @@ Datum ST_ClusterKMeans(PG_FUNCTION_ARGS)
 				max_radius = 0.0;
 		}
 
+		/* Optional mini-batch size and worker threads, 0 and 1 if not set */
+		if (PG_NARGS() > 3)
+		{
+			argdatum = WinGetFuncArgCurrent(winobj, 3, &isnull);
+			if (!isnull)
+			{
+				batch_size = DatumGetInt32(argdatum);
+				if (batch_size < 0)
+					lwpgerror("Batch size must be zero or a positive number");
+			}
+		}
+		if (PG_NARGS() > 4)
+		{
+			argdatum = WinGetFuncArgCurrent(winobj, 4, &isnull);
+			if (!isnull)
+			{
+				num_threads = DatumGetInt32(argdatum);
+				if (num_threads < 1)
+					lwpgerror("Number of threads must be a positive number");
+				num_threads = cluster_num_threads(num_threads);
+			}
+		}
+
 		/* Error out if N < K */
 		if (N<k)
 			lwpgerror("K (%d) must be smaller than the number of rows in the group (%d)", k, N);
@@ -242,7 +314,7 @@ Datum ST_ClusterKMeans(PG_FUNCTION_ARGS)
 		}
 
 		/* Calculate k-means on the list! */
-		r = lwgeom_cluster_kmeans((const LWGEOM **)geoms, N, k, max_radius);
+		r = lwgeom_cluster_kmeans_ext((const LWGEOM **)geoms, N, k, max_radius, batch_size, num_threads);
 
 		/* Clean up */
 		for (i = 0; i < N; i++)
@@ -251,6 +323,9 @@ Datum ST_ClusterKMeans(PG_FUNCTION_ARGS)
 
 		pfree(geoms);
 
+		/* An interrupted clustering returns no result; report the cancel, not a NULL */
+		CHECK_FOR_INTERRUPTS();
+
 		if (!r)
 		{
 			context->isdone = true;
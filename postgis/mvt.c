@@ -32,6 +32,8 @@
 #include "pgsql_compat.h"
 
 #ifdef HAVE_LIBPROTOBUF
+#include "access/xact.h"
+#include "storage/buffile.h"
 #include "utils/jsonb.h"
 
 #include "lwgeom_wagyu.h"
@@ -51,6 +53,9 @@
 
 #define FEATURES_CAPACITY_INITIAL 50
 
+/* Per-feature buffers are carved out of blocks of this size, see mvt_arena_alloc */
+#define MVT_ARENA_BLOCK_SIZE 65536
+
 enum mvt_cmd_id
 {
 	CMD_MOVE_TO = 1,
@@ -85,58 +90,102 @@ static inline uint32_t c_int(enum mvt_cmd_id id, uint32_t count)
 
 static inline uint32_t p_int(int32_t value)
 {
-	return (value << 1) ^ (value >> 31);
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+/**
+ * Bump allocator for the feature, geometry and tag buffers, which live as
+ * long as the aggregate transition context and are never freed one by one.
+ */
+static void *mvt_arena_alloc(mvt_agg_context *ctx, size_t size)
+{
+	void *ptr;
+
+	size = MAXALIGN(size);
+	if (size > ctx->arena_size - ctx->arena_used)
+	{
+		/* Large requests get a chunk of their own, keeping the current block */
+		if (size > MVT_ARENA_BLOCK_SIZE / 4)
+			return palloc(size);
+		ctx->arena_block = (char*)palloc(MVT_ARENA_BLOCK_SIZE);
+		ctx->arena_size = MVT_ARENA_BLOCK_SIZE;
+		ctx->arena_used = 0;
+	}
+	ptr = ctx->arena_block + ctx->arena_used;
+	ctx->arena_used += size;
+	return ptr;
+}
+
+/**
+ * Zig-zag encodes points [start, end) of pa as deltas from the previous
+ * point, the first one from the cursor at (*px, *py). Deltas after the first
+ * are taken between input points, so the loop carries no dependency between
+ * iterations and the compiler can vectorize it.
+ */
+static uint32_t *encode_deltas(const POINTARRAY *pa, uint32_t start, uint32_t end,
+			       uint32_t *buffer, int32_t *px, int32_t *py)
+{
+	const double *coords = (const double*)pa->serialized_pointlist;
+	const ptrdiff_t stride = FLAGS_NDIMS(pa->flags);
+	uint32_t i, n = end - start;
+	int32_t x, y;
+
+	if (start >= end)
+		return buffer;
+
+	x = coords[start * stride];
+	y = coords[start * stride + 1];
+	buffer[0] = p_int(x - *px);
+	buffer[1] = p_int(y - *py);
+
+	for (i = 1; i < n; i++)
+	{
+		const double *p = coords + (start + i) * stride;
+		buffer[2 * i] = p_int((int32_t)p[0] - (int32_t)p[-stride]);
+		buffer[2 * i + 1] = p_int((int32_t)p[1] - (int32_t)p[1 - stride]);
+	}
+
+	*px = coords[(end - 1) * stride];
+	*py = coords[(end - 1) * stride + 1];
+	return buffer + 2 * n;
 }
 
 static uint32_t encode_ptarray(__attribute__((__unused__)) mvt_agg_context *ctx,
 			       enum mvt_type type, POINTARRAY *pa, uint32_t *buffer,
 			       int32_t *px, int32_t *py)
 {
-	uint32_t offset = 0;
-	uint32_t i, c = 0;
-	int32_t dx, dy, x, y;
-	const POINT2D *p;
+	uint32_t *cursor = buffer;
+	uint32_t c = pa->npoints;
 
-	/* loop points and add to buffer */
-	for (i = 0; i < pa->npoints; i++)
-	{
-		/* move offset for command */
-		if (i == 0 || (i == 1 && type > MVT_POINT))
-			offset++;
-		/* skip closing point for rings */
-		if (type == MVT_RING && i == pa->npoints - 1)
-			break;
-		p = getPoint2d_cp(pa, i);
-		x = p->x;
-		y = p->y;
-		dx = x - *px;
-		dy = y - *py;
-		buffer[offset++] = p_int(dx);
-		buffer[offset++] = p_int(dy);
-		*px = x;
-		*py = y;
-		c++;
-	}
+	/* skip closing point for rings */
+	if (type == MVT_RING && c > 0)
+		c--;
+	if (c == 0)
+		return 0;
 
-	/* determine initial move and eventual line command */
 	if (type == MVT_POINT)
 	{
 		/* point or multipoint, use actual number of point count */
-		buffer[0] = c_int(CMD_MOVE_TO, c);
+		*cursor++ = c_int(CMD_MOVE_TO, c);
+		cursor = encode_deltas(pa, 0, c, cursor, px, py);
 	}
 	else
 	{
-		/* line or polygon, assume count 1 */
-		buffer[0] = c_int(CMD_MOVE_TO, 1);
-		/* line command with move point subtracted from count */
-		buffer[3] = c_int(CMD_LINE_TO, c - 1);
+		/* line or polygon, move to the first point */
+		*cursor++ = c_int(CMD_MOVE_TO, 1);
+		cursor = encode_deltas(pa, 0, 1, cursor, px, py);
+		/* line command with move point subtracted from count, always there for rings */
+		if (c > 1 || type == MVT_RING)
+		{
+			*cursor++ = c_int(CMD_LINE_TO, c - 1);
+			cursor = encode_deltas(pa, 1, c, cursor, px, py);
+		}
+		/* add close command if ring */
+		if (type == MVT_RING)
+			*cursor++ = c_int(CMD_CLOSE_PATH, 1);
 	}
 
-	/* add close command if ring */
-	if (type == MVT_RING)
-		buffer[offset++] = c_int(CMD_CLOSE_PATH, 1);
-
-	return offset;
+	return cursor - buffer;
 }
 
 static uint32_t encode_ptarray_initial(mvt_agg_context *ctx,
@@ -151,22 +200,32 @@ static void encode_point(mvt_agg_context *ctx, LWPOINT *point)
 {
 	VectorTile__Tile__Feature *feature = ctx->feature;
 	feature->type = VECTOR_TILE__TILE__GEOM_TYPE__POINT;
-	feature->n_geometry = 3;
-	feature->geometry = (uint32_t*)palloc(sizeof(*feature->geometry) * 3);
-	encode_ptarray_initial(ctx, MVT_POINT, point->point, feature->geometry);
+	feature->geometry = (uint32_t*)mvt_arena_alloc(ctx, sizeof(*feature->geometry) * 3);
+	/* nothing is encoded for an empty point */
+	feature->n_geometry = encode_ptarray_initial(ctx, MVT_POINT, point->point, feature->geometry);
 }
 
 static void encode_mpoint(mvt_agg_context *ctx, LWMPOINT *mpoint)
 {
-	size_t c;
+	uint32_t i, c = 0;
+	int32_t px = 0, py = 0;
+	uint32_t *cursor;
 	VectorTile__Tile__Feature *feature = ctx->feature;
-	// NOTE: inefficient shortcut LWMPOINT->LWLINE
-	LWLINE *lwline = lwline_from_lwmpoint(mpoint->srid, mpoint);
 	feature->type = VECTOR_TILE__TILE__GEOM_TYPE__POINT;
-	c = 1 + lwline->points->npoints * 2;
-	feature->geometry = (uint32_t*)palloc(sizeof(*feature->geometry) * c);
-	feature->n_geometry = encode_ptarray_initial(ctx, MVT_POINT,
-		lwline->points, feature->geometry);
+	for (i = 0; i < mpoint->ngeoms; i++)
+		c += mpoint->geoms[i]->point->npoints;
+	feature->geometry = (uint32_t*)mvt_arena_alloc(ctx, sizeof(*feature->geometry) * (1 + c * 2));
+	feature->n_geometry = c ? 1 + c * 2 : 0;
+	if (!c)
+		return;
+	/* a single move to command covering all the points */
+	cursor = feature->geometry;
+	*cursor++ = c_int(CMD_MOVE_TO, c);
+	for (i = 0; i < mpoint->ngeoms; i++)
+	{
+		POINTARRAY *pa = mpoint->geoms[i]->point;
+		cursor = encode_deltas(pa, 0, pa->npoints, cursor, &px, &py);
+	}
 }
 
 static void encode_line(mvt_agg_context *ctx, LWLINE *lwline)
@@ -175,7 +234,7 @@ static void encode_line(mvt_agg_context *ctx, LWLINE *lwline)
 	VectorTile__Tile__Feature *feature = ctx->feature;
 	feature->type = VECTOR_TILE__TILE__GEOM_TYPE__LINESTRING;
 	c = 2 + lwline->points->npoints * 2;
-	feature->geometry = (uint32_t*)palloc(sizeof(*feature->geometry) * c);
+	feature->geometry = (uint32_t*)mvt_arena_alloc(ctx, sizeof(*feature->geometry) * c);
 	feature->n_geometry = encode_ptarray_initial(ctx, MVT_LINE,
 		lwline->points, feature->geometry);
 }
@@ -189,7 +248,7 @@ static void encode_mline(mvt_agg_context *ctx, LWMLINE *lwmline)
 	feature->type = VECTOR_TILE__TILE__GEOM_TYPE__LINESTRING;
 	for (i = 0; i < lwmline->ngeoms; i++)
 		c += 2 + lwmline->geoms[i]->points->npoints * 2;
-	feature->geometry = (uint32_t*)palloc(sizeof(*feature->geometry) * c);
+	feature->geometry = (uint32_t*)mvt_arena_alloc(ctx, sizeof(*feature->geometry) * c);
 	for (i = 0; i < lwmline->ngeoms; i++)
 		offset += encode_ptarray(ctx, MVT_LINE,
 			lwmline->geoms[i]->points,
@@ -206,7 +265,7 @@ static void encode_poly(mvt_agg_context *ctx, LWPOLY *lwpoly)
 	feature->type = VECTOR_TILE__TILE__GEOM_TYPE__POLYGON;
 	for (i = 0; i < lwpoly->nrings; i++)
 		c += 3 + ((lwpoly->rings[i]->npoints - 1) * 2);
-	feature->geometry = (uint32_t*)palloc(sizeof(*feature->geometry) * c);
+	feature->geometry = (uint32_t*)mvt_arena_alloc(ctx, sizeof(*feature->geometry) * c);
 	for (i = 0; i < lwpoly->nrings; i++)
 		offset += encode_ptarray(ctx, MVT_RING,
 			lwpoly->rings[i],
@@ -225,7 +284,7 @@ static void encode_mpoly(mvt_agg_context *ctx, LWMPOLY *lwmpoly)
 	for (i = 0; i < lwmpoly->ngeoms; i++)
 		for (j = 0; poly = lwmpoly->geoms[i], j < poly->nrings; j++)
 			c += 3 + ((poly->rings[j]->npoints - 1) * 2);
-	feature->geometry = (uint32_t*)palloc(sizeof(*feature->geometry) * c);
+	feature->geometry = (uint32_t*)mvt_arena_alloc(ctx, sizeof(*feature->geometry) * c);
 	for (i = 0; i < lwmpoly->ngeoms; i++)
 		for (j = 0; poly = lwmpoly->geoms[i], j < poly->nrings; j++)
 			offset += encode_ptarray(ctx, MVT_RING,
@@ -398,13 +457,29 @@ static void encode_values(mvt_agg_context *ctx)
 
 }
 
+/**
+ * Scalar values are fixed size, so their dictionaries are keyed by a 64 bit
+ * mix of the value bits instead of uthash's byte at a time string hash.
+ * Equal values still compare by their bytes inside uthash.
+ */
+static inline unsigned mvt_hash_scalar(const void *value, size_t size)
+{
+	uint64_t bits = 0;
+	memcpy(&bits, value, size);
+	bits ^= bits >> 33;
+	bits *= UINT64_C(0xff51afd7ed558ccd);
+	bits ^= bits >> 33;
+	bits *= UINT64_C(0xc4ceb9fe1a85ec53);
+	bits ^= bits >> 33;
+	return (unsigned)bits;
+}
+
 #define MVT_PARSE_VALUE(hash, newvalue, size, pfvaluefield, pftype) \
 	{ \
 		POSTGIS_DEBUG(2, "MVT_PARSE_VALUE called"); \
 		{ \
 			struct mvt_kv_value *kv; \
-			unsigned hashv; \
-			HASH_VALUE(&newvalue, size, hashv); \
+			unsigned hashv = mvt_hash_scalar(&newvalue, size); \
 			HASH_FIND_BYHASHVALUE(hh, ctx->hash, &newvalue, size, hashv, kv); \
 			if (!kv) \
 			{ \
@@ -506,8 +581,29 @@ parse_datum_as_string(mvt_agg_context *ctx, Oid typoid, Datum datum, uint32_t *t
 	add_value_as_string(ctx, value, tags, k);
 }
 
+/*
+ * Makes room for one more key and value pair in tags, which has room for
+ * *tags_capacity pairs. The array is grown geometrically, the old one being
+ * left in the arena, so that rows with many jsonb keys stay linear.
+ */
+static uint32_t *reserve_tag(mvt_agg_context *ctx, uint32_t *tags, uint32_t *tags_capacity)
+{
+	uint32_t new_capacity;
+	uint32_t *new_tags;
+
+	if (ctx->row_columns < *tags_capacity)
+		return tags;
+
+	new_capacity = Max(*tags_capacity * 2, 8);
+	new_tags = (uint32_t*)mvt_arena_alloc(ctx, new_capacity * 2 * sizeof(*tags));
+	memcpy(new_tags, tags, ctx->row_columns * 2 * sizeof(*tags));
+	*tags_capacity = new_capacity;
+	return new_tags;
+}
+
+/* Adds the keys and values of a jsonb object to the tags, see reserve_tag */
 static uint32_t *parse_jsonb(mvt_agg_context *ctx, Jsonb *jb,
-	uint32_t *tags)
+	uint32_t *tags, uint32_t *tags_capacity)
 {
 	JsonbIterator *it;
 	JsonbValue v;
@@ -531,16 +627,15 @@ static uint32_t *parse_jsonb(mvt_agg_context *ctx, Jsonb *jb,
 			if (k == UINT32_MAX)
 			{
 				char *key;
-				uint32_t newSize = ctx->keys_hash_i + 1;
 
 				key = (char*)palloc(v.string.len + 1);
 				memcpy(key, v.string.val, v.string.len);
 				key[v.string.len] = '\0';
-
-				tags = (uint32_t*)repalloc(tags, newSize * 2 * sizeof(*tags));
 				k = add_key(ctx, key);
 			}
 
+			tags = reserve_tag(ctx, tags, tags_capacity);
+
 			r = JsonbIteratorNext(&it, &v, skipNested);
 
 			if (v.type == jbvString)
@@ -629,19 +724,12 @@ static void set_feature_id(mvt_agg_context *ctx, Datum datum, bool isNull)
 	ctx->feature->id = (uint64_t) value;
 }
 
-static void parse_values(mvt_agg_context *ctx)
+/* Splits the current row into the column cache values and nulls */
+static void deform_row(mvt_agg_context *ctx)
 {
-	uint32_t n_keys = ctx->keys_hash_i;
-	uint32_t *tags = (uint32_t*)palloc(n_keys * 2 * sizeof(*tags));
-	uint32_t i;
 	mvt_column_cache cc = ctx->column_cache;
-	uint32_t natts = (uint32_t) cc.tupdesc->natts;
-
 	HeapTupleData tuple;
 
-	POSTGIS_DEBUG(2, "parse_values called");
-	ctx->row_columns = 0;
-
 	/* Build a temporary HeapTuple control structure */
 	tuple.t_len = HeapTupleHeaderGetDatumLength(ctx->row);
 	ItemPointerSetInvalid(&(tuple.t_self));
@@ -650,6 +738,20 @@ static void parse_values(mvt_agg_context *ctx)
 
 	/* We use heap_deform_tuple as it costs only O(N) vs O(N^2) of GetAttributeByNum */
 	heap_deform_tuple(&tuple, cc.tupdesc, cc.values, cc.nulls);
+}
+
+/* Expects the row already split by deform_row */
+static void parse_values(mvt_agg_context *ctx)
+{
+	uint32_t n_keys = ctx->keys_hash_i;
+	uint32_t tags_capacity = n_keys;
+	uint32_t *tags = (uint32_t*)mvt_arena_alloc(ctx, n_keys * 2 * sizeof(*tags));
+	uint32_t i;
+	mvt_column_cache cc = ctx->column_cache;
+	uint32_t natts = (uint32_t) cc.tupdesc->natts;
+
+	POSTGIS_DEBUG(2, "parse_values called");
+	ctx->row_columns = 0;
 
 	POSTGIS_DEBUGF(3, "parse_values natts: %d", natts);
 
@@ -683,10 +785,12 @@ static void parse_values(mvt_agg_context *ctx)
 			elog(ERROR, "parse_values: unexpectedly could not find parsed key name '%s'", key);
 		if (typoid == JSONBOID)
 		{
-			tags = parse_jsonb(ctx, DatumGetJsonbP(datum), tags);
+			tags = parse_jsonb(ctx, DatumGetJsonbP(datum), tags, &tags_capacity);
 			continue;
 		}
 
+		tags = reserve_tag(ctx, tags, &tags_capacity);
+
 		switch (typoid)
 		{
 		case BOOLOID:
@@ -983,6 +1087,9 @@ void mvt_agg_init_context(mvt_agg_context *ctx)
 	ctx->keys_hash_i = 0;
 	ctx->id_index = UINT32_MAX;
 	ctx->geom_index = UINT32_MAX;
+	ctx->arena_block = NULL;
+	ctx->arena_size = 0;
+	ctx->arena_used = 0;
 
 	memset(&ctx->column_cache, 0, sizeof(ctx->column_cache));
 
@@ -997,22 +1104,15 @@ void mvt_agg_init_context(mvt_agg_context *ctx)
 }
 
 /**
- * Aggregation step.
+ * Appends a feature with a geometry already in tile coordinates, and the
+ * properties of ctx->row, which must have been split by deform_row.
  *
  * Expands features array if needed by a factor of 2.
- * Allocates a new feature, increment feature counter and
- * encode geometry and properties into it.
- */
-void mvt_agg_transfn(mvt_agg_context *ctx)
+ */
+static void mvt_agg_add_feature(mvt_agg_context *ctx, LWGEOM *lwgeom)
 {
-	bool isnull = false;
-	Datum datum;
-	GSERIALIZED *gs;
-	LWGEOM *lwgeom;
 	VectorTile__Tile__Feature *feature;
 	VectorTile__Tile__Layer *layer = ctx->layer;
-/*	VectorTile__Tile__Feature **features = layer->features; */
-	POSTGIS_DEBUG(2, "mvt_agg_transfn called");
 
 	if (layer->n_features >= ctx->features_capacity)
 	{
@@ -1023,10 +1123,38 @@ void mvt_agg_transfn(mvt_agg_context *ctx)
 		POSTGIS_DEBUGF(3, "mvt_agg_transfn new_capacity: %zd", new_capacity);
 	}
 
+	feature = (VectorTile__Tile__Feature*)mvt_arena_alloc(ctx, sizeof(*feature));
+	vector_tile__tile__feature__init(feature);
+
+	ctx->feature = feature;
+
+	POSTGIS_DEBUGF(3, "mvt_agg_transfn encoded feature count: %zd", layer->n_features);
+	layer->features[layer->n_features++] = feature;
+
+	encode_geometry(ctx, lwgeom);
+	parse_values(ctx);
+}
+
+/**
+ * Aggregation step.
+ *
+ * Allocates a new feature, increment feature counter and
+ * encode geometry and properties into it.
+ */
+void mvt_agg_transfn(mvt_agg_context *ctx)
+{
+	bool isnull = false;
+	Datum datum;
+	GSERIALIZED *gs;
+	LWGEOM *lwgeom;
+	POSTGIS_DEBUG(2, "mvt_agg_transfn called");
+
 	if (ctx->geom_index == UINT32_MAX)
 		parse_column_keys(ctx);
 
-	datum = GetAttributeByNum(ctx->row, ctx->geom_index + 1, &isnull);
+	deform_row(ctx);
+	datum = ctx->column_cache.values[ctx->geom_index];
+	isnull = ctx->column_cache.nulls[ctx->geom_index];
 	POSTGIS_DEBUGF(3, "mvt_agg_transfn ctx->geom_index: %d", ctx->geom_index);
 	POSTGIS_DEBUGF(3, "mvt_agg_transfn isnull: %u", isnull);
 	POSTGIS_DEBUGF(3, "mvt_agg_transfn datum: %lu", datum);
@@ -1036,21 +1164,12 @@ void mvt_agg_transfn(mvt_agg_context *ctx)
 		return;
 	}
 
-	feature = (VectorTile__Tile__Feature*)palloc(sizeof(*feature));
-	vector_tile__tile__feature__init(feature);
-
-	ctx->feature = feature;
-
 	gs = (GSERIALIZED *) PG_DETOAST_DATUM(datum);
 	lwgeom = lwgeom_from_gserialized(gs);
 
-	POSTGIS_DEBUGF(3, "mvt_agg_transfn encoded feature count: %zd", layer->n_features);
-	layer->features[layer->n_features++] = feature;
-
-	encode_geometry(ctx, lwgeom);
+	mvt_agg_add_feature(ctx, lwgeom);
 	lwgeom_free(lwgeom);
 	// TODO: free detoasted datum?
-	parse_values(ctx);
 }
 
 static VectorTile__Tile * mvt_ctx_to_tile(mvt_agg_context *ctx)
@@ -1275,5 +1394,452 @@ bytea *mvt_agg_finalfn(mvt_agg_context *ctx)
 	return mvt_ctx_to_bytea(ctx);
 }
 
+/* Tiles are keyed by zoom, then x, then y, so sorting by key gives zoom order */
+#define MVT_PYRAMID_KEY(z, x, y) (((uint64_t)(z) << 58) | ((uint64_t)(x) << 29) | (uint64_t)(y))
+
+/* A part of a tile written to the spill file, as an encoded tile */
+struct mvt_pyramid_chunk
+{
+	off_t offset;
+	size_t size;
+};
+
+struct mvt_pyramid_tile
+{
+	uint64_t key;
+	uint32_t z, x, y;
+	/* Features added since the last spill, NULL if none */
+	mvt_agg_context *ctx;
+	/* Earlier features, spilled in order */
+	struct mvt_pyramid_chunk *chunks;
+	uint32_t n_chunks, chunks_capacity;
+	UT_hash_handle hh;
+};
+
+struct mvt_pyramid
+{
+	/* Context holding the tile index, which outlives the resident tiles */
+	MemoryContext context;
+	/* Context holding the resident tiles, reset when they are spilled */
+	MemoryContext tiles_context;
+	/* Context for combining the parts of one tile on output */
+	MemoryContext output_context;
+	GBOX bounds;
+	uint32_t zmin, zmax;
+	uint32_t extent, buffer;
+	bool clip_geom;
+	char *name;
+	char *geom_name;
+	char *id_name;
+
+	HeapTupleHeader row;
+	struct mvt_pyramid_tile *tiles;
+	struct mvt_pyramid_tile *next_tile;
+	bool sorted;
+
+	/* Estimated size of the resident tiles, spilled past work_mem */
+	Size resident;
+	BufFile *spill;
+	off_t spill_end;
+#if POSTGIS_PGSQL_VERSION < 96
+	MemoryContext callback; /* child of context whose deletion closes the spill file */
+#else
+	MemoryContextCallback *callback; /* reset callback of context closing the spill file */
+#endif
+};
+
+/*
+ * The spill file goes with the pyramid context, which is deleted with the
+ * set returning function state even when not all tiles were read. On abort
+ * the resource owner has already closed it.
+ */
+static void mvt_pyramid_spill_close(mvt_pyramid *pyramid)
+{
+	if (pyramid->spill && IsTransactionState())
+		BufFileClose(pyramid->spill);
+	pyramid->spill = NULL;
+}
+
+#if POSTGIS_PGSQL_VERSION < 96
+typedef struct
+{
+	MemoryContextData header; /* must be first */
+	mvt_pyramid *pyramid;
+} MvtPyramidCallbackContextData;
+
+static void MvtPyramidCallbackInit(MemoryContext context)
+{
+	/* Nothing is allocated in this context */
+}
+
+static void MvtPyramidCallbackReset(MemoryContext context)
+{
+	MvtPyramidCallbackContextData *data = (MvtPyramidCallbackContextData *)context;
+	if (data->pyramid)
+	{
+		mvt_pyramid_spill_close(data->pyramid);
+		data->pyramid = NULL;
+	}
+}
+
+static void MvtPyramidCallbackDelete(MemoryContext context)
+{
+	MvtPyramidCallbackReset(context);
+}
+
+static bool MvtPyramidCallbackIsEmpty(MemoryContext context)
+{
+	return false;
+}
+
+static void MvtPyramidCallbackStats(MemoryContext context, int level)
+{
+}
+
+#ifdef MEMORY_CONTEXT_CHECKING
+static void MvtPyramidCallbackCheck(MemoryContext context)
+{
+}
+#endif
+
+/* Memory context definition must match the current version of PostgreSQL */
+static MemoryContextMethods MvtPyramidCallbackMethods =
+{
+	NULL,
+	NULL,
+	NULL,
+	MvtPyramidCallbackInit,
+	MvtPyramidCallbackReset,
+	MvtPyramidCallbackDelete,
+	NULL,
+	MvtPyramidCallbackIsEmpty,
+	MvtPyramidCallbackStats
+#ifdef MEMORY_CONTEXT_CHECKING
+	, MvtPyramidCallbackCheck
+#endif
+};
+#else
+static void mvt_pyramid_callback(void *arg)
+{
+	if (arg)
+		mvt_pyramid_spill_close((mvt_pyramid *)arg);
+}
+#endif
+
+static int mvt_pyramid_tile_cmp(struct mvt_pyramid_tile *a, struct mvt_pyramid_tile *b)
+{
+	return a->key < b->key ? -1 : a->key > b->key;
+}
+
+mvt_pyramid *mvt_pyramid_init(const GBOX *bounds, uint32_t zmin, uint32_t zmax, char *name, uint32_t extent,
+			      uint32_t buffer, bool clip_geom, char *geom_name, char *id_name)
+{
+	mvt_pyramid *pyramid;
+	MemoryContext context, old_context;
+
+	if (zmin > zmax || zmax > MVT_PYRAMID_MAX_ZOOM)
+		elog(ERROR, "%s: Invalid zoom range %u to %u", __func__, zmin, zmax);
+	if (extent == 0)
+		elog(ERROR, "%s: Extent must be greater than 0", __func__);
+
+	context = AllocSetContextCreate(CurrentMemoryContext, "ST_AsMVTPyramid", ALLOCSET_DEFAULT_SIZES);
+	old_context = MemoryContextSwitchTo(context);
+
+	pyramid = (mvt_pyramid*)palloc0(sizeof(*pyramid));
+	pyramid->context = context;
+	pyramid->tiles_context = AllocSetContextCreate(context, "ST_AsMVTPyramid tiles", ALLOCSET_DEFAULT_SIZES);
+	pyramid->output_context = AllocSetContextCreate(context, "ST_AsMVTPyramid output", ALLOCSET_DEFAULT_SIZES);
+	pyramid->bounds = *bounds;
+	pyramid->zmin = zmin;
+	pyramid->zmax = zmax;
+	pyramid->extent = extent;
+	pyramid->buffer = buffer;
+	pyramid->clip_geom = clip_geom;
+	pyramid->name = name;
+	pyramid->geom_name = geom_name;
+	pyramid->id_name = id_name;
+
+	/* Close the spill file when the pyramid context goes away */
+#if POSTGIS_PGSQL_VERSION < 96
+	pyramid->callback = MemoryContextCreate(T_AllocSetContext, sizeof(MvtPyramidCallbackContextData),
+						&MvtPyramidCallbackMethods, context,
+						"ST_AsMVTPyramid spill");
+	((MvtPyramidCallbackContextData *)pyramid->callback)->pyramid = pyramid;
+#else
+	pyramid->callback = (MemoryContextCallback *)palloc(sizeof(MemoryContextCallback));
+	pyramid->callback->func = mvt_pyramid_callback;
+	pyramid->callback->arg = pyramid;
+	MemoryContextRegisterResetCallback(context, pyramid->callback);
+#endif
+
+	MemoryContextSwitchTo(old_context);
+	return pyramid;
+}
+
+/* Tile envelope, and the envelope grown by the buffer, in the coordinates of the bounds */
+static void mvt_pyramid_tile_box(const mvt_pyramid *pyramid, uint32_t z, uint32_t x, uint32_t y,
+				 GBOX *tile_box, GBOX *clip_box)
+{
+	double tiles = (double)((uint64_t)1 << z);
+	double width = (pyramid->bounds.xmax - pyramid->bounds.xmin) / tiles;
+	double height = (pyramid->bounds.ymax - pyramid->bounds.ymin) / tiles;
+	double margin_x = width * pyramid->buffer / pyramid->extent;
+	double margin_y = height * pyramid->buffer / pyramid->extent;
+
+	memset(tile_box, 0, sizeof(*tile_box));
+	tile_box->xmin = pyramid->bounds.xmin + width * x;
+	tile_box->xmax = pyramid->bounds.xmin + width * (x + 1);
+	tile_box->ymin = pyramid->bounds.ymax - height * (y + 1);
+	tile_box->ymax = pyramid->bounds.ymax - height * y;
+
+	*clip_box = *tile_box;
+	clip_box->xmin -= margin_x;
+	clip_box->xmax += margin_x;
+	clip_box->ymin -= margin_y;
+	clip_box->ymax += margin_y;
+}
+
+static void mvt_pyramid_add_feature(mvt_pyramid *pyramid, uint32_t z, uint32_t x, uint32_t y, LWGEOM *lwgeom)
+{
+	struct mvt_pyramid_tile *tile;
+	uint64_t key = MVT_PYRAMID_KEY(z, x, y);
+	MemoryContext old_context = MemoryContextSwitchTo(pyramid->context);
+
+	HASH_FIND(hh, pyramid->tiles, &key, sizeof(key), tile);
+	if (!tile)
+	{
+		tile = (struct mvt_pyramid_tile*)palloc0(sizeof(*tile));
+		tile->key = key;
+		tile->z = z;
+		tile->x = x;
+		tile->y = y;
+		HASH_ADD(hh, pyramid->tiles, key, sizeof(key), tile);
+	}
+
+	MemoryContextSwitchTo(pyramid->tiles_context);
+	if (!tile->ctx)
+	{
+		tile->ctx = (mvt_agg_context*)palloc0(sizeof(*tile->ctx));
+		tile->ctx->name = pyramid->name;
+		tile->ctx->extent = pyramid->extent;
+		tile->ctx->geom_name = pyramid->geom_name;
+		tile->ctx->id_name = pyramid->id_name;
+		mvt_agg_init_context(tile->ctx);
+		pyramid->resident += sizeof(*tile->ctx) + sizeof(VectorTile__Tile__Layer);
+	}
+
+	tile->ctx->row = pyramid->row;
+	if (tile->ctx->geom_index == UINT32_MAX)
+		parse_column_keys(tile->ctx);
+	deform_row(tile->ctx);
+	mvt_agg_add_feature(tile->ctx, lwgeom);
+
+	/* Estimate: the encoded geometry, plus the row for the tags and values */
+	pyramid->resident += sizeof(VectorTile__Tile__Feature) + 2 * sizeof(uint32_t) * lwgeom_count_vertices(lwgeom) +
+			     HeapTupleHeaderGetDatumLength(pyramid->row);
+
+	MemoryContextSwitchTo(old_context);
+}
+
+/**
+ * Writes the resident part of every tile to the spill file as an encoded
+ * tile, and frees it. Tiles keep the list of their spilled parts.
+ */
+static void mvt_pyramid_spill(mvt_pyramid *pyramid)
+{
+	struct mvt_pyramid_tile *tile;
+	MemoryContext old_context = MemoryContextSwitchTo(pyramid->context);
+
+	if (!pyramid->spill)
+	{
+		pyramid->spill = BufFileCreateTemp(false);
+		pyramid->spill_end = 0;
+	}
+	if (BufFileSeek(pyramid->spill, 0, pyramid->spill_end, SEEK_SET) != 0)
+		elog(ERROR, "%s: Could not seek in temporary file", __func__);
+
+	for (tile = pyramid->tiles; tile; tile = (struct mvt_pyramid_tile*)tile->hh.next)
+	{
+		bytea *ba;
+		size_t size;
+
+		if (!tile->ctx)
+			continue;
+
+		MemoryContextSwitchTo(pyramid->tiles_context);
+		ba = mvt_ctx_serialize(tile->ctx);
+		size = VARSIZE(ba) - VARHDRSZ;
+		tile->ctx = NULL;
+		if (!size)
+			continue;
+
+		if (BufFileWrite(pyramid->spill, VARDATA(ba), size) != size)
+			elog(ERROR, "%s: Could not write tile to temporary file", __func__);
+
+		MemoryContextSwitchTo(pyramid->context);
+		if (tile->n_chunks == tile->chunks_capacity)
+		{
+			tile->chunks_capacity = tile->chunks_capacity ? 2 * tile->chunks_capacity : 4;
+			if (tile->chunks)
+				tile->chunks = (struct mvt_pyramid_chunk*)repalloc(
+				    tile->chunks, tile->chunks_capacity * sizeof(*tile->chunks));
+			else
+				tile->chunks = (struct mvt_pyramid_chunk*)palloc(tile->chunks_capacity * sizeof(*tile->chunks));
+		}
+		tile->chunks[tile->n_chunks].offset = pyramid->spill_end;
+		tile->chunks[tile->n_chunks].size = size;
+		tile->n_chunks++;
+		pyramid->spill_end += size;
+	}
+
+	MemoryContextSwitchTo(old_context);
+	MemoryContextReset(pyramid->tiles_context);
+	pyramid->resident = 0;
+}
+
+/**
+ * Clips a feature, in the coordinates of the bounds, into tile z/x/y, adds it
+ * to the tile if z is one of the requested zooms, and recurses into the four
+ * children with the clipped geometry down to the last zoom. Every level only
+ * works on the part of the feature that overlaps the parent tile, so a feature
+ * is clipped once per tile it touches. Buffered children boxes are contained
+ * in the parent one, so nothing the children need is clipped away.
+ */
+static void mvt_pyramid_clip(mvt_pyramid *pyramid, LWGEOM *lwgeom, const GBOX *geom_box,
+			     uint32_t z, uint32_t x, uint32_t y)
+{
+	GBOX tile_box, clip_box, clipped_box = *geom_box;
+	LWGEOM *clipped = lwgeom;
+
+	mvt_pyramid_tile_box(pyramid, z, x, y, &tile_box, &clip_box);
+	if (!gbox_overlaps_2d(geom_box, &clip_box))
+		return;
+
+	if (pyramid->clip_geom && !gbox_contains_2d(&clip_box, geom_box))
+	{
+		clipped = lwgeom_clip_by_rect(lwgeom, clip_box.xmin, clip_box.ymin, clip_box.xmax, clip_box.ymax);
+		if (!clipped || lwgeom_is_empty(clipped))
+			return;
+		lwgeom_calculate_gbox(clipped, &clipped_box);
+	}
+
+	if (z >= pyramid->zmin)
+	{
+		/* mvt_geom works in place */
+		LWGEOM *tile_geom = mvt_geom(lwgeom_clone_deep(clipped), &tile_box,
+					     pyramid->extent, pyramid->buffer, pyramid->clip_geom);
+		if (tile_geom)
+			mvt_pyramid_add_feature(pyramid, z, x, y, tile_geom);
+	}
+
+	if (z < pyramid->zmax)
+	{
+		for (uint32_t i = 0; i < 4; i++)
+			mvt_pyramid_clip(pyramid, clipped, &clipped_box, z + 1, 2 * x + (i & 1), 2 * y + (i >> 1));
+	}
+
+	if (clipped != lwgeom)
+		lwgeom_free(clipped);
+}
+
+/**
+ * Adds a feature to every tile of the pyramid it overlaps. The row must be a
+ * composite with the geometry column named as set up in mvt_pyramid_init.
+ * Scratch geometries are allocated in the current memory context. Once the
+ * resident tiles grow past work_mem they are spilled to a temporary file.
+ */
+void mvt_pyramid_add(mvt_pyramid *pyramid, HeapTupleHeader row, LWGEOM *lwgeom)
+{
+	GBOX geom_box;
+
+	if (lwgeom_is_empty(lwgeom))
+		return;
+
+	gbox_init(&geom_box);
+	if (lwgeom_calculate_gbox(lwgeom, &geom_box) != LW_SUCCESS)
+		return;
+
+	pyramid->row = row;
+	mvt_pyramid_clip(pyramid, lwgeom, &geom_box, 0, 0, 0);
+	pyramid->row = NULL;
+
+	if (pyramid->resident > (Size)u_sess->attr.attr_memory.work_mem * 1024L)
+		mvt_pyramid_spill(pyramid);
+}
+
+/* Reads back the spilled parts of a tile and merges them with the resident one */
+static mvt_agg_context *mvt_pyramid_tile_combine(mvt_pyramid *pyramid, struct mvt_pyramid_tile *tile)
+{
+	mvt_agg_context *ctx = NULL;
+
+	for (uint32_t i = 0; i < tile->n_chunks; i++)
+	{
+		bytea *ba = (bytea*)palloc(VARHDRSZ + tile->chunks[i].size);
+		SET_VARSIZE(ba, VARHDRSZ + tile->chunks[i].size);
+		if (!pyramid->spill || BufFileSeek(pyramid->spill, 0, tile->chunks[i].offset, SEEK_SET) != 0 ||
+		    BufFileRead(pyramid->spill, VARDATA(ba), tile->chunks[i].size) != tile->chunks[i].size)
+			elog(ERROR, "%s: Could not read tile from temporary file", __func__);
+		ctx = mvt_ctx_combine(ctx, mvt_ctx_deserialize(ba));
+	}
+
+	if (tile->ctx)
+	{
+		if (!tile->ctx->tile)
+			tile->ctx->tile = mvt_ctx_to_tile(tile->ctx);
+		ctx = mvt_ctx_combine(ctx, tile->ctx);
+	}
+	return ctx;
+}
+
+/**
+ * Encodes the next tile of the pyramid, in zoom, x, y order. Tiles that were
+ * spilled are merged back from their parts, like parallel ST_AsMVT results.
+ * Returns false once all tiles have been returned.
+ */
+bool mvt_pyramid_next(mvt_pyramid *pyramid, uint32_t *z, uint32_t *x, uint32_t *y, bytea **mvt)
+{
+	struct mvt_pyramid_tile *tile;
+	mvt_agg_context *ctx;
+	MemoryContext old_context;
+
+	if (!pyramid->sorted)
+	{
+		HASH_SORT(pyramid->tiles, mvt_pyramid_tile_cmp);
+		pyramid->next_tile = pyramid->tiles;
+		pyramid->sorted = true;
+	}
+
+	tile = pyramid->next_tile;
+	if (!tile)
+	{
+		/* Stay at the end for repeated calls */
+		mvt_pyramid_spill_close(pyramid);
+		return false;
+	}
+	pyramid->next_tile = (struct mvt_pyramid_tile*)tile->hh.next;
+
+	*z = tile->z;
+	*x = tile->x;
+	*y = tile->y;
+	if (!tile->n_chunks && tile->ctx)
+	{
+		*mvt = mvt_agg_finalfn(tile->ctx);
+		return true;
+	}
+
+	MemoryContextReset(pyramid->output_context);
+	old_context = MemoryContextSwitchTo(pyramid->output_context);
+	ctx = mvt_pyramid_tile_combine(pyramid, tile);
+	MemoryContextSwitchTo(old_context);
+	if (ctx)
+		*mvt = mvt_agg_finalfn(ctx);
+	else
+	{
+		/* Only empty parts were spilled */
+		*mvt = (bytea*)palloc(VARHDRSZ);
+		SET_VARSIZE(*mvt, VARHDRSZ);
+	}
+	return true;
+}
 
 #endif
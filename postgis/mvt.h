@@ -95,8 +95,19 @@ typedef struct mvt_agg_context
 
 	uint32_t row_columns;
 	mvt_column_cache column_cache;
+
+	/* Current block of the per-feature buffer allocator, see mvt_arena_alloc */
+	char *arena_block;
+	size_t arena_size;
+	size_t arena_used;
 } mvt_agg_context;
 
+/* Tiling of a whole zoom range in a single pass, see ST_AsMVTPyramid */
+typedef struct mvt_pyramid mvt_pyramid;
+
+/* Tile keys hold x and y in 29 bits each */
+#define MVT_PYRAMID_MAX_ZOOM 29
+
 /* Prototypes */
 LWGEOM *mvt_geom(LWGEOM *geom, const GBOX *bounds, uint32_t extent, uint32_t buffer, bool clip_geom);
 void mvt_agg_init_context(mvt_agg_context *ctx);
@@ -105,6 +116,10 @@ bytea *mvt_agg_finalfn(mvt_agg_context *ctx);
 bytea *mvt_ctx_serialize(mvt_agg_context *ctx);
 mvt_agg_context * mvt_ctx_deserialize(const bytea *ba);
 mvt_agg_context * mvt_ctx_combine(mvt_agg_context *ctx1, mvt_agg_context *ctx2);
+mvt_pyramid *mvt_pyramid_init(const GBOX *bounds, uint32_t zmin, uint32_t zmax, char *name, uint32_t extent,
+			      uint32_t buffer, bool clip_geom, char *geom_name, char *id_name);
+void mvt_pyramid_add(mvt_pyramid *pyramid, HeapTupleHeader row, LWGEOM *lwgeom);
+bool mvt_pyramid_next(mvt_pyramid *pyramid, uint32_t *z, uint32_t *x, uint32_t *y, bytea **mvt);
 
 
 #endif  /* HAVE_LIBPROTOBUF */
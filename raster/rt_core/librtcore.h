@@ -158,6 +158,8 @@ typedef struct rt_reclassexpr_t* rt_reclassexpr;
 
 typedef struct rt_iterator_t* rt_iterator;
 typedef struct rt_iterator_arg_t* rt_iterator_arg;
+typedef struct rt_mapexpr_t* rt_mapexpr;
+typedef struct rt_warp_cache_t* rt_warp_cache;
 
 typedef struct rt_colormap_entry_t* rt_colormap_entry;
 typedef struct rt_colormap_t* rt_colormap;
@@ -199,6 +201,12 @@ typedef enum {
     PT_END=13
 } rt_pixtype;
 
+/* Codecs for in-db band data */
+typedef enum {
+	RT_COMPRESSION_NONE = 0,	/* uncompressed */
+	RT_COMPRESSION_LZ4 = 1	/* LZ4 blocks, with delta predictor and byte shuffle */
+} rt_compression;
+
 typedef enum {
 	ET_INTERSECTION = 0,
 	ET_UNION,
@@ -225,6 +233,25 @@ typedef enum {
 	GSR_COVEREDBY
 } rt_geos_spatial_test;
 
+/* pixels under a polygon when rasterizing */
+typedef enum {
+	RT_RASTERIZE_CENTER = 0,	/* pixels whose center is inside the polygon */
+	RT_RASTERIZE_ALL_TOUCHED,	/* pixels touched by the polygon */
+	RT_RASTERIZE_COVERAGE	/* fraction of each pixel's area inside the polygon */
+} rt_rasterize_mode;
+
+/**
+ * Called by rt_raster_rasterize_lwgeom for each run of pixels under a
+ * polygon, with fraction the count fractions (0, 1] of the pixels
+ * (x, y) to (x + count - 1, y). Fractions are 1 unless rasterizing
+ * with RT_RASTERIZE_COVERAGE.
+ */
+typedef rt_errorstate (*rt_rasterize_callback)(
+	void *userarg,
+	int y, int x, int count,
+	const double *fraction
+);
+
 /**
 * Global functions for memory/logging handlers.
 */
@@ -596,6 +623,44 @@ int rt_band_get_ownsdata_flag(rt_band band);
 /* set ownsdata flag */
 void rt_band_set_ownsdata_flag(rt_band band, int flag);
 
+/**
+ * Return the codec used to store the band's data when serialized
+ *
+ * @param band : the band
+ *
+ * @return codec of the band
+ */
+rt_compression rt_band_get_compression(rt_band band);
+
+/**
+ * Set the codec used to store the band's data when serialized.
+ * Only in-db bands can be compressed.
+ *
+ * @param band : the band
+ * @param compression : codec to use
+ *
+ * @return ES_NONE on success, ES_ERROR on error
+ */
+rt_errorstate rt_band_set_compression(rt_band band, rt_compression compression);
+
+/**
+ * Return the codec of the given name
+ *
+ * @param name : codec name, NONE or LZ4
+ *
+ * @return codec or RT_COMPRESSION_NONE if name is not known
+ */
+rt_compression rt_util_compression_from_name(const char *name);
+
+/**
+ * Return the name of the codec
+ *
+ * @param compression : codec
+ *
+ * @return name of the codec
+ */
+const char *rt_util_compression_name(rt_compression compression);
+
 /**
 	* Get pointer to raster band data
 	*
@@ -879,6 +944,25 @@ rt_bandstats rt_band_get_summary_stats(
 	uint64_t *cK, double *cM, double *cQ
 );
 
+/**
+ * Compute summary statistics of the pixels of a band under a polygon,
+ * rasterized without GDAL
+ *
+ * @param raster : the raster whose band is summarized
+ * @param nband : the 0-based band to summarize
+ * @param geom : the polygon or multipolygon, in the coordinates of the raster
+ * @param mode : pixels under the polygon. with RT_RASTERIZE_COVERAGE, each
+ *   pixel is weighted by the fraction of its area inside the polygon
+ * @param exclude_nodata_value : if non-zero, ignore nodata values
+ *
+ * @return the summary statistics of the pixels or NULL
+ */
+rt_bandstats rt_raster_get_zonal_stats(
+	rt_raster raster, int nband,
+	const LWGEOM *geom, rt_rasterize_mode mode,
+	int exclude_nodata_value
+);
+
 /**
  * Count the distribution of data
  *
@@ -1825,6 +1909,44 @@ rt_raster rt_raster_gdal_warp(
 	double *skew_x, double *skew_y,
 	GDALResampleAlg resample_alg, double max_err);
 
+/**
+ * Return a warped raster using GDAL Warp API, reusing the converted
+ * spatial references and reprojection transformer kept in cache when
+ * the spatial references match those of the previous call. These do
+ * not depend on the raster's geotransform, so the tiles of a coverage
+ * share them
+ *
+ * @param cache : cache from rt_warp_cache_new() or NULL
+ *
+ * See rt_raster_gdal_warp() for the other parameters
+ *
+ * @return the warped raster or NULL
+ */
+rt_raster rt_raster_gdal_warp_cached(
+	rt_raster raster,
+	const char *src_srs, const char *dst_srs,
+	double *scale_x, double *scale_y,
+	int *width, int *height,
+	double *ul_xw, double *ul_yw,
+	double *grid_xw, double *grid_yw,
+	double *skew_x, double *skew_y,
+	GDALResampleAlg resample_alg, double max_err,
+	rt_warp_cache cache);
+
+/**
+ * Create an empty cache for rt_raster_gdal_warp_cached()
+ *
+ * @return new cache or NULL
+ */
+rt_warp_cache rt_warp_cache_new(void);
+
+/**
+ * Free a warp cache and the GDAL objects it holds
+ *
+ * @param cache : the cache to free
+ */
+void rt_warp_cache_destroy(rt_warp_cache cache);
+
 /**
  * Return a raster of the provided geometry
  *
@@ -1864,6 +1986,26 @@ rt_raster rt_raster_gdal_rasterize(const unsigned char *wkb,
 	char **options
 );
 
+/**
+ * Rasterize a polygon or multipolygon on the grid of a raster,
+ * without GDAL
+ *
+ * @param raster : the raster whose grid is used, only its geotransform,
+ *   width and height are read
+ * @param geom : the polygonal geometry, in the coordinates of the raster
+ * @param mode : which pixels are under the geometry
+ * @param callback : called for each run of pixels under the geometry
+ * @param userarg : passed to callback
+ *
+ * @return ES_NONE if success, ES_ERROR if error
+ */
+rt_errorstate rt_raster_rasterize_lwgeom(
+	rt_raster raster,
+	const LWGEOM *geom,
+	rt_rasterize_mode mode,
+	rt_rasterize_callback callback, void *userarg
+);
+
 /**
  * Return ES_ERROR if error occurred in function.
  * Parameter intersects returns non-zero if two rasters intersect
@@ -2160,6 +2302,48 @@ rt_raster_iterator(
 	rt_raster *rtnraster
 );
 
+/**
+ * Compile a map algebra expression so that it can be evaluated per
+ * pixel without going through SQL. Only arithmetic, comparisons, CASE
+ * and common math functions are supported.
+ *
+ * @param expr : the expression with its keywords, e.g. "[rast.val] * 2"
+ * @param kwcount : number of keywords
+ * @param kw : the keywords
+ * @param kwisint : for each keyword, non-zero if it is an integer
+ *
+ * @return compiled expression or NULL if expr must be evaluated with SQL
+ */
+rt_mapexpr
+rt_mapexpr_compile(const char *expr, int kwcount, const char * const *kw, const uint8_t *kwisint);
+
+/**
+ * Evaluate a compiled map algebra expression
+ *
+ * @param mexpr : compiled expression
+ * @param kwval : value of each keyword
+ * @param kwnull : for each keyword, non-zero if NULL
+ * @param value : result of the expression
+ * @param isnull : set to 1 if the result is NULL
+ *
+ * @return 1 on success, 0 if the expression must be evaluated with SQL
+ * for these values (e.g. division by zero)
+ */
+int
+rt_mapexpr_eval(
+	rt_mapexpr mexpr,
+	const double *kwval, const uint8_t *kwnull,
+	double *value, int *isnull
+);
+
+/**
+ * Free a compiled map algebra expression
+ *
+ * @param mexpr : compiled expression
+ */
+void
+rt_mapexpr_destroy(rt_mapexpr mexpr);
+
 /**
  * Returns a new raster with up to four 8BUI bands (RGBA) from
  * applying a colormap to the user-specified band of the
@@ -2456,6 +2640,20 @@ struct rt_extband_t {
 		void *mem; /* loaded external band data, internally owned */
 };
 
+/* compressed in-db band data, see rt_compress.c */
+struct rt_bandblocks_t {
+	uint8_t filter; /* predictor and byte shuffle flags */
+	uint16_t blockrows; /* rows per block */
+	uint32_t count; /* number of blocks */
+	const uint8_t *ends; /* end offset of each block, unaligned uint32 */
+	const uint8_t *data; /* compressed blocks, externally owned */
+	uint32_t size; /* size of the serialized payload starting at filter */
+	const uint8_t *payload; /* serialized payload, copied as is if untouched */
+
+	uint8_t *loaded; /* flag per block, blocks already decompressed */
+	uint32_t remaining; /* number of blocks still compressed */
+};
+
 struct rt_band_t {
     rt_pixtype pixtype;
     int32_t offline;
@@ -2467,6 +2665,9 @@ struct rt_band_t {
     double nodataval; /* int will be converted ... */
     int8_t ownsdata; /* 0, externally owned. 1, internally owned. only applies to data.mem */
 
+		rt_compression compression; /* codec used when serialized */
+		struct rt_bandblocks_t *blocks; /* compressed data not yet decompressed into data.mem */
+
 		rt_raster raster; /* reference to parent raster */
 
     union {
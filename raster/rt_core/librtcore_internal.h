@@ -45,4 +45,10 @@
 
 #include "librtcore.h"
 
+/* compressed in-db band data, rt_compress.c */
+uint8_t *rt_band_compress(rt_band band, uint32_t *size);
+uint32_t rt_band_load_blocks(rt_band band, const uint8_t *payload);
+rt_errorstate rt_band_decompress_rows(rt_band band, int y, int rows);
+void rt_band_destroy_blocks(rt_band band);
+
 #endif /* LIBRTCORE_INTERNAL_H_INCLUDED */
@@ -90,6 +90,8 @@ rt_band_new_inline(
 	band->nodataval = 0;
 	band->data.mem = data;
 	band->ownsdata = 0; /* we do NOT own this data!!! */
+	band->compression = RT_COMPRESSION_NONE;
+	band->blocks = NULL;
 	band->raster = NULL;
 
 	RASTER_DEBUGF(3, "Created rt_band with dimensions %d x %d", band->width, band->height);
@@ -156,6 +158,8 @@ rt_band_new_offline(
 	band->nodataval = 0;
 	band->isnodata = FALSE; /* we don't know if the offline band is NODATA */
 	band->ownsdata = 0; /* offline, flag is useless as all offline data cache is owned internally */
+	band->compression = RT_COMPRESSION_NONE;
+	band->blocks = NULL;
 	band->raster = NULL;
 
 	/* properly set nodataval as it may need to be constrained to the data type */
@@ -310,12 +314,18 @@ rt_band_duplicate(rt_band band) {
 	/* online */
 	else {
 		uint8_t *data = NULL;
+		uint8_t *srcdata = (uint8_t *) rt_band_get_data(band);
+		if (srcdata == NULL) {
+			rterror("rt_band_duplicate: Could not get band data");
+			return NULL;
+		}
+
 		data = (uint8_t*)rtalloc(rt_pixtype_size(band->pixtype) * band->width * band->height);
 		if (data == NULL) {
 			rterror("rt_band_duplicate: Out of memory allocating online band data");
 			return NULL;
 		}
-		memcpy(data, band->data.mem, rt_pixtype_size(band->pixtype) * band->width * band->height);
+		memcpy(data, srcdata, rt_pixtype_size(band->pixtype) * band->width * band->height);
 
 		rtn = rt_band_new_inline(
 			band->width, band->height,
@@ -324,6 +334,7 @@ rt_band_duplicate(rt_band band) {
 			data
 		);
 		rt_band_set_ownsdata_flag(rtn, 1); /* we DO own this data!!! */
+		rtn->compression = band->compression;
 	}
 
 	if (rtn == NULL) {
@@ -365,8 +376,11 @@ rt_band_destroy(rt_band band) {
 			rtdealloc(band->data.offline.path);
 	}
 	/* inline band and band owns the data */
-	else if (band->data.mem != NULL && band->ownsdata)
-		rtdealloc(band->data.mem);
+	else {
+		if (band->data.mem != NULL && band->ownsdata)
+			rtdealloc(band->data.mem);
+		rt_band_destroy_blocks(band);
+	}
 
 	rtdealloc(band);
 }
@@ -435,10 +449,38 @@ rt_band_get_data(rt_band band) {
 		else
 			return band->data.offline.mem;
 	}
+	/* compressed, decompress all of it */
+	else if (band->blocks != NULL) {
+		if (rt_band_decompress_rows(band, 0, band->height) != ES_NONE)
+			return NULL;
+		return band->data.mem;
+	}
 	else
 		return band->data.mem;
 }
 
+/**
+	* Get pointer to raster band data, making sure that the given rows
+	* are available. Only the blocks of these rows are decompressed if
+	* the band is compressed.
+	*
+	* @param band : the band who's data to get
+	* @param y : first row
+	* @param rows : number of rows
+	*
+	* @return pointer to band data or NULL if error
+	*/
+static uint8_t *
+rt_band_get_data_rows(rt_band band, int y, int rows) {
+	if (!band->offline && band->blocks != NULL) {
+		if (rt_band_decompress_rows(band, y, rows) != ES_NONE)
+			return NULL;
+		return (uint8_t *) band->data.mem;
+	}
+
+	return (uint8_t *) rt_band_get_data(band);
+}
+
 /* variable for PostgreSQL GUC: postgis.enable_outdb_rasters */
 bool THR_LOCAL enable_outdb_rasters = 1;
 
@@ -719,6 +761,29 @@ rt_band_set_ownsdata_flag(rt_band band, int flag) {
 	band->ownsdata = flag ? 1 : 0;
 }
 
+/* Get compression codec */
+rt_compression
+rt_band_get_compression(rt_band band) {
+	assert(NULL != band);
+
+	return band->compression;
+}
+
+/* Set compression codec */
+rt_errorstate
+rt_band_set_compression(rt_band band, rt_compression compression) {
+	assert(NULL != band);
+
+	if (band->offline && compression != RT_COMPRESSION_NONE) {
+		rterror("rt_band_set_compression: Cannot compress out-db band");
+		return ES_ERROR;
+	}
+
+	/* data is decompressed when serialized with a different codec, keep the blocks */
+	band->compression = compression;
+	return ES_NONE;
+}
+
 int
 rt_band_get_hasnodata_flag(rt_band band) {
 	//assert(NULL != band);
@@ -953,7 +1018,11 @@ rt_band_set_pixel_line(
 		return ES_ERROR;
 	}
 
-	data = (uint8_t*)rt_band_get_data(band);
+	data = rt_band_get_data_rows(band, y, (x + len - 1) / band->width + 1);
+	if (data == NULL) {
+		rterror("rt_band_set_pixel_line: Cannot get band data");
+		return ES_ERROR;
+	}
 	offset = x + (y * band->width);
 	RASTER_DEBUGF(4, "offset = %d", offset);
 
@@ -1099,7 +1168,11 @@ rt_band_set_pixel(
 		}
 	}
 
-	data = (uint8_t*)rt_band_get_data(band);
+	data = rt_band_get_data_rows(band, y, 1);
+	if (data == NULL) {
+		rterror("rt_band_set_pixel: Cannot get band data");
+		return ES_ERROR;
+	}
 	offset = x + (y * band->width);
 
 	switch (pixtype) {
@@ -1248,7 +1321,7 @@ rt_errorstate rt_band_get_pixel_line(
 	if (len < 1)
 		return ES_NONE;
 
-	data = (uint8_t*)rt_band_get_data(band);
+	data = rt_band_get_data_rows(band, y, (x + len - 1) / band->width + 1);
 	if (data == NULL) {
 		rterror("rt_band_get_pixel_line: Cannot get band data");
 		return ES_ERROR;
@@ -1496,7 +1569,7 @@ rt_band_get_pixel(
 		return ES_NONE;
 	}
 
-	data = (uint8_t*)rt_band_get_data(band);
+	data = rt_band_get_data_rows(band, y, 1);
 	if (data == NULL) {
 		rterror("rt_band_get_pixel: Cannot get band data");
 		return ES_ERROR;
@@ -0,0 +1,681 @@
+/*
+ *
+ * WKTRaster - Raster Types for PostGIS
+ * http://trac.osgeo.org/postgis/wiki/WKTRaster
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "librtcore.h"
+#include "librtcore_internal.h"
+
+/******************************************************************************
+* Compressed in-db band data
+*
+* The pixels of a compressed band are cut into blocks of whole rows,
+* each compressed on its own so that reading a pixel or a line only
+* decompresses the blocks it touches. Serialized, the band data is
+*
+*   uint8_t codec
+*   uint8_t filter
+*   uint16_t rows per block
+*   uint32_t number of blocks
+*   uint32_t end offset of each block in the block data
+*   block data
+*
+* Before compression, pixels are replaced by their difference with the
+* previous pixel of the row (RT_FILTER_DELTA) and the bytes of
+* multi-byte pixels are grouped by significance (RT_FILTER_SHUFFLE), so
+* that smooth surfaces turn into long runs of small, repeated bytes.
+*
+* Blocks are compressed in the LZ4 block format. A block whose compressed
+* size equals its raw size is stored as is, LZ4 output for a block is
+* never that size.
+******************************************************************************/
+
+#define RT_FILTER_DELTA 0x01
+#define RT_FILTER_SHUFFLE 0x02
+
+/* raw size a block aims for, also the largest LZ4 match offset */
+#define RT_BLOCK_TARGET_SIZE 65536
+
+#define RT_BLOCKS_HEADER_SIZE 8
+
+#define RT_LZ4_HASHLOG 12
+#define RT_LZ4_MINMATCH 4
+/* the last match must start 12 bytes before the end, the last 5 bytes are literals */
+#define RT_LZ4_MFLIMIT 12
+#define RT_LZ4_LASTLITERALS 5
+
+static uint32_t
+rt_read_u32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(uint32_t));
+	return v;
+}
+
+static void
+rt_write_u32(uint8_t *p, uint32_t v) {
+	memcpy(p, &v, sizeof(uint32_t));
+}
+
+static uint8_t
+rt_compress_filter(rt_pixtype pixtype) {
+	switch (pixtype) {
+		case PT_16BSI:
+		case PT_16BUI:
+		case PT_32BSI:
+		case PT_32BUI:
+		case PT_32BF:
+		case PT_64BF:
+			return RT_FILTER_DELTA | RT_FILTER_SHUFFLE;
+		default:
+			return RT_FILTER_DELTA;
+	}
+}
+
+/*
+ * Replace each pixel by its difference with the previous pixel of the
+ * row, wrapping around. Floating point pixels are differenced as
+ * integers of the same size: neighbouring values of a smooth surface
+ * share sign, exponent and high mantissa bits, so the difference is small.
+ */
+static void
+rt_filter_delta(uint8_t *buf, int pixbytes, int width, int rows) {
+	int x, y;
+
+	for (y = 0; y < rows; y++) {
+		switch (pixbytes) {
+			case 1: {
+				uint8_t *row = buf + (size_t) y * width;
+				for (x = width - 1; x > 0; x--)
+					row[x] = (uint8_t) (row[x] - row[x - 1]);
+				break;
+			}
+			case 2: {
+				uint8_t *row = buf + (size_t) y * width * 2;
+				uint16_t prev, cur;
+				for (x = width - 1; x > 0; x--) {
+					memcpy(&cur, row + x * 2, 2);
+					memcpy(&prev, row + (x - 1) * 2, 2);
+					cur = (uint16_t) (cur - prev);
+					memcpy(row + x * 2, &cur, 2);
+				}
+				break;
+			}
+			case 4: {
+				uint8_t *row = buf + (size_t) y * width * 4;
+				uint32_t prev, cur;
+				for (x = width - 1; x > 0; x--) {
+					memcpy(&cur, row + x * 4, 4);
+					memcpy(&prev, row + (x - 1) * 4, 4);
+					cur -= prev;
+					memcpy(row + x * 4, &cur, 4);
+				}
+				break;
+			}
+			case 8: {
+				uint8_t *row = buf + (size_t) y * width * 8;
+				uint64_t prev, cur;
+				for (x = width - 1; x > 0; x--) {
+					memcpy(&cur, row + x * 8, 8);
+					memcpy(&prev, row + (x - 1) * 8, 8);
+					cur -= prev;
+					memcpy(row + x * 8, &cur, 8);
+				}
+				break;
+			}
+		}
+	}
+}
+
+/* Undo rt_filter_delta() */
+static void
+rt_unfilter_delta(uint8_t *buf, int pixbytes, int width, int rows) {
+	int x, y;
+
+	for (y = 0; y < rows; y++) {
+		switch (pixbytes) {
+			case 1: {
+				uint8_t *row = buf + (size_t) y * width;
+				for (x = 1; x < width; x++)
+					row[x] = (uint8_t) (row[x] + row[x - 1]);
+				break;
+			}
+			case 2: {
+				uint8_t *row = buf + (size_t) y * width * 2;
+				uint16_t prev, cur;
+				memcpy(&prev, row, 2);
+				for (x = 1; x < width; x++) {
+					memcpy(&cur, row + x * 2, 2);
+					prev = (uint16_t) (cur + prev);
+					memcpy(row + x * 2, &prev, 2);
+				}
+				break;
+			}
+			case 4: {
+				uint8_t *row = buf + (size_t) y * width * 4;
+				uint32_t prev, cur;
+				memcpy(&prev, row, 4);
+				for (x = 1; x < width; x++) {
+					memcpy(&cur, row + x * 4, 4);
+					prev += cur;
+					memcpy(row + x * 4, &prev, 4);
+				}
+				break;
+			}
+			case 8: {
+				uint8_t *row = buf + (size_t) y * width * 8;
+				uint64_t prev, cur;
+				memcpy(&prev, row, 8);
+				for (x = 1; x < width; x++) {
+					memcpy(&cur, row + x * 8, 8);
+					prev += cur;
+					memcpy(row + x * 8, &prev, 8);
+				}
+				break;
+			}
+		}
+	}
+}
+
+/* Group the bytes of count pixels by significance */
+static void
+rt_filter_shuffle(const uint8_t *src, uint8_t *dst, int pixbytes, size_t count) {
+	size_t i;
+	int b;
+
+	for (b = 0; b < pixbytes; b++) {
+		uint8_t *plane = dst + b * count;
+		for (i = 0; i < count; i++)
+			plane[i] = src[i * pixbytes + b];
+	}
+}
+
+/* Undo rt_filter_shuffle() */
+static void
+rt_unfilter_shuffle(const uint8_t *src, uint8_t *dst, int pixbytes, size_t count) {
+	size_t i;
+	int b;
+
+	for (b = 0; b < pixbytes; b++) {
+		const uint8_t *plane = src + b * count;
+		for (i = 0; i < count; i++)
+			dst[i * pixbytes + b] = plane[i];
+	}
+}
+
+/* Largest LZ4 output for size bytes of input */
+static size_t
+rt_lz4_bound(size_t size) {
+	return size + size / 255 + 16;
+}
+
+static uint8_t *
+rt_lz4_length(uint8_t *op, size_t len) {
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (uint8_t) len;
+	return op;
+}
+
+static uint8_t *
+rt_lz4_sequence(uint8_t *op, const uint8_t *literals, size_t litlen, size_t offset, size_t matchlen) {
+	uint8_t *token = op++;
+
+	*token = (uint8_t) ((litlen < 15 ? litlen : 15) << 4);
+	if (litlen >= 15)
+		op = rt_lz4_length(op, litlen - 15);
+	memcpy(op, literals, litlen);
+	op += litlen;
+
+	/* last literals, no match */
+	if (matchlen == 0)
+		return op;
+
+	*op++ = (uint8_t) (offset & 0xFF);
+	*op++ = (uint8_t) (offset >> 8);
+
+	matchlen -= RT_LZ4_MINMATCH;
+	*token |= (uint8_t) (matchlen < 15 ? matchlen : 15);
+	if (matchlen >= 15)
+		op = rt_lz4_length(op, matchlen - 15);
+
+	return op;
+}
+
+/* Compress size bytes of src in the LZ4 block format, dst holds at least rt_lz4_bound(size) bytes */
+static size_t
+rt_lz4_compress(const uint8_t *src, size_t size, uint8_t *dst) {
+	uint32_t table[1 << RT_LZ4_HASHLOG];
+	uint8_t *op = dst;
+	size_t ip = 0;
+	size_t anchor = 0;
+
+	if (size > RT_LZ4_MFLIMIT) {
+		const size_t limit = size - RT_LZ4_MFLIMIT;
+		const size_t matchlimit = size - RT_LZ4_LASTLITERALS;
+
+		memset(table, 0, sizeof(table));
+
+		while (ip < limit) {
+			uint32_t seq = rt_read_u32(src + ip);
+			uint32_t h = (seq * 2654435761U) >> (32 - RT_LZ4_HASHLOG);
+			size_t ref = table[h];
+			table[h] = (uint32_t) ip;
+
+			if (ref < ip && ip - ref <= 65535 && rt_read_u32(src + ref) == seq) {
+				size_t len = RT_LZ4_MINMATCH;
+
+				/* extend backwards over pending literals */
+				while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+					ip--;
+					ref--;
+					len++;
+				}
+				while (ip + len < matchlimit && src[ref + len] == src[ip + len])
+					len++;
+
+				op = rt_lz4_sequence(op, src + anchor, ip - anchor, ip - ref, len);
+				ip += len;
+				anchor = ip;
+			}
+			/* skip faster through data that does not compress */
+			else
+				ip += 1 + ((ip - anchor) >> 6);
+		}
+	}
+
+	op = rt_lz4_sequence(op, src + anchor, size - anchor, 0, 0);
+	return op - dst;
+}
+
+/* Decompress an LZ4 block of srcsize bytes that must expand to exactly dstsize bytes */
+static rt_errorstate
+rt_lz4_decompress(const uint8_t *src, size_t srcsize, uint8_t *dst, size_t dstsize) {
+	const uint8_t *ip = src;
+	const uint8_t *iend = src + srcsize;
+	uint8_t *op = dst;
+	uint8_t *oend = dst + dstsize;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		size_t len = token >> 4;
+		size_t offset;
+
+		if (len == 15) {
+			uint8_t b;
+			do {
+				if (ip >= iend) return ES_ERROR;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		if ((size_t) (iend - ip) < len || (size_t) (oend - op) < len)
+			return ES_ERROR;
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+
+		/* last literals */
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return ES_ERROR;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t) (op - dst))
+			return ES_ERROR;
+
+		len = token & 0x0F;
+		if (len == 15) {
+			uint8_t b;
+			do {
+				if (ip >= iend) return ES_ERROR;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		len += RT_LZ4_MINMATCH;
+		if ((size_t) (oend - op) < len)
+			return ES_ERROR;
+
+		if (offset >= len)
+			memcpy(op, op - offset, len);
+		/* overlapping match repeats the last offset bytes */
+		else {
+			const uint8_t *ref = op - offset;
+			size_t i;
+			for (i = 0; i < len; i++)
+				op[i] = ref[i];
+		}
+		op += len;
+	}
+
+	return op == oend ? ES_NONE : ES_ERROR;
+}
+
+/**
+ * Compress the data of an in-db band
+ *
+ * @param band : the band, its compression must not be RT_COMPRESSION_NONE
+ * @param size : size of the returned payload
+ *
+ * @return serialized compressed data, see above, or NULL on error
+ */
+uint8_t *
+rt_band_compress(rt_band band, uint32_t *size) {
+	int pixbytes = rt_pixtype_size(band->pixtype);
+	size_t rowsize = (size_t) band->width * pixbytes;
+	uint8_t filter = rt_compress_filter(band->pixtype);
+	uint8_t *data = NULL;
+	uint8_t *rtn = NULL;
+	uint8_t *ptr = NULL;
+	uint8_t *filtered = NULL;
+	uint8_t *shuffled = NULL;
+	uint32_t blockrows = 1;
+	uint32_t count = 0;
+	uint32_t end = 0;
+	uint32_t i;
+
+	assert(!band->offline);
+	assert(band->compression != RT_COMPRESSION_NONE);
+
+	/* compressed blocks nobody touched are copied as is */
+	if (
+		band->blocks != NULL &&
+		band->blocks->remaining == band->blocks->count &&
+		band->blocks->payload[0] == band->compression
+	) {
+		rtn = (uint8_t *) rtalloc(band->blocks->size);
+		if (rtn == NULL) {
+			rterror("rt_band_compress: Could not allocate memory for compressed band");
+			return NULL;
+		}
+		memcpy(rtn, band->blocks->payload, band->blocks->size);
+		*size = band->blocks->size;
+		return rtn;
+	}
+
+	data = (uint8_t *) rt_band_get_data(band);
+	if (data == NULL) {
+		rterror("rt_band_compress: Could not get band data");
+		return NULL;
+	}
+
+	if (rowsize > 0 && band->height > 0) {
+		blockrows = RT_BLOCK_TARGET_SIZE / rowsize;
+		if (blockrows < 1)
+			blockrows = 1;
+		if (blockrows > band->height)
+			blockrows = band->height;
+		count = (band->height + blockrows - 1) / blockrows;
+	}
+
+	/* worst case, every block stored raw */
+	rtn = (uint8_t *) rtalloc(RT_BLOCKS_HEADER_SIZE + 4 * count + rt_lz4_bound(rowsize * blockrows) * count);
+	filtered = (uint8_t *) rtalloc(rowsize * blockrows + 1);
+	shuffled = (uint8_t *) rtalloc(rowsize * blockrows + 1);
+	if (rtn == NULL || filtered == NULL || shuffled == NULL) {
+		rterror("rt_band_compress: Could not allocate memory for compressed band");
+		if (rtn != NULL) rtdealloc(rtn);
+		if (filtered != NULL) rtdealloc(filtered);
+		if (shuffled != NULL) rtdealloc(shuffled);
+		return NULL;
+	}
+
+	rtn[0] = (uint8_t) band->compression;
+	rtn[1] = filter;
+	{
+		uint16_t br = (uint16_t) blockrows;
+		memcpy(rtn + 2, &br, 2);
+	}
+	rt_write_u32(rtn + 4, count);
+	ptr = rtn + RT_BLOCKS_HEADER_SIZE + 4 * count;
+
+	for (i = 0; i < count; i++) {
+		uint32_t rows = blockrows;
+		size_t rawsize;
+		size_t packed;
+		const uint8_t *block = NULL;
+
+		if ((i + 1) * blockrows > band->height)
+			rows = band->height - i * blockrows;
+		rawsize = rowsize * rows;
+
+		memcpy(filtered, data + rowsize * blockrows * i, rawsize);
+		block = filtered;
+		if (filter & RT_FILTER_DELTA)
+			rt_filter_delta(filtered, pixbytes, band->width, rows);
+		if ((filter & RT_FILTER_SHUFFLE) && pixbytes > 1) {
+			rt_filter_shuffle(filtered, shuffled, pixbytes, (size_t) band->width * rows);
+			block = shuffled;
+		}
+
+		packed = rt_lz4_compress(block, rawsize, ptr);
+		/* did not compress, store the raw rows */
+		if (packed >= rawsize) {
+			memcpy(ptr, data + rowsize * blockrows * i, rawsize);
+			packed = rawsize;
+		}
+
+		ptr += packed;
+		end += packed;
+		rt_write_u32(rtn + RT_BLOCKS_HEADER_SIZE + 4 * i, end);
+	}
+
+	rtdealloc(filtered);
+	rtdealloc(shuffled);
+
+	*size = ptr - rtn;
+	RASTER_DEBUGF(3, "rt_band_compress: %d blocks, %d bytes for %d bytes of pixels",
+		count, *size, (int) (rowsize * band->height));
+
+	return rtn;
+}
+
+/**
+ * Attach serialized compressed data to a deserialized in-db band.
+ * The data is only decompressed when pixels are read.
+ *
+ * @param band : the band
+ * @param payload : serialized compressed data, must stay allocated
+ * for the lifetime of the band
+ *
+ * @return size of the serialized compressed data, 0 on error
+ */
+uint32_t
+rt_band_load_blocks(rt_band band, const uint8_t *payload) {
+	struct rt_bandblocks_t *blocks = NULL;
+	uint16_t blockrows;
+	uint32_t count;
+	uint32_t prev = 0;
+	uint32_t i;
+
+	if (payload[0] != RT_COMPRESSION_LZ4) {
+		rterror("rt_band_load_blocks: Unknown compression codec %d", payload[0]);
+		return 0;
+	}
+
+	memcpy(&blockrows, payload + 2, 2);
+	count = rt_read_u32(payload + 4);
+	if (
+		(band->width > 0 && band->height > 0) &&
+		(blockrows < 1 || count != (uint32_t) (band->height + blockrows - 1) / blockrows)
+	) {
+		rterror("rt_band_load_blocks: Corrupted compressed band");
+		return 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		uint32_t end = rt_read_u32(payload + RT_BLOCKS_HEADER_SIZE + 4 * i);
+		if (end < prev) {
+			rterror("rt_band_load_blocks: Corrupted compressed band");
+			return 0;
+		}
+		prev = end;
+	}
+
+	blocks = (struct rt_bandblocks_t *) rtalloc(sizeof(struct rt_bandblocks_t));
+	if (blocks == NULL) {
+		rterror("rt_band_load_blocks: Could not allocate memory for compressed band");
+		return 0;
+	}
+	blocks->filter = payload[1];
+	blocks->blockrows = blockrows;
+	blocks->count = count;
+	blocks->ends = payload + RT_BLOCKS_HEADER_SIZE;
+	blocks->data = blocks->ends + 4 * count;
+	blocks->payload = payload;
+	blocks->size = RT_BLOCKS_HEADER_SIZE + 4 * count + prev;
+	blocks->remaining = count;
+	blocks->loaded = NULL;
+	if (count > 0) {
+		blocks->loaded = (uint8_t *) rtalloc(count);
+		if (blocks->loaded == NULL) {
+			rterror("rt_band_load_blocks: Could not allocate memory for compressed band");
+			rtdealloc(blocks);
+			return 0;
+		}
+		memset(blocks->loaded, 0, count);
+	}
+
+	band->compression = (rt_compression) payload[0];
+	band->blocks = blocks;
+	band->data.mem = NULL;
+	band->ownsdata = 0;
+
+	RASTER_DEBUGF(3, "rt_band_load_blocks: %d blocks of %d rows, %d bytes for %d bytes of pixels",
+		count, blockrows, blocks->size, band->width * band->height * rt_pixtype_size(band->pixtype));
+
+	return blocks->size;
+}
+
+/**
+ * Free the compressed data state of a band
+ */
+void
+rt_band_destroy_blocks(rt_band band) {
+	if (band->blocks == NULL)
+		return;
+	if (band->blocks->loaded != NULL)
+		rtdealloc(band->blocks->loaded);
+	rtdealloc(band->blocks);
+	band->blocks = NULL;
+}
+
+/**
+ * Decompress the blocks of a compressed band holding rows y to
+ * y + rows - 1 into the band's data. Once every block is decompressed
+ * the band behaves like an uncompressed one.
+ *
+ * @param band : the band
+ * @param y : first row
+ * @param rows : number of rows
+ *
+ * @return ES_NONE on success, ES_ERROR on error
+ */
+rt_errorstate
+rt_band_decompress_rows(rt_band band, int y, int rows) {
+	struct rt_bandblocks_t *blocks = band->blocks;
+	int pixbytes = rt_pixtype_size(band->pixtype);
+	size_t rowsize = (size_t) band->width * pixbytes;
+	uint8_t *tmp = NULL;
+	uint32_t first;
+	uint32_t last;
+	uint32_t i;
+
+	if (blocks == NULL)
+		return ES_NONE;
+
+	if (y < 0) {
+		rows += y;
+		y = 0;
+	}
+	if (y + rows > band->height)
+		rows = band->height - y;
+	if (rows < 1)
+		return ES_NONE;
+
+	if (band->data.mem == NULL) {
+		band->data.mem = rtalloc(rowsize * band->height);
+		if (band->data.mem == NULL) {
+			rterror("rt_band_decompress_rows: Could not allocate memory for band data");
+			return ES_ERROR;
+		}
+		band->ownsdata = 1;
+	}
+
+	first = y / blocks->blockrows;
+	last = (y + rows - 1) / blocks->blockrows;
+
+	for (i = first; i <= last && i < blocks->count; i++) {
+		uint32_t start = i > 0 ? rt_read_u32(blocks->ends + 4 * (i - 1)) : 0;
+		uint32_t end = rt_read_u32(blocks->ends + 4 * i);
+		uint32_t blockrows = blocks->blockrows;
+		uint8_t *dst = (uint8_t *) band->data.mem + rowsize * blocks->blockrows * i;
+		size_t rawsize;
+
+		if (blocks->loaded[i])
+			continue;
+
+		if ((i + 1) * blockrows > band->height)
+			blockrows = band->height - i * blockrows;
+		rawsize = rowsize * blockrows;
+
+		/* stored raw */
+		if (end - start == rawsize)
+			memcpy(dst, blocks->data + start, rawsize);
+		else if ((blocks->filter & RT_FILTER_SHUFFLE) && pixbytes > 1) {
+			if (tmp == NULL) {
+				tmp = (uint8_t *) rtalloc(rowsize * blocks->blockrows);
+				if (tmp == NULL) {
+					rterror("rt_band_decompress_rows: Could not allocate memory for decompression");
+					return ES_ERROR;
+				}
+			}
+			if (rt_lz4_decompress(blocks->data + start, end - start, tmp, rawsize) != ES_NONE) {
+				rterror("rt_band_decompress_rows: Corrupted block %d of compressed band", i);
+				rtdealloc(tmp);
+				return ES_ERROR;
+			}
+			rt_unfilter_shuffle(tmp, dst, pixbytes, (size_t) band->width * blockrows);
+		}
+		else if (rt_lz4_decompress(blocks->data + start, end - start, dst, rawsize) != ES_NONE) {
+			rterror("rt_band_decompress_rows: Corrupted block %d of compressed band", i);
+			if (tmp != NULL) rtdealloc(tmp);
+			return ES_ERROR;
+		}
+
+		if ((end - start != rawsize) && (blocks->filter & RT_FILTER_DELTA))
+			rt_unfilter_delta(dst, pixbytes, band->width, blockrows);
+
+		blocks->loaded[i] = 1;
+		blocks->remaining--;
+	}
+
+	if (tmp != NULL)
+		rtdealloc(tmp);
+
+	/* everything is decompressed */
+	if (blocks->remaining == 0)
+		rt_band_destroy_blocks(band);
+
+	return ES_NONE;
+}
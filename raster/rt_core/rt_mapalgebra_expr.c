@@ -0,0 +1,1226 @@
+/*
+ *
+ * WKTRaster - Raster Types for PostGIS
+ * http://trac.osgeo.org/postgis/wiki/WKTRaster
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <math.h>
+#include <ctype.h>
+
+#include "librtcore.h"
+#include "librtcore_internal.h"
+
+/******************************************************************************
+* Compiled map algebra expressions
+*
+* The map algebra functions wrap the user expression in
+* "SELECT (expr)::double precision" and run it through SPI once per pixel.
+* This compiles the arithmetic subset of that SQL into a small stack
+* program instead, typed the way the SQL parser would type it: int4 math
+* stays integer, decimal literals are only accepted where SQL would turn
+* them into float8, and so on.
+*
+* Whenever the SQL would not simply return a value - division by zero,
+* overflow, a math domain error, NaN ordering - evaluation gives up on
+* that pixel and the caller falls back to the prepared SPI plan, so the
+* result (or error) is always the one SQL would produce.
+******************************************************************************/
+
+typedef enum {
+	MX_T_INVALID = 0,
+	MX_T_INT,		/* int4 */
+	MX_T_FLOAT,		/* float8 */
+	MX_T_NUMERIC,	/* decimal literal, exact in a double */
+	MX_T_BOOL,
+	MX_T_NULL		/* untyped NULL literal */
+} mx_type;
+
+typedef enum {
+	MX_PUSH = 0,
+	MX_KW,
+	MX_ADDI, MX_SUBI, MX_MULI, MX_DIVI, MX_MODI, MX_NEGI, MX_ABSI,
+	MX_ADDF, MX_SUBF, MX_MULF, MX_DIVF, MX_NEGF, MX_POWF,
+	MX_FUNC,
+	MX_TOINT,
+	MX_EQ, MX_NE, MX_LT, MX_LE, MX_GT, MX_GE,
+	MX_AND, MX_OR, MX_NOT, MX_ISNULL, MX_NOTNULL,
+	MX_GREATEST, MX_LEAST, MX_COALESCE,
+	MX_DUP, MX_POP, MX_JMP, MX_JMPF
+} mx_opcode;
+
+typedef enum {
+	MX_F_ABS = 0, MX_F_SQRT, MX_F_CBRT, MX_F_EXP, MX_F_LN, MX_F_LOG,
+	MX_F_FLOOR, MX_F_CEIL, MX_F_ROUND, MX_F_TRUNC, MX_F_SIGN,
+	MX_F_SIN, MX_F_COS, MX_F_TAN, MX_F_COT, MX_F_ASIN, MX_F_ACOS, MX_F_ATAN,
+	MX_F_ATAN2, MX_F_DEGREES, MX_F_RADIANS
+} mx_func;
+
+struct rt_mapexpr_op_t {
+	uint8_t code;
+	uint8_t isnull;
+	uint16_t arg;	/* keyword index, function, argument count or jump target */
+	double val;
+};
+
+struct rt_mapexpr_t {
+	struct rt_mapexpr_op_t *ops;
+	int count;
+	double *val;
+	uint8_t *isnull;
+};
+
+/* Functions: how their argument types resolve in SQL */
+typedef enum {
+	MX_FK_FLOAT,	/* float8 only, a decimal literal is cast to float8 */
+	MX_FK_OVERLOAD,	/* float8 and numeric versions, decimal literal picks numeric */
+	MX_FK_ABS,		/* integer version too */
+	MX_FK_MOD,		/* integer version only */
+	MX_FK_VARIADIC,	/* greatest, least, coalesce */
+	MX_FK_PI
+} mx_funckind;
+
+static const struct {
+	const char *name;
+	mx_funckind kind;
+	int nargs;
+	int code;
+} mx_functions[] = {
+	{"abs", MX_FK_ABS, 1, MX_F_ABS},
+	{"sqrt", MX_FK_OVERLOAD, 1, MX_F_SQRT},
+	{"cbrt", MX_FK_FLOAT, 1, MX_F_CBRT},
+	{"exp", MX_FK_OVERLOAD, 1, MX_F_EXP},
+	{"ln", MX_FK_OVERLOAD, 1, MX_F_LN},
+	{"log", MX_FK_OVERLOAD, 1, MX_F_LOG},
+	{"floor", MX_FK_OVERLOAD, 1, MX_F_FLOOR},
+	{"ceil", MX_FK_OVERLOAD, 1, MX_F_CEIL},
+	{"ceiling", MX_FK_OVERLOAD, 1, MX_F_CEIL},
+	{"round", MX_FK_OVERLOAD, 1, MX_F_ROUND},
+	{"trunc", MX_FK_OVERLOAD, 1, MX_F_TRUNC},
+	{"sign", MX_FK_OVERLOAD, 1, MX_F_SIGN},
+	{"power", MX_FK_OVERLOAD, 2, -1},
+	{"pow", MX_FK_OVERLOAD, 2, -1},
+	{"sin", MX_FK_FLOAT, 1, MX_F_SIN},
+	{"cos", MX_FK_FLOAT, 1, MX_F_COS},
+	{"tan", MX_FK_FLOAT, 1, MX_F_TAN},
+	{"cot", MX_FK_FLOAT, 1, MX_F_COT},
+	{"asin", MX_FK_FLOAT, 1, MX_F_ASIN},
+	{"acos", MX_FK_FLOAT, 1, MX_F_ACOS},
+	{"atan", MX_FK_FLOAT, 1, MX_F_ATAN},
+	{"atan2", MX_FK_FLOAT, 2, MX_F_ATAN2},
+	{"degrees", MX_FK_FLOAT, 1, MX_F_DEGREES},
+	{"radians", MX_FK_FLOAT, 1, MX_F_RADIANS},
+	{"pi", MX_FK_PI, 0, 0},
+	{"mod", MX_FK_MOD, 2, 0},
+	{"greatest", MX_FK_VARIADIC, 0, MX_GREATEST},
+	{"least", MX_FK_VARIADIC, 0, MX_LEAST},
+	{"coalesce", MX_FK_VARIADIC, 0, MX_COALESCE}
+};
+
+typedef enum {
+	MX_TOK_END = 0,
+	MX_TOK_INT,
+	MX_TOK_DECIMAL,
+	MX_TOK_KW,
+	MX_TOK_IDENT,
+	MX_TOK_OP,
+	MX_TOK_LPAREN,
+	MX_TOK_RPAREN,
+	MX_TOK_COMMA,
+	MX_TOK_CAST,
+	MX_TOK_BAD
+} mx_token;
+
+typedef enum {
+	MX_OP_PLUS = 0, MX_OP_MINUS, MX_OP_MUL, MX_OP_DIV, MX_OP_MOD, MX_OP_POW,
+	MX_OP_EQ, MX_OP_NE, MX_OP_LT, MX_OP_LE, MX_OP_GT, MX_OP_GE
+} mx_operator;
+
+#define MX_IDENT_LEN 32
+
+typedef struct {
+	const char *p;
+
+	mx_token tok;
+	double tokval;
+	int tokop;
+	int tokkw;
+	char ident[MX_IDENT_LEN];
+
+	int kwcount;
+	const char * const *kw;
+	const uint8_t *kwisint;
+
+	struct rt_mapexpr_op_t *ops;
+	int count;
+	int size;
+	int depth;
+	int maxdepth;
+	int failed;
+} mx_compiler;
+
+static int
+mx_is_opchar(char c) {
+	return c != '\0' && strchr("+-*/<>=~!@#%^&|`?", c) != NULL;
+}
+
+/* Next token, following the SQL lexer closely enough to reject anything it would read differently */
+static void
+mx_next(mx_compiler *c) {
+	const char *p = c->p;
+
+	while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == '\f')
+		p++;
+
+	c->tok = MX_TOK_BAD;
+
+	if (*p == '\0') {
+		c->tok = MX_TOK_END;
+	}
+	else if (isdigit((unsigned char) *p) || (*p == '.' && isdigit((unsigned char) p[1]))) {
+		const char *start = p;
+		int decimal = 0;
+		int digits = 0;
+		int leading = 1;
+
+		for (; isdigit((unsigned char) *p) || *p == '.'; p++) {
+			if (*p == '.') {
+				if (decimal) break;
+				decimal = 1;
+				continue;
+			}
+			/* significant digits, for the exactness of decimal literals */
+			if (*p != '0' || !leading) {
+				leading = 0;
+				digits++;
+			}
+		}
+		if ((*p == 'e' || *p == 'E') &&
+			(isdigit((unsigned char) p[1]) || ((p[1] == '+' || p[1] == '-') && isdigit((unsigned char) p[2])))) {
+			decimal = 1;
+			p += 2;
+			while (isdigit((unsigned char) *p)) p++;
+		}
+		if (isalpha((unsigned char) *p) || *p == '_' || *p == '.') {
+			c->p = p;
+			return;
+		}
+
+		c->tokval = strtod(start, NULL);
+		if (decimal) {
+			/* a decimal of up to 15 significant digits orders and compares
+			   like its double, see mx_numeric_ok() */
+			if (digits <= 15 && isfinite(c->tokval))
+				c->tok = MX_TOK_DECIMAL;
+		}
+		else if (c->tokval <= INT32_MAX)
+			c->tok = MX_TOK_INT;
+	}
+	else if (*p == '[') {
+		int i;
+		for (i = 0; i < c->kwcount; i++) {
+			size_t len = strlen(c->kw[i]);
+			if (strncmp(p, c->kw[i], len) == 0) {
+				c->tok = MX_TOK_KW;
+				c->tokkw = i;
+				p += len;
+				break;
+			}
+		}
+	}
+	else if (isalpha((unsigned char) *p) || *p == '_') {
+		int len = 0;
+		for (; isalnum((unsigned char) *p) || *p == '_' || *p == '$'; p++) {
+			if (len >= MX_IDENT_LEN - 1) {
+				c->p = p;
+				return;
+			}
+			c->ident[len++] = tolower((unsigned char) *p);
+		}
+		c->ident[len] = '\0';
+		c->tok = MX_TOK_IDENT;
+	}
+	else if (*p == '(') {
+		c->tok = MX_TOK_LPAREN;
+		p++;
+	}
+	else if (*p == ')') {
+		c->tok = MX_TOK_RPAREN;
+		p++;
+	}
+	else if (*p == ',') {
+		c->tok = MX_TOK_COMMA;
+		p++;
+	}
+	else if (p[0] == ':' && p[1] == ':') {
+		c->tok = MX_TOK_CAST;
+		p += 2;
+	}
+	else if (mx_is_opchar(*p)) {
+		const char *start = p;
+		size_t len;
+		int special = 0;
+		size_t i;
+
+		while (mx_is_opchar(*p)) p++;
+		len = p - start;
+
+		/* comments are not handled */
+		for (i = 0; i + 1 < len; i++) {
+			if ((start[i] == '-' && start[i + 1] == '-') || (start[i] == '/' && start[i + 1] == '*'))
+				return;
+		}
+		/* like SQL, a trailing + or - is its own operator unless the
+		   operator contains one of ~ ! @ # % ^ & | ` ? */
+		for (i = 0; i < len; i++) {
+			if (strchr("~!@#%^&|`?", start[i]) != NULL)
+				special = 1;
+		}
+		if (!special) {
+			while (len > 1 && (start[len - 1] == '+' || start[len - 1] == '-'))
+				len--;
+		}
+		p = start + len;
+
+		c->tok = MX_TOK_OP;
+		if (len == 1) {
+			switch (*start) {
+				case '+': c->tokop = MX_OP_PLUS; break;
+				case '-': c->tokop = MX_OP_MINUS; break;
+				case '*': c->tokop = MX_OP_MUL; break;
+				case '/': c->tokop = MX_OP_DIV; break;
+				case '%': c->tokop = MX_OP_MOD; break;
+				case '^': c->tokop = MX_OP_POW; break;
+				case '=': c->tokop = MX_OP_EQ; break;
+				case '<': c->tokop = MX_OP_LT; break;
+				case '>': c->tokop = MX_OP_GT; break;
+				default: c->tok = MX_TOK_BAD;
+			}
+		}
+		else if (len == 2 && start[0] == '<' && start[1] == '=')
+			c->tokop = MX_OP_LE;
+		else if (len == 2 && start[0] == '>' && start[1] == '=')
+			c->tokop = MX_OP_GE;
+		else if (len == 2 && ((start[0] == '<' && start[1] == '>') || (start[0] == '!' && start[1] == '=')))
+			c->tokop = MX_OP_NE;
+		else
+			c->tok = MX_TOK_BAD;
+	}
+
+	c->p = p;
+}
+
+static int
+mx_is_ident(mx_compiler *c, const char *word) {
+	return c->tok == MX_TOK_IDENT && strcmp(c->ident, word) == 0;
+}
+
+static int
+mx_is_op(mx_compiler *c, mx_operator op) {
+	return c->tok == MX_TOK_OP && c->tokop == (int) op;
+}
+
+static int
+mx_emit(mx_compiler *c, mx_opcode code, uint16_t arg, double val, uint8_t isnull, int stackdelta) {
+	if (c->count == c->size) {
+		c->size *= 2;
+		c->ops = (struct rt_mapexpr_op_t *) rtrealloc(c->ops, c->size * sizeof(struct rt_mapexpr_op_t));
+	}
+	if (c->count >= UINT16_MAX) {
+		c->failed = 1;
+		return 0;
+	}
+	c->ops[c->count].code = code;
+	c->ops[c->count].arg = arg;
+	c->ops[c->count].val = val;
+	c->ops[c->count].isnull = isnull;
+
+	c->depth += stackdelta;
+	if (c->depth > c->maxdepth)
+		c->maxdepth = c->depth;
+
+	return c->count++;
+}
+
+static int
+mx_is_number(mx_type t) {
+	return t == MX_T_INT || t == MX_T_FLOAT || t == MX_T_NUMERIC || t == MX_T_NULL;
+}
+
+/*
+ * Result type of arithmetic on a and b. int op int stays int; anything
+ * with a float8 is float8. A decimal literal is numeric in SQL, so it is
+ * only accepted next to a float8, which turns it into a float8 as well.
+ */
+static mx_type
+mx_arith_type(mx_type a, mx_type b) {
+	if (!mx_is_number(a) || !mx_is_number(b) || (a == MX_T_NULL && b == MX_T_NULL))
+		return MX_T_INVALID;
+	if (a == MX_T_FLOAT || b == MX_T_FLOAT)
+		return MX_T_FLOAT;
+	if (a == MX_T_NUMERIC || b == MX_T_NUMERIC)
+		return MX_T_INVALID;
+	return MX_T_INT;
+}
+
+/*
+ * Common type of CASE branches, greatest/least/coalesce arguments and
+ * comparison operands. Values keep their double representation, so mixing
+ * int, float8 and decimal literals needs no conversion: a decimal literal
+ * of up to 15 digits converts to float8 and compares exactly like its
+ * double.
+ */
+static mx_type
+mx_common_type(mx_type a, mx_type b) {
+	if (a == MX_T_INVALID || b == MX_T_INVALID)
+		return MX_T_INVALID;
+	if (a == MX_T_NULL)
+		return b;
+	if (b == MX_T_NULL || a == b)
+		return a;
+	if (a == MX_T_BOOL || b == MX_T_BOOL)
+		return MX_T_INVALID;
+	if (a == MX_T_FLOAT || b == MX_T_FLOAT)
+		return MX_T_FLOAT;
+	return MX_T_NUMERIC;
+}
+
+static mx_type mx_parse_expr(mx_compiler *c);
+
+/* Argument type of a float8 function, or MX_T_INVALID if SQL would pick another version */
+static mx_type
+mx_float_arg(mx_funckind kind, mx_type t) {
+	if (t == MX_T_BOOL || t == MX_T_INVALID)
+		return MX_T_INVALID;
+	if (t == MX_T_NUMERIC && kind != MX_FK_FLOAT)
+		return MX_T_INVALID;
+	return MX_T_FLOAT;
+}
+
+static mx_type
+mx_parse_function(mx_compiler *c) {
+	mx_type args[2] = {MX_T_INVALID, MX_T_INVALID};
+	mx_type rtn = MX_T_NULL;
+	int nargs = 0;
+	size_t f;
+	size_t nfunc = sizeof(mx_functions) / sizeof(mx_functions[0]);
+
+	for (f = 0; f < nfunc; f++) {
+		if (strcmp(c->ident, mx_functions[f].name) == 0)
+			break;
+	}
+	if (f == nfunc)
+		return MX_T_INVALID;
+
+	/* current token is the opening parenthesis */
+	mx_next(c);
+	if (c->tok != MX_TOK_RPAREN) {
+		for (;;) {
+			mx_type t = mx_parse_expr(c);
+			if (t == MX_T_INVALID)
+				return MX_T_INVALID;
+			if (mx_functions[f].kind == MX_FK_VARIADIC) {
+				rtn = mx_common_type(rtn, t);
+				if (rtn == MX_T_INVALID)
+					return MX_T_INVALID;
+			}
+			else if (nargs < 2)
+				args[nargs] = t;
+			nargs++;
+			if (c->tok == MX_TOK_COMMA) {
+				mx_next(c);
+				continue;
+			}
+			break;
+		}
+	}
+	if (c->tok != MX_TOK_RPAREN)
+		return MX_T_INVALID;
+	mx_next(c);
+
+	switch (mx_functions[f].kind) {
+		case MX_FK_VARIADIC:
+			if (nargs < 1 || nargs > UINT16_MAX)
+				return MX_T_INVALID;
+			mx_emit(c, (mx_opcode) mx_functions[f].code, nargs, 0, 0, 1 - nargs);
+			return rtn;
+		case MX_FK_PI:
+			if (nargs != 0)
+				return MX_T_INVALID;
+			mx_emit(c, MX_PUSH, 0, M_PI, 0, 1);
+			return MX_T_FLOAT;
+		case MX_FK_MOD:
+			if (nargs != 2 || mx_arith_type(args[0], args[1]) != MX_T_INT)
+				return MX_T_INVALID;
+			mx_emit(c, MX_MODI, 0, 0, 0, -1);
+			return MX_T_INT;
+		case MX_FK_ABS:
+			if (nargs != 1)
+				return MX_T_INVALID;
+			if (args[0] == MX_T_INT) {
+				mx_emit(c, MX_ABSI, 0, 0, 0, 0);
+				return MX_T_INT;
+			}
+			/* fall through */
+		case MX_FK_FLOAT:
+		case MX_FK_OVERLOAD:
+			if (nargs != mx_functions[f].nargs)
+				return MX_T_INVALID;
+			if (mx_float_arg(mx_functions[f].kind, args[0]) == MX_T_INVALID)
+				return MX_T_INVALID;
+			if (nargs == 2 && mx_float_arg(mx_functions[f].kind, args[1]) == MX_T_INVALID)
+				return MX_T_INVALID;
+			if (mx_functions[f].code < 0)
+				mx_emit(c, MX_POWF, 0, 0, 0, -1);
+			else
+				mx_emit(c, MX_FUNC, mx_functions[f].code, 0, 0, 1 - nargs);
+			return MX_T_FLOAT;
+	}
+
+	return MX_T_INVALID;
+}
+
+/* CASE [operand] WHEN ... THEN ... [ELSE ...] END, current token is CASE */
+static mx_type
+mx_parse_case(mx_compiler *c) {
+	mx_type rtn = MX_T_NULL;
+	mx_type operand = MX_T_INVALID;
+	int base = c->depth;
+	int *ends = NULL;
+	int nends = 0;
+	int i;
+
+	mx_next(c);
+	if (!mx_is_ident(c, "when")) {
+		operand = mx_parse_expr(c);
+		if (operand == MX_T_INVALID)
+			return MX_T_INVALID;
+	}
+	if (!mx_is_ident(c, "when"))
+		return MX_T_INVALID;
+
+	ends = (int *) rtalloc(sizeof(int) * (strlen(c->p) / 4 + 1));
+
+	while (mx_is_ident(c, "when")) {
+		mx_type cond;
+		mx_type t;
+		int jf;
+
+		mx_next(c);
+		if (operand != MX_T_INVALID) {
+			mx_emit(c, MX_DUP, 0, 0, 0, 1);
+			t = mx_parse_expr(c);
+			if (mx_common_type(operand, t) == MX_T_INVALID) {
+				rtdealloc(ends);
+				return MX_T_INVALID;
+			}
+			mx_emit(c, MX_EQ, 0, 0, 0, -1);
+			cond = MX_T_BOOL;
+		}
+		else
+			cond = mx_parse_expr(c);
+		if ((cond != MX_T_BOOL && cond != MX_T_NULL) || !mx_is_ident(c, "then")) {
+			rtdealloc(ends);
+			return MX_T_INVALID;
+		}
+		jf = mx_emit(c, MX_JMPF, 0, 0, 0, -1);
+
+		mx_next(c);
+		if (operand != MX_T_INVALID)
+			mx_emit(c, MX_POP, 0, 0, 0, -1);
+		t = mx_parse_expr(c);
+		rtn = mx_common_type(rtn, t);
+		if (rtn == MX_T_INVALID || c->failed) {
+			rtdealloc(ends);
+			return MX_T_INVALID;
+		}
+		ends[nends++] = mx_emit(c, MX_JMP, 0, 0, 0, 0);
+
+		/* the next branch starts from the depth before this one */
+		c->depth = base + (operand != MX_T_INVALID ? 1 : 0);
+		c->ops[jf].arg = c->count;
+	}
+
+	if (operand != MX_T_INVALID)
+		mx_emit(c, MX_POP, 0, 0, 0, -1);
+	if (mx_is_ident(c, "else")) {
+		mx_type t;
+		mx_next(c);
+		t = mx_parse_expr(c);
+		rtn = mx_common_type(rtn, t);
+	}
+	else
+		mx_emit(c, MX_PUSH, 0, 0, 1, 1);
+
+	if (rtn == MX_T_INVALID || c->failed || !mx_is_ident(c, "end")) {
+		rtdealloc(ends);
+		return MX_T_INVALID;
+	}
+	mx_next(c);
+
+	for (i = 0; i < nends; i++)
+		c->ops[ends[i]].arg = c->count;
+	rtdealloc(ends);
+
+	return rtn;
+}
+
+static mx_type
+mx_parse_primary(mx_compiler *c) {
+	mx_type t = MX_T_INVALID;
+
+	switch (c->tok) {
+		case MX_TOK_INT:
+			mx_emit(c, MX_PUSH, 0, c->tokval, 0, 1);
+			mx_next(c);
+			return MX_T_INT;
+		case MX_TOK_DECIMAL:
+			mx_emit(c, MX_PUSH, 0, c->tokval, 0, 1);
+			mx_next(c);
+			return MX_T_NUMERIC;
+		case MX_TOK_KW:
+			mx_emit(c, MX_KW, c->tokkw, 0, 0, 1);
+			t = c->kwisint[c->tokkw] ? MX_T_INT : MX_T_FLOAT;
+			mx_next(c);
+			return t;
+		case MX_TOK_LPAREN:
+			mx_next(c);
+			t = mx_parse_expr(c);
+			if (c->tok != MX_TOK_RPAREN)
+				return MX_T_INVALID;
+			mx_next(c);
+			return t;
+		case MX_TOK_IDENT:
+			if (mx_is_ident(c, "null")) {
+				mx_emit(c, MX_PUSH, 0, 0, 1, 1);
+				mx_next(c);
+				return MX_T_NULL;
+			}
+			if (mx_is_ident(c, "true") || mx_is_ident(c, "false")) {
+				mx_emit(c, MX_PUSH, 0, mx_is_ident(c, "true") ? 1 : 0, 0, 1);
+				mx_next(c);
+				return MX_T_BOOL;
+			}
+			if (mx_is_ident(c, "case"))
+				return mx_parse_case(c);
+			mx_next(c);
+			if (c->tok != MX_TOK_LPAREN)
+				return MX_T_INVALID;
+			/* ident still holds the function name */
+			return mx_parse_function(c);
+		default:
+			return MX_T_INVALID;
+	}
+}
+
+/* expr::type */
+static mx_type
+mx_parse_postfix(mx_compiler *c) {
+	mx_type t = mx_parse_primary(c);
+
+	while (t != MX_T_INVALID && c->tok == MX_TOK_CAST) {
+		mx_next(c);
+		if (c->tok != MX_TOK_IDENT)
+			return MX_T_INVALID;
+
+		if (mx_is_ident(c, "double")) {
+			mx_next(c);
+			if (!mx_is_ident(c, "precision"))
+				return MX_T_INVALID;
+			mx_next(c);
+			if (t == MX_T_BOOL)
+				return MX_T_INVALID;
+			t = MX_T_FLOAT;
+		}
+		else if (mx_is_ident(c, "float8") || mx_is_ident(c, "float")) {
+			mx_next(c);
+			if (t == MX_T_BOOL)
+				return MX_T_INVALID;
+			t = MX_T_FLOAT;
+		}
+		else if (mx_is_ident(c, "integer") || mx_is_ident(c, "int") || mx_is_ident(c, "int4")) {
+			mx_next(c);
+			/* numeric rounds half away from zero, unlike float8 */
+			if (t == MX_T_NUMERIC) {
+				struct rt_mapexpr_op_t *last = &c->ops[c->count - 1];
+				if (last->code != MX_PUSH || fabs(last->val) > INT32_MAX)
+					return MX_T_INVALID;
+				last->val = round(last->val);
+			}
+			else if (t == MX_T_FLOAT)
+				mx_emit(c, MX_TOINT, 0, 0, 0, 0);
+			/* bool::int4 is 0 or 1 already */
+			t = MX_T_INT;
+		}
+		else
+			return MX_T_INVALID;
+	}
+
+	return t;
+}
+
+static mx_type
+mx_parse_unary(mx_compiler *c) {
+	if (mx_is_op(c, MX_OP_MINUS)) {
+		mx_type t;
+		mx_next(c);
+		t = mx_parse_unary(c);
+		switch (t) {
+			case MX_T_INT:
+				mx_emit(c, MX_NEGI, 0, 0, 0, 0);
+				return t;
+			case MX_T_FLOAT:
+			case MX_T_NUMERIC:
+				mx_emit(c, MX_NEGF, 0, 0, 0, 0);
+				return t;
+			default:
+				return MX_T_INVALID;
+		}
+	}
+	else if (mx_is_op(c, MX_OP_PLUS)) {
+		mx_type t;
+		mx_next(c);
+		t = mx_parse_unary(c);
+		return (t == MX_T_INT || t == MX_T_FLOAT || t == MX_T_NUMERIC) ? t : MX_T_INVALID;
+	}
+	return mx_parse_postfix(c);
+}
+
+static mx_type
+mx_parse_pow(mx_compiler *c) {
+	mx_type t = mx_parse_unary(c);
+
+	while (t != MX_T_INVALID && mx_is_op(c, MX_OP_POW)) {
+		mx_type r;
+		mx_next(c);
+		r = mx_parse_unary(c);
+		/* float8 ^ float8; int4 converts to float8, a decimal literal only next to a float8 */
+		if (mx_arith_type(t, r) == MX_T_INVALID)
+			return MX_T_INVALID;
+		mx_emit(c, MX_POWF, 0, 0, 0, -1);
+		t = MX_T_FLOAT;
+	}
+	return t;
+}
+
+static mx_type
+mx_parse_mul(mx_compiler *c) {
+	mx_type t = mx_parse_pow(c);
+
+	while (t != MX_T_INVALID &&
+		(mx_is_op(c, MX_OP_MUL) || mx_is_op(c, MX_OP_DIV) || mx_is_op(c, MX_OP_MOD))) {
+		int op = c->tokop;
+		mx_type r;
+		mx_next(c);
+		r = mx_parse_pow(c);
+		t = mx_arith_type(t, r);
+		if (t == MX_T_INVALID)
+			return t;
+		if (op == MX_OP_MOD) {
+			if (t != MX_T_INT)
+				return MX_T_INVALID;
+			mx_emit(c, MX_MODI, 0, 0, 0, -1);
+		}
+		else if (op == MX_OP_MUL)
+			mx_emit(c, t == MX_T_INT ? MX_MULI : MX_MULF, 0, 0, 0, -1);
+		else
+			mx_emit(c, t == MX_T_INT ? MX_DIVI : MX_DIVF, 0, 0, 0, -1);
+	}
+	return t;
+}
+
+static mx_type
+mx_parse_add(mx_compiler *c) {
+	mx_type t = mx_parse_mul(c);
+
+	while (t != MX_T_INVALID && (mx_is_op(c, MX_OP_PLUS) || mx_is_op(c, MX_OP_MINUS))) {
+		int op = c->tokop;
+		mx_type r;
+		mx_next(c);
+		r = mx_parse_mul(c);
+		t = mx_arith_type(t, r);
+		if (t == MX_T_INVALID)
+			return t;
+		if (op == MX_OP_PLUS)
+			mx_emit(c, t == MX_T_INT ? MX_ADDI : MX_ADDF, 0, 0, 0, -1);
+		else
+			mx_emit(c, t == MX_T_INT ? MX_SUBI : MX_SUBF, 0, 0, 0, -1);
+	}
+	return t;
+}
+
+/* expr IS [NOT] NULL */
+static mx_type
+mx_parse_is(mx_compiler *c) {
+	mx_type t = mx_parse_add(c);
+
+	while (t != MX_T_INVALID && mx_is_ident(c, "is")) {
+		int negate = 0;
+		mx_next(c);
+		if (mx_is_ident(c, "not")) {
+			negate = 1;
+			mx_next(c);
+		}
+		if (!mx_is_ident(c, "null"))
+			return MX_T_INVALID;
+		mx_next(c);
+		mx_emit(c, negate ? MX_NOTNULL : MX_ISNULL, 0, 0, 0, 0);
+		t = MX_T_BOOL;
+	}
+	return t;
+}
+
+static mx_type
+mx_parse_cmp(mx_compiler *c) {
+	mx_type t = mx_parse_is(c);
+	mx_type r;
+	int op;
+	static const mx_opcode codes[] = {MX_EQ, MX_NE, MX_LT, MX_LE, MX_GT, MX_GE};
+
+	if (t == MX_T_INVALID || c->tok != MX_TOK_OP || c->tokop < MX_OP_EQ)
+		return t;
+
+	op = c->tokop;
+	mx_next(c);
+	r = mx_parse_is(c);
+	if (mx_common_type(t, r) == MX_T_INVALID || (t == MX_T_NULL && r == MX_T_NULL))
+		return MX_T_INVALID;
+	mx_emit(c, codes[op - MX_OP_EQ], 0, 0, 0, -1);
+
+	/* a < b < c means something else in SQL */
+	if (c->tok == MX_TOK_OP && c->tokop >= MX_OP_EQ)
+		return MX_T_INVALID;
+
+	return MX_T_BOOL;
+}
+
+static mx_type
+mx_parse_not(mx_compiler *c) {
+	if (mx_is_ident(c, "not")) {
+		mx_type t;
+		mx_next(c);
+		t = mx_parse_not(c);
+		if (t != MX_T_BOOL && t != MX_T_NULL)
+			return MX_T_INVALID;
+		mx_emit(c, MX_NOT, 0, 0, 0, 0);
+		return MX_T_BOOL;
+	}
+	return mx_parse_cmp(c);
+}
+
+static mx_type
+mx_parse_and(mx_compiler *c) {
+	mx_type t = mx_parse_not(c);
+
+	while (t != MX_T_INVALID && mx_is_ident(c, "and")) {
+		mx_type r;
+		mx_next(c);
+		r = mx_parse_not(c);
+		if ((t != MX_T_BOOL && t != MX_T_NULL) || (r != MX_T_BOOL && r != MX_T_NULL))
+			return MX_T_INVALID;
+		mx_emit(c, MX_AND, 0, 0, 0, -1);
+		t = MX_T_BOOL;
+	}
+	return t;
+}
+
+static mx_type
+mx_parse_expr(mx_compiler *c) {
+	mx_type t = mx_parse_and(c);
+
+	while (t != MX_T_INVALID && mx_is_ident(c, "or")) {
+		mx_type r;
+		mx_next(c);
+		r = mx_parse_and(c);
+		if ((t != MX_T_BOOL && t != MX_T_NULL) || (r != MX_T_BOOL && r != MX_T_NULL))
+			return MX_T_INVALID;
+		mx_emit(c, MX_OR, 0, 0, 0, -1);
+		t = MX_T_BOOL;
+	}
+	return c->failed ? MX_T_INVALID : t;
+}
+
+/**
+ * Compile a map algebra expression into a program evaluated without SQL.
+ *
+ * @param expr : the expression as given by the user, with keywords
+ * @param kwcount : number of keywords
+ * @param kw : the keywords, e.g. "[rast.val]"
+ * @param kwisint : for each keyword, non-zero if it stands for an int4
+ * (pixel positions) rather than a float8
+ *
+ * @return compiled expression, or NULL if expr uses anything outside
+ * the supported subset and must go through SQL
+ */
+rt_mapexpr
+rt_mapexpr_compile(const char *expr, int kwcount, const char * const *kw, const uint8_t *kwisint) {
+	mx_compiler c;
+	mx_type t;
+	rt_mapexpr mexpr;
+
+	memset(&c, 0, sizeof(mx_compiler));
+	c.p = expr;
+	c.kwcount = kwcount;
+	c.kw = kw;
+	c.kwisint = kwisint;
+	c.size = 32;
+	c.ops = (struct rt_mapexpr_op_t *) rtalloc(c.size * sizeof(struct rt_mapexpr_op_t));
+
+	mx_next(&c);
+	t = mx_parse_expr(&c);
+
+	/* the result is cast to double precision, which a boolean cannot be */
+	if (t == MX_T_INVALID || t == MX_T_BOOL || c.failed || c.tok != MX_TOK_END || c.depth != 1) {
+		RASTER_DEBUGF(3, "expression not compiled, evaluating through SQL: %s", expr);
+		rtdealloc(c.ops);
+		return NULL;
+	}
+
+	mexpr = (rt_mapexpr) rtalloc(sizeof(struct rt_mapexpr_t));
+	mexpr->ops = c.ops;
+	mexpr->count = c.count;
+	mexpr->val = (double *) rtalloc(sizeof(double) * c.maxdepth);
+	mexpr->isnull = (uint8_t *) rtalloc(sizeof(uint8_t) * c.maxdepth);
+
+	return mexpr;
+}
+
+/**
+ * Free a compiled expression
+ */
+void
+rt_mapexpr_destroy(rt_mapexpr mexpr) {
+	if (mexpr == NULL)
+		return;
+	rtdealloc(mexpr->ops);
+	rtdealloc(mexpr->val);
+	rtdealloc(mexpr->isnull);
+	rtdealloc(mexpr);
+}
+
+/* float8 arithmetic raises an error on overflow to infinity and on underflow to zero */
+#define MX_FLOAT_CHECK(r, infok, zerook) \
+	if ((isinf(r) && !(infok)) || ((r) == 0.0 && !(zerook))) \
+		return 0;
+
+#define MX_INT_CHECK(r) \
+	if ((r) < INT32_MIN || (r) > INT32_MAX) \
+		return 0;
+
+/* Evaluate one float8 function, returns 0 where SQL would raise an error */
+static int
+mx_eval_func(int func, double a, double b, double *r) {
+	switch (func) {
+		case MX_F_ABS: *r = fabs(a); break;
+		case MX_F_SQRT:
+			if (a < 0) return 0;
+			*r = sqrt(a);
+			break;
+		case MX_F_CBRT: *r = cbrt(a); break;
+		case MX_F_EXP:
+			*r = exp(a);
+			MX_FLOAT_CHECK(*r, isinf(a), 1);
+			break;
+		case MX_F_LN:
+		case MX_F_LOG:
+			if (a <= 0) return 0;
+			*r = func == MX_F_LN ? log(a) : log10(a);
+			MX_FLOAT_CHECK(*r, isinf(a), 1);
+			break;
+		case MX_F_FLOOR: *r = floor(a); break;
+		case MX_F_CEIL: *r = ceil(a); break;
+		case MX_F_ROUND: *r = rint(a); break;
+		case MX_F_TRUNC: *r = a >= 0 ? floor(a) : -floor(-a); break;
+		case MX_F_SIGN: *r = a > 0 ? 1.0 : (a < 0 ? -1.0 : 0.0); break;
+		case MX_F_DEGREES:
+			*r = a * (180.0 / M_PI);
+			MX_FLOAT_CHECK(*r, isinf(a), 1);
+			break;
+		case MX_F_RADIANS:
+			*r = a * (M_PI / 180.0);
+			MX_FLOAT_CHECK(*r, isinf(a), a == 0);
+			break;
+		default:
+			/* trigonometry: SQL rejects out of domain and non-finite input */
+			if (!isfinite(a) || ((func == MX_F_ASIN || func == MX_F_ACOS) && (a < -1 || a > 1)))
+				return 0;
+			switch (func) {
+				case MX_F_SIN: *r = sin(a); break;
+				case MX_F_COS: *r = cos(a); break;
+				case MX_F_TAN: *r = tan(a); break;
+				case MX_F_COT: *r = 1.0 / tan(a); break;
+				case MX_F_ASIN: *r = asin(a); break;
+				case MX_F_ACOS: *r = acos(a); break;
+				case MX_F_ATAN: *r = atan(a); break;
+				case MX_F_ATAN2:
+					if (!isfinite(b)) return 0;
+					*r = atan2(a, b);
+					break;
+				default: return 0;
+			}
+			if (!isfinite(*r)) return 0;
+	}
+	return 1;
+}
+
+/**
+ * Evaluate a compiled expression for one pixel.
+ *
+ * @param mexpr : compiled expression
+ * @param kwval : value of each keyword, int4 keywords as whole numbers
+ * @param kwnull : for each keyword, non-zero if its value is NULL
+ * @param value : result
+ * @param isnull : set to 1 if the result is NULL
+ *
+ * @return 1 on success, 0 if SQL would not just return a value here
+ * (error, NaN comparison...) and the pixel must be evaluated through SQL
+ */
+int
+rt_mapexpr_eval(
+	rt_mapexpr mexpr,
+	const double *kwval, const uint8_t *kwnull,
+	double *value, int *isnull
+) {
+	double *v = mexpr->val;
+	uint8_t *n = mexpr->isnull;
+	int sp = 0;
+	int pc = 0;
+	double a, b, r;
+	int i;
+
+	while (pc < mexpr->count) {
+		const struct rt_mapexpr_op_t *op = &mexpr->ops[pc++];
+
+		/* binary operators: pop b, NULL in gives NULL out */
+#define MX_BINARY \
+		sp--; \
+		if (n[sp - 1] || n[sp]) { \
+			n[sp - 1] = 1; \
+			break; \
+		} \
+		a = v[sp - 1]; \
+		b = v[sp];
+
+		switch (op->code) {
+			case MX_PUSH:
+				v[sp] = op->val;
+				n[sp++] = op->isnull;
+				break;
+			case MX_KW:
+				v[sp] = kwval[op->arg];
+				n[sp++] = kwnull[op->arg] ? 1 : 0;
+				break;
+
+			case MX_ADDI:
+				MX_BINARY
+				r = a + b;
+				MX_INT_CHECK(r);
+				v[sp - 1] = r;
+				break;
+			case MX_SUBI:
+				MX_BINARY
+				r = a - b;
+				MX_INT_CHECK(r);
+				v[sp - 1] = r;
+				break;
+			case MX_MULI:
+				MX_BINARY
+				r = a * b;
+				MX_INT_CHECK(r);
+				v[sp - 1] = r;
+				break;
+			case MX_DIVI:
+				MX_BINARY
+				if (b == 0) return 0;
+				r = trunc(a / b);
+				MX_INT_CHECK(r);
+				v[sp - 1] = r;
+				break;
+			case MX_MODI:
+				MX_BINARY
+				if (b == 0) return 0;
+				v[sp - 1] = (double) ((int64_t) a % (int64_t) b);
+				break;
+			case MX_NEGI:
+				if (n[sp - 1]) break;
+				MX_INT_CHECK(-v[sp - 1]);
+				v[sp - 1] = -v[sp - 1];
+				break;
+			case MX_ABSI:
+				if (n[sp - 1]) break;
+				MX_INT_CHECK(fabs(v[sp - 1]));
+				v[sp - 1] = fabs(v[sp - 1]);
+				break;
+
+			case MX_ADDF:
+				MX_BINARY
+				r = a + b;
+				MX_FLOAT_CHECK(r, isinf(a) || isinf(b), 1);
+				v[sp - 1] = r;
+				break;
+			case MX_SUBF:
+				MX_BINARY
+				r = a - b;
+				MX_FLOAT_CHECK(r, isinf(a) || isinf(b), 1);
+				v[sp - 1] = r;
+				break;
+			case MX_MULF:
+				MX_BINARY
+				r = a * b;
+				MX_FLOAT_CHECK(r, isinf(a) || isinf(b), a == 0 || b == 0);
+				v[sp - 1] = r;
+				break;
+			case MX_DIVF:
+				MX_BINARY
+				if (b == 0) return 0;
+				r = a / b;
+				MX_FLOAT_CHECK(r, isinf(a), a == 0);
+				v[sp - 1] = r;
+				break;
+			case MX_NEGF:
+				if (!n[sp - 1])
+					v[sp - 1] = -v[sp - 1];
+				break;
+			case MX_POWF:
+				MX_BINARY
+				if ((a == 0 && b < 0) || (a < 0 && floor(b) != b))
+					return 0;
+				r = pow(a, b);
+				MX_FLOAT_CHECK(r, isinf(a) || isinf(b), a == 0);
+				v[sp - 1] = r;
+				break;
+			case MX_FUNC:
+				if (op->arg == MX_F_ATAN2) {
+					MX_BINARY
+				}
+				else {
+					if (n[sp - 1]) break;
+					a = v[sp - 1];
+					b = 0;
+				}
+				if (!mx_eval_func(op->arg, a, b, &r))
+					return 0;
+				v[sp - 1] = r;
+				break;
+			case MX_TOINT:
+				if (n[sp - 1]) break;
+				/* SQL checks the range before rounding */
+				if (isnan(v[sp - 1])) return 0;
+				MX_INT_CHECK(v[sp - 1]);
+				r = rint(v[sp - 1]);
+				MX_INT_CHECK(r);
+				v[sp - 1] = r;
+				break;
+
+			/* SQL orders NaN above everything, leave that to SQL */
+#define MX_COMPARE(expr) \
+				MX_BINARY \
+				if (isnan(a) || isnan(b)) return 0; \
+				v[sp - 1] = (expr) ? 1 : 0;
+			case MX_EQ: MX_COMPARE(a == b) break;
+			case MX_NE: MX_COMPARE(a != b) break;
+			case MX_LT: MX_COMPARE(a < b) break;
+			case MX_LE: MX_COMPARE(a <= b) break;
+			case MX_GT: MX_COMPARE(a > b) break;
+			case MX_GE: MX_COMPARE(a >= b) break;
+#undef MX_COMPARE
+
+			/* three-valued logic: FALSE wins over NULL for AND, TRUE for OR */
+			case MX_AND:
+				sp--;
+				if ((!n[sp - 1] && v[sp - 1] == 0) || (!n[sp] && v[sp] == 0)) {
+					v[sp - 1] = 0;
+					n[sp - 1] = 0;
+				}
+				else if (n[sp - 1] || n[sp])
+					n[sp - 1] = 1;
+				else
+					v[sp - 1] = 1;
+				break;
+			case MX_OR:
+				sp--;
+				if ((!n[sp - 1] && v[sp - 1] != 0) || (!n[sp] && v[sp] != 0)) {
+					v[sp - 1] = 1;
+					n[sp - 1] = 0;
+				}
+				else if (n[sp - 1] || n[sp])
+					n[sp - 1] = 1;
+				else
+					v[sp - 1] = 0;
+				break;
+			case MX_NOT:
+				if (!n[sp - 1])
+					v[sp - 1] = v[sp - 1] == 0 ? 1 : 0;
+				break;
+			case MX_ISNULL:
+				v[sp - 1] = n[sp - 1] ? 1 : 0;
+				n[sp - 1] = 0;
+				break;
+			case MX_NOTNULL:
+				v[sp - 1] = n[sp - 1] ? 0 : 1;
+				n[sp - 1] = 0;
+				break;
+
+			/* NULL arguments are skipped, NULL only if all are */
+			case MX_GREATEST:
+			case MX_LEAST:
+			case MX_COALESCE: {
+				int first = sp - op->arg;
+				int found = 0;
+				r = 0;
+				for (i = first; i < sp; i++) {
+					if (n[i]) continue;
+					if (isnan(v[i]) && op->code != MX_COALESCE) return 0;
+					if (!found ||
+						(op->code == MX_GREATEST && v[i] > r) ||
+						(op->code == MX_LEAST && v[i] < r)) {
+						r = v[i];
+						found = 1;
+						if (op->code == MX_COALESCE)
+							break;
+					}
+				}
+				sp = first + 1;
+				v[first] = r;
+				n[first] = found ? 0 : 1;
+				break;
+			}
+
+			case MX_DUP:
+				v[sp] = v[sp - 1];
+				n[sp] = n[sp - 1];
+				sp++;
+				break;
+			case MX_POP:
+				sp--;
+				break;
+			case MX_JMP:
+				pc = op->arg;
+				break;
+			case MX_JMPF:
+				sp--;
+				if (n[sp] || v[sp] == 0)
+					pc = op->arg;
+				break;
+		}
+#undef MX_BINARY
+	}
+
+	*value = v[0];
+	*isnull = n[0];
+	return 1;
+}
@@ -2681,6 +2681,9 @@ struct _rti_rasterize_arg_t {
 	uint8_t *hasnodata;
 	double *value;
 	int *bandlist;
+
+	LWGEOM *geom; /* set if burned without GDAL */
+	rt_raster burn;
 };
 
 static _rti_rasterize_arg
@@ -2706,6 +2709,9 @@ _rti_rasterize_arg_init() {
 	arg->value = NULL;
 	arg->bandlist = NULL;
 
+	arg->geom = NULL;
+	arg->burn = NULL;
+
 	return arg;
 }
 
@@ -2730,9 +2736,59 @@ _rti_rasterize_arg_destroy(_rti_rasterize_arg arg) {
 	if (arg->src_sr != NULL)
 		OSRDestroySpatialReference(arg->src_sr);
 
+	if (arg->geom != NULL)
+		lwgeom_free(arg->geom);
+
 	rtdealloc(arg);
 }
 
+/*
+ * polygons are burned by rt_raster_rasterize_lwgeom, other geometries
+ * and options other than ALL_TOUCHED go through GDAL
+ */
+static int
+_rti_rasterize_native(LWGEOM *geom, char **options, rt_rasterize_mode *mode) {
+	*mode = RT_RASTERIZE_CENTER;
+
+	if (geom->type != POLYGONTYPE && geom->type != MULTIPOLYGONTYPE)
+		return 0;
+
+	if (options != NULL) {
+		for (; *options != NULL; options++) {
+			if (strncasecmp(*options, "ALL_TOUCHED=", strlen("ALL_TOUCHED=")) != 0)
+				return 0;
+
+			if (strcasecmp(*options + strlen("ALL_TOUCHED="), "TRUE") == 0)
+				*mode = RT_RASTERIZE_ALL_TOUCHED;
+			else
+				*mode = RT_RASTERIZE_CENTER;
+		}
+	}
+
+	return 1;
+}
+
+static rt_errorstate
+_rti_rasterize_burn(void *userarg, int y, int x, int count, const double *fraction) {
+	_rti_rasterize_arg arg = (_rti_rasterize_arg) userarg;
+	rt_band band = NULL;
+	uint32_t i;
+	int j;
+
+	for (i = 0; i < arg->numbands; i++) {
+		band = rt_raster_get_band(arg->burn, i);
+
+		for (j = 0; j < count; j++) {
+			if (rt_band_set_pixel(band, x + j, y, arg->value[i], NULL) != ES_NONE) {
+				rterror("_rti_rasterize_burn: Could not set pixel value");
+				return ES_ERROR;
+			}
+		}
+	}
+
+	return ES_NONE;
+}
+
 /**
  * Return a raster of the provided geometry
  *
@@ -2784,10 +2840,12 @@ rt_raster_gdal_rasterize(
 	double _skew[2] = {0};
 
 	OGRErr ogrerr;
-	OGRGeometryH src_geom;
+	OGRGeometryH src_geom = NULL;
 	OGREnvelope src_env;
 	rt_envelope extent;
 	OGRwkbGeometryType wkbtype = wkbUnknown;
+	rt_rasterize_mode mode = RT_RASTERIZE_CENTER;
+	GBOX gbox;
 
 	int ul_user = 0;
 
@@ -2852,41 +2910,76 @@ rt_raster_gdal_rasterize(
 		arg->value = value;
 	}
 
-	/* OGR spatial reference */
-	if (NULL != srs && strlen(srs)) {
-		arg->src_sr = OSRNewSpatialReference(NULL);
-		if (OSRSetFromUserInput(arg->src_sr, srs) != OGRERR_NONE) {
-			rterror("rt_raster_gdal_rasterize: Could not create OSR spatial reference using the provided srs: %s", srs);
+	/* polygons are burned without OGR and GDAL */
+	arg->geom = lwgeom_from_wkb(wkb, wkb_len, LW_PARSER_CHECK_NONE);
+	if (arg->geom != NULL && !_rti_rasterize_native(arg->geom, options, &mode)) {
+		lwgeom_free(arg->geom);
+		arg->geom = NULL;
+	}
+
+	if (arg->geom != NULL) {
+		/* geometry is empty */
+		if (lwgeom_is_empty(arg->geom)) {
+			rtinfo("Geometry provided is empty. Returning empty raster");
+
+			_rti_rasterize_arg_destroy(arg);
+
+			return rt_raster_new(0, 0);
+		}
+
+		/* get envelope */
+		if (lwgeom_calculate_gbox(arg->geom, &gbox) != LW_SUCCESS) {
+			rterror("rt_raster_gdal_rasterize: Could not compute envelope of geometry");
+
 			_rti_rasterize_arg_destroy(arg);
+
 			return NULL;
 		}
+
+		extent.MinX = gbox.xmin;
+		extent.MaxX = gbox.xmax;
+		extent.MinY = gbox.ymin;
+		extent.MaxY = gbox.ymax;
+		extent.UpperLeftX = gbox.xmin;
+		extent.UpperLeftY = gbox.ymax;
 	}
+	else {
+		/* OGR spatial reference */
+		if (NULL != srs && strlen(srs)) {
+			arg->src_sr = OSRNewSpatialReference(NULL);
+			if (OSRSetFromUserInput(arg->src_sr, srs) != OGRERR_NONE) {
+				rterror("rt_raster_gdal_rasterize: Could not create OSR spatial reference using the provided srs: %s", srs);
+				_rti_rasterize_arg_destroy(arg);
+				return NULL;
+			}
+		}
 
-	/* convert WKB to OGR Geometry */
-	ogrerr = OGR_G_CreateFromWkb((unsigned char *) wkb, arg->src_sr, &src_geom, wkb_len);
-	if (ogrerr != OGRERR_NONE) {
-		rterror("rt_raster_gdal_rasterize: Could not create OGR Geometry from WKB");
+		/* convert WKB to OGR Geometry */
+		ogrerr = OGR_G_CreateFromWkb((unsigned char *) wkb, arg->src_sr, &src_geom, wkb_len);
+		if (ogrerr != OGRERR_NONE) {
+			rterror("rt_raster_gdal_rasterize: Could not create OGR Geometry from WKB");
 
-		_rti_rasterize_arg_destroy(arg);
-		/* OGRCleanupAll(); */
+			_rti_rasterize_arg_destroy(arg);
+			/* OGRCleanupAll(); */
 
-		return NULL;
-	}
+			return NULL;
+		}
 
-	/* OGR Geometry is empty */
-	if (OGR_G_IsEmpty(src_geom)) {
-		rtinfo("Geometry provided is empty. Returning empty raster");
+		/* OGR Geometry is empty */
+		if (OGR_G_IsEmpty(src_geom)) {
+			rtinfo("Geometry provided is empty. Returning empty raster");
 
-		OGR_G_DestroyGeometry(src_geom);
-		_rti_rasterize_arg_destroy(arg);
-		/* OGRCleanupAll(); */
+			OGR_G_DestroyGeometry(src_geom);
+			_rti_rasterize_arg_destroy(arg);
+			/* OGRCleanupAll(); */
 
-		return rt_raster_new(0, 0);
-	}
+			return rt_raster_new(0, 0);
+		}
 
-	/* get envelope */
-	OGR_G_GetEnvelope(src_geom, &src_env);
-	rt_util_from_ogr_envelope(src_env, &extent);
+		/* get envelope */
+		OGR_G_GetEnvelope(src_geom, &src_env);
+		rt_util_from_ogr_envelope(src_env, &extent);
+	}
 
 	RASTER_DEBUGF(3, "Suggested raster envelope: %f, %f, %f, %f",
 		extent.MinX, extent.MinY, extent.MaxX, extent.MaxY);
@@ -2967,7 +3060,8 @@ rt_raster_gdal_rasterize(
 		a whole pixel is used instead of half-pixel due to backward
 		compatibility with GDAL 1.6, 1.7 and 1.8.  1.9+ works fine with half-pixel.
 	*/
-	wkbtype = wkbFlatten(OGR_G_GetGeometryType(src_geom));
+	if (src_geom != NULL)
+		wkbtype = wkbFlatten(OGR_G_GetGeometryType(src_geom));
 	if ((
 			(wkbtype == wkbPoint) ||
 			(wkbtype == wkbMultiPoint) ||
@@ -3417,6 +3511,48 @@ rt_raster_gdal_rasterize(
 	RASTER_DEBUGF(3, "Raster dimensions (width x height): %d x %d",
 		_dim[0], _dim[1]);
 
+	/* burn polygon without GDAL */
+	if (arg->geom != NULL) {
+		RASTER_DEBUG(3, "Rasterizing polygon without GDAL");
+
+		rast = rt_raster_new(_dim[0], _dim[1]);
+		if (rast == NULL) {
+			rterror("rt_raster_gdal_rasterize: Out of memory allocating output raster");
+			_rti_rasterize_arg_destroy(arg);
+			return NULL;
+		}
+		rt_raster_set_geotransform_matrix(rast, _gt);
+
+		for (i = 0; i < arg->numbands; i++) {
+			if (rt_raster_generate_new_band(
+				rast,
+				arg->pixtype[i],
+				arg->init[i],
+				arg->hasnodata[i], arg->nodata[i],
+				i
+			) < 0) {
+				rterror("rt_raster_gdal_rasterize: Could not add band to output raster");
+				rt_raster_destroy(rast);
+				_rti_rasterize_arg_destroy(arg);
+				return NULL;
+			}
+		}
+
+		arg->burn = rast;
+		if (rt_raster_rasterize_lwgeom(rast, arg->geom, mode, _rti_rasterize_burn, arg) != ES_NONE) {
+			rterror("rt_raster_gdal_rasterize: Could not rasterize geometry");
+			rt_raster_destroy(rast);
+			_rti_rasterize_arg_destroy(arg);
+			return NULL;
+		}
+
+		_rti_rasterize_arg_destroy(arg);
+
+		RASTER_DEBUG(3, "done");
+
+		return rast;
+	}
+
 	/* load GDAL mem */
 	if (!rt_util_gdal_driver_registered("MEM")) {
 		RASTER_DEBUG(4, "Registering MEM driver");
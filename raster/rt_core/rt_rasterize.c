@@ -0,0 +1,507 @@
+/*
+ *
+ * WKTRaster - Raster Types for PostGIS
+ * http://trac.osgeo.org/postgis/wiki/WKTRaster
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "librtcore.h"
+#include "librtcore_internal.h"
+
+/******************************************************************************
+* Scanline rasterization of polygons
+*
+* The rings are transformed to cell space with the inverse geotransform of
+* the raster, where a pixel is the unit square [x, x + 1) x [y, y + 1), and
+* cut into edges sorted by their top end. Rows are walked top-down with a
+* table of the edges overlapping the row:
+*
+*   RT_RASTERIZE_CENTER: the edges are intersected with the line through
+*     the centers of the row and the spans between pairs of crossings are
+*     filled (even-odd rule), the same as GDALRasterizeGeometries
+*   RT_RASTERIZE_ALL_TOUCHED: as above, plus every pixel crossed by an edge
+*   RT_RASTERIZE_COVERAGE: the signed area swept by each edge is accumulated
+*     per pixel, which sums to the fraction of the pixel inside the polygon
+*
+* Each row is handed to the callback as runs of consecutive pixels with a
+* non-zero fraction.
+******************************************************************************/
+
+typedef struct {
+	double x0; /* top end, y0 <= y1 */
+	double y0;
+	double x1;
+	double y1;
+	double dir; /* +1 if the edge covers to its right, -1 otherwise */
+} _rti_rasterize_edge;
+
+typedef struct {
+	_rti_rasterize_edge *edge;
+	uint32_t numedge;
+	uint32_t maxedge;
+} _rti_rasterize_edges;
+
+static int
+_rti_rasterize_edge_cmp(const void *a, const void *b) {
+	const _rti_rasterize_edge *ea = (const _rti_rasterize_edge *) a;
+	const _rti_rasterize_edge *eb = (const _rti_rasterize_edge *) b;
+
+	if (ea->y0 < eb->y0) return -1;
+	if (ea->y0 > eb->y0) return 1;
+	return 0;
+}
+
+static int
+_rti_rasterize_double_cmp(const void *a, const void *b) {
+	double da = *((const double *) a);
+	double db = *((const double *) b);
+
+	if (da < db) return -1;
+	if (da > db) return 1;
+	return 0;
+}
+
+static void
+_rti_rasterize_to_cell(const double *igt, const POINT2D *p, double *x, double *y) {
+	*x = igt[0] + igt[1] * p->x + igt[2] * p->y;
+	*y = igt[3] + igt[4] * p->x + igt[5] * p->y;
+}
+
+static rt_errorstate
+_rti_rasterize_add_ring(
+	_rti_rasterize_edges *edges,
+	const POINTARRAY *pa, int hole,
+	const double *igt
+) {
+	double area = 0;
+	double sign;
+	double x0, y0;
+	double x1, y1;
+	uint32_t i;
+
+	if (pa == NULL || pa->npoints < 3)
+		return ES_NONE;
+
+	if (edges->numedge + pa->npoints > edges->maxedge) {
+		uint32_t maxedge = edges->maxedge ? edges->maxedge : 64;
+
+		while (maxedge < edges->numedge + pa->npoints)
+			maxedge *= 2;
+
+		edges->edge = (_rti_rasterize_edge *) rtrealloc(edges->edge, sizeof(_rti_rasterize_edge) * maxedge);
+		if (edges->edge == NULL) {
+			rterror("_rti_rasterize_add_ring: Could not allocate memory for edges");
+			return ES_ERROR;
+		}
+		edges->maxedge = maxedge;
+	}
+
+	/* orientation of the ring in cell space, where y goes down */
+	_rti_rasterize_to_cell(igt, getPoint2d_cp(pa, 0), &x0, &y0);
+	for (i = 1; i < pa->npoints; i++) {
+		_rti_rasterize_to_cell(igt, getPoint2d_cp(pa, i), &x1, &y1);
+		area += x0 * y1 - x1 * y0;
+		x0 = x1;
+		y0 = y1;
+	}
+
+	/* shells cover positively, holes negatively */
+	sign = (area < 0) ? 1 : -1;
+	if (hole)
+		sign = -sign;
+
+	_rti_rasterize_to_cell(igt, getPoint2d_cp(pa, 0), &x0, &y0);
+	for (i = 1; i < pa->npoints; i++) {
+		_rti_rasterize_edge *edge = &(edges->edge[edges->numedge]);
+
+		_rti_rasterize_to_cell(igt, getPoint2d_cp(pa, i), &x1, &y1);
+
+		if (FLT_NEQ(x0, x1) || FLT_NEQ(y0, y1)) {
+			if (y0 <= y1) {
+				edge->x0 = x0;
+				edge->y0 = y0;
+				edge->x1 = x1;
+				edge->y1 = y1;
+				edge->dir = sign;
+			}
+			else {
+				edge->x0 = x1;
+				edge->y0 = y1;
+				edge->x1 = x0;
+				edge->y1 = y0;
+				edge->dir = -sign;
+			}
+			edges->numedge++;
+		}
+
+		x0 = x1;
+		y0 = y1;
+	}
+
+	return ES_NONE;
+}
+
+static rt_errorstate
+_rti_rasterize_add_geom(
+	_rti_rasterize_edges *edges,
+	const LWGEOM *geom,
+	const double *igt
+) {
+	uint32_t i;
+
+	switch (geom->type) {
+		case POLYGONTYPE: {
+			const LWPOLY *poly = (const LWPOLY *) geom;
+
+			for (i = 0; i < poly->nrings; i++) {
+				if (_rti_rasterize_add_ring(edges, poly->rings[i], i > 0, igt) != ES_NONE)
+					return ES_ERROR;
+			}
+			break;
+		}
+		case MULTIPOLYGONTYPE:
+		case COLLECTIONTYPE: {
+			const LWCOLLECTION *col = (const LWCOLLECTION *) geom;
+
+			for (i = 0; i < col->ngeoms; i++) {
+				if (_rti_rasterize_add_geom(edges, col->geoms[i], igt) != ES_NONE)
+					return ES_ERROR;
+			}
+			break;
+		}
+		default:
+			rterror("_rti_rasterize_add_geom: Unsupported geometry type %s", lwtype_name(geom->type));
+			return ES_ERROR;
+	}
+
+	return ES_NONE;
+}
+
+/* x of edge at y, y within the edge */
+static double
+_rti_rasterize_edge_x(const _rti_rasterize_edge *edge, double y) {
+	if (y <= edge->y0) return edge->x0;
+	if (y >= edge->y1) return edge->x1;
+	return edge->x0 + (y - edge->y0) * (edge->x1 - edge->x0) / (edge->y1 - edge->y0);
+}
+
+/* mark the columns [c0, c1) of the row */
+static void
+_rti_rasterize_fill(double *row, int width, double c0, double c1, int *cmin, int *cmax) {
+	int x0;
+	int x1;
+	int x;
+
+	if (c0 < 0) c0 = 0;
+	if (c1 > width) c1 = width;
+	if (c1 <= c0)
+		return;
+
+	x0 = (int) c0;
+	x1 = (int) c1;
+	for (x = x0; x < x1; x++)
+		row[x] = 1;
+
+	if (x0 < *cmin) *cmin = x0;
+	if (x1 - 1 > *cmax) *cmax = x1 - 1;
+}
+
+/* add the area swept right of the piece of edge [xa, xb], dy high, to the cells of the row */
+static void
+_rti_rasterize_sweep(double *row, int width, double xa, double xb, double dy, int *cmin, int *cmax) {
+	double u;
+	double v;
+	double xm;
+	double f;
+	int c;
+
+	if (xa > xb) {
+		u = xa;
+		xa = xb;
+		xb = u;
+	}
+
+	/* left of the raster, covers the whole row */
+	if (xa < 0) {
+		v = (xb < 0) ? xb : 0;
+		if (xb > xa)
+			row[0] += dy * (v - xa) / (xb - xa);
+		else
+			row[0] += dy;
+		if (*cmin > 0) *cmin = 0;
+		if (*cmax < 0) *cmax = 0;
+		if (xb <= 0)
+			return;
+		dy -= dy * (v - xa) / (xb - xa);
+		xa = 0;
+	}
+
+	/* right of the raster only ends the row's running sum */
+	if (xb > width) {
+		if (xa >= width) {
+			if (*cmax < width) *cmax = width;
+			return;
+		}
+		dy *= (width - xa) / (xb - xa);
+		xb = width;
+	}
+
+	for (u = xa; ; u = v) {
+		v = floor(u) + 1;
+		if (v > xb) v = xb;
+
+		xm = (u + v) / 2.;
+		c = (int) xm;
+		if (c >= width) c = width - 1;
+		f = xm - c;
+
+		if (xb > xa) {
+			row[c] += dy * (v - u) / (xb - xa) * (1 - f);
+			row[c + 1] += dy * (v - u) / (xb - xa) * f;
+		}
+		else {
+			row[c] += dy * (1 - f);
+			row[c + 1] += dy * f;
+		}
+
+		if (c < *cmin) *cmin = c;
+		if (c + 1 > *cmax) *cmax = c + 1;
+
+		if (v >= xb)
+			break;
+	}
+}
+
+/**
+ * Rasterize a polygon or multipolygon on the grid of a raster
+ *
+ * @param raster : the raster whose grid is used, only its geotransform,
+ *   width and height are read
+ * @param geom : the polygonal geometry, in the coordinates of the raster
+ * @param mode : which pixels are under the geometry
+ * @param callback : called for each run of pixels under the geometry
+ * @param userarg : passed to callback
+ *
+ * @return ES_NONE if success, ES_ERROR if error
+ */
+rt_errorstate
+rt_raster_rasterize_lwgeom(
+	rt_raster raster,
+	const LWGEOM *geom,
+	rt_rasterize_mode mode,
+	rt_rasterize_callback callback, void *userarg
+) {
+	_rti_rasterize_edges edges = {NULL, 0, 0};
+	double igt[6] = {0};
+	uint32_t *active = NULL;
+	uint32_t numactive = 0;
+	uint32_t next = 0;
+	double *cross = NULL;
+	double *row = NULL;
+	double ymax = 0;
+	double cy;
+	double ya, yb;
+	int numcross;
+	int width;
+	int height;
+	int rowstart;
+	int rowend;
+	int cmin;
+	int cmax;
+	int r;
+	int c;
+	int start;
+	uint32_t i;
+	uint32_t j;
+	rt_errorstate err = ES_NONE;
+
+	assert(raster != NULL);
+	assert(geom != NULL);
+	assert(callback != NULL);
+
+	width = rt_raster_get_width(raster);
+	height = rt_raster_get_height(raster);
+	if (width < 1 || height < 1 || lwgeom_is_empty(geom))
+		return ES_NONE;
+
+	if (rt_raster_get_inverse_geotransform_matrix(raster, NULL, igt) != ES_NONE) {
+		rterror("rt_raster_rasterize_lwgeom: Could not get inverse geotransform matrix");
+		return ES_ERROR;
+	}
+
+	if (_rti_rasterize_add_geom(&edges, geom, igt) != ES_NONE) {
+		if (edges.edge != NULL) rtdealloc(edges.edge);
+		return ES_ERROR;
+	}
+	if (!edges.numedge) {
+		if (edges.edge != NULL) rtdealloc(edges.edge);
+		return ES_NONE;
+	}
+
+	qsort(edges.edge, edges.numedge, sizeof(_rti_rasterize_edge), _rti_rasterize_edge_cmp);
+	for (i = 0; i < edges.numedge; i++) {
+		if (edges.edge[i].y1 > ymax || i == 0)
+			ymax = edges.edge[i].y1;
+	}
+
+	/* rows touched by the geometry */
+	if (edges.edge[0].y0 >= height || ymax < 0) {
+		rtdealloc(edges.edge);
+		return ES_NONE;
+	}
+	rowstart = (edges.edge[0].y0 < 0) ? 0 : (int) edges.edge[0].y0;
+	rowend = (ymax >= height) ? height - 1 : (int) ymax;
+
+	active = (uint32_t *) rtalloc(sizeof(uint32_t) * edges.numedge);
+	cross = (double *) rtalloc(sizeof(double) * edges.numedge);
+	row = (double *) rtalloc(sizeof(double) * (width + 2));
+	if (active == NULL || cross == NULL || row == NULL) {
+		rterror("rt_raster_rasterize_lwgeom: Could not allocate memory for scanline");
+		if (active != NULL) rtdealloc(active);
+		if (cross != NULL) rtdealloc(cross);
+		if (row != NULL) rtdealloc(row);
+		rtdealloc(edges.edge);
+		return ES_ERROR;
+	}
+	memset(row, 0, sizeof(double) * (width + 2));
+
+	for (r = rowstart; r <= rowend; r++) {
+		/* edges starting above the bottom of the row */
+		while (next < edges.numedge && edges.edge[next].y0 < r + 1)
+			active[numactive++] = next++;
+
+		/* drop edges ending above the row */
+		for (i = 0, j = 0; i < numactive; i++) {
+			_rti_rasterize_edge *edge = &(edges.edge[active[i]]);
+
+			if (edge->y1 > r || (FLT_EQ(edge->y0, edge->y1) && edge->y0 >= r))
+				active[j++] = active[i];
+		}
+		numactive = j;
+
+		cmin = width;
+		cmax = -1;
+
+		if (mode == RT_RASTERIZE_COVERAGE) {
+			for (i = 0; i < numactive; i++) {
+				_rti_rasterize_edge *edge = &(edges.edge[active[i]]);
+
+				if (edge->y1 <= r || edge->y0 >= r + 1 || FLT_EQ(edge->y0, edge->y1))
+					continue;
+
+				ya = (edge->y0 > r) ? edge->y0 : r;
+				yb = (edge->y1 < r + 1) ? edge->y1 : r + 1;
+				_rti_rasterize_sweep(
+					row, width,
+					_rti_rasterize_edge_x(edge, ya), _rti_rasterize_edge_x(edge, yb),
+					(yb - ya) * edge->dir,
+					&cmin, &cmax
+				);
+			}
+
+			/* running sum of the swept areas is the coverage */
+			if (cmax >= width) cmax = width - 1;
+			for (c = cmin, cy = 0; c <= cmax; c++) {
+				cy += row[c];
+				if (cy > 1 - FLT_EPSILON)
+					row[c] = 1;
+				else if (cy < FLT_EPSILON)
+					row[c] = 0;
+				else
+					row[c] = cy;
+			}
+			row[width] = 0;
+			row[width + 1] = 0;
+		}
+		else {
+			/* crossings with the line through the centers of the row */
+			cy = r + 0.5;
+			numcross = 0;
+			for (i = 0; i < numactive; i++) {
+				_rti_rasterize_edge *edge = &(edges.edge[active[i]]);
+
+				if (edge->y0 <= cy && cy < edge->y1)
+					cross[numcross++] = _rti_rasterize_edge_x(edge, cy);
+			}
+			if (numcross > 1)
+				qsort(cross, numcross, sizeof(double), _rti_rasterize_double_cmp);
+
+			for (c = 0; c + 1 < numcross; c += 2)
+				_rti_rasterize_fill(row, width, floor(cross[c] + 0.5), floor(cross[c + 1] + 0.5), &cmin, &cmax);
+
+			/* pixels crossed by the edges */
+			if (mode == RT_RASTERIZE_ALL_TOUCHED) {
+				for (i = 0; i < numactive; i++) {
+					_rti_rasterize_edge *edge = &(edges.edge[active[i]]);
+					double xa;
+					double xb;
+
+					if (FLT_EQ(edge->y0, edge->y1)) {
+						if (edge->y0 < r || edge->y0 >= r + 1)
+							continue;
+						xa = edge->x0;
+						xb = edge->x1;
+					}
+					else {
+						if (edge->y1 <= r || edge->y0 >= r + 1)
+							continue;
+						ya = (edge->y0 > r) ? edge->y0 : r;
+						yb = (edge->y1 < r + 1) ? edge->y1 : r + 1;
+						xa = _rti_rasterize_edge_x(edge, ya);
+						xb = _rti_rasterize_edge_x(edge, yb);
+					}
+					if (xa > xb) {
+						cy = xa;
+						xa = xb;
+						xb = cy;
+					}
+
+					/* an edge on the right border of a pixel does not touch the next one */
+					cy = floor(xb) + 1;
+					if (xb > xa && FLT_EQ(xb, floor(xb)))
+						cy = floor(xb);
+					_rti_rasterize_fill(row, width, floor(xa), cy, &cmin, &cmax);
+				}
+			}
+		}
+
+		/* hand runs of covered pixels to the callback */
+		for (c = cmin; c <= cmax && err == ES_NONE; c++) {
+			if (row[c] <= 0)
+				continue;
+
+			start = c;
+			while (c + 1 <= cmax && row[c + 1] > 0)
+				c++;
+
+			err = callback(userarg, r, start, c - start + 1, row + start);
+		}
+
+		for (c = cmin; c <= cmax; c++)
+			row[c] = 0;
+
+		if (err != ES_NONE)
+			break;
+	}
+
+	rtdealloc(row);
+	rtdealloc(cross);
+	rtdealloc(active);
+	rtdealloc(edges.edge);
+
+	return err;
+}
@@ -459,7 +459,7 @@ write_float64(uint8_t** to, uint8_t littleEndian, double v) {
 */
 
 static uint32_t
-rt_raster_serialized_size(rt_raster raster) {
+rt_raster_serialized_size(rt_raster raster, const uint32_t *packedsize) {
 	uint32_t size = sizeof (struct rt_raster_serialized_t);
 	uint16_t i = 0;
 
@@ -494,6 +494,10 @@ rt_raster_serialized_size(rt_raster raster) {
 			/* Add space for null-terminated path */
 			size += strlen(band->data.offline.path) + 1;
 		}
+		else if (packedsize[i]) {
+			/* Add space for compressed band data */
+			size += packedsize[i];
+		}
 		else {
 			/* Add space for raster band data */
 			size += pixbytes * raster->width * raster->height;
@@ -526,13 +530,42 @@ rt_raster_serialize(rt_raster raster) {
 	uint8_t* ret = NULL;
 	uint8_t* ptr = NULL;
 	uint16_t i = 0;
+	uint8_t **packed = NULL;
+	uint32_t *packedsize = NULL;
 
 	//assert(NULL != raster);
 	if (NULL == raster) {
 		rterror("rt_raster_serialize: raster cannot be NULL.");
 	}
 
-	size = rt_raster_serialized_size(raster);
+	/* Compress bands first, the size of their data is only known afterwards */
+	packed = (uint8_t **) rtalloc(sizeof(uint8_t *) * (raster->numBands + 1));
+	packedsize = (uint32_t *) rtalloc(sizeof(uint32_t) * (raster->numBands + 1));
+	if (packed == NULL || packedsize == NULL) {
+		rterror("rt_raster_serialize: Out of memory allocating compressed band registry");
+		return NULL;
+	}
+	for (i = 0; i < raster->numBands; ++i) {
+		rt_band band = raster->bands[i];
+
+		packed[i] = NULL;
+		packedsize[i] = 0;
+		if (band->offline || band->compression == RT_COMPRESSION_NONE)
+			continue;
+
+		packed[i] = rt_band_compress(band, &(packedsize[i]));
+		if (packed[i] == NULL) {
+			rterror("rt_raster_serialize: Could not compress band %d", i);
+			while (i > 0) {
+				if (packed[--i] != NULL) rtdealloc(packed[i]);
+			}
+			rtdealloc(packed);
+			rtdealloc(packedsize);
+			return NULL;
+		}
+	}
+
+	size = rt_raster_serialized_size(raster, packedsize);
 	ret = (uint8_t*) rtalloc(size);
 	if (!ret) {
 		rterror("rt_raster_serialize: Out of memory allocating %d bytes for serializing a raster", size);
@@ -602,6 +635,10 @@ rt_raster_serialize(rt_raster raster) {
 			*ptr |= BANDTYPE_FLAG_ISNODATA;
 		}
 
+		if (packed[i] != NULL) {
+			*ptr |= BANDTYPE_FLAG_COMPRESSED;
+		}
+
 #if POSTGIS_DEBUG_LEVEL > 2
 		d_print_binary_hex("PIXTYPE", dbg_ptr, size);
 #endif
@@ -695,10 +732,22 @@ rt_raster_serialize(rt_raster raster) {
 			strcpy((char*) ptr, band->data.offline.path);
 			ptr += strlen(band->data.offline.path) + 1;
 		}
+		else if (packed[i] != NULL) {
+			/* Write compressed data */
+			memcpy(ptr, packed[i], packedsize[i]);
+			ptr += packedsize[i];
+			rtdealloc(packed[i]);
+		}
 		else {
 			/* Write data */
 			uint32_t datasize = raster->width * raster->height * pixbytes;
-			memcpy(ptr, band->data.mem, datasize);
+			void *data = rt_band_get_data(band);
+			if (data == NULL) {
+				rterror("rt_raster_serialize: Could not get band data");
+				rtdealloc(ret);
+				return NULL;
+			}
+			memcpy(ptr, data, datasize);
 			ptr += datasize;
 		}
 
@@ -716,6 +765,9 @@ rt_raster_serialize(rt_raster raster) {
 		assert(!((ptr - ret) % pixbytes));
 	} /* for-loop over bands */
 
+	rtdealloc(packed);
+	rtdealloc(packedsize);
+
 #if POSTGIS_DEBUG_LEVEL > 2
 		d_print_binary_hex("SERIALIZED RASTER", dbg_ptr, size);
 #endif
@@ -817,6 +869,8 @@ rt_raster_deserialize(void* serialized, int header_only) {
 		band->width = rast->width;
 		band->height = rast->height;
 		band->ownsdata = 0; /* we do NOT own this data!!! */
+		band->compression = RT_COMPRESSION_NONE;
+		band->blocks = NULL;
 		band->raster = rast;
 
 		/* Advance by data padding */
@@ -906,6 +960,17 @@ rt_raster_deserialize(void* serialized, int header_only) {
 
 			band->data.offline.mem = NULL;
 		}
+		else if (BANDTYPE_IS_COMPRESSED(type)) {
+			/* Register compressed data, decompressed on access */
+			const uint32_t datasize = rt_band_load_blocks(band, ptr);
+			if (!datasize) {
+				rterror("rt_raster_deserialize: Could not read compressed band data");
+				for (j = 0; j <= i; j++) rt_band_destroy(rast->bands[j]);
+				rt_raster_destroy(rast);
+				return NULL;
+			}
+			ptr += datasize;
+		}
 		else {
 			/* Register data */
 			const uint32_t datasize = rast->width * rast->height * pixbytes;
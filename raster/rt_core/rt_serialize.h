@@ -37,12 +37,13 @@
 #define BANDTYPE_FLAG_OFFDB     (1<<7)
 #define BANDTYPE_FLAG_HASNODATA (1<<6)
 #define BANDTYPE_FLAG_ISNODATA  (1<<5)
-#define BANDTYPE_FLAG_RESERVED3 (1<<4)
+#define BANDTYPE_FLAG_COMPRESSED (1<<4)
 
 #define BANDTYPE_PIXTYPE(x) ((x)&BANDTYPE_PIXTYPE_MASK)
 #define BANDTYPE_IS_OFFDB(x) ((x)&BANDTYPE_FLAG_OFFDB)
 #define BANDTYPE_HAS_NODATA(x) ((x)&BANDTYPE_FLAG_HASNODATA)
 #define BANDTYPE_IS_NODATA(x) ((x)&BANDTYPE_FLAG_ISNODATA)
+#define BANDTYPE_IS_COMPRESSED(x) ((x)&BANDTYPE_FLAG_COMPRESSED)
 
 #if POSTGIS_DEBUG_LEVEL > 2
 char*
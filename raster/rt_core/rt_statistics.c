@@ -89,6 +89,400 @@ static void quicksort(double *left, double *right) {
 	}
 }
 
+/******************************************************************************
+* summary stats kernels
+******************************************************************************/
+
+/*
+	pixels are reduced in blocks. within a block each of RT_STATS_LANES
+	lanes keeps its own sums so that the inner loop has no dependency
+	between consecutive pixels and can be vectorized. NODATA pixels are
+	masked out instead of branched around
+*/
+#define RT_STATS_LANES 8
+#define RT_STATS_BLOCK 4096
+
+/* moments of the pixels counted so far */
+typedef struct {
+	uint64_t count;
+	double sum;
+	double mean;
+	double Q; /* sum of squared differences from mean */
+	double min;
+	double max;
+} _rti_stats_moments;
+
+/* pixel values to mask out */
+typedef struct {
+	int exclude;
+	double val;
+	double val2;
+	int isnan;
+} _rti_stats_nodata;
+
+typedef void (*_rti_stats_kernel)(
+	const void *data, size_t len,
+	const _rti_stats_nodata *nodata,
+	_rti_stats_moments *acc
+);
+
+/*
+	merge the moments of a block of pixels into acc
+	Chan, Golub and LeVeque, "Updating Formulae and a Pairwise Algorithm
+	for Computing Sample Variances"
+*/
+static void
+_rti_stats_moments_merge(
+	_rti_stats_moments *acc,
+	uint64_t count, double sum, double mean, double Q,
+	double min, double max
+) {
+	uint64_t total;
+	double delta;
+
+	if (count < 1)
+		return;
+
+	if (acc->count < 1) {
+		acc->count = count;
+		acc->sum = sum;
+		acc->mean = mean;
+		acc->Q = Q;
+		acc->min = min;
+		acc->max = max;
+		return;
+	}
+
+	total = acc->count + count;
+	delta = mean - acc->mean;
+
+	acc->mean += delta * ((double) count / total);
+	acc->Q += Q + delta * delta * ((double) acc->count * count / total);
+	acc->count = total;
+	acc->sum += sum;
+
+	if (min < acc->min)
+		acc->min = min;
+	if (max > acc->max)
+		acc->max = max;
+}
+
+/*
+	8 and 16-bit integers: sums of values and squares are exact in int64
+	for a block, so the block variance is computed without cancellation
+*/
+#define RTI_STATS_KERNEL_EXACT(NAME, T, TMIN, TMAX) \
+static void \
+NAME( \
+	const void *data, size_t len, \
+	const _rti_stats_nodata *nodata, \
+	_rti_stats_moments *acc \
+) { \
+	const T *pix = (const T *) data; \
+	const int exclude = nodata->exclude; \
+	const T nd1 = exclude ? (T) nodata->val : 0; \
+	const T nd2 = exclude ? (T) nodata->val2 : 0; \
+	size_t start; \
+\
+	for (start = 0; start < len; start += RT_STATS_BLOCK) { \
+		const T *p = pix + start; \
+		size_t n = len - start < RT_STATS_BLOCK ? len - start : RT_STATS_BLOCK; \
+		int64_t s[RT_STATS_LANES] = {0}; \
+		int64_t q[RT_STATS_LANES] = {0}; \
+		int64_t c[RT_STATS_LANES] = {0}; \
+		T mn[RT_STATS_LANES]; \
+		T mx[RT_STATS_LANES]; \
+		int64_t bs = 0; \
+		int64_t bq = 0; \
+		int64_t bc = 0; \
+		T bmin = TMAX; \
+		T bmax = TMIN; \
+		size_t i; \
+		int l; \
+\
+		for (l = 0; l < RT_STATS_LANES; l++) { \
+			mn[l] = TMAX; \
+			mx[l] = TMIN; \
+		} \
+\
+		for (i = 0; i + RT_STATS_LANES <= n; i += RT_STATS_LANES) { \
+			for (l = 0; l < RT_STATS_LANES; l++) { \
+				const T v = p[i + l]; \
+				const int keep = !exclude | ((v != nd1) & (v != nd2)); \
+				const int64_t d = keep ? (int64_t) v : 0; \
+				s[l] += d; \
+				q[l] += d * d; \
+				c[l] += keep; \
+				mn[l] = (keep & (v < mn[l])) ? v : mn[l]; \
+				mx[l] = (keep & (v > mx[l])) ? v : mx[l]; \
+			} \
+		} \
+		for (; i < n; i++) { \
+			const T v = p[i]; \
+			const int keep = !exclude | ((v != nd1) & (v != nd2)); \
+			const int64_t d = keep ? (int64_t) v : 0; \
+			s[0] += d; \
+			q[0] += d * d; \
+			c[0] += keep; \
+			mn[0] = (keep & (v < mn[0])) ? v : mn[0]; \
+			mx[0] = (keep & (v > mx[0])) ? v : mx[0]; \
+		} \
+\
+		for (l = 0; l < RT_STATS_LANES; l++) { \
+			bs += s[l]; \
+			bq += q[l]; \
+			bc += c[l]; \
+			if (mn[l] < bmin) bmin = mn[l]; \
+			if (mx[l] > bmax) bmax = mx[l]; \
+		} \
+\
+		if (bc > 0) { \
+			_rti_stats_moments_merge( \
+				acc, bc, (double) bs, (double) bs / bc, \
+				(double) (bc * bq - bs * bs) / bc, \
+				bmin, bmax \
+			); \
+		} \
+	} \
+}
+
+/*
+	32-bit integers and floating point: sums in double of the differences
+	from a shift close to the mean, which keeps the block variance stable
+*/
+#define RTI_STATS_KERNEL_SHIFTED(NAME, T, IS_NODATA) \
+static void \
+NAME( \
+	const void *data, size_t len, \
+	const _rti_stats_nodata *nodata, \
+	_rti_stats_moments *acc \
+) { \
+	const T *pix = (const T *) data; \
+	const int exclude = nodata->exclude; \
+	const double nd1 = nodata->val; \
+	const double nd2 = nodata->val2; \
+	const int ndnan = nodata->isnan; \
+	size_t start; \
+\
+	(void) ndnan; \
+\
+	for (start = 0; start < len; start += RT_STATS_BLOCK) { \
+		const T *p = pix + start; \
+		size_t n = len - start < RT_STATS_BLOCK ? len - start : RT_STATS_BLOCK; \
+		double s[RT_STATS_LANES] = {0}; \
+		double q[RT_STATS_LANES] = {0}; \
+		double c[RT_STATS_LANES] = {0}; \
+		double mn[RT_STATS_LANES]; \
+		double mx[RT_STATS_LANES]; \
+		double shift = 0; \
+		double bs = 0; \
+		double bq = 0; \
+		double bc = 0; \
+		double bmin = HUGE_VAL; \
+		double bmax = -HUGE_VAL; \
+		size_t i; \
+		int l; \
+\
+		/* shift by the mean so far or the first value counted */ \
+		if (acc->count > 0) \
+			shift = acc->mean; \
+		else { \
+			for (i = 0; i < n; i++) { \
+				const double v = p[i]; \
+				if (!exclude || !(IS_NODATA(v))) { \
+					shift = v; \
+					break; \
+				} \
+			} \
+			if (i == n) \
+				continue; \
+		} \
+		if (!isfinite(shift)) \
+			shift = 0; \
+\
+		for (l = 0; l < RT_STATS_LANES; l++) { \
+			mn[l] = HUGE_VAL; \
+			mx[l] = -HUGE_VAL; \
+		} \
+\
+		for (i = 0; i + RT_STATS_LANES <= n; i += RT_STATS_LANES) { \
+			for (l = 0; l < RT_STATS_LANES; l++) { \
+				const double v = p[i + l]; \
+				const int keep = !exclude | !(IS_NODATA(v)); \
+				const double d = keep ? v - shift : 0.; \
+				s[l] += d; \
+				q[l] += d * d; \
+				c[l] += keep; \
+				mn[l] = (keep & (v < mn[l])) ? v : mn[l]; \
+				mx[l] = (keep & (v > mx[l])) ? v : mx[l]; \
+			} \
+		} \
+		for (; i < n; i++) { \
+			const double v = p[i]; \
+			const int keep = !exclude | !(IS_NODATA(v)); \
+			const double d = keep ? v - shift : 0.; \
+			s[0] += d; \
+			q[0] += d * d; \
+			c[0] += keep; \
+			mn[0] = (keep & (v < mn[0])) ? v : mn[0]; \
+			mx[0] = (keep & (v > mx[0])) ? v : mx[0]; \
+		} \
+\
+		for (l = 0; l < RT_STATS_LANES; l++) { \
+			bs += s[l]; \
+			bq += q[l]; \
+			bc += c[l]; \
+			if (mn[l] < bmin) bmin = mn[l]; \
+			if (mx[l] > bmax) bmax = mx[l]; \
+		} \
+\
+		if (bc > 0) { \
+			double Q = bq - bs * bs / bc; \
+			if (Q < 0) Q = 0; \
+			_rti_stats_moments_merge( \
+				acc, (uint64_t) bc, shift * bc + bs, shift + bs / bc, Q, \
+				bmin, bmax \
+			); \
+		} \
+	} \
+}
+
+/*
+	same tests as rt_band_clamped_value_is_nodata(), whose FLT_EQ() also
+	matches a NaN pixel to a NaN NODATA value; ndnan is that isnan(nd1)
+*/
+#define RTI_STATS_INT_IS_NODATA(v) (((v) == nd1) | ((v) == nd2))
+#define RTI_STATS_FLOAT_IS_NODATA(v) ( \
+	((v) == nd1) | ((v) == nd2) | \
+	(fabs((v) - nd1) <= FLT_EPSILON) | (fabs((v) - nd2) <= FLT_EPSILON) | \
+	(ndnan & ((v) != (v))) \
+)
+
+RTI_STATS_KERNEL_EXACT(_rti_stats_kernel_8BUI, uint8_t, 0, UINT8_MAX)
+RTI_STATS_KERNEL_EXACT(_rti_stats_kernel_8BSI, int8_t, INT8_MIN, INT8_MAX)
+RTI_STATS_KERNEL_EXACT(_rti_stats_kernel_16BUI, uint16_t, 0, UINT16_MAX)
+RTI_STATS_KERNEL_EXACT(_rti_stats_kernel_16BSI, int16_t, INT16_MIN, INT16_MAX)
+RTI_STATS_KERNEL_SHIFTED(_rti_stats_kernel_32BUI, uint32_t, RTI_STATS_INT_IS_NODATA)
+RTI_STATS_KERNEL_SHIFTED(_rti_stats_kernel_32BSI, int32_t, RTI_STATS_INT_IS_NODATA)
+RTI_STATS_KERNEL_SHIFTED(_rti_stats_kernel_32BF, float, RTI_STATS_FLOAT_IS_NODATA)
+RTI_STATS_KERNEL_SHIFTED(_rti_stats_kernel_64BF, double, RTI_STATS_FLOAT_IS_NODATA)
+
+/* clamp value to an integer pixel type */
+static double
+_rti_stats_clamp(rt_pixtype pixtype, double value) {
+	switch (pixtype) {
+		case PT_1BB:
+			return rt_util_clamp_to_1BB(value);
+		case PT_2BUI:
+			return rt_util_clamp_to_2BUI(value);
+		case PT_4BUI:
+			return rt_util_clamp_to_4BUI(value);
+		case PT_8BSI:
+			return rt_util_clamp_to_8BSI(value);
+		case PT_8BUI:
+			return rt_util_clamp_to_8BUI(value);
+		case PT_16BSI:
+			return rt_util_clamp_to_16BSI(value);
+		case PT_16BUI:
+			return rt_util_clamp_to_16BUI(value);
+		case PT_32BSI:
+			return rt_util_clamp_to_32BSI(value);
+		case PT_32BUI:
+			return rt_util_clamp_to_32BUI(value);
+		default:
+			return value;
+	}
+}
+
+/*
+	run the kernel for the band's pixel type over all of its pixels
+
+	@return 0 if the band's data cannot be scanned directly
+*/
+static int
+_rti_band_summary_stats_scan(
+	rt_band band, int exclude_nodata_value,
+	_rti_stats_moments *acc
+) {
+	_rti_stats_kernel kernel = NULL;
+	_rti_stats_nodata nodata;
+	void *data = NULL;
+
+	switch (band->pixtype) {
+		/* sub-byte types are stored one pixel per byte */
+		case PT_1BB:
+		case PT_2BUI:
+		case PT_4BUI:
+		case PT_8BUI:
+			kernel = _rti_stats_kernel_8BUI;
+			break;
+		case PT_8BSI:
+			kernel = _rti_stats_kernel_8BSI;
+			break;
+		case PT_16BUI:
+			kernel = _rti_stats_kernel_16BUI;
+			break;
+		case PT_16BSI:
+			kernel = _rti_stats_kernel_16BSI;
+			break;
+		case PT_32BUI:
+			kernel = _rti_stats_kernel_32BUI;
+			break;
+		case PT_32BSI:
+			kernel = _rti_stats_kernel_32BSI;
+			break;
+		case PT_32BF:
+			kernel = _rti_stats_kernel_32BF;
+			break;
+		case PT_64BF:
+			kernel = _rti_stats_kernel_64BF;
+			break;
+		default:
+			return 0;
+	}
+
+	data = rt_band_get_data(band);
+	if (data == NULL)
+		return 0;
+
+	nodata.exclude = exclude_nodata_value;
+	nodata.val = nodata.val2 = band->nodataval;
+	nodata.isnan = isnan(band->nodataval) ? 1 : 0;
+
+	if (exclude_nodata_value) {
+		switch (band->pixtype) {
+			case PT_32BF:
+				nodata.val2 = rt_util_clamp_to_32F(band->nodataval);
+				break;
+			case PT_64BF:
+				break;
+			/*
+				an integer pixel is NODATA if equal to the clamped NODATA
+				value or within FLT_EPSILON of the NODATA value
+			*/
+			default: {
+				double r = round(band->nodataval);
+
+				nodata.val = _rti_stats_clamp(band->pixtype, band->nodataval);
+				nodata.val2 = nodata.val;
+				if (
+					!isnan(r) &&
+					FLT_EQ(_rti_stats_clamp(band->pixtype, r), r) &&
+					rt_band_clamped_value_is_nodata(band, r)
+				) {
+					nodata.val2 = r;
+				}
+				break;
+			}
+		}
+	}
+
+	memset(acc, 0, sizeof(_rti_stats_moments));
+	kernel(data, (size_t) band->width * band->height, &nodata, acc);
+
+	return 1;
+}
+
 /******************************************************************************
 * rt_band_get_summary_stats()
 ******************************************************************************/
@@ -135,6 +529,8 @@ rt_band_get_summary_stats(
 	uint32_t k = 0;
 	double M = 0;
 	double Q = 0;
+	_rti_stats_moments moments;
+	int scanned = 0;
 
 #if POSTGIS_DEBUG_LEVEL > 0
 	clock_t start, stop;
@@ -272,7 +668,11 @@ rt_band_get_summary_stats(
 	stats->values = NULL;
 	stats->sorted = 0;
 
-	for (x = 0, j = 0, k = 0; x < band->width; x++) {
+	/* every pixel: type-specialized kernel over the band's data */
+	if (!do_sample && !inc_vals)
+		scanned = _rti_band_summary_stats_scan(band, exclude_nodata_value, &moments);
+
+	for (x = 0, j = 0, k = 0; !scanned && x < band->width; x++) {
 		y = -1;
 		diff = 0;
 
@@ -343,6 +743,33 @@ rt_band_get_summary_stats(
 		}
 	}
 
+	if (scanned) {
+		k = moments.count;
+		sum = moments.sum;
+		Q = moments.Q;
+		if (k > 0) {
+			stats->min = moments.min;
+			stats->max = moments.max;
+		}
+
+		/* coverage one-pass standard deviation */
+		if (NULL != cK && k > 0) {
+			if (*cK < 1) {
+				*cM = moments.mean;
+				*cQ = moments.Q;
+				*cK = k;
+			}
+			else {
+				uint64_t total = *cK + k;
+				double delta = moments.mean - *cM;
+
+				*cM += delta * ((double) k / total);
+				*cQ += moments.Q + delta * delta * ((double) *cK * k / total);
+				*cK = total;
+			}
+		}
+	}
+
 	RASTER_DEBUG(3, "sampling complete");
 
 	stats->count = k;
@@ -389,6 +816,130 @@ rt_band_get_summary_stats(
 	return stats;
 }
 
+/******************************************************************************
+* rt_raster_get_zonal_stats()
+******************************************************************************/
+
+typedef struct {
+	rt_band band;
+	int exclude_nodata_value;
+
+	rt_bandstats stats;
+	double weight; /* sum of the weights of the pixels counted */
+	double M;
+	double Q;
+} _rti_zonal_stats_arg;
+
+static rt_errorstate
+_rti_zonal_stats_add(void *userarg, int y, int x, int count, const double *fraction) {
+	_rti_zonal_stats_arg *arg = (_rti_zonal_stats_arg *) userarg;
+	rt_bandstats stats = arg->stats;
+	double value;
+	double delta;
+	int isnodata;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (rt_band_get_pixel(arg->band, x + i, y, &value, &isnodata) != ES_NONE) {
+			rterror("_rti_zonal_stats_add: Could not get pixel value");
+			return ES_ERROR;
+		}
+
+		if (arg->exclude_nodata_value && isnodata)
+			continue;
+
+		/* weighted one-pass standard deviation, with a weight of 1 same as rt_band_get_summary_stats */
+		arg->weight += fraction[i];
+		delta = value - arg->M;
+		arg->M += (fraction[i] / arg->weight) * delta;
+		arg->Q += fraction[i] * delta * (value - arg->M);
+
+		stats->sum += fraction[i] * value;
+
+		if (stats->count < 1)
+			stats->min = stats->max = value;
+		else {
+			if (value < stats->min)
+				stats->min = value;
+			if (value > stats->max)
+				stats->max = value;
+		}
+		stats->count++;
+	}
+
+	return ES_NONE;
+}
+
+/**
+ * Compute summary statistics of the pixels of a band under a polygon,
+ * rasterized without GDAL
+ *
+ * @param raster : the raster whose band is summarized
+ * @param nband : the 0-based band to summarize
+ * @param geom : the polygon or multipolygon, in the coordinates of the raster
+ * @param mode : pixels under the polygon. with RT_RASTERIZE_COVERAGE, each
+ *   pixel is weighted by the fraction of its area inside the polygon
+ * @param exclude_nodata_value : if non-zero, ignore nodata values
+ *
+ * @return the summary statistics of the pixels or NULL
+ */
+rt_bandstats
+rt_raster_get_zonal_stats(
+	rt_raster raster, int nband,
+	const LWGEOM *geom, rt_rasterize_mode mode,
+	int exclude_nodata_value
+) {
+	_rti_zonal_stats_arg arg;
+	rt_bandstats stats = NULL;
+
+	assert(NULL != raster);
+	assert(NULL != geom);
+
+	arg.band = rt_raster_get_band(raster, nband);
+	if (arg.band == NULL) {
+		rterror("rt_raster_get_zonal_stats: Could not get band at index %d", nband);
+		return NULL;
+	}
+	if (!rt_band_get_hasnodata_flag(arg.band))
+		exclude_nodata_value = 0;
+	arg.exclude_nodata_value = exclude_nodata_value;
+
+	stats = (rt_bandstats) rtalloc(sizeof(struct rt_bandstats_t));
+	if (NULL == stats) {
+		rterror("rt_raster_get_zonal_stats: Could not allocate memory for stats");
+		return NULL;
+	}
+	stats->sample = 1;
+	stats->count = 0;
+	stats->sum = 0;
+	stats->mean = 0;
+	stats->stddev = -1;
+	stats->min = stats->max = 0;
+	stats->values = NULL;
+	stats->sorted = 0;
+
+	arg.stats = stats;
+	arg.weight = 0;
+	arg.M = 0;
+	arg.Q = 0;
+
+	if (rt_raster_rasterize_lwgeom(raster, geom, mode, _rti_zonal_stats_add, &arg) != ES_NONE) {
+		rterror("rt_raster_get_zonal_stats: Could not rasterize geometry");
+		rtdealloc(stats);
+		return NULL;
+	}
+
+	if (stats->count > 0 && arg.weight > 0) {
+		stats->mean = stats->sum / arg.weight;
+		stats->stddev = sqrt(arg.Q / arg.weight);
+	}
+
+	RASTER_DEBUGF(3, "(count, weight, mean, stddev, min, max) = (%d, %f, %f, %f, %f, %f)",
+		stats->count, arg.weight, stats->mean, stats->stddev, stats->min, stats->max);
+
+	return stats;
+}
+
 /******************************************************************************
 * rt_band_get_histogram()
 ******************************************************************************/
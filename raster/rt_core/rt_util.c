@@ -208,6 +208,29 @@ rt_util_extent_type(const char *name) {
 		return ET_INTERSECTION;
 }
 
+/*
+	band compression codec
+*/
+rt_compression
+rt_util_compression_from_name(const char *name) {
+	assert(name != NULL);
+
+	if (strcmp(name, "LZ4") == 0)
+		return RT_COMPRESSION_LZ4;
+	else
+		return RT_COMPRESSION_NONE;
+}
+
+const char *
+rt_util_compression_name(rt_compression compression) {
+	switch (compression) {
+		case RT_COMPRESSION_LZ4:
+			return "LZ4";
+		default:
+			return "NONE";
+	}
+}
+
 /*
 	convert the spatial reference string from a GDAL recognized format to either WKT or Proj4
 */
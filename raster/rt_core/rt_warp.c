@@ -38,6 +38,102 @@
 * rt_raster_gdal_warp()
 ******************************************************************************/
 
+/* outputs of at least this many pixels are warped with GDAL worker threads */
+#define RT_WARP_THREADS_MIN_PIXELS (1024 * 1024)
+
+/* bytes of source and destination pixels GDAL may hold per warp chunk */
+#define RT_WARP_MEMORY_LIMIT (64. * 1024. * 1024.)
+
+struct rt_warp_cache_t {
+	/* spatial references as provided by the caller */
+	char *src_srs;
+	char *dst_srs;
+
+	/* the same in GDAL accepted format */
+	char *src_wkt;
+	char *dst_wkt;
+
+	/* reprojection between them, independent of any geotransform */
+	void *reproj;
+};
+
+/*
+	GDAL transformer between source and destination pixels: geotransform,
+	reprojection and inverse geotransform. only the reprojection is
+	expensive to build, and it can be shared by rasters of any extent
+*/
+typedef struct {
+	double src_gt[6];
+	double src_igt[6];
+	double dst_gt[6];
+	double dst_igt[6];
+
+	/* GDAL reprojection transformer, NULL if no reprojection */
+	void *reproj;
+} _rti_warp_transform_t;
+
+static void
+_rti_warp_apply_gt(const double *gt, int n, double *x, double *y, const int *success) {
+	double _x;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (!success[i])
+			continue;
+
+		_x = gt[0] + x[i] * gt[1] + y[i] * gt[2];
+		y[i] = gt[3] + x[i] * gt[4] + y[i] * gt[5];
+		x[i] = _x;
+	}
+}
+
+static int
+_rti_warp_transform(
+	void *arg, int dst_to_src,
+	int n, double *x, double *y, double *z,
+	int *success
+) {
+	_rti_warp_transform_t *t = (_rti_warp_transform_t *) arg;
+	int rtn = TRUE;
+	int i;
+
+	for (i = 0; i < n; i++)
+		success[i] = TRUE;
+
+	_rti_warp_apply_gt(dst_to_src ? t->dst_gt : t->src_gt, n, x, y, success);
+	if (t->reproj != NULL)
+		rtn = GDALReprojectionTransform(t->reproj, dst_to_src, n, x, y, z, success);
+	_rti_warp_apply_gt(dst_to_src ? t->src_igt : t->dst_igt, n, x, y, success);
+
+	return rtn;
+}
+
+/*
+	number of GDAL worker threads warping an output of width x height
+	pixels, 0 for all CPUs
+
+	postgis.gdal_warp_threads only applies to outputs of at least
+	RT_WARP_THREADS_MIN_PIXELS, smaller ones are warped by the backend
+*/
+static int
+_rti_warp_threads(int width, int height) {
+#if POSTGIS_GDAL_VERSION >= 20
+	char *opt = NULL;
+	int threads = 1;
+
+	if ((double) width * (double) height < RT_WARP_THREADS_MIN_PIXELS)
+		return 1;
+
+	opt = rtoptions("gdal_warp_threads");
+	if (opt != NULL)
+		threads = atoi(opt);
+
+	return threads < 0 ? 1 : threads;
+#else
+	return 1;
+#endif
+}
+
 typedef struct _rti_warp_arg_t* _rti_warp_arg;
 struct _rti_warp_arg_t {
 
@@ -49,6 +145,7 @@ struct _rti_warp_arg_t {
 	} src, dst;
 
 	GDALWarpOptions *wopts;
+	GDALWarpOperationH operation;
 
 	struct {
 		struct {
@@ -58,11 +155,17 @@ struct _rti_warp_arg_t {
 
 		struct {
 			void *transform;
+			void *reproj;
 			void *imgproj;
 			void *approx;
 		} arg;
 
+		_rti_warp_transform_t pixel;
+
 		GDALTransformerFunc func;
+
+		/* reprojection transformer is owned by the cache */
+		rt_warp_cache cache;
 	} transform;
 
 };
@@ -88,15 +191,19 @@ _rti_warp_arg_init() {
 	arg->dst.srs = NULL;
 
 	arg->wopts = NULL;
+	arg->operation = NULL;
 
 	arg->transform.option.item = NULL;
 	arg->transform.option.len = 0;
 
 	arg->transform.arg.transform = NULL;
+	arg->transform.arg.reproj = NULL;
 	arg->transform.arg.imgproj = NULL;
 	arg->transform.arg.approx = NULL;
+	memset(&(arg->transform.pixel), 0, sizeof(_rti_warp_transform_t));
 
 	arg->transform.func = NULL;
+	arg->transform.cache = NULL;
 
 	return arg;
 }
@@ -105,6 +212,9 @@ static void
 _rti_warp_arg_destroy(_rti_warp_arg arg) {
 	int i = 0;
 
+	if (arg->operation != NULL)
+		GDALDestroyWarpOperation(arg->operation);
+
 	if (arg->dst.ds != NULL)
 		GDALClose(arg->dst.ds);
 	if (arg->dst.srs != NULL)
@@ -125,10 +235,12 @@ _rti_warp_arg_destroy(_rti_warp_arg arg) {
 		GDALDestroyDriver(arg->src.drv);
 	}
 
-	if (arg->transform.func == GDALApproxTransform) {
-		if (arg->transform.arg.imgproj != NULL)
-			GDALDestroyGenImgProjTransformer(arg->transform.arg.imgproj);
-	}
+	if (arg->transform.arg.approx != NULL)
+		GDALDestroyApproxTransformer(arg->transform.arg.approx);
+	if (arg->transform.arg.imgproj != NULL)
+		GDALDestroyGenImgProjTransformer(arg->transform.arg.imgproj);
+	if (arg->transform.arg.reproj != NULL && arg->transform.cache == NULL)
+		GDALDestroyReprojectionTransformer(arg->transform.arg.reproj);
 
 	if (arg->wopts != NULL)
 		GDALDestroyWarpOptions(arg->wopts);
@@ -145,6 +257,60 @@ _rti_warp_arg_destroy(_rti_warp_arg arg) {
 	arg = NULL;
 }
 
+static void
+_rti_warp_cache_reset(rt_warp_cache cache) {
+	if (cache->reproj != NULL)
+		GDALDestroyReprojectionTransformer(cache->reproj);
+	cache->reproj = NULL;
+
+	if (cache->src_srs != NULL)
+		CPLFree(cache->src_srs);
+	if (cache->dst_srs != NULL)
+		CPLFree(cache->dst_srs);
+	if (cache->src_wkt != NULL)
+		CPLFree(cache->src_wkt);
+	if (cache->dst_wkt != NULL)
+		CPLFree(cache->dst_wkt);
+
+	cache->src_srs = NULL;
+	cache->dst_srs = NULL;
+	cache->src_wkt = NULL;
+	cache->dst_wkt = NULL;
+}
+
+/**
+ * Create an empty cache for rt_raster_gdal_warp_cached()
+ *
+ * @return new cache or NULL
+ */
+rt_warp_cache
+rt_warp_cache_new(void) {
+	rt_warp_cache cache = NULL;
+
+	cache = (rt_warp_cache) rtalloc(sizeof(struct rt_warp_cache_t));
+	if (cache == NULL) {
+		rterror("rt_warp_cache_new: Could not allocate memory for warp cache");
+		return NULL;
+	}
+	memset(cache, 0, sizeof(struct rt_warp_cache_t));
+
+	return cache;
+}
+
+/**
+ * Free a warp cache and the GDAL objects it holds
+ *
+ * @param cache : the cache to free
+ */
+void
+rt_warp_cache_destroy(rt_warp_cache cache) {
+	if (cache == NULL)
+		return;
+
+	_rti_warp_cache_reset(cache);
+	rtdealloc(cache);
+}
+
 /**
  * Return a warped raster using GDAL Warp API
  *
@@ -184,14 +350,49 @@ rt_raster rt_raster_gdal_warp(
 	double *grid_xw, double *grid_yw,
 	double *skew_x, double *skew_y,
 	GDALResampleAlg resample_alg, double max_err
+) {
+	return rt_raster_gdal_warp_cached(
+		raster,
+		src_srs, dst_srs,
+		scale_x, scale_y,
+		width, height,
+		ul_xw, ul_yw,
+		grid_xw, grid_yw,
+		skew_x, skew_y,
+		resample_alg, max_err,
+		NULL
+	);
+}
+
+/**
+ * Return a warped raster using GDAL Warp API, reusing the converted
+ * spatial references and reprojection transformer kept in cache when
+ * the spatial references match those of the previous call. These do
+ * not depend on the raster's geotransform, so the tiles of a coverage
+ * share them
+ *
+ * @param cache : cache from rt_warp_cache_new() or NULL
+ *
+ * See rt_raster_gdal_warp() for the other parameters
+ *
+ * @return the warped raster or NULL
+ */
+rt_raster rt_raster_gdal_warp_cached(
+	rt_raster raster,
+	const char *src_srs, const char *dst_srs,
+	double *scale_x, double *scale_y,
+	int *width, int *height,
+	double *ul_xw, double *ul_yw,
+	double *grid_xw, double *grid_yw,
+	double *skew_x, double *skew_y,
+	GDALResampleAlg resample_alg, double max_err,
+	rt_warp_cache cache
 ) {
 	CPLErr cplerr;
-	const char *dst_options[] = {"SUBCLASS=VRTWarpedDataset", NULL};
 	_rti_warp_arg arg = NULL;
 
 	int hasnodata = 0;
 
-	GDALRasterBandH band;
 	rt_band rtband = NULL;
 	rt_pixtype pt = PT_END;
 	GDALDataType gdal_pt = GDT_Unknown;
@@ -213,6 +414,10 @@ rt_raster rt_raster_gdal_warp(
 	/* flag indicating that the spatial info is being substituted */
 	int subspatial = 0;
 
+	int reproject = 0;
+	int threads = 1;
+	const double georef_gt[6] = {0., 1., 0., 0., 0., 1.};
+
 	RASTER_DEBUG(3, "starting");
 
 	//assert(NULL != raster);
@@ -240,14 +445,38 @@ rt_raster rt_raster_gdal_warp(
 		/* reprojection taking place */
 		if (dst_srs != NULL && strcmp(src_srs, dst_srs) != 0) {
 			RASTER_DEBUG(4, "Warp operation does include a reprojection");
-			arg->src.srs = rt_util_gdal_convert_sr(src_srs, 0);
-			arg->dst.srs = rt_util_gdal_convert_sr(dst_srs, 0);
 
-			if (arg->src.srs == NULL || arg->dst.srs == NULL) {
-				rterror("rt_raster_gdal_warp: Could not convert srs values to GDAL accepted format");
-				_rti_warp_arg_destroy(arg);
-				return NULL;
+			/* same spatial references as the previous call */
+			if (
+				cache != NULL &&
+				cache->src_srs != NULL && strcmp(cache->src_srs, src_srs) == 0 &&
+				cache->dst_srs != NULL && strcmp(cache->dst_srs, dst_srs) == 0
+			) {
+				RASTER_DEBUG(4, "Using cached spatial references");
+				arg->src.srs = CPLStrdup(cache->src_wkt);
+				arg->dst.srs = CPLStrdup(cache->dst_wkt);
 			}
+			else {
+				arg->src.srs = rt_util_gdal_convert_sr(src_srs, 0);
+				arg->dst.srs = rt_util_gdal_convert_sr(dst_srs, 0);
+
+				if (arg->src.srs == NULL || arg->dst.srs == NULL) {
+					rterror("rt_raster_gdal_warp: Could not convert srs values to GDAL accepted format");
+					_rti_warp_arg_destroy(arg);
+					return NULL;
+				}
+
+				if (cache != NULL) {
+					_rti_warp_cache_reset(cache);
+					cache->src_srs = CPLStrdup(src_srs);
+					cache->dst_srs = CPLStrdup(dst_srs);
+					cache->src_wkt = CPLStrdup(arg->src.srs);
+					cache->dst_wkt = CPLStrdup(arg->dst.srs);
+				}
+			}
+
+			reproject = 1;
+			arg->transform.cache = cache;
 		}
 		/* no reprojection, a stub just for clarity */
 		else {
@@ -262,7 +491,8 @@ rt_raster rt_raster_gdal_warp(
 	}
 
 	/* load raster into a GDAL MEM dataset */
-	arg->src.ds = rt_raster_to_gdal_mem(raster, arg->src.srs, NULL, NULL, 0, &(arg->src.drv), &(arg->src.destroy_drv));
+	/* the transformer gets the srs from the transform options */
+	arg->src.ds = rt_raster_to_gdal_mem(raster, NULL, NULL, NULL, 0, &(arg->src.drv), &(arg->src.destroy_drv));
 	if (NULL == arg->src.ds) {
 		rterror("rt_raster_gdal_warp: Could not convert raster to GDAL MEM format");
 		_rti_warp_arg_destroy(arg);
@@ -342,25 +572,47 @@ rt_raster rt_raster_gdal_warp(
 	else
 		arg->transform.option.len = 0;
 
-	/* transformation object for building dst dataset */
-	arg->transform.arg.transform = GDALCreateGenImgProjTransformer2(arg->src.ds, NULL, arg->transform.option.item);
-	if (NULL == arg->transform.arg.transform) {
-		rterror("rt_raster_gdal_warp: Could not create GDAL transformation object for output dataset creation");
+	/*
+		transformation object, with georeferenced output coordinates
+		until the output geotransform is known
+	*/
+	GDALGetGeoTransform(arg->src.ds, arg->transform.pixel.src_gt);
+	if (!GDALInvGeoTransform(arg->transform.pixel.src_gt, arg->transform.pixel.src_igt)) {
+		rterror("rt_raster_gdal_warp: Could not invert geotransform of input raster");
 		_rti_warp_arg_destroy(arg);
 		return NULL;
 	}
+	memcpy(arg->transform.pixel.dst_gt, georef_gt, sizeof(double) * 6);
+	memcpy(arg->transform.pixel.dst_igt, georef_gt, sizeof(double) * 6);
+
+	if (reproject) {
+		if (arg->transform.cache != NULL && arg->transform.cache->reproj != NULL) {
+			RASTER_DEBUG(4, "Using cached reprojection transformer");
+			arg->transform.arg.reproj = arg->transform.cache->reproj;
+		}
+		else {
+			arg->transform.arg.reproj = GDALCreateReprojectionTransformer(arg->src.srs, arg->dst.srs);
+			if (NULL == arg->transform.arg.reproj) {
+				rterror("rt_raster_gdal_warp: Could not create GDAL reprojection transformer");
+				_rti_warp_arg_destroy(arg);
+				return NULL;
+			}
+
+			if (arg->transform.cache != NULL)
+				arg->transform.cache->reproj = arg->transform.arg.reproj;
+		}
+	}
+	arg->transform.pixel.reproj = arg->transform.arg.reproj;
 
 	/* get approximate output georeferenced bounds and resolution */
 	cplerr = GDALSuggestedWarpOutput2(
-		arg->src.ds, GDALGenImgProjTransform,
-		arg->transform.arg.transform, _gt, &(_dim[0]), &(_dim[1]), dst_extent, 0);
+		arg->src.ds, _rti_warp_transform,
+		&(arg->transform.pixel), _gt, &(_dim[0]), &(_dim[1]), dst_extent, 0);
 	if (cplerr != CE_None) {
 		rterror("rt_raster_gdal_warp: Could not get GDAL suggested warp output for output dataset creation");
 		_rti_warp_arg_destroy(arg);
 		return NULL;
 	}
-	GDALDestroyGenImgProjTransformer(arg->transform.arg.transform);
-	arg->transform.arg.transform = NULL;
 
 	/*
 		don't use suggested dimensions as use of suggested scales
@@ -749,111 +1001,103 @@ rt_raster rt_raster_gdal_warp(
 		return NULL;
 	}
 
-	/* load VRT driver */
-	if (!rt_util_gdal_driver_registered("VRT")) {
-		RASTER_DEBUG(3, "Registering VRT driver");
-		GDALRegister_VRT();
-		arg->dst.destroy_drv = 1;
-	}
-	arg->dst.drv = GDALGetDriverByName("VRT");
-	if (NULL == arg->dst.drv) {
-		rterror("rt_raster_gdal_warp: Could not load the output GDAL VRT driver");
-		_rti_warp_arg_destroy(arg);
-		return NULL;
-	}
-
-	/* create dst dataset */
-	arg->dst.ds = GDALCreate(arg->dst.drv, "", _dim[0], _dim[1], 0, GDT_Byte, dst_options);
-	if (NULL == arg->dst.ds) {
-		rterror("rt_raster_gdal_warp: Could not create GDAL VRT dataset");
-		_rti_warp_arg_destroy(arg);
-		return NULL;
-	}
-
-	/* set dst srs */
-	if (arg->dst.srs != NULL) {
-		cplerr = GDALSetProjection(arg->dst.ds, arg->dst.srs);
-		if (cplerr != CE_None) {
-			rterror("rt_raster_gdal_warp: Could not set projection");
-			_rti_warp_arg_destroy(arg);
-			return NULL;
-		}
-		RASTER_DEBUGF(3, "Applied SRS: %s", GDALGetProjectionRef(arg->dst.ds));
-	}
-
-	/* set dst geotransform */
-	cplerr = GDALSetGeoTransform(arg->dst.ds, _gt);
-	if (cplerr != CE_None) {
-		rterror("rt_raster_gdal_warp: Could not set geotransform");
+	/* output raster, warped into in place */
+	rast = rt_raster_new(_dim[0], _dim[1]);
+	if (rast == NULL) {
+		rterror("rt_raster_gdal_warp: Out of memory allocating output raster");
 		_rti_warp_arg_destroy(arg);
 		return NULL;
 	}
+	rt_raster_set_geotransform_matrix(rast, _gt);
 
-	/* add bands to dst dataset */
+	/* add bands to output raster */
 	numBands = rt_raster_get_num_bands(raster);
 	for (i = 0; i < numBands; i++) {
 		rtband = rt_raster_get_band(raster, i);
 		if (NULL == rtband) {
-			rterror("rt_raster_gdal_warp: Could not get band %d for adding to VRT dataset", i);
+			rterror("rt_raster_gdal_warp: Could not get band %d for adding to output raster", i);
+			rt_raster_destroy(rast);
 			_rti_warp_arg_destroy(arg);
 			return NULL;
 		}
 
-		pt = rt_band_get_pixtype(rtband);
-		gdal_pt = rt_util_pixtype_to_gdal_datatype(pt);
+		/* pixel type as round-tripped through GDAL, e.g. 8BSI becomes 16BSI */
+		gdal_pt = rt_util_pixtype_to_gdal_datatype(rt_band_get_pixtype(rtband));
 		if (gdal_pt == GDT_Unknown)
 			rtwarn("rt_raster_gdal_warp: Unknown pixel type for band %d", i);
+		pt = rt_util_gdal_datatype_to_pixtype(gdal_pt);
 
-		cplerr = GDALAddBand(arg->dst.ds, gdal_pt, NULL);
-		if (cplerr != CE_None) {
-			rterror("rt_raster_gdal_warp: Could not add band to VRT dataset");
-			_rti_warp_arg_destroy(arg);
-			return NULL;
+		nodata = 0.;
+		if (rt_band_get_hasnodata_flag(rtband) != FALSE) {
+			hasnodata = 1;
+			rt_band_get_nodata(rtband, &nodata);
 		}
 
-		/* get band to write data to */
-		band = NULL;
-		band = GDALGetRasterBand(arg->dst.ds, i + 1);
-		if (NULL == band) {
-			rterror("rt_raster_gdal_warp: Could not get GDAL band for additional processing");
+		if (rt_raster_generate_new_band(
+			rast, pt,
+			nodata, rt_band_get_hasnodata_flag(rtband), nodata,
+			i
+		) < 0) {
+			rterror("rt_raster_gdal_warp: Could not add band to output raster");
+			rt_raster_destroy(rast);
 			_rti_warp_arg_destroy(arg);
 			return NULL;
 		}
+	}
 
-		/* set nodata */
-		if (rt_band_get_hasnodata_flag(rtband) != FALSE) {
-			hasnodata = 1;
-			rt_band_get_nodata(rtband, &nodata);
-			if (GDALSetRasterNoDataValue(band, nodata) != CE_None)
-				rtwarn("rt_raster_gdal_warp: Could not set nodata value for band %d", i);
-			RASTER_DEBUGF(3, "nodata value set to %f", GDALGetRasterNoDataValue(band, NULL));
-		}
+	/* dst dataset shares the output raster's band data */
+	arg->dst.ds = rt_raster_to_gdal_mem(rast, NULL, NULL, NULL, 0, &(arg->dst.drv), &(arg->dst.destroy_drv));
+	if (NULL == arg->dst.ds) {
+		rterror("rt_raster_gdal_warp: Could not create GDAL MEM dataset for output raster");
+		rt_raster_destroy(rast);
+		_rti_warp_arg_destroy(arg);
+		return NULL;
 	}
 
-	/* create transformation object */
-	arg->transform.arg.transform = arg->transform.arg.imgproj = GDALCreateGenImgProjTransformer2(
-		arg->src.ds, arg->dst.ds,
-		arg->transform.option.item
-	);
-	if (NULL == arg->transform.arg.transform) {
-		rterror("rt_raster_gdal_warp: Could not create GDAL transformation object");
+	/* transformation object maps to output pixels from here on */
+	memcpy(arg->transform.pixel.dst_gt, _gt, sizeof(double) * 6);
+	if (!GDALInvGeoTransform(_gt, arg->transform.pixel.dst_igt)) {
+		rterror("rt_raster_gdal_warp: Could not invert geotransform of output raster");
+		rt_raster_destroy(rast);
 		_rti_warp_arg_destroy(arg);
 		return NULL;
 	}
-	arg->transform.func = GDALGenImgProjTransform;
+	arg->transform.arg.transform = &(arg->transform.pixel);
+	arg->transform.func = _rti_warp_transform;
+
+	/*
+		GDAL worker threads need a transformer GDAL can clone, which
+		this one is not. a GenImgProj transformer is built for them
+	*/
+	threads = _rti_warp_threads(_dim[0], _dim[1]);
+	if (threads != 1) {
+		arg->transform.arg.imgproj = GDALCreateGenImgProjTransformer2(arg->src.ds, NULL, arg->transform.option.item);
+		if (NULL == arg->transform.arg.imgproj) {
+			rterror("rt_raster_gdal_warp: Could not create GDAL transformation object");
+			rt_raster_destroy(rast);
+			_rti_warp_arg_destroy(arg);
+			return NULL;
+		}
+		GDALSetGenImgProjTransformerDstGeoTransform(arg->transform.arg.imgproj, _gt);
+
+		arg->transform.arg.transform = arg->transform.arg.imgproj;
+		arg->transform.func = GDALGenImgProjTransform;
+	}
 
 	/* use approximate transformation object */
 	if (max_err > 0.0) {
-		arg->transform.arg.transform = arg->transform.arg.approx = GDALCreateApproxTransformer(
-			GDALGenImgProjTransform,
-			arg->transform.arg.imgproj, max_err
+		arg->transform.arg.approx = GDALCreateApproxTransformer(
+			arg->transform.func,
+			arg->transform.arg.transform, max_err
 		);
-		if (NULL == arg->transform.arg.transform) {
+		if (NULL == arg->transform.arg.approx) {
 			rterror("rt_raster_gdal_warp: Could not create GDAL approximate transformation object");
+			rt_raster_destroy(rast);
 			_rti_warp_arg_destroy(arg);
 			return NULL;
 		}
 
+		arg->transform.arg.transform = arg->transform.arg.approx;
 		arg->transform.func = GDALApproxTransform;
 	}
 
@@ -861,6 +1105,7 @@ rt_raster rt_raster_gdal_warp(
 	arg->wopts = GDALCreateWarpOptions();
 	if (NULL == arg->wopts) {
 		rterror("rt_raster_gdal_warp: Could not create GDAL warp options object");
+		rt_raster_destroy(rast);
 		_rti_warp_arg_destroy(arg);
 		return NULL;
 	}
@@ -871,10 +1116,23 @@ rt_raster rt_raster_gdal_warp(
 	arg->wopts->hDstDS = arg->dst.ds;
 	arg->wopts->pfnTransformer = arg->transform.func;
 	arg->wopts->pTransformerArg = arg->transform.arg.transform;
-	arg->wopts->papszWarpOptions = (char **) CPLMalloc(sizeof(char *) * 2);
-	arg->wopts->papszWarpOptions[0] = (char *) CPLMalloc(sizeof(char) * (strlen("INIT_DEST=NO_DATA") + 1));
-	strcpy(arg->wopts->papszWarpOptions[0], "INIT_DEST=NO_DATA");
-	arg->wopts->papszWarpOptions[1] = NULL;
+	arg->wopts->dfWarpMemoryLimit = RT_WARP_MEMORY_LIMIT;
+	arg->wopts->papszWarpOptions = CSLSetNameValue(arg->wopts->papszWarpOptions, "INIT_DEST", "NO_DATA");
+
+	/*
+		large outputs may be warped by GDAL worker threads. the workers only
+		touch GDAL objects and clones of the transformer, never rtcore's
+		allocators or error handlers
+	*/
+	if (threads == 0) {
+		arg->wopts->papszWarpOptions = CSLSetNameValue(arg->wopts->papszWarpOptions, "NUM_THREADS", "ALL_CPUS");
+	}
+	else if (threads > 1) {
+		char _threads[16];
+		snprintf(_threads, sizeof(_threads), "%d", threads);
+		arg->wopts->papszWarpOptions = CSLSetNameValue(arg->wopts->papszWarpOptions, "NUM_THREADS", _threads);
+	}
+	RASTER_DEBUGF(3, "Warp NUM_THREADS: %s", CSLFetchNameValueDef(arg->wopts->papszWarpOptions, "NUM_THREADS", "1"));
 
 	/* set band mapping */
 	arg->wopts->nBandCount = numBands;
@@ -897,18 +1155,20 @@ rt_raster rt_raster_gdal_warp(
 			NULL == arg->wopts->padfDstNoDataImag
 		) {
 			rterror("rt_raster_gdal_warp: Out of memory allocating nodata mapping");
+			rt_raster_destroy(rast);
 			_rti_warp_arg_destroy(arg);
 			return NULL;
 		}
 		for (i = 0; i < numBands; i++) {
-			band = rt_raster_get_band(raster, i);
-			if (!band) {
+			rtband = rt_raster_get_band(raster, i);
+			if (!rtband) {
 				rterror("rt_raster_gdal_warp: Could not process bands for nodata values");
+				rt_raster_destroy(rast);
 				_rti_warp_arg_destroy(arg);
 				return NULL;
 			}
 
-			if (!rt_band_get_hasnodata_flag((rt_band)band)) {
+			if (!rt_band_get_hasnodata_flag(rtband)) {
 				/*
 					based on line 1004 of gdalwarp.cpp
 					the problem is that there is a chance that this number is a legitimate value
@@ -916,7 +1176,7 @@ rt_raster rt_raster_gdal_warp(
 				arg->wopts->padfSrcNoDataReal[i] = -123456.789;
 			}
 			else {
-				rt_band_get_nodata((rt_band)band, &(arg->wopts->padfSrcNoDataReal[i]));
+				rt_band_get_nodata(rtband, &(arg->wopts->padfSrcNoDataReal[i]));
 			}
 
 			arg->wopts->padfDstNoDataReal[i] = arg->wopts->padfSrcNoDataReal[i];
@@ -929,31 +1189,56 @@ rt_raster rt_raster_gdal_warp(
 		}
 	}
 
-	/* warp raster */
+	/* warp raster in chunks bounded by dfWarpMemoryLimit */
 	RASTER_DEBUG(3, "Warping raster");
-	cplerr = GDALInitializeWarpedVRT(arg->dst.ds, arg->wopts);
+	arg->operation = GDALCreateWarpOperation(arg->wopts);
+	if (NULL == arg->operation) {
+		rterror("rt_raster_gdal_warp: Could not create GDAL warp operation");
+		rt_raster_destroy(rast);
+		_rti_warp_arg_destroy(arg);
+		return NULL;
+	}
+
+	cplerr = GDALChunkAndWarpImage(arg->operation, 0, 0, _dim[0], _dim[1]);
 	if (cplerr != CE_None) {
 		rterror("rt_raster_gdal_warp: Could not warp raster");
+		rt_raster_destroy(rast);
 		_rti_warp_arg_destroy(arg);
 		return NULL;
 	}
-	/*
-	GDALSetDescription(arg->dst.ds, "/tmp/warped.vrt");
-	*/
 	GDALFlushCache(arg->dst.ds);
 	RASTER_DEBUG(3, "Raster warped");
 
-	/* convert gdal dataset to raster */
-	RASTER_DEBUG(3, "Converting GDAL dataset to raster");
-	rast = rt_raster_from_gdal_dataset(arg->dst.ds);
+	/* output SRID from the dst srs, as a GDAL dataset would report it */
+	if (arg->dst.srs != NULL && !subspatial) {
+		char *authname = NULL;
+		char *authcode = NULL;
 
-	_rti_warp_arg_destroy(arg);
+		if (
+			GDALSetProjection(arg->dst.ds, arg->dst.srs) == CE_None &&
+			rt_util_gdal_sr_auth_info(arg->dst.ds, &authname, &authcode) == ES_NONE
+		) {
+			if (
+				authname != NULL &&
+				strcmp(authname, "EPSG") == 0 &&
+				authcode != NULL
+			) {
+				rt_raster_set_srid(rast, atoi(authcode));
+			}
 
-	if (NULL == rast) {
-		rterror("rt_raster_gdal_warp: Could not warp raster");
-		return NULL;
+			if (authname != NULL)
+				rtdealloc(authname);
+			if (authcode != NULL)
+				rtdealloc(authcode);
+		}
 	}
 
+	_rti_warp_arg_destroy(arg);
+
+	/* bands were created filled with NODATA */
+	for (i = 0; i < numBands; i++)
+		rt_band_set_isnodata_flag(rt_raster_get_band(rast, i), 0);
+
 	/* substitute spatial, reset back to default */
 	if (subspatial) {
 		double gt[6] = {0, 1, 0, 0, 0, -1};
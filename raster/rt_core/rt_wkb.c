@@ -60,6 +60,8 @@ rt_band_from_wkb(
 		return NULL;
 	}
 	band->ownsdata = 0; /* assume we don't own data */
+	band->compression = RT_COMPRESSION_NONE;
+	band->blocks = NULL;
 
 	if (end - *ptr < 1) {
 		rterror("rt_band_from_wkb: Premature end of WKB on band reading (%s:%d)",
@@ -57,6 +57,7 @@ Datum RASTER_getBandPath(PG_FUNCTION_ARGS);
 Datum RASTER_getBandFileSize(PG_FUNCTION_ARGS);
 Datum RASTER_getBandFileTimestamp(PG_FUNCTION_ARGS);
 Datum RASTER_bandIsNoData(PG_FUNCTION_ARGS);
+Datum RASTER_getBandCompression(PG_FUNCTION_ARGS);
 
 /* get raster band's meta data */
 Datum RASTER_bandmetadata(PG_FUNCTION_ARGS);
@@ -66,6 +67,7 @@ Datum RASTER_setBandIsNoData(PG_FUNCTION_ARGS);
 Datum RASTER_setBandNoDataValue(PG_FUNCTION_ARGS);
 Datum RASTER_setBandPath(PG_FUNCTION_ARGS);
 Datum RASTER_setBandIndex(PG_FUNCTION_ARGS);
+Datum RASTER_setBandCompression(PG_FUNCTION_ARGS);
 }
 /**
  * Return pixel type of the specified band of raster.
@@ -873,6 +875,54 @@ Datum RASTER_setBandNoDataValue(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(pgrtn);
 }
 
+/**
+ * Return the name of the codec used to store the specified band of raster.
+ * Band index is 1-based.
+ */
+PG_FUNCTION_INFO_V1(RASTER_getBandCompression);
+Datum RASTER_getBandCompression(PG_FUNCTION_ARGS)
+{
+	rt_pgraster *pgraster = NULL;
+	rt_raster raster = NULL;
+	rt_band band = NULL;
+	int32_t bandindex;
+	const char *name = NULL;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+	pgraster = (rt_pgraster *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
+
+	/* Index is 1-based */
+	bandindex = PG_GETARG_INT32(1);
+	if (bandindex < 1) {
+		elog(NOTICE, "Invalid band index (must use 1-based). Returning NULL");
+		PG_FREE_IF_COPY(pgraster, 0);
+		PG_RETURN_NULL();
+	}
+
+	raster = rt_raster_deserialize(pgraster, FALSE);
+	if (!raster) {
+		PG_FREE_IF_COPY(pgraster, 0);
+		elog(ERROR, "RASTER_getBandCompression: Could not deserialize raster");
+		PG_RETURN_NULL();
+	}
+
+	band = rt_raster_get_band(raster, bandindex - 1);
+	if (!band) {
+		elog(NOTICE, "Could not find raster band of index %d when getting compression. Returning NULL", bandindex);
+		rt_raster_destroy(raster);
+		PG_FREE_IF_COPY(pgraster, 0);
+		PG_RETURN_NULL();
+	}
+
+	name = rt_util_compression_name(rt_band_get_compression(band));
+
+	rt_raster_destroy(raster);
+	PG_FREE_IF_COPY(pgraster, 0);
+
+	PG_RETURN_TEXT_P(cstring_to_text(name));
+}
+
 /**
  * Set flag indicating that the entire band is NODATA
  */
@@ -1022,3 +1072,79 @@ Datum RASTER_setBandPath(PG_FUNCTION_ARGS)
 	SET_VARSIZE(pgrtn, pgrtn->size);
 	PG_RETURN_POINTER(pgrtn);
 }
+
+/**
+ * Set the codec used to store in-db band(s) when the raster is serialized.
+ * A NULL band index applies the codec to all in-db bands.
+ */
+PG_FUNCTION_INFO_V1(RASTER_setBandCompression);
+Datum RASTER_setBandCompression(PG_FUNCTION_ARGS)
+{
+	rt_pgraster *pgraster = NULL;
+	rt_pgraster *pgrtn = NULL;
+	rt_raster raster = NULL;
+	rt_band band = NULL;
+	rt_compression compression = RT_COMPRESSION_NONE;
+	char *name = NULL;
+	int32_t bandindex = 0;
+	int numbands = 0;
+	int i = 0;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+	pgraster = (rt_pgraster *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
+
+	/* codec name, NULL means no compression */
+	if (!PG_ARGISNULL(2)) {
+		name = rtpg_trim(rtpg_strtoupper(text_to_cstring(PG_GETARG_TEXT_P(2))));
+		compression = rt_util_compression_from_name(name);
+		if (strcmp(name, rt_util_compression_name(compression)) != 0) {
+			PG_FREE_IF_COPY(pgraster, 0);
+			elog(ERROR, "RASTER_setBandCompression: Unknown compression: %s", name);
+			PG_RETURN_NULL();
+		}
+		pfree(name);
+	}
+
+	raster = rt_raster_deserialize(pgraster, FALSE);
+	if (!raster) {
+		PG_FREE_IF_COPY(pgraster, 0);
+		elog(ERROR, "RASTER_setBandCompression: Could not deserialize raster");
+		PG_RETURN_NULL();
+	}
+
+	numbands = rt_raster_get_num_bands(raster);
+	if (!PG_ARGISNULL(1)) {
+		bandindex = PG_GETARG_INT32(1);
+		if (bandindex < 1 || bandindex > numbands) {
+			elog(NOTICE, "Could not find raster band of index %d. Compression not set. Returning original raster", bandindex);
+			numbands = 0;
+		}
+	}
+
+	for (i = 0; i < numbands; i++) {
+		if (bandindex > 0 && i != bandindex - 1)
+			continue;
+
+		band = rt_raster_get_band(raster, i);
+		if (!band)
+			continue;
+
+		if (rt_band_is_offline(band)) {
+			if (bandindex > 0)
+				elog(NOTICE, "Band of index %d is out-db. Compression not set", i + 1);
+			continue;
+		}
+
+		rt_band_set_compression(band, compression);
+	}
+
+	/* Serialize raster again */
+	pgrtn = (rt_pgraster *) rt_raster_serialize(raster);
+	rt_raster_destroy(raster);
+	PG_FREE_IF_COPY(pgraster, 0);
+	if (!pgrtn) PG_RETURN_NULL();
+
+	SET_VARSIZE(pgrtn, pgrtn->size);
+	PG_RETURN_POINTER(pgrtn);
+}
@@ -36,6 +36,7 @@
 #include <utils/guc.h> /* for ArrayType */
 #include <catalog/pg_type.h> /* for INT2OID, INT4OID, FLOAT4OID, FLOAT8OID and TEXTOID */
 #include <utils/memutils.h> /* For TopMemoryContext */
+#include <access/xact.h> /* for GetCurrentStatementStartTimestamp */
 //#include "../../include/extension_dependency.h"
 #include "../../postgis_config.h"
 
@@ -60,6 +61,7 @@ void _PG_init_gdal(void);
 }
 
 extern THR_LOCAL bool inited_gdal;
+extern MemoryContext gdal_shared_context;
 /* ----------------------------------------------------------------
  * Returns raster from GDAL raster
  * ---------------------------------------------------------------- */
@@ -848,6 +850,159 @@ Datum RASTER_InterpolateRaster(PG_FUNCTION_ARGS)
  * Warp a raster using GDAL Warp API
  ************************************************************************/
 
+#ifndef CacheMemoryContext
+#define CacheMemoryContext (u_sess->cache_mem_cxt)
+#endif
+
+/*
+	spatial references of the last SRID pair warped in this session and
+	the rtcore cache of their GDAL reprojection transformer. srtext is
+	looked up again by the first warp of each statement, the transformer
+	is kept for as long as the srtext is unchanged. all of it lives in
+	session memory and is freed with the session
+*/
+typedef struct {
+	TimestampTz stmt_start;
+
+	int src_srid;
+	char *src_srs;
+
+	int dst_srid;
+	char *dst_srs;
+
+	MemoryContext context;
+	rt_warp_cache warp;
+} rtpg_warp_cache_t;
+
+static THR_LOCAL rtpg_warp_cache_t rtpg_warp_cache = {0, SRID_UNKNOWN, NULL, SRID_UNKNOWN, NULL, NULL, NULL};
+
+/* free the GDAL objects when the session memory goes away */
+static void
+rtpg_warp_cache_delete(void) {
+	if (rtpg_warp_cache.warp != NULL)
+		rt_warp_cache_destroy(rtpg_warp_cache.warp);
+
+	memset(&rtpg_warp_cache, 0, sizeof(rtpg_warp_cache_t));
+	rtpg_warp_cache.src_srid = SRID_UNKNOWN;
+	rtpg_warp_cache.dst_srid = SRID_UNKNOWN;
+}
+
+#if POSTGIS_PGSQL_VERSION >= 96
+static void
+rtpg_warp_cache_callback(void *arg) {
+	rtpg_warp_cache_delete();
+}
+#else
+/* child of the cache context whose reset and delete methods free the cache */
+static void
+rtpg_warp_cache_context_init(MemoryContext context) {
+	/* nothing is allocated in this context */
+}
+
+static void
+rtpg_warp_cache_context_reset(MemoryContext context) {
+	rtpg_warp_cache_delete();
+}
+
+static void
+rtpg_warp_cache_context_delete(MemoryContext context) {
+	rtpg_warp_cache_delete();
+}
+
+static bool
+rtpg_warp_cache_context_is_empty(MemoryContext context) {
+	return false;
+}
+
+static void
+rtpg_warp_cache_context_stats(MemoryContext context, int level) {
+}
+
+#ifdef MEMORY_CONTEXT_CHECKING
+static void
+rtpg_warp_cache_context_check(MemoryContext context) {
+}
+#endif
+
+/* Memory context definition must match the current version of PostgreSQL */
+static MemoryContextMethods rtpg_warp_cache_context_methods = {
+	NULL,
+	NULL,
+	NULL,
+	rtpg_warp_cache_context_init,
+	rtpg_warp_cache_context_reset,
+	rtpg_warp_cache_context_delete,
+	NULL,
+	rtpg_warp_cache_context_is_empty,
+	rtpg_warp_cache_context_stats
+#ifdef MEMORY_CONTEXT_CHECKING
+	, rtpg_warp_cache_context_check
+#endif
+};
+#endif
+
+static rtpg_warp_cache_t *
+rtpg_warp_cache_get(void) {
+	if (rtpg_warp_cache.warp == NULL) {
+		MemoryContext old_context;
+
+		rtpg_warp_cache.context = AllocSetContextCreate(
+			CacheMemoryContext,
+			"PostGIS raster warp cache",
+			ALLOCSET_SMALL_MINSIZE,
+			ALLOCSET_SMALL_INITSIZE,
+			ALLOCSET_SMALL_MAXSIZE);
+
+#if POSTGIS_PGSQL_VERSION >= 96
+		{
+			MemoryContextCallback *callback = (MemoryContextCallback *) MemoryContextAlloc(rtpg_warp_cache.context, sizeof(MemoryContextCallback));
+			callback->func = rtpg_warp_cache_callback;
+			callback->arg = NULL;
+			MemoryContextRegisterResetCallback(rtpg_warp_cache.context, callback);
+		}
+#else
+		MemoryContextCreate(
+			T_AllocSetContext, sizeof(MemoryContextData),
+			&rtpg_warp_cache_context_methods,
+			rtpg_warp_cache.context,
+			"PostGIS raster warp cache callback");
+#endif
+
+		old_context = MemoryContextSwitchTo(rtpg_warp_cache.context);
+		rtpg_warp_cache.warp = rt_warp_cache_new();
+		MemoryContextSwitchTo(old_context);
+	}
+
+	if (rtpg_warp_cache.stmt_start != GetCurrentStatementStartTimestamp()) {
+		rtpg_warp_cache.stmt_start = GetCurrentStatementStartTimestamp();
+		rtpg_warp_cache.src_srid = SRID_UNKNOWN;
+		rtpg_warp_cache.dst_srid = SRID_UNKNOWN;
+	}
+
+	return &rtpg_warp_cache;
+}
+
+/* srtext of srid, looked up once per statement */
+static char *
+rtpg_warp_cache_srs(int srid, int *cached_srid, char **cached_srs) {
+	char *srs = NULL;
+
+	if (*cached_srid == srid && *cached_srs != NULL)
+		return *cached_srs;
+
+	srs = rtpg_getSR(srid);
+	if (srs == NULL)
+		return NULL;
+
+	if (*cached_srs != NULL)
+		pfree(*cached_srs);
+	*cached_srs = MemoryContextStrdup(rtpg_warp_cache.context, srs);
+	*cached_srid = srid;
+	pfree(srs);
+
+	return *cached_srs;
+}
+
 PG_FUNCTION_INFO_V1(RASTER_GDALWarp);
 Datum RASTER_GDALWarp(PG_FUNCTION_ARGS)
 {
@@ -866,6 +1021,7 @@ Datum RASTER_GDALWarp(PG_FUNCTION_ARGS)
 	int dst_srid = SRID_UNKNOWN;
 	char *dst_srs = NULL;
 	int no_srid = 0;
+	rtpg_warp_cache_t *cache = NULL;
 
 	double scale[2] = {0};
 	double *scale_x = NULL;
@@ -1041,10 +1197,12 @@ Datum RASTER_GDALWarp(PG_FUNCTION_ARGS)
 		PG_RETURN_POINTER(pgraster);
 	}
 
+	cache = rtpg_warp_cache_get();
+
 	/* get srses from srids */
 	if (!no_srid) {
 		/* source srs */
-		src_srs = rtpg_getSR(src_srid);
+		src_srs = rtpg_warp_cache_srs(src_srid, &(cache->src_srid), &(cache->src_srs));
 		if (NULL == src_srs) {
 			rt_raster_destroy(raster);
 			PG_FREE_IF_COPY(pgraster, 0);
@@ -1053,9 +1211,8 @@ Datum RASTER_GDALWarp(PG_FUNCTION_ARGS)
 		}
 		POSTGIS_RT_DEBUGF(4, "src srs: %s", src_srs);
 
-		dst_srs = rtpg_getSR(dst_srid);
+		dst_srs = rtpg_warp_cache_srs(dst_srid, &(cache->dst_srid), &(cache->dst_srs));
 		if (NULL == dst_srs) {
-			pfree(src_srs);
 			rt_raster_destroy(raster);
 			PG_FREE_IF_COPY(pgraster, 0);
 			elog(ERROR, "RASTER_GDALWarp: Target SRID (%d) is unknown", dst_srid);
@@ -1064,7 +1221,7 @@ Datum RASTER_GDALWarp(PG_FUNCTION_ARGS)
 		POSTGIS_RT_DEBUGF(4, "dst srs: %s", dst_srs);
 	}
 
-	rast = rt_raster_gdal_warp(
+	rast = rt_raster_gdal_warp_cached(
 		raster,
 		src_srs, dst_srs,
 		scale_x, scale_y,
@@ -1072,13 +1229,10 @@ Datum RASTER_GDALWarp(PG_FUNCTION_ARGS)
 		NULL, NULL,
 		grid_xw, grid_yw,
 		skew_x, skew_y,
-		alg, max_err);
+		alg, max_err,
+		cache->warp);
 	rt_raster_destroy(raster);
 	PG_FREE_IF_COPY(pgraster, 0);
-	if (!no_srid) {
-		pfree(src_srs);
-		pfree(dst_srs);
-	}
 	if (!rast) {
 		elog(ERROR, "RASTER_band: Could not create transformed raster");
 		PG_RETURN_NULL();
@@ -39,6 +39,10 @@
 #include <utils/builtins.h> /* for cstring_to_text */
 #include <catalog/pg_type.h> /* for INT2OID, INT4OID, FLOAT4OID, FLOAT8OID and TEXTOID */
 #include <executor/executor.h> /* for GetAttributeByName */
+#include <storage/buffile.h> /* for BufFile */
+#include <utils/memutils.h> /* for MemoryContextCreate */
+#include <access/xact.h> /* for IsTransactionState */
+#include <utils/hsearch.h> /* for HTAB */
 
 #include "../../postgis_config.h"
 #include "lwgeom_pg.h"
@@ -54,6 +58,9 @@ Datum RASTER_nMapAlgebraExpr(PG_FUNCTION_ARGS);
 /* raster union aggregate */
 Datum RASTER_union_transfn(PG_FUNCTION_ARGS);
 Datum RASTER_union_finalfn(PG_FUNCTION_ARGS);
+Datum RASTER_union_combinefn(PG_FUNCTION_ARGS);
+Datum RASTER_union_serialfn(PG_FUNCTION_ARGS);
+Datum RASTER_union_deserialfn(PG_FUNCTION_ARGS);
 
 /* raster clip */
 Datum RASTER_clip(PG_FUNCTION_ARGS);
@@ -1037,6 +1044,9 @@ typedef struct {
 		uint32_t spi_argcount;
 		uint8_t *spi_argpos;
 
+		/* expression compiled for evaluation without SPI, may be NULL */
+		rt_mapexpr compiled;
+
 		int hasval;
 		double val;
 	} expr[3];
@@ -1083,6 +1093,7 @@ static rtpg_nmapalgebraexpr_arg rtpg_nmapalgebraexpr_arg_init(int cnt, char **kw
 	for (i = 0; i < arg->callback.exprcount; i++) {
 		arg->callback.expr[i].spi_plan = NULL;
 		arg->callback.expr[i].spi_argcount = 0;
+		arg->callback.expr[i].compiled = NULL;
 		arg->callback.expr[i].spi_argpos = (uint8_t*)palloc(cnt * sizeof(uint8_t));
 		if (arg->callback.expr[i].spi_argpos == NULL) {
 			elog(ERROR, "rtpg_nmapalgebraexpr_arg_init: Could not allocate memory for spi_argpos");
@@ -1107,6 +1118,8 @@ static void rtpg_nmapalgebraexpr_arg_destroy(rtpg_nmapalgebraexpr_arg arg) {
 	for (i = 0; i < arg->callback.exprcount; i++) {
 		if (arg->callback.expr[i].spi_plan)
 			SPI_freeplan(arg->callback.expr[i].spi_plan);
+		if (arg->callback.expr[i].compiled)
+			rt_mapexpr_destroy(arg->callback.expr[i].compiled);
 		if (arg->callback.kw.count)
 			pfree(arg->callback.expr[i].spi_argpos);
 	}
@@ -1114,6 +1127,27 @@ static void rtpg_nmapalgebraexpr_arg_destroy(rtpg_nmapalgebraexpr_arg arg) {
 	pfree(arg);
 }
 
+/* value of a pixel whose expression evaluated to NULL */
+static void rtpg_nmapalgebraexpr_callback_null(
+	rt_iterator_arg arg, rtpg_nmapalgebraexpr_callback_arg *callback,
+	double *value, int *nodata
+) {
+	/* 2 raster, check nodatanodataval */
+	if (arg->rasters > 1) {
+		if (callback->nodatanodata.hasval)
+			*value = callback->nodatanodata.val;
+		else
+			*nodata = 1;
+	}
+	/* 1 raster, check nodataval */
+	else {
+		if (callback->expr[1].hasval)
+			*value = callback->expr[1].val;
+		else
+			*nodata = 1;
+	}
+}
+
 static int rtpg_nmapalgebraexpr_callback(
 	rt_iterator_arg arg, void *userarg,
 	double *value, int *nodata
@@ -1205,6 +1239,51 @@ static int rtpg_nmapalgebraexpr_callback(
 		}
 	}
 
+	/* evaluate compiled expression, the prepared plan is only needed if that fails */
+	if (plan != NULL && callback->expr[id].compiled != NULL) {
+		double kwval[12];
+		uint8_t kwnull[12];
+		double result = 0;
+		int resultnull = 0;
+		int r = 0;
+
+		memset(kwval, 0, sizeof(double) * callback->kw.count);
+		memset(kwnull, 0, sizeof(uint8_t) * callback->kw.count);
+
+		for (i = 0; i < callback->kw.count; i++) {
+			if (callback->expr[id].spi_argpos[i] < 1) continue;
+
+			/* [rast.*] and [rast1.*] are of the first raster, [rast2.*] of the second */
+			r = (i < 8) ? 0 : 1;
+			switch (i % 4) {
+				/* [rastN.x] */
+				case 0:
+					kwval[i] = arg->src_pixel[r][0] + 1;
+					break;
+				/* [rastN.y] */
+				case 1:
+					kwval[i] = arg->src_pixel[r][1] + 1;
+					break;
+				/* [rastN.val], [rastN] */
+				default:
+					if (!arg->nodata[r][0][0])
+						kwval[i] = arg->values[r][0][0];
+					else
+						kwnull[i] = 1;
+					break;
+			}
+		}
+
+		if (rt_mapexpr_eval(callback->expr[id].compiled, kwval, kwnull, &result, &resultnull)) {
+			plan = NULL;
+
+			if (!resultnull)
+				*value = result;
+			else
+				rtpg_nmapalgebraexpr_callback_null(arg, callback, value, nodata);
+		}
+	}
+
 	/* run prepared plan */
 	if (plan != NULL) {
 		Datum values[12];
@@ -1313,22 +1392,8 @@ static int rtpg_nmapalgebraexpr_callback(
 			*value = DatumGetFloat8(datum);
 			POSTGIS_RT_DEBUG(4, "Getting value from Datum");
 		}
-		else {
-			/* 2 raster, check nodatanodataval */
-			if (arg->rasters > 1) {
-				if (callback->nodatanodata.hasval)
-					*value = callback->nodatanodata.val;
-				else
-					*nodata = 1;
-			}
-			/* 1 raster, check nodataval */
-			else {
-				if (callback->expr[1].hasval)
-					*value = callback->expr[1].val;
-				else
-					*nodata = 1;
-			}
-		}
+		else
+			rtpg_nmapalgebraexpr_callback_null(arg, callback, value, nodata);
 
 		if (SPI_tuptable) SPI_freetuptable(tuptable);
 	}
@@ -1381,6 +1446,8 @@ Datum RASTER_nMapAlgebraExpr(PG_FUNCTION_ARGS)
 		"[rast2.val]",
 		"[rast2]"
 	};
+	/* positions are INT4, everything else is FLOAT8 */
+	const uint8_t argkwisint[] = {1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0};
 
 	if (PG_ARGISNULL(0))
 		PG_RETURN_NULL();
@@ -1503,6 +1570,7 @@ Datum RASTER_nMapAlgebraExpr(PG_FUNCTION_ARGS)
 		char *tmp = NULL;
 		char *sql = NULL;
 		char place[12] = "$1";
+		rt_mapexpr compiled = NULL;
 
 		if (PG_ARGISNULL(exprpos[i]))
 			continue;
@@ -1510,6 +1578,9 @@ Datum RASTER_nMapAlgebraExpr(PG_FUNCTION_ARGS)
 		expr = text_to_cstring(PG_GETARG_TEXT_P(exprpos[i]));
 		POSTGIS_RT_DEBUGF(3, "raw expr of argument #%d: %s", exprpos[i], expr);
 
+		/* compile expression, only used per pixel if it has keywords */
+		compiled = rt_mapexpr_compile(expr, argkwcount, (const char * const *) argkw, argkwisint);
+
 		for (j = 0, k = 1; j < argkwcount; j++) {
 			/* attempt to replace keyword with placeholder */
 			len = 0;
@@ -1577,7 +1648,10 @@ Datum RASTER_nMapAlgebraExpr(PG_FUNCTION_ARGS)
 				k++;
 			}
 
+			/* prepare the plan even if compiled, it checks the expression and takes the pixels that cannot be evaluated without SPI */
 			arg->callback.expr[i].spi_plan = SPI_prepare(sql, arg->callback.expr[i].spi_argcount, argtype);
+			arg->callback.expr[i].compiled = compiled;
+			compiled = NULL;
 			pfree(argtype);
 			pfree(sql);
 
@@ -1591,6 +1665,10 @@ Datum RASTER_nMapAlgebraExpr(PG_FUNCTION_ARGS)
 		/* no args, just execute query */
 		else {
 			POSTGIS_RT_DEBUGF(3, "expression parameter %d has no args, simply executing", exprpos[i]);
+			if (compiled != NULL) {
+				rt_mapexpr_destroy(compiled);
+				compiled = NULL;
+			}
 			err = SPI_execute(sql, TRUE, 0);
 			pfree(sql);
 
@@ -1759,206 +1837,852 @@ static rtpg_union_type rtpg_uniontype_index_from_name(const char *cutype) {
 	return UT_LAST;
 }
 
+/*
+ * ST_Union(raster) accumulates into a grid of fixed-size blocks aligned
+ * to the first non-empty input raster. Each input raster is only merged
+ * into the blocks it overlaps, so the cost of a tile is proportional to
+ * its own size instead of the size of the mosaic built so far.
+ *
+ * Every band argument owns one accumulator per pass (two for MEAN and
+ * RANGE), and a block holds the pixels of all accumulators one after the
+ * other. Blocks that were not used recently are written to a temporary
+ * file once the resident blocks grow past work_mem, and read back when a
+ * later raster touches them. The output raster is only assembled by the
+ * final function.
+ */
+
+/* width and height in pixels of a block */
+#define RTPG_UNION_BLOCK_SIZE 128
+
 typedef struct rtpg_union_band_arg_t *rtpg_union_band_arg;
 struct rtpg_union_band_arg_t {
 	int nband; /* source raster's band index, 0-based */
 	rtpg_union_type uniontype;
 
-	int numraster;
-	rt_raster *raster;
+	int numraster; /* number of accumulators, 2 for MEAN and RANGE */
+	int acc; /* index of first accumulator, -1 if not allocated */
+};
+
+typedef struct rtpg_union_acc_t *rtpg_union_acc;
+struct rtpg_union_acc_t {
+	rtpg_union_type uniontype; /* operation of this pass */
+
+	int ready; /* pixel type is known */
+	rt_pixtype pixtype;
+	int hasnodata;
+	double nodataval;
+
+	Size offset; /* offset of the accumulator in a block */
+	Size size; /* bytes of the accumulator in a block */
+};
+
+typedef struct {
+	int32 bx;
+	int32 by;
+} rtpg_union_block_key;
+
+typedef struct rtpg_union_block_t *rtpg_union_block;
+struct rtpg_union_block_t {
+	rtpg_union_block_key key; /* must be first */
+
+	uint8_t *data; /* accumulators, NULL if spilled */
+	Size size; /* bytes of data, less than blocksize if accumulators were added since */
+
+	off_t spillpos; /* position in spill file, -1 if never spilled */
+	Size spillsize;
+
+	/* list of resident blocks, most recently used first */
+	rtpg_union_block prev;
+	rtpg_union_block next;
 };
 
 typedef struct rtpg_union_arg_t *rtpg_union_arg;
 struct rtpg_union_arg_t {
 	int numband; /* number of bandargs */
 	rtpg_union_band_arg bandarg;
+
+	int numacc; /* number of accumulators */
+	rtpg_union_acc acc;
+	Size blocksize; /* bytes of all ready accumulators in a block */
+
+	/* 1x1 raster carrying the geotransform and SRID of the grid */
+	rt_raster grid;
+	double igt[6];
+	/* extent on the grid: minimum column, row and exclusive maximum column, row */
+	int32 extent[4];
+
+	MemoryContext context;
+	HTAB *blocks;
+	rtpg_union_block head;
+	rtpg_union_block tail;
+	Size resident; /* bytes of resident blocks */
+
+	BufFile *spill;
+	off_t spillend;
+#if POSTGIS_PGSQL_VERSION < 96
+	MemoryContext callback; /* child of context whose deletion closes the spill file */
+#else
+	MemoryContextCallback *callback; /* reset callback of context closing the spill file */
+#endif
 };
 
-static void rtpg_union_arg_destroy(rtpg_union_arg arg) {
-	int i = 0;
-	int j = 0;
-	int k = 0;
+/*
+ * The state lives in the aggregate context, which is reset for every group
+ * of a grouped or sorted aggregate and deleted with the executor state.
+ * The spill file is closed when that happens. On abort the resource owner
+ * has already closed it.
+ */
+static void rtpg_union_spill_close(rtpg_union_arg arg) {
+	if (arg->spill != NULL && IsTransactionState())
+		BufFileClose(arg->spill);
+	arg->spill = NULL;
+}
 
-	if (arg->bandarg != NULL) {
-		for (i = 0; i < arg->numband; i++) {
-			if (!arg->bandarg[i].numraster)
-				continue;
+#if POSTGIS_PGSQL_VERSION < 96
+typedef struct {
+	MemoryContextData header; /* must be first */
+	rtpg_union_arg arg;
+} rtpg_union_callback_context_t;
 
-			for (j = 0; j < arg->bandarg[i].numraster; j++) {
-				if (arg->bandarg[i].raster[j] == NULL)
-					continue;
+static void rtpg_union_callback_init(MemoryContext context) {
+	/* nothing is allocated in this context */
+}
 
-				for (k = rt_raster_get_num_bands(arg->bandarg[i].raster[j]) - 1; k >= 0; k--)
-					rt_band_destroy(rt_raster_get_band(arg->bandarg[i].raster[j], k));
-				rt_raster_destroy(arg->bandarg[i].raster[j]);
-			}
+/* the state goes with the parent context, whether reset or deleted */
+static void rtpg_union_callback_reset(MemoryContext context) {
+	rtpg_union_callback_context_t *callback = (rtpg_union_callback_context_t *) context;
 
-			pfree(arg->bandarg[i].raster);
-		}
+	if (callback->arg == NULL)
+		return;
+
+	rtpg_union_spill_close(callback->arg);
+	callback->arg->callback = NULL;
+	callback->arg = NULL;
+}
+
+static void rtpg_union_callback_delete(MemoryContext context) {
+	rtpg_union_callback_reset(context);
+}
+
+static bool rtpg_union_callback_is_empty(MemoryContext context) {
+	return false;
+}
 
+static void rtpg_union_callback_stats(MemoryContext context, int level) {
+}
+
+#ifdef MEMORY_CONTEXT_CHECKING
+static void rtpg_union_callback_check(MemoryContext context) {
+}
+#endif
+
+/* Memory context definition must match the current version of PostgreSQL */
+static MemoryContextMethods rtpg_union_callback_methods = {
+	NULL,
+	NULL,
+	NULL,
+	rtpg_union_callback_init,
+	rtpg_union_callback_reset,
+	rtpg_union_callback_delete,
+	NULL,
+	rtpg_union_callback_is_empty,
+	rtpg_union_callback_stats
+#ifdef MEMORY_CONTEXT_CHECKING
+	, rtpg_union_callback_check
+#endif
+};
+#else
+static void rtpg_union_callback_reset(void *arg) {
+	/* state destroyed before context reset */
+	if (arg == NULL)
+		return;
+	rtpg_union_spill_close((rtpg_union_arg) arg);
+}
+#endif
+
+static rtpg_union_arg rtpg_union_arg_init(MemoryContext context) {
+	rtpg_union_arg arg = NULL;
+	HASHCTL ctl;
+
+	arg = (rtpg_union_arg) MemoryContextAllocZero(context, sizeof(struct rtpg_union_arg_t));
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(rtpg_union_block_key);
+	ctl.entrysize = sizeof(struct rtpg_union_block_t);
+	ctl.hash = tag_hash;
+	ctl.hcxt = context;
+	arg->blocks = hash_create("PostGIS raster union blocks", 256, &ctl, HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	arg->context = context;
+	arg->spillend = 0;
+
+	/* close the spill file when context is reset or deleted */
+#if POSTGIS_PGSQL_VERSION < 96
+	arg->callback = MemoryContextCreate(
+		T_AllocSetContext, sizeof(rtpg_union_callback_context_t),
+		&rtpg_union_callback_methods,
+		context,
+		"PostGIS raster union spill"
+	);
+	((rtpg_union_callback_context_t *) arg->callback)->arg = arg;
+#else
+	arg->callback = (MemoryContextCallback *) MemoryContextAlloc(context, sizeof(MemoryContextCallback));
+	arg->callback->func = rtpg_union_callback_reset;
+	arg->callback->arg = (void *) arg;
+	MemoryContextRegisterResetCallback(context, arg->callback);
+#endif
+
+	return arg;
+}
+
+static void rtpg_union_arg_destroy(rtpg_union_arg arg) {
+#if POSTGIS_PGSQL_VERSION < 96
+	if (arg->callback != NULL)
+		MemoryContextDelete(arg->callback);
+#else
+	arg->callback->arg = NULL;
+#endif
+	rtpg_union_spill_close(arg);
+
+	hash_destroy(arg->blocks);
+
+	if (arg->grid != NULL)
+		rt_raster_destroy(arg->grid);
+	if (arg->acc != NULL)
+		pfree(arg->acc);
+	if (arg->bandarg != NULL)
 		pfree(arg->bandarg);
-	}
 
 	pfree(arg);
 }
 
-static int rtpg_union_callback(
-	rt_iterator_arg arg, void *userarg,
-	double *value, int *nodata
+/* allocate the accumulators of the bandargs that have none yet */
+static void rtpg_union_arg_add_accs(rtpg_union_arg arg) {
+	int numacc = arg->numacc;
+	int i;
+	int j;
+
+	for (i = 0; i < arg->numband; i++) {
+		if (arg->bandarg[i].acc < 0)
+			numacc += arg->bandarg[i].numraster;
+	}
+	if (numacc == arg->numacc)
+		return;
+
+	if (arg->acc == NULL)
+		arg->acc = (rtpg_union_acc) MemoryContextAllocZero(arg->context, sizeof(struct rtpg_union_acc_t) * numacc);
+	else {
+		arg->acc = (rtpg_union_acc) repalloc(arg->acc, sizeof(struct rtpg_union_acc_t) * numacc);
+		memset(arg->acc + arg->numacc, 0, sizeof(struct rtpg_union_acc_t) * (numacc - arg->numacc));
+	}
+
+	for (i = 0; i < arg->numband; i++) {
+		rtpg_union_band_arg bandarg = &(arg->bandarg[i]);
+
+		if (bandarg->acc >= 0)
+			continue;
+
+		bandarg->acc = arg->numacc;
+		for (j = 0; j < bandarg->numraster; j++) {
+			rtpg_union_acc acc = &(arg->acc[arg->numacc++]);
+
+			/* UT_MEAN and UT_RANGE require two passes */
+			/* UT_MEAN: first for UT_COUNT and second for UT_SUM */
+			/* UT_RANGE: first for UT_MIN and second for UT_MAX */
+			if (bandarg->uniontype == UT_MEAN)
+				acc->uniontype = (j < 1) ? UT_COUNT : UT_SUM;
+			else if (bandarg->uniontype == UT_RANGE)
+				acc->uniontype = (j < 1) ? UT_MIN : UT_MAX;
+			else
+				acc->uniontype = bandarg->uniontype;
+		}
+	}
+}
+
+/* fix the pixel type of an accumulator, placing it after the ready ones in the blocks */
+static void rtpg_union_acc_set(
+	rtpg_union_arg arg, rtpg_union_acc acc,
+	rt_pixtype pixtype, int hasnodata, double nodataval
 ) {
-	rtpg_union_type *utype = (rtpg_union_type *) userarg;
+	/* force band settings for UT_COUNT */
+	if (acc->uniontype == UT_COUNT) {
+		pixtype = PT_32BUI;
+		hasnodata = 0;
+		nodataval = 0;
+	}
 
-	if (arg == NULL)
-		return 0;
+	acc->ready = 1;
+	acc->pixtype = pixtype;
+	acc->hasnodata = hasnodata;
+	acc->nodataval = nodataval;
+
+	acc->offset = arg->blocksize;
+	acc->size = (Size) rt_pixtype_size(pixtype) * RTPG_UNION_BLOCK_SIZE * RTPG_UNION_BLOCK_SIZE;
+	arg->blocksize += acc->size;
+
+	POSTGIS_RT_DEBUGF(4, "(pixtype, hasnodata, nodataval) = (%s, %d, %f)", rt_pixtype_name(pixtype), hasnodata, nodataval);
+}
+
+/* wrap the pixels of an accumulator of a block as a band */
+static rt_band rtpg_union_block_band(rtpg_union_acc acc, uint8_t *data) {
+	rt_band band = rt_band_new_inline(
+		RTPG_UNION_BLOCK_SIZE, RTPG_UNION_BLOCK_SIZE,
+		acc->pixtype,
+		acc->hasnodata, acc->nodataval,
+		data + acc->offset
+	);
+	if (band == NULL)
+		elog(ERROR, "rtpg_union_block_band: Could not create band for block");
+
+	return band;
+}
+
+/* set the accumulators starting at byte from to NODATA, or 0 for UT_COUNT */
+static void rtpg_union_block_clear(rtpg_union_arg arg, uint8_t *data, Size from) {
+	int i;
+
+	for (i = 0; i < arg->numacc; i++) {
+		rtpg_union_acc acc = &(arg->acc[i]);
+		rt_band band = NULL;
+		Size pixbytes;
+		Size filled;
+		uint8_t *ptr;
+
+		if (!acc->ready || acc->offset < from)
+			continue;
+
+		ptr = data + acc->offset;
+		if (!acc->hasnodata || FLT_EQ(acc->nodataval, 0.0)) {
+			memset(ptr, 0, acc->size);
+			continue;
+		}
+
+		/* set the first pixel and replicate it */
+		band = rtpg_union_block_band(acc, data);
+		rt_band_set_pixel(band, 0, 0, acc->nodataval, NULL);
+		rt_band_destroy(band);
+
+		pixbytes = rt_pixtype_size(acc->pixtype);
+		for (filled = pixbytes; filled < acc->size; filled *= 2)
+			memcpy(ptr + filled, ptr, Min(filled, acc->size - filled));
+	}
+}
+
+static void rtpg_union_lru_unlink(rtpg_union_arg arg, rtpg_union_block block) {
+	if (block->prev != NULL)
+		block->prev->next = block->next;
+	else
+		arg->head = block->next;
+	if (block->next != NULL)
+		block->next->prev = block->prev;
+	else
+		arg->tail = block->prev;
+	block->prev = NULL;
+	block->next = NULL;
+}
+
+static void rtpg_union_lru_push(rtpg_union_arg arg, rtpg_union_block block) {
+	block->prev = NULL;
+	block->next = arg->head;
+	if (arg->head != NULL)
+		arg->head->prev = block;
+	arg->head = block;
+	if (arg->tail == NULL)
+		arg->tail = block;
+}
+
+/* write a block to the spill file and release its memory */
+static void rtpg_union_block_evict(rtpg_union_arg arg, rtpg_union_block block) {
+	MemoryContext oldcontext;
+
+	if (arg->spill == NULL) {
+		oldcontext = MemoryContextSwitchTo(arg->context);
+		arg->spill = BufFileCreateTemp(false);
+		MemoryContextSwitchTo(oldcontext);
+		arg->spillend = 0;
+	}
+
+	/* rewrite in place unless accumulators were added since */
+	if (block->spillpos < 0 || block->spillsize != block->size) {
+		block->spillpos = arg->spillend;
+		block->spillsize = block->size;
+		arg->spillend += block->size;
+	}
 
 	if (
-		arg->rasters != 2 ||
-		arg->rows != 1 ||
-		arg->columns != 1
+		BufFileSeek(arg->spill, 0, block->spillpos, SEEK_SET) != 0 ||
+		BufFileWrite(arg->spill, block->data, block->size) != block->size
 	) {
-		elog(ERROR, "rtpg_union_callback: Invalid arguments passed to callback");
-		return 0;
+		elog(ERROR, "rtpg_union_block_evict: Could not write block to temporary file");
 	}
 
-	*value = 0;
-	*nodata = 0;
+	POSTGIS_RT_DEBUGF(4, "spilled block (%d, %d) at %ld", block->key.bx, block->key.by, (long) block->spillpos);
 
-	/* handle NODATA situations except for COUNT, which is a special case */
-	if (*utype != UT_COUNT) {
-		/* both NODATA */
-		if (arg->nodata[0][0][0] && arg->nodata[1][0][0]) {
-			*nodata = 1;
-			POSTGIS_RT_DEBUGF(4, "value, nodata = %f, %d", *value, *nodata);
-			return 1;
-		}
-		/* second NODATA */
-		else if (!arg->nodata[0][0][0] && arg->nodata[1][0][0]) {
-			*value = arg->values[0][0][0];
-			POSTGIS_RT_DEBUGF(4, "value, nodata = %f, %d", *value, *nodata);
-			return 1;
-		}
-		/* first NODATA */
-		else if (arg->nodata[0][0][0] && !arg->nodata[1][0][0]) {
-			*value = arg->values[1][0][0];
-			POSTGIS_RT_DEBUGF(4, "value, nodata = %f, %d", *value, *nodata);
-			return 1;
+	rtpg_union_lru_unlink(arg, block);
+	arg->resident -= block->size;
+	pfree(block->data);
+	block->data = NULL;
+}
+
+/* spill least recently used blocks, except keep, while over work_mem */
+static void rtpg_union_enforce_budget(rtpg_union_arg arg, rtpg_union_block keep) {
+	Size budget = (Size) u_sess->attr.attr_memory.work_mem * 1024L;
+
+	while (arg->resident > budget && arg->tail != NULL && arg->tail != keep)
+		rtpg_union_block_evict(arg, arg->tail);
+}
+
+/* get a resident block, creating it if needed */
+static rtpg_union_block rtpg_union_block_get(rtpg_union_arg arg, int32 bx, int32 by) {
+	rtpg_union_block_key key;
+	rtpg_union_block block;
+	bool found;
+
+	key.bx = bx;
+	key.by = by;
+	block = (rtpg_union_block) hash_search(arg->blocks, &key, HASH_ENTER, &found);
+
+	if (!found) {
+		block->data = (uint8_t *) MemoryContextAlloc(arg->context, arg->blocksize);
+		block->size = arg->blocksize;
+		block->spillpos = -1;
+		block->spillsize = 0;
+		block->prev = NULL;
+		block->next = NULL;
+		rtpg_union_block_clear(arg, block->data, 0);
+
+		arg->resident += block->size;
+		rtpg_union_lru_push(arg, block);
+	}
+	else if (block->data == NULL) {
+		if (arg->spill == NULL)
+			elog(ERROR, "rtpg_union_block_get: Temporary file of union state is closed");
+
+		block->data = (uint8_t *) MemoryContextAlloc(arg->context, Max(block->size, arg->blocksize));
+		if (
+			BufFileSeek(arg->spill, 0, block->spillpos, SEEK_SET) != 0 ||
+			BufFileRead(arg->spill, block->data, block->size) != block->size
+		) {
+			elog(ERROR, "rtpg_union_block_get: Could not read block from temporary file");
 		}
+
+		arg->resident += block->size;
+		rtpg_union_lru_push(arg, block);
+	}
+	else if (arg->head != block) {
+		rtpg_union_lru_unlink(arg, block);
+		rtpg_union_lru_push(arg, block);
+	}
+
+	/* accumulators added since the block was created */
+	if (block->size < arg->blocksize) {
+		block->data = (uint8_t *) repalloc(block->data, arg->blocksize);
+		rtpg_union_block_clear(arg, block->data, block->size);
+		arg->resident += arg->blocksize - block->size;
+		block->size = arg->blocksize;
+	}
+
+	rtpg_union_enforce_budget(arg, block);
+
+	return block;
+}
+
+/* floor division, block index of a grid column or row */
+static int32 rtpg_union_block_index(int32 v) {
+	if (v >= 0)
+		return v / RTPG_UNION_BLOCK_SIZE;
+	return -((-v + RTPG_UNION_BLOCK_SIZE - 1) / RTPG_UNION_BLOCK_SIZE);
+}
+
+/* merge two values of a pixel, returns 1 if the accumulated value changed */
+static int rtpg_union_pixel(
+	rtpg_union_type utype, int combine,
+	double *value, int nodata,
+	double inval, int innodata
+) {
+	/* second NODATA, including both NODATA */
+	if (innodata)
+		return 0;
+	/* first NODATA, except for COUNT which has no NODATA */
+	else if (nodata && utype != UT_COUNT) {
+		*value = inval;
+		return 1;
 	}
 
-	switch (*utype) {
+	switch (utype) {
 		case UT_FIRST:
-			*value = arg->values[0][0][0];
-			break;
+			return 0;
 		case UT_MIN:
-			if (arg->values[0][0][0] < arg->values[1][0][0])
-				*value = arg->values[0][0][0];
-			else
-				*value = arg->values[1][0][0];
-			break;
+			if (inval < *value) {
+				*value = inval;
+				return 1;
+			}
+			return 0;
 		case UT_MAX:
-			if (arg->values[0][0][0] > arg->values[1][0][0])
-				*value = arg->values[0][0][0];
-			else
-				*value = arg->values[1][0][0];
-			break;
+			if (inval > *value) {
+				*value = inval;
+				return 1;
+			}
+			return 0;
 		case UT_COUNT:
-			/* both NODATA */
-			if (arg->nodata[0][0][0] && arg->nodata[1][0][0])
-				*value = 0;
-			/* second NODATA */
-			else if (!arg->nodata[0][0][0] && arg->nodata[1][0][0])
-				*value = arg->values[0][0][0];
-			/* first NODATA */
-			else if (arg->nodata[0][0][0] && !arg->nodata[1][0][0])
-				*value = 1;
-			/* has value, increment */
+			/* partial counts of parallel workers add up */
+			if (combine)
+				*value += inval;
 			else
-				*value = arg->values[0][0][0] + 1;
-			break;
+				*value += 1;
+			return 1;
 		case UT_SUM:
-			*value = arg->values[0][0][0] + arg->values[1][0][0];
-			break;
+			*value += inval;
+			return 1;
 		case UT_MEAN:
 		case UT_RANGE:
-			break;
+			return 0;
 		case UT_LAST:
 		default:
-			*value = arg->values[1][0][0];
-			break;
+			*value = inval;
+			return 1;
 	}
+}
 
-	POSTGIS_RT_DEBUGF(4, "value, nodata = %f, %d", *value, *nodata);
+/*
+ * merge the pixels of band into accumulator k, with the upper-left pixel
+ * of band at grid column col and row row. only the blocks overlapped are
+ * touched. the (x, y, width, height) window of band is merged
+ */
+static void rtpg_union_merge_band(
+	rtpg_union_arg arg, int k, int combine,
+	rt_band band,
+	int x, int y, int width, int height,
+	int32 col, int32 row
+) {
+	rtpg_union_acc acc = &(arg->acc[k]);
+	rtpg_union_block block = NULL;
+	rt_band blockband = NULL;
+	int32 bx;
+	int32 by;
+	int32 c0, c1;
+	int32 r0, r1;
+	int32 c, r;
+	double inval;
+	int innodata;
+	double value;
+	int nodata;
+
+	if (width < 1 || height < 1)
+		return;
+
+	for (by = rtpg_union_block_index(row); by <= rtpg_union_block_index(row + height - 1); by++) {
+		r0 = Max(row, by * RTPG_UNION_BLOCK_SIZE);
+		r1 = Min(row + height, (by + 1) * RTPG_UNION_BLOCK_SIZE);
+
+		for (bx = rtpg_union_block_index(col); bx <= rtpg_union_block_index(col + width - 1); bx++) {
+			c0 = Max(col, bx * RTPG_UNION_BLOCK_SIZE);
+			c1 = Min(col + width, (bx + 1) * RTPG_UNION_BLOCK_SIZE);
+
+			block = rtpg_union_block_get(arg, bx, by);
+			blockband = rtpg_union_block_band(acc, block->data);
+
+			for (r = r0; r < r1; r++) {
+				for (c = c0; c < c1; c++) {
+					if (rt_band_get_pixel(band, x + c - col, y + r - row, &inval, &innodata) != ES_NONE)
+						elog(ERROR, "rtpg_union_merge_band: Could not get pixel of input band");
+
+					/* NODATA leaves the accumulated value as is */
+					if (innodata)
+						continue;
+
+					if (rt_band_get_pixel(
+						blockband,
+						c - bx * RTPG_UNION_BLOCK_SIZE, r - by * RTPG_UNION_BLOCK_SIZE,
+						&value, &nodata
+					) != ES_NONE) {
+						elog(ERROR, "rtpg_union_merge_band: Could not get pixel of block");
+					}
 
+					if (!rtpg_union_pixel(acc->uniontype, combine, &value, nodata, inval, innodata))
+						continue;
 
-	return 1;
+					if (rt_band_set_pixel(
+						blockband,
+						c - bx * RTPG_UNION_BLOCK_SIZE, r - by * RTPG_UNION_BLOCK_SIZE,
+						value, NULL
+					) != ES_NONE) {
+						elog(ERROR, "rtpg_union_merge_band: Could not set pixel of block");
+					}
+				}
+			}
+
+			rt_band_destroy(blockband);
+		}
+	}
 }
 
-static int rtpg_union_mean_callback(
-	rt_iterator_arg arg, void *userarg,
-	double *value, int *nodata
-) {
-	if (arg == NULL)
-		return 0;
+/* grid column and row of the upper-left pixel of raster, which must be aligned with the grid */
+static void rtpg_union_grid_offset(rtpg_union_arg arg, rt_raster raster, int32 *col, int32 *row) {
+	int aligned = 0;
+	char *reason = NULL;
+	double gt[6] = {0};
+	double xr;
+	double yr;
+
+	if (rt_raster_same_alignment(arg->grid, raster, &aligned, &reason) != ES_NONE)
+		elog(ERROR, "rtpg_union_grid_offset: Could not test for alignment of raster");
+	if (!aligned)
+		elog(ERROR, "rtpg_union_grid_offset: The rasters are not aligned: %s", reason);
+
+	rt_raster_get_geotransform_matrix(raster, gt);
+	if (rt_raster_geopoint_to_cell(arg->grid, gt[0], gt[3], &xr, &yr, arg->igt) != ES_NONE)
+		elog(ERROR, "rtpg_union_grid_offset: Could not compute offset of raster");
+
+	/* output raster dimensions are 16-bit, so are offsets within a valid union */
+	if (fabs(xr) > INT32_MAX / 2 || fabs(yr) > INT32_MAX / 2)
+		elog(ERROR, "rtpg_union_grid_offset: Extent of union is too large");
+
+	*col = (int32) xr;
+	*row = (int32) yr;
+}
+
+/* use the first raster as grid */
+static void rtpg_union_grid_set(rtpg_union_arg arg, rt_raster raster) {
+	MemoryContext oldcontext;
+	double gt[6] = {0};
+
+	oldcontext = MemoryContextSwitchTo(arg->context);
+	arg->grid = rt_raster_new(1, 1);
+	MemoryContextSwitchTo(oldcontext);
+	if (arg->grid == NULL)
+		elog(ERROR, "rtpg_union_grid_set: Could not create grid of union");
+
+	rt_raster_get_geotransform_matrix(raster, gt);
+	rt_raster_set_geotransform_matrix(arg->grid, gt);
+	rt_raster_set_srid(arg->grid, rt_raster_get_srid(raster));
+	if (rt_raster_get_inverse_geotransform_matrix(arg->grid, NULL, arg->igt) != ES_NONE)
+		elog(ERROR, "rtpg_union_grid_set: Could not get inverse geotransform of grid");
+}
+
+/* grow the extent of the union */
+static void rtpg_union_extend(rtpg_union_arg arg, int32 col, int32 row, int32 width, int32 height, int first) {
+	if (first) {
+		arg->extent[0] = col;
+		arg->extent[1] = row;
+		arg->extent[2] = col + width;
+		arg->extent[3] = row + height;
+	}
+	else {
+		arg->extent[0] = Min(arg->extent[0], col);
+		arg->extent[1] = Min(arg->extent[1], row);
+		arg->extent[2] = Max(arg->extent[2], col + width);
+		arg->extent[3] = Max(arg->extent[3], row + height);
+	}
 
 	if (
-		arg->rasters != 2 ||
-		arg->rows != 1 ||
-		arg->columns != 1
+		arg->extent[2] - arg->extent[0] > UINT16_MAX ||
+		arg->extent[3] - arg->extent[1] > UINT16_MAX
 	) {
-		elog(ERROR, "rtpg_union_mean_callback: Invalid arguments passed to callback");
-		return 0;
+		elog(ERROR, "rtpg_union_extend: Union of rasters would be larger than %d x %d pixels", UINT16_MAX, UINT16_MAX);
 	}
+}
 
-	*value = 0;
-	*nodata = 1;
+/* merge a raster into the union */
+static void rtpg_union_add_raster(rtpg_union_arg arg, rt_raster raster, int nbnodata) {
+	rt_band band = NULL;
+	int32 col = 0;
+	int32 row = 0;
+	int width;
+	int height;
+	int first = 0;
+	int i;
+	int j;
 
-	POSTGIS_RT_DEBUGF(4, "rast0: %f %d", arg->values[0][0][0], arg->nodata[0][0][0]);
-	POSTGIS_RT_DEBUGF(4, "rast1: %f %d", arg->values[1][0][0], arg->nodata[1][0][0]);
+	if (raster == NULL || rt_raster_is_empty(raster))
+		return;
 
-	if (!arg->nodata[0][0][0] && FLT_NEQ(arg->values[0][0][0], 0.0) && !arg->nodata[1][0][0])
-	{
-		*value = arg->values[1][0][0] / arg->values[0][0][0];
-		*nodata = 0;
+	width = rt_raster_get_width(raster);
+	height = rt_raster_get_height(raster);
+
+	if (arg->grid == NULL) {
+		rtpg_union_grid_set(arg, raster);
+		first = 1;
 	}
+	else
+		rtpg_union_grid_offset(arg, raster, &col, &row);
+	rtpg_union_extend(arg, col, row, width, height, first);
 
-	POSTGIS_RT_DEBUGF(4, "value, nodata = (%f, %d)", *value, *nodata);
+	for (i = 0; i < arg->numband; i++) {
+		rtpg_union_band_arg bandarg = &(arg->bandarg[i]);
 
-	return 1;
+		band = NULL;
+		if (rt_raster_has_band(raster, bandarg->nband))
+			band = rt_raster_get_band(raster, bandarg->nband);
+		else if (!nbnodata)
+			elog(ERROR, "rtpg_union_add_raster: Could not get band at index %d of raster", bandarg->nband);
+
+		for (j = 0; j < bandarg->numraster; j++) {
+			rtpg_union_acc acc = &(arg->acc[bandarg->acc + j]);
+
+			/* determine pixtype, hasnodata and nodataval */
+			if (!acc->ready) {
+				double nodataval;
+
+				if (band != NULL) {
+					if (rt_band_get_hasnodata_flag(band))
+						rt_band_get_nodata(band, &nodataval);
+					else
+						nodataval = rt_band_get_min_value(band);
+					rtpg_union_acc_set(arg, acc, rt_band_get_pixtype(band), 1, nodataval);
+				}
+				else
+					rtpg_union_acc_set(arg, acc, PT_64BF, 1, rt_pixtype_get_min_value(PT_64BF));
+			}
+
+			/* missing band is NODATA, which leaves the accumulator as is */
+			if (band == NULL)
+				continue;
+
+			rtpg_union_merge_band(arg, bandarg->acc + j, 0, band, 0, 0, width, height, col, row);
+		}
+	}
 }
+/* build the output raster from the blocks */
+static rt_raster rtpg_union_output(rtpg_union_arg arg) {
+	rt_raster raster = NULL;
+	rt_band *band = NULL;
+	HASH_SEQ_STATUS status;
+	rtpg_union_block block = NULL;
+	double gt[6] = {0};
+	int width = arg->extent[2] - arg->extent[0];
+	int height = arg->extent[3] - arg->extent[1];
+	int numbands = 0;
+	int32 c0, c1;
+	int32 r0, r1;
+	int32 c, r;
+	int i;
 
-static int rtpg_union_range_callback(
-	rt_iterator_arg arg, void *userarg,
-	double *value, int *nodata
-) {
-	if (arg == NULL)
-		return 0;
+	raster = rt_raster_new(width, height);
+	if (raster == NULL)
+		elog(ERROR, "rtpg_union_output: Could not create output raster");
 
-	if (
-		arg->rasters != 2 ||
-		arg->rows != 1 ||
-		arg->columns != 1
-	) {
-		elog(ERROR, "rtpg_union_range_callback: Invalid arguments passed to callback");
-		return 0;
+	rt_raster_get_geotransform_matrix(arg->grid, gt);
+	rt_raster_cell_to_geopoint(arg->grid, arg->extent[0], arg->extent[1], &(gt[0]), &(gt[3]), NULL);
+	rt_raster_set_geotransform_matrix(raster, gt);
+	rt_raster_set_srid(raster, rt_raster_get_srid(arg->grid));
+
+	/* one output band per bandarg, NODATA where nothing was merged */
+	band = (rt_band *) palloc0(sizeof(rt_band) * (arg->numband + 1));
+	for (i = 0; i < arg->numband; i++) {
+		rtpg_union_acc acc = &(arg->acc[arg->bandarg[i].acc]);
+
+		if (!acc->ready)
+			continue;
+
+		/* MEAN and RANGE take the type of the SUM or MAX */
+		if (arg->bandarg[i].numraster > 1)
+			acc++;
+
+		if (rt_raster_generate_new_band(
+			raster,
+			acc->pixtype,
+			acc->hasnodata ? acc->nodataval : 0,
+			acc->hasnodata, acc->nodataval,
+			numbands
+		) < 0) {
+			elog(ERROR, "rtpg_union_output: Could not add band to output raster");
+		}
+		band[i] = rt_raster_get_band(raster, numbands++);
 	}
 
-	*value = 0;
-	*nodata = 1;
+	if (!numbands) {
+		pfree(band);
+		rt_raster_destroy(raster);
+		return NULL;
+	}
 
-	POSTGIS_RT_DEBUGF(4, "rast0: %f %d", arg->values[0][0][0], arg->nodata[0][0][0]);
-	POSTGIS_RT_DEBUGF(4, "rast1: %f %d", arg->values[1][0][0], arg->nodata[1][0][0]);
+	hash_seq_init(&status, arg->blocks);
+	while ((block = (rtpg_union_block) hash_seq_search(&status)) != NULL) {
+		c0 = Max(arg->extent[0], block->key.bx * RTPG_UNION_BLOCK_SIZE);
+		c1 = Min(arg->extent[2], (block->key.bx + 1) * RTPG_UNION_BLOCK_SIZE);
+		r0 = Max(arg->extent[1], block->key.by * RTPG_UNION_BLOCK_SIZE);
+		r1 = Min(arg->extent[3], (block->key.by + 1) * RTPG_UNION_BLOCK_SIZE);
+		if (c0 >= c1 || r0 >= r1)
+			continue;
 
-	if (
-		!arg->nodata[0][0][0] &&
-		!arg->nodata[1][0][0]
-	) {
-		*value = arg->values[1][0][0] - arg->values[0][0][0];
-		*nodata = 0;
+		block = rtpg_union_block_get(arg, block->key.bx, block->key.by);
+
+		for (i = 0; i < arg->numband; i++) {
+			rtpg_union_band_arg bandarg = &(arg->bandarg[i]);
+			rtpg_union_acc acc = &(arg->acc[bandarg->acc]);
+
+			if (band[i] == NULL)
+				continue;
+
+			/* copy the accumulated pixels */
+			if (bandarg->numraster < 2) {
+				int pixbytes = rt_pixtype_size(acc->pixtype);
+
+				for (r = r0; r < r1; r++) {
+					uint8_t *ptr = block->data + acc->offset + (
+						(Size) (r - block->key.by * RTPG_UNION_BLOCK_SIZE) * RTPG_UNION_BLOCK_SIZE +
+						(c0 - block->key.bx * RTPG_UNION_BLOCK_SIZE)
+					) * pixbytes;
+
+					if (rt_band_set_pixel_line(
+						band[i],
+						c0 - arg->extent[0], r - arg->extent[1],
+						ptr, c1 - c0
+					) != ES_NONE) {
+						elog(ERROR, "rtpg_union_output: Could not set pixel line of output band");
+					}
+				}
+			}
+			/* MEAN is SUM / COUNT, RANGE is MAX - MIN */
+			else {
+				rt_band first = rtpg_union_block_band(acc, block->data);
+				rt_band second = rtpg_union_block_band(acc + 1, block->data);
+				double value[2];
+				int nodata[2];
+
+				for (r = r0; r < r1; r++) {
+					for (c = c0; c < c1; c++) {
+						int x = c - block->key.bx * RTPG_UNION_BLOCK_SIZE;
+						int y = r - block->key.by * RTPG_UNION_BLOCK_SIZE;
+
+						if (
+							rt_band_get_pixel(first, x, y, &(value[0]), &(nodata[0])) != ES_NONE ||
+							rt_band_get_pixel(second, x, y, &(value[1]), &(nodata[1])) != ES_NONE
+						) {
+							elog(ERROR, "rtpg_union_output: Could not get pixel of block");
+						}
+
+						if (nodata[0] || nodata[1])
+							continue;
+
+						if (bandarg->uniontype == UT_MEAN) {
+							if (FLT_EQ(value[0], 0.0))
+								continue;
+							value[1] = value[1] / value[0];
+						}
+						else
+							value[1] = value[1] - value[0];
+
+						if (rt_band_set_pixel(
+							band[i],
+							c - arg->extent[0], r - arg->extent[1],
+							value[1], NULL
+						) != ES_NONE) {
+							elog(ERROR, "rtpg_union_output: Could not set pixel of output band");
+						}
+					}
+				}
+
+				rt_band_destroy(first);
+				rt_band_destroy(second);
+			}
+		}
 	}
 
-	POSTGIS_RT_DEBUGF(4, "value, nodata = (%f, %d)", *value, *nodata);
+	pfree(band);
 
-	return 1;
+	return raster;
 }
 
 /* called for ST_Union(raster, unionarg[]) */
@@ -2046,7 +2770,7 @@ static int rtpg_union_unionarg_process(rtpg_union_arg arg, ArrayType *array) {
 
 		arg->bandarg[i].uniontype = utype;
 		arg->bandarg[i].nband = nband - 1;
-		arg->bandarg[i].raster = NULL;
+		arg->bandarg[i].acc = -1;
 
 		if (
 			utype != UT_MEAN &&
@@ -2092,34 +2816,19 @@ static int rtpg_union_noarg(rtpg_union_arg arg, rt_raster raster) {
 		return 0;
 	}
 
+	/* new bands are NODATA over the extent unioned so far */
 	i = arg->numband;
 	arg->numband = numbands;
 	for (; i < arg->numband; i++) {
-		POSTGIS_RT_DEBUGF(4, "Adding bandarg for band at index %d", i);
-		arg->bandarg[i].uniontype = UT_LAST;
-		arg->bandarg[i].nband = i;
-		arg->bandarg[i].numraster = 1;
-
-		arg->bandarg[i].raster = (rt_raster *) palloc(sizeof(rt_raster) * arg->bandarg[i].numraster);
-		if (arg->bandarg[i].raster == NULL) {
-			elog(ERROR, "rtpg_union_noarg: Could not allocate memory for working rasters");
-			return 0;
-		}
-		memset(arg->bandarg[i].raster, 0, sizeof(rt_raster) * arg->bandarg[i].numraster);
-
-		/* add new working rt_raster but only if working raster already exists */
-		if (!rt_raster_is_empty(arg->bandarg[0].raster[0])) {
-			arg->bandarg[i].raster[0] = rt_raster_clone(arg->bandarg[0].raster[0], 0); /* shallow clone */
-			if (arg->bandarg[i].raster[0] == NULL) {
-				elog(ERROR, "rtpg_union_noarg: Could not create working raster");
-				return 0;
-			}
-		}
+		POSTGIS_RT_DEBUGF(4, "Adding bandarg for band at index %d", i);
+		arg->bandarg[i].uniontype = UT_LAST;
+		arg->bandarg[i].nband = i;
+		arg->bandarg[i].numraster = 1;
+		arg->bandarg[i].acc = -1;
 	}
 
 	return 1;
 }
-
 /* UNION aggregate transition function */
 PG_FUNCTION_INFO_V1(RASTER_union_transfn);
 Datum RASTER_union_transfn(PG_FUNCTION_ARGS)
@@ -2131,34 +2840,14 @@ Datum RASTER_union_transfn(PG_FUNCTION_ARGS)
 
 	rt_pgraster *pgraster = NULL;
 	rt_raster raster = NULL;
-	rt_raster _raster = NULL;
-	rt_band _band = NULL;
 	int nband = 1;
-	int noerr = 1;
-	int isempty[2] = {0};
-	int hasband[2] = {0};
 	int nargs = 0;
-	double _offset[4] = {0.};
 	int nbnodata = 0; /* 1 if adding bands */
 
 	int i = 0;
-	int j = 0;
-	int k = 0;
 
-	rt_iterator itrset;
 	char *utypename = NULL;
 	rtpg_union_type utype = UT_LAST;
-	rt_pixtype pixtype = PT_END;
-	int hasnodata = 1;
-	double nodataval = 0;
-
-	rt_raster iraster = NULL;
-	rt_band iband = NULL;
-	int reuserast = 0;
-	int y = 0;
-	uint16_t _dim[2] = {0};
-	void *vals = NULL;
-	uint16_t nvals = 0;
 
 	POSTGIS_RT_DEBUG(3, "Starting...");
 
@@ -2174,16 +2863,7 @@ Datum RASTER_union_transfn(PG_FUNCTION_ARGS)
 	if (PG_ARGISNULL(0)) {
 		POSTGIS_RT_DEBUG(3, "Creating state variable");
 		/* allocate container in aggcontext */
-		iwr = (rtpg_union_arg)MemoryContextAlloc(aggcontext, sizeof(struct rtpg_union_arg_t));
-		if (iwr == NULL) {
-			MemoryContextSwitchTo(oldcontext);
-			elog(ERROR, "RASTER_union_transfn: Could not allocate memory for state variable");
-			PG_RETURN_NULL();
-		}
-
-		iwr->numband = 0;
-		iwr->bandarg = NULL;
-
+		iwr = rtpg_union_arg_init(aggcontext);
 		skiparg = 0;
 	}
 	else {
@@ -2293,7 +2973,7 @@ Datum RASTER_union_transfn(PG_FUNCTION_ARGS)
 						}
 						else
 							iwr->bandarg[i].numraster = 1;
-						iwr->bandarg[i].raster = NULL;
+						iwr->bandarg[i].acc = -1;
 					}
 
 					break;
@@ -2338,7 +3018,7 @@ Datum RASTER_union_transfn(PG_FUNCTION_ARGS)
 					iwr->bandarg[0].nband = nband - 1;
 
 					iwr->bandarg[0].numraster = 1;
-					iwr->bandarg[0].raster = NULL;
+					iwr->bandarg[0].acc = -1;
 					break;
 				/* only other type allowed is unionarg */
 				default:
@@ -2377,52 +3057,6 @@ Datum RASTER_union_transfn(PG_FUNCTION_ARGS)
 				iwr->bandarg[0].numraster = 2;
 			}
 		}
-
-		/* allocate space for pointers to rt_raster */
-		for (i = 0; i < iwr->numband; i++) {
-			POSTGIS_RT_DEBUGF(4, "iwr->bandarg[%d].raster @ %p", i, iwr->bandarg[i].raster);
-
-			/* no need to allocate */
-			if (iwr->bandarg[i].raster != NULL)
-				continue;
-
-			POSTGIS_RT_DEBUGF(4, "Allocating space for working rasters of band %d", i);
-
-			iwr->bandarg[i].raster = (rt_raster *) palloc(sizeof(rt_raster) * iwr->bandarg[i].numraster);
-			if (iwr->bandarg[i].raster == NULL) {
-
-				rtpg_union_arg_destroy(iwr);
-				if (raster != NULL) {
-					rt_raster_destroy(raster);
-					PG_FREE_IF_COPY(pgraster, 1);
-				}
-
-				MemoryContextSwitchTo(oldcontext);
-				elog(ERROR, "RASTER_union_transfn: Could not allocate memory for working raster(s)");
-				PG_RETURN_NULL();
-			}
-
-			memset(iwr->bandarg[i].raster, 0, sizeof(rt_raster) * iwr->bandarg[i].numraster);
-
-			/* add new working rt_raster but only if working raster already exists */
-			if (i > 0 && !rt_raster_is_empty(iwr->bandarg[0].raster[0])) {
-				for (j = 0; j < iwr->bandarg[i].numraster; j++) {
-					iwr->bandarg[i].raster[j] = rt_raster_clone(iwr->bandarg[0].raster[0], 0); /* shallow clone */
-					if (iwr->bandarg[i].raster[j] == NULL) {
-
-						rtpg_union_arg_destroy(iwr);
-						if (raster != NULL) {
-							rt_raster_destroy(raster);
-							PG_FREE_IF_COPY(pgraster, 1);
-						}
-
-						MemoryContextSwitchTo(oldcontext);
-						elog(ERROR, "RASTER_union_transfn: Could not create working raster");
-						PG_RETURN_NULL();
-					}
-				}
-			}
-		}
 	}
 	/* only raster, no additional args */
 	/* only do this if raster isn't empty */
@@ -2443,364 +3077,329 @@ Datum RASTER_union_transfn(PG_FUNCTION_ARGS)
 		}
 	}
 
-	/* init itrset */
-	itrset = (rt_iterator)palloc(sizeof(struct rt_iterator_t) * 2);
-	if (itrset == NULL) {
+	/* accumulators of new bandargs */
+	rtpg_union_arg_add_accs(iwr);
 
-		rtpg_union_arg_destroy(iwr);
-		if (raster != NULL) {
-			rt_raster_destroy(raster);
-			PG_FREE_IF_COPY(pgraster, 1);
-		}
+	/* merge raster into the blocks it overlaps */
+	rtpg_union_add_raster(iwr, raster, nbnodata);
 
-		MemoryContextSwitchTo(oldcontext);
-		elog(ERROR, "RASTER_union_transfn: Could not allocate memory for iterator arguments");
-		PG_RETURN_NULL();
+	if (raster != NULL) {
+		rt_raster_destroy(raster);
+		PG_FREE_IF_COPY(pgraster, 1);
 	}
 
-	/* by band to UNION */
-	for (i = 0; i < iwr->numband; i++) {
-
-		/* by raster */
-		for (j = 0; j < iwr->bandarg[i].numraster; j++) {
-			reuserast = 0;
-
-			/* type of union */
-			utype = iwr->bandarg[i].uniontype;
-
-			/* raster flags */
-			isempty[0] = rt_raster_is_empty(iwr->bandarg[i].raster[j]);
-			isempty[1] = rt_raster_is_empty(raster);
-
-			if (!isempty[0])
-				hasband[0] = rt_raster_has_band(iwr->bandarg[i].raster[j], 0);
-			if (!isempty[1])
-				hasband[1] = rt_raster_has_band(raster, iwr->bandarg[i].nband);
-
-			/* determine pixtype, hasnodata and nodataval */
-			_band = NULL;
-			if (!isempty[0] && hasband[0])
-				_band = rt_raster_get_band(iwr->bandarg[i].raster[j], 0);
-			else if (!isempty[1] && hasband[1])
-				_band = rt_raster_get_band(raster, iwr->bandarg[i].nband);
-			else {
-				pixtype = PT_64BF;
-				hasnodata = 1;
-				nodataval = rt_pixtype_get_min_value(pixtype);
-			}
-			if (_band != NULL) {
-				pixtype = rt_band_get_pixtype(_band);
-				hasnodata = 1;
-				if (rt_band_get_hasnodata_flag(_band))
-					rt_band_get_nodata(_band, &nodataval);
-				else
-					nodataval = rt_band_get_min_value(_band);
-			}
+	/* switch back to local context */
+	MemoryContextSwitchTo(oldcontext);
 
-			/* UT_MEAN and UT_RANGE require two passes */
-			/* UT_MEAN: first for UT_COUNT and second for UT_SUM */
-			if (iwr->bandarg[i].uniontype == UT_MEAN) {
-				/* first pass, UT_COUNT */
-				if (j < 1)
-					utype = UT_COUNT;
-				else
-					utype = UT_SUM;
-			}
-			/* UT_RANGE: first for UT_MIN and second for UT_MAX */
-			else if (iwr->bandarg[i].uniontype == UT_RANGE) {
-				/* first pass, UT_MIN */
-				if (j < 1)
-					utype = UT_MIN;
-				else
-					utype = UT_MAX;
-			}
+	POSTGIS_RT_DEBUG(3, "Finished");
 
-			/* force band settings for UT_COUNT */
-			if (utype == UT_COUNT) {
-				pixtype = PT_32BUI;
-				hasnodata = 0;
-				nodataval = 0;
-			}
+	PG_RETURN_POINTER(iwr);
+}
 
-			POSTGIS_RT_DEBUGF(4, "(pixtype, hasnodata, nodataval) = (%s, %d, %f)", rt_pixtype_name(pixtype), hasnodata, nodataval);
+/* UNION aggregate combine function, merges the blocks of the second state into the first */
+PG_FUNCTION_INFO_V1(RASTER_union_combinefn);
+Datum RASTER_union_combinefn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	rtpg_union_arg iwr1 = NULL;
+	rtpg_union_arg iwr2 = NULL;
+	HASH_SEQ_STATUS status;
+	rtpg_union_block block = NULL;
+	int32 col = 0;
+	int32 row = 0;
+	int first = 0;
+	int i;
+	int j;
 
-			/* set itrset */
-			itrset[0].raster = iwr->bandarg[i].raster[j];
-			itrset[0].nband = 0;
-			itrset[1].raster = raster;
-			itrset[1].nband = iwr->bandarg[i].nband;
+	if (!AggCheckCallContext(fcinfo, &aggcontext)) {
+		elog(ERROR, "RASTER_union_combinefn: Cannot be called in a non-aggregate context");
+		PG_RETURN_NULL();
+	}
 
-			/* allow use NODATA to replace missing bands */
-			if (nbnodata) {
-				itrset[0].nbnodata = 1;
-				itrset[1].nbnodata = 1;
-			}
-			/* missing bands are not ignored */
-			else {
-				itrset[0].nbnodata = 0;
-				itrset[1].nbnodata = 0;
-			}
+	iwr1 = PG_ARGISNULL(0) ? NULL : (rtpg_union_arg) PG_GETARG_POINTER(0);
+	iwr2 = PG_ARGISNULL(1) ? NULL : (rtpg_union_arg) PG_GETARG_POINTER(1);
 
-			/* if rasters AND bands are present, use copy approach */
-			if (!isempty[0] && !isempty[1] && hasband[0] && hasband[1]) {
-				POSTGIS_RT_DEBUG(3, "using line method");
+	if (iwr2 == NULL) {
+		if (iwr1 == NULL)
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(iwr1);
+	}
+	if (iwr1 == NULL)
+		PG_RETURN_POINTER(iwr2);
 
-				/* generate empty out raster */
-				if (rt_raster_from_two_rasters(
-					iwr->bandarg[i].raster[j], raster,
-					ET_UNION,
-					&iraster, _offset
-				) != ES_NONE) {
+	oldcontext = MemoryContextSwitchTo(aggcontext);
 
-					pfree(itrset);
-					rtpg_union_arg_destroy(iwr);
-					if (raster != NULL) {
-						rt_raster_destroy(raster);
-						PG_FREE_IF_COPY(pgraster, 1);
-					}
+	/* bands only seen by the second state, for ST_Union(raster) */
+	if (iwr2->numband > iwr1->numband) {
+		if (iwr1->numband)
+			iwr1->bandarg = (rtpg_union_band_arg) repalloc(iwr1->bandarg, sizeof(struct rtpg_union_band_arg_t) * iwr2->numband);
+		else
+			iwr1->bandarg = (rtpg_union_band_arg) MemoryContextAlloc(iwr1->context, sizeof(struct rtpg_union_band_arg_t) * iwr2->numband);
 
-					MemoryContextSwitchTo(oldcontext);
-					elog(ERROR, "RASTER_union_transfn: Could not create internal raster");
-					PG_RETURN_NULL();
-				}
-				POSTGIS_RT_DEBUGF(4, "_offset = %f, %f, %f, %f",
-					_offset[0], _offset[1], _offset[2], _offset[3]);
+		for (i = iwr1->numband; i < iwr2->numband; i++) {
+			iwr1->bandarg[i] = iwr2->bandarg[i];
+			iwr1->bandarg[i].acc = -1;
+		}
+		iwr1->numband = iwr2->numband;
+		rtpg_union_arg_add_accs(iwr1);
+	}
 
-				/* rasters are spatially the same? */
-				if (
-					rt_raster_get_width(iwr->bandarg[i].raster[j]) == rt_raster_get_width(iraster) &&
-					rt_raster_get_height(iwr->bandarg[i].raster[j]) == rt_raster_get_height(iraster)
-				) {
-					double igt[6] = {0};
-					double gt[6] = {0};
+	for (i = 0; i < iwr2->numband; i++) {
+		for (j = 0; j < Min(iwr1->bandarg[i].numraster, iwr2->bandarg[i].numraster); j++) {
+			rtpg_union_acc acc1 = &(iwr1->acc[iwr1->bandarg[i].acc + j]);
+			rtpg_union_acc acc2 = &(iwr2->acc[iwr2->bandarg[i].acc + j]);
 
-					rt_raster_get_geotransform_matrix(iwr->bandarg[i].raster[j], gt);
-					rt_raster_get_geotransform_matrix(iraster, igt);
+			if (!acc1->ready && acc2->ready)
+				rtpg_union_acc_set(iwr1, acc1, acc2->pixtype, acc2->hasnodata, acc2->nodataval);
+		}
+	}
 
-					reuserast = rt_util_same_geotransform_matrix(gt, igt);
-				}
 
-				/* use internal raster */
-				if (!reuserast) {
-					/* create band of same type */
-					if (rt_raster_generate_new_band(
-						iraster,
-						pixtype,
-						nodataval,
-						hasnodata, nodataval,
-						0
-					) == -1) {
-
-						pfree(itrset);
-						rtpg_union_arg_destroy(iwr);
-						rt_raster_destroy(iraster);
-						if (raster != NULL) {
-							rt_raster_destroy(raster);
-							PG_FREE_IF_COPY(pgraster, 1);
-						}
+	if (iwr2->grid != NULL) {
+		if (iwr1->grid == NULL) {
+			rtpg_union_grid_set(iwr1, iwr2->grid);
+			first = 1;
+		}
+		else
+			rtpg_union_grid_offset(iwr1, iwr2->grid, &col, &row);
+		rtpg_union_extend(
+			iwr1,
+			iwr2->extent[0] + col, iwr2->extent[1] + row,
+			iwr2->extent[2] - iwr2->extent[0], iwr2->extent[3] - iwr2->extent[1],
+			first
+		);
 
-						MemoryContextSwitchTo(oldcontext);
-						elog(ERROR, "RASTER_union_transfn: Could not add new band to internal raster");
-						PG_RETURN_NULL();
-					}
-					iband = rt_raster_get_band(iraster, 0);
-
-					/* copy working raster to output raster */
-					_dim[0] = rt_raster_get_width(iwr->bandarg[i].raster[j]);
-					_dim[1] = rt_raster_get_height(iwr->bandarg[i].raster[j]);
-					for (y = 0; y < _dim[1]; y++) {
-						POSTGIS_RT_DEBUGF(4, "Getting pixel line of working raster at (x, y, length) = (0, %d, %d)", y, _dim[0]);
-						if (rt_band_get_pixel_line(
-							_band,
-							0, y,
-							_dim[0],
-							&vals, &nvals
-						) != ES_NONE) {
+		hash_seq_init(&status, iwr2->blocks);
+		while ((block = (rtpg_union_block) hash_seq_search(&status)) != NULL) {
+			int32 c0 = Max(iwr2->extent[0], block->key.bx * RTPG_UNION_BLOCK_SIZE);
+			int32 c1 = Min(iwr2->extent[2], (block->key.bx + 1) * RTPG_UNION_BLOCK_SIZE);
+			int32 r0 = Max(iwr2->extent[1], block->key.by * RTPG_UNION_BLOCK_SIZE);
+			int32 r1 = Min(iwr2->extent[3], (block->key.by + 1) * RTPG_UNION_BLOCK_SIZE);
 
-							pfree(itrset);
-							rtpg_union_arg_destroy(iwr);
-							rt_band_destroy(iband);
-							rt_raster_destroy(iraster);
-							if (raster != NULL) {
-								rt_raster_destroy(raster);
-								PG_FREE_IF_COPY(pgraster, 1);
-							}
+			if (c0 >= c1 || r0 >= r1)
+				continue;
 
-							MemoryContextSwitchTo(oldcontext);
-							elog(ERROR, "RASTER_union_transfn: Could not get pixel line from band of working raster");
-							PG_RETURN_NULL();
-						}
+			block = rtpg_union_block_get(iwr2, block->key.bx, block->key.by);
 
-						POSTGIS_RT_DEBUGF(4, "Setting pixel line at (x, y, length) = (%d, %d, %d)", (int) _offset[0], (int) _offset[1] + y, nvals);
-						if (rt_band_set_pixel_line(
-							iband,
-							(int) _offset[0], (int) _offset[1] + y,
-							vals, nvals
-						) != ES_NONE) {
+			for (i = 0; i < iwr2->numband; i++) {
+				for (j = 0; j < Min(iwr1->bandarg[i].numraster, iwr2->bandarg[i].numraster); j++) {
+					rtpg_union_acc acc2 = &(iwr2->acc[iwr2->bandarg[i].acc + j]);
+					rt_band band = NULL;
 
-							pfree(itrset);
-							rtpg_union_arg_destroy(iwr);
-							rt_band_destroy(iband);
-							rt_raster_destroy(iraster);
-							if (raster != NULL) {
-								rt_raster_destroy(raster);
-								PG_FREE_IF_COPY(pgraster, 1);
-							}
+					if (!acc2->ready)
+						continue;
 
-							MemoryContextSwitchTo(oldcontext);
-							elog(ERROR, "RASTER_union_transfn: Could not set pixel line to band of internal raster");
-							PG_RETURN_NULL();
-						}
-					}
-				}
-				else {
-					rt_raster_destroy(iraster);
-					iraster = iwr->bandarg[i].raster[j];
-					iband = rt_raster_get_band(iraster, 0);
+					band = rtpg_union_block_band(acc2, block->data);
+					rtpg_union_merge_band(
+						iwr1, iwr1->bandarg[i].acc + j, 1,
+						band,
+						c0 - block->key.bx * RTPG_UNION_BLOCK_SIZE, r0 - block->key.by * RTPG_UNION_BLOCK_SIZE,
+						c1 - c0, r1 - r0,
+						c0 + col, r0 + row
+					);
+					rt_band_destroy(band);
 				}
+			}
+		}
+	}
 
-				/* run iterator for extent of input raster */
-				noerr = rt_raster_iterator(
-					itrset, 2,
-					ET_LAST, NULL,
-					pixtype,
-					hasnodata, nodataval,
-					0, 0,
-					NULL,
-					&utype,
-					rtpg_union_callback,
-					&_raster
-				);
-				if (noerr != ES_NONE) {
+	rtpg_union_arg_destroy(iwr2);
 
-					pfree(itrset);
-					rtpg_union_arg_destroy(iwr);
-					if (!reuserast) {
-						rt_band_destroy(iband);
-						rt_raster_destroy(iraster);
-					}
-					if (raster != NULL) {
-						rt_raster_destroy(raster);
-						PG_FREE_IF_COPY(pgraster, 1);
-					}
+	MemoryContextSwitchTo(oldcontext);
 
-					MemoryContextSwitchTo(oldcontext);
-					elog(ERROR, "RASTER_union_transfn: Could not run raster iterator function");
-					PG_RETURN_NULL();
-				}
+	PG_RETURN_POINTER(iwr1);
+}
 
-				/* with iterator raster, copy data to output raster */
-				_band = rt_raster_get_band(_raster, 0);
-				_dim[0] = rt_raster_get_width(_raster);
-				_dim[1] = rt_raster_get_height(_raster);
-				for (y = 0; y < _dim[1]; y++) {
-					POSTGIS_RT_DEBUGF(4, "Getting pixel line of iterator raster at (x, y, length) = (0, %d, %d)", y, _dim[0]);
-					if (rt_band_get_pixel_line(
-						_band,
-						0, y,
-						_dim[0],
-						&vals, &nvals
-					) != ES_NONE) {
+static void rtpg_union_write(char **ptr, const void *src, Size size) {
+	memcpy(*ptr, src, size);
+	*ptr += size;
+}
 
-						pfree(itrset);
-						rtpg_union_arg_destroy(iwr);
-						if (!reuserast) {
-							rt_band_destroy(iband);
-							rt_raster_destroy(iraster);
-						}
-						if (raster != NULL) {
-							rt_raster_destroy(raster);
-							PG_FREE_IF_COPY(pgraster, 1);
-						}
+static void rtpg_union_read(const char **ptr, const char *end, void *dst, Size size) {
+	if (*ptr + size > end)
+		elog(ERROR, "rtpg_union_read: Invalid serialized union state");
+	memcpy(dst, *ptr, size);
+	*ptr += size;
+}
 
-						MemoryContextSwitchTo(oldcontext);
-						elog(ERROR, "RASTER_union_transfn: Could not get pixel line from band of working raster");
-						PG_RETURN_NULL();
-					}
+/* UNION aggregate serial function, writes bandargs, accumulators, grid and blocks */
+PG_FUNCTION_INFO_V1(RASTER_union_serialfn);
+Datum RASTER_union_serialfn(PG_FUNCTION_ARGS)
+{
+	rtpg_union_arg iwr = NULL;
+	HASH_SEQ_STATUS status;
+	rtpg_union_block block = NULL;
+	int32 numblock = 0;
+	int32 hasgrid = 0;
+	int32 srid = 0;
+	int64 offset = 0;
+	double gt[6] = {0};
+	Size size = VARHDRSZ;
+	bytea *result = NULL;
+	char *ptr = NULL;
+	int i;
 
-					POSTGIS_RT_DEBUGF(4, "Setting pixel line at (x, y, length) = (%d, %d, %d)", (int) _offset[2], (int) _offset[3] + y, nvals);
-					if (rt_band_set_pixel_line(
-						iband,
-						(int) _offset[2], (int) _offset[3] + y,
-						vals, nvals
-					) != ES_NONE) {
+	if (!AggCheckCallContext(fcinfo, NULL)) {
+		elog(ERROR, "RASTER_union_serialfn: Cannot be called in a non-aggregate context");
+		PG_RETURN_NULL();
+	}
 
-						pfree(itrset);
-						rtpg_union_arg_destroy(iwr);
-						if (!reuserast) {
-							rt_band_destroy(iband);
-							rt_raster_destroy(iraster);
-						}
-						if (raster != NULL) {
-							rt_raster_destroy(raster);
-							PG_FREE_IF_COPY(pgraster, 1);
-						}
+	iwr = (rtpg_union_arg) PG_GETARG_POINTER(0);
+	numblock = hash_get_num_entries(iwr->blocks);
+	hasgrid = (iwr->grid != NULL);
+
+	size += sizeof(int32) + iwr->numband * sizeof(struct rtpg_union_band_arg_t);
+	size += sizeof(int32) + iwr->numacc * (4 * sizeof(int32) + sizeof(double) + sizeof(int64));
+	size += sizeof(int32);
+	if (hasgrid)
+		size += 6 * sizeof(double) + 5 * sizeof(int32);
+	size += sizeof(int32) + (Size) numblock * (2 * sizeof(int32) + iwr->blocksize);
+	if (!AllocSizeIsValid(size))
+		elog(ERROR, "RASTER_union_serialfn: Union state is too large to be serialized");
+
+	result = (bytea *) palloc(size);
+	SET_VARSIZE(result, size);
+	ptr = VARDATA(result);
+
+	rtpg_union_write(&ptr, &(iwr->numband), sizeof(int32));
+	if (iwr->numband)
+		rtpg_union_write(&ptr, iwr->bandarg, iwr->numband * sizeof(struct rtpg_union_band_arg_t));
+
+	rtpg_union_write(&ptr, &(iwr->numacc), sizeof(int32));
+	for (i = 0; i < iwr->numacc; i++) {
+		rtpg_union_acc acc = &(iwr->acc[i]);
+		int32 v[4];
+
+		v[0] = acc->uniontype;
+		v[1] = acc->ready;
+		v[2] = acc->pixtype;
+		v[3] = acc->hasnodata;
+		offset = acc->offset;
+		rtpg_union_write(&ptr, v, sizeof(v));
+		rtpg_union_write(&ptr, &(acc->nodataval), sizeof(double));
+		rtpg_union_write(&ptr, &offset, sizeof(int64));
+	}
+
+	rtpg_union_write(&ptr, &hasgrid, sizeof(int32));
+	if (hasgrid) {
+		rt_raster_get_geotransform_matrix(iwr->grid, gt);
+		srid = rt_raster_get_srid(iwr->grid);
+		rtpg_union_write(&ptr, gt, sizeof(gt));
+		rtpg_union_write(&ptr, &srid, sizeof(int32));
+		rtpg_union_write(&ptr, iwr->extent, sizeof(iwr->extent));
+	}
+
+	rtpg_union_write(&ptr, &numblock, sizeof(int32));
+	hash_seq_init(&status, iwr->blocks);
+	while ((block = (rtpg_union_block) hash_seq_search(&status)) != NULL) {
+		block = rtpg_union_block_get(iwr, block->key.bx, block->key.by);
+		rtpg_union_write(&ptr, &(block->key), 2 * sizeof(int32));
+		rtpg_union_write(&ptr, block->data, iwr->blocksize);
+	}
+
+	PG_RETURN_BYTEA_P(result);
+}
 
-						MemoryContextSwitchTo(oldcontext);
-						elog(ERROR, "RASTER_union_transfn: Could not set pixel line to band of internal raster");
-						PG_RETURN_NULL();
-					}
-				}
+/* UNION aggregate deserial function */
+PG_FUNCTION_INFO_V1(RASTER_union_deserialfn);
+Datum RASTER_union_deserialfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	rtpg_union_arg iwr = NULL;
+	rtpg_union_block block = NULL;
+	bytea *serialized = NULL;
+	const char *ptr = NULL;
+	const char *end = NULL;
+	int32 numblock = 0;
+	int32 hasgrid = 0;
+	int32 srid = 0;
+	int64 offset = 0;
+	double gt[6] = {0};
+	int i;
 
-				/* free _raster */
-				rt_band_destroy(_band);
-				rt_raster_destroy(_raster);
+	if (!AggCheckCallContext(fcinfo, &aggcontext)) {
+		elog(ERROR, "RASTER_union_deserialfn: Cannot be called in a non-aggregate context");
+		PG_RETURN_NULL();
+	}
 
-				/* replace working raster with output raster */
-				_raster = iraster;
-			}
-			else {
-				POSTGIS_RT_DEBUG(3, "using pixel method");
-
-				/* pass everything to iterator */
-				noerr = rt_raster_iterator(
-					itrset, 2,
-					ET_UNION, NULL,
-					pixtype,
-					hasnodata, nodataval,
-					0, 0,
-					NULL,
-					&utype,
-					rtpg_union_callback,
-					&_raster
-				);
+	serialized = PG_GETARG_BYTEA_P(0);
+	ptr = VARDATA(serialized);
+	end = ptr + VARSIZE(serialized) - VARHDRSZ;
 
-				if (noerr != ES_NONE) {
+	iwr = rtpg_union_arg_init(aggcontext);
 
-					pfree(itrset);
-					rtpg_union_arg_destroy(iwr);
-					if (raster != NULL) {
-						rt_raster_destroy(raster);
-						PG_FREE_IF_COPY(pgraster, 1);
-					}
+	rtpg_union_read(&ptr, end, &(iwr->numband), sizeof(int32));
+	if (iwr->numband < 0)
+		elog(ERROR, "RASTER_union_deserialfn: Invalid serialized union state");
+	if (iwr->numband) {
+		iwr->bandarg = (rtpg_union_band_arg) MemoryContextAlloc(aggcontext, iwr->numband * sizeof(struct rtpg_union_band_arg_t));
+		rtpg_union_read(&ptr, end, iwr->bandarg, iwr->numband * sizeof(struct rtpg_union_band_arg_t));
+	}
 
-					MemoryContextSwitchTo(oldcontext);
-					elog(ERROR, "RASTER_union_transfn: Could not run raster iterator function");
-					PG_RETURN_NULL();
-				}
-			}
+	rtpg_union_read(&ptr, end, &(iwr->numacc), sizeof(int32));
+	if (iwr->numacc < 0)
+		elog(ERROR, "RASTER_union_deserialfn: Invalid serialized union state");
+	if (iwr->numacc)
+		iwr->acc = (rtpg_union_acc) MemoryContextAllocZero(aggcontext, iwr->numacc * sizeof(struct rtpg_union_acc_t));
+	for (i = 0; i < iwr->numacc; i++) {
+		rtpg_union_acc acc = &(iwr->acc[i]);
+		int32 v[4];
 
-			/* replace working raster */
-			if (iwr->bandarg[i].raster[j] != NULL && !reuserast) {
-				for (k = rt_raster_get_num_bands(iwr->bandarg[i].raster[j]) - 1; k >= 0; k--)
-					rt_band_destroy(rt_raster_get_band(iwr->bandarg[i].raster[j], k));
-				rt_raster_destroy(iwr->bandarg[i].raster[j]);
-			}
-			iwr->bandarg[i].raster[j] = _raster;
+		rtpg_union_read(&ptr, end, v, sizeof(v));
+		rtpg_union_read(&ptr, end, &(acc->nodataval), sizeof(double));
+		rtpg_union_read(&ptr, end, &offset, sizeof(int64));
+		acc->uniontype = (rtpg_union_type) v[0];
+		acc->ready = v[1];
+		acc->pixtype = (rt_pixtype) v[2];
+		acc->hasnodata = v[3];
+		if (acc->ready) {
+			acc->offset = offset;
+			acc->size = (Size) rt_pixtype_size(acc->pixtype) * RTPG_UNION_BLOCK_SIZE * RTPG_UNION_BLOCK_SIZE;
+			iwr->blocksize = Max(iwr->blocksize, acc->offset + acc->size);
 		}
-
 	}
 
-	pfree(itrset);
-	if (raster != NULL) {
-		rt_raster_destroy(raster);
-		PG_FREE_IF_COPY(pgraster, 1);
+	rtpg_union_read(&ptr, end, &hasgrid, sizeof(int32));
+	if (hasgrid) {
+		rtpg_union_read(&ptr, end, gt, sizeof(gt));
+		rtpg_union_read(&ptr, end, &srid, sizeof(int32));
+		rtpg_union_read(&ptr, end, iwr->extent, sizeof(iwr->extent));
+
+		oldcontext = MemoryContextSwitchTo(aggcontext);
+		iwr->grid = rt_raster_new(1, 1);
+		MemoryContextSwitchTo(oldcontext);
+		if (iwr->grid == NULL)
+			elog(ERROR, "RASTER_union_deserialfn: Could not create grid of union");
+		rt_raster_set_geotransform_matrix(iwr->grid, gt);
+		rt_raster_set_srid(iwr->grid, srid);
+		if (rt_raster_get_inverse_geotransform_matrix(iwr->grid, NULL, iwr->igt) != ES_NONE)
+			elog(ERROR, "RASTER_union_deserialfn: Could not get inverse geotransform of grid");
 	}
 
-	/* switch back to local context */
-	MemoryContextSwitchTo(oldcontext);
+	rtpg_union_read(&ptr, end, &numblock, sizeof(int32));
+	for (i = 0; i < numblock; i++) {
+		rtpg_union_block_key key;
+		bool found;
 
-	POSTGIS_RT_DEBUG(3, "Finished");
+		rtpg_union_read(&ptr, end, &key, sizeof(key));
+		block = (rtpg_union_block) hash_search(iwr->blocks, &key, HASH_ENTER, &found);
+		if (found)
+			elog(ERROR, "RASTER_union_deserialfn: Invalid serialized union state");
+
+		block->data = (uint8_t *) MemoryContextAlloc(aggcontext, iwr->blocksize);
+		block->size = iwr->blocksize;
+		block->spillpos = -1;
+		block->spillsize = 0;
+		block->prev = NULL;
+		block->next = NULL;
+		rtpg_union_read(&ptr, end, block->data, iwr->blocksize);
+
+		iwr->resident += block->size;
+		rtpg_union_lru_push(iwr, block);
+		rtpg_union_enforce_budget(iwr, block);
+	}
 
 	PG_RETURN_POINTER(iwr);
 }
@@ -2811,19 +3410,8 @@ Datum RASTER_union_finalfn(PG_FUNCTION_ARGS)
 {
 	rtpg_union_arg iwr;
 	rt_raster _rtn = NULL;
-	rt_raster _raster = NULL;
 	rt_pgraster *pgraster = NULL;
 
-	int i = 0;
-	int j = 0;
-	rt_iterator itrset = NULL;
-	rt_band _band = NULL;
-	int noerr = 1;
-	int status = 0;
-	rt_pixtype pixtype = PT_END;
-	int hasnodata = 0;
-	double nodataval = 0;
-
 	POSTGIS_RT_DEBUG(3, "Starting...");
 
 	/* cannot be called directly as this is exclusive aggregate function */
@@ -2838,116 +3426,17 @@ Datum RASTER_union_finalfn(PG_FUNCTION_ARGS)
 
 	iwr = (rtpg_union_arg) PG_GETARG_POINTER(0);
 
-	/* init itrset */
-	itrset = (rt_iterator)palloc(sizeof(struct rt_iterator_t) * 2);
-	if (itrset == NULL) {
-		rtpg_union_arg_destroy(iwr);
-		elog(ERROR, "RASTER_union_finalfn: Could not allocate memory for iterator arguments");
+	/* no raster was unioned */
+	if (iwr->grid == NULL)
 		PG_RETURN_NULL();
-	}
-
-	for (i = 0; i < iwr->numband; i++) {
-		if (
-			iwr->bandarg[i].uniontype == UT_MEAN ||
-			iwr->bandarg[i].uniontype == UT_RANGE
-		) {
-			/* raster containing the SUM or MAX is at index 1 */
-			_band = rt_raster_get_band(iwr->bandarg[i].raster[1], 0);
-
-			pixtype = rt_band_get_pixtype(_band);
-			hasnodata = rt_band_get_hasnodata_flag(_band);
-			if (hasnodata)
-				rt_band_get_nodata(_band, &nodataval);
-			POSTGIS_RT_DEBUGF(4, "(pixtype, hasnodata, nodataval) = (%s, %d, %f)", rt_pixtype_name(pixtype), hasnodata, nodataval);
-
-			itrset[0].raster = iwr->bandarg[i].raster[0];
-			itrset[0].nband = 0;
-			itrset[1].raster = iwr->bandarg[i].raster[1];
-			itrset[1].nband = 0;
-
-			/* pass everything to iterator */
-			if (iwr->bandarg[i].uniontype == UT_MEAN) {
-				noerr = rt_raster_iterator(
-					itrset, 2,
-					ET_UNION, NULL,
-					pixtype,
-					hasnodata, nodataval,
-					0, 0,
-					NULL,
-					NULL,
-					rtpg_union_mean_callback,
-					&_raster
-				);
-			}
-			else if (iwr->bandarg[i].uniontype == UT_RANGE) {
-				noerr = rt_raster_iterator(
-					itrset, 2,
-					ET_UNION, NULL,
-					pixtype,
-					hasnodata, nodataval,
-					0, 0,
-					NULL,
-					NULL,
-					rtpg_union_range_callback,
-					&_raster
-				);
-			}
-
-			if (noerr != ES_NONE) {
-				pfree(itrset);
-				rtpg_union_arg_destroy(iwr);
-				if (_rtn != NULL)
-					rt_raster_destroy(_rtn);
-				elog(ERROR, "RASTER_union_finalfn: Could not run raster iterator function");
-				PG_RETURN_NULL();
-			}
-		}
-		else {
-			_raster = iwr->bandarg[i].raster[0];
-			if (_raster == NULL)
-				continue;
-		}
-
-		/* first band, _rtn doesn't exist */
-		if (i < 1) {
-			uint32_t bandNums[1] = {0};
-			_rtn = rt_raster_from_band(_raster, bandNums, 1);
-			status = (_rtn == NULL) ? -1 : 0;
-		}
-		else
-			status = rt_raster_copy_band(_rtn, _raster, 0, i);
-
-		POSTGIS_RT_DEBUG(4, "destroying source rasters");
-
-		/* destroy source rasters */
-		if (
-			iwr->bandarg[i].uniontype == UT_MEAN ||
-			iwr->bandarg[i].uniontype == UT_RANGE
-		) {
-			rt_raster_destroy(_raster);
-		}
-
-		for (j = 0; j < iwr->bandarg[i].numraster; j++) {
-			if (iwr->bandarg[i].raster[j] == NULL)
-				continue;
-			rt_raster_destroy(iwr->bandarg[i].raster[j]);
-			iwr->bandarg[i].raster[j] = NULL;
-		}
 
-		if (status < 0) {
-			rtpg_union_arg_destroy(iwr);
-			rt_raster_destroy(_rtn);
-			elog(ERROR, "RASTER_union_finalfn: Could not add band to final raster");
-			PG_RETURN_NULL();
-		}
-	}
+	_rtn = rtpg_union_output(iwr);
 
 	/* cleanup */
 	/* For Windowing functions, it is important to leave */
 	/* the state intact, knowing that the aggcontext will be */
 	/* freed by PgSQL when the statement is complete. */
 	/* https://trac.osgeo.org/postgis/ticket/4770 */
-	// pfree(itrset);
 	// rtpg_union_arg_destroy(iwr);
 
 	if (!_rtn) PG_RETURN_NULL();
@@ -4516,6 +5005,14 @@ Datum RASTER_mapAlgebraExpr(PG_FUNCTION_ARGS)
     int argcount = 0;
     Oid argtype[] = { FLOAT8OID, INT4OID, INT4OID };
     uint8_t argpos[3] = {0};
+    /* keywords of the compiled expression, [rast.val] is the same as [rast] */
+    const char *mapexprkw[] = {"[rast]", "[rast.x]", "[rast.y]", "[rast.val]"};
+    const uint8_t mapexprkwisint[] = {0, 1, 1, 0};
+    double mapexprval[4] = {0};
+    uint8_t mapexprnull[4] = {0};
+    rt_mapexpr compiled = NULL;
+    int evaluated = 0;
+    int exprnull = 0;
     char place[12];
     int idx = 0;
     int ret = -1;
@@ -5017,6 +5514,9 @@ Datum RASTER_mapAlgebraExpr(PG_FUNCTION_ARGS)
             elog(ERROR, "RASTER_mapAlgebraExpr: Could not prepare expression");
             PG_RETURN_NULL();
         }
+
+        /* Evaluate the expression without SPI wherever possible */
+        compiled = rt_mapexpr_compile(expression, 4, mapexprkw, mapexprkwisint);
     }
 
     for (x = 0; x < width; x++) {
@@ -5029,7 +5529,23 @@ Datum RASTER_mapAlgebraExpr(PG_FUNCTION_ARGS)
              **/
             if (ret == ES_NONE && FLT_NEQ(r, newnodatavalue)) {
                 if (skipcomputation == 0) {
-                    if (initexpr != NULL) {
+                    evaluated = 0;
+                    if (compiled != NULL) {
+                        /* x and y are 0 based index, but SQL expects 1 based index */
+                        mapexprval[0] = r;
+                        mapexprval[1] = x + 1;
+                        mapexprval[2] = y + 1;
+                        mapexprval[3] = r;
+                        evaluated = rt_mapexpr_eval(compiled, mapexprval, mapexprnull, &newval, &exprnull);
+                    }
+
+                    if (evaluated) {
+                        if (exprnull) {
+                            POSTGIS_RT_DEBUGF(3, "Expression for pixel %d,%d (value %g) evaluated to NULL, skip setting", x+1,y+1,r);
+                            newval = newinitialvalue;
+                        }
+                    }
+                    else if (initexpr != NULL) {
                         /* Reset the null arg flags. */
                         memset(nulls, 'n', argcount);
 
@@ -5111,6 +5627,8 @@ Datum RASTER_mapAlgebraExpr(PG_FUNCTION_ARGS)
     }
 
     if (initexpr != NULL) {
+        if (compiled != NULL)
+            rt_mapexpr_destroy(compiled);
         SPI_freeplan(spi_plan);
         SPI_finish();
 
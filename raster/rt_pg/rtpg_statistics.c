@@ -38,12 +38,14 @@
 #include <funcapi.h> /* for SRF */
 
 #include "../../postgis_config.h"
+#include "lwgeom_pg.h"
 
 
 // #include "access/htup_details.h" /* for heap_form_tuple() */
 
 
 #include "rtpostgis.h"
+#include "rtpg_internal.h"
 
 extern "C"
 {
@@ -54,6 +56,9 @@ Datum RASTER_summaryStatsCoverage(PG_FUNCTION_ARGS);
 Datum RASTER_summaryStats_transfn(PG_FUNCTION_ARGS);
 Datum RASTER_summaryStats_finalfn(PG_FUNCTION_ARGS);
 
+/* get summary stats under a polygon */
+Datum RASTER_zonalStats(PG_FUNCTION_ARGS);
+
 /* get histogram */
 Datum RASTER_histogram(PG_FUNCTION_ARGS);
 
@@ -911,6 +916,143 @@ Datum RASTER_summaryStats_finalfn(PG_FUNCTION_ARGS)
 	PG_RETURN_DATUM(result);
 }
 
+/**
+ * Get summary stats of the pixels of a band under a polygon
+ */
+PG_FUNCTION_INFO_V1(RASTER_zonalStats);
+Datum RASTER_zonalStats(PG_FUNCTION_ARGS)
+{
+	rt_pgraster *pgraster = NULL;
+	rt_raster raster = NULL;
+	GSERIALIZED *gser = NULL;
+	LWGEOM *geom = NULL;
+	int32_t bandindex = 1;
+	bool exclude_nodata_value = TRUE;
+	rt_rasterize_mode mode = RT_RASTERIZE_CENTER;
+	char *modename = NULL;
+	int num_bands = 0;
+	rt_bandstats stats = NULL;
+
+	TupleDesc tupdesc;
+	Datum values[VALUES_LENGTH];
+	bool nulls[VALUES_LENGTH];
+	HeapTuple tuple;
+	Datum result;
+
+	/* pgraster or geometry is null, return null */
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
+		PG_RETURN_NULL();
+
+	/* band index is 1-based */
+	if (!PG_ARGISNULL(2))
+		bandindex = PG_GETARG_INT32(2);
+
+	/* exclude_nodata_value flag */
+	if (!PG_ARGISNULL(3))
+		exclude_nodata_value = PG_GETARG_BOOL(3);
+
+	/* pixels under the polygon */
+	if (!PG_ARGISNULL(4)) {
+		modename = rtpg_trim(rtpg_strtoupper(text_to_cstring(PG_GETARG_TEXT_P(4))));
+		if (strcmp(modename, "CENTER") == 0)
+			mode = RT_RASTERIZE_CENTER;
+		else if (strcmp(modename, "ALL_TOUCHED") == 0)
+			mode = RT_RASTERIZE_ALL_TOUCHED;
+		else if (strcmp(modename, "COVERAGE") == 0)
+			mode = RT_RASTERIZE_COVERAGE;
+		else
+			elog(ERROR, "RASTER_zonalStats: Unknown mode: %s. Must be CENTER, ALL_TOUCHED or COVERAGE", modename);
+		pfree(modename);
+	}
+
+	pgraster = (rt_pgraster *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
+	raster = rt_raster_deserialize(pgraster, FALSE);
+	if (!raster) {
+		PG_FREE_IF_COPY(pgraster, 0);
+		elog(ERROR, "RASTER_zonalStats: Cannot deserialize raster");
+		PG_RETURN_NULL();
+	}
+
+	num_bands = rt_raster_get_num_bands(raster);
+	if (bandindex < 1 || bandindex > num_bands) {
+		elog(NOTICE, "Invalid band index (must use 1-based). Returning NULL");
+		rt_raster_destroy(raster);
+		PG_FREE_IF_COPY(pgraster, 0);
+		PG_RETURN_NULL();
+	}
+
+	gser = PG_GETARG_GSERIALIZED_P(1);
+
+	/* check that SRIDs match */
+	if (clamp_srid(rt_raster_get_srid(raster)) != clamp_srid(gserialized_get_srid(gser))) {
+		elog(NOTICE, "Geometry provided does not have the same SRID as the raster. Returning NULL");
+		rt_raster_destroy(raster);
+		PG_FREE_IF_COPY(pgraster, 0);
+		PG_FREE_IF_COPY(gser, 1);
+		PG_RETURN_NULL();
+	}
+
+	geom = lwgeom_from_gserialized(gser);
+	if (geom->type != POLYGONTYPE && geom->type != MULTIPOLYGONTYPE) {
+		rt_raster_destroy(raster);
+		PG_FREE_IF_COPY(pgraster, 0);
+		elog(ERROR, "RASTER_zonalStats: Geometry must be a POLYGON or MULTIPOLYGON, not %s", lwtype_name(geom->type));
+		PG_RETURN_NULL();
+	}
+
+	stats = rt_raster_get_zonal_stats(raster, bandindex - 1, geom, mode, (int) exclude_nodata_value);
+	lwgeom_free(geom);
+	rt_raster_destroy(raster);
+	PG_FREE_IF_COPY(pgraster, 0);
+	PG_FREE_IF_COPY(gser, 1);
+	if (NULL == stats) {
+		elog(NOTICE, "Cannot compute zonal statistics for band at index %d. Returning NULL", bandindex);
+		PG_RETURN_NULL();
+	}
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+		ereport(ERROR, (
+			errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			errmsg(
+				"function returning record called in context "
+				"that cannot accept type record"
+			)
+		));
+	}
+
+	BlessTupleDesc(tupdesc);
+
+	memset(nulls, FALSE, sizeof(bool) * VALUES_LENGTH);
+
+	values[0] = Int64GetDatum(stats->count);
+	if (stats->count > 0) {
+		values[1] = Float8GetDatum(stats->sum);
+		values[2] = Float8GetDatum(stats->mean);
+		values[3] = Float8GetDatum(stats->stddev);
+		values[4] = Float8GetDatum(stats->min);
+		values[5] = Float8GetDatum(stats->max);
+	}
+	else {
+		nulls[1] = TRUE;
+		nulls[2] = TRUE;
+		nulls[3] = TRUE;
+		nulls[4] = TRUE;
+		nulls[5] = TRUE;
+	}
+
+	/* build a tuple */
+	tuple = heap_form_tuple(tupdesc, values, nulls);
+
+	/* make the tuple into a datum */
+	result = HeapTupleGetDatum(tuple);
+
+	/* clean up */
+	pfree(stats);
+
+	PG_RETURN_DATUM(result);
+}
+
 #undef VALUES_LENGTH
 #define VALUES_LENGTH 4
 
@@ -464,6 +464,7 @@ rt_pg_vsi_check_options(char **newval, void **extra, GucSource source)
 
 static char *gdal_datapath = NULL;
 static char *gdal_vsi_options = NULL;
+static THR_LOCAL int gdal_warp_threads = 1;
 extern THR_LOCAL char *gdal_enabled_drivers;
 extern THR_LOCAL bool enable_outdb_rasters;
 MemoryContext gdal_shared_context;
@@ -815,6 +816,28 @@ _PG_init_gdal(void) {
 		);
 	}
 
+	if ( postgis_guc_find_option("postgis.gdal_warp_threads") )
+	{
+		//elog(WARNING, "'%s' is already set and cannot be changed until you reconnect", "postgis.gdal_warp_threads");
+	}
+	else
+	{
+		DefineCustomIntVariable(
+			"postgis.gdal_warp_threads", /* name */
+			"Number of threads used by GDAL to warp large rasters", /* short_desc */
+			"Sets the NUM_THREADS warp option for large outputs of ST_Transform, ST_Resample and related functions. 1, the default, disables multi-threaded warping and 0 uses all CPUs", /* long_desc */
+			&gdal_warp_threads, /* valueAddr */
+			1, /* bootValue */
+			0, /* minValue */
+			64, /* maxValue */
+			PGC_USERSET, /* GucContext context */
+			0, /* int flags */
+			NULL, /* GucIntCheckHook check_hook */
+			NULL, /* GucIntAssignHook assign_hook */
+			NULL  /* GucShowHook show_hook */
+		);
+	}
+
 	/* postgis.gdal_enabled_drivers is alway GDAL_ENABLE_ALL  */
 	gdal_enabled_drivers = (char*)palloc(sizeof(char) * (strlen(GDAL_ENABLE_ALL) + 1));
 	sprintf(gdal_enabled_drivers, "%s", GDAL_ENABLE_ALL);
@@ -209,6 +209,99 @@ static void test_band_stats() {
 	cu_free_raster(raster);
 }
 
+static void test_band_stats_kernels() {
+	rt_bandstats stats = NULL;
+	rt_bandstats expected = NULL;
+	rt_pixtype pixtype[] = {PT_8BUI, PT_16BSI, PT_32BUI, PT_32BF, PT_64BF};
+	uint64_t cK = 0;
+	double cM = 0;
+	double cQ = 0;
+	uint64_t eK = 0;
+	double eM = 0;
+	double eQ = 0;
+
+	rt_raster raster;
+	rt_band band;
+	uint32_t x;
+	uint32_t xmax = 97;
+	uint32_t y;
+	uint32_t ymax = 103;
+	int i;
+	int j;
+
+	/* full-band stats match the per-pixel stats collected with inc_vals */
+	for (i = 0; i < 5; i++) {
+		raster = rt_raster_new(xmax, ymax);
+		CU_ASSERT(raster != NULL);
+		band = cu_add_band(raster, pixtype[i], 1, 3);
+		CU_ASSERT(band != NULL);
+
+		for (x = 0; x < xmax; x++) {
+			for (y = 0; y < ymax; y++) {
+				rt_band_set_pixel(band, x, y, ((x * 7 + y * 13) % 120) + (pixtype[i] >= PT_32BF ? 0.25 : 0), NULL);
+			}
+		}
+		rt_band_set_pixel(band, 0, 0, 3, NULL);
+
+		for (j = 0; j < 2; j++) {
+			stats = (rt_bandstats) rt_band_get_summary_stats(band, j, 0, 0, &cK, &cM, &cQ);
+			CU_ASSERT(stats != NULL);
+			expected = (rt_bandstats) rt_band_get_summary_stats(band, j, 0, 1, &eK, &eM, &eQ);
+			CU_ASSERT(expected != NULL);
+
+			CU_ASSERT_EQUAL(stats->count, expected->count);
+			CU_ASSERT_DOUBLE_EQUAL(stats->sum, expected->sum, 1e-6);
+			CU_ASSERT_DOUBLE_EQUAL(stats->mean, expected->mean, 1e-9);
+			CU_ASSERT_DOUBLE_EQUAL(stats->stddev, expected->stddev, 1e-9);
+			CU_ASSERT_DOUBLE_EQUAL(stats->min, expected->min, DBL_EPSILON);
+			CU_ASSERT_DOUBLE_EQUAL(stats->max, expected->max, DBL_EPSILON);
+
+			rtdealloc(expected->values);
+			rtdealloc(expected);
+			rtdealloc(stats);
+		}
+
+		/* coverage stats merge the same way */
+		CU_ASSERT_EQUAL(cK, eK);
+		CU_ASSERT_DOUBLE_EQUAL(cM, eM, 1e-9);
+		CU_ASSERT_DOUBLE_EQUAL(cQ / cK, eQ / eK, 1e-6);
+
+		cu_free_raster(raster);
+	}
+
+	/* NaN pixels are NODATA for a NaN NODATA value, on both paths */
+	for (i = 3; i < 5; i++) {
+		raster = rt_raster_new(xmax, ymax);
+		CU_ASSERT(raster != NULL);
+		band = cu_add_band(raster, pixtype[i], 1, NAN);
+		CU_ASSERT(band != NULL);
+
+		for (x = 0; x < xmax; x++) {
+			for (y = 0; y < ymax; y++) {
+				rt_band_set_pixel(band, x, y, (x + y) % 5 ? ((x * 7 + y * 13) % 120) + 0.25 : NAN, NULL);
+			}
+		}
+
+		stats = (rt_bandstats) rt_band_get_summary_stats(band, 1, 0, 0, NULL, NULL, NULL);
+		CU_ASSERT(stats != NULL);
+		expected = (rt_bandstats) rt_band_get_summary_stats(band, 1, 0, 1, NULL, NULL, NULL);
+		CU_ASSERT(expected != NULL);
+
+		CU_ASSERT(stats->count > 0);
+		CU_ASSERT(stats->count < xmax * ymax);
+		CU_ASSERT_EQUAL(stats->count, expected->count);
+		CU_ASSERT_DOUBLE_EQUAL(stats->sum, expected->sum, 1e-6);
+		CU_ASSERT_DOUBLE_EQUAL(stats->mean, expected->mean, 1e-9);
+		CU_ASSERT_DOUBLE_EQUAL(stats->stddev, expected->stddev, 1e-9);
+
+		rtdealloc(expected->values);
+		rtdealloc(expected);
+		rtdealloc(stats);
+
+		cu_free_raster(raster);
+	}
+}
+
 static void test_band_value_count() {
 	rt_valuecount vcnts = NULL;
 
@@ -266,12 +359,76 @@ static void test_band_value_count() {
 	cu_free_raster(raster);
 }
 
+static void test_band_zonal_stats() {
+	rt_bandstats stats = NULL;
+	rt_raster raster;
+	rt_band band;
+	LWGEOM *geom;
+	uint32_t x;
+	uint32_t y;
+
+	raster = rt_raster_new(10, 10);
+	CU_ASSERT(raster != NULL);
+	rt_raster_set_offsets(raster, 0, 10);
+	rt_raster_set_scale(raster, 1, -1);
+	band = cu_add_band(raster, PT_8BUI, 1, 0);
+	CU_ASSERT(band != NULL);
+
+	for (x = 0; x < 10; x++) {
+		for (y = 0; y < 10; y++) {
+			rt_band_set_pixel(band, x, y, x + 1, NULL);
+		}
+	}
+
+	geom = lwgeom_from_wkt("POLYGON((0.5 0.5,2.5 0.5,2.5 2.5,0.5 2.5,0.5 0.5))", LW_PARSER_CHECK_NONE);
+	CU_ASSERT(geom != NULL);
+
+	/* centers of columns 1 and 2 of rows 7 and 8 */
+	stats = rt_raster_get_zonal_stats(raster, 0, geom, RT_RASTERIZE_CENTER, 1);
+	CU_ASSERT(stats != NULL);
+	CU_ASSERT_EQUAL(stats->count, 4);
+	CU_ASSERT_DOUBLE_EQUAL(stats->sum, 10, DBL_EPSILON);
+	CU_ASSERT_DOUBLE_EQUAL(stats->mean, 2.5, DBL_EPSILON);
+	CU_ASSERT_DOUBLE_EQUAL(stats->min, 2, DBL_EPSILON);
+	CU_ASSERT_DOUBLE_EQUAL(stats->max, 3, DBL_EPSILON);
+	rtdealloc(stats);
+
+	stats = rt_raster_get_zonal_stats(raster, 0, geom, RT_RASTERIZE_ALL_TOUCHED, 1);
+	CU_ASSERT(stats != NULL);
+	CU_ASSERT_EQUAL(stats->count, 9);
+	CU_ASSERT_DOUBLE_EQUAL(stats->sum, 18, DBL_EPSILON);
+	rtdealloc(stats);
+
+	/* pixels weighted by the area covered, which totals 4 */
+	stats = rt_raster_get_zonal_stats(raster, 0, geom, RT_RASTERIZE_COVERAGE, 1);
+	CU_ASSERT(stats != NULL);
+	CU_ASSERT_EQUAL(stats->count, 9);
+	CU_ASSERT_DOUBLE_EQUAL(stats->sum, 8, FLT_EPSILON);
+	CU_ASSERT_DOUBLE_EQUAL(stats->mean, 2, FLT_EPSILON);
+	CU_ASSERT_DOUBLE_EQUAL(stats->stddev, sqrt(0.5), FLT_EPSILON);
+	rtdealloc(stats);
+
+	lwgeom_free(geom);
+
+	/* outside of the raster */
+	geom = lwgeom_from_wkt("POLYGON((20 20,30 20,30 30,20 20))", LW_PARSER_CHECK_NONE);
+	stats = rt_raster_get_zonal_stats(raster, 0, geom, RT_RASTERIZE_COVERAGE, 1);
+	CU_ASSERT(stats != NULL);
+	CU_ASSERT_EQUAL(stats->count, 0);
+	rtdealloc(stats);
+	lwgeom_free(geom);
+
+	cu_free_raster(raster);
+}
+
 /* register tests */
 void band_stats_suite_setup(void);
 void band_stats_suite_setup(void)
 {
 	CU_pSuite suite = CU_add_suite("band_stats", NULL, NULL);
 	PG_ADD_TEST(suite, test_band_stats);
+	PG_ADD_TEST(suite, test_band_stats_kernels);
 	PG_ADD_TEST(suite, test_band_value_count);
+	PG_ADD_TEST(suite, test_band_zonal_stats);
 }
 
@@ -596,6 +596,180 @@ static void test_gdal_warp() {
 	cu_free_raster(raster);
 }
 
+/* same dimensions, geotransform and pixels */
+static void cu_gdal_warp_compare(rt_raster rast, rt_raster crast) {
+	rt_band band = NULL;
+	rt_band cband = NULL;
+	double gt[6] = {0};
+	double cgt[6] = {0};
+	double value = 0;
+	double cvalue = 0;
+	uint32_t x;
+	uint32_t y;
+	int i;
+
+	CU_ASSERT(rast != NULL);
+	CU_ASSERT(crast != NULL);
+	CU_ASSERT_EQUAL(rt_raster_get_width(crast), rt_raster_get_width(rast));
+	CU_ASSERT_EQUAL(rt_raster_get_height(crast), rt_raster_get_height(rast));
+	CU_ASSERT_EQUAL(rt_raster_get_srid(crast), rt_raster_get_srid(rast));
+
+	rt_raster_get_geotransform_matrix(rast, gt);
+	rt_raster_get_geotransform_matrix(crast, cgt);
+	for (i = 0; i < 6; i++)
+		CU_ASSERT_DOUBLE_EQUAL(cgt[i], gt[i], 1e-6);
+
+	band = rt_raster_get_band(rast, 0);
+	cband = rt_raster_get_band(crast, 0);
+	CU_ASSERT(cband != NULL);
+	CU_ASSERT_EQUAL(rt_band_get_pixtype(cband), rt_band_get_pixtype(band));
+
+	for (x = 0; x < rt_raster_get_width(rast); x += 7) {
+		for (y = 0; y < rt_raster_get_height(rast); y += 7) {
+			CU_ASSERT_EQUAL(rt_band_get_pixel(band, x, y, &value, NULL), ES_NONE);
+			CU_ASSERT_EQUAL(rt_band_get_pixel(cband, x, y, &cvalue, NULL), ES_NONE);
+			CU_ASSERT_DOUBLE_EQUAL(cvalue, value, DBL_EPSILON);
+		}
+	}
+}
+
+static char *cu_gdal_warp_threads(const char *varname) {
+	static char threads[] = "4";
+
+	if (strcmp(varname, "gdal_warp_threads") == 0)
+		return threads;
+	return NULL;
+}
+
+static void test_gdal_warp_cached() {
+	rt_pixtype pixtype = PT_8BSI;
+	rt_band band = NULL;
+	rt_warp_cache cache = NULL;
+
+	rt_raster raster;
+	rt_raster tile;
+	rt_raster rast;
+	rt_raster crast;
+	uint32_t x;
+	uint32_t width = 1024;
+	uint32_t y;
+	uint32_t height = 1024;
+	double value = 0;
+	int i;
+
+	char src_srs[] = "EPSG:2163";
+	char dst_srs[] = "EPSG:3310";
+
+	raster = rt_raster_new(width, height);
+	CU_ASSERT(raster != NULL); /* or we're out of virtual memory */
+
+	band = cu_add_band(raster, pixtype, 1, -1);
+	CU_ASSERT(band != NULL);
+
+	rt_raster_set_offsets(raster, -500000, 600000);
+	rt_raster_set_scale(raster, 1000, -1000);
+
+	for (x = 0; x < width; x++) {
+		for (y = 0; y < height; y++) {
+			rt_band_set_pixel(band, x, y, (x + y) % 100, NULL);
+		}
+	}
+
+	/* GDAL worker threads use GDAL's own transformer */
+	rast = rt_raster_gdal_warp(
+		raster,
+		src_srs, dst_srs,
+		NULL, NULL,
+		NULL, NULL,
+		NULL, NULL,
+		NULL, NULL,
+		NULL, NULL,
+		GRA_NearestNeighbour, 0
+	);
+	CU_ASSERT(rast != NULL);
+	CU_ASSERT(
+		(double) rt_raster_get_width(rast) * rt_raster_get_height(rast) >=
+		1024. * 1024.
+	);
+
+	band = rt_raster_get_band(rast, 0);
+	CU_ASSERT(band != NULL);
+
+	/* 8BSI comes back as 16BSI */
+	CU_ASSERT_EQUAL(rt_band_get_pixtype(band), PT_16BSI);
+	CU_ASSERT(rt_band_get_hasnodata_flag(band));
+	CU_ASSERT(!rt_band_get_isnodata_flag(band));
+	rt_band_get_nodata(band, &value);
+	CU_ASSERT_DOUBLE_EQUAL(value, -1., DBL_EPSILON);
+
+	cu_set_options_handler(cu_gdal_warp_threads);
+	crast = rt_raster_gdal_warp(
+		raster,
+		src_srs, dst_srs,
+		NULL, NULL,
+		NULL, NULL,
+		NULL, NULL,
+		NULL, NULL,
+		NULL, NULL,
+		GRA_NearestNeighbour, 0
+	);
+	cu_set_options_handler(NULL);
+	cu_gdal_warp_compare(rast, crast);
+
+	cu_free_raster(crast);
+	cu_free_raster(rast);
+
+	/* tiles of a coverage share the cached reprojection */
+	cache = rt_warp_cache_new();
+	CU_ASSERT(cache != NULL);
+
+	for (i = 0; i < 4; i++) {
+		tile = rt_raster_new(100, 100);
+		CU_ASSERT(tile != NULL);
+		band = cu_add_band(tile, pixtype, 1, -1);
+		CU_ASSERT(band != NULL);
+
+		rt_raster_set_offsets(tile, -500000 + (i % 2) * 100000, 600000 - (i / 2) * 100000);
+		rt_raster_set_scale(tile, 1000, -1000);
+
+		for (x = 0; x < 100; x++) {
+			for (y = 0; y < 100; y++) {
+				rt_band_set_pixel(band, x, y, (x + y + i) % 100, NULL);
+			}
+		}
+
+		rast = rt_raster_gdal_warp(
+			tile,
+			src_srs, dst_srs,
+			NULL, NULL,
+			NULL, NULL,
+			NULL, NULL,
+			NULL, NULL,
+			NULL, NULL,
+			GRA_NearestNeighbour, -1
+		);
+		crast = rt_raster_gdal_warp_cached(
+			tile,
+			src_srs, dst_srs,
+			NULL, NULL,
+			NULL, NULL,
+			NULL, NULL,
+			NULL, NULL,
+			NULL, NULL,
+			GRA_NearestNeighbour, -1,
+			cache
+		);
+		cu_gdal_warp_compare(rast, crast);
+
+		cu_free_raster(crast);
+		cu_free_raster(rast);
+		cu_free_raster(tile);
+	}
+
+	rt_warp_cache_destroy(cache);
+	cu_free_raster(raster);
+}
+
 /* register tests */
 void gdal_suite_setup(void);
 void gdal_suite_setup(void)
@@ -608,5 +782,6 @@ void gdal_suite_setup(void)
 	PG_ADD_TEST(suite, test_raster_to_gdal);
 	PG_ADD_TEST(suite, test_gdal_to_raster);
 	PG_ADD_TEST(suite, test_gdal_warp);
+	PG_ADD_TEST(suite, test_gdal_warp_cached);
 }
 
@@ -1183,6 +1183,71 @@ static void test_raster_colormap() {
 	cu_free_raster(raster);
 }
 
+static void test_mapexpr() {
+	const char *kw[] = {"[rast.x]", "[rast.y]", "[rast]"};
+	const uint8_t kwisint[] = {1, 1, 0};
+	double kwval[3] = {3, 4, 2.5};
+	uint8_t kwnull[3] = {0, 0, 0};
+	rt_mapexpr mexpr = NULL;
+	double value = 0;
+	int isnull = 0;
+
+	/* float arithmetic */
+	mexpr = rt_mapexpr_compile("[rast] * 2 + sqrt([rast.x] * 3)", 3, kw, kwisint);
+	CU_ASSERT(mexpr != NULL);
+	CU_ASSERT_EQUAL(rt_mapexpr_eval(mexpr, kwval, kwnull, &value, &isnull), 1);
+	CU_ASSERT_EQUAL(isnull, 0);
+	CU_ASSERT_DOUBLE_EQUAL(value, 8, DBL_EPSILON);
+
+	/* NULL propagates */
+	kwnull[2] = 1;
+	CU_ASSERT_EQUAL(rt_mapexpr_eval(mexpr, kwval, kwnull, &value, &isnull), 1);
+	CU_ASSERT_EQUAL(isnull, 1);
+	kwnull[2] = 0;
+	rt_mapexpr_destroy(mexpr);
+
+	/* integer division of positions */
+	mexpr = rt_mapexpr_compile("[rast.y] / [rast.x] + 7 % 4", 3, kw, kwisint);
+	CU_ASSERT(mexpr != NULL);
+	CU_ASSERT_EQUAL(rt_mapexpr_eval(mexpr, kwval, kwnull, &value, &isnull), 1);
+	CU_ASSERT_DOUBLE_EQUAL(value, 4, DBL_EPSILON);
+	rt_mapexpr_destroy(mexpr);
+
+	/* CASE, comparisons and casts */
+	mexpr = rt_mapexpr_compile(
+		"CASE WHEN [rast] IS NULL THEN -1 WHEN [rast] > 2 AND [rast.x] <> 1 THEN [rast]::int ELSE 0 END",
+		3, kw, kwisint
+	);
+	CU_ASSERT(mexpr != NULL);
+	CU_ASSERT_EQUAL(rt_mapexpr_eval(mexpr, kwval, kwnull, &value, &isnull), 1);
+	CU_ASSERT_DOUBLE_EQUAL(value, 2, DBL_EPSILON);
+	kwnull[2] = 1;
+	CU_ASSERT_EQUAL(rt_mapexpr_eval(mexpr, kwval, kwnull, &value, &isnull), 1);
+	CU_ASSERT_EQUAL(isnull, 0);
+	CU_ASSERT_DOUBLE_EQUAL(value, -1, DBL_EPSILON);
+	kwnull[2] = 0;
+	rt_mapexpr_destroy(mexpr);
+
+	/* division by zero is left to SQL */
+	mexpr = rt_mapexpr_compile("[rast] / ([rast.x] - 3)", 3, kw, kwisint);
+	CU_ASSERT(mexpr != NULL);
+	CU_ASSERT_EQUAL(rt_mapexpr_eval(mexpr, kwval, kwnull, &value, &isnull), 0);
+	rt_mapexpr_destroy(mexpr);
+
+	/* integer overflow is left to SQL */
+	mexpr = rt_mapexpr_compile("2147483647 + [rast.x]", 3, kw, kwisint);
+	CU_ASSERT(mexpr != NULL);
+	CU_ASSERT_EQUAL(rt_mapexpr_eval(mexpr, kwval, kwnull, &value, &isnull), 0);
+	rt_mapexpr_destroy(mexpr);
+
+	/* outside of the supported subset */
+	CU_ASSERT(rt_mapexpr_compile("[rast] > 1", 3, kw, kwisint) == NULL);
+	CU_ASSERT(rt_mapexpr_compile("[rast.x] * 0.5", 3, kw, kwisint) == NULL);
+	CU_ASSERT(rt_mapexpr_compile("length('abc') + [rast]", 3, kw, kwisint) == NULL);
+	CU_ASSERT(rt_mapexpr_compile("[rast2] + 1", 3, kw, kwisint) == NULL);
+	CU_ASSERT(rt_mapexpr_compile("[rast] -- comment", 3, kw, kwisint) == NULL);
+}
+
 /* register tests */
 void mapalgebra_suite_setup(void);
 void mapalgebra_suite_setup(void)
@@ -1191,5 +1256,6 @@ void mapalgebra_suite_setup(void)
 	PG_ADD_TEST(suite, test_raster_iterator);
 	PG_ADD_TEST(suite, test_band_reclass);
 	PG_ADD_TEST(suite, test_raster_colormap);
+	PG_ADD_TEST(suite, test_mapexpr);
 }
 
@@ -808,11 +808,95 @@ static void test_raster_wkb() {
 */
 }
 
+static void test_raster_serialize_compressed() {
+	rt_raster raster = NULL;
+	rt_raster rast2 = NULL;
+	rt_band band = NULL;
+	rt_band band2 = NULL;
+	void *serialized = NULL;
+	void *serialized2 = NULL;
+	void *plain = NULL;
+	double val = 0;
+	int isnodata = 0;
+	uint32_t x;
+	uint32_t y;
+	rt_errorstate err;
+
+	/* 16BUI band large enough to span several blocks */
+	raster = rt_raster_new(400, 300);
+	CU_ASSERT(raster != NULL);
+	band = cu_add_band(raster, PT_16BUI, 1, 0);
+	CU_ASSERT(band != NULL);
+	for (y = 0; y < 300; y++) {
+		for (x = 0; x < 400; x++)
+			rt_band_set_pixel(band, x, y, (x + y) % 1000, NULL);
+	}
+	CU_ASSERT_EQUAL(rt_band_get_compression(band), RT_COMPRESSION_NONE);
+
+	plain = rt_raster_serialize(raster);
+	CU_ASSERT(plain != NULL);
+
+	err = rt_band_set_compression(band, RT_COMPRESSION_LZ4);
+	CU_ASSERT_EQUAL(err, ES_NONE);
+	serialized = rt_raster_serialize(raster);
+	CU_ASSERT(serialized != NULL);
+	CU_ASSERT(((struct rt_raster_serialized_t *) serialized)->size < ((struct rt_raster_serialized_t *) plain)->size);
+
+	rast2 = rt_raster_deserialize(serialized, FALSE);
+	CU_ASSERT(rast2 != NULL);
+	band2 = rt_raster_get_band(rast2, 0);
+	CU_ASSERT(band2 != NULL);
+	CU_ASSERT_EQUAL(rt_band_get_compression(band2), RT_COMPRESSION_LZ4);
+	CU_ASSERT(band2->blocks != NULL);
+
+	/* untouched payload is written back as-is */
+	serialized2 = rt_raster_serialize(rast2);
+	CU_ASSERT(serialized2 != NULL);
+	CU_ASSERT_EQUAL(((struct rt_raster_serialized_t *) serialized2)->size, ((struct rt_raster_serialized_t *) serialized)->size);
+	CU_ASSERT(memcmp(serialized2, serialized, ((struct rt_raster_serialized_t *) serialized)->size) == 0);
+	free(serialized2);
+
+	/* reading one pixel only decompresses the block holding it */
+	err = rt_band_get_pixel(band2, 7, 250, &val, &isnodata);
+	CU_ASSERT_EQUAL(err, ES_NONE);
+	CU_ASSERT_DOUBLE_EQUAL(val, 257, DBL_EPSILON);
+	CU_ASSERT(band2->blocks != NULL);
+
+	/* writing a pixel keeps the rest of the band intact */
+	err = rt_band_set_pixel(band2, 399, 0, 999, NULL);
+	CU_ASSERT_EQUAL(err, ES_NONE);
+	for (y = 0; y < 300; y++) {
+		for (x = 0; x < 400; x++) {
+			err = rt_band_get_pixel(band2, x, y, &val, &isnodata);
+			CU_ASSERT_EQUAL(err, ES_NONE);
+			if (x == 399 && y == 0)
+				CU_ASSERT_DOUBLE_EQUAL(val, 999, DBL_EPSILON);
+			else
+				CU_ASSERT_DOUBLE_EQUAL(val, (x + y) % 1000, DBL_EPSILON);
+		}
+	}
+	CU_ASSERT(band2->blocks == NULL);
+
+	/* decompressed band serializes uncompressed once codec is cleared */
+	err = rt_band_set_compression(band2, RT_COMPRESSION_NONE);
+	CU_ASSERT_EQUAL(err, ES_NONE);
+	serialized2 = rt_raster_serialize(rast2);
+	CU_ASSERT(serialized2 != NULL);
+	CU_ASSERT_EQUAL(((struct rt_raster_serialized_t *) serialized2)->size, ((struct rt_raster_serialized_t *) plain)->size);
+
+	free(serialized2);
+	cu_free_raster(rast2);
+	free(serialized);
+	free(plain);
+	cu_free_raster(raster);
+}
+
 /* register tests */
 void raster_wkb_suite_setup(void);
 void raster_wkb_suite_setup(void)
 {
 	CU_pSuite suite = CU_add_suite("raster_wkb", NULL, NULL);
 	PG_ADD_TEST(suite, test_raster_wkb);
+	PG_ADD_TEST(suite, test_raster_serialize_compressed);
 }
 
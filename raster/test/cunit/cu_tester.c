@@ -204,6 +204,18 @@ static void cu_error_reporter(const char *fmt, va_list ap) {
   cu_error_msg[MAX_CUNIT_MSG_LENGTH]='\0';
 }
 
+void cu_set_options_handler(rt_options options_handler) {
+	rt_set_handlers_options(
+		default_rt_allocator,
+		default_rt_reallocator,
+		default_rt_deallocator,
+		cu_error_reporter,
+		default_rt_info_handler,
+		default_rt_warning_handler,
+		options_handler != NULL ? options_handler : default_rt_options
+	);
+}
+
 void cu_error_msg_reset() {
 	memset(cu_error_msg, '\0', MAX_CUNIT_MSG_LENGTH);
 }
@@ -26,6 +26,9 @@ extern char cu_error_msg[];
 /* Resets cu_error_msg back to blank. */
 void cu_error_msg_reset(void);
 
+/* Installs an options handler, NULL restores the default one. */
+void cu_set_options_handler(rt_options options_handler);
+
 /* free raster object */
 void cu_free_raster(rt_raster raster);
 
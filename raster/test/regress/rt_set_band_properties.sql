@@ -243,4 +243,31 @@ SELECT
  FROM rt_band_properties_test
 WHERE (b1nodatavalue+1) != st_bandnodatavalue(st_setbandnodatavalue(rast, 1, b1nodatavalue+1),1);
 
+-----------------------------------------------------------------------
+--- ST_SetBandCompression
+-----------------------------------------------------------------------
+
+CREATE TEMP TABLE rt_band_compression_test AS
+SELECT
+	ST_SetBandCompression(
+		ST_AddBand(
+			ST_MakeEmptyRaster(300, 300, 0, 0, 1, -1, 0, 0, 0),
+			ARRAY[
+				ROW(1, '16BUI', 7, NULL),
+				ROW(2, '32BF', 1.5, NULL)
+			]::addbandarg[]
+		),
+		1, 'lz4'
+	) AS rast;
+
+SELECT 'compression1', ST_BandCompression(rast, 1), ST_BandCompression(rast, 2) FROM rt_band_compression_test;
+SELECT 'compression2', ST_BandCompression(ST_SetBandCompression(rast, 'LZ4'), 2) FROM rt_band_compression_test;
+SELECT 'compression3', ST_BandCompression(ST_SetBandCompression(rast, NULL), 1) FROM rt_band_compression_test;
+SELECT 'compression4', ST_Value(rast, 1, 150, 150), ST_Value(rast, 2, 300, 300) FROM rt_band_compression_test;
+SELECT 'compression5', ST_Value(ST_SetValue(rast, 1, 20, 30, 42), 1, 20, 30) FROM rt_band_compression_test;
+SELECT 'compression6', pg_column_size(ST_SetBandCompression(rast, 'LZ4')) < pg_column_size(ST_SetBandCompression(rast, NULL)) FROM rt_band_compression_test;
+SELECT 'compression7', ST_SetBandCompression(rast, 1, 'foo') FROM rt_band_compression_test;
+
+DROP TABLE rt_band_compression_test;
+
 DROP TABLE rt_band_properties_test;
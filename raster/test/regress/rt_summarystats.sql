@@ -297,3 +297,28 @@ FROM (
 ROLLBACK TO SAVEPOINT test;
 RELEASE SAVEPOINT test;
 ROLLBACK;
+
+-- ST_ZonalStats
+WITH foo AS (
+	SELECT ST_MapAlgebra(
+		ST_AddBand(ST_MakeEmptyRaster(10, 10, 0, 10, 1, -1, 0, 0, 0), 1, '8BUI', 0, 0),
+		1, '8BUI', '[rast.x]'
+	) AS rast
+)
+SELECT
+	mode,
+	(stats).count,
+	round((stats).sum::numeric, 3),
+	round((stats).mean::numeric, 3),
+	round((stats).stddev::numeric, 3),
+	round((stats).min::numeric, 3),
+	round((stats).max::numeric, 3)
+FROM (
+	SELECT
+		mode,
+		ST_ZonalStats(rast, 'POLYGON((0.5 0.5,2.5 0.5,2.5 2.5,0.5 2.5,0.5 0.5))'::geometry, 1, TRUE, mode) AS stats
+	FROM foo, (VALUES ('center'), ('all_touched'), ('coverage')) AS m(mode)
+) bar
+ORDER BY mode;
+SELECT ST_ZonalStats(ST_AddBand(ST_MakeEmptyRaster(10, 10, 0, 10, 1, -1, 0, 0, 0), 1, '8BUI', 1, 0), 'POLYGON((20 20,30 20,30 30,20 20))'::geometry);
+SELECT ST_ZonalStats(ST_AddBand(ST_MakeEmptyRaster(10, 10, 0, 10, 1, -1, 0, 0, 0), 1, '8BUI', 1, 0), 'POLYGON((1 1,2 1,2 2,1 1))'::geometry, 1, TRUE, 'nearest');
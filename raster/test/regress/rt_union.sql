@@ -459,3 +459,44 @@ SELECT 'none', ST_Union(r) from ( select null::raster r where false ) f;
 SELECT 'null', ST_Union(null::raster);
 --#4699 crash
 SELECT 'null-1', ST_Union(null::raster,1);
+
+-- tiles spanning several accumulation blocks
+SELECT
+	'blocks',
+	ST_Width(rast),
+	ST_Height(rast),
+	(ST_SummaryStats(rast)).count,
+	(ST_SummaryStats(rast)).sum,
+	(ST_SummaryStats(rast)).min,
+	(ST_SummaryStats(rast)).max
+FROM (
+	SELECT ST_Union(rast, 'SUM') AS rast
+	FROM (
+		SELECT ST_AddBand(ST_MakeEmptyRaster(200, 200, x, y, 1, -1, 0, 0, 0), 1, '16BUI', 1, 0) AS rast
+		FROM generate_series(0, 100, 100) x, generate_series(0, -100, -100) y
+	) foo
+) bar;
+
+-- one state per group, blocks spilled to disk past work_mem
+SET work_mem = 64;
+SET enable_hashagg = off;
+SELECT
+	'spill',
+	g,
+	ST_Width(rast),
+	ST_Height(rast),
+	(ST_SummaryStats(rast)).count,
+	(ST_SummaryStats(rast)).sum,
+	(ST_SummaryStats(rast)).min,
+	(ST_SummaryStats(rast)).max
+FROM (
+	SELECT g, ST_Union(rast, 'SUM') AS rast
+	FROM (
+		SELECT g, ST_AddBand(ST_MakeEmptyRaster(300, 300, x, y, 1, -1, 0, 0, 0), 1, '16BUI', g, 0) AS rast
+		FROM generate_series(1, 3) g, generate_series(0, 200, 200) x, generate_series(0, -200, -200) y
+	) foo
+	GROUP BY g
+) bar
+ORDER BY g;
+RESET enable_hashagg;
+RESET work_mem;
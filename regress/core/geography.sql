@@ -124,3 +124,24 @@ select 'dwithin_poly_line_1', ST_DWithin('POLYGON((1 1, 2 2, 3 0, 1 1))'::geogra
 select 'dwithin_poly_poly_1', ST_DWithin('POLYGON((0 0, -2 -2, -3 0, 0 0))'::geography, 'POLYGON((1 1, 2 2, 3 0, 1 1))'::geography, 10);
 select 'dwithin_poly_poly_2', ST_DWithin('POLYGON((0 0, -2 -2, -3 0, 0 0))'::geography, 'POLYGON((1 1, 2 2, 3 0, 1 1))'::geography, 300000);
 select 'dwithin_poly_poly_3', ST_DWithin('POLYGON((1 1, -2 -2, -3 0, 1 1))'::geography, 'POLYGON((1 1, 2 2, 3 0, 1 1))'::geography, 300000);
+
+-- cell indexes of more polygons than the shared set holds, one statement each
+CREATE FUNCTION _dwithin_poly_cycle() RETURNS integer AS $$
+DECLARE
+	total integer := 0;
+	c integer;
+	i integer;
+BEGIN
+	FOR i IN 1..20 LOOP
+		EXECUTE 'SELECT count(*)::integer FROM generate_series(1, 8) p
+			WHERE ST_DWithin($1, ST_MakePoint($2 + (p % 4) - 1.5, 0.5)::geography, 0)'
+			INTO c
+			USING ST_MakeEnvelope(i * 5 - 1, -1, i * 5 + 1, 1, 4326)::geography, i * 5;
+		total := total + c;
+	END LOOP;
+	RETURN total;
+END;
+$$ LANGUAGE plpgsql;
+select 'dwithin_poly_cycle_1', _dwithin_poly_cycle();
+select 'dwithin_poly_cycle_2', _dwithin_poly_cycle();
+DROP FUNCTION _dwithin_poly_cycle();
@@ -734,3 +734,73 @@ WITH geom AS (
 	SELECT 3 as id, 'TRIANGLE EMPTY'::geometry geom
 )
 select '#4399', id, 'ST_AsMVTGeom', ST_AsText(ST_AsMVTGeom(geom, ST_MakeBox2D(ST_Point(0, 0), ST_Point(32, 32))))::text from geom order by id asc;
+
+-- Empty points encode no geometry, like empty multipoints
+SELECT 'EmptyPoint',
+	(SELECT ST_AsMVT(q, 'test', 4096, 'geom') FROM (SELECT 'POINT EMPTY'::geometry AS geom) q) =
+	(SELECT ST_AsMVT(q, 'test', 4096, 'geom') FROM (SELECT 'MULTIPOINT EMPTY'::geometry AS geom) q);
+
+-- Many jsonb keys, repeated across columns
+SELECT 'JsonbKeys', length(ST_AsMVT(q, 'test', 4096, 'geom')) > 0 FROM (
+	SELECT 'POINT(1 1)'::geometry AS geom, j AS j1, 1 AS k1, j AS j2
+	FROM (SELECT ('{' || string_agg('"k' || i || '": ' || i, ',') || '}')::jsonb AS j
+		FROM generate_series(1, 300) i) t
+) q;
+
+-- ST_AsMVTPyramid
+CREATE TABLE mvt_pyramid_test (id integer, name text, geom geometry);
+INSERT INTO mvt_pyramid_test VALUES
+	(1, 'a', 'POINT(100 900)'),
+	(2, 'b', 'POINT(700 300)'),
+	(3, 'c', 'LINESTRING(100 100, 900 900)'),
+	(4, NULL, 'POLYGON((600 600, 1000 600, 1000 1000, 600 1000, 600 600))'),
+	(5, 'e', NULL);
+WITH pyramid AS (
+	SELECT * FROM ST_AsMVTPyramid('mvt_pyramid_test', 1, 2, bounds => 'LINESTRING(0 0, 1024 1024)'::geometry)
+), tiles AS (
+	SELECT z, x, y, (
+		SELECT ST_AsMVT(q, 'default', 4096, 'geom')
+		FROM (
+			SELECT id, name, ST_AsMVTGeom(geom, ST_TileEnvelope(z, x, y, 'LINESTRING(0 0, 1024 1024)'::geometry)) AS geom
+			FROM mvt_pyramid_test
+		) q WHERE geom IS NOT NULL
+	) AS mvt
+	FROM generate_series(1, 2) z, generate_series(0, 3) x, generate_series(0, 3) y
+	WHERE x < (1 << z) AND y < (1 << z)
+)
+SELECT 'AsMVTPyramid', count(p.*), count(t.*), count(*) FILTER (WHERE p.mvt IS DISTINCT FROM t.mvt)
+FROM pyramid p FULL JOIN (SELECT * FROM tiles WHERE length(mvt) > 0) t USING (z, x, y);
+SELECT 'AsMVTPyramidZoom', min(z), max(z) FROM ST_AsMVTPyramid('mvt_pyramid_test', 0, 3, bounds => 'LINESTRING(0 0, 1024 1024)'::geometry);
+SELECT 'AsMVTPyramidOrder', count(DISTINCT z), count(*) FILTER (WHERE (z, x, y) <= (pz, px, py))
+FROM (
+	SELECT z, x, y, lag(z) OVER w AS pz, lag(x) OVER w AS px, lag(y) OVER w AS py
+	FROM (SELECT row_number() OVER () AS n, z, x, y
+		FROM ST_AsMVTPyramid('mvt_pyramid_test', 0, 3, bounds => 'LINESTRING(0 0, 1024 1024)'::geometry)) p
+	WINDOW w AS (ORDER BY n)
+) q;
+SELECT 'AsMVTPyramidBadZoom', count(*) FROM ST_AsMVTPyramid('mvt_pyramid_test', 3, 2);
+-- All zooms come out of a single scan of the source
+CREATE SEQUENCE mvt_pyramid_seq;
+CREATE VIEW mvt_pyramid_view AS SELECT *, nextval('mvt_pyramid_seq') AS n FROM mvt_pyramid_test;
+SELECT 'AsMVTPyramidScan', count(DISTINCT z) FROM ST_AsMVTPyramid('mvt_pyramid_view', 0, 3, bounds => 'LINESTRING(0 0, 1024 1024)'::geometry);
+SELECT 'AsMVTPyramidScanRows', last_value FROM mvt_pyramid_seq;
+DROP VIEW mvt_pyramid_view;
+DROP SEQUENCE mvt_pyramid_seq;
+DROP TABLE mvt_pyramid_test;
+-- Tiles spilled past work_mem keep all their features
+CREATE TABLE mvt_pyramid_test AS
+	SELECT i AS id, 'n' || i AS name, ST_MakePoint((i % 64) * 16 + 8, (i / 64) * 16 + 8) AS geom
+	FROM generate_series(0, 4095) i;
+SET work_mem = '64MB';
+CREATE TEMP TABLE mvt_pyramid_memory AS
+	SELECT * FROM ST_AsMVTPyramid('mvt_pyramid_test', 0, 3, bounds => 'LINESTRING(0 0, 1024 1024)'::geometry);
+SET work_mem = 64;
+CREATE TEMP TABLE mvt_pyramid_spilled AS
+	SELECT * FROM ST_AsMVTPyramid('mvt_pyramid_test', 0, 3, bounds => 'LINESTRING(0 0, 1024 1024)'::geometry);
+RESET work_mem;
+SELECT 'AsMVTPyramidSpill', count(m.*), count(s.*),
+	count(*) FILTER (WHERE length(s.mvt) < length(m.mvt)), count(*) FILTER (WHERE s.mvt <> m.mvt) > 0
+FROM mvt_pyramid_memory m FULL JOIN mvt_pyramid_spilled s USING (z, x, y);
+DROP TABLE mvt_pyramid_memory;
+DROP TABLE mvt_pyramid_spilled;
+DROP TABLE mvt_pyramid_test;
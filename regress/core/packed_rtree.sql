@@ -0,0 +1,50 @@
+CREATE TABLE packed_rtree_layer AS
+	SELECT i AS id, ST_MakeEnvelope(i % 40, i / 40, i % 40 + 0.5 + (i % 3), i / 40 + 0.5) AS geom
+	FROM generate_series(0, 1999) i;
+INSERT INTO packed_rtree_layer VALUES (2000, 'POLYGON EMPTY'), (2001, NULL);
+
+CREATE TABLE packed_rtree AS
+	SELECT ST_PackedRTree(geom, id) AS tree FROM packed_rtree_layer;
+
+-- && through the tree matches a scan of the layer
+WITH q(g) AS (VALUES ('POINT(3.2 7.25)'::geometry), ('LINESTRING(-5 -5, 10.2 3)'), ('POLYGON((20 20, 30 20, 30 30, 20 20))'), ('POINT(100 100)'))
+SELECT 1, ST_AsText(g),
+	(SELECT count(*) FROM packed_rtree, ST_PackedRTreeSearch(tree, g)),
+	(SELECT count(*) FROM packed_rtree_layer WHERE geom && g),
+	(SELECT count(*) FROM (
+		SELECT ST_PackedRTreeSearch(tree, g) FROM packed_rtree
+		EXCEPT SELECT id FROM packed_rtree_layer WHERE geom && g) e)
+FROM q;
+
+-- <-> through the tree returns the nearest boxes first
+SELECT 2, id, round(distance::numeric, 3)
+FROM packed_rtree, ST_PackedRTreeNearest(tree, 'POINT(-3 -4)', 3);
+
+SELECT 3, count(*), round(max(t.distance)::numeric, 3),
+	bool_and(abs(t.distance - ST_Distance(Box2D(l.geom)::geometry, 'POINT(45.5 12.25)')) < 1e-9)
+FROM packed_rtree, ST_PackedRTreeNearest(tree, 'POINT(45.5 12.25)', 25) t
+JOIN packed_rtree_layer l ON l.id = t.id;
+
+-- Degenerate trees
+SELECT 4, count(*) FROM ST_PackedRTreeSearch((SELECT ST_PackedRTree(geom, 7) FROM (VALUES ('POINT(1 1)'::geometry)) v(geom)), 'POINT(1 1)');
+SELECT 5, count(*) FROM ST_PackedRTreeSearch((SELECT ST_PackedRTree(geom, 7) FROM (VALUES ('POINT EMPTY'::geometry)) v(geom)), 'POINT(1 1)');
+SELECT 6, ST_PackedRTree(geom, 1) IS NULL FROM (VALUES (NULL::geometry)) v(geom) WHERE false;
+SELECT 7, ST_PackedRTreeSearch('\x00'::bytea, 'POINT(1 1)');
+
+-- Searches repeated over many rows, alternating between a stored and a computed tree
+WITH trees(k, tree) AS (
+	SELECT 1, tree FROM packed_rtree
+	UNION ALL SELECT 2, ST_PackedRTree(geom, id) FROM packed_rtree_layer WHERE id % 2 = 0
+)
+SELECT 8, k, count(*), sum(CASE WHEN n_tree <> n_scan THEN 1 ELSE 0 END)
+FROM (
+	SELECT t.k,
+		(SELECT count(*) FROM (SELECT ST_PackedRTreeSearch(t.tree, p.geom)) s) AS n_tree,
+		(SELECT count(*) FROM packed_rtree_layer l WHERE l.geom && p.geom AND (t.k = 1 OR l.id % 2 = 0)) AS n_scan
+	FROM packed_rtree_layer p, trees t
+	WHERE p.id % 50 = 0
+) c
+GROUP BY k ORDER BY k;
+
+DROP TABLE packed_rtree;
+DROP TABLE packed_rtree_layer;
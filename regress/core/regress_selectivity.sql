@@ -2186,3 +2186,22 @@ select 'selectivity_09', 'estimated', _postgis_selectivity('regular_overdots','g
 drop table if exists regular_overdots;
 drop table if exists regular_overdots_ab;
 
+-- Join of two layers of small, scattered boxes: every histogram cell
+-- holds a few features but almost none of them touch each other
+create table small_boxes_a as
+  select ST_MakeEnvelope(x, y, x + 0.1, y + 0.1) as g from (
+    select (i * 37 % 10000) / 100.0 as x, (i * 61 % 9973) / 99.73 as y
+    from generate_series(1, 10000) i) as foo;
+create table small_boxes_b as
+  select ST_MakeEnvelope(x, y, x + 0.1, y + 0.1) as g from (
+    select (i * 53 % 9967) / 99.67 as x, (i * 29 % 9949) / 99.49 as y
+    from generate_series(1, 10000) i) as foo;
+analyze small_boxes_a;
+analyze small_boxes_b;
+
+-- Sixth test, actual selectivity is in the order of 4e-6
+select 'joinselectivity_01', _postgis_join_selectivity('small_boxes_a', 'g', 'small_boxes_b', 'g') between 4e-7 and 4e-5;
+
+-- Clean
+drop table if exists small_boxes_a;
+drop table if exists small_boxes_b;
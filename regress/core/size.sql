@@ -11,3 +11,32 @@ WITH areal(g) AS  ( SELECT ST_Buffer('POINT(0 0)',1,1) ),
 SELECT 'bbox',ST_Dimension(g) d, ST_ZMFlag(g) f,
  ST_MemSize(postgis_addbbox(g))-ST_MemSize(postgis_dropbbox(g))
 FROM alltyp ORDER BY f,d;
+
+-- stored validity and hash
+SELECT 'checks', ST_MemSize(postgis_addchecks(g)) - ST_MemSize(g),
+ ST_IsValid(postgis_addchecks(g)), ST_IsValidReason(postgis_addchecks(g)),
+ geometry_hash(postgis_addchecks(g)) = geometry_hash(g),
+ ST_MemSize(postgis_dropchecks(postgis_addchecks(g))) = ST_MemSize(g)
+FROM ( VALUES ('SRID=4326;POLYGON((0 0,1 0,1 1,0 1,0 0))'::geometry),
+ ('POLYGON((0 0,1 1,1 0,0 1,0 0))'::geometry) ) AS t(g);
+SELECT 'checks_srid', geometry_hash(ST_SetSRID(postgis_addchecks('POINT(1 2)'::geometry), 3857)) = geometry_hash('SRID=3857;POINT(1 2)'::geometry);
+SELECT 'checks_distinct', count(DISTINCT g) FROM (
+ SELECT postgis_addchecks('LINESTRING(0 0,1 1)'::geometry) AS g UNION ALL
+ SELECT 'LINESTRING(0 0,1 1)'::geometry ) AS t;
+SELECT 'checks_makevalid', ST_AsText(ST_MakeValid(postgis_addchecks('LINESTRING(0 0,1 1)'::geometry)));
+
+-- compact storage
+WITH t(g) AS ( SELECT 'LINESTRING(0.004 0.996,1.004 1.996,2.004 2.996,3.004 3.996,4.004 4.996,5.004 5.996,6.004 6.996,7.004 7.996)'::geometry )
+SELECT 'compact', ST_MemSize(g), ST_MemSize(postgis_compact(g, 2)),
+ postgis_iscompact(postgis_compact(g, 2)), ST_AsText(postgis_compact(g, 2)),
+ postgis_compact(g, 2) = 'LINESTRING(0 1,1 2,2 3,3 4,4 5,5 6,6 7,7 8)'::geometry,
+ postgis_compact(g, 2) && 'POINT(3 4)'::geometry,
+ ST_MemSize(postgis_uncompact(postgis_compact(g, 2)))
+FROM t;
+SELECT 'compact_point', postgis_iscompact(postgis_compact('POINT(1.5 2.5)', 2));
+SELECT 'compact_empty', postgis_iscompact(postgis_compact('POLYGON EMPTY')), ST_IsEmpty(postgis_compact('POLYGON EMPTY'));
+SELECT 'compact_curve', postgis_iscompact(postgis_compact('CIRCULARSTRING(0 0,1 1,2 0)'));
+SELECT 'compact_distinct', count(DISTINCT g) FROM (
+ SELECT postgis_compact('LINESTRING(0 0,1 1,2 2,3 3)'::geometry, 0) AS g UNION ALL
+ SELECT 'LINESTRING(0 0,1 1,2 2,3 3)'::geometry ) AS t;
+SELECT 'compact_prec', postgis_compact('LINESTRING(0 0,1 1)', 9);
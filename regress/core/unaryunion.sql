@@ -8,3 +8,25 @@ SELECT 2, ST_AsText(ST_Normalize(ST_UnaryUnion('GEOMETRYCOLLECTION(POLYGON((0 0,
 -- Unioning an heterogeneous collection of geometries
 SELECT 3, ST_AsText(ST_Normalize(ST_UnaryUnion('GEOMETRYCOLLECTION(POLYGON((0 0, 10 0, 10 10, 0 10, 0 0)),POLYGON((5 5, 15 5, 15 15, 5 15, 5 5)), MULTIPOINT(5 4, -5 4),LINESTRING(2 -10, 2 20))')));
 
+
+-- Aggregate union over more vertices than are buffered before a partial union
+WITH circles AS (
+	SELECT ST_Buffer(ST_MakePoint(i % 20, i / 20), 0.8, 'quad_segs=1024') AS geom
+	FROM generate_series(0, 299) i
+)
+SELECT 4, abs(ST_Area(ST_Union(geom)) - ST_Area(ST_UnaryUnion(ST_Collect(geom)))) < 1e-6,
+	ST_NumGeometries(ST_Union(geom))
+FROM circles;
+
+-- Aggregate union of empties and nulls
+SELECT 5, ST_AsText(ST_Union(geom)) FROM (VALUES (NULL::geometry), ('POINT EMPTY'), ('LINESTRING EMPTY')) t(geom);
+SELECT 6, ST_AsText(ST_Union(geom)) FROM (VALUES (NULL::geometry), (NULL)) t(geom);
+
+-- Aggregate union over several flushes, merged through the levels
+WITH circles AS (
+	SELECT ST_Buffer(ST_MakePoint(i % 40, i / 40), 0.8, 'quad_segs=1024') AS geom
+	FROM generate_series(0, 1199) i
+)
+SELECT 7, abs(ST_Area(ST_Union(geom)) - ST_Area(ST_UnaryUnion(ST_Collect(geom)))) < 1e-6,
+	ST_NumGeometries(ST_Union(geom))
+FROM circles;
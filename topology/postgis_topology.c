@@ -23,6 +23,7 @@
 #include "access/xact.h" /* for RegisterXactCallback */
 #include "funcapi.h" /* for FuncCallContext */
 #include "executor/spi.h" /* this is what you need to work with SPI */
+#include "utils/hsearch.h" /* for HTAB, used by the bulk backend */
 #include "inttypes.h" /* for PRId64 */
 #include "../postgis_config.h"
 
@@ -54,12 +55,14 @@
 PG_MODULE_MAGIC;
 
 LWT_BE_IFACE* be_iface;
+LWT_BE_IFACE* bulk_be_iface;
 MemoryContext topology_shared_context;
 
 /*
  * Private data we'll use for this backend
  */
 #define MAXERRLEN 256
+typedef struct TopoBulk TopoBulk;
 struct LWT_BE_DATA_T
 {
   char lastErrorMsg[MAXERRLEN];
@@ -75,6 +78,12 @@ struct LWT_BE_DATA_T
   bool data_changed;
 
   int topoLoadFailMessageFlavor; /* 0:sql, 1:AddPoint */
+
+  /*
+   * In-memory store to be filled by the next topology
+   * load going through bulk_be_iface
+   */
+  TopoBulk *bulkTarget;
 };
 
 LWT_BE_DATA be_data;
@@ -88,6 +97,7 @@ struct LWT_BE_TOPOLOGY_T
   double precision;
   int hasZ;
   Oid geometryOID;
+  TopoBulk *bulk; /* NULL unless loaded through bulk_be_iface */
 };
 
 /* utility funx */
@@ -221,6 +231,7 @@ cb_loadTopologyByName(const LWT_BE_DATA* be, const char *name)
   topo->be_data = (LWT_BE_DATA *)be; /* const cast.. */
   topo->name = pstrdup(name);
   topo->hasZ = 0;
+  topo->bulk = NULL;
 
   dat = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
   if ( isnull )
@@ -913,6 +924,183 @@ getNotNullInt32( HeapTuple row, TupleDesc desc, int col, int32 *val )
   return 1;
 }
 
+/* ----------------- Prepared plans cache ------------------------ */
+
+/*
+ * Queries run by the callbacks through cached plans. The SQL of each
+ * depends on the topology (schema name) and on the requested fields,
+ * so plans are cached per session keyed by topology id, query and
+ * variant (fields mask, plus query specific flags).
+ */
+typedef enum
+{
+  TOPO_Q_EDGE_BY_ID,
+  TOPO_Q_EDGE_BY_NODE,
+  TOPO_Q_EDGE_BY_FACE,
+  TOPO_Q_FACES_BY_ID,
+  TOPO_Q_NODE_BY_ID,
+  TOPO_Q_NODE_BY_FACE,
+  TOPO_Q_RING_EDGES,
+  TOPO_Q_NODE_WITHIN_DISTANCE,
+  TOPO_Q_EDGE_WITHIN_DISTANCE,
+  TOPO_Q_CLOSEST_EDGE,
+  TOPO_Q_DELETE_FACES_BY_ID,
+  TOPO_Q_DELETE_NODES_BY_ID,
+  /* not cached, counted only */
+  TOPO_Q_UPDATE_EDGES_BY_ID,
+  TOPO_Q_UPDATE_NODES_BY_ID,
+  TOPO_Q_UPDATE_FACES_BY_ID,
+  TOPO_Q_COUNT
+} TopoQuery;
+
+static const char *topoQueryNames[TOPO_Q_COUNT] =
+{
+  "getEdgeById",
+  "getEdgeByNode",
+  "getEdgeByFace",
+  "getFacesById",
+  "getNodeById",
+  "getNodeByFace",
+  "getRingEdges",
+  "getNodeWithinDistance2D",
+  "getEdgeWithinDistance2D",
+  "getClosestEdge",
+  "deleteFacesById",
+  "deleteNodesById",
+  "updateEdgesById",
+  "updateNodesById",
+  "updateFacesById"
+};
+
+/* Query variant flags, above any fields mask */
+#define TOPO_QV_BOX      (1<<16) /* has a bounding box parameter */
+#define TOPO_QV_DIST     (1<<17) /* has a non-zero distance parameter */
+#define TOPO_QV_EXISTS   (1<<18) /* existence check only */
+
+typedef struct
+{
+  int32 topology_id;
+  int32 query;
+  int32 variant;
+} TopoPlanKey;
+
+typedef struct
+{
+  TopoPlanKey key;
+  SPIPlanPtr plan;
+  char *sql; /* in TopMemoryContext, for error messages */
+} TopoPlanEntry;
+
+typedef struct
+{
+  uint64 calls;
+  uint64 rows;
+  uint64 prepared;
+} TopoQueryCounters;
+
+static THR_LOCAL HTAB *TopoPlanCache = NULL;
+static THR_LOCAL TopoQueryCounters topoQueryCounters[TOPO_Q_COUNT];
+
+/*
+ * Get the cache entry for the given query, with a NULL plan
+ * if it needs to be prepared with topoPlanPrepare
+ */
+static TopoPlanEntry *
+topoPlanGet(const LWT_BE_TOPOLOGY *topo, TopoQuery query, int variant)
+{
+  TopoPlanKey key;
+  TopoPlanEntry *entry;
+  bool found;
+
+  if ( ! TopoPlanCache )
+  {
+    HASHCTL ctl;
+    memset(&ctl, 0, sizeof(ctl));
+    ctl.keysize = sizeof(TopoPlanKey);
+    ctl.entrysize = sizeof(TopoPlanEntry);
+    ctl.hash = tag_hash;
+    ctl.hcxt = TopMemoryContext;
+    TopoPlanCache = hash_create("PostGIS Topology plans", 64, &ctl,
+                                HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+  }
+
+  memset(&key, 0, sizeof(key));
+  key.topology_id = topo->id;
+  key.query = query;
+  key.variant = variant;
+  entry = (TopoPlanEntry *)hash_search(TopoPlanCache, &key, HASH_ENTER, &found);
+  if ( ! found )
+  {
+    entry->plan = NULL;
+    entry->sql = NULL;
+  }
+  return entry;
+}
+
+/* Prepare and keep the plan of a cache entry, return false on error */
+static bool
+topoPlanPrepare(const LWT_BE_TOPOLOGY *topo, TopoPlanEntry *entry,
+                const char *sql, int nargs, Oid *argtypes)
+{
+  MemoryContext oldcontext = CurrentMemoryContext;
+  SPIPlanPtr plan;
+
+  POSTGIS_DEBUGF(1, "topoPlanPrepare %s: %s",
+                 topoQueryNames[entry->key.query], sql);
+  plan = SPI_prepare(sql, nargs, argtypes);
+  MemoryContextSwitchTo( oldcontext ); /* switch back */
+  if ( ! plan )
+  {
+    cberror(topo->be_data, "unexpected return (%d) from query preparation: %s",
+            SPI_result, sql);
+    return false;
+  }
+  SPI_keepplan(plan);
+  entry->plan = plan;
+  entry->sql = MemoryContextStrdup(TopMemoryContext, sql);
+  topoQueryCounters[entry->key.query].prepared++;
+  return true;
+}
+
+static int
+topoPlanExecute(const LWT_BE_TOPOLOGY *topo, TopoPlanEntry *entry,
+                Datum *values, bool read_only, long tcount)
+{
+  MemoryContext oldcontext = CurrentMemoryContext;
+  int spi_result;
+
+  spi_result = SPI_execute_plan(entry->plan, values, NULL, read_only, tcount);
+  MemoryContextSwitchTo( oldcontext ); /* switch back */
+  topoQueryCounters[entry->key.query].calls++;
+  if ( spi_result >= 0 )
+    topoQueryCounters[entry->key.query].rows += SPI_processed;
+  return spi_result;
+}
+
+/* Count a query run without a cached plan */
+static inline void
+topoQueryCount(TopoQuery query, uint64 rows)
+{
+  topoQueryCounters[query].calls++;
+  topoQueryCounters[query].rows += rows;
+}
+
+/* Identifiers as an int4[] parameter, to be pfree'd by caller */
+static ArrayType *
+_elemids_to_int4array(const LWT_ELEMID *ids, uint64_t numelems)
+{
+  ArrayType *array_ids;
+  Datum *datum_ids;
+  uint64_t i;
+
+  datum_ids = (Datum *)palloc(sizeof(Datum) * (numelems ? numelems : 1));
+  for ( i = 0; i < numelems; ++i ) datum_ids[i] = Int32GetDatum(ids[i]);
+  array_ids = construct_array(datum_ids, numelems, INT4OID, 4, true, 'i');
+  pfree(datum_ids);
+
+  return array_ids;
+}
+
 /* ----------------- Callbacks start here ------------------------ */
 
 static LWT_ISO_EDGE *
@@ -920,34 +1108,43 @@ cb_getEdgeById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *num
 {
   LWT_ISO_EDGE *edges;
   int spi_result;
-  MemoryContext oldcontext = CurrentMemoryContext;
-  StringInfoData sqldata;
-  StringInfo sql = &sqldata;
+  TopoPlanEntry *plan;
+  ArrayType *array_ids;
+  Datum values[1];
   uint64_t i;
 
-  initStringInfo(sql);
-  appendStringInfoString(sql, "SELECT ");
-  addEdgeFields(sql, fields, 0);
-  appendStringInfo(sql, " FROM \"%s\".edge_data", topo->name);
-  appendStringInfoString(sql, " WHERE edge_id IN (");
-  // add all identifiers here
-  for (i=0; i<*numelems; ++i)
+  plan = topoPlanGet(topo, TOPO_Q_EDGE_BY_ID, fields);
+  if ( ! plan->plan )
   {
-    appendStringInfo(sql, "%s%" LWTFMT_ELEMID, (i?",":""), ids[i]);
+    StringInfoData sqldata;
+    StringInfo sql = &sqldata;
+    Oid argtypes[1] = { INT4ARRAYOID };
+    bool ok;
+
+    initStringInfo(sql);
+    appendStringInfoString(sql, "SELECT ");
+    addEdgeFields(sql, fields, 0);
+    appendStringInfo(sql, " FROM \"%s\".edge_data", topo->name);
+    appendStringInfoString(sql, " WHERE edge_id = ANY($1)");
+    ok = topoPlanPrepare(topo, plan, sql->data, 1, argtypes);
+    pfree(sqldata.data);
+    if ( ! ok )
+    {
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
   }
-  appendStringInfoString(sql, ")");
-  POSTGIS_DEBUGF(1, "cb_getEdgeById query: %s", sql->data);
 
-  spi_result = SPI_execute(sql->data, !topo->be_data->data_changed, *numelems);
-  MemoryContextSwitchTo( oldcontext ); /* switch back */
+  array_ids = _elemids_to_int4array(ids, *numelems);
+  values[0] = PointerGetDatum(array_ids);
+  spi_result = topoPlanExecute(topo, plan, values, !topo->be_data->data_changed, *numelems);
+  pfree(array_ids); /* not needed anymore */
   if ( spi_result != SPI_OK_SELECT )
   {
-    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, sql->data);
-    pfree(sqldata.data);
+    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, plan->sql);
     *numelems = UINT64_MAX;
     return NULL;
   }
-  pfree(sqldata.data);
 
   POSTGIS_DEBUGF(1, "cb_getEdgeById: edge query returned " UINT64_FORMAT " rows", SPI_processed);
   *numelems = SPI_processed;
@@ -973,43 +1170,45 @@ cb_getEdgeByNode(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *n
 {
   LWT_ISO_EDGE *edges;
   int spi_result;
-
-  StringInfoData sqldata;
-  StringInfo sql = &sqldata;
+  TopoPlanEntry *plan;
+  ArrayType *array_ids;
+  Datum values[1];
   uint64_t i;
-  MemoryContext oldcontext = CurrentMemoryContext;
 
-  initStringInfo(sql);
-  appendStringInfoString(sql, "SELECT ");
-  addEdgeFields(sql, fields, 0);
-  appendStringInfo(sql, " FROM \"%s\".edge_data", topo->name);
-  appendStringInfoString(sql, " WHERE start_node IN (");
-  // add all identifiers here
-  for (i=0; i<*numelems; ++i)
+  plan = topoPlanGet(topo, TOPO_Q_EDGE_BY_NODE, fields);
+  if ( ! plan->plan )
   {
-    appendStringInfo(sql, "%s%" LWTFMT_ELEMID, (i?",":""), ids[i]);
-  }
-  appendStringInfoString(sql, ") OR end_node IN (");
-  // add all identifiers here
-  for (i=0; i<*numelems; ++i)
-  {
-    appendStringInfo(sql, "%s%" LWTFMT_ELEMID, (i?",":""), ids[i]);
+    StringInfoData sqldata;
+    StringInfo sql = &sqldata;
+    Oid argtypes[1] = { INT4ARRAYOID };
+    bool ok;
+
+    initStringInfo(sql);
+    appendStringInfoString(sql, "SELECT ");
+    addEdgeFields(sql, fields, 0);
+    appendStringInfo(sql, " FROM \"%s\".edge_data", topo->name);
+    appendStringInfoString(sql, " WHERE start_node = ANY($1) OR end_node = ANY($1)");
+    ok = topoPlanPrepare(topo, plan, sql->data, 1, argtypes);
+    pfree(sqldata.data);
+    if ( ! ok )
+    {
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
   }
-  appendStringInfoString(sql, ")");
 
-  POSTGIS_DEBUGF(1, "cb_getEdgeByNode query: %s", sql->data);
   POSTGIS_DEBUGF(1, "data_changed is %d", topo->be_data->data_changed);
 
-  spi_result = SPI_execute(sql->data, !topo->be_data->data_changed, 0);
-  MemoryContextSwitchTo( oldcontext ); /* switch back */
+  array_ids = _elemids_to_int4array(ids, *numelems);
+  values[0] = PointerGetDatum(array_ids);
+  spi_result = topoPlanExecute(topo, plan, values, !topo->be_data->data_changed, 0);
+  pfree(array_ids); /* not needed anymore */
   if ( spi_result != SPI_OK_SELECT )
   {
-    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, sql->data);
-    pfree(sqldata.data);
+    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, plan->sql);
     *numelems = UINT64_MAX;
     return NULL;
   }
-  pfree(sqldata.data);
 
   POSTGIS_DEBUGF(1, "cb_getEdgeByNode: edge query returned " UINT64_FORMAT " rows", SPI_processed);
   *numelems = SPI_processed;
@@ -1035,60 +1234,66 @@ cb_getEdgeByFace(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *n
 {
   LWT_ISO_EDGE *edges;
   int spi_result;
-  MemoryContext oldcontext = CurrentMemoryContext;
-  StringInfoData sqldata;
-  StringInfo sql = &sqldata;
+  TopoPlanEntry *plan;
   uint64_t i;
   ArrayType *array_ids;
-  Datum *datum_ids;
   Datum values[2];
-  Oid argtypes[2];
-  int nargs = 1;
   GSERIALIZED *gser = NULL;
 
-  datum_ids = palloc(sizeof(Datum)*(*numelems));
-  for (i=0; i<*numelems; ++i) datum_ids[i] = Int32GetDatum(ids[i]);
-  array_ids = construct_array(datum_ids, *numelems, INT4OID, 4, true, 's');
+  plan = topoPlanGet(topo, TOPO_Q_EDGE_BY_FACE, fields | ( box ? TOPO_QV_BOX : 0 ));
+  if ( ! plan->plan )
+  {
+    StringInfoData sqldata;
+    StringInfo sql = &sqldata;
+    Oid argtypes[2];
+    int nargs = 1;
+    bool ok;
 
-  initStringInfo(sql);
-  appendStringInfoString(sql, "SELECT ");
-  addEdgeFields(sql, fields, 0);
-  appendStringInfo(sql, " FROM \"%s\".edge_data"
-                   " WHERE ( left_face = ANY($1) "
-                   " OR right_face = ANY ($1) )",
-                   topo->name);
+    initStringInfo(sql);
+    appendStringInfoString(sql, "SELECT ");
+    addEdgeFields(sql, fields, 0);
+    appendStringInfo(sql, " FROM \"%s\".edge_data"
+                     " WHERE ( left_face = ANY($1) "
+                     " OR right_face = ANY ($1) )",
+                     topo->name);
+    argtypes[0] = INT4ARRAYOID;
+    if ( box )
+    {
+      appendStringInfo(sql, " AND geom && $2");
+      argtypes[1] = topo->geometryOID;
+      ++nargs;
+    }
+    ok = topoPlanPrepare(topo, plan, sql->data, nargs, argtypes);
+    pfree(sqldata.data);
+    if ( ! ok )
+    {
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
+  }
 
+  array_ids = _elemids_to_int4array(ids, *numelems);
   values[0] = PointerGetDatum(array_ids);
-  argtypes[0] = INT4ARRAYOID;
 
   if ( box )
   {
     LWGEOM *g = _box2d_to_lwgeom(box, topo->srid);
     gser = geometry_serialize(g);
     lwgeom_free(g);
-    appendStringInfo(sql, " AND geom && $2");
-
     values[1] = PointerGetDatum(gser);
-    argtypes[1] = topo->geometryOID;
-    ++nargs;
   }
 
-  POSTGIS_DEBUGF(1, "cb_getEdgeByFace query: %s", sql->data);
   POSTGIS_DEBUGF(1, "data_changed is %d", topo->be_data->data_changed);
 
-  spi_result = SPI_execute_with_args(sql->data, nargs, argtypes, values, NULL,
-                                     !topo->be_data->data_changed, 0, NULL);
+  spi_result = topoPlanExecute(topo, plan, values, !topo->be_data->data_changed, 0);
   pfree(array_ids); /* not needed anymore */
   if ( gser ) pfree(gser); /* not needed anymore */
-  MemoryContextSwitchTo( oldcontext ); /* switch back */
   if ( spi_result != SPI_OK_SELECT )
   {
-    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, sql->data);
-    pfree(sqldata.data);
+    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, plan->sql);
     *numelems = UINT64_MAX;
     return NULL;
   }
-  pfree(sqldata.data);
 
   POSTGIS_DEBUGF(1, "cb_getEdgeByFace: edge query returned " UINT64_FORMAT " rows", SPI_processed);
   *numelems = SPI_processed;
@@ -1114,36 +1319,45 @@ cb_getFacesById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *nu
 {
   LWT_ISO_FACE *faces;
   int spi_result;
-  StringInfoData sqldata;
-  StringInfo sql = &sqldata;
+  TopoPlanEntry *plan;
+  ArrayType *array_ids;
+  Datum values[1];
   uint64_t i;
-  MemoryContext oldcontext = CurrentMemoryContext;
 
-  initStringInfo(sql);
-  appendStringInfoString(sql, "SELECT ");
-  addFaceFields(sql, fields);
-  appendStringInfo(sql, " FROM \"%s\".face", topo->name);
-  appendStringInfoString(sql, " WHERE face_id IN (");
-  // add all identifiers here
-  for (i=0; i<*numelems; ++i)
+  plan = topoPlanGet(topo, TOPO_Q_FACES_BY_ID, fields);
+  if ( ! plan->plan )
   {
-    appendStringInfo(sql, "%s%" LWTFMT_ELEMID, (i?",":""), ids[i]);
+    StringInfoData sqldata;
+    StringInfo sql = &sqldata;
+    Oid argtypes[1] = { INT4ARRAYOID };
+    bool ok;
+
+    initStringInfo(sql);
+    appendStringInfoString(sql, "SELECT ");
+    addFaceFields(sql, fields);
+    appendStringInfo(sql, " FROM \"%s\".face", topo->name);
+    appendStringInfoString(sql, " WHERE face_id = ANY($1)");
+    ok = topoPlanPrepare(topo, plan, sql->data, 1, argtypes);
+    pfree(sqldata.data);
+    if ( ! ok )
+    {
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
   }
-  appendStringInfoString(sql, ")");
 
-  POSTGIS_DEBUGF(1, "cb_getFaceById query: %s", sql->data);
   POSTGIS_DEBUGF(1, "data_changed is %d", topo->be_data->data_changed);
 
-  spi_result = SPI_execute(sql->data, !topo->be_data->data_changed, 0);
-  MemoryContextSwitchTo( oldcontext ); /* switch back */
+  array_ids = _elemids_to_int4array(ids, *numelems);
+  values[0] = PointerGetDatum(array_ids);
+  spi_result = topoPlanExecute(topo, plan, values, !topo->be_data->data_changed, 0);
+  pfree(array_ids); /* not needed anymore */
   if ( spi_result != SPI_OK_SELECT )
   {
-    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, sql->data);
-    pfree(sqldata.data);
+    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, plan->sql);
     *numelems = UINT64_MAX;
     return NULL;
   }
-  pfree(sqldata.data);
 
   POSTGIS_DEBUGF(1, "cb_getFaceById: face query returned " UINT64_FORMAT " rows", SPI_processed);
   *numelems = SPI_processed;
@@ -1170,41 +1384,56 @@ cb_getRingEdges(const LWT_BE_TOPOLOGY *topo, LWT_ELEMID edge, uint64_t *numelems
   LWT_ELEMID *edges;
   int spi_result;
   TupleDesc rowdesc;
-  StringInfoData sqldata;
-  StringInfo sql = &sqldata;
+  TopoPlanEntry *plan;
+  Datum values[2];
   uint64_t i;
-  MemoryContext oldcontext = CurrentMemoryContext;
 
-  initStringInfo(sql);
-  appendStringInfo(sql, "WITH RECURSIVE edgering AS ( "
-                   "SELECT %" LWTFMT_ELEMID
-                   " as signed_edge_id, edge_id, next_left_edge, next_right_edge "
-                   "FROM \"%s\".edge_data WHERE edge_id = %" LWTFMT_ELEMID " UNION "
-                   "SELECT CASE WHEN "
-                   "p.signed_edge_id < 0 THEN p.next_right_edge ELSE p.next_left_edge END, "
-                   "e.edge_id, e.next_left_edge, e.next_right_edge "
-                   "FROM \"%s\".edge_data e, edgering p WHERE "
-                   "e.edge_id = CASE WHEN p.signed_edge_id < 0 THEN "
-                   "abs(p.next_right_edge) ELSE abs(p.next_left_edge) END ) "
-                   "SELECT * FROM edgering",
-                   edge, topo->name, ABS(edge), topo->name);
+  plan = topoPlanGet(topo, TOPO_Q_RING_EDGES, 0);
+  if ( ! plan->plan )
+  {
+    StringInfoData sqldata;
+    StringInfo sql = &sqldata;
+    Oid argtypes[2] = { INT4OID, INT8OID };
+    bool ok;
+
+    initStringInfo(sql);
+    appendStringInfo(sql, "WITH RECURSIVE edgering AS ( "
+                     "SELECT $1"
+                     " as signed_edge_id, edge_id, next_left_edge, next_right_edge "
+                     "FROM \"%s\".edge_data WHERE edge_id = abs($1) UNION "
+                     "SELECT CASE WHEN "
+                     "p.signed_edge_id < 0 THEN p.next_right_edge ELSE p.next_left_edge END, "
+                     "e.edge_id, e.next_left_edge, e.next_right_edge "
+                     "FROM \"%s\".edge_data e, edgering p WHERE "
+                     "e.edge_id = CASE WHEN p.signed_edge_id < 0 THEN "
+                     "abs(p.next_right_edge) ELSE abs(p.next_left_edge) END ) "
+                     "SELECT * FROM edgering LIMIT $2",
+                     topo->name, topo->name);
+    ok = topoPlanPrepare(topo, plan, sql->data, 2, argtypes);
+    pfree(sqldata.data);
+    if ( ! ok )
+    {
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
+  }
+
   if ( limit )
   {
     ++limit; /* so we know if we hit it */
-    appendStringInfo(sql, " LIMIT %d", limit);
   }
+  values[0] = Int32GetDatum(edge);
+  /* LIMIT ALL is spelled as the largest bigint, not to need a NULL */
+  values[1] = Int64GetDatum(limit ? (int64)limit : INT64_MAX);
 
-  POSTGIS_DEBUGF(1, "cb_getRingEdges query (limit %d): %s", limit, sql->data);
-  spi_result = SPI_execute(sql->data, !topo->be_data->data_changed, limit);
-  MemoryContextSwitchTo( oldcontext ); /* switch back */
+  POSTGIS_DEBUGF(1, "cb_getRingEdges query (limit %d): %s", limit, plan->sql);
+  spi_result = topoPlanExecute(topo, plan, values, !topo->be_data->data_changed, limit);
   if ( spi_result != SPI_OK_SELECT )
   {
-    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, sql->data);
-    pfree(sqldata.data);
+    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, plan->sql);
     *numelems = UINT64_MAX;
     return NULL;
   }
-  pfree(sqldata.data);
 
   POSTGIS_DEBUGF(1, "cb_getRingEdges: edge query returned " UINT64_FORMAT " rows", SPI_processed);
   *numelems = SPI_processed;
@@ -1290,34 +1519,43 @@ cb_getNodeById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *num
 {
   LWT_ISO_NODE *nodes;
   int spi_result;
-
-  StringInfoData sqldata;
-  StringInfo sql = &sqldata;
+  TopoPlanEntry *plan;
+  ArrayType *array_ids;
+  Datum values[1];
   uint64_t i;
-  MemoryContext oldcontext = CurrentMemoryContext;
 
-  initStringInfo(sql);
-  appendStringInfoString(sql, "SELECT ");
-  addNodeFields(sql, fields);
-  appendStringInfo(sql, " FROM \"%s\".node", topo->name);
-  appendStringInfoString(sql, " WHERE node_id IN (");
-  // add all identifiers here
-  for (i=0; i<*numelems; ++i)
+  plan = topoPlanGet(topo, TOPO_Q_NODE_BY_ID, fields);
+  if ( ! plan->plan )
   {
-    appendStringInfo(sql, "%s%" LWTFMT_ELEMID, (i?",":""), ids[i]);
+    StringInfoData sqldata;
+    StringInfo sql = &sqldata;
+    Oid argtypes[1] = { INT4ARRAYOID };
+    bool ok;
+
+    initStringInfo(sql);
+    appendStringInfoString(sql, "SELECT ");
+    addNodeFields(sql, fields);
+    appendStringInfo(sql, " FROM \"%s\".node", topo->name);
+    appendStringInfoString(sql, " WHERE node_id = ANY($1)");
+    ok = topoPlanPrepare(topo, plan, sql->data, 1, argtypes);
+    pfree(sqldata.data);
+    if ( ! ok )
+    {
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
   }
-  appendStringInfoString(sql, ")");
-  POSTGIS_DEBUGF(1, "cb_getNodeById query: %s", sql->data);
-  spi_result = SPI_execute(sql->data, !topo->be_data->data_changed, *numelems);
-  MemoryContextSwitchTo( oldcontext ); /* switch back */
+
+  array_ids = _elemids_to_int4array(ids, *numelems);
+  values[0] = PointerGetDatum(array_ids);
+  spi_result = topoPlanExecute(topo, plan, values, !topo->be_data->data_changed, *numelems);
+  pfree(array_ids); /* not needed anymore */
   if ( spi_result != SPI_OK_SELECT )
   {
-    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, sql->data);
-    pfree(sqldata.data);
-    *numelems = -1;
+    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, plan->sql);
+    *numelems = UINT64_MAX;
     return NULL;
   }
-  pfree(sqldata.data);
 
   POSTGIS_DEBUGF(1, "cb_getNodeById: edge query returned " UINT64_FORMAT " rows", SPI_processed);
   *numelems = SPI_processed;
@@ -1343,41 +1581,63 @@ cb_getNodeByFace(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *n
 {
   LWT_ISO_NODE *nodes;
   int spi_result;
-  MemoryContext oldcontext = CurrentMemoryContext;
-  StringInfoData sqldata;
-  StringInfo sql = &sqldata;
+  TopoPlanEntry *plan;
   uint64_t i;
-  char *hexbox;
+  ArrayType *array_ids;
+  Datum values[2];
+  GSERIALIZED *gser = NULL;
 
-  initStringInfo(sql);
-  appendStringInfoString(sql, "SELECT ");
-  addNodeFields(sql, fields);
-  appendStringInfo(sql, " FROM \"%s\".node", topo->name);
-  appendStringInfoString(sql, " WHERE containing_face IN (");
-  // add all identifiers here
-  for (i=0; i<*numelems; ++i)
+  plan = topoPlanGet(topo, TOPO_Q_NODE_BY_FACE, fields | ( box ? TOPO_QV_BOX : 0 ));
+  if ( ! plan->plan )
   {
-    appendStringInfo(sql, "%s%" LWTFMT_ELEMID, (i?",":""), ids[i]);
+    StringInfoData sqldata;
+    StringInfo sql = &sqldata;
+    Oid argtypes[2];
+    int nargs = 1;
+    bool ok;
+
+    initStringInfo(sql);
+    appendStringInfoString(sql, "SELECT ");
+    addNodeFields(sql, fields);
+    appendStringInfo(sql, " FROM \"%s\".node", topo->name);
+    appendStringInfoString(sql, " WHERE containing_face = ANY($1)");
+    argtypes[0] = INT4ARRAYOID;
+    if ( box )
+    {
+      appendStringInfoString(sql, " AND geom && $2");
+      argtypes[1] = topo->geometryOID;
+      ++nargs;
+    }
+    ok = topoPlanPrepare(topo, plan, sql->data, nargs, argtypes);
+    pfree(sqldata.data);
+    if ( ! ok )
+    {
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
   }
-  appendStringInfoString(sql, ")");
+
+  array_ids = _elemids_to_int4array(ids, *numelems);
+  values[0] = PointerGetDatum(array_ids);
+
   if ( box )
   {
-    hexbox = _box2d_to_hexwkb(box, topo->srid);
-    appendStringInfo(sql, " AND geom && '%s'::geometry", hexbox);
-    lwfree(hexbox);
+    LWGEOM *g = _box2d_to_lwgeom(box, topo->srid);
+    gser = geometry_serialize(g);
+    lwgeom_free(g);
+    values[1] = PointerGetDatum(gser);
   }
-  POSTGIS_DEBUGF(1, "cb_getNodeByFace query: %s", sql->data);
+
   POSTGIS_DEBUGF(1, "data_changed is %d", topo->be_data->data_changed);
-  spi_result = SPI_execute(sql->data, !topo->be_data->data_changed, 0);
-  MemoryContextSwitchTo( oldcontext ); /* switch back */
+  spi_result = topoPlanExecute(topo, plan, values, !topo->be_data->data_changed, 0);
+  pfree(array_ids); /* not needed anymore */
+  if ( gser ) pfree(gser); /* not needed anymore */
   if ( spi_result != SPI_OK_SELECT )
   {
-    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, sql->data);
-    pfree(sqldata.data);
+    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, plan->sql);
     *numelems = UINT64_MAX;
     return NULL;
   }
-  pfree(sqldata.data);
 
   POSTGIS_DEBUGF(1, "cb_getNodeByFace: edge query returned " UINT64_FORMAT " rows", SPI_processed);
   *numelems = SPI_processed;
@@ -1409,53 +1669,74 @@ cb_getEdgeWithinDistance2D(const LWT_BE_TOPOLOGY *topo,
   LWT_ISO_EDGE *edges;
   int spi_result;
   int64_t elems_requested = limit;
-  char *hexewkb;
-  MemoryContext oldcontext = CurrentMemoryContext;
-  StringInfoData sqldata;
-  StringInfo sql = &sqldata;
+  TopoPlanEntry *plan;
+  GSERIALIZED *pts;
+  Datum values[3];
   uint64_t i;
 
-  initStringInfo(sql);
-  if ( elems_requested == -1 )
-  {
-    appendStringInfoString(sql, "SELECT EXISTS ( SELECT 1");
-  }
-  else
+  plan = topoPlanGet(topo, TOPO_Q_EDGE_WITHIN_DISTANCE,
+                     ( elems_requested == -1 ? TOPO_QV_EXISTS : fields ) |
+                     ( dist ? TOPO_QV_DIST : 0 ));
+  if ( ! plan->plan )
   {
-    appendStringInfoString(sql, "SELECT ");
-    addEdgeFields(sql, fields, 0);
-  }
-  appendStringInfo(sql, " FROM \"%s\".edge_data", topo->name);
-  // TODO: use binary cursor here ?
-  hexewkb = lwgeom_to_hexwkb_buffer(lwpoint_as_lwgeom(pt), WKB_EXTENDED);
-  if ( dist )
-  {
-    appendStringInfo(sql, " WHERE ST_DWithin('%s'::geometry, geom, %g)", hexewkb, dist);
-  }
-  else
-  {
-    appendStringInfo(sql, " WHERE ST_Within('%s'::geometry, geom)", hexewkb);
-  }
-  lwfree(hexewkb);
-  if ( elems_requested == -1 )
-  {
-    appendStringInfoString(sql, ")");
-  }
-  else if ( elems_requested > 0 )
-  {
-	  appendStringInfo(sql, " LIMIT " INT64_FORMAT, elems_requested);
+    StringInfoData sqldata;
+    StringInfo sql = &sqldata;
+    Oid argtypes[3];
+    bool ok;
+
+    initStringInfo(sql);
+    if ( elems_requested == -1 )
+    {
+      appendStringInfoString(sql, "SELECT EXISTS ( SELECT 1");
+    }
+    else
+    {
+      appendStringInfoString(sql, "SELECT ");
+      addEdgeFields(sql, fields, 0);
+    }
+    appendStringInfo(sql, " FROM \"%s\".edge_data", topo->name);
+    if ( dist )
+    {
+      appendStringInfoString(sql, " WHERE ST_DWithin($1, geom, $2)");
+    }
+    else
+    {
+      appendStringInfoString(sql, " WHERE ST_Within($1, geom)");
+    }
+    if ( elems_requested == -1 )
+    {
+      appendStringInfoString(sql, ")");
+    }
+    else
+    {
+      appendStringInfoString(sql, " LIMIT $3");
+    }
+    argtypes[0] = topo->geometryOID;
+    argtypes[1] = FLOAT8OID;
+    argtypes[2] = INT8OID;
+    ok = topoPlanPrepare(topo, plan, sql->data, 3, argtypes);
+    pfree(sqldata.data);
+    if ( ! ok )
+    {
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
   }
-  POSTGIS_DEBUGF(1, "cb_getEdgeWithinDistance2D: query is: %s", sql->data);
-  spi_result = SPI_execute(sql->data, !topo->be_data->data_changed, limit >= 0 ? limit : 0);
-  MemoryContextSwitchTo( oldcontext ); /* switch back */
+
+  pts = geometry_serialize(lwpoint_as_lwgeom(pt));
+  values[0] = PointerGetDatum(pts);
+  values[1] = Float8GetDatum(dist);
+  values[2] = Int64GetDatum(elems_requested > 0 ? elems_requested : INT64_MAX);
+
+  POSTGIS_DEBUGF(1, "cb_getEdgeWithinDistance2D: query is: %s", plan->sql);
+  spi_result = topoPlanExecute(topo, plan, values, !topo->be_data->data_changed, limit >= 0 ? limit : 0);
+  pfree(pts); /* not needed anymore */
   if ( spi_result != SPI_OK_SELECT )
   {
-    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, sql->data);
-    pfree(sqldata.data);
+    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, plan->sql);
     *numelems = UINT64_MAX;
     return NULL;
   }
-  pfree(sqldata.data);
 
   POSTGIS_DEBUGF(1,
 		 "cb_getEdgeWithinDistance2D: edge query "
@@ -1505,64 +1786,84 @@ cb_getNodeWithinDistance2D(const LWT_BE_TOPOLOGY *topo,
 			   int fields,
 			   int64_t limit)
 {
-  MemoryContext oldcontext = CurrentMemoryContext;
   LWT_ISO_NODE *nodes;
   int spi_result;
-  char *hexewkb;
-  StringInfoData sqldata;
-  StringInfo sql = &sqldata;
+  TopoPlanEntry *plan;
+  GSERIALIZED *pts;
+  Datum values[3];
   int64_t elems_requested = limit;
   uint64_t i;
 
-  initStringInfo(sql);
-  if ( elems_requested == -1 )
-  {
-    appendStringInfoString(sql, "SELECT EXISTS ( SELECT 1");
-  }
-  else
+  plan = topoPlanGet(topo, TOPO_Q_NODE_WITHIN_DISTANCE,
+                     ( elems_requested == -1 ? TOPO_QV_EXISTS : fields ) |
+                     ( dist ? TOPO_QV_DIST : 0 ));
+  if ( ! plan->plan )
   {
-    appendStringInfoString(sql, "SELECT ");
-    if ( fields ) addNodeFields(sql, fields);
+    StringInfoData sqldata;
+    StringInfo sql = &sqldata;
+    Oid argtypes[3];
+    bool ok;
+
+    initStringInfo(sql);
+    if ( elems_requested == -1 )
+    {
+      appendStringInfoString(sql, "SELECT EXISTS ( SELECT 1");
+    }
     else
     {
-      lwpgwarning("liblwgeom-topo invoked 'getNodeWithinDistance2D' "
-                  "backend callback with limit=%d and no fields",
-                  elems_requested);
-      appendStringInfo(sql, "*");
+      appendStringInfoString(sql, "SELECT ");
+      if ( fields ) addNodeFields(sql, fields);
+      else
+      {
+        lwpgwarning("liblwgeom-topo invoked 'getNodeWithinDistance2D' "
+                    "backend callback with limit=%d and no fields",
+                    elems_requested);
+        appendStringInfo(sql, "*");
+      }
+    }
+    appendStringInfo(sql, " FROM \"%s\".node", topo->name);
+    if ( dist )
+    {
+      appendStringInfoString(sql, " WHERE ST_DWithin(geom, $1, $2)");
+    }
+    else
+    {
+      appendStringInfoString(sql, " WHERE ST_Equals(geom, $1)");
+    }
+    if ( elems_requested == -1 )
+    {
+      appendStringInfoString(sql, ")");
+    }
+    else
+    {
+      appendStringInfoString(sql, " LIMIT $3");
+    }
+    argtypes[0] = topo->geometryOID;
+    argtypes[1] = FLOAT8OID;
+    argtypes[2] = INT8OID;
+    ok = topoPlanPrepare(topo, plan, sql->data, 3, argtypes);
+    pfree(sqldata.data);
+    if ( ! ok )
+    {
+      *numelems = UINT64_MAX;
+      return NULL;
     }
   }
-  appendStringInfo(sql, " FROM \"%s\".node", topo->name);
-  // TODO: use binary cursor here ?
-  hexewkb = lwgeom_to_hexwkb_buffer(lwpoint_as_lwgeom(pt), WKB_EXTENDED);
-  if ( dist )
-  {
-    appendStringInfo(sql, " WHERE ST_DWithin(geom, '%s'::geometry, %g)",
-                     hexewkb, dist);
-  }
-  else
-  {
-    appendStringInfo(sql, " WHERE ST_Equals(geom, '%s'::geometry)", hexewkb);
-  }
-  lwfree(hexewkb);
-  if ( elems_requested == -1 )
-  {
-    appendStringInfoString(sql, ")");
-  }
-  else if ( elems_requested > 0 )
-  {
-	  appendStringInfo(sql, " LIMIT " INT64_FORMAT, elems_requested);
-  }
-  spi_result = SPI_execute(sql->data, !topo->be_data->data_changed, limit >= 0 ? limit : 0);
-  MemoryContextSwitchTo( oldcontext ); /* switch back */
+
+  pts = geometry_serialize(lwpoint_as_lwgeom(pt));
+  values[0] = PointerGetDatum(pts);
+  values[1] = Float8GetDatum(dist);
+  values[2] = Int64GetDatum(elems_requested > 0 ? elems_requested : INT64_MAX);
+
+  spi_result = topoPlanExecute(topo, plan, values, !topo->be_data->data_changed, limit >= 0 ? limit : 0);
+  pfree(pts); /* not needed anymore */
   if ( spi_result != SPI_OK_SELECT )
   {
     cberror(topo->be_data, "unexpected return (%d) from query execution: %s",
-            spi_result, sql->data);
-    pfree(sqldata.data);
+            spi_result, plan->sql);
     *numelems = UINT64_MAX;
     return NULL;
   }
-  pfree(sqldata.data);
 
   POSTGIS_DEBUGF(1,
 		 "cb_getNodeWithinDistance2D: node query "
@@ -1947,6 +2248,7 @@ cb_updateNodesById(const LWT_BE_TOPOLOGY *topo, const LWT_ISO_NODE *nodes, uint6
   pfree(sqldata.data);
 
   if ( SPI_processed ) topo->be_data->data_changed = true;
+  topoQueryCount(TOPO_Q_UPDATE_NODES_BY_ID, SPI_processed);
 
   POSTGIS_DEBUGF(1, "cb_updateNodesById: update query processed " UINT64_FORMAT " rows", SPI_processed);
 
@@ -1995,6 +2297,7 @@ cb_updateFacesById( const LWT_BE_TOPOLOGY* topo,
   pfree(sqldata.data);
 
   if ( SPI_processed ) topo->be_data->data_changed = true;
+  topoQueryCount(TOPO_Q_UPDATE_FACES_BY_ID, SPI_processed);
 
   POSTGIS_DEBUGF(1, "cb_updateFacesById: update query processed " UINT64_FORMAT " rows", SPI_processed);
 
@@ -2087,6 +2390,7 @@ cb_updateEdgesById(const LWT_BE_TOPOLOGY *topo, const LWT_ISO_EDGE *edges, uint6
   pfree(sqldata.data);
 
   if ( SPI_processed ) topo->be_data->data_changed = true;
+  topoQueryCount(TOPO_Q_UPDATE_EDGES_BY_ID, SPI_processed);
 
   POSTGIS_DEBUGF(1, "cb_updateEdgesById: update query processed " UINT64_FORMAT " rows", SPI_processed);
 
@@ -2984,16 +3288,35 @@ cb_updateTopoGeomEdgeHeal ( const LWT_BE_TOPOLOGY* topo,
 static LWT_ISO_EDGE *
 cb_getClosestEdge( const LWT_BE_TOPOLOGY* topo, const LWPOINT* pt, uint64_t *numedges, int fields )
 {
-  MemoryContext oldcontext = CurrentMemoryContext;
   HeapTuple row;
   int spi_result;
-  StringInfoData sqldata;
-  StringInfo sql = &sqldata;
+  TopoPlanEntry *plan;
   GSERIALIZED *pts;
   Datum values[1];
-  Oid argtypes[1];
   LWT_ISO_EDGE* edges;
 
+  plan = topoPlanGet(topo, TOPO_Q_CLOSEST_EDGE, fields);
+  if ( ! plan->plan )
+  {
+    StringInfoData sqldata;
+    StringInfo sql = &sqldata;
+    Oid argtypes[1];
+    bool ok;
+
+    initStringInfo(sql);
+    appendStringInfoString(sql, "SELECT ");
+    addEdgeFields(sql, fields, 0);
+    appendStringInfo(sql, " FROM \"%s\".edge_data ORDER BY geom <-> $1 ASC, edge_id ASC LIMIT 1", topo->name);
+    argtypes[0] = topo->geometryOID;
+    ok = topoPlanPrepare(topo, plan, sql->data, 1, argtypes);
+    pfree(sqldata.data);
+    if ( ! ok )
+    {
+      *numedges = UINT64_MAX;
+      return NULL;
+    }
+  }
+
   pts = geometry_serialize(lwpoint_as_lwgeom(pt));
   if ( ! pts )
   {
@@ -3003,27 +3326,15 @@ cb_getClosestEdge( const LWT_BE_TOPOLOGY* topo, const LWPOINT* pt, uint64_t *num
     return NULL;
   }
 
-  initStringInfo(sql);
-
-
-  appendStringInfoString(sql, "SELECT ");
-  addEdgeFields(sql, fields, 0);
-  appendStringInfo(sql, " FROM \"%s\".edge_data ORDER BY geom <-> $1 ASC, edge_id ASC LIMIT 1", topo->name);
-
-  POSTGIS_DEBUGF(1, "cb_getClosestEdge query: %s", sql->data);
+  POSTGIS_DEBUGF(1, "cb_getClosestEdge query: %s", plan->sql);
 
   values[0] = PointerGetDatum(pts);
-  argtypes[0] = topo->geometryOID;
-
-  spi_result = SPI_execute_with_args(sql->data, 1, argtypes, values, NULL,
-                                     !topo->be_data->data_changed, 1, NULL);
-  MemoryContextSwitchTo( oldcontext ); /* switch back */
+  spi_result = topoPlanExecute(topo, plan, values, !topo->be_data->data_changed, 1);
   pfree(pts); /* not needed anymore */
   if ( spi_result != SPI_OK_SELECT )
   {
     cberror(topo->be_data, "unexpected return (%d) from query execution: %s",
-            spi_result, sql->data);
-    pfree(sqldata.data);
+            spi_result, plan->sql);
     *numedges = UINT64_MAX;
     return NULL;
   }
@@ -3031,7 +3342,6 @@ cb_getClosestEdge( const LWT_BE_TOPOLOGY* topo, const LWPOINT* pt, uint64_t *num
   if ( SPI_processed == 0 )
   {
     /* No edges in topology, point is in universal face */
-    pfree(sqldata.data);
     *numedges = 0;
     return NULL;
   }
@@ -3050,31 +3360,39 @@ cb_getClosestEdge( const LWT_BE_TOPOLOGY* topo, const LWPOINT* pt, uint64_t *num
 static int
 cb_deleteFacesById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t numelems)
 {
-  MemoryContext oldcontext = CurrentMemoryContext;
   int spi_result;
-  StringInfoData sqldata;
-  StringInfo sql = &sqldata;
+  TopoPlanEntry *plan;
+  ArrayType *array_ids;
+  Datum values[1];
 
-  initStringInfo(sql);
-  appendStringInfo(sql, "DELETE FROM \"%s\".face WHERE face_id IN (", topo->name);
-  for (uint64_t i = 0; i < numelems; ++i)
+  plan = topoPlanGet(topo, TOPO_Q_DELETE_FACES_BY_ID, 0);
+  if ( ! plan->plan )
   {
-    appendStringInfo(sql, "%s%" LWTFMT_ELEMID, (i?",":""), ids[i]);
+    StringInfoData sqldata;
+    StringInfo sql = &sqldata;
+    Oid argtypes[1] = { INT4ARRAYOID };
+    bool ok;
+
+    initStringInfo(sql);
+    appendStringInfo(sql, "DELETE FROM \"%s\".face WHERE face_id = ANY($1)",
+                     topo->name);
+    ok = topoPlanPrepare(topo, plan, sql->data, 1, argtypes);
+    pfree(sqldata.data);
+    if ( ! ok ) return -1;
   }
-  appendStringInfoString(sql, ")");
 
-  POSTGIS_DEBUGF(1, "cb_deleteFacesById query: %s", sql->data);
+  POSTGIS_DEBUGF(1, "cb_deleteFacesById query: %s", plan->sql);
 
-  spi_result = SPI_execute( sql->data, false, 0 );
-  MemoryContextSwitchTo( oldcontext ); /* switch back */
+  array_ids = _elemids_to_int4array(ids, numelems);
+  values[0] = PointerGetDatum(array_ids);
+  spi_result = topoPlanExecute(topo, plan, values, false, 0);
+  pfree(array_ids); /* not needed anymore */
   if ( spi_result != SPI_OK_DELETE )
   {
     cberror(topo->be_data, "unexpected return (%d) from query execution: %s",
-            spi_result, sql->data);
-    pfree(sqldata.data);
+            spi_result, plan->sql);
     return -1;
   }
-  pfree(sqldata.data);
 
   if ( SPI_processed ) topo->be_data->data_changed = true;
 
@@ -3086,32 +3404,39 @@ cb_deleteFacesById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t
 static int
 cb_deleteNodesById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t numelems)
 {
-  MemoryContext oldcontext = CurrentMemoryContext;
   int spi_result;
-  StringInfoData sqldata;
-  StringInfo sql = &sqldata;
+  TopoPlanEntry *plan;
+  ArrayType *array_ids;
+  Datum values[1];
 
-  initStringInfo(sql);
-  appendStringInfo(sql, "DELETE FROM \"%s\".node WHERE node_id IN (",
-                   topo->name);
-  for (uint64_t i = 0; i < numelems; ++i)
+  plan = topoPlanGet(topo, TOPO_Q_DELETE_NODES_BY_ID, 0);
+  if ( ! plan->plan )
   {
-    appendStringInfo(sql, "%s%" LWTFMT_ELEMID, (i?",":""), ids[i]);
+    StringInfoData sqldata;
+    StringInfo sql = &sqldata;
+    Oid argtypes[1] = { INT4ARRAYOID };
+    bool ok;
+
+    initStringInfo(sql);
+    appendStringInfo(sql, "DELETE FROM \"%s\".node WHERE node_id = ANY($1)",
+                     topo->name);
+    ok = topoPlanPrepare(topo, plan, sql->data, 1, argtypes);
+    pfree(sqldata.data);
+    if ( ! ok ) return -1;
   }
-  appendStringInfoString(sql, ")");
 
-  POSTGIS_DEBUGF(1, "cb_deleteNodesById query: %s", sql->data);
+  POSTGIS_DEBUGF(1, "cb_deleteNodesById query: %s", plan->sql);
 
-  spi_result = SPI_execute( sql->data, false, 0 );
-  MemoryContextSwitchTo( oldcontext ); /* switch back */
+  array_ids = _elemids_to_int4array(ids, numelems);
+  values[0] = PointerGetDatum(array_ids);
+  spi_result = topoPlanExecute(topo, plan, values, false, 0);
+  pfree(array_ids); /* not needed anymore */
   if ( spi_result != SPI_OK_DELETE )
   {
     cberror(topo->be_data, "unexpected return (%d) from query execution: %s",
-            spi_result, sql->data);
-    pfree(sqldata.data);
+            spi_result, plan->sql);
     return -1;
   }
-  pfree(sqldata.data);
 
   if ( SPI_processed ) topo->be_data->data_changed = true;
 
@@ -3335,97 +3660,2089 @@ cb_getFaceWithinBox2D(const LWT_BE_TOPOLOGY *topo, const GBOX *box, uint64_t *nu
   MemoryContextSwitchTo( oldcontext ); /* switch back */
   if ( spi_result != SPI_OK_SELECT )
   {
-    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, sql->data);
-    pfree(sqldata.data);
-    *numelems = UINT64_MAX;
+    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, sql->data);
+    pfree(sqldata.data);
+    *numelems = UINT64_MAX;
+    return NULL;
+  }
+  pfree(sqldata.data);
+
+  POSTGIS_DEBUGF(1,
+		 "cb_getFaceWithinBox2D: face query "
+		 "(limited by %d) returned " UINT64_FORMAT " rows",
+		 elems_requested,
+		 SPI_processed);
+  *numelems = SPI_processed;
+  if ( ! SPI_processed )
+  {
+    return NULL;
+  }
+
+  if ( elems_requested == -1 )
+  {
+    /* This was an EXISTS query */
+    {
+      Datum dat;
+      bool isnull, exists;
+      dat = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
+      exists = DatumGetBool(dat);
+      *numelems = exists ? 1 : 0;
+      POSTGIS_DEBUGF(1, "cb_getFaceWithinBox2D: exists ? " UINT64_FORMAT, *numelems);
+    }
+
+    SPI_freetuptable(SPI_tuptable);
+
+    return NULL;
+  }
+
+  faces = palloc( sizeof(LWT_ISO_EDGE) * *numelems );
+  for ( i=0; i<*numelems; ++i )
+  {
+    HeapTuple row = SPI_tuptable->vals[i];
+    fillFaceFields(&faces[i], row, SPI_tuptable->tupdesc, fields);
+  }
+
+  SPI_freetuptable(SPI_tuptable);
+
+  return faces;
+}
+
+
+static LWT_BE_CALLBACKS be_callbacks =
+{
+  cb_lastErrorMessage,
+  NULL, /* createTopology */
+  cb_loadTopologyByName,
+  cb_freeTopology,
+  cb_getNodeById,
+  cb_getNodeWithinDistance2D,
+  cb_insertNodes,
+  cb_getEdgeById,
+  cb_getEdgeWithinDistance2D,
+  cb_getNextEdgeId,
+  cb_insertEdges,
+  cb_updateEdges,
+  cb_getFacesById,
+  cb_updateTopoGeomEdgeSplit,
+  cb_deleteEdges,
+  cb_getNodeWithinBox2D,
+  cb_getEdgeWithinBox2D,
+  cb_getEdgeByNode,
+  cb_updateNodes,
+  cb_updateTopoGeomFaceSplit,
+  cb_insertFaces,
+  cb_updateFacesById,
+  cb_getRingEdges,
+  cb_updateEdgesById,
+  cb_getEdgeByFace,
+  cb_getNodeByFace,
+  cb_updateNodesById,
+  cb_deleteFacesById,
+  cb_topoGetSRID,
+  cb_topoGetPrecision,
+  cb_topoHasZ,
+  cb_deleteNodesById,
+  cb_checkTopoGeomRemEdge,
+  cb_updateTopoGeomFaceHeal,
+  cb_checkTopoGeomRemNode,
+  cb_updateTopoGeomEdgeHeal,
+  cb_getFaceWithinBox2D,
+  cb_checkTopoGeomRemIsoNode,
+  cb_checkTopoGeomRemIsoEdge,
+  cb_getClosestEdge
+};
+
+/* ----------------- In-memory bulk backend ------------------------ */
+
+/*
+ * The bulk backend keeps a whole topology in memory while many
+ * geometries are added to it (see TopoGeo_BulkAddGeometry).
+ *
+ * Nodes, edges and faces are kept in hash tables keyed by identifier
+ * and spatially indexed by an STR packed tree. Edges are also indexed
+ * by the nodes, faces and next edges they reference, so that every
+ * callback can be answered without scanning the whole topology.
+ *
+ * Nothing is written to the database until topo_bulk_flush() sends
+ * the final state using the multi-row statements of the SPI callbacks.
+ */
+
+#define TOPO_BULK_FETCH_SIZE 10000
+#define TOPO_BULK_FLUSH_BATCH 1000
+#define TOPO_BULK_INDEX_CAPACITY 16
+#define TOPO_BULK_INDEX_MIN_PENDING 256
+
+typedef enum
+{
+  TOPO_BULK_CLEAN, /* as found in the database */
+  TOPO_BULK_DIRTY, /* found in the database, then modified */
+  TOPO_BULK_NEW    /* not in the database yet */
+} TopoBulkRowState;
+
+typedef struct
+{
+  double xmin, ymin, xmax, ymax;
+} TopoBulkBox;
+
+/* Common header of all stored primitives, the id is the hash key */
+typedef struct
+{
+  LWT_ELEMID id;
+  TopoBulkBox box;
+  bool has_box;
+  uint64 stamp; /* last query which returned this item */
+  TopoBulkRowState state;
+} TopoBulkItem;
+
+typedef struct
+{
+  TopoBulkItem item;
+  LWT_ISO_NODE node;
+} TopoBulkNode;
+
+typedef struct
+{
+  TopoBulkItem item;
+  LWT_ISO_EDGE edge;
+} TopoBulkEdge;
+
+typedef struct
+{
+  TopoBulkItem item;
+  GBOX mbr;
+} TopoBulkFace;
+
+/* Identifiers of the elements referencing a given key */
+typedef struct
+{
+  LWT_ELEMID key;
+  LWT_ELEMID *ids;
+  int nids;
+  int maxids;
+} TopoBulkRefs;
+
+/*
+ * STR packed tree entry: leaves reference an element identifier,
+ * inner entries the range of their children in the level below
+ */
+typedef struct
+{
+  TopoBulkBox box;
+  LWT_ELEMID ref;
+  int count;
+} TopoBulkIndexEntry;
+
+/*
+ * Primitives of one kind with their spatial index.
+ *
+ * Modified or added items get appended to the pending list rather
+ * than inserted in the packed tree, which is rebuilt from the hash
+ * table once the pending list grows past a fraction of its size.
+ * Entries for deleted or moved items are left in place and filtered
+ * out at query time by looking up the current item.
+ */
+typedef struct
+{
+  HTAB *hash;
+  TopoBulkIndexEntry **levels; /* levels[0] are the leaves */
+  int *nentries;
+  int nlevels;
+  TopoBulkIndexEntry *pending;
+  int npending;
+  int maxpending;
+  LWT_ELEMID lastid;  /* last assigned identifier */
+  LWT_ELEMID seqbase; /* first identifier taken from the sequence */
+  LWT_ELEMID *deleted; /* deleted identifiers found in the database */
+  int ndeleted;
+  int maxdeleted;
+} TopoBulkTable;
+
+struct TopoBulk
+{
+  MemoryContext mcxt;
+  LWT_BE_TOPOLOGY *be_topo;
+  bool has_layers;
+  bool loading;
+  uint64 stamp;
+  TopoBulkTable nodes;
+  TopoBulkTable edges;
+  TopoBulkTable faces;
+  HTAB *edges_by_node;
+  HTAB *edges_by_face;
+  HTAB *edges_by_next_left;
+  HTAB *edges_by_next_right;
+  HTAB *nodes_by_face;
+};
+
+static HTAB *
+topo_bulk_hash_create(TopoBulk *bulk, const char *name, Size entrysize)
+{
+  HASHCTL ctl;
+
+  memset(&ctl, 0, sizeof(ctl));
+  ctl.keysize = sizeof(LWT_ELEMID);
+  ctl.entrysize = entrysize;
+  ctl.hash = tag_hash;
+  ctl.hcxt = bulk->mcxt;
+  return hash_create(name, 1024, &ctl, HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+}
+
+static TopoBulk *
+topo_bulk_create(MemoryContext parent)
+{
+  MemoryContext mcxt;
+  TopoBulk *bulk;
+
+  mcxt = AllocSetContextCreate(parent, "TopoGeo bulk topology", ALLOCSET_DEFAULT_SIZES);
+  bulk = (TopoBulk *)MemoryContextAllocZero(mcxt, sizeof(TopoBulk));
+  bulk->mcxt = mcxt;
+  bulk->nodes.hash = topo_bulk_hash_create(bulk, "TopoGeo bulk nodes", sizeof(TopoBulkNode));
+  bulk->edges.hash = topo_bulk_hash_create(bulk, "TopoGeo bulk edges", sizeof(TopoBulkEdge));
+  bulk->faces.hash = topo_bulk_hash_create(bulk, "TopoGeo bulk faces", sizeof(TopoBulkFace));
+  bulk->edges_by_node = topo_bulk_hash_create(bulk, "TopoGeo bulk edges by node", sizeof(TopoBulkRefs));
+  bulk->edges_by_face = topo_bulk_hash_create(bulk, "TopoGeo bulk edges by face", sizeof(TopoBulkRefs));
+  bulk->edges_by_next_left = topo_bulk_hash_create(bulk, "TopoGeo bulk edges by next left", sizeof(TopoBulkRefs));
+  bulk->edges_by_next_right = topo_bulk_hash_create(bulk, "TopoGeo bulk edges by next right", sizeof(TopoBulkRefs));
+  bulk->nodes_by_face = topo_bulk_hash_create(bulk, "TopoGeo bulk nodes by face", sizeof(TopoBulkRefs));
+
+  return bulk;
+}
+
+/* Box as seen by the && operator, that is rounded out to float */
+static void
+topo_bulk_box_from_gbox(TopoBulkBox *box, const GBOX *gbox)
+{
+  GBOX rounded = *gbox;
+
+  gbox_float_round(&rounded);
+  box->xmin = rounded.xmin;
+  box->ymin = rounded.ymin;
+  box->xmax = rounded.xmax;
+  box->ymax = rounded.ymax;
+}
+
+static bool
+topo_bulk_box_from_ptarray(TopoBulkBox *box, const POINTARRAY *pa)
+{
+  GBOX gbox;
+
+  if ( ! pa || ! pa->npoints ) return false;
+  ptarray_calculate_gbox_cartesian(pa, &gbox);
+  topo_bulk_box_from_gbox(box, &gbox);
+  return true;
+}
+
+static inline bool
+topo_bulk_box_overlaps(const TopoBulkBox *a, const TopoBulkBox *b)
+{
+  return a->xmin <= b->xmax && b->xmin <= a->xmax &&
+         a->ymin <= b->ymax && b->ymin <= a->ymax;
+}
+
+static inline void
+topo_bulk_box_merge(TopoBulkBox *a, const TopoBulkBox *b)
+{
+  if ( b->xmin < a->xmin ) a->xmin = b->xmin;
+  if ( b->ymin < a->ymin ) a->ymin = b->ymin;
+  if ( b->xmax > a->xmax ) a->xmax = b->xmax;
+  if ( b->ymax > a->ymax ) a->ymax = b->ymax;
+}
+
+static inline double
+topo_bulk_box_distance(const TopoBulkBox *box, const POINT2D *p)
+{
+  double dx = 0, dy = 0;
+
+  if ( p->x < box->xmin ) dx = box->xmin - p->x;
+  else if ( p->x > box->xmax ) dx = p->x - box->xmax;
+  if ( p->y < box->ymin ) dy = box->ymin - p->y;
+  else if ( p->y > box->ymax ) dy = p->y - box->ymax;
+  return sqrt(dx * dx + dy * dy);
+}
+
+/* Spatial index */
+
+static int
+topo_bulk_cmp_x(const void *a, const void *b)
+{
+  const TopoBulkBox *ba = &((const TopoBulkIndexEntry *)a)->box;
+  const TopoBulkBox *bb = &((const TopoBulkIndexEntry *)b)->box;
+  double ca = ba->xmin + ba->xmax;
+  double cb = bb->xmin + bb->xmax;
+  return ca < cb ? -1 : (ca > cb ? 1 : 0);
+}
+
+static int
+topo_bulk_cmp_y(const void *a, const void *b)
+{
+  const TopoBulkBox *ba = &((const TopoBulkIndexEntry *)a)->box;
+  const TopoBulkBox *bb = &((const TopoBulkIndexEntry *)b)->box;
+  double ca = ba->ymin + ba->ymax;
+  double cb = bb->ymin + bb->ymax;
+  return ca < cb ? -1 : (ca > cb ? 1 : 0);
+}
+
+/*
+ * Sort-Tile-Recursive packing of one level: sorts the given entries
+ * in place and returns the (palloc'ed) entries of the parent level
+ */
+static TopoBulkIndexEntry *
+topo_bulk_index_pack(TopoBulkIndexEntry *entries, int n, int *nparents)
+{
+  const int cap = TOPO_BULK_INDEX_CAPACITY;
+  TopoBulkIndexEntry *parents;
+  int nslices, slicelen, i, j;
+
+  *nparents = (n + cap - 1) / cap;
+  nslices = (int)ceil(sqrt((double)*nparents));
+  slicelen = nslices * cap;
+
+  qsort(entries, n, sizeof(TopoBulkIndexEntry), topo_bulk_cmp_x);
+  for ( i = 0; i < n; i += slicelen )
+    qsort(entries + i, Min(slicelen, n - i), sizeof(TopoBulkIndexEntry), topo_bulk_cmp_y);
+
+  parents = (TopoBulkIndexEntry *)palloc(sizeof(TopoBulkIndexEntry) * *nparents);
+  for ( i = 0; i < *nparents; ++i )
+  {
+    TopoBulkIndexEntry *p = &parents[i];
+    p->ref = (LWT_ELEMID)i * cap;
+    p->count = Min(cap, n - i * cap);
+    p->box = entries[p->ref].box;
+    for ( j = 1; j < p->count; ++j )
+      topo_bulk_box_merge(&p->box, &entries[p->ref + j].box);
+  }
+
+  return parents;
+}
+
+/* Rebuild the packed tree of a table from its live items */
+static void
+topo_bulk_index_build(TopoBulk *bulk, TopoBulkTable *tab)
+{
+  MemoryContext oldcontext = MemoryContextSwitchTo(bulk->mcxt);
+  HASH_SEQ_STATUS status;
+  TopoBulkItem *item;
+  TopoBulkIndexEntry *leaves;
+  long nitems = hash_get_num_entries(tab->hash);
+  int n = 0, i;
+
+  for ( i = 0; i < tab->nlevels; ++i ) pfree(tab->levels[i]);
+  if ( tab->levels )
+  {
+    pfree(tab->levels);
+    pfree(tab->nentries);
+  }
+  tab->levels = NULL;
+  tab->nentries = NULL;
+  tab->nlevels = 0;
+  tab->npending = 0;
+
+  leaves = (TopoBulkIndexEntry *)palloc(sizeof(TopoBulkIndexEntry) * Max(nitems, 1));
+  hash_seq_init(&status, tab->hash);
+  while ( (item = (TopoBulkItem *)hash_seq_search(&status)) )
+  {
+    if ( ! item->has_box ) continue;
+    leaves[n].box = item->box;
+    leaves[n].ref = item->id;
+    leaves[n].count = 0;
+    ++n;
+  }
+
+  if ( n )
+  {
+    /* a tree of capacity 16 holding 2^31 entries has 8 levels */
+    tab->levels = (TopoBulkIndexEntry **)palloc(sizeof(TopoBulkIndexEntry *) * 9);
+    tab->nentries = (int *)palloc(sizeof(int) * 9);
+    tab->levels[0] = leaves;
+    tab->nentries[0] = n;
+    tab->nlevels = 1;
+    while ( tab->nentries[tab->nlevels - 1] > TOPO_BULK_INDEX_CAPACITY )
+    {
+      int l = tab->nlevels;
+      tab->levels[l] = topo_bulk_index_pack(tab->levels[l - 1], tab->nentries[l - 1], &tab->nentries[l]);
+      tab->nlevels++;
+    }
+  }
+  else
+  {
+    pfree(leaves);
+  }
+
+  MemoryContextSwitchTo(oldcontext);
+}
+
+/* Register the current box of an item in the index of its table */
+static void
+topo_bulk_index_add(TopoBulk *bulk, TopoBulkTable *tab, const TopoBulkItem *item)
+{
+  int indexed;
+
+  if ( bulk->loading || ! item->has_box ) return;
+
+  indexed = tab->nlevels ? tab->nentries[0] : 0;
+  if ( tab->npending >= Max(TOPO_BULK_INDEX_MIN_PENDING, indexed / 4) )
+  {
+    /* the rebuild picks up the item from the hash table */
+    topo_bulk_index_build(bulk, tab);
+    return;
+  }
+
+  if ( tab->npending == tab->maxpending )
+  {
+    tab->maxpending = tab->maxpending ? tab->maxpending * 2 : 64;
+    if ( tab->pending )
+      tab->pending = (TopoBulkIndexEntry *)repalloc(tab->pending, sizeof(TopoBulkIndexEntry) * tab->maxpending);
+    else
+      tab->pending = (TopoBulkIndexEntry *)MemoryContextAlloc(bulk->mcxt, sizeof(TopoBulkIndexEntry) * tab->maxpending);
+  }
+  tab->pending[tab->npending].box = item->box;
+  tab->pending[tab->npending].ref = item->id;
+  tab->pending[tab->npending].count = 0;
+  tab->npending++;
+}
+
+typedef struct
+{
+  TopoBulkItem **items;
+  int nitems;
+  int maxitems;
+} TopoBulkItemList;
+
+static void
+topo_bulk_list_add(TopoBulkItemList *list, TopoBulkItem *item)
+{
+  if ( list->nitems == list->maxitems )
+  {
+    list->maxitems = list->maxitems ? list->maxitems * 2 : 16;
+    if ( list->items )
+      list->items = (TopoBulkItem **)repalloc(list->items, sizeof(TopoBulkItem *) * list->maxitems);
+    else
+      list->items = (TopoBulkItem **)palloc(sizeof(TopoBulkItem *) * list->maxitems);
+  }
+  list->items[list->nitems++] = item;
+}
+
+/* Add the live item with the given identifier, unless already added */
+static void
+topo_bulk_list_add_id(TopoBulk *bulk, TopoBulkTable *tab, TopoBulkItemList *list,
+                      LWT_ELEMID id, const TopoBulkBox *box)
+{
+  TopoBulkItem *item = (TopoBulkItem *)hash_search(tab->hash, &id, HASH_FIND, NULL);
+
+  if ( ! item || item->stamp == bulk->stamp ) return;
+  if ( box && ! ( item->has_box && topo_bulk_box_overlaps(&item->box, box) ) ) return;
+  item->stamp = bulk->stamp;
+  topo_bulk_list_add(list, item);
+}
+
+static void
+topo_bulk_index_search(TopoBulk *bulk, TopoBulkTable *tab, TopoBulkItemList *list,
+                       const TopoBulkBox *box, int level, LWT_ELEMID first, int count)
+{
+  int i;
+
+  for ( i = 0; i < count; ++i )
+  {
+    const TopoBulkIndexEntry *e = &tab->levels[level][first + i];
+    if ( ! topo_bulk_box_overlaps(&e->box, box) ) continue;
+    if ( level )
+      topo_bulk_index_search(bulk, tab, list, box, level - 1, e->ref, e->count);
+    else
+      topo_bulk_list_add_id(bulk, tab, list, e->ref, box);
+  }
+}
+
+/*
+ * Collect the live items of a table whose box overlaps the given one,
+ * or all items if box is NULL. Items come out in no particular order.
+ */
+static void
+topo_bulk_query(TopoBulk *bulk, TopoBulkTable *tab, const GBOX *gbox, TopoBulkItemList *list)
+{
+  TopoBulkBox box;
+  int i;
+
+  memset(list, 0, sizeof(TopoBulkItemList));
+  bulk->stamp++;
+
+  if ( ! gbox )
+  {
+    HASH_SEQ_STATUS status;
+    TopoBulkItem *item;
+    hash_seq_init(&status, tab->hash);
+    while ( (item = (TopoBulkItem *)hash_seq_search(&status)) )
+      topo_bulk_list_add(list, item);
+    return;
+  }
+
+  topo_bulk_box_from_gbox(&box, gbox);
+  if ( tab->nlevels )
+  {
+    int top = tab->nlevels - 1;
+    topo_bulk_index_search(bulk, tab, list, &box, top, 0, tab->nentries[top]);
+  }
+  for ( i = 0; i < tab->npending; ++i )
+  {
+    if ( topo_bulk_box_overlaps(&tab->pending[i].box, &box) )
+      topo_bulk_list_add_id(bulk, tab, list, tab->pending[i].ref, &box);
+  }
+}
+
+/* Reference lists */
+
+static void
+topo_bulk_refs_add(TopoBulk *bulk, HTAB *refs, LWT_ELEMID key, LWT_ELEMID id)
+{
+  bool found;
+  TopoBulkRefs *r = (TopoBulkRefs *)hash_search(refs, &key, HASH_ENTER, &found);
+
+  if ( ! found )
+  {
+    r->maxids = 4;
+    r->nids = 0;
+    r->ids = (LWT_ELEMID *)MemoryContextAlloc(bulk->mcxt, sizeof(LWT_ELEMID) * r->maxids);
+  }
+  else if ( r->nids == r->maxids )
+  {
+    r->maxids *= 2;
+    r->ids = (LWT_ELEMID *)repalloc(r->ids, sizeof(LWT_ELEMID) * r->maxids);
+  }
+  r->ids[r->nids++] = id;
+}
+
+static void
+topo_bulk_refs_del(HTAB *refs, LWT_ELEMID key, LWT_ELEMID id)
+{
+  TopoBulkRefs *r = (TopoBulkRefs *)hash_search(refs, &key, HASH_FIND, NULL);
+  int i;
+
+  if ( ! r ) return;
+  for ( i = 0; i < r->nids; ++i )
+  {
+    if ( r->ids[i] != id ) continue;
+    r->ids[i] = r->ids[--r->nids];
+    break;
+  }
+  if ( ! r->nids )
+  {
+    pfree(r->ids);
+    hash_search(refs, &key, HASH_REMOVE, NULL);
+  }
+}
+
+/*
+ * Collect the live items referenced by the given key, returns false
+ * if the key is not indexed and the caller needs to scan all items
+ */
+static bool
+topo_bulk_refs_query(TopoBulk *bulk, TopoBulkTable *tab, HTAB *refs, LWT_ELEMID key,
+                     TopoBulkItemList *list)
+{
+  TopoBulkRefs *r = (TopoBulkRefs *)hash_search(refs, &key, HASH_FIND, NULL);
+  int i;
+
+  if ( ! r ) return true;
+  for ( i = 0; i < r->nids; ++i )
+    topo_bulk_list_add_id(bulk, tab, list, r->ids[i], NULL);
+  return true;
+}
+
+/* Faces other than the universe index their edges and isolated nodes */
+#define TOPO_BULK_FACE_INDEXED(f) ((f) > 0)
+
+static void
+topo_bulk_edge_link(TopoBulk *bulk, const LWT_ISO_EDGE *e)
+{
+  topo_bulk_refs_add(bulk, bulk->edges_by_node, e->start_node, e->edge_id);
+  if ( e->end_node != e->start_node )
+    topo_bulk_refs_add(bulk, bulk->edges_by_node, e->end_node, e->edge_id);
+  if ( TOPO_BULK_FACE_INDEXED(e->face_left) )
+    topo_bulk_refs_add(bulk, bulk->edges_by_face, e->face_left, e->edge_id);
+  if ( TOPO_BULK_FACE_INDEXED(e->face_right) && e->face_right != e->face_left )
+    topo_bulk_refs_add(bulk, bulk->edges_by_face, e->face_right, e->edge_id);
+  topo_bulk_refs_add(bulk, bulk->edges_by_next_left, e->next_left, e->edge_id);
+  topo_bulk_refs_add(bulk, bulk->edges_by_next_right, e->next_right, e->edge_id);
+}
+
+static void
+topo_bulk_edge_unlink(TopoBulk *bulk, const LWT_ISO_EDGE *e)
+{
+  topo_bulk_refs_del(bulk->edges_by_node, e->start_node, e->edge_id);
+  if ( e->end_node != e->start_node )
+    topo_bulk_refs_del(bulk->edges_by_node, e->end_node, e->edge_id);
+  if ( TOPO_BULK_FACE_INDEXED(e->face_left) )
+    topo_bulk_refs_del(bulk->edges_by_face, e->face_left, e->edge_id);
+  if ( TOPO_BULK_FACE_INDEXED(e->face_right) && e->face_right != e->face_left )
+    topo_bulk_refs_del(bulk->edges_by_face, e->face_right, e->edge_id);
+  topo_bulk_refs_del(bulk->edges_by_next_left, e->next_left, e->edge_id);
+  topo_bulk_refs_del(bulk->edges_by_next_right, e->next_right, e->edge_id);
+}
+
+/* Storage of primitives */
+
+static void
+topo_bulk_mark_dirty(TopoBulkItem *item)
+{
+  if ( item->state == TOPO_BULK_CLEAN ) item->state = TOPO_BULK_DIRTY;
+}
+
+static void
+topo_bulk_mark_deleted(TopoBulk *bulk, TopoBulkTable *tab, const TopoBulkItem *item)
+{
+  if ( item->state == TOPO_BULK_NEW ) return;
+  if ( tab->ndeleted == tab->maxdeleted )
+  {
+    tab->maxdeleted = tab->maxdeleted ? tab->maxdeleted * 2 : 64;
+    if ( tab->deleted )
+      tab->deleted = (LWT_ELEMID *)repalloc(tab->deleted, sizeof(LWT_ELEMID) * tab->maxdeleted);
+    else
+      tab->deleted = (LWT_ELEMID *)MemoryContextAlloc(bulk->mcxt, sizeof(LWT_ELEMID) * tab->maxdeleted);
+  }
+  tab->deleted[tab->ndeleted++] = item->id;
+}
+
+static void
+topo_bulk_set_node_geom(TopoBulk *bulk, TopoBulkNode *n, const LWPOINT *geom)
+{
+  MemoryContext oldcontext = MemoryContextSwitchTo(bulk->mcxt);
+
+  if ( n->node.geom ) lwpoint_free(n->node.geom);
+  n->node.geom = geom ? lwgeom_as_lwpoint(lwgeom_clone_deep(lwpoint_as_lwgeom(geom))) : NULL;
+  n->item.has_box = geom && topo_bulk_box_from_ptarray(&n->item.box, geom->point);
+  MemoryContextSwitchTo(oldcontext);
+}
+
+static void
+topo_bulk_set_edge_geom(TopoBulk *bulk, TopoBulkEdge *e, const LWLINE *geom)
+{
+  MemoryContext oldcontext = MemoryContextSwitchTo(bulk->mcxt);
+
+  if ( e->edge.geom ) lwline_free(e->edge.geom);
+  e->edge.geom = geom ? lwgeom_as_lwline(lwgeom_clone_deep(lwline_as_lwgeom(geom))) : NULL;
+  e->item.has_box = geom && topo_bulk_box_from_ptarray(&e->item.box, geom->points);
+  MemoryContextSwitchTo(oldcontext);
+}
+
+static void
+topo_bulk_set_face_mbr(TopoBulkFace *f, const GBOX *mbr)
+{
+  f->item.has_box = mbr != NULL;
+  if ( mbr )
+  {
+    f->mbr = *mbr;
+    topo_bulk_box_from_gbox(&f->item.box, mbr);
+  }
+}
+
+static void
+topo_bulk_put_node(TopoBulk *bulk, const LWT_ISO_NODE *node, TopoBulkRowState state)
+{
+  TopoBulkNode *n = (TopoBulkNode *)hash_search(bulk->nodes.hash, &node->node_id, HASH_ENTER, NULL);
+
+  n->item.stamp = 0;
+  n->item.state = state;
+  n->node = *node;
+  n->node.geom = NULL;
+  topo_bulk_set_node_geom(bulk, n, node->geom);
+  if ( TOPO_BULK_FACE_INDEXED(node->containing_face) )
+    topo_bulk_refs_add(bulk, bulk->nodes_by_face, node->containing_face, node->node_id);
+  topo_bulk_index_add(bulk, &bulk->nodes, &n->item);
+}
+
+static void
+topo_bulk_put_edge(TopoBulk *bulk, const LWT_ISO_EDGE *edge, TopoBulkRowState state)
+{
+  TopoBulkEdge *e = (TopoBulkEdge *)hash_search(bulk->edges.hash, &edge->edge_id, HASH_ENTER, NULL);
+
+  e->item.stamp = 0;
+  e->item.state = state;
+  e->edge = *edge;
+  e->edge.geom = NULL;
+  topo_bulk_set_edge_geom(bulk, e, edge->geom);
+  topo_bulk_edge_link(bulk, &e->edge);
+  topo_bulk_index_add(bulk, &bulk->edges, &e->item);
+}
+
+static void
+topo_bulk_put_face(TopoBulk *bulk, const LWT_ISO_FACE *face, TopoBulkRowState state)
+{
+  TopoBulkFace *f = (TopoBulkFace *)hash_search(bulk->faces.hash, &face->face_id, HASH_ENTER, NULL);
+
+  f->item.stamp = 0;
+  f->item.state = state;
+  topo_bulk_set_face_mbr(f, face->mbr);
+  topo_bulk_index_add(bulk, &bulk->faces, &f->item);
+}
+
+static void
+topo_bulk_update_node(TopoBulk *bulk, TopoBulkNode *n, const LWT_ISO_NODE *upd, int fields)
+{
+  if ( fields & LWT_COL_NODE_CONTAINING_FACE && n->node.containing_face != upd->containing_face )
+  {
+    if ( TOPO_BULK_FACE_INDEXED(n->node.containing_face) )
+      topo_bulk_refs_del(bulk->nodes_by_face, n->node.containing_face, n->item.id);
+    n->node.containing_face = upd->containing_face;
+    if ( TOPO_BULK_FACE_INDEXED(n->node.containing_face) )
+      topo_bulk_refs_add(bulk, bulk->nodes_by_face, n->node.containing_face, n->item.id);
+  }
+  if ( fields & LWT_COL_NODE_GEOM )
+  {
+    topo_bulk_set_node_geom(bulk, n, upd->geom);
+    topo_bulk_index_add(bulk, &bulk->nodes, &n->item);
+  }
+  topo_bulk_mark_dirty(&n->item);
+}
+
+static void
+topo_bulk_update_edge(TopoBulk *bulk, TopoBulkEdge *e, const LWT_ISO_EDGE *upd, int fields)
+{
+  topo_bulk_edge_unlink(bulk, &e->edge);
+  if ( fields & LWT_COL_EDGE_START_NODE ) e->edge.start_node = upd->start_node;
+  if ( fields & LWT_COL_EDGE_END_NODE ) e->edge.end_node = upd->end_node;
+  if ( fields & LWT_COL_EDGE_FACE_LEFT ) e->edge.face_left = upd->face_left;
+  if ( fields & LWT_COL_EDGE_FACE_RIGHT ) e->edge.face_right = upd->face_right;
+  if ( fields & LWT_COL_EDGE_NEXT_LEFT ) e->edge.next_left = upd->next_left;
+  if ( fields & LWT_COL_EDGE_NEXT_RIGHT ) e->edge.next_right = upd->next_right;
+  topo_bulk_edge_link(bulk, &e->edge);
+  if ( fields & LWT_COL_EDGE_GEOM )
+  {
+    topo_bulk_set_edge_geom(bulk, e, upd->geom);
+    topo_bulk_index_add(bulk, &bulk->edges, &e->item);
+  }
+  topo_bulk_mark_dirty(&e->item);
+}
+
+static void
+topo_bulk_remove_node(TopoBulk *bulk, TopoBulkNode *n)
+{
+  LWT_ELEMID id = n->item.id;
+
+  if ( TOPO_BULK_FACE_INDEXED(n->node.containing_face) )
+    topo_bulk_refs_del(bulk->nodes_by_face, n->node.containing_face, id);
+  if ( n->node.geom ) lwpoint_free(n->node.geom);
+  topo_bulk_mark_deleted(bulk, &bulk->nodes, &n->item);
+  hash_search(bulk->nodes.hash, &id, HASH_REMOVE, NULL);
+}
+
+static void
+topo_bulk_remove_edge(TopoBulk *bulk, TopoBulkEdge *e)
+{
+  LWT_ELEMID id = e->item.id;
+
+  topo_bulk_edge_unlink(bulk, &e->edge);
+  if ( e->edge.geom ) lwline_free(e->edge.geom);
+  topo_bulk_mark_deleted(bulk, &bulk->edges, &e->item);
+  hash_search(bulk->edges.hash, &id, HASH_REMOVE, NULL);
+}
+
+/* Copy out the requested fields, in the caller memory context */
+
+static void
+topo_bulk_copy_node(LWT_ISO_NODE *dst, const TopoBulkNode *n, int fields)
+{
+  *dst = n->node;
+  dst->geom = NULL;
+  if ( fields & LWT_COL_NODE_GEOM && n->node.geom )
+    dst->geom = lwgeom_as_lwpoint(lwgeom_clone_deep(lwpoint_as_lwgeom(n->node.geom)));
+}
+
+static void
+topo_bulk_copy_edge(LWT_ISO_EDGE *dst, const TopoBulkEdge *e, int fields)
+{
+  *dst = e->edge;
+  dst->geom = NULL;
+  if ( fields & LWT_COL_EDGE_GEOM && e->edge.geom )
+    dst->geom = lwgeom_as_lwline(lwgeom_clone_deep(lwline_as_lwgeom(e->edge.geom)));
+}
+
+static void
+topo_bulk_copy_face(LWT_ISO_FACE *dst, const TopoBulkFace *f, int fields)
+{
+  dst->face_id = f->item.id;
+  dst->mbr = NULL;
+  if ( fields & LWT_COL_FACE_MBR && f->item.has_box )
+    dst->mbr = gbox_clone(&f->mbr);
+}
+
+static LWT_ISO_NODE *
+topo_bulk_nodes_out(TopoBulkItemList *list, uint64_t *numelems, int fields, int64_t limit)
+{
+  LWT_ISO_NODE *nodes;
+  uint64_t n = list->nitems;
+  uint64_t i;
+
+  if ( limit > 0 && n > (uint64_t)limit ) n = limit;
+  if ( limit == -1 || ! n )
+  {
+    *numelems = n ? 1 : 0;
+    if ( list->items ) pfree(list->items);
+    return NULL;
+  }
+  nodes = (LWT_ISO_NODE *)palloc(sizeof(LWT_ISO_NODE) * n);
+  for ( i = 0; i < n; ++i )
+    topo_bulk_copy_node(&nodes[i], (TopoBulkNode *)list->items[i], fields);
+  pfree(list->items);
+  *numelems = n;
+  return nodes;
+}
+
+static LWT_ISO_EDGE *
+topo_bulk_edges_out(TopoBulkItemList *list, uint64_t *numelems, int fields, int64_t limit)
+{
+  LWT_ISO_EDGE *edges;
+  uint64_t n = list->nitems;
+  uint64_t i;
+
+  if ( limit > 0 && n > (uint64_t)limit ) n = limit;
+  if ( limit == -1 || ! n )
+  {
+    *numelems = n ? 1 : 0;
+    if ( list->items ) pfree(list->items);
+    return NULL;
+  }
+  edges = (LWT_ISO_EDGE *)palloc(sizeof(LWT_ISO_EDGE) * n);
+  for ( i = 0; i < n; ++i )
+    topo_bulk_copy_edge(&edges[i], (TopoBulkEdge *)list->items[i], fields);
+  pfree(list->items);
+  *numelems = n;
+  return edges;
+}
+
+static LWT_ISO_FACE *
+topo_bulk_faces_out(TopoBulkItemList *list, uint64_t *numelems, int fields, int64_t limit)
+{
+  LWT_ISO_FACE *faces;
+  uint64_t n = list->nitems;
+  uint64_t i;
+
+  if ( limit > 0 && n > (uint64_t)limit ) n = limit;
+  if ( limit == -1 || ! n )
+  {
+    *numelems = n ? 1 : 0;
+    if ( list->items ) pfree(list->items);
+    return NULL;
+  }
+  faces = (LWT_ISO_FACE *)palloc(sizeof(LWT_ISO_FACE) * n);
+  for ( i = 0; i < n; ++i )
+    topo_bulk_copy_face(&faces[i], (TopoBulkFace *)list->items[i], fields);
+  pfree(list->items);
+  *numelems = n;
+  return faces;
+}
+
+/* Selection by field values, mirroring the SQL of cb_updateEdges */
+
+static bool
+topo_bulk_edge_field_equals(const LWT_ISO_EDGE *e, const LWT_ISO_EDGE *v, int field)
+{
+  switch ( field )
+  {
+  case LWT_COL_EDGE_EDGE_ID: return e->edge_id == v->edge_id;
+  case LWT_COL_EDGE_START_NODE: return e->start_node == v->start_node;
+  case LWT_COL_EDGE_END_NODE: return e->end_node == v->end_node;
+  case LWT_COL_EDGE_FACE_LEFT: return e->face_left == v->face_left;
+  case LWT_COL_EDGE_FACE_RIGHT: return e->face_right == v->face_right;
+  case LWT_COL_EDGE_NEXT_LEFT: return e->next_left == v->next_left;
+  case LWT_COL_EDGE_NEXT_RIGHT: return e->next_right == v->next_right;
+  case LWT_COL_EDGE_GEOM:
+    return e->geom && v->geom &&
+           lwgeom_same(lwline_as_lwgeom(e->geom), lwline_as_lwgeom(v->geom));
+  }
+  return false;
+}
+
+static bool
+topo_bulk_edge_selected(const LWT_ISO_EDGE *e,
+                        const LWT_ISO_EDGE *sel, int sel_fields,
+                        const LWT_ISO_EDGE *exc, int exc_fields)
+{
+  int f;
+
+  for ( f = 1; f < (1 << 8); f <<= 1 )
+  {
+    if ( sel_fields & f && ! topo_bulk_edge_field_equals(e, sel, f) ) return false;
+    if ( exc && exc_fields & f && topo_bulk_edge_field_equals(e, exc, f) ) return false;
+  }
+  return true;
+}
+
+static void
+topo_bulk_select_edges(TopoBulk *bulk, const LWT_ISO_EDGE *sel, int fields,
+                       const LWT_ISO_EDGE *exc, int exc_fields, TopoBulkItemList *list)
+{
+  TopoBulkItemList cand;
+  int i;
+
+  memset(&cand, 0, sizeof(cand));
+  bulk->stamp++;
+  if ( fields & LWT_COL_EDGE_EDGE_ID )
+    topo_bulk_list_add_id(bulk, &bulk->edges, &cand, sel->edge_id, NULL);
+  else if ( fields & LWT_COL_EDGE_START_NODE )
+    topo_bulk_refs_query(bulk, &bulk->edges, bulk->edges_by_node, sel->start_node, &cand);
+  else if ( fields & LWT_COL_EDGE_END_NODE )
+    topo_bulk_refs_query(bulk, &bulk->edges, bulk->edges_by_node, sel->end_node, &cand);
+  else if ( fields & LWT_COL_EDGE_NEXT_LEFT )
+    topo_bulk_refs_query(bulk, &bulk->edges, bulk->edges_by_next_left, sel->next_left, &cand);
+  else if ( fields & LWT_COL_EDGE_NEXT_RIGHT )
+    topo_bulk_refs_query(bulk, &bulk->edges, bulk->edges_by_next_right, sel->next_right, &cand);
+  else if ( fields & LWT_COL_EDGE_FACE_LEFT && TOPO_BULK_FACE_INDEXED(sel->face_left) )
+    topo_bulk_refs_query(bulk, &bulk->edges, bulk->edges_by_face, sel->face_left, &cand);
+  else if ( fields & LWT_COL_EDGE_FACE_RIGHT && TOPO_BULK_FACE_INDEXED(sel->face_right) )
+    topo_bulk_refs_query(bulk, &bulk->edges, bulk->edges_by_face, sel->face_right, &cand);
+  else
+    topo_bulk_query(bulk, &bulk->edges, NULL, &cand);
+
+  memset(list, 0, sizeof(TopoBulkItemList));
+  for ( i = 0; i < cand.nitems; ++i )
+  {
+    TopoBulkEdge *e = (TopoBulkEdge *)cand.items[i];
+    if ( topo_bulk_edge_selected(&e->edge, sel, fields, exc, exc_fields) )
+      topo_bulk_list_add(list, cand.items[i]);
+  }
+  if ( cand.items ) pfree(cand.items);
+}
+
+static bool
+topo_bulk_node_field_equals(const LWT_ISO_NODE *n, const LWT_ISO_NODE *v, int field)
+{
+  switch ( field )
+  {
+  case LWT_COL_NODE_NODE_ID: return n->node_id == v->node_id;
+  case LWT_COL_NODE_CONTAINING_FACE:
+    /* a NULL containing face never compares, as in SQL */
+    return n->containing_face != -1 && n->containing_face == v->containing_face;
+  case LWT_COL_NODE_GEOM:
+    return n->geom && v->geom &&
+           lwgeom_same(lwpoint_as_lwgeom(n->geom), lwpoint_as_lwgeom(v->geom));
+  }
+  return false;
+}
+
+static bool
+topo_bulk_node_selected(const LWT_ISO_NODE *n,
+                        const LWT_ISO_NODE *sel, int sel_fields,
+                        const LWT_ISO_NODE *exc, int exc_fields)
+{
+  int f;
+
+  for ( f = 1; f < (1 << 3); f <<= 1 )
+  {
+    if ( sel_fields & f && ! topo_bulk_node_field_equals(n, sel, f) ) return false;
+    if ( exc && exc_fields & f )
+    {
+      if ( f == LWT_COL_NODE_CONTAINING_FACE &&
+           ( n->containing_face == -1 || exc->containing_face == -1 ) )
+        return false;
+      if ( topo_bulk_node_field_equals(n, exc, f) ) return false;
+    }
+  }
+  return true;
+}
+
+/* Bulk backend callbacks */
+
+static LWT_BE_TOPOLOGY*
+cb_bulk_loadTopologyByName(const LWT_BE_DATA* be, const char *name);
+
+static int
+cb_bulk_freeTopology(LWT_BE_TOPOLOGY* topo)
+{
+  topo->bulk = NULL; /* owned by the caller of lwt_LoadTopology */
+  return cb_freeTopology(topo);
+}
+
+static LWT_ISO_NODE *
+cb_bulk_getNodeById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *numelems, int fields)
+{
+  TopoBulk *bulk = topo->bulk;
+  TopoBulkItemList list;
+  uint64_t i;
+
+  memset(&list, 0, sizeof(list));
+  bulk->stamp++;
+  for ( i = 0; i < *numelems; ++i )
+    topo_bulk_list_add_id(bulk, &bulk->nodes, &list, ids[i], NULL);
+  return topo_bulk_nodes_out(&list, numelems, fields, 0);
+}
+
+static LWT_ISO_NODE *
+cb_bulk_getNodeWithinDistance2D(const LWT_BE_TOPOLOGY *topo,
+                                const LWPOINT *pt,
+                                double dist,
+                                uint64_t *numelems,
+                                int fields,
+                                int64_t limit)
+{
+  TopoBulk *bulk = topo->bulk;
+  TopoBulkItemList list;
+  POINT2D p;
+  GBOX qbox;
+  int i, n = 0;
+
+  getPoint2d_p(pt->point, 0, &p);
+  qbox.flags = 0;
+  qbox.xmin = p.x - dist;
+  qbox.xmax = p.x + dist;
+  qbox.ymin = p.y - dist;
+  qbox.ymax = p.y + dist;
+  topo_bulk_query(bulk, &bulk->nodes, &qbox, &list);
+
+  for ( i = 0; i < list.nitems; ++i )
+  {
+    TopoBulkNode *node = (TopoBulkNode *)list.items[i];
+    POINT2D q;
+    if ( ! node->node.geom ) continue;
+    getPoint2d_p(node->node.geom->point, 0, &q);
+    if ( dist ? distance2d_pt_pt(&p, &q) > dist : ( p.x != q.x || p.y != q.y ) )
+      continue;
+    list.items[n++] = list.items[i];
+  }
+  list.nitems = n;
+
+  return topo_bulk_nodes_out(&list, numelems, fields, limit);
+}
+
+static int
+cb_bulk_insertNodes(const LWT_BE_TOPOLOGY *topo, LWT_ISO_NODE *nodes, uint64_t numelems)
+{
+  TopoBulk *bulk = topo->bulk;
+  uint64_t i;
+
+  for ( i = 0; i < numelems; ++i )
+  {
+    if ( nodes[i].node_id == -1 ) nodes[i].node_id = ++bulk->nodes.lastid;
+    topo_bulk_put_node(bulk, &nodes[i], TOPO_BULK_NEW);
+  }
+  return 1;
+}
+
+static LWT_ISO_EDGE *
+cb_bulk_getEdgeById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *numelems, int fields)
+{
+  TopoBulk *bulk = topo->bulk;
+  TopoBulkItemList list;
+  uint64_t i;
+
+  memset(&list, 0, sizeof(list));
+  bulk->stamp++;
+  for ( i = 0; i < *numelems; ++i )
+    topo_bulk_list_add_id(bulk, &bulk->edges, &list, ids[i], NULL);
+  return topo_bulk_edges_out(&list, numelems, fields, 0);
+}
+
+static LWT_ISO_EDGE *
+cb_bulk_getEdgeWithinDistance2D(const LWT_BE_TOPOLOGY *topo,
+                                const LWPOINT *pt,
+                                double dist,
+                                uint64_t *numelems,
+                                int fields,
+                                int64_t limit)
+{
+  TopoBulk *bulk = topo->bulk;
+  TopoBulkItemList list;
+  LWGEOM *ptg = lwpoint_as_lwgeom(pt);
+  POINT2D p;
+  GBOX qbox;
+  int i, n = 0;
+
+  getPoint2d_p(pt->point, 0, &p);
+  qbox.flags = 0;
+  qbox.xmin = p.x - dist;
+  qbox.xmax = p.x + dist;
+  qbox.ymin = p.y - dist;
+  qbox.ymax = p.y + dist;
+  topo_bulk_query(bulk, &bulk->edges, &qbox, &list);
+
+  for ( i = 0; i < list.nitems; ++i )
+  {
+    TopoBulkEdge *e = (TopoBulkEdge *)list.items[i];
+    LWGEOM *eg;
+    if ( ! e->edge.geom ) continue;
+    eg = lwline_as_lwgeom(e->edge.geom);
+    if ( dist )
+    {
+      /* ST_DWithin */
+      if ( lwgeom_mindistance2d_tolerance(ptg, eg, dist) > dist ) continue;
+    }
+    else
+    {
+      /* ST_Within: on the line, but not on its boundary */
+      if ( lwgeom_mindistance2d_tolerance(ptg, eg, 0) != 0 ) continue;
+      if ( ! lwline_is_closed(e->edge.geom) )
+      {
+        POINT2D a, b;
+        getPoint2d_p(e->edge.geom->points, 0, &a);
+        getPoint2d_p(e->edge.geom->points, e->edge.geom->points->npoints - 1, &b);
+        if ( p2d_same(&p, &a) || p2d_same(&p, &b) ) continue;
+      }
+    }
+    list.items[n++] = list.items[i];
+  }
+  list.nitems = n;
+
+  return topo_bulk_edges_out(&list, numelems, fields, limit);
+}
+
+static LWT_ELEMID
+cb_bulk_getNextEdgeId( const LWT_BE_TOPOLOGY* topo )
+{
+  return ++topo->bulk->edges.lastid;
+}
+
+static int
+cb_bulk_insertEdges(const LWT_BE_TOPOLOGY *topo, LWT_ISO_EDGE *edges, uint64_t numelems)
+{
+  TopoBulk *bulk = topo->bulk;
+  uint64_t i;
+
+  for ( i = 0; i < numelems; ++i )
+  {
+    if ( edges[i].edge_id == -1 ) edges[i].edge_id = ++bulk->edges.lastid;
+    topo_bulk_put_edge(bulk, &edges[i], TOPO_BULK_NEW);
+  }
+  return numelems;
+}
+
+static int
+cb_bulk_updateEdges( const LWT_BE_TOPOLOGY* topo,
+                     const LWT_ISO_EDGE* sel_edge, int sel_fields,
+                     const LWT_ISO_EDGE* upd_edge, int upd_fields,
+                     const LWT_ISO_EDGE* exc_edge, int exc_fields )
+{
+  TopoBulk *bulk = topo->bulk;
+  TopoBulkItemList list;
+  int i, n;
+
+  topo_bulk_select_edges(bulk, sel_edge, sel_fields, exc_edge, exc_fields, &list);
+  for ( i = 0; i < list.nitems; ++i )
+    topo_bulk_update_edge(bulk, (TopoBulkEdge *)list.items[i], upd_edge, upd_fields);
+  n = list.nitems;
+  if ( list.items ) pfree(list.items);
+  return n;
+}
+
+static LWT_ISO_FACE *
+cb_bulk_getFacesById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *numelems, int fields)
+{
+  TopoBulk *bulk = topo->bulk;
+  TopoBulkItemList list;
+  uint64_t i;
+
+  memset(&list, 0, sizeof(list));
+  bulk->stamp++;
+  for ( i = 0; i < *numelems; ++i )
+    topo_bulk_list_add_id(bulk, &bulk->faces, &list, ids[i], NULL);
+  return topo_bulk_faces_out(&list, numelems, fields, 0);
+}
+
+static int
+cb_bulk_deleteEdges( const LWT_BE_TOPOLOGY* topo,
+                     const LWT_ISO_EDGE* sel_edge, int sel_fields )
+{
+  TopoBulk *bulk = topo->bulk;
+  TopoBulkItemList list;
+  int i, n;
+
+  topo_bulk_select_edges(bulk, sel_edge, sel_fields, NULL, 0, &list);
+  for ( i = 0; i < list.nitems; ++i )
+    topo_bulk_remove_edge(bulk, (TopoBulkEdge *)list.items[i]);
+  n = list.nitems;
+  if ( list.items ) pfree(list.items);
+  return n;
+}
+
+static LWT_ISO_NODE *
+cb_bulk_getNodeWithinBox2D(const LWT_BE_TOPOLOGY *topo, const GBOX *box, uint64_t *numelems, int fields, int limit)
+{
+  TopoBulkItemList list;
+
+  topo_bulk_query(topo->bulk, &topo->bulk->nodes, box, &list);
+  return topo_bulk_nodes_out(&list, numelems, fields, limit);
+}
+
+static LWT_ISO_EDGE *
+cb_bulk_getEdgeWithinBox2D(const LWT_BE_TOPOLOGY *topo, const GBOX *box, uint64_t *numelems, int fields, int limit)
+{
+  TopoBulkItemList list;
+
+  topo_bulk_query(topo->bulk, &topo->bulk->edges, box, &list);
+  return topo_bulk_edges_out(&list, numelems, fields, limit);
+}
+
+static LWT_ISO_EDGE *
+cb_bulk_getEdgeByNode(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *numelems, int fields)
+{
+  TopoBulk *bulk = topo->bulk;
+  TopoBulkItemList list;
+  uint64_t i;
+
+  memset(&list, 0, sizeof(list));
+  bulk->stamp++;
+  for ( i = 0; i < *numelems; ++i )
+    topo_bulk_refs_query(bulk, &bulk->edges, bulk->edges_by_node, ids[i], &list);
+  return topo_bulk_edges_out(&list, numelems, fields, 0);
+}
+
+static int
+cb_bulk_updateNodes( const LWT_BE_TOPOLOGY* topo,
+                     const LWT_ISO_NODE* sel_node, int sel_fields,
+                     const LWT_ISO_NODE* upd_node, int upd_fields,
+                     const LWT_ISO_NODE* exc_node, int exc_fields )
+{
+  TopoBulk *bulk = topo->bulk;
+  TopoBulkItemList cand;
+  int i, n = 0;
+
+  memset(&cand, 0, sizeof(cand));
+  bulk->stamp++;
+  if ( sel_fields & LWT_COL_NODE_NODE_ID )
+    topo_bulk_list_add_id(bulk, &bulk->nodes, &cand, sel_node->node_id, NULL);
+  else if ( sel_fields & LWT_COL_NODE_CONTAINING_FACE &&
+            TOPO_BULK_FACE_INDEXED(sel_node->containing_face) )
+    topo_bulk_refs_query(bulk, &bulk->nodes, bulk->nodes_by_face, sel_node->containing_face, &cand);
+  else
+    topo_bulk_query(bulk, &bulk->nodes, NULL, &cand);
+
+  for ( i = 0; i < cand.nitems; ++i )
+  {
+    TopoBulkNode *node = (TopoBulkNode *)cand.items[i];
+    if ( ! topo_bulk_node_selected(&node->node, sel_node, sel_fields, exc_node, exc_fields) )
+      continue;
+    topo_bulk_update_node(bulk, node, upd_node, upd_fields);
+    ++n;
+  }
+  if ( cand.items ) pfree(cand.items);
+  return n;
+}
+
+static int
+cb_bulk_insertFaces(const LWT_BE_TOPOLOGY *topo, LWT_ISO_FACE *faces, uint64_t numelems)
+{
+  TopoBulk *bulk = topo->bulk;
+  uint64_t i;
+
+  for ( i = 0; i < numelems; ++i )
+  {
+    if ( faces[i].face_id == -1 ) faces[i].face_id = ++bulk->faces.lastid;
+    topo_bulk_put_face(bulk, &faces[i], TOPO_BULK_NEW);
+  }
+  return numelems;
+}
+
+static uint64_t
+cb_bulk_updateFacesById( const LWT_BE_TOPOLOGY* topo,
+                         const LWT_ISO_FACE* faces, uint64_t numfaces )
+{
+  TopoBulk *bulk = topo->bulk;
+  uint64_t i, n = 0;
+
+  for ( i = 0; i < numfaces; ++i )
+  {
+    TopoBulkFace *f = (TopoBulkFace *)hash_search(bulk->faces.hash, &faces[i].face_id, HASH_FIND, NULL);
+    if ( ! f ) continue;
+    topo_bulk_set_face_mbr(f, faces[i].mbr);
+    topo_bulk_index_add(bulk, &bulk->faces, &f->item);
+    topo_bulk_mark_dirty(&f->item);
+    ++n;
+  }
+  return n;
+}
+
+static LWT_ELEMID *
+cb_bulk_getRingEdges(const LWT_BE_TOPOLOGY *topo, LWT_ELEMID edge, uint64_t *numelems, int limit)
+{
+  TopoBulk *bulk = topo->bulk;
+  LWT_ELEMID *edges;
+  LWT_ELEMID cur = edge;
+  uint64_t n = 0, max = 8;
+  /* a ring can visit each edge at most once per side */
+  uint64_t bound = 2 * hash_get_num_entries(bulk->edges.hash);
+
+  edges = (LWT_ELEMID *)palloc(sizeof(LWT_ELEMID) * max);
+  for ( ;; )
+  {
+    LWT_ELEMID absid = ABS(cur);
+    TopoBulkEdge *e = (TopoBulkEdge *)hash_search(bulk->edges.hash, &absid, HASH_FIND, NULL);
+    if ( ! e )
+    {
+      pfree(edges);
+      if ( ! n )
+        cberror(topo->be_data, "No edge with id %" LWTFMT_ELEMID " in Topology \"%s\"",
+                ABS(edge), topo->name);
+      else
+        cberror(topo->be_data, "Corrupted topology: ring of edge %" LWTFMT_ELEMID
+                " references missing edge %" LWTFMT_ELEMID, edge, absid);
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
+    if ( limit && n == (uint64_t)limit )
+    {
+      pfree(edges);
+      cberror(topo->be_data, "Max traversing limit hit: %d", limit);
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
+    if ( n > bound )
+    {
+      pfree(edges);
+      cberror(topo->be_data, "Corrupted topology: ring of edge %"
+              LWTFMT_ELEMID " is topologically non-closed", edge);
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
+    if ( n == max )
+    {
+      max *= 2;
+      edges = (LWT_ELEMID *)repalloc(edges, sizeof(LWT_ELEMID) * max);
+    }
+    edges[n++] = cur;
+    cur = cur < 0 ? e->edge.next_right : e->edge.next_left;
+    if ( cur == edge ) break;
+  }
+
+  *numelems = n;
+  return edges;
+}
+
+static int
+cb_bulk_updateEdgesById(const LWT_BE_TOPOLOGY *topo, const LWT_ISO_EDGE *edges, uint64_t numedges, int fields)
+{
+  TopoBulk *bulk = topo->bulk;
+  uint64_t i;
+  int n = 0;
+
+  for ( i = 0; i < numedges; ++i )
+  {
+    TopoBulkEdge *e = (TopoBulkEdge *)hash_search(bulk->edges.hash, &edges[i].edge_id, HASH_FIND, NULL);
+    if ( ! e ) continue;
+    topo_bulk_update_edge(bulk, e, &edges[i], fields);
+    ++n;
+  }
+  return n;
+}
+
+static LWT_ISO_EDGE *
+cb_bulk_getEdgeByFace(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *numelems, int fields, const GBOX *box)
+{
+  TopoBulk *bulk = topo->bulk;
+  TopoBulkItemList cand, list;
+  TopoBulkBox qbox;
+  uint64_t i;
+  int j;
+
+  memset(&cand, 0, sizeof(cand));
+  for ( i = 0; i < *numelems && cand.items == NULL; ++i )
+  {
+    /* the universe face is not indexed, use the box or scan everything */
+    if ( ! TOPO_BULK_FACE_INDEXED(ids[i]) )
+      topo_bulk_query(bulk, &bulk->edges, box, &cand);
+  }
+  if ( ! cand.items )
+  {
+    bulk->stamp++;
+    for ( i = 0; i < *numelems; ++i )
+      topo_bulk_refs_query(bulk, &bulk->edges, bulk->edges_by_face, ids[i], &cand);
+  }
+
+  if ( box ) topo_bulk_box_from_gbox(&qbox, box);
+  memset(&list, 0, sizeof(list));
+  for ( j = 0; j < cand.nitems; ++j )
+  {
+    TopoBulkEdge *e = (TopoBulkEdge *)cand.items[j];
+    if ( box && ! ( e->item.has_box && topo_bulk_box_overlaps(&e->item.box, &qbox) ) )
+      continue;
+    for ( i = 0; i < *numelems; ++i )
+    {
+      if ( e->edge.face_left == ids[i] || e->edge.face_right == ids[i] )
+      {
+        topo_bulk_list_add(&list, cand.items[j]);
+        break;
+      }
+    }
+  }
+  if ( cand.items ) pfree(cand.items);
+
+  return topo_bulk_edges_out(&list, numelems, fields, 0);
+}
+
+static LWT_ISO_NODE *
+cb_bulk_getNodeByFace(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *numelems, int fields, const GBOX *box)
+{
+  TopoBulk *bulk = topo->bulk;
+  TopoBulkItemList cand, list;
+  TopoBulkBox qbox;
+  uint64_t i;
+  int j;
+
+  memset(&cand, 0, sizeof(cand));
+  for ( i = 0; i < *numelems && cand.items == NULL; ++i )
+  {
+    if ( ! TOPO_BULK_FACE_INDEXED(ids[i]) )
+      topo_bulk_query(bulk, &bulk->nodes, box, &cand);
+  }
+  if ( ! cand.items )
+  {
+    bulk->stamp++;
+    for ( i = 0; i < *numelems; ++i )
+      topo_bulk_refs_query(bulk, &bulk->nodes, bulk->nodes_by_face, ids[i], &cand);
+  }
+
+  if ( box ) topo_bulk_box_from_gbox(&qbox, box);
+  memset(&list, 0, sizeof(list));
+  for ( j = 0; j < cand.nitems; ++j )
+  {
+    TopoBulkNode *n = (TopoBulkNode *)cand.items[j];
+    if ( box && ! ( n->item.has_box && topo_bulk_box_overlaps(&n->item.box, &qbox) ) )
+      continue;
+    for ( i = 0; i < *numelems; ++i )
+    {
+      if ( n->node.containing_face == ids[i] )
+      {
+        topo_bulk_list_add(&list, cand.items[j]);
+        break;
+      }
+    }
+  }
+  if ( cand.items ) pfree(cand.items);
+
+  return topo_bulk_nodes_out(&list, numelems, fields, 0);
+}
+
+static int
+cb_bulk_updateNodesById(const LWT_BE_TOPOLOGY *topo, const LWT_ISO_NODE *nodes, uint64_t numnodes, int fields)
+{
+  TopoBulk *bulk = topo->bulk;
+  uint64_t i;
+  int n = 0;
+
+  for ( i = 0; i < numnodes; ++i )
+  {
+    TopoBulkNode *node = (TopoBulkNode *)hash_search(bulk->nodes.hash, &nodes[i].node_id, HASH_FIND, NULL);
+    if ( ! node ) continue;
+    topo_bulk_update_node(bulk, node, &nodes[i], fields);
+    ++n;
+  }
+  return n;
+}
+
+static int
+cb_bulk_deleteFacesById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t numelems)
+{
+  TopoBulk *bulk = topo->bulk;
+  uint64_t i;
+  int n = 0;
+
+  for ( i = 0; i < numelems; ++i )
+  {
+    TopoBulkFace *f = (TopoBulkFace *)hash_search(bulk->faces.hash, &ids[i], HASH_FIND, NULL);
+    if ( ! f ) continue;
+    topo_bulk_mark_deleted(bulk, &bulk->faces, &f->item);
+    hash_search(bulk->faces.hash, &ids[i], HASH_REMOVE, NULL);
+    ++n;
+  }
+  return n;
+}
+
+static int
+cb_bulk_deleteNodesById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t numelems)
+{
+  TopoBulk *bulk = topo->bulk;
+  uint64_t i;
+  int n = 0;
+
+  for ( i = 0; i < numelems; ++i )
+  {
+    TopoBulkNode *node = (TopoBulkNode *)hash_search(bulk->nodes.hash, &ids[i], HASH_FIND, NULL);
+    if ( ! node ) continue;
+    topo_bulk_remove_node(bulk, node);
+    ++n;
+  }
+  return n;
+}
+
+static LWT_ISO_FACE *
+cb_bulk_getFaceWithinBox2D(const LWT_BE_TOPOLOGY *topo, const GBOX *box, uint64_t *numelems, int fields, int limit)
+{
+  TopoBulkItemList list;
+  int i, n = 0;
+
+  topo_bulk_query(topo->bulk, &topo->bulk->faces, box, &list);
+  /* faces without an mbr (the universe) never match && */
+  for ( i = 0; i < list.nitems; ++i )
+    if ( list.items[i]->has_box ) list.items[n++] = list.items[i];
+  list.nitems = n;
+  return topo_bulk_faces_out(&list, numelems, fields, limit);
+}
+
+/* Search the packed tree for the edge closest to a point */
+static void
+topo_bulk_closest_search(TopoBulk *bulk, const POINT2D *p, const LWGEOM *ptg,
+                         int level, LWT_ELEMID first, int count,
+                         TopoBulkEdge **best, double *bestdist)
+{
+  TopoBulkTable *tab = &bulk->edges;
+  int i;
+
+  for ( i = 0; i < count; ++i )
+  {
+    const TopoBulkIndexEntry *e = level >= 0 ? &tab->levels[level][first + i] : &tab->pending[first + i];
+    if ( *best && topo_bulk_box_distance(&e->box, p) > *bestdist ) continue;
+    if ( level > 0 )
+    {
+      topo_bulk_closest_search(bulk, p, ptg, level - 1, e->ref, e->count, best, bestdist);
+    }
+    else
+    {
+      LWT_ELEMID id = e->ref;
+      TopoBulkEdge *edge = (TopoBulkEdge *)hash_search(tab->hash, &id, HASH_FIND, NULL);
+      double d;
+      if ( ! edge || ! edge->edge.geom ) continue;
+      d = lwgeom_mindistance2d(ptg, lwline_as_lwgeom(edge->edge.geom));
+      if ( ! *best || d < *bestdist || ( d == *bestdist && id < (*best)->item.id ) )
+      {
+        *best = edge;
+        *bestdist = d;
+      }
+    }
+  }
+}
+
+static LWT_ISO_EDGE *
+cb_bulk_getClosestEdge( const LWT_BE_TOPOLOGY* topo, const LWPOINT* pt, uint64_t *numedges, int fields )
+{
+  TopoBulk *bulk = topo->bulk;
+  TopoBulkEdge *best = NULL;
+  double bestdist = 0;
+  LWT_ISO_EDGE *edges;
+  POINT2D p;
+
+  getPoint2d_p(pt->point, 0, &p);
+  if ( bulk->edges.nlevels )
+  {
+    int top = bulk->edges.nlevels - 1;
+    topo_bulk_closest_search(bulk, &p, lwpoint_as_lwgeom(pt), top, 0,
+                             bulk->edges.nentries[top], &best, &bestdist);
+  }
+  /* level -1 stands for the pending entries */
+  topo_bulk_closest_search(bulk, &p, lwpoint_as_lwgeom(pt), -1, 0,
+                           bulk->edges.npending, &best, &bestdist);
+
+  if ( ! best )
+  {
+    *numedges = 0;
+    return NULL;
+  }
+  *numedges = 1;
+  edges = (LWT_ISO_EDGE *)palloc(sizeof(LWT_ISO_EDGE));
+  topo_bulk_copy_edge(edges, best, fields);
+  return edges;
+}
+
+/*
+ * TopoGeometry objects live in the database, so their callbacks
+ * go through SPI, and are skipped when no layer is defined
+ */
+
+static int
+cb_bulk_updateTopoGeomEdgeSplit ( const LWT_BE_TOPOLOGY* topo,
+                                  LWT_ELEMID split_edge, LWT_ELEMID new_edge1, LWT_ELEMID new_edge2 )
+{
+  if ( ! topo->bulk->has_layers ) return 1;
+  return cb_updateTopoGeomEdgeSplit(topo, split_edge, new_edge1, new_edge2);
+}
+
+static int
+cb_bulk_updateTopoGeomFaceSplit ( const LWT_BE_TOPOLOGY* topo,
+                                  LWT_ELEMID split_face, LWT_ELEMID new_face1, LWT_ELEMID new_face2 )
+{
+  if ( ! topo->bulk->has_layers ) return 1;
+  return cb_updateTopoGeomFaceSplit(topo, split_face, new_face1, new_face2);
+}
+
+static int
+cb_bulk_checkTopoGeomRemEdge ( const LWT_BE_TOPOLOGY* topo,
+                               LWT_ELEMID rem_edge, LWT_ELEMID face_left, LWT_ELEMID face_right )
+{
+  if ( ! topo->bulk->has_layers ) return 1;
+  return cb_checkTopoGeomRemEdge(topo, rem_edge, face_left, face_right);
+}
+
+static int
+cb_bulk_updateTopoGeomFaceHeal ( const LWT_BE_TOPOLOGY* topo,
+                                 LWT_ELEMID face1, LWT_ELEMID face2, LWT_ELEMID newface )
+{
+  if ( ! topo->bulk->has_layers ) return 1;
+  return cb_updateTopoGeomFaceHeal(topo, face1, face2, newface);
+}
+
+static int
+cb_bulk_checkTopoGeomRemNode ( const LWT_BE_TOPOLOGY* topo,
+                               LWT_ELEMID rem_node, LWT_ELEMID e1, LWT_ELEMID e2 )
+{
+  if ( ! topo->bulk->has_layers ) return 1;
+  return cb_checkTopoGeomRemNode(topo, rem_node, e1, e2);
+}
+
+static int
+cb_bulk_updateTopoGeomEdgeHeal ( const LWT_BE_TOPOLOGY* topo,
+                                 LWT_ELEMID edge1, LWT_ELEMID edge2, LWT_ELEMID newedge )
+{
+  if ( ! topo->bulk->has_layers ) return 1;
+  return cb_updateTopoGeomEdgeHeal(topo, edge1, edge2, newedge);
+}
+
+static int
+cb_bulk_checkTopoGeomRemIsoNode ( const LWT_BE_TOPOLOGY* topo, LWT_ELEMID rem_node )
+{
+  if ( ! topo->bulk->has_layers ) return 1;
+  return cb_checkTopoGeomRemIsoNode(topo, rem_node);
+}
+
+static int
+cb_bulk_checkTopoGeomRemIsoEdge ( const LWT_BE_TOPOLOGY* topo, LWT_ELEMID rem_edge )
+{
+  if ( ! topo->bulk->has_layers ) return 1;
+  return cb_checkTopoGeomRemIsoEdge(topo, rem_edge);
+}
+
+static LWT_BE_CALLBACKS bulk_be_callbacks =
+{
+  cb_lastErrorMessage,
+  NULL, /* createTopology */
+  cb_bulk_loadTopologyByName,
+  cb_bulk_freeTopology,
+  cb_bulk_getNodeById,
+  cb_bulk_getNodeWithinDistance2D,
+  cb_bulk_insertNodes,
+  cb_bulk_getEdgeById,
+  cb_bulk_getEdgeWithinDistance2D,
+  cb_bulk_getNextEdgeId,
+  cb_bulk_insertEdges,
+  cb_bulk_updateEdges,
+  cb_bulk_getFacesById,
+  cb_bulk_updateTopoGeomEdgeSplit,
+  cb_bulk_deleteEdges,
+  cb_bulk_getNodeWithinBox2D,
+  cb_bulk_getEdgeWithinBox2D,
+  cb_bulk_getEdgeByNode,
+  cb_bulk_updateNodes,
+  cb_bulk_updateTopoGeomFaceSplit,
+  cb_bulk_insertFaces,
+  cb_bulk_updateFacesById,
+  cb_bulk_getRingEdges,
+  cb_bulk_updateEdgesById,
+  cb_bulk_getEdgeByFace,
+  cb_bulk_getNodeByFace,
+  cb_bulk_updateNodesById,
+  cb_bulk_deleteFacesById,
+  cb_topoGetSRID,
+  cb_topoGetPrecision,
+  cb_topoHasZ,
+  cb_bulk_deleteNodesById,
+  cb_bulk_checkTopoGeomRemEdge,
+  cb_bulk_updateTopoGeomFaceHeal,
+  cb_bulk_checkTopoGeomRemNode,
+  cb_bulk_updateTopoGeomEdgeHeal,
+  cb_bulk_getFaceWithinBox2D,
+  cb_bulk_checkTopoGeomRemIsoNode,
+  cb_bulk_checkTopoGeomRemIsoEdge,
+  cb_bulk_getClosestEdge
+};
+
+/* Loading and flushing */
+
+/* Run a query returning a single value, returns false on error */
+static bool
+topo_bulk_query_int8(LWT_BE_TOPOLOGY *topo, const char *sql, int64 *val)
+{
+  MemoryContext oldcontext = CurrentMemoryContext;
+  int spi_result;
+  bool isnull;
+  Datum dat;
+
+  spi_result = SPI_execute(sql, false, 1);
+  MemoryContextSwitchTo( oldcontext ); /* switch back */
+  if ( spi_result != SPI_OK_SELECT || SPI_processed != 1 )
+  {
+    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, sql);
+    return false;
+  }
+  dat = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
+  if ( isnull ) *val = 0;
+  else if ( SPI_gettypeid(SPI_tuptable->tupdesc, 1) == BOOLOID ) *val = DatumGetBool(dat);
+  else *val = DatumGetInt64(dat);
+  SPI_freetuptable(SPI_tuptable);
+  return true;
+}
+
+/* Take the next sequence value as the base for new identifiers */
+static bool
+topo_bulk_load_sequence(LWT_BE_TOPOLOGY *topo, TopoBulkTable *tab, const char *seq)
+{
+  StringInfoData sqldata;
+  int64 val;
+  bool ok;
+
+  initStringInfo(&sqldata);
+  appendStringInfo(&sqldata, "SELECT nextval('\"%s\".%s')", topo->name, seq);
+  ok = topo_bulk_query_int8(topo, sqldata.data, &val);
+  pfree(sqldata.data);
+  if ( ! ok ) return false;
+  tab->seqbase = val;
+  tab->lastid = val - 1;
+  return true;
+}
+
+static bool
+topo_bulk_load_rows(TopoBulk *bulk, LWT_BE_TOPOLOGY *topo, const char *what)
+{
+  MemoryContext oldcontext = CurrentMemoryContext;
+  StringInfoData sqldata;
+  StringInfo sql = &sqldata;
+  SPIPlanPtr plan;
+  Portal portal;
+  uint64 i;
+
+  initStringInfo(sql);
+  appendStringInfoString(sql, "SELECT ");
+  if ( what[0] == 'n' )
+  {
+    addNodeFields(sql, LWT_COL_NODE_ALL);
+    appendStringInfo(sql, " FROM \"%s\".node", topo->name);
+  }
+  else if ( what[0] == 'e' )
+  {
+    addEdgeFields(sql, LWT_COL_EDGE_ALL, 0);
+    appendStringInfo(sql, " FROM \"%s\".edge_data", topo->name);
+  }
+  else
+  {
+    addFaceFields(sql, LWT_COL_FACE_ALL);
+    appendStringInfo(sql, " FROM \"%s\".face", topo->name);
+  }
+
+  plan = SPI_prepare(sql->data, 0, NULL);
+  if ( ! plan )
+  {
+    cberror(topo->be_data, "unexpected return (%d) from query preparation: %s",
+            SPI_result, sql->data);
+    pfree(sqldata.data);
+    return false;
+  }
+  portal = SPI_cursor_open(NULL, plan, NULL, NULL, true);
+  MemoryContextSwitchTo( oldcontext ); /* switch back */
+
+  for ( ;; )
+  {
+    SPI_cursor_fetch(portal, true, TOPO_BULK_FETCH_SIZE);
+    MemoryContextSwitchTo( oldcontext ); /* switch back */
+    if ( ! SPI_processed ) break;
+    for ( i = 0; i < SPI_processed; ++i )
+    {
+      HeapTuple row = SPI_tuptable->vals[i];
+      TupleDesc desc = SPI_tuptable->tupdesc;
+      if ( what[0] == 'n' )
+      {
+        LWT_ISO_NODE node;
+        fillNodeFields(&node, row, desc, LWT_COL_NODE_ALL);
+        topo_bulk_put_node(bulk, &node, TOPO_BULK_CLEAN);
+        if ( node.geom ) lwpoint_free(node.geom);
+      }
+      else if ( what[0] == 'e' )
+      {
+        LWT_ISO_EDGE edge;
+        fillEdgeFields(&edge, row, desc, LWT_COL_EDGE_ALL);
+        topo_bulk_put_edge(bulk, &edge, TOPO_BULK_CLEAN);
+        if ( edge.geom ) lwline_free(edge.geom);
+      }
+      else
+      {
+        LWT_ISO_FACE face;
+        fillFaceFields(&face, row, desc, LWT_COL_FACE_ALL);
+        topo_bulk_put_face(bulk, &face, TOPO_BULK_CLEAN);
+        if ( face.mbr ) lwfree(face.mbr);
+      }
+    }
+    SPI_freetuptable(SPI_tuptable);
+  }
+
+  SPI_cursor_close(portal);
+  SPI_freeplan(plan);
+  pfree(sqldata.data);
+  return true;
+}
+
+/*
+ * Load all primitives of the topology, locking its tables against
+ * concurrent edits which would be overwritten on flush
+ */
+static bool
+topo_bulk_load(TopoBulk *bulk, LWT_BE_TOPOLOGY *topo)
+{
+  MemoryContext oldcontext = CurrentMemoryContext;
+  StringInfoData sqldata;
+  int spi_result;
+  int64 val;
+
+  initStringInfo(&sqldata);
+  appendStringInfo(&sqldata, "LOCK TABLE \"%s\".face, \"%s\".node, \"%s\".edge_data "
+                   "IN EXCLUSIVE MODE", topo->name, topo->name, topo->name);
+  spi_result = SPI_execute(sqldata.data, false, 0);
+  MemoryContextSwitchTo( oldcontext ); /* switch back */
+  if ( spi_result != SPI_OK_UTILITY )
+  {
+    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, sqldata.data);
+    pfree(sqldata.data);
+    return false;
+  }
+
+  resetStringInfo(&sqldata);
+  appendStringInfo(&sqldata, "SELECT EXISTS ( SELECT 1 FROM public.layer "
+                   "WHERE topology_id = %d )", topo->id);
+  if ( ! topo_bulk_query_int8(topo, sqldata.data, &val) )
+  {
+    pfree(sqldata.data);
+    return false;
+  }
+  bulk->has_layers = val != 0;
+  pfree(sqldata.data);
+
+  if ( ! topo_bulk_load_sequence(topo, &bulk->nodes, "node_node_id_seq") ||
+       ! topo_bulk_load_sequence(topo, &bulk->edges, "edge_data_edge_id_seq") ||
+       ! topo_bulk_load_sequence(topo, &bulk->faces, "face_face_id_seq") )
+    return false;
+
+  bulk->loading = true;
+  if ( ! topo_bulk_load_rows(bulk, topo, "faces") ||
+       ! topo_bulk_load_rows(bulk, topo, "nodes") ||
+       ! topo_bulk_load_rows(bulk, topo, "edges") )
+  {
+    bulk->loading = false;
+    return false;
+  }
+  bulk->loading = false;
+
+  topo_bulk_index_build(bulk, &bulk->nodes);
+  topo_bulk_index_build(bulk, &bulk->edges);
+  topo_bulk_index_build(bulk, &bulk->faces);
+
+  POSTGIS_DEBUGF(1, "topo_bulk_load: loaded %ld nodes, %ld edges, %ld faces",
+                 hash_get_num_entries(bulk->nodes.hash),
+                 hash_get_num_entries(bulk->edges.hash),
+                 hash_get_num_entries(bulk->faces.hash));
+
+  return true;
+}
+
+static LWT_BE_TOPOLOGY*
+cb_bulk_loadTopologyByName(const LWT_BE_DATA* be, const char *name)
+{
+  TopoBulk *bulk = be->bulkTarget;
+  LWT_BE_TOPOLOGY *topo;
+
+  if ( ! bulk )
+  {
+    cberror(be, "bulk topology backend invoked without a target store");
     return NULL;
   }
-  pfree(sqldata.data);
 
-  POSTGIS_DEBUGF(1,
-		 "cb_getFaceWithinBox2D: face query "
-		 "(limited by %d) returned " UINT64_FORMAT " rows",
-		 elems_requested,
-		 SPI_processed);
-  *numelems = SPI_processed;
-  if ( ! SPI_processed )
+  topo = cb_loadTopologyByName(be, name);
+  if ( ! topo ) return NULL;
+
+  topo->bulk = bulk;
+  bulk->be_topo = topo;
+  if ( ! topo_bulk_load(bulk, topo) )
   {
+    topo->bulk = NULL;
+    bulk->be_topo = NULL;
+    cb_freeTopology(topo);
     return NULL;
   }
 
-  if ( elems_requested == -1 )
-  {
-    /* This was an EXISTS query */
-    {
-      Datum dat;
-      bool isnull, exists;
-      dat = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
-      exists = DatumGetBool(dat);
-      *numelems = exists ? 1 : 0;
-      POSTGIS_DEBUGF(1, "cb_getFaceWithinBox2D: exists ? " UINT64_FORMAT, *numelems);
-    }
+  return topo;
+}
 
-    SPI_freetuptable(SPI_tuptable);
+static int
+topo_bulk_cmp_items(const void *a, const void *b)
+{
+  LWT_ELEMID ia = (*(TopoBulkItem *const *)a)->id;
+  LWT_ELEMID ib = (*(TopoBulkItem *const *)b)->id;
+  return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
 
-    return NULL;
-  }
+/* Items of a table in the given state, ordered by identifier */
+static void
+topo_bulk_collect(TopoBulkTable *tab, TopoBulkRowState state, TopoBulkItemList *list)
+{
+  HASH_SEQ_STATUS status;
+  TopoBulkItem *item;
 
-  faces = palloc( sizeof(LWT_ISO_EDGE) * *numelems );
-  for ( i=0; i<*numelems; ++i )
+  memset(list, 0, sizeof(TopoBulkItemList));
+  hash_seq_init(&status, tab->hash);
+  while ( (item = (TopoBulkItem *)hash_seq_search(&status)) )
   {
-    HeapTuple row = SPI_tuptable->vals[i];
-    fillFaceFields(&faces[i], row, SPI_tuptable->tupdesc, fields);
+    if ( item->state == state ) topo_bulk_list_add(list, item);
   }
+  if ( list->nitems )
+    qsort(list->items, list->nitems, sizeof(TopoBulkItem *), topo_bulk_cmp_items);
+}
 
-  SPI_freetuptable(SPI_tuptable);
+static bool
+topo_bulk_flush_faces(TopoBulk *bulk, TopoBulkRowState state)
+{
+  LWT_BE_TOPOLOGY *topo = bulk->be_topo;
+  TopoBulkItemList list;
+  LWT_ISO_FACE *faces;
+  int i, n = 0;
+
+  topo_bulk_collect(&bulk->faces, state, &list);
+  faces = (LWT_ISO_FACE *)palloc(sizeof(LWT_ISO_FACE) * TOPO_BULK_FLUSH_BATCH);
+  for ( i = 0; i < list.nitems; ++i )
+  {
+    TopoBulkFace *f = (TopoBulkFace *)list.items[i];
+    /* a face losing its mbr can only be the universe */
+    if ( state == TOPO_BULK_DIRTY && ! f->item.has_box ) continue;
+    faces[n].face_id = f->item.id;
+    faces[n].mbr = f->item.has_box ? &f->mbr : NULL;
+    if ( ++n < TOPO_BULK_FLUSH_BATCH && i < list.nitems - 1 ) continue;
+    if ( state == TOPO_BULK_NEW ? cb_insertFaces(topo, faces, n) != n
+                                : cb_updateFacesById(topo, faces, n) == UINT64_MAX )
+      return false;
+    n = 0;
+  }
+  if ( n && ( state == TOPO_BULK_NEW ? cb_insertFaces(topo, faces, n) != n
+                                     : cb_updateFacesById(topo, faces, n) == UINT64_MAX ) )
+    return false;
+  pfree(faces);
+  if ( list.items ) pfree(list.items);
+  return true;
+}
 
-  return faces;
+static bool
+topo_bulk_flush_nodes(TopoBulk *bulk, TopoBulkRowState state)
+{
+  LWT_BE_TOPOLOGY *topo = bulk->be_topo;
+  TopoBulkItemList list;
+  LWT_ISO_NODE *nodes;
+  int i, n = 0;
+
+  topo_bulk_collect(&bulk->nodes, state, &list);
+  nodes = (LWT_ISO_NODE *)palloc(sizeof(LWT_ISO_NODE) * TOPO_BULK_FLUSH_BATCH);
+  for ( i = 0; i < list.nitems; ++i )
+  {
+    nodes[n++] = ((TopoBulkNode *)list.items[i])->node;
+    if ( n < TOPO_BULK_FLUSH_BATCH && i < list.nitems - 1 ) continue;
+    if ( state == TOPO_BULK_NEW ? ! cb_insertNodes(topo, nodes, n)
+                                : cb_updateNodesById(topo, nodes, n,
+                                    LWT_COL_NODE_CONTAINING_FACE | LWT_COL_NODE_GEOM) < 0 )
+      return false;
+    n = 0;
+  }
+  pfree(nodes);
+  if ( list.items ) pfree(list.items);
+  return true;
 }
 
+static bool
+topo_bulk_flush_edges(TopoBulk *bulk, TopoBulkRowState state)
+{
+  LWT_BE_TOPOLOGY *topo = bulk->be_topo;
+  TopoBulkItemList list;
+  LWT_ISO_EDGE *edges;
+  int i, n = 0;
+
+  topo_bulk_collect(&bulk->edges, state, &list);
+  edges = (LWT_ISO_EDGE *)palloc(sizeof(LWT_ISO_EDGE) * TOPO_BULK_FLUSH_BATCH);
+  for ( i = 0; i < list.nitems; ++i )
+  {
+    edges[n++] = ((TopoBulkEdge *)list.items[i])->edge;
+    if ( n < TOPO_BULK_FLUSH_BATCH && i < list.nitems - 1 ) continue;
+    if ( state == TOPO_BULK_NEW ? cb_insertEdges(topo, edges, n) != n
+                                : cb_updateEdgesById(topo, edges, n,
+                                    LWT_COL_EDGE_ALL & ~LWT_COL_EDGE_EDGE_ID) < 0 )
+      return false;
+    n = 0;
+  }
+  pfree(edges);
+  if ( list.items ) pfree(list.items);
+  return true;
+}
 
-static LWT_BE_CALLBACKS be_callbacks =
+/* Delete rows by identifier, in batches */
+static bool
+topo_bulk_flush_deletes(TopoBulk *bulk, TopoBulkTable *tab, const char *table, const char *idcol)
 {
-  cb_lastErrorMessage,
-  NULL, /* createTopology */
-  cb_loadTopologyByName,
-  cb_freeTopology,
-  cb_getNodeById,
-  cb_getNodeWithinDistance2D,
-  cb_insertNodes,
-  cb_getEdgeById,
-  cb_getEdgeWithinDistance2D,
-  cb_getNextEdgeId,
-  cb_insertEdges,
-  cb_updateEdges,
-  cb_getFacesById,
-  cb_updateTopoGeomEdgeSplit,
-  cb_deleteEdges,
-  cb_getNodeWithinBox2D,
-  cb_getEdgeWithinBox2D,
-  cb_getEdgeByNode,
-  cb_updateNodes,
-  cb_updateTopoGeomFaceSplit,
-  cb_insertFaces,
-  cb_updateFacesById,
-  cb_getRingEdges,
-  cb_updateEdgesById,
-  cb_getEdgeByFace,
-  cb_getNodeByFace,
-  cb_updateNodesById,
-  cb_deleteFacesById,
-  cb_topoGetSRID,
-  cb_topoGetPrecision,
-  cb_topoHasZ,
-  cb_deleteNodesById,
-  cb_checkTopoGeomRemEdge,
-  cb_updateTopoGeomFaceHeal,
-  cb_checkTopoGeomRemNode,
-  cb_updateTopoGeomEdgeHeal,
-  cb_getFaceWithinBox2D,
-  cb_checkTopoGeomRemIsoNode,
-  cb_checkTopoGeomRemIsoEdge,
-  cb_getClosestEdge
-};
+  LWT_BE_TOPOLOGY *topo = bulk->be_topo;
+  MemoryContext oldcontext = CurrentMemoryContext;
+  StringInfoData sqldata;
+  StringInfo sql = &sqldata;
+  int spi_result;
+  int i, j;
+
+  initStringInfo(sql);
+  for ( i = 0; i < tab->ndeleted; i += TOPO_BULK_FLUSH_BATCH )
+  {
+    resetStringInfo(sql);
+    appendStringInfo(sql, "DELETE FROM \"%s\".%s WHERE %s IN (", topo->name, table, idcol);
+    for ( j = i; j < Min(i + TOPO_BULK_FLUSH_BATCH, tab->ndeleted); ++j )
+      appendStringInfo(sql, "%s%" LWTFMT_ELEMID, (j > i ? "," : ""), tab->deleted[j]);
+    appendStringInfoChar(sql, ')');
+
+    spi_result = SPI_execute(sql->data, false, 0);
+    MemoryContextSwitchTo( oldcontext ); /* switch back */
+    if ( spi_result != SPI_OK_DELETE )
+    {
+      cberror(topo->be_data, "unexpected return (%d) from query execution: %s",
+              spi_result, sql->data);
+      pfree(sqldata.data);
+      return false;
+    }
+    if ( SPI_processed ) topo->be_data->data_changed = true;
+  }
+  pfree(sqldata.data);
+  return true;
+}
+
+/* Move a sequence past the identifiers assigned in memory */
+static bool
+topo_bulk_flush_sequence(TopoBulk *bulk, TopoBulkTable *tab, const char *seq)
+{
+  StringInfoData sqldata;
+  int64 val;
+  bool ok;
+
+  if ( tab->lastid < tab->seqbase ) return true;
+  initStringInfo(&sqldata);
+  appendStringInfo(&sqldata, "SELECT setval('\"%s\".%s', %" LWTFMT_ELEMID ")",
+                   bulk->be_topo->name, seq, tab->lastid);
+  ok = topo_bulk_query_int8(bulk->be_topo, sqldata.data, &val);
+  pfree(sqldata.data);
+  return ok;
+}
+
+/*
+ * Write back all changes, ordered so that foreign keys
+ * to nodes and faces are satisfied at each step
+ */
+static void
+topo_bulk_flush(TopoBulk *bulk)
+{
+  if ( ! topo_bulk_flush_faces(bulk, TOPO_BULK_NEW) ||
+       ! topo_bulk_flush_faces(bulk, TOPO_BULK_DIRTY) ||
+       ! topo_bulk_flush_nodes(bulk, TOPO_BULK_NEW) ||
+       ! topo_bulk_flush_nodes(bulk, TOPO_BULK_DIRTY) ||
+       ! topo_bulk_flush_deletes(bulk, &bulk->edges, "edge_data", "edge_id") ||
+       ! topo_bulk_flush_edges(bulk, TOPO_BULK_NEW) ||
+       ! topo_bulk_flush_edges(bulk, TOPO_BULK_DIRTY) ||
+       ! topo_bulk_flush_deletes(bulk, &bulk->nodes, "node", "node_id") ||
+       ! topo_bulk_flush_deletes(bulk, &bulk->faces, "face", "face_id") ||
+       ! topo_bulk_flush_sequence(bulk, &bulk->nodes, "node_node_id_seq") ||
+       ! topo_bulk_flush_sequence(bulk, &bulk->edges, "edge_data_edge_id_seq") ||
+       ! topo_bulk_flush_sequence(bulk, &bulk->faces, "face_face_id_seq") )
+  {
+    lwpgerror("Could not write bulk loaded topology: %s", be_data.lastErrorMsg);
+  }
+}
 
 static void
 xact_callback(XactEvent event, void *arg)
@@ -3460,6 +5777,7 @@ _PG_init(void)
   /* initialize backend data */
   be_data.data_changed = false;
   be_data.topoLoadFailMessageFlavor = 0;
+  be_data.bulkTarget = NULL;
 
   /* hook on transaction end to reset data_changed */
   RegisterXactCallback(xact_callback, &be_data);
@@ -3467,6 +5785,8 @@ _PG_init(void)
   /* register callbacks against liblwgeom-topo */
   be_iface = lwt_CreateBackendIface(&be_data);
   lwt_BackendIfaceRegisterCallbacks(be_iface, &be_callbacks);
+  bulk_be_iface = lwt_CreateBackendIface(&be_data);
+  lwt_BackendIfaceRegisterCallbacks(bulk_be_iface, &bulk_be_callbacks);
 
   /* Switch back to whatever memory context was in place
    * at time of _PG_init enter.
@@ -3486,6 +5806,7 @@ _PG_fini(void)
 
   UnregisterXactCallback(xact_callback, &be_data);
   lwt_FreeBackendIface(be_iface);
+  lwt_FreeBackendIface(bulk_be_iface);
 }
 
 /*  ST_ModEdgeSplit(atopology, anedge, apoint) */
@@ -5386,3 +7707,246 @@ Datum GetFaceContainingPoint(PG_FUNCTION_ARGS)
   SPI_finish();
   PG_RETURN_INT32(face_id);
 }
+
+/*
+ * State of the TopoGeo_BulkAddGeometry aggregate: the topology
+ * is loaded in memory on the first row and written back at the end
+ */
+typedef struct
+{
+  TopoBulk *bulk;
+  LWT_TOPOLOGY *topo;
+  char *toponame;
+  int32 added;
+} TopoBulkAddState;
+
+/* Add all points, lines and polygons found in the given geometry */
+static void
+topo_bulk_add_lwgeom(LWT_TOPOLOGY *topo, LWGEOM *lwgeom, double tol)
+{
+  LWT_ELEMID *elems = NULL;
+  LWCOLLECTION *col;
+  int nelems = 0;
+  uint32_t i;
+
+  if ( lwgeom_is_empty(lwgeom) ) return;
+
+  switch ( lwgeom->type )
+  {
+  case POINTTYPE:
+    lwt_AddPoint(topo, lwgeom_as_lwpoint(lwgeom), tol);
+    break;
+  case LINETYPE:
+    elems = lwt_AddLine(topo, lwgeom_as_lwline(lwgeom), tol, &nelems);
+    break;
+  case POLYGONTYPE:
+    elems = lwt_AddPolygon(topo, lwgeom_as_lwpoly(lwgeom), tol, &nelems);
+    break;
+  case MULTIPOINTTYPE:
+  case MULTILINETYPE:
+  case MULTIPOLYGONTYPE:
+  case COLLECTIONTYPE:
+    col = lwgeom_as_lwcollection(lwgeom);
+    for ( i = 0; i < col->ngeoms; ++i )
+      topo_bulk_add_lwgeom(topo, col->geoms[i], tol);
+    break;
+  default:
+    {
+      char buf[32];
+      _lwtype_upper_name(lwgeom_get_type(lwgeom), buf, 32);
+      lwpgerror("Invalid geometry type (%s) passed to "
+                "TopoGeo_BulkAddGeometry", buf);
+    }
+  }
+
+  if ( elems ) lwfree(elems);
+}
+
+/*  TopoGeo_BulkAddGeometry_transfn(state, atopology, geom, tolerance) */
+extern "C" Datum TopoGeo_BulkAddGeometry_transfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(TopoGeo_BulkAddGeometry_transfn);
+Datum TopoGeo_BulkAddGeometry_transfn(PG_FUNCTION_ARGS)
+{
+  MemoryContext aggcontext, oldcontext;
+  TopoBulkAddState *state;
+  char *toponame;
+  GSERIALIZED *geom;
+  LWGEOM *lwgeom;
+  double tol = 0;
+
+  if ( ! AggCheckCallContext(fcinfo, &aggcontext) )
+    elog(ERROR, "%s called in non-aggregate context", __func__);
+
+  if ( PG_ARGISNULL(1) )
+  {
+    lwpgerror("SQL/MM Spatial exception - null argument");
+    PG_RETURN_NULL();
+  }
+  toponame = text_to_cstring(PG_GETARG_TEXT_P(1));
+
+  if ( ! PG_ARGISNULL(3) )
+  {
+    tol = PG_GETARG_FLOAT8(3);
+    if ( tol < 0 )
+    {
+      lwpgerror("Tolerance must be >=0");
+      PG_RETURN_NULL();
+    }
+  }
+
+  if ( PG_ARGISNULL(0) )
+  {
+    state = (TopoBulkAddState *)MemoryContextAllocZero(aggcontext, sizeof(TopoBulkAddState));
+    state->toponame = MemoryContextStrdup(aggcontext, toponame);
+    state->bulk = topo_bulk_create(aggcontext);
+
+    if ( SPI_OK_CONNECT != SPI_connect() )
+    {
+      lwpgerror("Could not connect to SPI");
+      PG_RETURN_NULL();
+    }
+
+    /* The topology and its primitives must outlive this call */
+    oldcontext = MemoryContextSwitchTo(state->bulk->mcxt);
+    {
+      int pre = be_data.topoLoadFailMessageFlavor;
+      be_data.topoLoadFailMessageFlavor = 1;
+      be_data.bulkTarget = state->bulk;
+      state->topo = lwt_LoadTopology(bulk_be_iface, toponame);
+      be_data.bulkTarget = NULL;
+      be_data.topoLoadFailMessageFlavor = pre;
+    }
+    MemoryContextSwitchTo(oldcontext);
+    SPI_finish();
+
+    if ( ! state->topo )
+    {
+      /* should never reach this point, as lwerror would raise an exception */
+      PG_RETURN_NULL();
+    }
+  }
+  else
+  {
+    state = (TopoBulkAddState *)PG_GETARG_POINTER(0);
+    if ( ! state->topo )
+    {
+      lwpgerror("TopoGeo_BulkAddGeometry state was already written back");
+      PG_RETURN_NULL();
+    }
+    if ( strcmp(state->toponame, toponame) )
+    {
+      lwpgerror("TopoGeo_BulkAddGeometry cannot add to more than one topology "
+                "at a time (got \"%s\" and \"%s\")", state->toponame, toponame);
+      PG_RETURN_NULL();
+    }
+  }
+  pfree(toponame);
+
+  if ( PG_ARGISNULL(2) ) PG_RETURN_POINTER(state);
+
+  geom = PG_GETARG_GSERIALIZED_P(2);
+  lwgeom = lwgeom_from_gserialized(geom);
+
+  /* TopoGeometry objects are only kept up to date through SPI */
+  if ( state->bulk->has_layers && SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling topo_bulk_add_lwgeom");
+  topo_bulk_add_lwgeom(state->topo, lwgeom, tol);
+  POSTGIS_DEBUG(1, "topo_bulk_add_lwgeom returned");
+  state->added++;
+
+  if ( state->bulk->has_layers ) SPI_finish();
+
+  lwgeom_free(lwgeom);
+  PG_FREE_IF_COPY(geom, 2);
+
+  PG_RETURN_POINTER(state);
+}
+
+/*  TopoGeo_BulkAddGeometry_finalfn(state) */
+extern "C" Datum TopoGeo_BulkAddGeometry_finalfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(TopoGeo_BulkAddGeometry_finalfn);
+Datum TopoGeo_BulkAddGeometry_finalfn(PG_FUNCTION_ARGS)
+{
+  TopoBulkAddState *state;
+
+  if ( ! AggCheckCallContext(fcinfo, NULL) )
+    elog(ERROR, "%s called in non-aggregate context", __func__);
+
+  if ( PG_ARGISNULL(0) ) PG_RETURN_INT32(0);
+  state = (TopoBulkAddState *)PG_GETARG_POINTER(0);
+
+  /* The final function may be called again, e.g. in window context */
+  if ( ! state->topo ) PG_RETURN_INT32(state->added);
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling topo_bulk_flush");
+  topo_bulk_flush(state->bulk);
+  POSTGIS_DEBUG(1, "topo_bulk_flush returned");
+  lwt_FreeTopology(state->topo);
+  state->topo = NULL;
+
+  SPI_finish();
+
+  MemoryContextDelete(state->bulk->mcxt);
+  state->bulk = NULL;
+
+  PG_RETURN_INT32(state->added);
+}
+
+/*  TopologyBackendStats() */
+extern "C" Datum TopologyBackendStats(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(TopologyBackendStats);
+Datum TopologyBackendStats(PG_FUNCTION_ARGS)
+{
+  FuncCallContext *funcctx;
+  MemoryContext oldcontext;
+  TopoQueryCounters *counters;
+  HeapTuple tuple;
+  Datum ret[4];
+  bool isnull[4] = {0,0,0,0}; /* needed to say no value is null */
+  int q;
+
+  if (SRF_IS_FIRSTCALL())
+  {
+    funcctx = SRF_FIRSTCALL_INIT();
+    oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+    /* Snapshot, so that the output is consistent */
+    counters = (TopoQueryCounters *)palloc(sizeof(topoQueryCounters));
+    memcpy(counters, topoQueryCounters, sizeof(topoQueryCounters));
+    funcctx->user_fctx = counters;
+    funcctx->max_calls = TOPO_Q_COUNT;
+
+    get_call_result_type(fcinfo, 0, &funcctx->tuple_desc);
+    BlessTupleDesc(funcctx->tuple_desc);
+
+    MemoryContextSwitchTo(oldcontext);
+  }
+
+  funcctx = SRF_PERCALL_SETUP();
+  counters = (TopoQueryCounters *)funcctx->user_fctx;
+
+  if ( funcctx->call_cntr == funcctx->max_calls )
+  {
+    SRF_RETURN_DONE(funcctx);
+  }
+
+  q = funcctx->call_cntr;
+  ret[0] = CStringGetTextDatum(topoQueryNames[q]);
+  ret[1] = Int64GetDatum(counters[q].calls);
+  ret[2] = Int64GetDatum(counters[q].rows);
+  ret[3] = Int64GetDatum(counters[q].prepared);
+  tuple = heap_form_tuple(funcctx->tuple_desc, ret, isnull);
+
+  SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+}
@@ -13,4 +13,8 @@ SELECT 'R'||edge_id, (public.GetRingEdges('city_data', edge_id)).*
 SELECT 'R-'||edge_id, (public.GetRingEdges('city_data', -edge_id)).*
 	FROM city_data.edge;
 
+-- All ring walks go through a single prepared plan
+SELECT 'stats', calls >= 52, prepared
+  FROM public.TopologyBackendStats() WHERE query = 'getRingEdges';
+
 SELECT public.DropTopology('city_data');
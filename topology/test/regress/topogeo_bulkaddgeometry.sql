@@ -0,0 +1,85 @@
+\set VERBOSITY terse
+set client_min_messages to ERROR;
+
+SELECT 'create', public.CreateTopology('bulk') > 0;
+SELECT 'create', public.CreateTopology('incr') > 0;
+
+CREATE TABLE bulk_input(id serial primary key, g geometry);
+-- A 5x5 grid of crossing lines
+INSERT INTO bulk_input(g)
+  SELECT ST_MakeLine(ST_MakePoint(0, y), ST_MakePoint(40, y))
+  FROM generate_series(0, 40, 10) y;
+INSERT INTO bulk_input(g)
+  SELECT ST_MakeLine(ST_MakePoint(x, 0), ST_MakePoint(x, 40))
+  FROM generate_series(0, 40, 10) x;
+-- Shapes overlapping the grid and each other
+INSERT INTO bulk_input(g) VALUES
+  ('POLYGON((5 5,35 5,35 35,5 35,5 5))'),
+  ('POINT(15 15)'),
+  ('POINT(50 50)'),
+  ('MULTILINESTRING((-5 20,45 20),(20 -5,20 45))'),
+  ('GEOMETRYCOLLECTION(POINT(25 25),LINESTRING(0 0,40 40))'),
+  ('LINESTRING EMPTY');
+
+-- Errors
+SELECT public.TopoGeo_BulkAddGeometry('bulk', g, -1) FROM bulk_input;
+SELECT public.TopoGeo_BulkAddGeometry('invalid', g, 0) FROM bulk_input;
+SELECT public.TopoGeo_BulkAddGeometry(CASE WHEN id = 1 THEN 'bulk' ELSE 'incr' END, g, 0)
+  FROM ( SELECT * FROM bulk_input ORDER BY id ) foo;
+SELECT public.TopoGeo_BulkAddGeometry('bulk', 'TRIANGLE((0 0,1 0,0 1,0 0))', 0);
+
+-- Nothing to add
+SELECT 'none', public.TopoGeo_BulkAddGeometry('bulk', g, 0) FROM bulk_input WHERE false;
+SELECT 'none', count(*) FROM bulk.edge_data;
+
+-- Same geometries, in the same order, added in bulk or one at a time
+SELECT 'bulk', public.TopoGeo_BulkAddGeometry('bulk', g, 0 ORDER BY id) FROM bulk_input;
+
+CREATE FUNCTION bulk_add(atopology varchar, ageom geometry)
+RETURNS void AS $$
+DECLARE
+  sub geometry;
+BEGIN
+  FOR sub IN SELECT (ST_Dump(ageom)).geom LOOP
+    IF ST_IsEmpty(sub) THEN
+      CONTINUE;
+    ELSIF GeometryType(sub) = 'POINT' THEN
+      PERFORM public.TopoGeo_AddPoint(atopology, sub, 0);
+    ELSIF GeometryType(sub) = 'LINESTRING' THEN
+      PERFORM public.TopoGeo_AddLinestring(atopology, sub, 0);
+    ELSE
+      PERFORM public.TopoGeo_AddPolygon(atopology, sub, 0);
+    END IF;
+  END LOOP;
+END
+$$ LANGUAGE 'plpgsql';
+SELECT bulk_add('incr', g) FROM ( SELECT * FROM bulk_input ORDER BY id ) foo;
+
+SELECT 'nodes', (SELECT count(*) FROM bulk.node) = (SELECT count(*) FROM incr.node);
+SELECT 'edges', (SELECT count(*) FROM bulk.edge_data) = (SELECT count(*) FROM incr.edge_data);
+SELECT 'faces', (SELECT count(*) FROM bulk.face) = (SELECT count(*) FROM incr.face);
+SELECT 'edge_geoms', count(*) FROM (
+  ( SELECT ST_AsText(ST_Normalize(geom)) FROM bulk.edge_data
+    EXCEPT SELECT ST_AsText(ST_Normalize(geom)) FROM incr.edge_data )
+  UNION ALL
+  ( SELECT ST_AsText(ST_Normalize(geom)) FROM incr.edge_data
+    EXCEPT SELECT ST_AsText(ST_Normalize(geom)) FROM bulk.edge_data )
+) foo;
+SELECT 'valid', count(*) FROM public.ValidateTopology('bulk');
+
+-- Identifiers assigned in memory are not reused afterwards
+SELECT 'seq', public.TopoGeo_AddPoint('bulk', 'POINT(60 60)', 0)
+  = ( SELECT max(node_id) FROM bulk.node );
+SELECT 'seq', public.TopoGeo_AddLinestring('bulk', 'LINESTRING(60 60,70 70)', 0)
+  = ( SELECT max(edge_id) FROM bulk.edge_data );
+
+-- Adding to a non-empty topology
+SELECT 'again', public.TopoGeo_BulkAddGeometry('bulk', g, 0)
+  FROM ( VALUES ('LINESTRING(-10 -10,50 50)'::geometry),
+                ('LINESTRING(60 60,80 60)') ) foo(g);
+SELECT 'again', count(*) FROM public.ValidateTopology('bulk');
+
+DROP FUNCTION bulk_add(varchar, geometry);
+DROP TABLE bulk_input;
+SELECT 'drop', public.DropTopology('bulk');
+SELECT 'drop', public.DropTopology('incr');